@@ -0,0 +1,523 @@
+/* pkbench.c - Driver for the poke benchmarks.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This program runs the benchmarks defined in the Poke files given
+   in the command line, and reports the time and the amount of memory
+   allocated by every operation.
+
+   The benchmarks are registered by the Poke files by calling the
+   function `bench_register', defined in bench.pk, which must be the
+   first file to be loaded.  Files that fail to compile, for example
+   because they need a pickle that is not installed, are skipped.
+
+   In addition to the benchmarks defined in Poke, this program
+   measures the time it takes to bootstrap a new incremental
+   compiler, and the throughput of pk_call and pk_call_prepared.
+
+   Every benchmark is run once to warm up, and then REPEAT times.  The
+   fastest run is the one reported, since it is the one less disturbed
+   by the rest of the system.  */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <time.h>
+#include <getopt.h>
+
+#include "libpoke.h"
+
+/* Default number of times every benchmark is run.  */
+
+#define PKBENCH_DEFAULT_REPEAT 5
+
+/* Number of compilers to bootstrap in the bootstrap benchmark.  */
+
+#define PKBENCH_BOOTSTRAP_OPS 3
+
+/* Number of calls in the pk_call benchmark.  */
+
+#define PKBENCH_CALL_OPS 100000
+
+static int pkbench_repeat = PKBENCH_DEFAULT_REPEAT;
+static const char *pkbench_filter = NULL;
+
+/* The output of the Poke programs is discarded while running the
+   benchmarks, since some of them print a lot of data, but it is
+   shown in the standard error while the benchmark files are
+   compiled.  */
+
+static int pkbench_quiet_p = 0;
+
+static void
+pkbench_term_flush (pk_compiler pkc __attribute__ ((unused)))
+{
+}
+
+static void
+pkbench_term_puts (pk_compiler pkc __attribute__ ((unused)), const char *str)
+{
+  if (!pkbench_quiet_p)
+    fputs (str, stderr);
+}
+
+__attribute__ ((__format__ (__printf__, 2, 3))) static void
+pkbench_term_printf (pk_compiler pkc __attribute__ ((unused)),
+                     const char *format, ...)
+{
+  va_list ap;
+
+  if (pkbench_quiet_p)
+    return;
+
+  va_start (ap, format);
+  vfprintf (stderr, format, ap);
+  va_end (ap);
+}
+
+static void
+pkbench_term_indent (pk_compiler pkc __attribute__ ((unused)),
+                     unsigned int lvl, unsigned int step)
+{
+  if (!pkbench_quiet_p)
+    fprintf (stderr, "\n%*s", (step * lvl), "");
+}
+
+static void
+pkbench_term_class (pk_compiler pkc __attribute__ ((unused)),
+                    const char *class __attribute__ ((unused)))
+{
+}
+
+static int
+pkbench_term_end_class (pk_compiler pkc __attribute__ ((unused)),
+                        const char *class __attribute__ ((unused)))
+{
+  return 1;
+}
+
+static void
+pkbench_term_hyperlink (pk_compiler pkc __attribute__ ((unused)),
+                        const char *url __attribute__ ((unused)),
+                        const char *id __attribute__ ((unused)))
+{
+}
+
+static int
+pkbench_term_end_hyperlink (pk_compiler pkc __attribute__ ((unused)))
+{
+  return 1;
+}
+
+static struct pk_color
+pkbench_term_get_color (pk_compiler pkc __attribute__ ((unused)))
+{
+  struct pk_color inv = { -1, -1, -1 };
+  return inv;
+}
+
+static void
+pkbench_term_set_color (pk_compiler pkc __attribute__ ((unused)),
+                        struct pk_color color __attribute__ ((unused)))
+{
+}
+
+static struct pk_term_if pkbench_term_if =
+  {
+    .flush_fn = pkbench_term_flush,
+    .puts_fn = pkbench_term_puts,
+    .printf_fn = pkbench_term_printf,
+    .indent_fn = pkbench_term_indent,
+    .class_fn = pkbench_term_class,
+    .end_class_fn = pkbench_term_end_class,
+    .hyperlink_fn = pkbench_term_hyperlink,
+    .end_hyperlink_fn = pkbench_term_end_hyperlink,
+    .get_color_fn = pkbench_term_get_color,
+    .get_bgcolor_fn = pkbench_term_get_color,
+    .set_color_fn = pkbench_term_set_color,
+    .set_bgcolor_fn = pkbench_term_set_color,
+  };
+
+/* Return the current time in nanoseconds.  */
+
+static uint64_t
+pkbench_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* The result of a run of a benchmark.  */
+
+struct pkbench_run
+{
+  uint64_t ns;
+  uint64_t bytes;
+  uint64_t collections;
+};
+
+/* The compiler used to get the statistics of the garbage collector,
+   which are shared by all the compilers.  */
+
+static pk_compiler pkbench_gc_compiler;
+
+static void
+pkbench_begin (struct pkbench_run *run)
+{
+  struct pk_gc_stats stats;
+
+  pk_gc_stats (pkbench_gc_compiler, &stats);
+  run->collections = stats.collections;
+  run->bytes = stats.total_bytes;
+  run->ns = pkbench_now ();
+}
+
+static void
+pkbench_end (struct pkbench_run *run)
+{
+  struct pk_gc_stats stats;
+
+  run->ns = pkbench_now () - run->ns;
+  pk_gc_stats (pkbench_gc_compiler, &stats);
+  run->bytes = stats.total_bytes - run->bytes;
+  run->collections = stats.collections - run->collections;
+}
+
+static void
+pkbench_report_header (void)
+{
+  printf ("%-44s %10s %14s %12s %6s\n",
+          "benchmark", "ops", "ns/op", "bytes/op", "gcs");
+}
+
+static void
+pkbench_report (const char *name, uint64_t ops,
+                const struct pkbench_run *run)
+{
+  if (ops == 0)
+    ops = 1;
+
+  printf ("%-44s %10" PRIu64 " %14.1f %12.1f %6" PRIu64 "\n",
+          name, ops,
+          (double) run->ns / ops, (double) run->bytes / ops,
+          run->collections);
+  fflush (stdout);
+}
+
+static int
+pkbench_selected_p (const char *name)
+{
+  return pkbench_filter == NULL || strstr (name, pkbench_filter) != NULL;
+}
+
+/* Benchmark the bootstrapping of new incremental compilers.  */
+
+static void
+pkbench_bootstrap (void)
+{
+  struct pkbench_run run, best;
+  int i, r;
+
+  if (!pkbench_selected_p ("bootstrap"))
+    return;
+
+  for (r = 0; r < pkbench_repeat; ++r)
+    {
+      pkbench_begin (&run);
+      for (i = 0; i < PKBENCH_BOOTSTRAP_OPS; ++i)
+        {
+          pk_compiler pkc = pk_compiler_new (&pkbench_term_if);
+
+          if (pkc == NULL)
+            {
+              fputs ("pkbench: error creating compiler\n", stderr);
+              exit (EXIT_FAILURE);
+            }
+          pk_compiler_free (pkc);
+        }
+      pkbench_end (&run);
+
+      if (r == 0 || run.ns < best.ns)
+        best = run;
+    }
+
+  pkbench_report ("compiler bootstrap", PKBENCH_BOOTSTRAP_OPS, &best);
+}
+
+/* Return the trivial Poke function called by the pk_call
+   benchmarks, or PK_NULL if it can't be compiled.  */
+
+static pk_val
+pkbench_identity (pk_compiler pkc)
+{
+  pk_val exit_exception;
+
+  if (pk_decl_p (pkc, "pkbench_identity", PK_DECL_KIND_FUNC))
+    return pk_decl_val (pkc, "pkbench_identity");
+
+  if (pk_compile_buffer (pkc,
+                         "fun pkbench_identity = (int<32> x) int<32>:"
+                         " { return x; }",
+                         NULL, &exit_exception) != PK_OK
+      || exit_exception != PK_NULL)
+    {
+      fputs ("pkbench: error compiling pk_call benchmark\n", stderr);
+      return PK_NULL;
+    }
+
+  return pk_decl_val (pkc, "pkbench_identity");
+}
+
+/* Benchmark calls to a trivial Poke function through pk_call.  */
+
+static void
+pkbench_pk_call (pk_compiler pkc)
+{
+  struct pkbench_run run, best;
+  pk_val cls, ret, exit_exception, arg;
+  int i, r;
+
+  if (!pkbench_selected_p ("pk_call"))
+    return;
+
+  cls = pkbench_identity (pkc);
+  if (cls == PK_NULL)
+    return;
+  arg = pk_make_int (pkc, 666, 32);
+
+  pkbench_quiet_p = 1;
+  for (r = 0; r <= pkbench_repeat; ++r)
+    {
+      pkbench_begin (&run);
+      for (i = 0; i < PKBENCH_CALL_OPS; ++i)
+        pk_call (pkc, cls, &ret, &exit_exception, 1, arg);
+      pkbench_end (&run);
+
+      /* The first run is the warm up.  */
+      if (r == 1 || (r > 1 && run.ns < best.ns))
+        best = run;
+    }
+  pkbench_quiet_p = 0;
+
+  pkbench_report ("pk_call", PKBENCH_CALL_OPS, &best);
+}
+
+/* Likewise, but preparing the call once with pk_prepare_call.  */
+
+static void
+pkbench_pk_call_prepared (pk_compiler pkc)
+{
+  struct pkbench_run run, best;
+  pk_prepared_call call;
+  pk_val cls, ret, exit_exception, arg;
+  int i, r;
+
+  if (!pkbench_selected_p ("pk_call_prepared"))
+    return;
+
+  cls = pkbench_identity (pkc);
+  if (cls == PK_NULL)
+    return;
+  call = pk_prepare_call (pkc, cls, 1);
+  if (call == NULL)
+    {
+      fputs ("pkbench: error preparing call\n", stderr);
+      return;
+    }
+  arg = pk_make_int (pkc, 666, 32);
+
+  pkbench_quiet_p = 1;
+  for (r = 0; r <= pkbench_repeat; ++r)
+    {
+      pkbench_begin (&run);
+      for (i = 0; i < PKBENCH_CALL_OPS; ++i)
+        pk_call_prepared (call, &arg, &ret, &exit_exception);
+      pkbench_end (&run);
+
+      /* The first run is the warm up.  */
+      if (r == 1 || (r > 1 && run.ns < best.ns))
+        best = run;
+    }
+  pkbench_quiet_p = 0;
+
+  pk_prepared_call_free (call);
+  pkbench_report ("pk_call_prepared", PKBENCH_CALL_OPS, &best);
+}
+
+/* Run the benchmarks registered in the Poke array `bench_benchmarks'
+   that have not been run yet.  FIRST is the index of the first of
+   them.  Return the index following the last one.  */
+
+static uint64_t
+pkbench_run_registered (pk_compiler pkc, uint64_t first)
+{
+  pk_val benchmarks = pk_decl_val (pkc, "bench_benchmarks");
+  uint64_t i, nelem;
+
+  if (benchmarks == PK_NULL)
+    return first;
+
+  nelem = pk_uint_value (pk_array_nelem (benchmarks));
+  for (i = first; i < nelem; ++i)
+    {
+      pk_val bench = pk_array_elem_value (benchmarks, i);
+      const char *name
+        = pk_string_str (pk_struct_ref_field_value (bench, "name"));
+      uint64_t ops
+        = pk_uint_value (pk_struct_ref_field_value (bench, "ops"));
+      pk_val func = pk_struct_ref_field_value (bench, "func");
+      struct pkbench_run run, best;
+      pk_val ret, exit_exception = PK_NULL;
+      int r, failed_p = 0;
+
+      if (!pkbench_selected_p (name))
+        continue;
+
+      pkbench_quiet_p = 1;
+      for (r = 0; r <= pkbench_repeat; ++r)
+        {
+          pkbench_begin (&run);
+          if (pk_call (pkc, func, &ret, &exit_exception, 0) != PK_OK
+              || exit_exception != PK_NULL)
+            {
+              failed_p = 1;
+              break;
+            }
+          pkbench_end (&run);
+
+          if (r == 1 || (r > 1 && run.ns < best.ns))
+            best = run;
+        }
+      pkbench_quiet_p = 0;
+
+      if (failed_p)
+        printf ("%-44s failed\n", name);
+      else
+        pkbench_report (name, ops, &best);
+    }
+
+  return nelem;
+}
+
+/* Add the directory with the pickles of the source tree to the load
+   path of PKC, so the benchmarks can run without installing poke.  */
+
+static void
+pkbench_set_load_path (pk_compiler pkc)
+{
+  const char *picklesdir = getenv ("POKEPICKLESDIR");
+  const char *appdir = getenv ("POKEAPPDIR");
+  pk_val load_path = pk_decl_val (pkc, "load_path");
+  const char *old_load_path = pk_string_str (load_path);
+  char *new_load_path;
+  size_t size;
+
+  if (picklesdir == NULL)
+    picklesdir = "";
+  if (appdir == NULL)
+    appdir = "";
+
+  size = strlen (old_load_path) + strlen (picklesdir) + strlen (appdir) + 3;
+  new_load_path = malloc (size);
+  if (new_load_path == NULL)
+    {
+      fputs ("pkbench: out of memory\n", stderr);
+      exit (EXIT_FAILURE);
+    }
+  snprintf (new_load_path, size, "%s:%s:%s",
+            old_load_path, appdir, picklesdir);
+  pk_decl_set_val (pkc, "load_path", pk_make_string (pkc, new_load_path));
+  free (new_load_path);
+}
+
+static void
+pkbench_usage (void)
+{
+  puts ("Usage: pkbench [OPTION]... FILE...\n"
+        "Run the benchmarks defined in the given Poke files.\n"
+        "\n"
+        "  -r NUM      run every benchmark NUM times (default 5)\n"
+        "  -f STRING   only run the benchmarks whose name contains STRING\n"
+        "  -h          print this help and exit");
+}
+
+int
+main (int argc, char *argv[])
+{
+  pk_compiler pkc;
+  uint64_t next = 0;
+  int opt, i;
+
+  while ((opt = getopt (argc, argv, "r:f:h")) != -1)
+    {
+      switch (opt)
+        {
+        case 'r':
+          pkbench_repeat = atoi (optarg);
+          if (pkbench_repeat < 1)
+            pkbench_repeat = 1;
+          break;
+        case 'f':
+          pkbench_filter = optarg;
+          break;
+        case 'h':
+          pkbench_usage ();
+          return EXIT_SUCCESS;
+        default:
+          pkbench_usage ();
+          return EXIT_FAILURE;
+        }
+    }
+
+  pkc = pk_compiler_new (&pkbench_term_if);
+  if (pkc == NULL)
+    {
+      fputs ("pkbench: error creating compiler\n", stderr);
+      return EXIT_FAILURE;
+    }
+  pkbench_gc_compiler = pkc;
+  pkbench_set_load_path (pkc);
+
+  pkbench_report_header ();
+  pkbench_bootstrap ();
+
+  pkbench_pk_call (pkc);
+  pkbench_pk_call_prepared (pkc);
+
+  for (i = optind; i < argc; ++i)
+    {
+      pk_val exit_exception;
+
+      if (pk_compile_file (pkc, argv[i], &exit_exception) != PK_OK
+          || exit_exception != PK_NULL)
+        {
+          fprintf (stderr, "pkbench: skipping %s\n", argv[i]);
+          continue;
+        }
+
+      next = pkbench_run_registered (pkc, next);
+    }
+
+  pk_compiler_free (pkc);
+  return EXIT_SUCCESS;
+}
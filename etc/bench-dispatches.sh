@@ -0,0 +1,80 @@
+#!/bin/sh
+# Compare the performance of the Jitter dispatches of the PVM.
+
+# Copyright (C) 2026 Jose E. Marchesi
+
+# This program is free software: you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation, either version 3 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License
+# along with this program.  If not, see <http://www.gnu.org/licenses/>.
+
+# Usage: bench-dispatches.sh SRCDIR [CONFIGURE-ARG]...
+#
+# When Jitter is built as a sub-package of poke it only compiles the
+# most efficient dispatch among the enabled ones, so selecting a
+# dispatch requires disabling the faster ones at configure time.  This
+# script configures and builds poke once per dispatch, in
+# subdirectories bench-DISPATCH of the current directory, and reports
+# the dispatch actually selected by Jitter along with the time it
+# takes to run a part of the testsuite.
+#
+# The testsuite to run is given by the BENCH_RUNTESTFLAGS environment
+# variable, which defaults to the mapping testsuite.  Set BENCH_JOBS
+# to the number of parallel jobs to use for building.
+
+set -e
+
+if test $# -lt 1; then
+  echo "usage: $0 SRCDIR [CONFIGURE-ARG]..." >&2
+  exit 1
+fi
+
+srcdir=`cd "$1" && pwd`
+shift
+
+runtestflags=${BENCH_RUNTESTFLAGS-map.exp}
+jobs=${BENCH_JOBS-1}
+
+# The dispatches, from the most efficient to the least efficient.
+dispatches="no-threading minimal-threading direct-threading switch"
+
+results=
+disabled=
+for dispatch in $dispatches; do
+  builddir=bench-$dispatch
+
+  echo "$0: building with $dispatch dispatch in $builddir" >&2
+  rm -rf "$builddir"
+  mkdir "$builddir"
+  (cd "$builddir" \
+     && "$srcdir"/configure --enable-dispatch-$dispatch $disabled "$@" \
+          > configure.log 2>&1 \
+     && make -j"$jobs" > make.log 2>&1)
+
+  selected=`"$builddir"/run poke -q --quiet -c '.vm dispatch' \
+            </dev/null 2>/dev/null \
+            || echo unknown`
+
+  start=`date +%s`
+  if (cd "$builddir"/testsuite \
+        && make check RUNTESTFLAGS="$runtestflags" > check.log 2>&1); then
+    status=ok
+  else
+    status=FAIL
+  fi
+  end=`date +%s`
+
+  results="$results$dispatch: selected '$selected', $runtestflags: `expr $end - $start`s ($status)
+"
+  disabled="$disabled --disable-dispatch-$dispatch"
+done
+
+printf '%s' "$results"
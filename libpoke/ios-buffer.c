@@ -24,36 +24,43 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-#define IOB_CHUNK_SIZE          2048
-#define IOB_BUCKET_COUNT        8
+/* Default size of the chunks of a buffer.  */
 
-#define IOB_CHUNK_OFFSET(offset)        \
-  ((offset) % IOB_CHUNK_SIZE)
+#define IOB_CHUNK_SIZE          2048
 
-#define IOB_CHUNK_NO(offset)            \
-  ((offset) / IOB_CHUNK_SIZE)
+#define IOB_CHUNK_OFFSET(buffer, offset)        \
+  ((offset) % (buffer)->chunk_size)
 
-#define IOB_BUCKET_NO(chunk_no)         \
-  ((chunk_no) % IOB_BUCKET_COUNT)
+#define IOB_CHUNK_NO(buffer, offset)            \
+  ((offset) / (buffer)->chunk_size)
 
 struct ios_buffer_chunk
 {
-  uint8_t bytes[IOB_CHUNK_SIZE];
-  int chunk_no;
-  struct ios_buffer_chunk *next;
+  uint64_t chunk_no;
+  uint8_t bytes[];
 };
 
-/* begin_offset is the first offset that's not yet flushed,
+/* Chunks are allocated in order, and they are only discarded from
+   the beginning of the buffer.  The chunks not yet discarded are
+   therefore kept in CHUNKS, where CHUNKS[I] is the chunk number
+   FIRST_CHUNK_NO + I, so finding a chunk never requires a search.
+   NCHUNKS is the number of chunks in the table and NALLOC its
+   capacity.
+
+   begin_offset is the first offset that's not yet flushed,
    initialized as 0.  end_offset of an instream is the next byte to
    read to.  end_offset of an outstream is the successor of the
    greatest offset that is written to.  */
 
 struct ios_buffer
 {
-  struct ios_buffer_chunk* chunks[IOB_BUCKET_COUNT];
+  struct ios_buffer_chunk **chunks;
+  size_t nchunks;
+  size_t nalloc;
+  uint64_t first_chunk_no;
+  size_t chunk_size;
   ios_dev_off begin_offset;
   ios_dev_off end_offset;
-  int next_chunk_no;
 };
 
 ios_dev_off
@@ -67,70 +74,72 @@ ios_buffer_get_end_offset (struct ios_buffer *buffer) {
 }
 
 struct ios_buffer *
-ios_buffer_init ()
+ios_buffer_init (size_t chunk_size)
 {
   struct ios_buffer *bio = calloc (1, sizeof (struct ios_buffer));
+
+  if (bio)
+    bio->chunk_size = chunk_size ? chunk_size : IOB_CHUNK_SIZE;
   return bio;
 }
 
 void
 ios_buffer_free (struct ios_buffer *buffer)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-
   if (buffer == NULL)
     return;
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
-    {
-      chunk = buffer->chunks[i];
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          free (chunk);
-          chunk = chunk_next;
-        }
-    }
+  for (size_t i = 0; i < buffer->nchunks; i++)
+    free (buffer->chunks[i]);
 
+  free (buffer->chunks);
   free (buffer);
   return;
 }
 
 struct ios_buffer_chunk*
-ios_buffer_get_chunk (struct ios_buffer *buffer, int chunk_no)
+ios_buffer_get_chunk (struct ios_buffer *buffer, uint64_t chunk_no)
 {
-  int bucket_no = IOB_BUCKET_NO (chunk_no);
-  struct ios_buffer_chunk *chunk = buffer->chunks[bucket_no];
-
-  for ( ; chunk; chunk = chunk->next)
-    if (chunk->chunk_no == chunk_no)
-      return chunk;
+  if (chunk_no < buffer->first_chunk_no
+      || chunk_no - buffer->first_chunk_no >= buffer->nchunks)
+    return NULL;
 
-  return NULL;
+  return buffer->chunks[chunk_no - buffer->first_chunk_no];
 }
 
 int
-ios_buffer_allocate_new_chunk (struct ios_buffer *buffer, int final_chunk_no,
+ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
+                               uint64_t final_chunk_no,
                                struct ios_buffer_chunk **final_chunk)
 {
   struct ios_buffer_chunk *chunk;
-  int bucket_no;
+  uint64_t next_chunk_no = buffer->first_chunk_no + buffer->nchunks;
 
-  assert (buffer->next_chunk_no <= final_chunk_no);
+  assert (next_chunk_no <= final_chunk_no);
 
   do
     {
-      chunk = calloc (1, sizeof (struct ios_buffer_chunk));
+      if (buffer->nchunks == buffer->nalloc)
+        {
+          size_t nalloc = buffer->nalloc ? buffer->nalloc * 2 : 16;
+          struct ios_buffer_chunk **chunks
+            = realloc (buffer->chunks, nalloc * sizeof (*chunks));
+
+          if (!chunks)
+            return IOD_ERROR;
+          buffer->chunks = chunks;
+          buffer->nalloc = nalloc;
+        }
+
+      chunk = calloc (1, sizeof (struct ios_buffer_chunk)
+                         + buffer->chunk_size);
       if (!chunk)
         return IOD_ERROR;
       /* Place the new chunk into the buffer.  */
-      chunk->chunk_no = buffer->next_chunk_no;
-      bucket_no = IOB_BUCKET_NO (chunk->chunk_no);
-      chunk->next = buffer->chunks[bucket_no];
-      buffer->chunks[bucket_no] = chunk;
-      buffer->next_chunk_no++;
+      chunk->chunk_no = next_chunk_no++;
+      buffer->chunks[buffer->nchunks++] = chunk;
     }
-  while (buffer->next_chunk_no <= final_chunk_no);
+  while (next_chunk_no <= final_chunk_no);
 
   /* end_offset is updated as the buffer is written to. Therefore, it is not
      updated here, but in ios_buffer_pwrite.  */
@@ -146,36 +155,36 @@ int
 ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
                   ios_dev_off offset)
 {
-  int chunk_no;
+  uint64_t chunk_no;
   struct ios_buffer_chunk *chunk;
   ios_dev_off chunk_offset;
   size_t already_read_count = 0,
          to_be_read_count = 0;
 
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
+  chunk_no = IOB_CHUNK_NO (buffer, offset);
+  chunk_offset = IOB_CHUNK_OFFSET (buffer, offset);
   chunk = ios_buffer_get_chunk (buffer, chunk_no);
   if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
     return IOD_ERROR;
 
   /* The amount we read from this chunk is the maximum of
      the COUNT requested and the size of the rest of this chunk. */
-  to_be_read_count = IOB_CHUNK_SIZE - chunk_offset > count
+  to_be_read_count = buffer->chunk_size - chunk_offset > count
                      ? count
-                     : IOB_CHUNK_SIZE - chunk_offset;
+                     : buffer->chunk_size - chunk_offset;
 
-  memcpy (buf, (void *) chunk + chunk_offset, to_be_read_count);
+  memcpy (buf, chunk->bytes + chunk_offset, to_be_read_count);
 
   while ((already_read_count += to_be_read_count) < count)
     {
-      to_be_read_count = count - already_read_count > IOB_CHUNK_SIZE
-                         ? IOB_CHUNK_SIZE
+      to_be_read_count = count - already_read_count > buffer->chunk_size
+                         ? buffer->chunk_size
                          : count - already_read_count;
 
       chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
       if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
         return IOD_ERROR;
-      memcpy (buf + already_read_count, chunk, to_be_read_count);
+      memcpy (buf + already_read_count, chunk->bytes, to_be_read_count);
     };
 
   return IOD_OK;
@@ -189,36 +198,36 @@ int
 ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
                    ios_dev_off offset)
 {
-  int chunk_no;
+  uint64_t chunk_no;
   struct ios_buffer_chunk *chunk;
   ios_dev_off chunk_offset;
   size_t already_written_count = 0,
          to_be_written_count = 0;
 
-  chunk_no = IOB_CHUNK_NO (offset);
-  chunk_offset = IOB_CHUNK_OFFSET (offset);
+  chunk_no = IOB_CHUNK_NO (buffer, offset);
+  chunk_offset = IOB_CHUNK_OFFSET (buffer, offset);
   chunk = ios_buffer_get_chunk (buffer, chunk_no);
   if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
     return IOD_ERROR;
 
   /* The amount we write to this chunk is the maximum of the COUNT requested
      and the size of the rest of this chunk. */
-  to_be_written_count = IOB_CHUNK_SIZE - chunk_offset > count
+  to_be_written_count = buffer->chunk_size - chunk_offset > count
                         ? count
-                        : IOB_CHUNK_SIZE - chunk_offset;
+                        : buffer->chunk_size - chunk_offset;
 
-  memcpy ((void *) chunk + chunk_offset, buf, to_be_written_count);
+  memcpy (chunk->bytes + chunk_offset, buf, to_be_written_count);
 
   while ((already_written_count += to_be_written_count) < count)
     {
-      to_be_written_count = count - already_written_count > IOB_CHUNK_SIZE
-                            ? IOB_CHUNK_SIZE
+      to_be_written_count = count - already_written_count > buffer->chunk_size
+                            ? buffer->chunk_size
                             : count - already_written_count;
 
       chunk = ios_buffer_get_chunk (buffer, ++chunk_no);
       if (!chunk && ios_buffer_allocate_new_chunk (buffer, chunk_no, &chunk))
         return IOD_ERROR;
-      memcpy (chunk, buf + already_written_count, to_be_written_count);
+      memcpy (chunk->bytes, buf + already_written_count, to_be_written_count);
     };
 
   /* Lastly, keep track of the greatest offset we wrote to in the buffer.
@@ -232,28 +241,30 @@ ios_buffer_pwrite (struct ios_buffer *buffer, const void *buf, size_t count,
 int
 ios_buffer_forget_till (struct ios_buffer *buffer, ios_dev_off offset)
 {
-  struct ios_buffer_chunk *chunk, *chunk_next;
-  int chunk_no = IOB_CHUNK_NO (offset);
+  uint64_t chunk_no = IOB_CHUNK_NO (buffer, offset);
+  size_t nforget = 0;
 
-  for (int i = 0; i < IOB_BUCKET_COUNT; i++)
+  /* The chunks preceding CHUNK_NO are at the beginning of the
+     table.  */
+  if (chunk_no > buffer->first_chunk_no)
     {
-      chunk = buffer->chunks[i];
-      buffer->chunks[i] = NULL;
-      while (chunk)
-        {
-          chunk_next = chunk->next;
-          if (chunk->chunk_no >= chunk_no)
-            {
-              chunk->next = buffer->chunks[i];
-              buffer->chunks[i] = chunk;
-            }
-          else
-            free (chunk);
-          chunk = chunk_next;
-        }
+      nforget = chunk_no - buffer->first_chunk_no;
+      if (nforget > buffer->nchunks)
+        nforget = buffer->nchunks;
     }
 
-  buffer->begin_offset = chunk_no * IOB_CHUNK_SIZE;
+  for (size_t i = 0; i < nforget; i++)
+    free (buffer->chunks[i]);
+  memmove (buffer->chunks, buffer->chunks + nforget,
+           (buffer->nchunks - nforget) * sizeof (*buffer->chunks));
+  buffer->nchunks -= nforget;
+  if (chunk_no > buffer->first_chunk_no)
+    buffer->first_chunk_no = chunk_no;
+
+  /* Only whole chunks are freed, but the data preceding OFFSET is
+     forgotten all the same.  */
+  if (offset > buffer->begin_offset)
+    buffer->begin_offset = offset;
   assert (buffer->end_offset >= buffer->begin_offset);
   assert (buffer->begin_offset <= offset);
   return IOD_OK;
@@ -18,7 +18,10 @@
 
 struct ios_buffer;
 
-struct ios_buffer *ios_buffer_init ();
+/* Return a new buffer keeping the data in chunks of CHUNK_SIZE
+   bytes, or of a default size if CHUNK_SIZE is zero.  */
+
+struct ios_buffer *ios_buffer_init (size_t chunk_size);
 
 void ios_buffer_free (struct ios_buffer *buffer);
 
@@ -27,10 +30,10 @@ ios_dev_off ios_buffer_get_begin_offset (struct ios_buffer *buffer);
 ios_dev_off ios_buffer_get_end_offset (struct ios_buffer *buffer);
 
 struct ios_buffer_chunk *ios_buffer_get_chunk (struct ios_buffer *buffer,
-                                               int chunk_no);
+                                               uint64_t chunk_no);
 
 int ios_buffer_allocate_new_chunk (struct ios_buffer *buffer,
-                                   int final_chunk_no,
+                                   uint64_t final_chunk_no,
                                    struct ios_buffer_chunk **final_chunk);
 
 int ios_buffer_pread (struct ios_buffer *buffer, void *buf, size_t count,
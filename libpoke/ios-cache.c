@@ -0,0 +1,932 @@
+/* ios-cache.c - Block cache for IO spaces.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+#include "ios-cache.h"
+
+/* A cache block holds a copy of the BLOCK_SIZE bytes of the device
+   starting at byte offset BLOCK_NO * BLOCK_SIZE.
+
+   VALID is the number of bytes at the beginning of DATA that hold
+   device contents.  It is smaller than the block size only for the
+   block containing the end of the device.
+
+   DIRTY_P is set if DATA has been modified since it was read from
+   the device, and not yet written back.
+
+   HNEXT links the blocks living in the same hash bucket.
+
+   STAMP is the value of the clock of the pool the last time the
+   block was accessed.  It is used to find the least recently used
+   block among all the caches of the pool.
+
+   PREV and NEXT link the cached blocks in LRU order, from the most
+   recently used to the least recently used.  Blocks in the free list
+   are linked using NEXT, and have no DATA.  */
+
+struct ios_cache_block
+{
+  ios_dev_off block_no;
+  size_t valid;
+  int dirty_p;
+  uint64_t stamp;
+  uint8_t *data;
+  struct ios_cache_block *hnext;
+  struct ios_cache_block *prev;
+  struct ios_cache_block *next;
+};
+
+/* A cache pool is shared by the caches of all the IO spaces of an IO
+   context.  The contents of the blocks of the caches are allocated
+   from the pool, and the total size of the cached blocks shall not
+   exceed BUDGET bytes.  USED is the number of bytes currently held by
+   the cached blocks.
+
+   CLOCK is incremented every time a block is accessed.
+
+   CACHES is the list of caches using the pool, linked by their
+   POOL_NEXT field.  */
+
+struct ios_cache_pool
+{
+  size_t budget;
+  size_t used;
+  uint64_t clock;
+  struct ios_cache *caches;
+};
+
+/* DEV_SIZE is the size of the device as of the last time it was
+   queried.  Only requests that fall in [0,DEV_SIZE) are served from
+   the cache.
+
+   NCACHED is the number of blocks currently in the cache.  HITS and
+   MISSES count the accesses to blocks that were found in the cache
+   and the blocks that had to be brought into the cache,
+   respectively.
+
+   NOTIFY, if not NULL, is called with NOTIFY_DATA after every
+   operation performed on the device.  See ios_cache_set_notify.
+
+   LAST_HIT is the most recently accessed block, which is checked
+   before looking in the hash table.  */
+
+struct ios_cache
+{
+  struct ios_cache_pool *pool;
+  struct ios_cache *pool_next;
+  const struct ios_dev_if *dev_if;
+  void *dev;
+  int write_through_p;
+  size_t block_size;
+  int block_shift;
+  size_t nblocks;
+  size_t nbuckets;
+  size_t ncached;
+  uint64_t hits;
+  uint64_t misses;
+  ios_cache_notify_fn notify;
+  void *notify_data;
+  ios_dev_off dev_size;
+  struct ios_cache_block *blocks;
+  struct ios_cache_block **buckets;
+  struct ios_cache_block *free_list;
+  struct ios_cache_block *lru_first;
+  struct ios_cache_block *lru_last;
+  struct ios_cache_block *last_hit;
+};
+
+#define IOS_CACHE_BLOCK_NO(CACHE,OFFSET)        \
+  ((OFFSET) >> (CACHE)->block_shift)
+
+#define IOS_CACHE_BLOCK_OFFSET(CACHE,OFFSET)    \
+  ((OFFSET) & ((CACHE)->block_size - 1))
+
+#define IOS_CACHE_BUCKET(CACHE,BLOCK_NO)        \
+  ((BLOCK_NO) & ((CACHE)->nbuckets - 1))
+
+struct ios_cache_pool *
+ios_cache_pool_new (size_t budget)
+{
+  struct ios_cache_pool *pool = calloc (1, sizeof (struct ios_cache_pool));
+
+  if (!pool)
+    return NULL;
+
+  pool->budget = budget;
+  return pool;
+}
+
+void
+ios_cache_pool_free (struct ios_cache_pool *pool)
+{
+  if (!pool)
+    return;
+
+  assert (pool->caches == NULL);
+  free (pool);
+}
+
+size_t
+ios_cache_pool_budget (struct ios_cache_pool *pool)
+{
+  return pool->budget;
+}
+
+size_t
+ios_cache_pool_used (struct ios_cache_pool *pool)
+{
+  return pool->used;
+}
+
+static void
+ios_cache_reset (struct ios_cache *cache)
+{
+  memset (cache->buckets, 0,
+          cache->nbuckets * sizeof (struct ios_cache_block *));
+
+  cache->free_list = NULL;
+  for (size_t i = 0; i < cache->nblocks; ++i)
+    {
+      struct ios_cache_block *blk = &cache->blocks[i];
+
+      if (blk->data)
+        {
+          free (blk->data);
+          cache->pool->used -= cache->block_size;
+        }
+      blk->data = NULL;
+      blk->dirty_p = 0;
+      blk->valid = 0;
+      blk->hnext = NULL;
+      blk->prev = NULL;
+      blk->next = cache->free_list;
+      cache->free_list = blk;
+    }
+
+  cache->lru_first = NULL;
+  cache->lru_last = NULL;
+  cache->last_hit = NULL;
+  cache->ncached = 0;
+}
+
+struct ios_cache *
+ios_cache_new (struct ios_cache_pool *pool,
+               const struct ios_dev_if *dev_if, void *dev,
+               size_t block_size, size_t nblocks,
+               int write_through_p)
+{
+  struct ios_cache *cache;
+
+  assert (block_size != 0 && (block_size & (block_size - 1)) == 0);
+  assert (nblocks != 0);
+
+  if (nblocks > SIZE_MAX / block_size)
+    return NULL;
+
+  cache = calloc (1, sizeof (struct ios_cache));
+  if (!cache)
+    return NULL;
+
+  cache->pool = pool;
+  cache->dev_if = dev_if;
+  cache->dev = dev;
+  cache->write_through_p = write_through_p;
+  cache->block_size = block_size;
+  for (cache->block_shift = 0;
+       ((size_t) 1 << cache->block_shift) != block_size;
+       ++cache->block_shift)
+    ;
+  cache->nblocks = nblocks;
+  for (cache->nbuckets = 1; cache->nbuckets < nblocks;)
+    cache->nbuckets <<= 1;
+
+  /* The contents of the blocks are allocated when they are brought
+     into the cache.  */
+  cache->blocks = calloc (nblocks, sizeof (struct ios_cache_block));
+  cache->buckets = calloc (cache->nbuckets,
+                           sizeof (struct ios_cache_block *));
+  if (!cache->blocks || !cache->buckets)
+    {
+      free (cache->buckets);
+      free (cache->blocks);
+      free (cache);
+      return NULL;
+    }
+
+  ios_cache_reset (cache);
+  cache->dev_size = dev_if->size (dev);
+
+  cache->pool_next = pool->caches;
+  pool->caches = cache;
+  return cache;
+}
+
+void
+ios_cache_free (struct ios_cache *cache)
+{
+  struct ios_cache **p;
+
+  if (!cache)
+    return;
+
+  for (p = &cache->pool->caches; *p != cache; p = &(*p)->pool_next)
+    ;
+  *p = cache->pool_next;
+
+  ios_cache_reset (cache);
+  free (cache->buckets);
+  free (cache->blocks);
+  free (cache);
+}
+
+void
+ios_cache_get_stats (struct ios_cache *cache,
+                     struct ios_cache_stats *stats)
+{
+  stats->hits = cache->hits;
+  stats->misses = cache->misses;
+  stats->bytes = cache->ncached * cache->block_size;
+}
+
+void
+ios_cache_reset_stats (struct ios_cache *cache)
+{
+  cache->hits = 0;
+  cache->misses = 0;
+}
+
+void
+ios_cache_set_notify (struct ios_cache *cache,
+                      ios_cache_notify_fn notify, void *data)
+{
+  cache->notify = notify;
+  cache->notify_data = data;
+}
+
+/* Read or write COUNT bytes at byte offset OFFSET of the cached
+   device, and tell the user of the cache about it.  */
+
+static int
+ios_cache_dev_pread (struct ios_cache *cache, void *buf, size_t count,
+                     ios_dev_off offset)
+{
+  int ret = cache->dev_if->pread (cache->dev, buf, count, offset);
+
+  if (cache->notify)
+    cache->notify (cache->notify_data, IOS_TRACE_PREAD, offset, count, ret);
+  return ret;
+}
+
+static int
+ios_cache_dev_pwrite (struct ios_cache *cache, const void *buf,
+                      size_t count, ios_dev_off offset)
+{
+  int ret = cache->dev_if->pwrite (cache->dev, buf, count, offset);
+
+  if (cache->notify)
+    cache->notify (cache->notify_data, IOS_TRACE_PWRITE, offset, count, ret);
+  return ret;
+}
+
+static void
+ios_cache_lru_unlink (struct ios_cache *cache,
+                      struct ios_cache_block *blk)
+{
+  if (blk->prev)
+    blk->prev->next = blk->next;
+  else
+    cache->lru_first = blk->next;
+
+  if (blk->next)
+    blk->next->prev = blk->prev;
+  else
+    cache->lru_last = blk->prev;
+
+  blk->prev = blk->next = NULL;
+}
+
+static void
+ios_cache_lru_push (struct ios_cache *cache,
+                    struct ios_cache_block *blk)
+{
+  blk->prev = NULL;
+  blk->next = cache->lru_first;
+  if (cache->lru_first)
+    cache->lru_first->prev = blk;
+  else
+    cache->lru_last = blk;
+  cache->lru_first = blk;
+}
+
+/* Look for the given block in the cache.  If found, it becomes the
+   most recently used block.  Return NULL if the block is not
+   cached.  */
+
+static struct ios_cache_block *
+ios_cache_lookup (struct ios_cache *cache, ios_dev_off block_no)
+{
+  struct ios_cache_block *blk = cache->last_hit;
+
+  if (blk && blk->block_no == block_no)
+    {
+      blk->stamp = ++cache->pool->clock;
+      return blk;
+    }
+
+  for (blk = cache->buckets[IOS_CACHE_BUCKET (cache, block_no)];
+       blk;
+       blk = blk->hnext)
+    if (blk->block_no == block_no)
+      break;
+
+  if (blk)
+    {
+      if (blk != cache->lru_first)
+        {
+          ios_cache_lru_unlink (cache, blk);
+          ios_cache_lru_push (cache, blk);
+        }
+      blk->stamp = ++cache->pool->clock;
+      cache->last_hit = blk;
+    }
+
+  return blk;
+}
+
+/* Write the contents of the given block to the device, if it is
+   dirty.  */
+
+static int
+ios_cache_write_block (struct ios_cache *cache,
+                       struct ios_cache_block *blk)
+{
+  int ret;
+
+  if (!blk->dirty_p)
+    return IOD_OK;
+
+  ret = ios_cache_dev_pwrite (cache, blk->data, blk->valid,
+                              blk->block_no << cache->block_shift);
+  if (ret != IOD_OK)
+    return ret;
+
+  blk->dirty_p = 0;
+  return IOD_OK;
+}
+
+/* Remove the given block from the cache, give its contents back to
+   the pool and put it in the free list.  Any modification not written
+   back is lost.  */
+
+static void
+ios_cache_drop_block (struct ios_cache *cache,
+                      struct ios_cache_block *blk)
+{
+  struct ios_cache_block **p;
+
+  for (p = &cache->buckets[IOS_CACHE_BUCKET (cache, blk->block_no)];
+       *p != blk;
+       p = &(*p)->hnext)
+    ;
+  *p = blk->hnext;
+  blk->hnext = NULL;
+
+  ios_cache_lru_unlink (cache, blk);
+  if (cache->last_hit == blk)
+    cache->last_hit = NULL;
+
+  free (blk->data);
+  blk->data = NULL;
+  cache->pool->used -= cache->block_size;
+  cache->ncached--;
+
+  blk->dirty_p = 0;
+  blk->valid = 0;
+  blk->next = cache->free_list;
+  cache->free_list = blk;
+}
+
+/* Evict the least recently used blocks of all the caches of POOL
+   until there is room for SIZE more bytes in the budget, or no more
+   blocks can be evicted.  Dirty blocks are written back before being
+   evicted.  If some block cannot be written back then the budget is
+   exceeded, rather than losing data or failing.  */
+
+static void
+ios_cache_pool_reserve (struct ios_cache_pool *pool, size_t size)
+{
+  while (pool->used > 0 && pool->used + size > pool->budget)
+    {
+      struct ios_cache *victim_cache = NULL;
+
+      for (struct ios_cache *c = pool->caches; c; c = c->pool_next)
+        if (c->lru_last
+            && (!victim_cache
+                || c->lru_last->stamp < victim_cache->lru_last->stamp))
+          victim_cache = c;
+
+      if (!victim_cache
+          || ios_cache_write_block (victim_cache,
+                                    victim_cache->lru_last) != IOD_OK)
+        break;
+      ios_cache_drop_block (victim_cache, victim_cache->lru_last);
+    }
+}
+
+int
+ios_cache_pool_set_budget (struct ios_cache_pool *pool, size_t budget)
+{
+  pool->budget = budget;
+  ios_cache_pool_reserve (pool, 0);
+
+  /* Blocks that could not be written back are still in the pool.  */
+  return pool->used > budget ? IOD_ERROR : IOD_OK;
+}
+
+/* Get the block BLOCK_NO, making sure that at least its first NEEDED
+   bytes are valid.  If the block is not in the cache then it is
+   allocated, evicting the least recently used block if needed, and
+   its contents are read from the device unless FILL_P is zero.  The
+   block is returned in *BLKP.
+
+   The caller must make sure the data requested lies in
+   [0,DEV_SIZE).  */
+
+static int
+ios_cache_get_block (struct ios_cache *cache, ios_dev_off block_no,
+                     size_t needed, int fill_p,
+                     struct ios_cache_block **blkp)
+{
+  struct ios_cache_block *blk;
+  ios_dev_off start = block_no << cache->block_shift;
+  int ret;
+
+  blk = ios_cache_lookup (cache, block_no);
+  if (blk)
+    {
+      if (blk->valid >= needed)
+        {
+          cache->hits++;
+          *blkp = blk;
+          return IOD_OK;
+        }
+
+      /* This block was cached when the device was smaller.  Get rid
+         of it and read it again.  */
+      ret = ios_cache_write_block (cache, blk);
+      if (ret != IOD_OK)
+        return ret;
+      ios_cache_drop_block (cache, blk);
+    }
+
+  if (!cache->free_list)
+    {
+      blk = cache->lru_last;
+      ret = ios_cache_write_block (cache, blk);
+      if (ret != IOD_OK)
+        return ret;
+      ios_cache_drop_block (cache, blk);
+    }
+
+  /* Make room for the new block in the budget of the pool.  Note
+     that this may evict blocks of this cache as well.  */
+  ios_cache_pool_reserve (cache->pool, cache->block_size);
+
+  blk = cache->free_list;
+  blk->data = malloc (cache->block_size);
+  if (!blk->data)
+    return IOD_ENOMEM;
+
+  blk->block_no = block_no;
+  blk->valid = cache->block_size;
+  if (cache->dev_size - start < blk->valid)
+    blk->valid = cache->dev_size - start;
+
+  assert (blk->valid >= needed);
+  if (fill_p)
+    {
+      ret = ios_cache_dev_pread (cache, blk->data, blk->valid, start);
+      if (ret != IOD_OK)
+        {
+          free (blk->data);
+          blk->data = NULL;
+          return ret;
+        }
+    }
+
+  cache->free_list = blk->next;
+  blk->hnext = cache->buckets[IOS_CACHE_BUCKET (cache, block_no)];
+  cache->buckets[IOS_CACHE_BUCKET (cache, block_no)] = blk;
+  ios_cache_lru_push (cache, blk);
+  blk->stamp = ++cache->pool->clock;
+  cache->last_hit = blk;
+  cache->pool->used += cache->block_size;
+  cache->ncached++;
+  cache->misses++;
+
+  *blkp = blk;
+  return IOD_OK;
+}
+
+/* Determine whether the COUNT bytes at OFFSET are within the device,
+   and thus can be served by the cache.  */
+
+static int
+ios_cache_in_extent_p (struct ios_cache *cache, ios_dev_off offset,
+                       size_t count)
+{
+  if (count <= cache->dev_size && offset <= cache->dev_size - count)
+    return 1;
+
+  /* The device may have grown since the last time we looked.  */
+  cache->dev_size = cache->dev_if->size (cache->dev);
+  return (count <= cache->dev_size && offset <= cache->dev_size - count);
+}
+
+int
+ios_cache_pread (struct ios_cache *cache, void *buf, size_t count,
+                 ios_dev_off offset)
+{
+  uint8_t *p = buf;
+  int ret;
+
+  if (!ios_cache_in_extent_p (cache, offset, count))
+    goto direct;
+
+  while (count > 0)
+    {
+      struct ios_cache_block *blk;
+      size_t boff = IOS_CACHE_BLOCK_OFFSET (cache, offset);
+      size_t len = cache->block_size - boff;
+
+      if (len > count)
+        len = count;
+
+      ret = ios_cache_get_block (cache, IOS_CACHE_BLOCK_NO (cache, offset),
+                                 boff + len, 1 /* fill_p */, &blk);
+      if (ret != IOD_OK)
+        /* Filling a whole block may fail even if the requested bytes
+           are readable.  Try to get them directly from the
+           device.  */
+        goto direct;
+
+      memcpy (p, blk->data + boff, len);
+      p += len;
+      offset += len;
+      count -= len;
+    }
+
+  return IOD_OK;
+
+ direct:
+  ret = ios_cache_sync_range (cache, offset, count);
+  if (ret != IOD_OK)
+    return ret;
+  return ios_cache_dev_pread (cache, p, count, offset);
+}
+
+const void *
+ios_cache_get_ptr (struct ios_cache *cache, size_t count,
+                   ios_dev_off offset)
+{
+  struct ios_cache_block *blk;
+  size_t boff = IOS_CACHE_BLOCK_OFFSET (cache, offset);
+
+  if (count > cache->block_size - boff
+      || !ios_cache_in_extent_p (cache, offset, count))
+    return NULL;
+
+  if (ios_cache_get_block (cache, IOS_CACHE_BLOCK_NO (cache, offset),
+                           boff + count, 1 /* fill_p */, &blk) != IOD_OK)
+    return NULL;
+
+  return blk->data + boff;
+}
+
+int
+ios_cache_pwrite (struct ios_cache *cache, const void *buf,
+                  size_t count, ios_dev_off offset)
+{
+  const uint8_t *p = buf;
+  int ret;
+
+  if (!ios_cache_in_extent_p (cache, offset, count))
+    goto direct;
+
+  if (cache->write_through_p)
+    {
+      ret = ios_cache_dev_pwrite (cache, buf, count, offset);
+      if (ret != IOD_OK)
+        {
+          ios_cache_sync_range (cache, offset, count);
+          return ret;
+        }
+
+      /* Update the copies of the blocks that happen to be cached, but
+         do not bring new blocks into the cache.  */
+      while (count > 0)
+        {
+          struct ios_cache_block *blk;
+          size_t boff = IOS_CACHE_BLOCK_OFFSET (cache, offset);
+          size_t len = cache->block_size - boff;
+
+          if (len > count)
+            len = count;
+
+          blk = ios_cache_lookup (cache, IOS_CACHE_BLOCK_NO (cache, offset));
+          if (blk && blk->valid >= boff + len)
+            memcpy (blk->data + boff, p, len);
+          else if (blk)
+            ios_cache_drop_block (cache, blk);
+
+          p += len;
+          offset += len;
+          count -= len;
+        }
+
+      return IOD_OK;
+    }
+
+  while (count > 0)
+    {
+      struct ios_cache_block *blk;
+      ios_dev_off start = offset - IOS_CACHE_BLOCK_OFFSET (cache, offset);
+      size_t boff = IOS_CACHE_BLOCK_OFFSET (cache, offset);
+      size_t len = cache->block_size - boff;
+      int fill_p;
+
+      if (len > count)
+        len = count;
+
+      /* There is no need to read the block from the device if we are
+         about to overwrite all of it.  */
+      fill_p = !(boff == 0
+                 && (len == cache->block_size
+                     || len >= cache->dev_size - start));
+
+      ret = ios_cache_get_block (cache, IOS_CACHE_BLOCK_NO (cache, offset),
+                                 boff + len, fill_p, &blk);
+      if (ret != IOD_OK)
+        goto direct;
+
+      memcpy (blk->data + boff, p, len);
+      blk->dirty_p = 1;
+      p += len;
+      offset += len;
+      count -= len;
+    }
+
+  return IOD_OK;
+
+ direct:
+  ret = ios_cache_sync_range (cache, offset, count);
+  if (ret != IOD_OK)
+    return ret;
+  return ios_cache_dev_pwrite (cache, p, count, offset);
+}
+
+/* State of a batch of asynchronous reads.  PENDING is the number of
+   reads that have not completed yet, and STATUS is the status of the
+   first one that failed, or IOD_OK.  */
+
+struct ios_cache_batch
+{
+  size_t pending;
+  int status;
+};
+
+static void
+ios_cache_batch_done (void *tag, int status)
+{
+  struct ios_cache_batch *batch = tag;
+
+  batch->pending--;
+  if (status != IOD_OK && batch->status == IOD_OK)
+    batch->status = status;
+}
+
+/* Perform the IOVCNT reads in IOV, in one batch if the device
+   supports it.  */
+
+static int
+ios_cache_preadv (struct ios_cache *cache,
+                  const struct ios_dev_iovec *iov, size_t iovcnt)
+{
+  if (cache->dev_if->preadv)
+    return cache->dev_if->preadv (cache->dev, iov, iovcnt);
+
+  if (cache->dev_if->pread_async)
+    {
+      struct ios_cache_batch batch = { 0, IOD_OK };
+
+      /* Issue all the reads before waiting for any of them.  */
+      for (size_t i = 0; i < iovcnt; ++i)
+        {
+          int ret;
+
+          /* Note that the read may complete right away.  */
+          batch.pending++;
+          ret = cache->dev_if->pread_async (cache->dev, iov[i].buf,
+                                            iov[i].count, iov[i].offset,
+                                            ios_cache_batch_done, &batch);
+          if (ret != IOD_OK)
+            {
+              batch.pending--;
+              batch.status = ret;
+              break;
+            }
+        }
+
+      /* The reads that were issued write into the buffers of the
+         caller, so wait for all of them.  */
+      while (batch.pending > 0)
+        if (cache->dev_if->poll (cache->dev, 1 /* wait_p */) != IOD_OK)
+          {
+            /* The device lost track of the reads.  */
+            batch.status = IOD_ERROR;
+            break;
+          }
+
+      return batch.status;
+    }
+
+  for (size_t i = 0; i < iovcnt; ++i)
+    {
+      int ret = cache->dev_if->pread (cache->dev, iov[i].buf,
+                                      iov[i].count, iov[i].offset);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_prefetch (struct ios_cache *cache, ios_dev_off offset,
+                    size_t count)
+{
+  struct ios_dev_iovec *iov;
+  struct ios_cache_block **blks;
+  ios_dev_off block_no, last_block_no;
+  size_t n = 0, max_blocks;
+  int ret;
+
+  if (count == 0)
+    return IOD_OK;
+
+  /* Only fetch the part of the range that is within the device.  */
+  if (!ios_cache_in_extent_p (cache, offset, count))
+    {
+      if (offset >= cache->dev_size)
+        return IOD_OK;
+      count = cache->dev_size - offset;
+    }
+
+  /* Fetch no more blocks than fit in the cache and in the budget of
+     the pool.  */
+  max_blocks = cache->pool->budget / cache->block_size;
+  if (max_blocks == 0)
+    max_blocks = 1;
+  if (max_blocks > cache->nblocks)
+    max_blocks = cache->nblocks;
+
+  block_no = IOS_CACHE_BLOCK_NO (cache, offset);
+  last_block_no = IOS_CACHE_BLOCK_NO (cache, offset + count - 1);
+  if (last_block_no - block_no >= max_blocks)
+    last_block_no = block_no + max_blocks - 1;
+
+  iov = malloc ((last_block_no - block_no + 1) * sizeof (*iov));
+  blks = malloc ((last_block_no - block_no + 1) * sizeof (*blks));
+  if (!iov || !blks)
+    {
+      ret = IOD_ENOMEM;
+      goto done;
+    }
+
+  /* Allocate the missing blocks without filling them.  Since the new
+     blocks are the most recently used, in this cache and in the pool,
+     allocating a block never evicts any of the others.  */
+  for (; block_no <= last_block_no; ++block_no)
+    {
+      struct ios_cache_block *blk;
+
+      if (ios_cache_lookup (cache, block_no))
+        continue;
+
+      ret = ios_cache_get_block (cache, block_no, 0, 0 /* fill_p */, &blk);
+      if (ret != IOD_OK)
+        break;
+
+      blks[n] = blk;
+      iov[n].buf = blk->data;
+      iov[n].count = blk->valid;
+      iov[n].offset = block_no << cache->block_shift;
+      n++;
+    }
+
+  if (n > 0)
+    {
+      ret = ios_cache_preadv (cache, iov, n);
+      if (cache->notify)
+        {
+          size_t total = 0;
+
+          for (size_t i = 0; i < n; ++i)
+            total += iov[i].count;
+          cache->notify (cache->notify_data, IOS_TRACE_PREADV,
+                         iov[0].offset, total, ret);
+        }
+    }
+  else
+    ret = IOD_OK;
+  if (ret != IOD_OK)
+    /* The contents of the blocks are garbage.  */
+    for (size_t i = 0; i < n; ++i)
+      ios_cache_drop_block (cache, blks[i]);
+
+ done:
+  free (iov);
+  free (blks);
+  return ret;
+}
+
+int
+ios_cache_sync_range (struct ios_cache *cache, ios_dev_off offset,
+                      size_t count)
+{
+  struct ios_cache_block *blk, *next;
+
+  if (count == 0)
+    return IOD_OK;
+
+  for (blk = cache->lru_first; blk; blk = next)
+    {
+      ios_dev_off start = blk->block_no << cache->block_shift;
+
+      next = blk->next;
+      if (start < offset + count && offset < start + cache->block_size)
+        {
+          int ret = ios_cache_write_block (cache, blk);
+
+          if (ret != IOD_OK)
+            return ret;
+          ios_cache_drop_block (cache, blk);
+        }
+    }
+
+  return IOD_OK;
+}
+
+int
+ios_cache_flush (struct ios_cache *cache)
+{
+  int ret = IOD_OK;
+
+  for (struct ios_cache_block *blk = cache->lru_first; blk; blk = blk->next)
+    {
+      int r = ios_cache_write_block (cache, blk);
+
+      /* Keep trying with the rest of the blocks, but report the first
+         error.  */
+      if (r != IOD_OK && ret == IOD_OK)
+        ret = r;
+    }
+
+  return ret;
+}
+
+int
+ios_cache_invalidate (struct ios_cache *cache)
+{
+  int ret = ios_cache_flush (cache);
+
+  /* Do not lose data that couldn't be written back.  */
+  if (ret != IOD_OK)
+    return ret;
+
+  ios_cache_reset (cache);
+  cache->dev_size = cache->dev_if->size (cache->dev);
+  return IOD_OK;
+}
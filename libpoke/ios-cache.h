@@ -0,0 +1,184 @@
+/* ios-cache.h - Block cache for IO spaces.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef IOS_CACHE_H
+#define IOS_CACHE_H
+
+#include <config.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* An IOS cache sits between the IO space and the device that it
+   operates, and keeps copies of fixed-size, aligned blocks of the
+   device contents.  Blocks are replaced following a LRU policy.
+
+   In write-back mode writes only update the cached blocks, which get
+   written to the device when they are evicted or when the cache is
+   flushed.  In write-through mode writes are always propagated to the
+   device.
+
+   The memory holding the cached blocks is taken from a cache pool,
+   which is shared by several caches and has a global memory budget.
+   When the budget is exhausted, the least recently used block among
+   all the caches of the pool is evicted.
+
+   All the functions below return IOD_* status codes.  */
+
+struct ios_cache;
+struct ios_cache_pool;
+
+/* Default geometry of IOS caches.  */
+
+#define IOS_CACHE_DEFAULT_BLOCK_SIZE 4096
+#define IOS_CACHE_DEFAULT_NBLOCKS    1024
+
+/* Default memory budget of cache pools, in bytes.  */
+
+#define IOS_CACHE_DEFAULT_BUDGET (16 * 1024 * 1024)
+
+/* Create a new cache pool whose caches can hold at most BUDGET bytes
+   of cached data in total.
+
+   Return NULL if there is not enough memory.  */
+
+struct ios_cache_pool *ios_cache_pool_new (size_t budget);
+
+/* Free the resources used by POOL.  All the caches using the pool
+   shall have been freed.  */
+
+void ios_cache_pool_free (struct ios_cache_pool *pool);
+
+/* Set the memory budget of POOL to BUDGET bytes.  If the cached
+   blocks exceed the new budget then the least recently used ones are
+   written back and evicted.  */
+
+int ios_cache_pool_set_budget (struct ios_cache_pool *pool,
+                               size_t budget);
+
+/* Return the memory budget of POOL, in bytes.  */
+
+size_t ios_cache_pool_budget (struct ios_cache_pool *pool);
+
+/* Return the number of bytes held by the blocks cached in POOL.  */
+
+size_t ios_cache_pool_used (struct ios_cache_pool *pool);
+
+/* Create a new cache for the device DEV, operated by DEV_IF, whose
+   blocks are allocated from POOL.  BLOCK_SIZE is the size of the
+   cache blocks in bytes, and must be a power of two.  NBLOCKS is the
+   maximum number of blocks kept in the cache, and should be bigger
+   than zero.  If WRITE_THROUGH_P is not zero then the cache operates
+   in write-through mode.
+
+   Return NULL if there is not enough memory.  */
+
+struct ios_cache *ios_cache_new (struct ios_cache_pool *pool,
+                                 const struct ios_dev_if *dev_if,
+                                 void *dev,
+                                 size_t block_size, size_t nblocks,
+                                 int write_through_p);
+
+/* Free all the resources used by CACHE, and give its blocks back to
+   its pool.  Note that dirty blocks are _not_ written back to the
+   device.  Use ios_cache_flush for that.  */
+
+void ios_cache_free (struct ios_cache *cache);
+
+/* Statistics of a cache.  HITS is the number of accesses to blocks
+   that were found in the cache, MISSES is the number of blocks that
+   had to be brought into the cache, and BYTES is the memory currently
+   held by the cached blocks.  */
+
+struct ios_cache_stats
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t bytes;
+};
+
+/* Store the statistics of CACHE in *STATS.  */
+
+void ios_cache_get_stats (struct ios_cache *cache,
+                          struct ios_cache_stats *stats);
+
+/* Set the counters of the statistics of CACHE to zero.  */
+
+void ios_cache_reset_stats (struct ios_cache *cache);
+
+/* Arrange for NOTIFY to be called with DATA after every operation
+   that CACHE performs on its device.  OP is one of the IOS_TRACE_*
+   values, OFFSET and COUNT are the byte offset and the number of
+   bytes transferred, and STATUS is the IOD_* status code of the
+   operation.  A batch of reads is notified once, with the offset of
+   its first read and the total number of bytes read.  If NOTIFY is
+   NULL then no notifications are made.  */
+
+typedef void (*ios_cache_notify_fn) (void *data, int op,
+                                     ios_dev_off offset, size_t count,
+                                     int status);
+
+void ios_cache_set_notify (struct ios_cache *cache,
+                           ios_cache_notify_fn notify, void *data);
+
+/* Read COUNT bytes at byte offset OFFSET of the cached device into
+   BUF.  */
+
+int ios_cache_pread (struct ios_cache *cache, void *buf, size_t count,
+                     ios_dev_off offset);
+
+/* Write COUNT bytes from BUF at byte offset OFFSET of the cached
+   device.  */
+
+int ios_cache_pwrite (struct ios_cache *cache, const void *buf,
+                      size_t count, ios_dev_off offset);
+
+/* Bring into the cache the blocks overlapping the COUNT bytes at byte
+   offset OFFSET, reading all the missing blocks from the device in a
+   single batch if the device supports it.  At most the number of
+   blocks of the cache are fetched.  */
+
+int ios_cache_prefetch (struct ios_cache *cache, ios_dev_off offset,
+                        size_t count);
+
+/* Return a pointer to the cached copy of the COUNT bytes at byte
+   offset OFFSET, bringing the containing block into the cache if
+   needed.  Return NULL if the bytes do not lie in a single block, or
+   if the block cannot be read.  The pointer is only valid until the
+   next operation on any of the caches of the pool of CACHE.  */
+
+const void *ios_cache_get_ptr (struct ios_cache *cache, size_t count,
+                               ios_dev_off offset);
+
+/* Write back any dirty block overlapping the COUNT bytes at byte
+   offset OFFSET, and drop them from the cache.  This is to be used
+   before accessing the device directly.  */
+
+int ios_cache_sync_range (struct ios_cache *cache, ios_dev_off offset,
+                          size_t count);
+
+/* Write back all the dirty blocks to the device.  */
+
+int ios_cache_flush (struct ios_cache *cache);
+
+/* Write back all the dirty blocks and then drop every block from the
+   cache, so the next accesses will get their data from the
+   device.  */
+
+int ios_cache_invalidate (struct ios_cache *cache);
+
+#endif /* ! IOS_CACHE_H */
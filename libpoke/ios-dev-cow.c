@@ -0,0 +1,473 @@
+/* ios-dev-cow.c - Copy-on-write overlay IO devices.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements an IO device that shows the contents of some
+   other IO space, the base, with changes.  Reads fall through to the
+   base IO space, and writes are kept in memory, so they can be tested
+   without altering the base.  The changes are written to the base IO
+   space when the device is flushed, and they are lost when the device
+   is closed, or discarded.
+
+   The changes are kept in a table of extents, sorted by offset.
+   Extents never overlap nor touch each other: a write touching one or
+   more existing extents merges them.  */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* A range of changed bytes.  DATA holds the SIZE bytes starting at
+   BEGIN, and has room for ALLOC bytes.  */
+
+struct ios_dev_cow_extent
+{
+  ios_dev_off begin;
+  size_t size;
+  size_t alloc;
+  uint8_t *data;
+};
+
+/* State associated with a copy-on-write pseudo-device.  */
+
+struct ios_dev_cow
+{
+  ios base_ios;
+  char *name;
+  uint64_t flags;
+  struct ios_dev_cow_extent *extents;
+  size_t nextents;
+  size_t nalloc;
+};
+
+static const char *
+ios_dev_cow_get_if_name () {
+  return "COW";
+}
+
+static char *
+ios_dev_cow_handler_normalize (const char *handler, uint64_t flags, int* error)
+{
+  char *new_handler = NULL;
+
+  if (strlen (handler) > 6 && strncmp (handler, "cow://", 6) == 0)
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        {
+          *error = IOD_ENOMEM;
+          return NULL;
+        }
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return new_handler;
+}
+
+static void *
+ios_dev_cow_open (const char *handler, uint64_t flags, int *error, void *data)
+{
+  ios_context ios_ctx = (ios_context)data;
+  struct ios_dev_cow *cow;
+  ios base_ios;
+  const char *p;
+  char *end;
+  int base_ios_id;
+
+  /* Flags: only IOS_F_READ and IOS_F_WRITE are allowed.  The changes
+     are kept in memory, so the device is writable even if the base
+     IOS is not.  */
+  if (flags == 0)
+    flags = IOS_F_READ | IOS_F_WRITE;
+  if (flags & ~(IOS_F_READ|IOS_F_WRITE))
+    {
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
+
+  /* Format of handler:
+     cow://IOS/NAME  */
+
+  /* Skip the cow:// */
+  p = handler + 6;
+
+  /* Parse the Id of the base IOS.  This is an integer.  */
+  base_ios_id = strtol (p, &end, 0);
+  if (*p == '\0' || *end != '/')
+    goto error;
+  p = end + 1;
+
+  /* The referred IOS should exist.  */
+  base_ios = ios_search_by_id (ios_ctx, base_ios_id);
+  if (base_ios == NULL)
+    goto error;
+
+  cow = malloc (sizeof (struct ios_dev_cow));
+  if (cow == NULL)
+    goto enomem;
+
+  /* The rest of the string is the name, which may be empty.  */
+  cow->name = strdup (p);
+  if (cow->name == NULL)
+    {
+      free (cow);
+      goto enomem;
+    }
+
+  cow->base_ios = base_ios;
+  cow->flags = flags;
+  cow->extents = NULL;
+  cow->nextents = 0;
+  cow->nalloc = 0;
+  ios_inc_sub_dev (base_ios);
+
+  if (error)
+    *error = IOD_OK;
+  return cow;
+
+ enomem:
+  if (error)
+    *error = IOD_ENOMEM;
+  return NULL;
+
+ error:
+  if (error)
+    *error = IOD_ERROR;
+  return NULL;
+}
+
+/* Forget all the changes.  */
+
+static void
+ios_dev_cow_free_extents (struct ios_dev_cow *cow)
+{
+  size_t i;
+
+  for (i = 0; i < cow->nextents; ++i)
+    free (cow->extents[i].data);
+  cow->nextents = 0;
+}
+
+static int
+ios_dev_cow_close (void *iod)
+{
+  struct ios_dev_cow *cow = iod;
+
+  assert (cow->base_ios != NULL);
+
+  ios_dev_cow_free_extents (cow);
+  free (cow->extents);
+  ios_dec_sub_dev (cow->base_ios);
+  free (cow->name);
+  free (cow);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_cow_get_flags (void *iod)
+{
+  struct ios_dev_cow *cow = iod;
+  return cow->flags;
+}
+
+static ios_dev_off
+ios_dev_cow_size (void *iod)
+{
+  struct ios_dev_cow *cow = iod;
+
+  if (ios_zombie_p (cow->base_ios))
+    return 0;
+  return ios_get_dev_if (cow->base_ios)->size (ios_get_dev (cow->base_ios));
+}
+
+/* Return the index of the first extent ending after OFFSET, or the
+   number of extents if there is none.  */
+
+static size_t
+ios_dev_cow_search (struct ios_dev_cow *cow, ios_dev_off offset)
+{
+  size_t lo = 0, hi = cow->nextents;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      struct ios_dev_cow_extent *e = &cow->extents[mid];
+
+      if (e->begin + e->size <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+static int
+ios_dev_cow_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_cow *cow = iod;
+  ios_dev_off end = offset + count;
+  size_t i;
+  int ret;
+
+  if (ios_zombie_p (cow->base_ios) || !(cow->flags & IOS_F_READ))
+    return IOD_ERROR;
+
+  if (end > ios_dev_cow_size (cow))
+    return IOD_EOF;
+
+  /* Go through the cache of the base IOS, so we don't get out of
+     sync with it.  */
+  ret = ios_pread (cow->base_ios, buf, count, offset);
+  if (ret != IOD_OK)
+    return ret;
+
+  /* Apply the changes overlapping the range.  */
+  for (i = ios_dev_cow_search (cow, offset);
+       i < cow->nextents && cow->extents[i].begin < end;
+       ++i)
+    {
+      struct ios_dev_cow_extent *e = &cow->extents[i];
+      ios_dev_off b = e->begin > offset ? e->begin : offset;
+      ios_dev_off t = e->begin + e->size < end ? e->begin + e->size : end;
+
+      memcpy ((uint8_t *) buf + (b - offset), e->data + (b - e->begin),
+              t - b);
+    }
+
+  return IOD_OK;
+}
+
+/* Make room in the extent E for SIZE bytes.  */
+
+static int
+ios_dev_cow_reserve (struct ios_dev_cow_extent *e, size_t size)
+{
+  if (size > e->alloc)
+    {
+      size_t alloc = e->alloc ? e->alloc : 64;
+      uint8_t *data;
+
+      while (alloc < size)
+        alloc *= 2;
+      data = realloc (e->data, alloc);
+      if (data == NULL)
+        return IOD_ENOMEM;
+      e->data = data;
+      e->alloc = alloc;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_cow_pwrite (void *iod, const void *buf, size_t count,
+                    ios_dev_off offset)
+{
+  struct ios_dev_cow *cow = iod;
+  ios_dev_off end = offset + count;
+  struct ios_dev_cow_extent *e;
+  size_t first, last;
+
+  if (ios_zombie_p (cow->base_ios) || !(cow->flags & IOS_F_WRITE))
+    return IOD_ERROR;
+
+  /* Overlays don't accept writes past the end of the base IOS.  */
+  if (end > ios_dev_cow_size (cow))
+    return IOD_EOF;
+  if (count == 0)
+    return IOD_OK;
+
+  /* The extents in [FIRST,LAST) overlap or touch the written
+     range.  */
+  first = ios_dev_cow_search (cow, offset);
+  if (first > 0 && cow->extents[first - 1].begin
+                   + cow->extents[first - 1].size == offset)
+    first--;
+  for (last = first;
+       last < cow->nextents && cow->extents[last].begin <= end;
+       ++last)
+    ;
+
+  if (first == last)
+    {
+      /* Insert a new extent.  */
+      struct ios_dev_cow_extent new = { offset, 0, 0, NULL };
+
+      if (ios_dev_cow_reserve (&new, count) != IOD_OK)
+        return IOD_ENOMEM;
+      memcpy (new.data, buf, count);
+      new.size = count;
+
+      if (cow->nextents == cow->nalloc)
+        {
+          size_t nalloc = cow->nalloc ? cow->nalloc * 2 : 16;
+          struct ios_dev_cow_extent *extents
+            = realloc (cow->extents, nalloc * sizeof (*extents));
+
+          if (extents == NULL)
+            {
+              free (new.data);
+              return IOD_ENOMEM;
+            }
+          cow->extents = extents;
+          cow->nalloc = nalloc;
+        }
+
+      memmove (&cow->extents[first + 1], &cow->extents[first],
+               (cow->nextents - first) * sizeof (*cow->extents));
+      cow->extents[first] = new;
+      cow->nextents++;
+      return IOD_OK;
+    }
+
+  /* Merge the written range and the extents in [FIRST,LAST) into the
+     extent FIRST.  The data of the first extent is kept, which makes
+     sequential writes cheap.  */
+  e = &cow->extents[first];
+  {
+    struct ios_dev_cow_extent *l = &cow->extents[last - 1];
+    ios_dev_off new_end = l->begin + l->size > end ? l->begin + l->size : end;
+    size_t i;
+
+    if (offset < e->begin)
+      {
+        size_t shift = e->begin - offset;
+
+        if (ios_dev_cow_reserve (e, new_end - offset) != IOD_OK)
+          return IOD_ENOMEM;
+        memmove (e->data + shift, e->data, e->size);
+        e->begin = offset;
+        e->size += shift;
+      }
+    else if (ios_dev_cow_reserve (e, new_end - e->begin) != IOD_OK)
+      return IOD_ENOMEM;
+
+    for (i = first + 1; i < last; ++i)
+      {
+        struct ios_dev_cow_extent *o = &cow->extents[i];
+
+        memcpy (e->data + (o->begin - e->begin), o->data, o->size);
+        free (o->data);
+      }
+
+    memcpy (e->data + (offset - e->begin), buf, count);
+    e->size = new_end - e->begin;
+  }
+
+  memmove (&cow->extents[first + 1], &cow->extents[last],
+           (cow->nextents - last) * sizeof (*cow->extents));
+  cow->nextents -= last - first - 1;
+  return IOD_OK;
+}
+
+/* Write the changes to the base IO space.  */
+
+static int
+ios_dev_cow_flush (void *iod, ios_dev_off offset)
+{
+  struct ios_dev_cow *cow = iod;
+  size_t i;
+
+  if (ios_zombie_p (cow->base_ios))
+    return IOD_ERROR;
+  if (cow->nextents == 0)
+    return IOD_OK;
+  if (!(ios_flags (cow->base_ios) & IOS_F_WRITE))
+    return IOD_ERROR;
+
+  for (i = 0; i < cow->nextents; ++i)
+    {
+      struct ios_dev_cow_extent *e = &cow->extents[i];
+      int ret = ios_pwrite (cow->base_ios, e->data, e->size, e->begin);
+
+      if (ret != IOD_OK)
+        {
+          /* Keep the changes not written yet.  */
+          size_t j;
+
+          for (j = 0; j < i; ++j)
+            free (cow->extents[j].data);
+          memmove (cow->extents, cow->extents + i,
+                   (cow->nextents - i) * sizeof (*cow->extents));
+          cow->nextents -= i;
+          return ret;
+        }
+
+      /* Values mapped in the base IO space are now stale.  */
+      ios_mark_dirty_range (cow->base_ios, e->begin * 8,
+                            (e->begin + e->size) * 8);
+    }
+
+  ios_dev_cow_free_extents (cow);
+  return IOD_OK;
+}
+
+static int
+ios_dev_cow_volatile_by_default (void *iod, const char *handler)
+{
+  struct ios_dev_cow *cow = iod;
+
+  return ios_volatile_p (cow->base_ios);
+}
+
+static int
+ios_dev_cow_next_change (void *iod, ios_dev_off offset,
+                         ios_dev_off *begin, ios_dev_off *end)
+{
+  struct ios_dev_cow *cow = iod;
+  size_t i = ios_dev_cow_search (cow, offset);
+
+  if (i == cow->nextents)
+    return IOD_EOF;
+
+  *begin = cow->extents[i].begin > offset ? cow->extents[i].begin : offset;
+  *end = cow->extents[i].begin + cow->extents[i].size;
+  return IOD_OK;
+}
+
+static int
+ios_dev_cow_discard (void *iod)
+{
+  struct ios_dev_cow *cow = iod;
+
+  ios_dev_cow_free_extents (cow);
+  return IOD_OK;
+}
+
+struct ios_dev_if ios_dev_cow =
+  {
+   .get_if_name = ios_dev_cow_get_if_name,
+   .handler_normalize = ios_dev_cow_handler_normalize,
+   .open = ios_dev_cow_open,
+   .close = ios_dev_cow_close,
+   .pread = ios_dev_cow_pread,
+   .pwrite = ios_dev_cow_pwrite,
+   .get_flags = ios_dev_cow_get_flags,
+   .size = ios_dev_cow_size,
+   .flush = ios_dev_cow_flush,
+   .volatile_by_default = ios_dev_cow_volatile_by_default,
+   .next_change = ios_dev_cow_next_change,
+   .discard = ios_dev_cow_discard,
+  };
@@ -25,6 +25,7 @@
 #define _FILE_OFFSET_BITS 64
 
 #include <fcntl.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <sys/stat.h>
@@ -33,13 +34,33 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with a file device.  */
+/* Default size in bytes of the readahead window of file devices.
+   This can be overridden by setting the environment variable
+   POKE_FILE_READAHEAD.  Setting it to zero disables readahead.  */
+
+#define IOS_DEV_FILE_READAHEAD 65536
+
+/* State associated with a file device.
+
+   FD is the file descriptor of the open file.  Reads and writes are
+   performed using positional pread and pwrite calls on it, so the
+   file offset associated with the descriptor is never used.
+
+   RA_BUF is a buffer of RA_SIZE bytes holding RA_LEN bytes read from
+   the file at offset RA_OFFSET.  Small reads falling in the window
+   are served from RA_BUF.  Reads missing the window fill it
+   starting at the requested offset.  If RA_SIZE is zero then
+   readahead is disabled and RA_BUF is NULL.  */
 
 struct ios_dev_file
 {
-  FILE *file;
+  int fd;
   char *filename;
   uint64_t flags;
+  uint8_t *ra_buf;
+  size_t ra_size;
+  size_t ra_len;
+  ios_dev_off ra_offset;
 };
 
 static const char *
@@ -64,28 +85,19 @@ ios_dev_file_handler_normalize (const char *handler, uint64_t flags, int* error)
   return new_handler;
 }
 
-/* Returns 0 when the flags are inconsistent.  */
+/* Returns -1 when the flags are inconsistent.  */
 static inline int
-ios_dev_file_convert_flags (int mode_flags, char **mode_for_fdopen)
+ios_dev_file_convert_flags (int mode_flags)
 {
   int flags_for_open = 0;
 
   if ((mode_flags & IOS_F_READ)
       && (mode_flags & IOS_F_WRITE))
-    {
-      flags_for_open |= O_RDWR;
-      *mode_for_fdopen = "r+b";
-    }
+    flags_for_open |= O_RDWR;
   else if (mode_flags & IOS_F_READ)
-    {
-      flags_for_open |= O_RDONLY;
-      *mode_for_fdopen = "rb";
-    }
+    flags_for_open |= O_RDONLY;
   else if (mode_flags & IOS_F_WRITE)
-    {
-      flags_for_open |= O_WRONLY;
-      *mode_for_fdopen = "wb";
-    }
+    flags_for_open |= O_WRONLY;
   else
     /* Cannot open a file neither to write nor to read.  */
     return -1;
@@ -96,18 +108,37 @@ ios_dev_file_convert_flags (int mode_flags, char **mode_for_fdopen)
   return flags_for_open;
 }
 
+/* Return the size of the readahead window to use in new file
+   devices.  */
+
+static size_t
+ios_dev_file_readahead_size (void)
+{
+  const char *str = getenv ("POKE_FILE_READAHEAD");
+  char *end;
+  unsigned long long size;
+
+  if (str == NULL || *str == '\0')
+    return IOS_DEV_FILE_READAHEAD;
+
+  errno = 0;
+  size = strtoull (str, &end, 0);
+  if (errno != 0 || *end != '\0' || size > SIZE_MAX)
+    return IOS_DEV_FILE_READAHEAD;
+
+  return size;
+}
+
 static void *
 ios_dev_file_open (const char *handler, uint64_t flags, int *error,
                    void *data __attribute__ ((unused)))
 {
   struct ios_dev_file *fio = NULL;
-  FILE *f = NULL;
   int internal_error = IOD_ERROR;
 
   uint8_t mode_flags = flags & IOS_FLAGS_MODE;
-  char *mode_for_fdopen = NULL;
   int flags_for_open = 0;
-  int fd;
+  int fd = -1;
 
 #ifdef _WIN32
   /* On windows the O_BINARY flag is needed to open files in binary mode.  */
@@ -120,8 +151,7 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error,
   if (mode_flags != 0)
     {
       /* Decide what mode to use to open the file.  */
-      flags_for_open
-        = ios_dev_file_convert_flags (mode_flags, &mode_for_fdopen);
+      flags_for_open = ios_dev_file_convert_flags (mode_flags);
       if (flags_for_open == -1)
         {
           internal_error = IOD_EFLAGS;
@@ -131,49 +161,51 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error,
                  S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH);
       if (fd == -1)
         goto err;
-      f = fdopen (fd, mode_for_fdopen);
     }
   else
     {
       /* Try read-write initially.
          If that fails, then try read-only.
          If that fails, then try write-only.  */
-      const char *mode_for_fdopen;
-
       fd = open (handler, O_RDWR | bin_flag, 0);
       flags |= (IOS_F_READ | IOS_F_WRITE);
-      mode_for_fdopen = "r+b";
       if (fd == -1)
         {
           fd = open (handler, O_RDONLY | bin_flag, 0);
           if (fd != -1)
             flags &= ~IOS_F_WRITE;
-          mode_for_fdopen = "rb";
         }
       if (fd == -1)
         {
           fd = open (handler, O_WRONLY | bin_flag, 0);
           if (fd != -1)
             flags &= ~IOS_F_READ;
-          mode_for_fdopen = "wb";
         }
       if (fd == -1)
         goto err;
-      f = fdopen (fd, mode_for_fdopen);
     }
 
-  if (!f)
-    goto err;
-
   fio = malloc (sizeof (struct ios_dev_file));
   if (!fio)
     goto err;
+  memset (fio, 0, sizeof (struct ios_dev_file));
 
   fio->filename = strdup (handler);
   if (!fio->filename)
     goto err;
 
-  fio->file = f;
+  /* There is no point in reading ahead in files that cannot be
+     read.  */
+  if (flags & IOS_F_READ)
+    fio->ra_size = ios_dev_file_readahead_size ();
+  if (fio->ra_size > 0)
+    {
+      fio->ra_buf = malloc (fio->ra_size);
+      if (!fio->ra_buf)
+        goto err;
+    }
+
+  fio->fd = fd;
   fio->flags = flags;
 
   if (error)
@@ -182,11 +214,14 @@ ios_dev_file_open (const char *handler, uint64_t flags, int *error,
 
 err:
   if (fio)
-    free (fio->filename);
+    {
+      free (fio->filename);
+      free (fio->ra_buf);
+    }
   free (fio);
 
-  if (f)
-    fclose (f);
+  if (fd != -1)
+    close (fd);
 
   if (error)
     {
@@ -209,20 +244,18 @@ static int
 ios_dev_file_close (void *iod)
 {
   struct ios_dev_file *fio = iod;
+  int ret = IOD_OK;
 
-  if (fclose (fio->file) == 0)
-    {
-      free (fio->filename);
-      free (fio);
-      return IOD_OK;
-    }
-  else
+  if (close (fio->fd) != 0)
     {
       perror (fio->filename);
-      free (fio->filename);
-      free (fio);
-      return IOD_ERROR;
+      ret = IOD_ERROR;
     }
+
+  free (fio->filename);
+  free (fio->ra_buf);
+  free (fio);
+  return ret;
 }
 
 static uint64_t
@@ -234,30 +267,76 @@ ios_dev_file_get_flags (void *iod)
 }
 
 
+/* Read up to COUNT bytes at OFFSET into BUF, retrying on short
+   reads.  Return the number of bytes read, which is less than COUNT
+   only if the end of the file is reached, or -1 on error.  */
+
+static ssize_t
+ios_dev_file_pread_full (int fd, void *buf, size_t count, off_t offset)
+{
+  size_t done = 0;
+
+  while (done < count)
+    {
+      ssize_t ret = pread (fd, (uint8_t *) buf + done, count - done,
+                           offset + done);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          return -1;
+        }
+      if (ret == 0)
+        break;
+
+      done += ret;
+    }
+
+  return done;
+}
+
 static int
 ios_dev_file_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
+  ssize_t ret;
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (ftello(fio->file) != offset)
-    if (fseeko (fio->file, offset, SEEK_SET) == -1)
-      return IOD_EOF;
-  ret = fread (buf, 1, count, fio->file);
+  if (offset > INT64_MAX || count > INT64_MAX - offset)
+    return IOD_EOF;
 
-  if (ferror (fio->file))
+  /* Serve the read from the readahead window if possible.  */
+  if (fio->ra_len > 0
+      && offset >= fio->ra_offset
+      && offset + count <= fio->ra_offset + fio->ra_len)
     {
-      clearerr (fio->file);
-      return IOD_ERROR;
+      memcpy (buf, fio->ra_buf + (offset - fio->ra_offset), count);
+      return IOD_OK;
     }
 
-  /* XXX As long as count <= 9 because the ios layer reads at most an
-     unaligned uint64_t, we are unlikely to hit short reads.  But if
-     future code adds in large buffer reads, we may want to retry on
-     short reads rather than giving up right away. */
-  return ret == count ? IOD_OK : IOD_EOF;
+  /* Reads that are as big as the window go straight to the file.  */
+  if (count >= fio->ra_size)
+    {
+      ret = ios_dev_file_pread_full (fio->fd, buf, count, offset);
+      if (ret == -1)
+        return IOD_ERROR;
+      return (size_t) ret == count ? IOD_OK : IOD_EOF;
+    }
+
+  /* Otherwise refill the window starting at OFFSET.  */
+  fio->ra_len = 0;
+  ret = ios_dev_file_pread_full (fio->fd, fio->ra_buf, fio->ra_size, offset);
+  if (ret == -1)
+    return IOD_ERROR;
+
+  fio->ra_offset = offset;
+  fio->ra_len = ret;
+
+  if ((size_t) ret < count)
+    return IOD_EOF;
+
+  memcpy (buf, fio->ra_buf, count);
+  return IOD_OK;
 }
 
 static int
@@ -265,22 +344,36 @@ ios_dev_file_pwrite (void *iod, const void *buf, size_t count,
                      ios_dev_off offset)
 {
   struct ios_dev_file *fio = iod;
-  size_t ret;
+  size_t done = 0;
 
-  /* We are using FILE* for buffering, rather than low-level fd, so we
-     have to fake low-level pread by using fseeko.  */
-  if (fseeko (fio->file, offset, SEEK_SET))
+  if (offset > INT64_MAX || count > INT64_MAX - offset)
     return IOD_EOF;
-  ret = fwrite (buf, 1, count, fio->file);
 
-  if (ferror (fio->file))
+  /* Keep the readahead window coherent with the file contents.  */
+  if (fio->ra_len > 0
+      && offset < fio->ra_offset + fio->ra_len
+      && offset + count > fio->ra_offset)
+    fio->ra_len = 0;
+
+  while (done < count)
     {
-      perror ("write: ");
-      clearerr (fio->file);
-      return IOD_ERROR;
+      ssize_t ret = pwrite (fio->fd, (const uint8_t *) buf + done,
+                            count - done, offset + done);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("write: ");
+          return IOD_ERROR;
+        }
+      if (ret == 0)
+        return IOD_EOF;
+
+      done += ret;
     }
 
-  return ret == count ? IOD_OK : IOD_EOF;
+  return IOD_OK;
 }
 
 static ios_dev_off
@@ -289,22 +382,101 @@ ios_dev_file_size (void *iod)
   struct stat st;
   struct ios_dev_file *fio = iod;
 
-  fstat (fileno (fio->file), &st);
+  fstat (fio->fd, &st);
   return st.st_size;
 }
 
 static int
 ios_dev_file_flush (void *iod, ios_dev_off offset)
 {
+  struct ios_dev_file *fio = iod;
+
+  /* Writes go straight to the file, but the file may have been
+     modified behind our back, so forget about whatever was read
+     ahead.  */
+  fio->ra_len = 0;
   return IOS_OK;
 }
 
+static int
+ios_dev_file_mtime (void *iod, int64_t *mtime)
+{
+  struct stat st;
+  struct ios_dev_file *fio = iod;
+
+  if (fstat (fio->fd, &st) == -1)
+    return IOD_ERROR;
+  *mtime = st.st_mtime;
+  return IOD_OK;
+}
+
+static int
+ios_dev_file_copy (void *iod, ios_dev_off offset, void *dst,
+                   ios_dev_off dst_offset, size_t count)
+{
+  struct ios_dev_file *fio = iod;
+  struct ios_dev_file *dst_fio = dst;
+  size_t done = 0;
+
+  if (offset > INT64_MAX || count > INT64_MAX - offset
+      || dst_offset > INT64_MAX || count > INT64_MAX - dst_offset)
+    return IOD_EOF;
+
+  /* Keep the readahead window coherent with the file contents.  */
+  dst_fio->ra_len = 0;
+
+  while (done < count)
+    {
+      off_t in = offset + done;
+      off_t out = dst_offset + done;
+      ssize_t ret = copy_file_range (fio->fd, &in, dst_fio->fd, &out,
+                                     count - done, 0);
+
+      if (ret == -1)
+        {
+          if (errno == EINTR)
+            continue;
+          /* The file system, or the kernel, doesn't support copying
+             between these files.  */
+          if (done == 0
+              && (errno == ENOSYS || errno == EXDEV || errno == EINVAL
+                  || errno == EOPNOTSUPP || errno == EBADF))
+            return IOD_EINVAL;
+          return IOD_ERROR;
+        }
+      if (ret == 0)
+        return IOD_EOF;
+
+      done += ret;
+    }
+
+  return IOD_OK;
+}
+
 static int
 ios_dev_file_volatile_by_default (void *iod, const char *handler)
 {
   return 0;
 }
 
+static int
+ios_dev_file_prefetch (void *iod, ios_dev_off offset, size_t count)
+{
+  struct ios_dev_file *fio = iod;
+
+  /* This is called with a zero COUNT whenever the contents of a
+     volatile IO space may have changed, so the readahead window
+     shall not be used anymore.  */
+  if (count == 0)
+    {
+      fio->ra_len = 0;
+      return IOD_OK;
+    }
+
+  /* Let the cache fetch the data.  */
+  return IOD_EINVAL;
+}
+
 struct ios_dev_if ios_dev_file =
   {
    .get_if_name = ios_dev_file_get_if_name,
@@ -316,5 +488,8 @@ struct ios_dev_if ios_dev_file =
    .get_flags = ios_dev_file_get_flags,
    .size = ios_dev_file_size,
    .flush = ios_dev_file_flush,
-   .volatile_by_default = ios_dev_file_volatile_by_default
+   .volatile_by_default = ios_dev_file_volatile_by_default,
+   .prefetch = ios_dev_file_prefetch,
+   .mtime = ios_dev_file_mtime,
+   .copy = ios_dev_file_copy,
   };
@@ -0,0 +1,693 @@
+/* ios-dev-gz.c - Random access to gzip compressed files.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements a read-only IO device that provides access to
+   the uncompressed contents of gzip files, without decompressing the
+   whole file every time some data is read.
+
+   When the device is opened the compressed file is decompressed once
+   in order to build an index of access points, which are locations
+   in the compressed stream where decompression can be resumed.  An
+   access point is recorded at the beginning of every gzip member and
+   then at the first deflate block boundary every IOS_GZ_SPAN
+   uncompressed bytes.  Since the deflate blocks may refer to the
+   last 32 KiB of uncompressed data, every access point past the
+   beginning of a member keeps a copy of them.
+
+   The uncompressed data between an access point and the next one is
+   a frame.  Reads decompress the frames covering the requested
+   range, which are kept in a small cache with a least recently used
+   replacement policy.  */
+
+#include <config.h>
+
+/* We want 64-bit file offsets in all systems.  */
+#define _FILE_OFFSET_BITS 64
+
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include <zlib.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+/* Distance in bytes of uncompressed data between access points.  */
+
+#define IOS_GZ_SPAN (1024 * 1024)
+
+/* Size of the window of the deflate format.  */
+
+#define IOS_GZ_WINSIZE 32768
+
+/* Number of decompressed frames kept in the cache.  */
+
+#define IOS_GZ_CACHE_SIZE 8
+
+/* Size of the buffer used to read the compressed file.  */
+
+#define IOS_GZ_CHUNK 16384
+
+/* An access point.
+
+   OUT is the offset in the uncompressed data and IN is the offset of
+   the first byte in the compressed file that is needed to resume the
+   decompression.
+
+   BITS is -1 if the access point is the beginning of a gzip member.
+   Otherwise decompression resumes in the middle of the byte at IN - 1
+   if BITS is not zero, precisely at its BITS most significant bits,
+   and needs the WINDOW_LEN bytes of uncompressed data in WINDOW as a
+   dictionary.  */
+
+struct ios_dev_gz_point
+{
+  uint64_t out;
+  uint64_t in;
+  int bits;
+  size_t window_len;
+  uint8_t *window;
+};
+
+/* A decompressed frame in the cache.  POINT is the index of the
+   access point starting the frame, or -1 if the entry is not used.
+   STAMP tells when was the frame last used.  */
+
+struct ios_dev_gz_frame
+{
+  ssize_t point;
+  uint64_t stamp;
+  uint8_t *data;
+  size_t len;
+};
+
+/* State associated with a gzip device.
+
+   SIZE is the size of the uncompressed data.
+
+   POINTS is a table of NUM_POINTS access points, sorted by offset in
+   the uncompressed data.  The allocated size of the table is
+   MAX_POINTS.  */
+
+struct ios_dev_gz
+{
+  int fd;
+  uint64_t flags;
+  uint64_t size;
+  struct ios_dev_gz_point *points;
+  size_t num_points;
+  size_t max_points;
+  struct ios_dev_gz_frame cache[IOS_GZ_CACHE_SIZE];
+  uint64_t stamp;
+};
+
+static const char *
+ios_dev_gz_get_if_name () {
+  return "GZ";
+}
+
+static char *
+ios_dev_gz_handler_normalize (const char *handler, uint64_t flags, int* error)
+{
+  char *new_handler = NULL;
+
+  if (strlen (handler) > 5
+      && handler[0] == 'g'
+      && handler[1] == 'z'
+      && handler[2] == ':'
+      && handler[3] == '/'
+      && handler[4] == '/')
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = IOD_ENOMEM;
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return new_handler;
+}
+
+/* Read up to COUNT bytes at OFFSET of the compressed file into BUF.
+   Return the number of bytes read, or -1 on error.  */
+
+static ssize_t
+ios_dev_gz_read (struct ios_dev_gz *gio, uint8_t *buf, size_t count,
+                 uint64_t offset)
+{
+  ssize_t ret;
+
+  do
+    ret = pread (gio->fd, buf, count, offset);
+  while (ret == -1 && errno == EINTR);
+  return ret;
+}
+
+/* Add an access point to the index of GIO.  The window is made of
+   the last WINDOW_LEN bytes written to the circular buffer WINDOW,
+   whose next position to be written is WINDOW_POS.  Return an IOD_*
+   status code.  */
+
+static int
+ios_dev_gz_add_point (struct ios_dev_gz *gio, uint64_t out, uint64_t in,
+                      int bits, const uint8_t *window, size_t window_pos,
+                      size_t window_len)
+{
+  struct ios_dev_gz_point *point;
+
+  if (gio->num_points == gio->max_points)
+    {
+      size_t max_points = gio->max_points ? gio->max_points * 2 : 16;
+      struct ios_dev_gz_point *points
+        = realloc (gio->points, max_points * sizeof (*points));
+
+      if (!points)
+        return IOD_ENOMEM;
+      gio->points = points;
+      gio->max_points = max_points;
+    }
+
+  point = &gio->points[gio->num_points];
+  point->out = out;
+  point->in = in;
+  point->bits = bits;
+  point->window_len = window_len;
+  point->window = NULL;
+
+  if (window_len > 0)
+    {
+      size_t tail = window_len < window_pos ? window_len : window_pos;
+
+      point->window = malloc (window_len);
+      if (!point->window)
+        return IOD_ENOMEM;
+      /* The window is circular, so the oldest bytes may be at the
+         end of the buffer.  */
+      memcpy (point->window + window_len - tail,
+              window + window_pos - tail, tail);
+      if (tail < window_len)
+        memcpy (point->window,
+                window + IOS_GZ_WINSIZE - (window_len - tail),
+                window_len - tail);
+    }
+
+  gio->num_points++;
+  return IOD_OK;
+}
+
+/* Decompress the whole compressed file of GIO, building its index of
+   access points and computing the size of the uncompressed data.
+   Return an IOD_* status code.  */
+
+static int
+ios_dev_gz_build_index (struct ios_dev_gz *gio)
+{
+  z_stream strm;
+  uint8_t *input, *window;
+  uint64_t totin = 0, totout = 0, member_out = 0, last = 0;
+  size_t window_pos = 0;
+  int member_start_p = 1;
+  int ret, result = IOD_OK;
+
+  input = malloc (IOS_GZ_CHUNK);
+  window = malloc (IOS_GZ_WINSIZE);
+  if (!input || !window)
+    {
+      free (input);
+      free (window);
+      return IOD_ENOMEM;
+    }
+
+  memset (&strm, 0, sizeof (strm));
+  if (inflateInit2 (&strm, 15 + 16) != Z_OK)
+    {
+      free (input);
+      free (window);
+      return IOD_ENOMEM;
+    }
+
+  while (1)
+    {
+      if (strm.avail_in == 0)
+        {
+          ssize_t nread = ios_dev_gz_read (gio, input, IOS_GZ_CHUNK,
+                                           totin);
+
+          if (nread == -1)
+            {
+              result = IOD_ERROR;
+              break;
+            }
+          if (nread == 0)
+            {
+              /* The file shall not end in the middle of a member,
+                 but data following the last member which is not a
+                 gzip member is ignored, like gzip does.  */
+              if (!member_start_p)
+                {
+                  if (gio->num_points > 1 && member_out == 0)
+                    gio->num_points--;
+                  else
+                    result = IOD_EINVAL;
+                }
+              break;
+            }
+          strm.next_in = input;
+          strm.avail_in = nread;
+        }
+
+      if (member_start_p)
+        {
+          /* Every member starts with an access point, which doesn't
+             need a window.  */
+          ret = ios_dev_gz_add_point (gio, totout, totin, -1, NULL, 0, 0);
+          if (ret != IOD_OK)
+            {
+              result = ret;
+              break;
+            }
+          member_start_p = 0;
+          member_out = 0;
+          last = totout;
+        }
+
+      if (window_pos == IOS_GZ_WINSIZE)
+        window_pos = 0;
+      strm.next_out = window + window_pos;
+      strm.avail_out = IOS_GZ_WINSIZE - window_pos;
+
+      {
+        size_t avail_in = strm.avail_in;
+        size_t avail_out = strm.avail_out;
+
+        ret = inflate (&strm, Z_BLOCK);
+        totin += avail_in - strm.avail_in;
+        totout += avail_out - strm.avail_out;
+        member_out += avail_out - strm.avail_out;
+        window_pos += avail_out - strm.avail_out;
+      }
+
+      if (ret == Z_NEED_DICT || ret == Z_DATA_ERROR)
+        {
+          /* Again, ignore whatever follows the last member.  */
+          if (!(gio->num_points > 1 && member_out == 0))
+            result = IOD_EINVAL;
+          else
+            gio->num_points--;
+          break;
+        }
+      if (ret == Z_MEM_ERROR)
+        {
+          result = IOD_ENOMEM;
+          break;
+        }
+
+      if (ret == Z_STREAM_END)
+        {
+          /* Another member may follow.  */
+          if (inflateReset (&strm) != Z_OK)
+            {
+              result = IOD_ERROR;
+              break;
+            }
+          member_start_p = 1;
+          continue;
+        }
+
+      /* At the end of a block which is not the last one of the
+         member, record an access point if we are far enough from the
+         previous one.  */
+      if ((strm.data_type & 128) && !(strm.data_type & 64)
+          && totout - last > IOS_GZ_SPAN)
+        {
+          size_t window_len = (member_out < IOS_GZ_WINSIZE
+                               ? member_out : IOS_GZ_WINSIZE);
+
+          ret = ios_dev_gz_add_point (gio, totout, totin,
+                                      strm.data_type & 7,
+                                      window, window_pos, window_len);
+          if (ret != IOD_OK)
+            {
+              result = ret;
+              break;
+            }
+          last = totout;
+        }
+    }
+
+  inflateEnd (&strm);
+  free (input);
+  free (window);
+
+  if (result == IOD_OK && gio->num_points == 0)
+    result = IOD_EINVAL;
+
+  gio->size = totout;
+  return result;
+}
+
+static void
+ios_dev_gz_free (struct ios_dev_gz *gio)
+{
+  size_t i;
+
+  for (i = 0; i < gio->num_points; ++i)
+    free (gio->points[i].window);
+  free (gio->points);
+  for (i = 0; i < IOS_GZ_CACHE_SIZE; ++i)
+    free (gio->cache[i].data);
+  if (gio->fd != -1)
+    close (gio->fd);
+  free (gio);
+}
+
+static void *
+ios_dev_gz_open (const char *handler, uint64_t flags, int *error,
+                 void *data __attribute__ ((unused)))
+{
+  struct ios_dev_gz *gio;
+  uint8_t mode_flags = flags & IOS_FLAGS_MODE;
+  int ret, i;
+
+  /* Compressed files can only be read.  */
+  if (mode_flags & IOS_F_WRITE)
+    {
+      if (error)
+        *error = IOD_EFLAGS;
+      return NULL;
+    }
+
+  gio = calloc (1, sizeof (struct ios_dev_gz));
+  if (!gio)
+    {
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+  for (i = 0; i < IOS_GZ_CACHE_SIZE; ++i)
+    gio->cache[i].point = -1;
+
+  /* Skip the gz:// */
+  gio->fd = open (handler + 5, O_RDONLY);
+  if (gio->fd == -1)
+    {
+      ios_dev_gz_free (gio);
+      if (error)
+        *error = IOD_ENOENT;
+      return NULL;
+    }
+  gio->flags = IOS_F_READ;
+
+  ret = ios_dev_gz_build_index (gio);
+  if (ret != IOD_OK)
+    {
+      ios_dev_gz_free (gio);
+      if (error)
+        *error = ret;
+      return NULL;
+    }
+
+  if (error)
+    *error = IOD_OK;
+  return gio;
+}
+
+static int
+ios_dev_gz_close (void *iod)
+{
+  ios_dev_gz_free (iod);
+  return IOD_OK;
+}
+
+static uint64_t
+ios_dev_gz_get_flags (void *iod)
+{
+  struct ios_dev_gz *gio = iod;
+
+  return gio->flags;
+}
+
+/* Return the index of the access point starting the frame that
+   contains the byte at OFFSET of the uncompressed data.  OFFSET shall
+   be less than the size of the uncompressed data.  */
+
+static size_t
+ios_dev_gz_find_point (struct ios_dev_gz *gio, uint64_t offset)
+{
+  size_t lo = 0, hi = gio->num_points;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (gio->points[mid].out <= offset)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  return lo;
+}
+
+/* Decompress the frame starting at the access point POINT into the
+   LEN bytes at BUF.  Return an IOD_* status code.  */
+
+static int
+ios_dev_gz_inflate_frame (struct ios_dev_gz *gio, size_t point,
+                          uint8_t *buf, size_t len)
+{
+  const struct ios_dev_gz_point *p = &gio->points[point];
+  z_stream strm;
+  uint8_t input[IOS_GZ_CHUNK];
+  uint64_t in = p->in;
+  int ret, result = IOD_OK;
+
+  memset (&strm, 0, sizeof (strm));
+  if (inflateInit2 (&strm, p->bits == -1 ? 15 + 16 : -15) != Z_OK)
+    return IOD_ENOMEM;
+
+  if (p->bits > 0)
+    {
+      uint8_t byte;
+
+      if (ios_dev_gz_read (gio, &byte, 1, in - 1) != 1)
+        {
+          inflateEnd (&strm);
+          return IOD_ERROR;
+        }
+      inflatePrime (&strm, p->bits, byte >> (8 - p->bits));
+    }
+  if (p->window_len > 0)
+    inflateSetDictionary (&strm, p->window, p->window_len);
+
+  strm.next_out = buf;
+  strm.avail_out = len;
+  while (strm.avail_out > 0)
+    {
+      if (strm.avail_in == 0)
+        {
+          ssize_t nread = ios_dev_gz_read (gio, input, sizeof (input), in);
+
+          if (nread <= 0)
+            {
+              result = IOD_ERROR;
+              break;
+            }
+          in += nread;
+          strm.next_in = input;
+          strm.avail_in = nread;
+        }
+
+      ret = inflate (&strm, Z_NO_FLUSH);
+      if (ret == Z_MEM_ERROR)
+        {
+          result = IOD_ENOMEM;
+          break;
+        }
+      if (ret != Z_OK && ret != Z_BUF_ERROR
+          && !(ret == Z_STREAM_END && strm.avail_out == 0))
+        {
+          /* The file changed after the index was built.  */
+          result = IOD_ERROR;
+          break;
+        }
+    }
+
+  inflateEnd (&strm);
+  return result;
+}
+
+/* Return the decompressed frame starting at the access point POINT,
+   decompressing it if it is not in the cache.  Return NULL on
+   error, setting *ERROR to an IOD_* status code.  */
+
+static struct ios_dev_gz_frame *
+ios_dev_gz_get_frame (struct ios_dev_gz *gio, size_t point, int *error)
+{
+  struct ios_dev_gz_frame *frame = &gio->cache[0];
+  uint64_t end;
+  size_t len, i;
+  int ret;
+
+  for (i = 0; i < IOS_GZ_CACHE_SIZE; ++i)
+    {
+      if (gio->cache[i].point == (ssize_t) point)
+        {
+          gio->cache[i].stamp = ++gio->stamp;
+          return &gio->cache[i];
+        }
+      if (gio->cache[i].stamp < frame->stamp)
+        frame = &gio->cache[i];
+    }
+
+  /* Replace the least recently used frame.  */
+  end = (point + 1 < gio->num_points
+         ? gio->points[point + 1].out : gio->size);
+  len = end - gio->points[point].out;
+
+  if (frame->point == -1 || len > frame->len)
+    {
+      uint8_t *data = realloc (frame->data, len);
+
+      if (!data)
+        {
+          *error = IOD_ENOMEM;
+          return NULL;
+        }
+      frame->data = data;
+    }
+  frame->point = -1;
+  frame->stamp = 0;
+
+  ret = ios_dev_gz_inflate_frame (gio, point, frame->data, len);
+  if (ret != IOD_OK)
+    {
+      *error = ret;
+      return NULL;
+    }
+
+  frame->point = point;
+  frame->len = len;
+  frame->stamp = ++gio->stamp;
+  return frame;
+}
+
+static int
+ios_dev_gz_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_gz *gio = iod;
+  uint8_t *p = buf;
+  size_t point;
+
+  if (offset > gio->size || count > gio->size - offset)
+    return IOD_EOF;
+  if (count == 0)
+    return IOD_OK;
+
+  point = ios_dev_gz_find_point (gio, offset);
+  while (count > 0)
+    {
+      struct ios_dev_gz_frame *frame;
+      uint64_t frame_offset;
+      size_t n;
+      int error;
+
+      /* Skip the empty frames of empty members.  */
+      if (point + 1 < gio->num_points
+          && gio->points[point + 1].out == gio->points[point].out)
+        {
+          point++;
+          continue;
+        }
+
+      frame = ios_dev_gz_get_frame (gio, point, &error);
+      if (!frame)
+        return error;
+
+      frame_offset = offset - gio->points[point].out;
+      n = frame->len - frame_offset;
+      if (n > count)
+        n = count;
+      memcpy (p, frame->data + frame_offset, n);
+
+      p += n;
+      offset += n;
+      count -= n;
+      point++;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_gz_pwrite (void *iod, const void *buf, size_t count,
+                   ios_dev_off offset)
+{
+  /* Compressed files are read-only.  */
+  return IOD_ERROR;
+}
+
+static ios_dev_off
+ios_dev_gz_size (void *iod)
+{
+  struct ios_dev_gz *gio = iod;
+
+  return gio->size;
+}
+
+static int
+ios_dev_gz_flush (void *iod, ios_dev_off offset)
+{
+  /* Nothing to do here.  */
+  return IOD_OK;
+}
+
+static int
+ios_dev_gz_volatile_by_default (void *iod, const char *handler)
+{
+  return 0;
+}
+
+static int
+ios_dev_gz_mtime (void *iod, int64_t *mtime)
+{
+  struct stat st;
+  struct ios_dev_gz *gio = iod;
+
+  if (fstat (gio->fd, &st) == -1)
+    return IOD_ERROR;
+  *mtime = st.st_mtime;
+  return IOD_OK;
+}
+
+struct ios_dev_if ios_dev_gz =
+  {
+   .get_if_name = ios_dev_gz_get_if_name,
+   .handler_normalize = ios_dev_gz_handler_normalize,
+   .open = ios_dev_gz_open,
+   .close = ios_dev_gz_close,
+   .pread = ios_dev_gz_pread,
+   .pwrite = ios_dev_gz_pwrite,
+   .get_flags = ios_dev_gz_get_flags,
+   .size = ios_dev_gz_size,
+   .flush = ios_dev_gz_flush,
+   .volatile_by_default = ios_dev_gz_volatile_by_default,
+   .mtime = ios_dev_gz_mtime,
+  };
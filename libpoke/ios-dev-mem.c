@@ -25,17 +25,35 @@
 #include "ios.h"
 #include "ios-dev.h"
 
+/* The contents of a memory device are stored in chunks of
+   MEM_CHUNK_SIZE bytes, so growing the device never moves the data
+   already written.  Chunks that have only been written zeros, or not
+   written at all, are not allocated.  */
+
+#define MEM_CHUNK_SIZE (64 * 1024)
+
 /* State associated with a memory device.  */
 
 struct ios_dev_mem
 {
-  char *pointer;
+  /* Table of chunks.  NULL entries are chunks full of zeros.  */
+  char **chunks;
+  size_t nchunks;
+
   size_t size;
   uint64_t flags;
 };
 
+/* The size of a memory device grows by MEM_STEP bytes, and writes
+   may extend past the end of the device by at most MEM_STEP bytes.
+   This shall be a divisor of MEM_CHUNK_SIZE.  */
+
 #define MEM_STEP (512 * 8)
 
+/* Contents of the chunks that are not allocated.  */
+
+static const char mem_zero_chunk[MEM_CHUNK_SIZE];
+
 static const char *
 ios_dev_mem_get_if_name () {
   return "MEMORY";
@@ -69,13 +87,8 @@ ios_dev_mem_open (const char *handler, uint64_t flags, int *error,
       goto err;
     }
 
-  mio->pointer = calloc (MEM_STEP, 1);
-  if (!mio->pointer)
-    {
-      internal_error = IOD_ENOMEM;
-      goto err;
-    }
-
+  mio->chunks = NULL;
+  mio->nchunks = 0;
   mio->size = MEM_STEP;
   mio->flags = IOS_F_READ | IOS_F_WRITE;
 
@@ -94,8 +107,11 @@ static int
 ios_dev_mem_close (void *iod)
 {
   struct ios_dev_mem *mio = iod;
+  size_t i;
 
-  free (mio->pointer);
+  for (i = 0; i < mio->nchunks; ++i)
+    free (mio->chunks[i]);
+  free (mio->chunks);
   free (mio);
 
   return IOD_OK;
@@ -109,45 +125,130 @@ ios_dev_mem_get_flags (void *iod)
   return mio->flags;
 }
 
+/* Return the contents of the chunk number N.  */
+
+static inline const char *
+ios_dev_mem_chunk (struct ios_dev_mem *mio, size_t n)
+{
+  if (n < mio->nchunks && mio->chunks[n] != NULL)
+    return mio->chunks[n];
+  return mem_zero_chunk;
+}
+
 static int
 ios_dev_mem_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_mem *mio = iod;
+  char *p = buf;
 
   if (offset + count > mio->size)
     return IOD_EOF;
 
-  memcpy (buf, &mio->pointer[offset], count);
+  while (count > 0)
+    {
+      size_t n = offset / MEM_CHUNK_SIZE;
+      size_t off = offset % MEM_CHUNK_SIZE;
+      size_t len = MEM_CHUNK_SIZE - off;
+
+      if (len > count)
+        len = count;
+      memcpy (p, ios_dev_mem_chunk (mio, n) + off, len);
+      p += len;
+      offset += len;
+      count -= len;
+    }
+
   return 0;
 }
 
+static const void *
+ios_dev_mem_get_ptr (void *iod, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_mem *mio = iod;
+
+  if (offset > mio->size || count > mio->size - offset)
+    return NULL;
+
+  /* The range shall be contained in a single chunk.  */
+  if (count > 0
+      && offset / MEM_CHUNK_SIZE != (offset + count - 1) / MEM_CHUNK_SIZE)
+    return NULL;
+
+  return ios_dev_mem_chunk (mio, offset / MEM_CHUNK_SIZE)
+         + offset % MEM_CHUNK_SIZE;
+}
+
+/* Return whether the COUNT bytes at BUF are all zero.  */
+
+static int
+ios_dev_mem_zero_p (const char *buf, size_t count)
+{
+  return count == 0 || (buf[0] == 0 && memcmp (buf, buf + 1, count - 1) == 0);
+}
+
 static int
 ios_dev_mem_pwrite (void *iod, const void *buf, size_t count,
                     ios_dev_off offset)
 
 {
   struct ios_dev_mem *mio = iod;
+  const char *p = buf;
+  size_t nchunks;
 
   if (offset + count > mio->size + MEM_STEP)
     return IOD_EOF;
 
-  if (offset + count > mio->size)
+  /* Make room in the table for the chunks covering the range.  The
+     table grows geometrically.  */
+  nchunks = (offset + count + MEM_CHUNK_SIZE - 1) / MEM_CHUNK_SIZE;
+  if (nchunks > mio->nchunks)
     {
-      void *pointer_bak = mio->pointer;
+      size_t new_nchunks = mio->nchunks == 0 ? 1 : mio->nchunks;
+      char **chunks;
+
+      while (new_nchunks < nchunks)
+        new_nchunks *= 2;
+      chunks = realloc (mio->chunks, new_nchunks * sizeof (char *));
+      if (!chunks)
+        return IOD_ERROR;
+      memset (chunks + mio->nchunks, 0,
+              (new_nchunks - mio->nchunks) * sizeof (char *));
+      mio->chunks = chunks;
+      mio->nchunks = new_nchunks;
+    }
 
-      mio->pointer = realloc (mio->pointer, mio->size + MEM_STEP);
-      if (!mio->pointer)
+  while (count > 0)
+    {
+      size_t n = offset / MEM_CHUNK_SIZE;
+      size_t off = offset % MEM_CHUNK_SIZE;
+      size_t len = MEM_CHUNK_SIZE - off;
+
+      if (len > count)
+        len = count;
+
+      if (mio->chunks[n] == NULL)
         {
-          /* Restore pointer after failed realloc and return error. */
-          mio->pointer = pointer_bak;
-          return IOD_ERROR;
+          /* Writing zeros to an unallocated chunk is a no-op.  */
+          if (ios_dev_mem_zero_p (p, len))
+            goto next;
+
+          mio->chunks[n] = calloc (MEM_CHUNK_SIZE, 1);
+          if (!mio->chunks[n])
+            return IOD_ERROR;
         }
+      memcpy (mio->chunks[n] + off, p, len);
 
-      memset (&mio->pointer[mio->size], 0, MEM_STEP);
-      mio->size += MEM_STEP;
+    next:
+      p += len;
+      offset += len;
+      count -= len;
     }
 
-  memcpy (&mio->pointer[offset], buf, count);
+  /* The size grows by a single step, as the writes can't extend past
+     the end of the device by more than that.  */
+  if (offset > mio->size)
+    mio->size += MEM_STEP;
+
   return 0;
 }
 
@@ -182,4 +283,5 @@ struct ios_dev_if ios_dev_mem =
    .size = ios_dev_mem_size,
    .flush = ios_dev_mem_flush,
    .volatile_by_default = ios_dev_mem_volatile_by_default,
+   .get_ptr = ios_dev_mem_get_ptr,
   };
@@ -357,6 +357,23 @@ ios_dev_mmap_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   return IOD_OK;
 }
 
+static const void *
+ios_dev_mmap_get_ptr (void *iod, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_mmap *dev_map = iod;
+
+  /* Mappings of devices other than regular files may not support
+     arbitrary accesses, and are read using accesses of the size of
+     the address bus.  See ios_dev_mmap_pread.  */
+  if (!dev_map->reg_file)
+    return NULL;
+
+  if (offset > dev_map->size || count > dev_map->size - offset)
+    return NULL;
+
+  return (const uint8_t *) dev_map->addr + offset;
+}
+
 static int
 ios_dev_mmap_pwrite (void *iod, const void *buf, size_t count,
                      ios_dev_off offset)
@@ -416,6 +433,18 @@ ios_dev_mmap_size (void *iod)
   return dev_map->size;
 }
 
+static int
+ios_dev_mmap_mtime (void *iod, int64_t *mtime)
+{
+  struct stat st;
+  struct ios_dev_mmap *dev_map = iod;
+
+  if (fstat (dev_map->fd, &st) == -1)
+    return IOD_ERROR;
+  *mtime = st.st_mtime;
+  return IOD_OK;
+}
+
 static int
 ios_dev_mmap_flush (void *iod, ios_dev_off offset)
 {
@@ -450,4 +479,6 @@ struct ios_dev_if ios_dev_mmap =
     .size = ios_dev_mmap_size,
     .flush = ios_dev_mmap_flush,
     .volatile_by_default = ios_dev_mmap_volatile_by_default,
+    .get_ptr = ios_dev_mmap_get_ptr,
+    .mtime = ios_dev_mmap_mtime,
   };
@@ -28,7 +28,40 @@
 #include "ios.h"
 #include "ios-dev.h"
 
-/* State associated with an NBD device.  */
+/* Maximum number of asynchronous read requests in flight, and size
+   in bytes of each request.  */
+
+#define IOS_DEV_NBD_QUEUE_LEN 8
+#define IOS_DEV_NBD_REQ_SIZE  65536
+
+/* An asynchronous read request, for COUNT bytes at byte offset
+   OFFSET, to be stored in BUF.  COOKIE identifies the request in
+   libnbd while it is pending.  */
+
+enum ios_dev_nbd_req_state
+{
+  IOS_DEV_NBD_REQ_FREE,
+  IOS_DEV_NBD_REQ_PENDING,
+  IOS_DEV_NBD_REQ_DONE
+};
+
+struct ios_dev_nbd_req
+{
+  enum ios_dev_nbd_req_state state;
+  ios_dev_off offset;
+  size_t count;
+  int64_t cookie;
+  uint8_t buf[IOS_DEV_NBD_REQ_SIZE];
+};
+
+/* State associated with an NBD device.
+
+   QUEUE holds the asynchronous read requests issued as the result of
+   prefetch hints.  The range of the device that was hinted to be
+   read, and that has not been requested yet, is [PF_NEXT,PF_END).
+   Every time a request gets consumed by a read, new requests are
+   issued from that range, so the server is kept busy while the data
+   already received is being decoded.  */
 
 struct ios_dev_nbd
 {
@@ -36,6 +69,9 @@ struct ios_dev_nbd
   char *uri;
   ios_dev_off size;
   uint64_t flags;
+  ios_dev_off pf_next;
+  ios_dev_off pf_end;
+  struct ios_dev_nbd_req queue[IOS_DEV_NBD_QUEUE_LEN];
 };
 
 static bool
@@ -99,7 +135,7 @@ ios_dev_nbd_open (const char *handler, uint64_t flags, int *error,
   if (size < 0)
     goto err;
 
-  nio = malloc (sizeof *nio);
+  nio = calloc (1, sizeof *nio);
   if (!nio)
     {
       internal_error = IOD_ENOMEM;
@@ -138,7 +174,9 @@ ios_dev_nbd_close (void *iod)
 {
   struct ios_dev_nbd *nio = iod;
 
-  /* Should this flush when possible?  */
+  /* Should this flush when possible?  Note that closing the handle
+     discards any pending request, so it is safe to free the queue
+     afterwards.  */
   nbd_close (nio->nbd);
   free (nio->uri);
   free (nio);
@@ -154,12 +192,217 @@ ios_dev_nbd_get_flags (void *iod)
   return nio->flags;
 }
 
+/* Wait for the given request to complete.  If it fails, the request
+   is freed.  */
+
+static int
+ios_dev_nbd_req_wait (struct ios_dev_nbd *nio, struct ios_dev_nbd_req *req)
+{
+  int r;
+
+  if (req->state != IOS_DEV_NBD_REQ_PENDING)
+    return IOD_OK;
+
+  while ((r = nbd_aio_command_completed (nio->nbd, req->cookie)) == 0)
+    if (nbd_poll (nio->nbd, -1) == -1)
+      {
+        r = -1;
+        break;
+      }
+
+  if (r == -1)
+    {
+      req->state = IOS_DEV_NBD_REQ_FREE;
+      return IOD_EOF;
+    }
+
+  req->state = IOS_DEV_NBD_REQ_DONE;
+  return IOD_OK;
+}
+
+/* Issue requests for the hinted range until the queue is full.  */
+
+static void
+ios_dev_nbd_queue_fill (struct ios_dev_nbd *nio)
+{
+  for (int i = 0;
+       i < IOS_DEV_NBD_QUEUE_LEN && nio->pf_next < nio->pf_end;
+       ++i)
+    {
+      struct ios_dev_nbd_req *req = &nio->queue[i];
+
+      if (req->state != IOS_DEV_NBD_REQ_FREE)
+        continue;
+
+      req->offset = nio->pf_next;
+      req->count = IOS_DEV_NBD_REQ_SIZE;
+      if (req->count > nio->pf_end - nio->pf_next)
+        req->count = nio->pf_end - nio->pf_next;
+
+      req->cookie = nbd_aio_pread (nio->nbd, req->buf, req->count,
+                                   req->offset, NBD_NULL_COMPLETION, 0);
+      if (req->cookie == -1)
+        {
+          /* Give up on the hint.  Reads will be synchronous.  */
+          nio->pf_next = nio->pf_end;
+          break;
+        }
+
+      req->state = IOS_DEV_NBD_REQ_PENDING;
+      nio->pf_next += req->count;
+    }
+}
+
+/* Return the queued request containing the byte at OFFSET, or NULL
+   if there is none.  */
+
+static struct ios_dev_nbd_req *
+ios_dev_nbd_queue_lookup (struct ios_dev_nbd *nio, ios_dev_off offset)
+{
+  for (int i = 0; i < IOS_DEV_NBD_QUEUE_LEN; ++i)
+    {
+      struct ios_dev_nbd_req *req = &nio->queue[i];
+
+      if (req->state != IOS_DEV_NBD_REQ_FREE
+          && offset >= req->offset
+          && offset - req->offset < req->count)
+        return req;
+    }
+
+  return NULL;
+}
+
 static int
 ios_dev_nbd_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_nbd *nio = iod;
+  uint8_t *p = buf;
+  int ret = IOD_OK;
 
-  return nbd_pread (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
+  /* Serve as much as possible from the queued requests.  */
+  while (count > 0)
+    {
+      struct ios_dev_nbd_req *req = ios_dev_nbd_queue_lookup (nio, offset);
+      size_t len;
+
+      if (req == NULL || ios_dev_nbd_req_wait (nio, req) != IOD_OK)
+        break;
+
+      len = req->count - (offset - req->offset);
+      if (len > count)
+        len = count;
+      memcpy (p, req->buf + (offset - req->offset), len);
+      p += len;
+      offset += len;
+      count -= len;
+
+      /* Reads usually proceed forward, so once the end of a request
+         has been read, it is not needed anymore.  */
+      if (offset == req->offset + req->count)
+        req->state = IOS_DEV_NBD_REQ_FREE;
+    }
+
+  if (count > 0
+      && nbd_pread (nio->nbd, p, count, offset, 0) == -1)
+    ret = IOD_EOF;
+
+  ios_dev_nbd_queue_fill (nio);
+  return ret;
+}
+
+static int
+ios_dev_nbd_preadv (void *iod, const struct ios_dev_iovec *iov,
+                    size_t iovcnt)
+{
+  struct ios_dev_nbd *nio = iod;
+  int64_t *cookies;
+  int ret = IOD_OK;
+  size_t i;
+
+  cookies = malloc (iovcnt * sizeof (int64_t));
+  if (!cookies)
+    return IOD_ENOMEM;
+
+  /* Issue all the requests before waiting for any of them, so we pay
+     for a single round trip to the server.  */
+  for (i = 0; i < iovcnt; ++i)
+    {
+      cookies[i] = nbd_aio_pread (nio->nbd, iov[i].buf, iov[i].count,
+                                  iov[i].offset, NBD_NULL_COMPLETION, 0);
+      if (cookies[i] == -1)
+        {
+          ret = IOD_EOF;
+          break;
+        }
+    }
+
+  /* Wait for all the requests that were issued, since they write into
+     the buffers of the caller.  */
+  iovcnt = i;
+  for (i = 0; i < iovcnt; ++i)
+    {
+      int r;
+
+      while ((r = nbd_aio_command_completed (nio->nbd, cookies[i])) == 0)
+        if (nbd_poll (nio->nbd, -1) == -1)
+          {
+            r = -1;
+            break;
+          }
+
+      if (r == -1)
+        ret = IOD_EOF;
+    }
+
+  free (cookies);
+  return ret;
+}
+
+static int
+ios_dev_nbd_prefetch (void *iod, ios_dev_off offset, size_t count)
+{
+  struct ios_dev_nbd *nio = iod;
+
+  /* Discard the data received for requests outside of the new range.
+     The pending ones may still be useful, and anyway libnbd is
+     writing into their buffers.  If we are told to discard
+     everything, wait for them.  */
+  for (int i = 0; i < IOS_DEV_NBD_QUEUE_LEN; ++i)
+    {
+      struct ios_dev_nbd_req *req = &nio->queue[i];
+
+      if (count == 0)
+        {
+          (void) ios_dev_nbd_req_wait (nio, req);
+          req->state = IOS_DEV_NBD_REQ_FREE;
+        }
+      else if (req->state == IOS_DEV_NBD_REQ_DONE
+               && (req->offset + req->count <= offset
+                   || req->offset >= offset + count))
+        req->state = IOS_DEV_NBD_REQ_FREE;
+    }
+
+  if (offset >= nio->size)
+    count = 0;
+  else if (count > nio->size - offset)
+    count = nio->size - offset;
+
+  nio->pf_next = offset;
+  nio->pf_end = offset + count;
+
+  /* Do not request again what is already queued.  */
+  while (nio->pf_next < nio->pf_end)
+    {
+      struct ios_dev_nbd_req *req
+        = ios_dev_nbd_queue_lookup (nio, nio->pf_next);
+
+      if (req == NULL)
+        break;
+      nio->pf_next = req->offset + req->count;
+    }
+
+  ios_dev_nbd_queue_fill (nio);
+  return IOD_OK;
 }
 
 static int
@@ -168,6 +411,21 @@ ios_dev_nbd_pwrite (void *iod, const void *buf, size_t count,
 {
   struct ios_dev_nbd *nio = iod;
 
+  /* Queued requests overlapping the written range would return stale
+     data.  */
+  for (int i = 0; i < IOS_DEV_NBD_QUEUE_LEN; ++i)
+    {
+      struct ios_dev_nbd_req *req = &nio->queue[i];
+
+      if (req->state != IOS_DEV_NBD_REQ_FREE
+          && req->offset < offset + count
+          && offset < req->offset + req->count)
+        {
+          (void) ios_dev_nbd_req_wait (nio, req);
+          req->state = IOS_DEV_NBD_REQ_FREE;
+        }
+    }
+
   return nbd_pwrite (nio->nbd, buf, count, offset, 0) == -1 ? IOD_EOF : 0;
 }
 
@@ -203,4 +461,6 @@ struct ios_dev_if ios_dev_nbd =
    .size = ios_dev_nbd_size,
    .flush = ios_dev_nbd_flush,
    .volatile_by_default = ios_dev_nbd_volatile_by_default,
+   .preadv = ios_dev_nbd_preadv,
+   .prefetch = ios_dev_nbd_prefetch,
   };
@@ -17,13 +17,34 @@
  */
 
 /* This file implements an IO device that can be used in order to edit
-   the memory mapped for live running processes.  */
+   the memory mapped for live running processes.
+
+   Where available, the memory of the process is accessed using the
+   process_vm_readv and process_vm_writev system calls, which don't
+   need to seek and can perform several transfers at once.  The file
+   /proc/PID/mem is used otherwise, and also for the accesses these
+   calls can't perform, like writing to read-only pages.
+
+   The list of memory regions of the process, which is read from
+   /proc/PID/maps, is kept so accesses to unmapped addresses fail
+   without asking the kernel.  The process can map and unmap memory
+   at any time, so the list is read again if an address is not found
+   in it and it may be outdated.  It becomes outdated every time the
+   contents of the IO space are invalidated, or when the IO space is
+   flushed.  */
 
 #include <config.h>
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdio.h>
 #include <string.h>
+#include <errno.h>
+#include <limits.h>
 #include <sys/types.h>
+#ifdef HAVE_PROCESS_VM_READV
+# include <sys/uio.h>
+#endif
 
 #include "ios.h"
 #include "ios-dev.h"
@@ -32,13 +53,46 @@
 /* This IOD makes use of the file IOD machinery internally.  */
 extern struct ios_dev_if ios_dev_file;
 
-/* State associated with a proc device.  */
+/* Maximum number of transfers performed by a single call to
+   process_vm_readv.  */
+
+#ifdef IOV_MAX
+# define IOS_PROC_MAX_IOV (IOV_MAX < 64 ? IOV_MAX : 64)
+#else
+# define IOS_PROC_MAX_IOV 16
+#endif
+
+/* A range of contiguous mapped addresses [BEGIN,END).  */
+
+struct ios_dev_proc_region
+{
+  uint64_t begin;
+  uint64_t end;
+};
+
+/* State associated with a proc device.
+
+   REGIONS is a table of NUM_REGIONS memory regions of the process,
+   sorted by address, and MAX_REGIONS is its allocated size.  If
+   REGIONS_P is zero then the regions of the process are unknown and
+   not checked.  STALE_P tells whether the process may have changed
+   its memory map since the table was filled.
+
+   VM_P tells whether process_vm_readv and process_vm_writev can be
+   used.  */
 
 struct ios_dev_proc
 {
   pid_t pid;
   char *memfile_path;
   void *memfile;
+  char *maps_path;
+  struct ios_dev_proc_region *regions;
+  size_t num_regions;
+  size_t max_regions;
+  int regions_p;
+  int stale_p;
+  int vm_p;
 };
 
 static const char *
@@ -70,6 +124,122 @@ ios_dev_proc_handler_normalize (const char *handler, uint64_t flags, int *error)
   return new_handler;
 }
 
+/* Read the memory regions of the process from /proc/PID/maps.
+   Regions that are adjacent are merged.  If the file can't be read
+   then the regions are not checked.  */
+
+static void
+ios_dev_proc_load_regions (struct ios_dev_proc *proc)
+{
+  FILE *fp;
+  char *line = NULL;
+  size_t line_size = 0;
+
+  proc->num_regions = 0;
+  proc->regions_p = 0;
+  proc->stale_p = 0;
+
+  fp = fopen (proc->maps_path, "r");
+  if (!fp)
+    return;
+
+  while (getline (&line, &line_size, fp) != -1)
+    {
+      uint64_t begin, end;
+      char *p;
+
+      /* Every line starts with BEGIN-END, in hexadecimal.  */
+      begin = strtoull (line, &p, 16);
+      if (*p != '-')
+        goto error;
+      end = strtoull (p + 1, &p, 16);
+      if (*p != ' ' || end < begin)
+        goto error;
+
+      if (proc->num_regions > 0
+          && proc->regions[proc->num_regions - 1].end == begin)
+        {
+          proc->regions[proc->num_regions - 1].end = end;
+          continue;
+        }
+
+      if (proc->num_regions == proc->max_regions)
+        {
+          size_t max_regions
+            = proc->max_regions ? proc->max_regions * 2 : 64;
+          struct ios_dev_proc_region *regions
+            = realloc (proc->regions, max_regions * sizeof (*regions));
+
+          if (!regions)
+            goto error;
+          proc->regions = regions;
+          proc->max_regions = max_regions;
+        }
+
+      proc->regions[proc->num_regions].begin = begin;
+      proc->regions[proc->num_regions].end = end;
+      proc->num_regions++;
+    }
+
+  proc->regions_p = 1;
+  free (line);
+  fclose (fp);
+  return;
+
+ error:
+  proc->num_regions = 0;
+  free (line);
+  fclose (fp);
+}
+
+/* Return whether the COUNT bytes at address OFFSET are mapped in the
+   process, according to the memory regions of PROC.  */
+
+static int
+ios_dev_proc_mapped_p_1 (struct ios_dev_proc *proc,
+                         ios_dev_off offset, size_t count)
+{
+  size_t lo = 0, hi = proc->num_regions;
+
+  if (count > UINT64_MAX - offset)
+    return 0;
+
+  /* Find the last region starting at or before OFFSET.  */
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (proc->regions[mid].begin <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return (lo > 0
+          && offset + count <= proc->regions[lo - 1].end);
+}
+
+static int
+ios_dev_proc_mapped_p (struct ios_dev_proc *proc,
+                       ios_dev_off offset, size_t count)
+{
+  if (!proc->regions_p)
+    return 1;
+
+  if (ios_dev_proc_mapped_p_1 (proc, offset, count))
+    return 1;
+
+  /* The address may have been mapped after the regions were read.  */
+  if (proc->stale_p)
+    {
+      ios_dev_proc_load_regions (proc);
+      return !proc->regions_p || ios_dev_proc_mapped_p_1 (proc, offset,
+                                                         count);
+    }
+
+  return 0;
+}
+
 static void *
 ios_dev_proc_open (const char *handler, uint64_t flags, int *error,
                    void *data __attribute__ ((unused)))
@@ -111,16 +281,39 @@ ios_dev_proc_open (const char *handler, uint64_t flags, int *error,
       return NULL;
     }
 
+  proc->maps_path
+    = pk_str_concat ("/proc/", handler + 6, "/maps", NULL);
+  if (proc->maps_path == NULL)
+    {
+      free (proc->memfile_path);
+      free (proc);
+      if (error)
+        *error = IOD_ENOMEM;
+      return NULL;
+    }
+
   proc->memfile = ios_dev_file.open (proc->memfile_path,
                                      IOS_F_READ | IOS_F_WRITE,
                                      error, NULL);
   if (proc->memfile == NULL)
     {
+      free (proc->maps_path);
+      free (proc->memfile_path);
       free (proc);
       /* Note `error' is initialized by ios_dev_file.open.  */
       return NULL;
     }
 
+  proc->regions = NULL;
+  proc->max_regions = 0;
+  ios_dev_proc_load_regions (proc);
+
+#ifdef HAVE_PROCESS_VM_READV
+  proc->vm_p = 1;
+#else
+  proc->vm_p = 0;
+#endif
+
   if (error)
     *error = IOD_OK;
   return proc;
@@ -133,6 +326,8 @@ ios_dev_proc_close (void *iod)
   int ret;
 
   ret = ios_dev_file.close (proc->memfile);
+  free (proc->regions);
+  free (proc->maps_path);
   free (proc->memfile_path);
   free (proc);
 
@@ -145,18 +340,127 @@ ios_dev_proc_get_flags (void *iod)
   return IOS_F_READ | IOS_F_WRITE;
 }
 
+#ifdef HAVE_PROCESS_VM_READV
+
+/* Perform the IOVCNT transfers described by IOV using
+   process_vm_readv, or process_vm_writev if WRITE_P is not zero.
+   Return whether all the transfers were performed.  */
+
+static int
+ios_dev_proc_vm_rw (struct ios_dev_proc *proc, int write_p,
+                    const struct ios_dev_iovec *iov, size_t iovcnt)
+{
+  struct iovec local[IOS_PROC_MAX_IOV], remote[IOS_PROC_MAX_IOV];
+  size_t i, total = 0;
+  ssize_t ret;
+
+  if (!proc->vm_p)
+    return 0;
+
+  for (i = 0; i < iovcnt; ++i)
+    {
+      if (iov[i].offset > UINTPTR_MAX
+          || iov[i].count > UINTPTR_MAX - iov[i].offset
+          || iov[i].count > SSIZE_MAX - total)
+        return 0;
+
+      local[i].iov_base = iov[i].buf;
+      local[i].iov_len = iov[i].count;
+      remote[i].iov_base = (void *) (uintptr_t) iov[i].offset;
+      remote[i].iov_len = iov[i].count;
+      total += iov[i].count;
+    }
+
+  if (write_p)
+    ret = process_vm_writev (proc->pid, local, iovcnt, remote, iovcnt, 0);
+  else
+    ret = process_vm_readv (proc->pid, local, iovcnt, remote, iovcnt, 0);
+
+  /* Do not insist if the kernel doesn't provide the calls.  */
+  if (ret == -1 && errno == ENOSYS)
+    proc->vm_p = 0;
+
+  return ret != -1 && (size_t) ret == total;
+}
+
+#endif /* HAVE_PROCESS_VM_READV */
+
 static int
 ios_dev_proc_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
   struct ios_dev_proc *proc = iod;
+
+  if (!ios_dev_proc_mapped_p (proc, offset, count))
+    return IOD_ERROR;
+
+#ifdef HAVE_PROCESS_VM_READV
+  {
+    struct ios_dev_iovec iov = { buf, count, offset };
+
+    if (ios_dev_proc_vm_rw (proc, 0 /* write_p */, &iov, 1))
+      return IOD_OK;
+  }
+#endif
+
   return ios_dev_file.pread (proc->memfile, buf, count, offset);
 }
 
+static int
+ios_dev_proc_preadv (void *iod, const struct ios_dev_iovec *iov,
+                     size_t iovcnt)
+{
+  struct ios_dev_proc *proc = iod;
+  size_t i;
+
+  for (i = 0; i < iovcnt; ++i)
+    if (!ios_dev_proc_mapped_p (proc, iov[i].offset, iov[i].count))
+      return IOD_ERROR;
+
+  while (iovcnt > 0)
+    {
+      size_t n = iovcnt < IOS_PROC_MAX_IOV ? iovcnt : IOS_PROC_MAX_IOV;
+
+#ifdef HAVE_PROCESS_VM_READV
+      if (!ios_dev_proc_vm_rw (proc, 0 /* write_p */, iov, n))
+#endif
+        {
+          /* Perform the transfers one by one.  */
+          for (i = 0; i < n; ++i)
+            {
+              int ret = ios_dev_file.pread (proc->memfile, iov[i].buf,
+                                            iov[i].count, iov[i].offset);
+              if (ret != IOD_OK)
+                return ret;
+            }
+        }
+
+      iov += n;
+      iovcnt -= n;
+    }
+
+  return IOD_OK;
+}
+
 static int
 ios_dev_proc_pwrite (void *iod, const void *buf, size_t count,
                      ios_dev_off offset)
 {
   struct ios_dev_proc *proc = iod;
+
+  if (!ios_dev_proc_mapped_p (proc, offset, count))
+    return IOD_ERROR;
+
+#ifdef HAVE_PROCESS_VM_READV
+  {
+    struct ios_dev_iovec iov = { (void *) buf, count, offset };
+
+    /* Note that this fails for read-only pages, which can still be
+       written using the mem file below.  */
+    if (ios_dev_proc_vm_rw (proc, 1 /* write_p */, &iov, 1))
+      return IOD_OK;
+  }
+#endif
+
   return ios_dev_file.pwrite (proc->memfile, buf, count, offset);
 }
 
@@ -169,7 +473,29 @@ ios_dev_proc_size (void *iod)
 static int
 ios_dev_proc_flush (void *iod, ios_dev_off offset)
 {
-  return IOS_OK;
+  struct ios_dev_proc *proc = iod;
+
+  /* The memory map of the process is checked again when needed.  */
+  proc->stale_p = 1;
+  return ios_dev_file.flush (proc->memfile, offset);
+}
+
+static int
+ios_dev_proc_prefetch (void *iod, ios_dev_off offset, size_t count)
+{
+  struct ios_dev_proc *proc = iod;
+
+  /* The IO space is volatile, so this is called with a zero COUNT
+     whenever its contents may have changed.  The memory map of the
+     process may have changed as well.  */
+  if (count == 0)
+    {
+      proc->stale_p = 1;
+      return ios_dev_file.flush (proc->memfile, 0);
+    }
+
+  /* Let the cache fetch the data.  */
+  return IOD_EINVAL;
 }
 
 static int
@@ -190,4 +516,6 @@ struct ios_dev_if ios_dev_proc =
    .size = ios_dev_proc_size,
    .flush = ios_dev_proc_flush,
    .volatile_by_default = ios_dev_proc_volatile_by_default,
+   .preadv = ios_dev_proc_preadv,
+   .prefetch = ios_dev_proc_prefetch,
   };
@@ -0,0 +1,395 @@
+/* ios-dev-shared.c - Read-only IO devices shared by several IO contexts.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/* This file implements an IO device that gives access to a device
+   opened read-only, which is shared by all the IO spaces that are
+   opened with the IOS_F_SHARED flag on the same handler, in any IO
+   context of the process.  This allows several PVMs, running in
+   different threads, to read the same file out of a single file
+   descriptor and a single block cache.
+
+   Only the device and its contents are shared: every IO space keeps
+   its own range table, map cache, statistics, etc., which are
+   accessed by the thread using its IO context only.
+
+   The shared devices are kept in a process-wide registry, protected
+   by a mutex, and are reference counted.  The blocks of the cache
+   are protected by sequence counters instead, so reading cached data
+   doesn't take any lock: a reader copies the data out of the block
+   and then checks that the sequence counter of the block didn't
+   change meanwhile, retrying through the slow path if it did.
+   Filling a block, which requires reading from the device, is done
+   with the mutex of the shared device held, so the underlying device
+   is never accessed by two threads at the same time.  */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "ios.h"
+#include "ios-dev.h"
+
+#define IOS_DEV_SHARED_BLOCK_SIZE 4096
+#define IOS_DEV_SHARED_NBLOCKS 1024
+
+/* A block of the cache of a shared device.
+
+   SEQ is the sequence counter of the block.  It is odd while the
+   block is being filled, and it is incremented twice every time the
+   block is filled.
+
+   TAG is the number of the block of the device held in DATA plus one,
+   or zero if the block is empty.  LEN is the number of valid bytes in
+   DATA, which is less than the size of the block only for the last
+   block of the device.  */
+
+struct ios_dev_shared_block
+{
+  uint64_t seq;
+  uint64_t tag;
+  size_t len;
+  uint8_t data[IOS_DEV_SHARED_BLOCK_SIZE];
+};
+
+/* State associated with a shared device.
+
+   DEV_IF and DEV are the interface and the underlying device.
+   HANDLER is the normalized handler used to open it.  FLAGS are the
+   flags passed to its open function, and DEV_FLAGS the flags
+   reported by the device.  SIZE is the size of the device, which
+   doesn't change since it is read-only.
+
+   LOCK serializes the accesses to the underlying device and the
+   filling of blocks.  REFCOUNT is the number of IO spaces using the
+   shared device, and it is protected by the registry lock.  */
+
+struct ios_dev_shared
+{
+  const struct ios_dev_if *dev_if;
+  void *dev;
+  char *handler;
+  uint64_t flags;
+  uint64_t dev_flags;
+  ios_dev_off size;
+  int refcount;
+  pthread_mutex_t lock;
+  struct ios_dev_shared_block *blocks;
+  struct ios_dev_shared *next;
+};
+
+static pthread_mutex_t ios_dev_shared_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct ios_dev_shared *ios_dev_shared_registry;
+
+static const char *
+ios_dev_shared_get_if_name ()
+{
+  return "SHARED";
+}
+
+/* Shared devices are never selected by their handler; see
+   ios_dev_shared_attach.  */
+
+static char *
+ios_dev_shared_handler_normalize (const char *handler, uint64_t flags,
+                                  int *error)
+{
+  if (error)
+    *error = IOD_OK;
+  return NULL;
+}
+
+static void *
+ios_dev_shared_open (const char *handler, uint64_t flags, int *error,
+                     void *data)
+{
+  if (error)
+    *error = IOD_EINVAL;
+  return NULL;
+}
+
+void *
+ios_dev_shared_attach (const struct ios_dev_if *dev_if,
+                       const char *handler, const char *normalized_handler,
+                       uint64_t flags, int *error)
+{
+  struct ios_dev_shared *shared;
+  int iod_error = IOD_OK;
+
+  pthread_mutex_lock (&ios_dev_shared_registry_lock);
+
+  for (shared = ios_dev_shared_registry; shared; shared = shared->next)
+    if (shared->dev_if == dev_if
+        && shared->flags == flags
+        && strcmp (shared->handler, normalized_handler) == 0)
+      {
+        shared->refcount++;
+        goto done;
+      }
+
+  shared = calloc (1, sizeof (struct ios_dev_shared));
+  if (!shared)
+    {
+      iod_error = IOD_ENOMEM;
+      goto done;
+    }
+
+  shared->handler = strdup (normalized_handler);
+  shared->blocks = calloc (IOS_DEV_SHARED_NBLOCKS,
+                           sizeof (struct ios_dev_shared_block));
+  if (!shared->handler || !shared->blocks)
+    {
+      iod_error = IOD_ENOMEM;
+      goto error;
+    }
+
+  shared->dev = dev_if->open (handler, flags, &iod_error, NULL);
+  if (iod_error != IOD_OK || shared->dev == NULL)
+    {
+      if (iod_error == IOD_OK)
+        iod_error = IOD_ERROR;
+      goto error;
+    }
+
+  shared->dev_if = dev_if;
+  shared->flags = flags;
+  shared->dev_flags = dev_if->get_flags (shared->dev);
+  shared->size = dev_if->size (shared->dev);
+  shared->refcount = 1;
+  pthread_mutex_init (&shared->lock, NULL);
+
+  shared->next = ios_dev_shared_registry;
+  ios_dev_shared_registry = shared;
+  goto done;
+
+ error:
+  free (shared->handler);
+  free (shared->blocks);
+  free (shared);
+  shared = NULL;
+
+ done:
+  pthread_mutex_unlock (&ios_dev_shared_registry_lock);
+  if (error)
+    *error = iod_error;
+  return shared;
+}
+
+static int
+ios_dev_shared_close (void *iod)
+{
+  struct ios_dev_shared *shared = iod;
+  struct ios_dev_shared **p;
+  int ret = IOD_OK;
+
+  pthread_mutex_lock (&ios_dev_shared_registry_lock);
+
+  if (--shared->refcount > 0)
+    {
+      pthread_mutex_unlock (&ios_dev_shared_registry_lock);
+      return IOD_OK;
+    }
+
+  for (p = &ios_dev_shared_registry; *p != shared; p = &(*p)->next)
+    ;
+  *p = shared->next;
+
+  pthread_mutex_unlock (&ios_dev_shared_registry_lock);
+
+  ret = shared->dev_if->close (shared->dev);
+  pthread_mutex_destroy (&shared->lock);
+  free (shared->handler);
+  free (shared->blocks);
+  free (shared);
+  return ret;
+}
+
+/* Copy COUNT bytes starting at OFFSET in BLOCK, which holds the
+   block number BNUM, to BUF, without taking any lock.  Return 1 if
+   the block held the data during the whole copy, 0 otherwise.  */
+
+static int
+ios_dev_shared_copy_block (struct ios_dev_shared_block *block,
+                           uint64_t bnum, void *buf, size_t count,
+                           size_t offset)
+{
+  uint64_t seq = __atomic_load_n (&block->seq, __ATOMIC_ACQUIRE);
+
+  if ((seq & 1)
+      || __atomic_load_n (&block->tag, __ATOMIC_RELAXED) != bnum + 1
+      || __atomic_load_n (&block->len, __ATOMIC_RELAXED) < offset + count)
+    return 0;
+
+  /* The data may be overwritten while it is copied, in which case
+     the copy is discarded below.  */
+  memcpy (buf, block->data + offset, count);
+
+  __atomic_thread_fence (__ATOMIC_ACQUIRE);
+  return __atomic_load_n (&block->seq, __ATOMIC_RELAXED) == seq;
+}
+
+/* Fill BLOCK with the block number BNUM of the device.  This must
+   be called with the lock of SHARED held.  */
+
+static int
+ios_dev_shared_fill_block (struct ios_dev_shared *shared,
+                           struct ios_dev_shared_block *block,
+                           uint64_t bnum)
+{
+  ios_dev_off begin = bnum * IOS_DEV_SHARED_BLOCK_SIZE;
+  size_t len = (shared->size - begin < IOS_DEV_SHARED_BLOCK_SIZE
+                ? shared->size - begin : IOS_DEV_SHARED_BLOCK_SIZE);
+  uint64_t seq = block->seq;
+  int ret;
+
+  __atomic_store_n (&block->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence (__ATOMIC_RELEASE);
+
+  ret = shared->dev_if->pread (shared->dev, block->data, len, begin);
+  __atomic_store_n (&block->tag, ret == IOD_OK ? bnum + 1 : 0,
+                    __ATOMIC_RELAXED);
+  __atomic_store_n (&block->len, ret == IOD_OK ? len : 0, __ATOMIC_RELAXED);
+
+  __atomic_store_n (&block->seq, seq + 2, __ATOMIC_RELEASE);
+  return ret;
+}
+
+static int
+ios_dev_shared_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_shared *shared = iod;
+  uint8_t *p = buf;
+
+  if (offset > shared->size || count > shared->size - offset)
+    return IOD_EOF;
+
+  while (count > 0)
+    {
+      uint64_t bnum = offset / IOS_DEV_SHARED_BLOCK_SIZE;
+      size_t boff = offset % IOS_DEV_SHARED_BLOCK_SIZE;
+      size_t n = (count < IOS_DEV_SHARED_BLOCK_SIZE - boff
+                  ? count : IOS_DEV_SHARED_BLOCK_SIZE - boff);
+      struct ios_dev_shared_block *block
+        = &shared->blocks[bnum % IOS_DEV_SHARED_NBLOCKS];
+
+      if (!ios_dev_shared_copy_block (block, bnum, p, n, boff))
+        {
+          int ret = IOD_OK;
+
+          /* Slow path.  Another thread may have filled the block
+             while we were waiting for the lock.  */
+          pthread_mutex_lock (&shared->lock);
+          if (block->tag != bnum + 1)
+            ret = ios_dev_shared_fill_block (shared, block, bnum);
+          if (ret == IOD_OK)
+            memcpy (p, block->data + boff, n);
+          pthread_mutex_unlock (&shared->lock);
+
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      p += n;
+      offset += n;
+      count -= n;
+    }
+
+  return IOD_OK;
+}
+
+static int
+ios_dev_shared_pwrite (void *iod, const void *buf, size_t count,
+                       ios_dev_off offset)
+{
+  /* Shared devices are read-only.  */
+  return IOD_ERROR;
+}
+
+static uint64_t
+ios_dev_shared_get_flags (void *iod)
+{
+  struct ios_dev_shared *shared = iod;
+
+  return shared->dev_flags | IOS_F_SHARED;
+}
+
+static ios_dev_off
+ios_dev_shared_size (void *iod)
+{
+  struct ios_dev_shared *shared = iod;
+
+  return shared->size;
+}
+
+static int
+ios_dev_shared_flush (void *iod, ios_dev_off offset)
+{
+  return IOD_OK;
+}
+
+static int
+ios_dev_shared_volatile_by_default (void *iod, const char *handler)
+{
+  return 0;
+}
+
+/* The contents of devices providing direct pointers to their data,
+   like mmapped files, don't move nor change when they are opened
+   read-only, so these are used without locking.  */
+
+static const void *
+ios_dev_shared_get_ptr (void *iod, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_shared *shared = iod;
+
+  if (!shared->dev_if->get_ptr)
+    return NULL;
+  return shared->dev_if->get_ptr (shared->dev, count, offset);
+}
+
+static int
+ios_dev_shared_mtime (void *iod, int64_t *mtime)
+{
+  struct ios_dev_shared *shared = iod;
+  int ret;
+
+  if (!shared->dev_if->mtime)
+    return IOD_ERROR;
+
+  pthread_mutex_lock (&shared->lock);
+  ret = shared->dev_if->mtime (shared->dev, mtime);
+  pthread_mutex_unlock (&shared->lock);
+  return ret;
+}
+
+struct ios_dev_if ios_dev_shared =
+  {
+   .get_if_name = ios_dev_shared_get_if_name,
+   .handler_normalize = ios_dev_shared_handler_normalize,
+   .open = ios_dev_shared_open,
+   .close = ios_dev_shared_close,
+   .pread = ios_dev_shared_pread,
+   .pwrite = ios_dev_shared_pwrite,
+   .get_flags = ios_dev_shared_get_flags,
+   .size = ios_dev_shared_size,
+   .flush = ios_dev_shared_flush,
+   .volatile_by_default = ios_dev_shared_volatile_by_default,
+   .get_ptr = ios_dev_shared_get_ptr,
+   .mtime = ios_dev_shared_mtime,
+  };
@@ -32,6 +32,10 @@
 #define IOS_STDOUT_HANDLER      ("<stdout>")
 #define IOS_STDERR_HANDLER      ("<stderr>")
 
+/* Size of the chunks buffering the data read from the standard
+   input.  */
+#define IOS_STDIN_CHUNK_SIZE    (64 * 1024)
+
 /* State associated with a stream device.  */
 
 struct ios_dev_stream
@@ -94,7 +98,7 @@ ios_dev_stream_open (const char *handler, uint64_t flags, int *error,
     {
       sio->file = stdin;
       sio->flags = IOS_F_READ;
-      sio->buffer = ios_buffer_init ();
+      sio->buffer = ios_buffer_init (IOS_STDIN_CHUNK_SIZE);
       if (!sio->buffer)
         {
           internal_error = IOD_ENOMEM;
@@ -153,6 +157,41 @@ ios_dev_stream_get_flags (void *iod)
   return sio->flags;
 }
 
+/* Read from the stream into the buffer until the end of the buffer
+   reaches OFFSET.  If FORGET_P is set then the data is forgotten as
+   it is read, so the buffer doesn't grow.  Return IOD_EOF if the
+   stream ends before OFFSET.  */
+
+static int
+ios_dev_stream_fill (struct ios_dev_stream *sio, ios_dev_off offset,
+                     int forget_p)
+{
+  struct ios_buffer *buffer = sio->buffer;
+  char tmp[8192];
+
+  while (ios_buffer_get_end_offset (buffer) < offset)
+    {
+      ios_dev_off end_offset = ios_buffer_get_end_offset (buffer);
+      size_t count = offset - end_offset > sizeof (tmp)
+                     ? sizeof (tmp) : offset - end_offset;
+      size_t read_count = fread (tmp, 1, count, sio->file);
+      int ret;
+
+      if (read_count > 0)
+        {
+          ret = ios_buffer_pwrite (buffer, tmp, read_count, end_offset);
+          if (ret != IOD_OK)
+            return ret;
+          if (forget_p)
+            ios_buffer_forget_till (buffer, end_offset + read_count);
+        }
+      if (read_count < count)
+        return IOD_EOF;
+    }
+
+  return IOD_OK;
+}
+
 static int
 ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
 {
@@ -164,9 +203,18 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   if (sio->flags & IOS_F_WRITE)
     return IOD_ERROR;
 
-  /* If the beginning of the buffer is discarded, return EOF. */
+  /* The data preceding the forget point can't be read anymore.  This
+     is not an end of file, as the data existed.  */
   if (ios_buffer_get_begin_offset (buffer) > offset)
-    return IOD_EOF;
+    return IOD_EIOFF;
+
+  /* Buffer the data preceding OFFSET, if it hasn't been read yet.  */
+  if (ios_buffer_get_end_offset (buffer) < offset)
+    {
+      potential_error = ios_dev_stream_fill (sio, offset, 0 /* forget_p */);
+      if (potential_error != IOD_OK)
+        return potential_error;
+    }
 
   /* If the requested range is in the buffer, return it. */
   if (ios_buffer_get_end_offset (buffer) >= offset + count)
@@ -196,10 +244,12 @@ ios_dev_stream_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
     }
   while (total_read_count < count && read_count);
 
-  /* Write back to the buffer.  */
+  /* Write back to the buffer what has been actually read, so the
+     buffer keeps ending where the stream does.  */
   potential_error = ios_buffer_pwrite (buffer,
                                        buf + read_from_buffer_count,
-                                       count - read_from_buffer_count,
+                                       total_read_count
+                                       - read_from_buffer_count,
                                        ios_buffer_get_end_offset (buffer));
   if (potential_error != IOD_OK)
     return potential_error;
@@ -251,9 +301,21 @@ ios_dev_stream_flush (void *iod, ios_dev_off offset)
   struct ios_dev_stream *sio = iod;
 
   if (sio->flags & IOS_F_READ
-      && offset > ios_buffer_get_begin_offset (sio->buffer)
-      && offset <= ios_buffer_get_end_offset (sio->buffer))
-    return ios_buffer_forget_till (sio->buffer, offset);
+      && offset > ios_buffer_get_begin_offset (sio->buffer))
+    {
+      /* Data that hasn't been read yet is skipped without keeping
+         it.  */
+      if (offset > ios_buffer_get_end_offset (sio->buffer))
+        {
+          int ret = ios_dev_stream_fill (sio, offset, 1 /* forget_p */);
+
+          if (ret != IOD_OK && ret != IOD_EOF)
+            return ret;
+          if (offset > ios_buffer_get_end_offset (sio->buffer))
+            offset = ios_buffer_get_end_offset (sio->buffer);
+        }
+      return ios_buffer_forget_till (sio->buffer, offset);
+    }
   else if (sio->flags & IOS_F_WRITE)
     fflush (sio->file);
   return IOS_OK;
@@ -17,7 +17,15 @@
  */
 
 /* This file implements an IO device that exposes a subrange of some
-   other IO device.  */
+   other IO device.
+
+   Sub-range IO spaces don't have a cache of their own.  Every
+   operation is forwarded to the base IO space, and goes through its
+   cache, so the contents of both IO spaces are always in sync.  This
+   includes getting pointers to the data, so a sub-range of an IO
+   space whose contents are in memory can be read without copying.
+   Writes mark the range written as dirty in the base IO space, so
+   the values mapped in it are remapped.  */
 
 #include <config.h>
 
@@ -219,12 +227,12 @@ ios_dev_sub_pread (void *iod, void *buf, size_t count, ios_dev_off offset)
   if (ios_zombie_p (ios) || !(sub->flags & IOS_F_READ))
     return IOD_ERROR;
 
-  if (offset >= sub->size)
+  if (offset >= sub->size || count > sub->size - offset)
     return IOD_EOF;
 
-  return ios_get_dev_if (ios)->pread (ios_get_dev (ios),
-                                      buf, count,
-                                      sub->base + offset);
+  /* Go through the cache of the base IOS, so we don't get out of
+     sync with it.  */
+  return ios_pread (ios, buf, count, sub->base + offset);
 }
 
 static int
@@ -233,17 +241,70 @@ ios_dev_sub_pwrite (void *iod, const void *buf, size_t count,
 {
   struct ios_dev_sub *sub = iod;
   ios ios = sub->base_ios;
+  int ret;
 
   if (ios_zombie_p (ios) || !(sub->flags & IOS_F_WRITE))
     return IOD_ERROR;
 
   /* Sub-range IOS dot accept writes past the end of the IOS.  */
-  if (offset >= sub->size)
+  if (offset >= sub->size || count > sub->size - offset)
     return IOD_EOF;
 
-  return ios_get_dev_if (ios)->pwrite (ios_get_dev (ios),
-                                       buf, count,
-                                       sub->base + offset);
+  ret = ios_pwrite (ios, buf, count, sub->base + offset);
+  if (ret != IOD_OK)
+    return ret;
+
+  /* Values mapped in the base IOS are now stale.  */
+  ios_mark_dirty_range (ios, (sub->base + offset) * 8,
+                        (sub->base + offset + count) * 8);
+  return IOD_OK;
+}
+
+static const void *
+ios_dev_sub_get_ptr (void *iod, size_t count, ios_dev_off offset)
+{
+  struct ios_dev_sub *sub = iod;
+  ios ios = sub->base_ios;
+
+  if (ios_zombie_p (ios) || !(sub->flags & IOS_F_READ))
+    return NULL;
+
+  if (offset >= sub->size || count > sub->size - offset)
+    return NULL;
+
+  return ios_get_ptr (ios, count, sub->base + offset);
+}
+
+static int
+ios_dev_sub_prefetch (void *iod, ios_dev_off offset, size_t count)
+{
+  struct ios_dev_sub *sub = iod;
+  ios ios = sub->base_ios;
+
+  if (ios_zombie_p (ios))
+    return IOD_OK;
+
+  /* Only prefetch the part of the range that is within the
+     sub-range.  */
+  if (offset >= sub->size)
+    return IOD_OK;
+  if (count > sub->size - offset)
+    count = sub->size - offset;
+
+  return ios_pprefetch (ios, count, sub->base + offset);
+}
+
+static int
+ios_dev_sub_mtime (void *iod, int64_t *mtime)
+{
+  struct ios_dev_sub *sub = iod;
+  ios ios = sub->base_ios;
+
+  if (ios_zombie_p (ios))
+    return IOD_ERROR;
+
+  /* ios_mtime returns an IOS_* status code.  */
+  return ios_mtime (ios, mtime) == IOS_OK ? IOD_OK : IOD_EINVAL;
 }
 
 static ios_dev_off
@@ -279,4 +340,7 @@ struct ios_dev_if ios_dev_sub =
    .size = ios_dev_sub_size,
    .flush = ios_dev_sub_flush,
    .volatile_by_default = ios_dev_sub_volatile_by_default,
+   .get_ptr = ios_dev_sub_get_ptr,
+   .prefetch = ios_dev_sub_prefetch,
+   .mtime = ios_dev_sub_mtime,
   };
@@ -49,11 +49,83 @@ typedef uint64_t ios_dev_off;
 #define IOD_EMMAP  -7 /* Memory mapping error.  */
 #define IOD_ENOENT -8 /* Device not found.  */
 
+/* An entry in a batch of reads.  COUNT bytes at byte offset OFFSET
+   are to be read into BUF.  */
+
+struct ios_dev_iovec
+{
+  void *buf;
+  size_t count;
+  ios_dev_off offset;
+};
+
+/* Function called when an asynchronous read completes.  TAG is the
+   value passed when the read was issued, and STATUS is an IOD_*
+   status code.  */
+
+typedef void (*ios_dev_completion_fn) (void *tag, int status);
+
 /* Each IO backend should implement a device interface, by filling an
    instance of the struct defined below.
 
    See the pk_iod_if struct in libpoke.h for an explanation of the
-   interface functions.  */
+   interface functions.
+
+   GET_PTR is optional, and can be NULL.  Devices whose contents are
+   held in memory can implement it to return a pointer to the COUNT
+   bytes located at byte offset OFFSET, so the IO space can access
+   them without copying.  It returns NULL if the range is not
+   entirely contained in the device, or if the device doesn't hold
+   it contiguously in memory.  The returned pointer is only
+   valid until the next write or close operation on the device.
+
+   PREADV is optional, and can be NULL.  It performs the IOVCNT reads
+   described by the entries in IOV, which are not necessarily
+   contiguous.  Devices for which every request is expensive, like
+   network devices, can implement it in order to issue all the reads
+   at once.  It returns IOD_OK only if all the reads succeed.
+
+   PREFETCH is optional, and can be NULL.  It tells the device that
+   the COUNT bytes at byte offset OFFSET are about to be read, so it
+   can start fetching them in the background.  This replaces any
+   previous hint.  If COUNT is zero then any data fetched in advance
+   is discarded.  It returns IOD_EINVAL if the device doesn't fetch
+   data in advance, so the cache of the IO space can do it instead.
+
+   MTIME is optional, and can be NULL.  It stores in *MTIME the time
+   of the last modification of the underlying object, in seconds
+   since the Epoch.  Devices backed by files implement it so the
+   users can tell whether data derived from the contents of the
+   device is still valid.
+
+   COPY is optional, and can be NULL.  It copies the COUNT bytes at
+   byte offset OFFSET of DEV to byte offset DST_OFFSET of DST, which
+   is a device with the same interface, without moving the data
+   through user memory.  The ranges shall not overlap.  It returns
+   IOD_EINVAL without copying anything if the data can't be copied
+   that way, so the caller can use pread and pwrite instead.
+
+   NEXT_CHANGE is optional, and can be NULL.  Devices keeping changes
+   that have not reached the underlying storage yet can implement it
+   to store in *BEGIN and *END the first range of changed bytes ending
+   after byte offset OFFSET, starting no earlier than OFFSET.  It
+   returns IOD_EOF if there are no more changes.
+
+   DISCARD is optional, and can be NULL.  It drops the changes that
+   have not reached the underlying storage yet.
+
+   PREAD_ASYNC and POLL are optional, and can be NULL, but a device
+   implementing one of them shall implement both.  PREAD_ASYNC issues
+   a read of COUNT bytes at byte offset OFFSET into BUF and returns
+   IOD_OK without waiting for the data, unless the read can't be
+   issued.  DONE is then called with TAG and the status of the read
+   when it completes, which happens during a call to POLL.  POLL
+   processes the reads that have completed, waiting for at least one
+   of them if WAIT_P is not zero and there are pending reads.  It
+   returns IOD_EOF if there are no pending reads, and any other error
+   code only if DONE won't be called for the pending reads.  Devices
+   implementing these but not PREADV get their batches of reads
+   issued at once anyway.  */
 
 struct ios_dev_if
 {
@@ -67,6 +139,18 @@ struct ios_dev_if
   ios_dev_off (*size) (void *dev);
   int (*flush) (void *dev, ios_dev_off offset);
   int (*volatile_by_default) (void *dev, const char *handler);
+  const void * (*get_ptr) (void *dev, size_t count, ios_dev_off offset);
+  int (*preadv) (void *dev, const struct ios_dev_iovec *iov, size_t iovcnt);
+  int (*prefetch) (void *dev, ios_dev_off offset, size_t count);
+  int (*mtime) (void *dev, int64_t *mtime);
+  int (*copy) (void *dev, ios_dev_off offset, void *dst,
+               ios_dev_off dst_offset, size_t count);
+  int (*next_change) (void *dev, ios_dev_off offset,
+                      ios_dev_off *begin, ios_dev_off *end);
+  int (*discard) (void *dev);
+  int (*pread_async) (void *dev, void *buf, size_t count, ios_dev_off offset,
+                      ios_dev_completion_fn done, void *tag);
+  int (*poll) (void *dev, int wait_p);
 };
 
 #define IOS_FILE_HANDLER_NORMALIZE(handler, new_handler)                \
@@ -94,3 +178,26 @@ struct ios_dev_if
 
 extern void *ios_get_dev (ios ios);
 extern const struct ios_dev_if *ios_get_dev_if (ios ios);
+
+/* Read or write COUNT bytes at byte offset OFFSET of the device
+   operated by the IO space IOS.  Unlike calling the device interface
+   directly, these go through the cache of IOS.  Return an IOD_*
+   status code.  */
+
+extern int ios_pread (ios ios, void *buf, size_t count,
+                      ios_dev_off offset);
+extern int ios_pwrite (ios ios, const void *buf, size_t count,
+                       ios_dev_off offset);
+
+/* Return a pointer to the COUNT bytes at byte offset OFFSET of the
+   device operated by the IO space IOS, or NULL if they can't be
+   accessed directly.  The pointer is provided by the cache of IOS if
+   it has one.  See GET_PTR above.  */
+
+extern const void *ios_get_ptr (ios ios, size_t count, ios_dev_off offset);
+
+/* Tell the device operated by the IO space IOS, or its cache, that
+   the COUNT bytes at byte offset OFFSET are about to be read.  See
+   PREFETCH above.  Return an IOD_* status code.  */
+
+extern int ios_pprefetch (ios ios, size_t count, ios_dev_off offset);
@@ -28,63 +28,561 @@
 #include <gc/gc.h>
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <assert.h>
 
-typedef int (*payload_compar_fn)(pvm_val v1, pvm_val v2);
-
 /* The IOS range table tracks, for every pvm_val mapped in a given
    IOS, the interval where that val is mapped.  Its purpose is to
    be able to quickly determine which mapped values are affected
    by a write to the IOS at some interval.
 
-   The table is implemented as an augmented interval tree, a type of
-   self-balancing binary search tree specialized to storing intervals,
-   and facilitating quickly identifying all stored intervals which
-   overlap with some query interval.  */
+   The table is a flat interval index.  The entries are kept in a few
+   runs, which are arrays sorted by the beginning of the intervals.
+   Every run has an implicit augmented binary tree, an array holding
+   the highest end of the intervals below every node, which allows
+   to find all the entries of the run overlapping some interval
+   without looking at the rest.
+
+   New entries are appended to a small unsorted buffer.  When the
+   buffer gets full it is sorted into a new run, and runs of similar
+   sizes are merged, so there are only a logarithmic number of runs,
+   whose sizes decrease geometrically.  Values are usually mapped at
+   increasing offsets, and then the merges amount to concatenations.
+
+   The table holds weak references to the values: the entries don't
+   prevent the values from being collected.  Each entry refers to a
+   slot containing a disappearing link to the box of the value, which
+   is cleared by the garbage collector once the value is no longer
+   reachable.  The slots are never moved, since the links are
+   registered by address, but the entries are.  Entries whose link has
+   been cleared are dead, and so are the removed entries, which have
+   no slot.  Dead entries are dropped lazily when runs are merged, and
+   also when the table has grown enough since the last full sweep.
+   This avoids registering a finalizer for every mapped value.  */
+
+/* Slots containing the weak references to the values.  LINK is the
+   hidden pointer to the box of the value, registered as a
+   disappearing link.  It is zero if the value is dead.  NEXT_FREE
+   chains the free slots.  */
+
+struct ios_range_slot
+{
+  GC_hidden_pointer link;
+  struct ios_range_slot *next_free;
+};
 
-struct NODE_IMPL;
-struct ios_rangetbl
+#define IOS_RANGE_SLOT_CHUNK 256
+
+/* Entries of the table.  KEY is the value, hidden from the collector.
+   It is only used to order the entries and to identify them.  The
+   interval is [BEGIN, END].  SLOT is NULL if the entry has been
+   removed.  */
+
+struct ios_range_entry
 {
-  size_t count;                 /* Number of values currently tracked.  */
-  struct NODE_IMPL *root;       /* Root of the tree.  */
-  payload_compar_fn compar;     /* Payload comparison function.  */
+  ios_off begin;
+  ios_off end;
+  GC_hidden_pointer key;
+  struct ios_range_slot *slot;
 };
 
-/* Definitions for the tree implementation.  */
+/* Runs of entries, sorted by BEGIN and then by KEY.  MAXEND is the
+   implicit tree, whose nodes are numbered from 1, the children of
+   the node N being 2N and 2N+1.  The SIZE leaves, SIZE being the
+   smallest power of two not less than NENTRIES, hold the ends of the
+   intervals of the entries.  */
 
-typedef struct ios_rangetbl * CONTAINER_T;
+struct ios_range_run
+{
+  struct ios_range_entry *entries;
+  size_t nentries;
+  ios_off *maxend;
+  size_t size;
+};
 
-#define NODE_PAYLOAD_FIELDS pvm_val val;
-#define NODE_PAYLOAD_ASSIGN(node) \
-  (node->val) = val;
-#define NODE_PAYLOAD_PARAMS \
-  pvm_val val
-#define NODE_PAYLOAD_ARGS val
-#define NODE_PAYLOAD_ACCESS(node) \
-  (node->val)
+#define IOS_RANGE_BUFFER_SIZE 64
+#define IOS_RANGE_MAX_RUNS 64
+#define IOS_RANGE_OFF_MIN INT64_MIN
+
+struct ios_rangetbl
+{
+  size_t count;                 /* Number of values currently tracked.  */
+  size_t sweep_count;           /* Number of entries after last sweep.  */
+  /* Recently inserted entries, not sorted.  */
+  struct ios_range_entry buffer[IOS_RANGE_BUFFER_SIZE];
+  size_t nbuffer;
+  /* Runs, of decreasing sizes.  */
+  struct ios_range_run runs[IOS_RANGE_MAX_RUNS];
+  int nruns;
+  /* Storage of the slots.  */
+  struct ios_range_slot **chunks;
+  size_t nchunks;
+  struct ios_range_slot *free_slots;
+};
 
 /* Prototype for visitor functions which operate on entries of the
    range table.  */
 
-typedef void (*node_visitor_fn)(NODE_PAYLOAD_PARAMS);
-#define NODE_VISITOR_FN node_visitor_fn
+typedef void (*entry_visitor_fn) (struct ios_rangetbl *,
+                                  struct ios_range_entry *);
 
-/* Payload (i.e., pvm_val) comparator a la qsort.  */
+static pvm_val
+entry_val (struct ios_range_entry *entry)
+{
+  return (pvm_val) (uintptr_t) GC_REVEAL_POINTER (entry->key);
+}
 
-int
-ivtree_payload_compar (pvm_val v1, pvm_val v2)
+static int
+entry_live_p (struct ios_range_entry *entry)
+{
+  return entry->slot != NULL && entry->slot->link != 0;
+}
+
+/* Order of the entries, a la qsort.  */
+
+static int
+entry_compar (const void *p1, const void *p2)
 {
-  if (v1 < v2)
-    return -1;
-  else if (v1 == v2)
-    return 0;
-  else
-    return 1;
+  const struct ios_range_entry *e1 = p1;
+  const struct ios_range_entry *e2 = p2;
+
+  if (e1->begin != e2->begin)
+    return e1->begin < e2->begin ? -1 : 1;
+  if (e1->key != e2->key)
+    return e1->key < e2->key ? -1 : 1;
+  return 0;
 }
 
-/* The actual tree implementation.  */
+/* Get a new slot for TBL, or NULL if there is not enough memory.  */
 
-#include "ios-ivtree.h"
+static struct ios_range_slot *
+slot_alloc (struct ios_rangetbl *tbl)
+{
+  struct ios_range_slot *slot;
+
+  if (tbl->free_slots == NULL)
+    {
+      struct ios_range_slot **chunks;
+      struct ios_range_slot *chunk;
+      size_t i;
+
+      chunks = realloc (tbl->chunks,
+                        (tbl->nchunks + 1) * sizeof (struct ios_range_slot *));
+      if (chunks == NULL)
+        return NULL;
+      tbl->chunks = chunks;
+
+      chunk = malloc (IOS_RANGE_SLOT_CHUNK * sizeof (struct ios_range_slot));
+      if (chunk == NULL)
+        return NULL;
+      tbl->chunks[tbl->nchunks++] = chunk;
+
+      for (i = 0; i < IOS_RANGE_SLOT_CHUNK; ++i)
+        {
+          chunk[i].link = 0;
+          chunk[i].next_free = tbl->free_slots;
+          tbl->free_slots = &chunk[i];
+        }
+    }
+
+  slot = tbl->free_slots;
+  tbl->free_slots = slot->next_free;
+  slot->next_free = NULL;
+  return slot;
+}
+
+static void
+slot_free (struct ios_rangetbl *tbl, struct ios_range_slot *slot)
+{
+  GC_unregister_disappearing_link ((void **) &slot->link);
+  slot->link = 0;
+  slot->next_free = tbl->free_slots;
+  tbl->free_slots = slot;
+}
+
+/* Remove ENTRY from TBL.  The entry stays in its run, without a slot,
+   until the run is merged.  */
+
+static void
+kill_entry (struct ios_rangetbl *tbl, struct ios_range_entry *entry)
+{
+  if (entry->slot)
+    {
+      slot_free (tbl, entry->slot);
+      entry->slot = NULL;
+      tbl->count--;
+    }
+}
+
+/* Build the implicit tree of RUN.  Return IOS_OK, or IOS_ENOMEM if
+   there is not enough memory.  */
+
+static int
+run_build_tree (struct ios_range_run *run)
+{
+  size_t size = 1, i;
+  ios_off *maxend;
+
+  while (size < run->nentries)
+    size *= 2;
+
+  maxend = malloc (2 * size * sizeof (ios_off));
+  if (maxend == NULL)
+    return IOS_ENOMEM;
+
+  for (i = 0; i < size; ++i)
+    maxend[size + i] = (i < run->nentries
+                        ? run->entries[i].end : IOS_RANGE_OFF_MIN);
+  for (i = size - 1; i > 0; --i)
+    maxend[i] = (maxend[2 * i] > maxend[2 * i + 1]
+                 ? maxend[2 * i] : maxend[2 * i + 1]);
+
+  run->maxend = maxend;
+  run->size = size;
+  return IOS_OK;
+}
+
+static void
+run_free (struct ios_range_run *run)
+{
+  free (run->entries);
+  free (run->maxend);
+  run->entries = NULL;
+  run->maxend = NULL;
+  run->nentries = 0;
+  run->size = 0;
+}
+
+/* Return the index of the first entry of RUN that is not less than
+   the entry with BEGIN and KEY.  */
+
+static size_t
+run_lower_bound (struct ios_range_run *run, ios_off begin,
+                 GC_hidden_pointer key)
+{
+  size_t lo = 0, hi = run->nentries;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      struct ios_range_entry *entry = &run->entries[mid];
+
+      if (entry->begin < begin
+          || (entry->begin == begin && entry->key < key))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Return the number of entries of RUN beginning at or before
+   OFFSET.  */
+
+static size_t
+run_upper_bound (struct ios_range_run *run, ios_off offset)
+{
+  size_t lo = 0, hi = run->nentries;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+
+      if (run->entries[mid].begin <= offset)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  return lo;
+}
+
+/* Invoke FN on every entry of RUN whose interval overlaps with
+   [LOW,HIGH].  Dead entries are removed.  */
+
+static void
+run_visit_overlaps (struct ios_rangetbl *tbl, struct ios_range_run *run,
+                    ios_off low, ios_off high, entry_visitor_fn fn)
+{
+  /* Every node is pushed along with the index of its first leaf and
+     its number of leaves.  The stack never holds more than two nodes
+     per level of the tree.  */
+  size_t stack[2 * 64][3];
+  size_t sp = 0;
+  size_t ub = run_upper_bound (run, high);
+
+  if (ub == 0)
+    return;
+
+  stack[sp][0] = 1;
+  stack[sp][1] = 0;
+  stack[sp][2] = run->size;
+  sp++;
+  while (sp > 0)
+    {
+      size_t node, first, span;
+
+      sp--;
+      node = stack[sp][0];
+      first = stack[sp][1];
+      span = stack[sp][2];
+
+      /* Only the entries beginning at or before HIGH may overlap,
+         and only those ending at or after LOW.  */
+      if (first >= ub || run->maxend[node] < low)
+        continue;
+
+      if (span == 1)
+        {
+          struct ios_range_entry *entry = &run->entries[first];
+
+          if (!entry_live_p (entry))
+            kill_entry (tbl, entry);
+          else if (entry->end >= low)
+            fn (tbl, entry);
+          continue;
+        }
+
+      /* Push the right child first, so the entries get visited in
+         order.  */
+      stack[sp][0] = 2 * node + 1;
+      stack[sp][1] = first + span / 2;
+      stack[sp][2] = span / 2;
+      sp++;
+      stack[sp][0] = 2 * node;
+      stack[sp][1] = first;
+      stack[sp][2] = span / 2;
+      sp++;
+    }
+}
+
+/* Invoke FN on every live entry of TBL whose interval overlaps with
+   [LOW,HIGH], or on every entry if ALL_P is set.  Dead entries are
+   removed.  */
+
+static void
+visit_entries (struct ios_rangetbl *tbl, int all_p,
+               ios_off low, ios_off high, entry_visitor_fn fn)
+{
+  size_t i;
+  int r;
+
+  for (i = 0; i < tbl->nbuffer; ++i)
+    {
+      struct ios_range_entry *entry = &tbl->buffer[i];
+
+      if (!entry_live_p (entry))
+        kill_entry (tbl, entry);
+      else if (all_p || (entry->begin <= high && entry->end >= low))
+        fn (tbl, entry);
+    }
+
+  for (r = 0; r < tbl->nruns; ++r)
+    {
+      struct ios_range_run *run = &tbl->runs[r];
+
+      if (all_p)
+        {
+          for (i = 0; i < run->nentries; ++i)
+            {
+              struct ios_range_entry *entry = &run->entries[i];
+
+              if (!entry_live_p (entry))
+                kill_entry (tbl, entry);
+              else
+                fn (tbl, entry);
+            }
+        }
+      else
+        run_visit_overlaps (tbl, run, low, high, fn);
+    }
+}
+
+/* Merge the runs RUN1 and RUN2 into OUT, dropping the dead entries.
+   Return IOS_OK, or IOS_ENOMEM if there is not enough memory, in
+   which case the runs are left untouched.  */
+
+static int
+run_merge (struct ios_rangetbl *tbl, struct ios_range_run *run1,
+           struct ios_range_run *run2, struct ios_range_run *out)
+{
+  struct ios_range_entry *entries;
+  size_t i = 0, j = 0, n = 0;
+
+  entries = malloc ((run1->nentries + run2->nentries)
+                    * sizeof (struct ios_range_entry));
+  if (entries == NULL)
+    return IOS_ENOMEM;
+
+  while (i < run1->nentries || j < run2->nentries)
+    {
+      struct ios_range_entry *entry;
+
+      if (j == run2->nentries
+          || (i < run1->nentries
+              && entry_compar (&run1->entries[i], &run2->entries[j]) <= 0))
+        entry = &run1->entries[i++];
+      else
+        entry = &run2->entries[j++];
+
+      if (entry_live_p (entry))
+        entries[n++] = *entry;
+      else
+        kill_entry (tbl, entry);
+    }
+
+  out->entries = entries;
+  out->nentries = n;
+  if (run_build_tree (out) != IOS_OK)
+    {
+      /* The dead entries are gone already, but that is harmless.  */
+      free (entries);
+      out->entries = NULL;
+      return IOS_ENOMEM;
+    }
+
+  return IOS_OK;
+}
+
+/* Sort the buffered entries of TBL into a new run, and merge it with
+   the runs that are not bigger than itself.  Return IOS_OK, or
+   IOS_ENOMEM if there is not enough memory, in which case the table
+   is left unchanged.  */
+
+static int
+flush_buffer (struct ios_rangetbl *tbl)
+{
+  struct ios_range_run run;
+  size_t i, n = 0;
+
+  if (tbl->nbuffer == 0)
+    return IOS_OK;
+
+  run.entries = malloc (tbl->nbuffer * sizeof (struct ios_range_entry));
+  if (run.entries == NULL)
+    return IOS_ENOMEM;
+
+  for (i = 0; i < tbl->nbuffer; ++i)
+    {
+      struct ios_range_entry *entry = &tbl->buffer[i];
+
+      if (entry_live_p (entry))
+        run.entries[n++] = *entry;
+      else
+        kill_entry (tbl, entry);
+    }
+
+  run.nentries = n;
+  qsort (run.entries, n, sizeof (struct ios_range_entry), entry_compar);
+  if (run_build_tree (&run) != IOS_OK)
+    {
+      free (run.entries);
+      return IOS_ENOMEM;
+    }
+
+  /* Merging runs of similar sizes keeps their number logarithmic in
+     the number of entries.  If a merge fails the runs are simply
+     left unmerged.  */
+  while (tbl->nruns > 0
+         && tbl->runs[tbl->nruns - 1].nentries <= run.nentries)
+    {
+      struct ios_range_run merged;
+
+      if (run_merge (tbl, &tbl->runs[tbl->nruns - 1], &run,
+                     &merged) != IOS_OK)
+        break;
+
+      run_free (&tbl->runs[tbl->nruns - 1]);
+      run_free (&run);
+      run = merged;
+      tbl->nruns--;
+    }
+
+  if (tbl->nruns == IOS_RANGE_MAX_RUNS)
+    {
+      run_free (&run);
+      return IOS_ENOMEM;
+    }
+
+  tbl->runs[tbl->nruns++] = run;
+  tbl->nbuffer = 0;
+  return IOS_OK;
+}
+
+/* Remove all the dead entries from TBL, leaving all its entries in a
+   single run.  This is not done if there is not enough memory.  */
+
+static void
+sweep (struct ios_rangetbl *tbl)
+{
+  if (flush_buffer (tbl) != IOS_OK)
+    return;
+
+  while (tbl->nruns > 1)
+    {
+      struct ios_range_run merged;
+
+      if (run_merge (tbl, &tbl->runs[tbl->nruns - 2],
+                     &tbl->runs[tbl->nruns - 1], &merged) != IOS_OK)
+        return;
+
+      run_free (&tbl->runs[tbl->nruns - 2]);
+      run_free (&tbl->runs[tbl->nruns - 1]);
+      tbl->runs[tbl->nruns - 2] = merged;
+      tbl->nruns--;
+    }
+
+  /* A single run may still contain dead entries.  */
+  if (tbl->nruns == 1)
+    {
+      struct ios_range_run empty = { NULL, 0, NULL, 0 };
+      struct ios_range_run merged;
+
+      if (run_merge (tbl, &tbl->runs[0], &empty, &merged) != IOS_OK)
+        return;
+
+      run_free (&tbl->runs[0]);
+      tbl->runs[0] = merged;
+    }
+
+  tbl->sweep_count = tbl->count;
+}
+
+/* Return the entry of TBL for VAL mapped at offset BEGIN, or NULL if
+   there is no such entry.  */
+
+static struct ios_range_entry *
+lookup (struct ios_rangetbl *tbl, pvm_val val, ios_off begin)
+{
+  GC_hidden_pointer key = GC_HIDE_POINTER ((void *) (uintptr_t) val);
+  size_t i;
+  int r;
+
+  for (i = 0; i < tbl->nbuffer; ++i)
+    {
+      struct ios_range_entry *entry = &tbl->buffer[i];
+
+      if (entry->slot && entry->begin == begin && entry->key == key)
+        return entry;
+    }
+
+  for (r = 0; r < tbl->nruns; ++r)
+    {
+      struct ios_range_run *run = &tbl->runs[r];
+
+      for (i = run_lower_bound (run, begin, key);
+           (i < run->nentries
+            && run->entries[i].begin == begin
+            && run->entries[i].key == key);
+           ++i)
+        if (run->entries[i].slot)
+          return &run->entries[i];
+    }
+
+  return NULL;
+}
 
 /* ************** Interface via ios_rangetbl ******************** */
 
@@ -92,33 +590,75 @@ int
 ios_rangetbl_insert (struct ios_rangetbl *tbl, pvm_val val,
                      ios_off begin, ios_off end)
 {
-  return ios_ivtree_insert (tbl, begin, end, val);
+  struct ios_range_entry *entry;
+  struct ios_range_slot *slot;
+
+  /* Sweeping the whole table every time its size doubles keeps the
+     number of dead entries proportional to the number of live ones,
+     at an amortized constant cost per insertion.  */
+  if (tbl->count >= 2 * tbl->sweep_count + 1024)
+    sweep (tbl);
+
+  /* Values already tracked at the same offset are not inserted
+     again.  An entry of a dead value may share its key with VAL, if
+     VAL got allocated where the dead value was.  */
+  entry = lookup (tbl, val, begin);
+  if (entry)
+    {
+      if (entry_live_p (entry))
+        return IOS_OK;
+      kill_entry (tbl, entry);
+    }
+
+  if (tbl->nbuffer == IOS_RANGE_BUFFER_SIZE
+      && flush_buffer (tbl) != IOS_OK)
+    return IOS_ENOMEM;
+
+  slot = slot_alloc (tbl);
+  if (slot == NULL)
+    return IOS_ENOMEM;
+
+  slot->link = GC_HIDE_POINTER (PVM_VAL_BOX (val));
+  GC_general_register_disappearing_link ((void **) &slot->link,
+                                         PVM_VAL_BOX (val));
+
+  entry = &tbl->buffer[tbl->nbuffer++];
+  entry->begin = begin;
+  entry->end = end;
+  entry->key = GC_HIDE_POINTER ((void *) (uintptr_t) val);
+  entry->slot = slot;
+  tbl->count++;
+
+  return IOS_OK;
 }
 
 void
 ios_rangetbl_remove (struct ios_rangetbl *tbl, pvm_val val, ios_off offs)
 {
-  /* N.B. Attempting to remove an entry which is not in the tree is either
-     a logic error by the caller or a bug in the GC.  */
-  NODE_T target = ios_ivtree_lookup (tbl, offs, val);
+  /* N.B. Attempting to remove an entry which is not in the table is
+     a logic error by the caller.  */
+  struct ios_range_entry *target = lookup (tbl, val, offs);
   assert (target);
-  ios_ivtree_remove (tbl, target);
+  kill_entry (tbl, target);
 }
 
 struct ios_rangetbl *
 ios_rangetbl_create (void)
 {
+  /* All the memory of the table is malloc'ed, and it doesn't contain
+     any pointer to GC memory, so it doesn't need to be registered as
+     a GC root.  */
   struct ios_rangetbl *tbl = malloc (sizeof (struct ios_rangetbl));
   if (!tbl)
     return NULL;
 
-  /* Nodes of the table are stored in GC memory; register the
-     table container as GC root.  */
-  GC_add_roots (tbl, tbl + sizeof (struct ios_rangetbl));
-
-  tbl->root = NULL;
   tbl->count = 0;
-  tbl->compar = ivtree_payload_compar;
+  tbl->sweep_count = 0;
+  tbl->nbuffer = 0;
+  tbl->nruns = 0;
+  tbl->chunks = NULL;
+  tbl->nchunks = 0;
+  tbl->free_slots = NULL;
 
   return tbl;
 }
@@ -126,28 +666,39 @@ ios_rangetbl_create (void)
 void
 ios_rangetbl_destroy (struct ios_rangetbl *tbl)
 {
+  size_t i, j;
+  int r;
+
   assert (tbl);
 
-  /* Free all nodes in the tree including the root.  */
-  /* Note: With the tree in GC memory, this isn't really necessary
-     to do. TBD whether it's worth manually freeing or leave to GC.  */
-  ios_ivtree_destroy (tbl);
+  /* Unregister the disappearing links of the live entries.  The links
+     cleared by the collector are no longer registered.  */
+  for (i = 0; i < tbl->nchunks; ++i)
+    {
+      for (j = 0; j < IOS_RANGE_SLOT_CHUNK; ++j)
+        if (tbl->chunks[i][j].link != 0)
+          GC_unregister_disappearing_link ((void **) &tbl->chunks[i][j].link);
+      free (tbl->chunks[i]);
+    }
+  free (tbl->chunks);
+
+  for (r = 0; r < tbl->nruns; ++r)
+    run_free (&tbl->runs[r]);
 
-  GC_remove_roots (tbl, tbl + sizeof (struct ios_rangetbl));
   free (tbl);
 }
 
 static void
-mark_dirty (pvm_val val)
+mark_dirty (struct ios_rangetbl *tbl, struct ios_range_entry *entry)
 {
-  PVM_VAL_SET_DIRTY_P (val, 1);
+  PVM_VAL_SET_DIRTY_P (entry_val (entry), 1);
 }
 
 void
 ios_rangetbl_dirty (struct ios_rangetbl *tbl, ios_off begin, ios_off end)
 {
   assert (tbl);
-  ios_ivtree_visit_overlaps (tbl->root, begin, end, mark_dirty);
+  visit_entries (tbl, 0 /* all_p */, begin, end, mark_dirty);
 }
 
 void
@@ -155,7 +706,8 @@ ios_rangetbl_dirty_all (struct ios_rangetbl *tbl)
 {
   assert (tbl);
 
-  ios_ivtree_visit_all (tbl->root, mark_dirty);
+  visit_entries (tbl, 1 /* all_p */, 0, 0, mark_dirty);
+  tbl->sweep_count = tbl->count;
 }
 
 size_t
@@ -164,14 +716,29 @@ ios_rangetbl_nentries (struct ios_rangetbl *tbl)
   return tbl->count;
 }
 
+size_t
+ios_rangetbl_bytes (struct ios_rangetbl *tbl)
+{
+  size_t bytes = sizeof (struct ios_rangetbl);
+  int r;
+
+  for (r = 0; r < tbl->nruns; ++r)
+    bytes += (tbl->runs[r].nentries * sizeof (struct ios_range_entry)
+              + 2 * tbl->runs[r].size * sizeof (ios_off));
+
+  return bytes
+    + tbl->nchunks * (sizeof (struct ios_range_slot *)
+                      + IOS_RANGE_SLOT_CHUNK * sizeof (struct ios_range_slot));
+}
+
 static void
-notify_ios_closed (pvm_val val)
+notify_ios_closed (struct ios_rangetbl *tbl, struct ios_range_entry *entry)
 {
-  PVM_VAL_SET_IOSLIVE_P (val, 0);
+  PVM_VAL_SET_IOSLIVE_P (entry_val (entry), 0);
 }
 
 void
 ios_rangetbl_notify_close (struct ios_rangetbl *tbl)
 {
-  ios_ivtree_visit_all (tbl->root, notify_ios_closed);
+  visit_entries (tbl, 1 /* all_p */, 0, 0, notify_ios_closed);
 }
@@ -36,7 +36,9 @@ void ios_rangetbl_destroy (struct ios_rangetbl *);
 int  ios_rangetbl_insert (struct ios_rangetbl *tbl, pvm_val val,
                           ios_off begin, ios_off end);
 
-/* Remove VAL from TBL, given that it is mapped at offset OFFS.  */
+/* Remove VAL from TBL, given that it is mapped at offset OFFS.  Note
+   that it is not necessary to remove values that are no longer used,
+   since TBL holds weak references to them.  */
 void ios_rangetbl_remove (struct ios_rangetbl *tbl, pvm_val val,
                           ios_off offs);
 
@@ -52,9 +54,13 @@ void ios_rangetbl_dirty_all (struct ios_rangetbl *);
 /* Return the number of entries currently in the given table.  */
 size_t ios_rangetbl_nentries (struct ios_rangetbl *);
 
+/* Return the number of bytes of memory used by the given table,
+   including its entries.  */
+size_t ios_rangetbl_bytes (struct ios_rangetbl *);
+
 /* Notify the range table that the corresponding ios is being closed,
-   so that values tracked in that table will not attempt to deregister
-   themselves from a closed ios when they get GC'd.  */
+   so that the values tracked in that table get marked as no longer
+   being mapped in a live ios.  */
 void ios_rangetbl_notify_close (struct ios_rangetbl *);
 
 #endif /* ! IOS_RANGE_H */
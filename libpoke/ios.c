@@ -33,12 +33,14 @@
 #include "ios.h"
 #include "ios-dev.h"
 #include "pvm-val.h"
+#include "pvm-alloc.h"
 #include "ios-range.h"
+#include "ios-cache.h"
 
-#define IOS_GET_C_ERR_CHCK(c, io, off)                                 \
+#define IOS_GET_C_ERR_CHCK(c, io, flags, off)                          \
   {                                                                    \
     uint8_t ch;                                                        \
-    int ret = (io)->dev_if->pread ((io)->dev, &ch, 1, off);            \
+    int ret = ios_do_pread ((io), (flags), &ch, 1, off);               \
     if (ret != IOD_OK && ret != IOD_EOF)                               \
       return IOD_ERROR_TO_IOS_ERROR (ret);                             \
     /* If the pread reports an EOF, it means the partial byte */       \
@@ -49,9 +51,9 @@
     (c) = ret == IOD_EOF ? 0 : ch;                                     \
   }
 
-#define IOS_PUT_C_ERR_CHCK(c, io, len, off)                     \
+#define IOS_PUT_C_ERR_CHCK(c, io, flags, len, off)              \
   {                                                             \
-    int ret = (io)->dev_if->pwrite ((io)->dev, c, len, off);    \
+    int ret = ios_do_pwrite ((io), (flags), c, len, off);       \
     if (ret != IOD_OK)                                          \
       return IOD_ERROR_TO_IOS_ERROR (ret);                      \
   }
@@ -65,15 +67,44 @@
    DEV is the device operated by the IO space.
    DEV_IF is the interface to use when operating the device.
 
+   STATS contains the counters of the statistics of the IO space,
+   indexed by IOS_STAT_* code.  The statistics computed on demand
+   have no counter.  See ios_get_stat.
+
+   TRACE_FN, if not NULL, is called after every operation performed
+   on the device.  See ios_set_trace.
+
+   CTX is the IO context the IO space belongs to.
+
    NEXT is a pointer to the next open IO space, or NULL.
 
    VOLATILE_P determines whether the IO space contents can vary
    beetween calls to ios_write_*.  In other words, a volatile IOS
    assume that its contents may change at any time.
 
+   CACHE is the block cache used to access the device, or NULL if the
+   accesses go straight to the device.  The cache of a volatile IOS
+   is write-through, and gets invalidated every time the PVM starts
+   executing a program.  See ios_invalidate_volatile_caches.
+
+   MAP_CACHE is the map cache of the IO space, with MAP_CACHE_SIZE
+   entries, or NULL if it is disabled.  It is allocated as
+   uncollectable memory, so the cached values and their keys are
+   visible to the garbage collector.  See ios_set_map_cache.
+
    XXX: add status, saved or not saved.
  */
 
+struct ios_map_cache_entry
+{
+  uint64_t val;
+  uint64_t mapper;
+  ios_off offset;
+  int strict_p;
+  enum ios_endian endian;
+  enum ios_nenc nenc;
+};
+
 struct ios
 {
   int id;
@@ -85,7 +116,51 @@ struct ios
   const struct ios_dev_if *dev_if;
   ios_off bias;
   struct ios_rangetbl *ranges;
-
+  struct ios_cache *cache;
+  struct ios_map_cache_entry *map_cache;
+  size_t map_cache_size;
+
+  /* Number of writes performed in the IO space.  */
+  uint64_t write_count;
+
+  /* Write batches.  BATCH_DEPTH is the nesting level of the current
+     write batch, or zero if no batch is active.  DIRTY contains the
+     DIRTY_COUNT ranges written, merged as possible, that have not
+     been marked dirty in the range table yet.  See
+     ios_begin_write_batch.  */
+  int batch_depth;
+  int dirty_count;
+  struct
+  {
+    ios_off begin;
+    ios_off end;
+  } dirty[IOS_DIRTY_BATCH_SIZE];
+
+  /* Write combining.  While in a write batch, the writes of up to
+     IOS_WRITE_BUFFER_SIZE bytes are collected in WBUF, which holds
+     the WBUF_COUNT bytes starting at the byte offset WBUF_OFFSET of
+     the device, all written with the flags WBUF_FLAGS.  Writes
+     contiguous to or overlapping with the collected bytes are added
+     to them, and the rest cause the collected bytes to be written to
+     the device first.  WBUF is allocated the first time it is
+     needed.  */
+  uint8_t *wbuf;
+  size_t wbuf_count;
+  ios_dev_off wbuf_offset;
+  int wbuf_flags;
+
+  /* Byte range [PREFETCH_BEGIN, PREFETCH_END) of the device covered
+     by the last prefetch hint given in the current run of the PVM.
+     Hints contained in it, like the ones given by the mappers of the
+     elements of an array that has been already hinted, are not
+     passed to the device, so they don't replace the outer hint.  */
+  ios_dev_off prefetch_begin;
+  ios_dev_off prefetch_end;
+
+  uint64_t stats[IOS_STAT_NUM];
+  ios_trace_fn trace_fn;
+
+  struct ios_context *ctx;
   struct ios *next;
 };
 
@@ -96,8 +171,12 @@ struct ios_context
   struct ios *cur_io;  /* Pointer to the current IOS.  */
   struct ios_dev_if *foreign_dev_if;
   void *foreign_dev_if_data; /* User-defined data for foreign device.  */
+  int foreign_dev_if_cache_p; /* Whether to cache foreign devices.  */
+  struct ios_cache_pool *cache_pool; /* Pool shared by the IOS caches.  */
 };
 
+static int ios_flush_write_buffer (ios io);
+
 /* The available backends are implemented in their own files, and
    provide the following interfaces.  */
 
@@ -108,22 +187,37 @@ extern struct ios_dev_if ios_dev_stream; /* ios-dev-stream.c */
 #ifdef HAVE_LIBNBD
 extern struct ios_dev_if ios_dev_nbd; /* ios-dev-nbd.c */
 #endif
+#ifdef HAVE_ZLIB
+extern struct ios_dev_if ios_dev_gz; /* ios-dev-gz.c */
+#endif
 #ifdef HAVE_PROC
 extern struct ios_dev_if ios_dev_proc; /* ios-dev-proc.c */
 #endif
 extern struct ios_dev_if ios_dev_sub; /* ios-dev-sub.c */
+extern struct ios_dev_if ios_dev_cow; /* ios-dev-cow.c */
 #ifdef HAVE_MMAP
 extern struct ios_dev_if ios_dev_mmap; /* ios-dev-mmap.c */
 #endif
 
+/* Shared devices wrap the devices of the IO spaces opened with the
+   IOS_F_SHARED flag.  */
+
+extern struct ios_dev_if ios_dev_shared; /* ios-dev-shared.c */
+void *ios_dev_shared_attach (const struct ios_dev_if *dev_if,
+                             const char *handler,
+                             const char *normalized_handler,
+                             uint64_t flags, int *error);
+
 enum
 {
   IOS_DEV_ZERO,
   IOS_DEV_MEM,
   IOS_DEV_STREAM,
   IOS_DEV_NBD,
+  IOS_DEV_GZ,
   IOS_DEV_PROC,
   IOS_DEV_SUB,
+  IOS_DEV_COW,
   IOS_DEV_MMAP,
   IOS_DEV_FILE, /* File must be last */
 };
@@ -138,12 +232,18 @@ static const struct ios_dev_if *ios_dev_ifs[] =
 #else
     [IOS_DEV_NBD] = NULL,
 #endif
+#ifdef HAVE_ZLIB
+    [IOS_DEV_GZ] = &ios_dev_gz,
+#else
+    [IOS_DEV_GZ] = NULL,
+#endif
 #ifdef HAVE_PROC
     [IOS_DEV_PROC] = &ios_dev_proc,
 #else
     [IOS_DEV_PROC] = NULL,
 #endif
     [IOS_DEV_SUB] = &ios_dev_sub,
+    [IOS_DEV_COW] = &ios_dev_cow,
 #ifdef HAVE_MMAP
     [IOS_DEV_MMAP] = &ios_dev_mmap,
 #else
@@ -160,11 +260,45 @@ ios_context_data (ios_context ios_ctx, const struct ios_dev_if *dev_if)
 {
   if (dev_if == ios_ctx->foreign_dev_if)
     return ios_ctx->foreign_dev_if_data;
-  if (dev_if == ios_dev_ifs[IOS_DEV_SUB])
+  if (dev_if == ios_dev_ifs[IOS_DEV_SUB]
+      || dev_if == ios_dev_ifs[IOS_DEV_COW])
     return ios_ctx;
   return NULL;
 }
 
+/* Return whether the devices operated by DEV_IF can be shared by
+   several IO contexts.  This excludes the devices whose contents
+   belong to an IO context, like memory buffers and sub-ranges of
+   other IO spaces, and the ones whose contents are not stable, like
+   streams and the memory of processes.  */
+
+static int
+ios_dev_if_shareable_p (ios_context ios_ctx, const struct ios_dev_if *dev_if)
+{
+  return (dev_if != ios_ctx->foreign_dev_if
+          && (dev_if == ios_dev_ifs[IOS_DEV_ZERO]
+              || dev_if == ios_dev_ifs[IOS_DEV_NBD]
+              || dev_if == ios_dev_ifs[IOS_DEV_GZ]
+              || dev_if == ios_dev_ifs[IOS_DEV_MMAP]
+              || dev_if == ios_dev_ifs[IOS_DEV_FILE]));
+}
+
+/* Account for an operation performed on the device of the IO space
+   DATA, and trace it if requested.  This is also called by the cache
+   of the IO space.  See ios_cache_set_notify.  */
+
+static void
+ios_dev_op_done (void *data, int op, ios_dev_off offset, size_t count,
+                 int status)
+{
+  ios io = data;
+
+  io->stats[op == IOS_TRACE_PWRITE
+            ? IOS_STAT_DEV_WRITES : IOS_STAT_DEV_READS]++;
+  if (io->trace_fn)
+    io->trace_fn (io, op, offset, count, IOD_ERROR_TO_IOS_ERROR (status));
+}
+
 ios_context
 ios_init (void)
 {
@@ -172,7 +306,14 @@ ios_init (void)
 
   if (!ios_ctx)
     return NULL;
-  /* Nothing to do here... yet.  */
+
+  ios_ctx->cache_pool = ios_cache_pool_new (IOS_CACHE_DEFAULT_BUDGET);
+  if (!ios_ctx->cache_pool)
+    {
+      free (ios_ctx);
+      return NULL;
+    }
+
   return ios_ctx;
 }
 
@@ -189,6 +330,7 @@ ios_shutdown (ios_context ios_ctx)
       inext = i->next;
       ios_close (ios_ctx, i);
     }
+  ios_cache_pool_free (ios_ctx->cache_pool);
   free (ios_ctx);
 }
 
@@ -213,8 +355,23 @@ ios_open (ios_context ios_ctx, const char *handler, uint64_t flags,
   io->zombie_p = 0;
   io->num_sub_devs = 0;
   io->handler = NULL;
+  io->ctx = ios_ctx;
   io->next = NULL;
   io->bias = 0;
+  io->cache = NULL;
+  io->map_cache = NULL;
+  io->map_cache_size = 0;
+  io->batch_depth = 0;
+  io->dirty_count = 0;
+  io->wbuf = NULL;
+  io->wbuf_count = 0;
+  io->wbuf_offset = 0;
+  io->wbuf_flags = 0;
+  io->write_count = 0;
+  io->prefetch_begin = 0;
+  io->prefetch_end = 0;
+  memset (io->stats, 0, sizeof (io->stats));
+  io->trace_fn = NULL;
 
   io->ranges = tbl;
 
@@ -254,9 +411,28 @@ found:
         goto error;
       }
 
-  /* Open the device using the interface found above.  */
-  io->dev = io->dev_if->open (handler, flags, &iod_error,
-                              ios_context_data (ios_ctx, io->dev_if));
+  /* Shared IO spaces are read-only, and the device opened on their
+     handler is shared with the shared IO spaces of other IO contexts.
+     See ios-dev-shared.c.  */
+  if (flags & IOS_F_SHARED)
+    {
+      if ((flags & (IOS_F_WRITE | IOS_F_CREATE | IOS_F_VOLATILE))
+          || !ios_dev_if_shareable_p (ios_ctx, dev_if))
+        {
+          error = IOS_EFLAGS;
+          goto error;
+        }
+
+      flags &= ~(uint64_t) (IOS_FLAGS_MODE | IOS_F_SHARED);
+      flags |= IOS_F_READ;
+      io->dev = ios_dev_shared_attach (dev_if, handler, io->handler, flags,
+                                       &iod_error);
+      io->dev_if = dev_if = &ios_dev_shared;
+    }
+  else
+    /* Open the device using the interface found above.  */
+    io->dev = io->dev_if->open (handler, flags, &iod_error,
+                                ios_context_data (ios_ctx, io->dev_if));
   if (iod_error || io->dev == NULL)
     goto error;
 
@@ -265,6 +441,29 @@ found:
   io->volatile_p =
     (flags & IOS_F_VOLATILE) || dev_if->volatile_by_default (io->dev, handler);
 
+  /* Devices whose contents are already in memory, or that are always
+     accessed sequentially, do not benefit from caching.  Neither do
+     sub-range devices, which access their base IOS through its own
+     cache, nor shared devices, which have their own cache.  Foreign
+     devices are cached only if they asked for it.  */
+  if (dev_if != ios_dev_ifs[IOS_DEV_ZERO]
+      && dev_if != ios_dev_ifs[IOS_DEV_MEM]
+      && dev_if != ios_dev_ifs[IOS_DEV_STREAM]
+      && dev_if != ios_dev_ifs[IOS_DEV_SUB]
+      && dev_if != ios_dev_ifs[IOS_DEV_MMAP]
+      && dev_if != &ios_dev_shared
+      && (dev_if != ios_ctx->foreign_dev_if
+          || ios_ctx->foreign_dev_if_cache_p))
+    {
+      /* Note that failing to allocate the cache is not fatal.  */
+      io->cache = ios_cache_new (ios_ctx->cache_pool, dev_if, io->dev,
+                                 IOS_CACHE_DEFAULT_BLOCK_SIZE,
+                                 IOS_CACHE_DEFAULT_NBLOCKS,
+                                 io->volatile_p /* write_through_p */);
+      if (io->cache)
+        ios_cache_set_notify (io->cache, ios_dev_op_done, io);
+    }
+
   /* Increment the id counter after all possible errors are avoided.  */
   io->id = ios_ctx->next_id++;
 
@@ -293,13 +492,30 @@ int
 ios_close (ios_context ios_ctx, ios io)
 {
   struct ios *tmp;
-  int ret;
+  int ret, cache_ret = IOD_OK;
 
   /* XXX: if not saved, ask before closing.  */
 
+  /* Write back any pending data and get rid of the cache.  */
+  cache_ret = ios_flush_write_buffer (io);
+  free (io->wbuf);
+  io->wbuf = NULL;
+  io->batch_depth = 0;
+  if (io->cache)
+    {
+      int flush_ret = ios_cache_flush (io->cache);
+
+      if (cache_ret == IOD_OK)
+        cache_ret = flush_ret;
+      ios_cache_free (io->cache);
+      io->cache = NULL;
+    }
+
   /* Close the device operated by the IO space.
      XXX: Errors may be received from fclose.  What do we do in that case?  */
   ret = io->dev_if->close (io->dev);
+  if (ret == IOD_OK)
+    ret = cache_ret;
 
   /* Unlink the IOS from the list.  */
   /* The list contains at least this IO space.  */
@@ -330,6 +546,8 @@ ios_close (ios_context ios_ctx, ios io)
   ios_rangetbl_destroy (io->ranges);
   io->ranges = NULL;
 
+  ios_set_map_cache (io, 0);
+
   if (io->num_sub_devs == 0)
     free (io);
   else
@@ -483,6 +701,202 @@ ios_map (ios_context ios_ctx, ios_map_fn cb, void *data)
     }
 }
 
+/* Read or write COUNT bytes at byte offset OFFSET of the device
+   operated by IO.  The accesses are served by the IOS cache, if there
+   is one, unless IOS_F_BYPASS_CACHE is set in FLAGS.  Return an
+   IOD_* status code.  */
+
+/* Return whether the COUNT bytes at byte offset OFFSET overlap with
+   the bytes collected in the write buffer of IO.  */
+
+static inline int
+ios_wbuf_overlap_p (ios io, size_t count, ios_dev_off offset)
+{
+  return (io->wbuf_count > 0
+          && offset < io->wbuf_offset + io->wbuf_count
+          && offset + count > io->wbuf_offset);
+}
+
+static inline const uint8_t *
+ios_do_get_ptr (ios io, int flags, size_t count, ios_dev_off offset)
+{
+  /* The device shall have the bytes collected in the write buffer
+     before giving away pointers to its contents.  */
+  if (ios_wbuf_overlap_p (io, count, offset)
+      && ios_flush_write_buffer (io) != IOD_OK)
+    return NULL;
+
+  /* The cache may hold data that is more recent than the contents
+     of the device, so it is the cache who provides the pointer.  */
+  if (io->cache)
+    {
+      if (flags & IOS_F_BYPASS_CACHE)
+        return NULL;
+      return ios_cache_get_ptr (io->cache, count, offset);
+    }
+
+  if (!io->dev_if->get_ptr)
+    return NULL;
+
+  return io->dev_if->get_ptr (io->dev, count, offset);
+}
+
+static inline int
+ios_do_pread (ios io, int flags, void *buf, size_t count,
+              ios_dev_off offset)
+{
+  const uint8_t *ptr;
+  int ret;
+
+  /* Reads of bytes collected in the write buffer are served from it.
+     This is the case of the bytes partially written by the writes of
+     integers that are not byte-aligned.  Other reads overlapping with
+     the buffer write it to the device first.  */
+  if (ios_wbuf_overlap_p (io, count, offset))
+    {
+      if (offset >= io->wbuf_offset
+          && offset + count <= io->wbuf_offset + io->wbuf_count)
+        {
+          memcpy (buf, io->wbuf + (offset - io->wbuf_offset), count);
+          return IOD_OK;
+        }
+
+      ret = ios_flush_write_buffer (io);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  ptr = ios_do_get_ptr (io, flags, count, offset);
+  if (ptr)
+    {
+      memcpy (buf, ptr, count);
+      return IOD_OK;
+    }
+
+  if (io->cache)
+    {
+      if (!(flags & IOS_F_BYPASS_CACHE))
+        return ios_cache_pread (io->cache, buf, count, offset);
+
+      /* Make sure the device has the data we are about to read.  */
+      ret = ios_cache_sync_range (io->cache, offset, count);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  ret = io->dev_if->pread (io->dev, buf, count, offset);
+  ios_dev_op_done (io, IOS_TRACE_PREAD, offset, count, ret);
+  return ret;
+}
+
+static inline int
+ios_dev_pwrite (ios io, int flags, const void *buf, size_t count,
+                ios_dev_off offset)
+{
+  int ret;
+
+  if (io->cache)
+    {
+      if (!(flags & IOS_F_BYPASS_CACHE))
+        return ios_cache_pwrite (io->cache, buf, count, offset);
+
+      /* Do not let stale cached blocks shadow the data we are about to
+         write.  */
+      ret = ios_cache_sync_range (io->cache, offset, count);
+      if (ret != IOD_OK)
+        return ret;
+    }
+
+  ret = io->dev_if->pwrite (io->dev, buf, count, offset);
+  ios_dev_op_done (io, IOS_TRACE_PWRITE, offset, count, ret);
+  return ret;
+}
+
+/* Write the bytes collected in the write buffer of IO to the device.
+   Return an IOD_* status code.  */
+
+static int
+ios_flush_write_buffer (ios io)
+{
+  size_t count = io->wbuf_count;
+
+  if (count == 0)
+    return IOD_OK;
+
+  io->wbuf_count = 0;
+  return ios_dev_pwrite (io, io->wbuf_flags, io->wbuf, count,
+                         io->wbuf_offset);
+}
+
+static inline int
+ios_do_pwrite (ios io, int flags, const void *buf, size_t count,
+               ios_dev_off offset)
+{
+  int ret;
+
+  /* The writes performed while in a write batch, which are usually
+     the writes of the fields of a struct or the elements of an
+     array, are collected in the write buffer and reach the device
+     together.  */
+  if (io->batch_depth > 0 && count <= IOS_WRITE_BUFFER_SIZE)
+    {
+      size_t end;
+
+      if (io->wbuf_count > 0
+          && (flags != io->wbuf_flags
+              || offset < io->wbuf_offset
+              || offset > io->wbuf_offset + io->wbuf_count
+              || offset + count > io->wbuf_offset + IOS_WRITE_BUFFER_SIZE))
+        {
+          ret = ios_flush_write_buffer (io);
+          if (ret != IOD_OK)
+            return ret;
+        }
+
+      if (io->wbuf == NULL)
+        io->wbuf = malloc (IOS_WRITE_BUFFER_SIZE);
+
+      if (io->wbuf != NULL)
+        {
+          if (io->wbuf_count == 0)
+            {
+              io->wbuf_offset = offset;
+              io->wbuf_flags = flags;
+            }
+
+          end = offset - io->wbuf_offset + count;
+          memcpy (io->wbuf + (offset - io->wbuf_offset), buf, count);
+          if (end > io->wbuf_count)
+            io->wbuf_count = end;
+          return IOD_OK;
+        }
+    }
+
+  /* Writes not collected in the buffer shall reach the device after
+     the collected ones.  */
+  ret = ios_flush_write_buffer (io);
+  if (ret != IOD_OK)
+    return ret;
+
+  return ios_dev_pwrite (io, flags, buf, count, offset);
+}
+
+/* Account for a read or a write of BITS bits in IO.  */
+
+static inline void
+ios_count_access (ios io, int write_p, uint64_t bits)
+{
+  int base = write_p ? IOS_STAT_WRITES : IOS_STAT_READS;
+  int size_class = (bits <= 8 ? 1 : bits <= 32 ? 2 : bits <= 64 ? 3 : 4);
+
+  /* Note that the layout of the statistics of reads and writes is
+     the same.  */
+  io->stats[base]++;
+  io->stats[base + size_class]++;
+  io->stats[write_p ? IOS_STAT_BYTES_WRITTEN : IOS_STAT_BYTES_READ]
+    += (bits + 7) / 8;
+}
+
 /* Set all except the lowest SIGNIFICANT_BITS of VALUE to zero.  */
 #define IOS_CHAR_GET_LSB(value, significant_bits)                \
   (*(value) &= 0xFFU >> (CHAR_BIT - (significant_bits)))
@@ -514,7 +928,7 @@ ios_read_int_common (ios io, ios_off offset, int flags,
   lastbyte_bits = lastbyte_bits == 0 ? 8 : lastbyte_bits;
 
   /* Read the bytes and clear the unused bits.  */
-  ret = io->dev_if->pread (io->dev, c, bytes_minus1 + 1, offset / 8);
+  ret = ios_do_pread (io, flags, c, bytes_minus1 + 1, offset / 8);
   if (ret != IOD_OK)
     return IOD_ERROR_TO_IOS_ERROR (ret);
 
@@ -859,6 +1273,33 @@ ios_read_int_common (ios io, ios_off offset, int flags,
   }
 }
 
+/* Read an integer of BITS bits located at the byte-aligned bit-offset
+   OFFSET, where BITS is a multiple of 8.  The bytes are decoded in
+   place if the device allows it.  */
+
+static inline int
+ios_read_int_fast (ios io, ios_off offset, int flags,
+                   int bits,
+                   enum ios_endian endian,
+                   uint64_t *value)
+{
+  uint8_t buf[8];
+  const uint8_t *c;
+
+  c = ios_do_get_ptr (io, flags, bits / 8, offset / 8);
+  if (c == NULL)
+    {
+      int ret = ios_do_pread (io, flags, buf, bits / 8, offset / 8);
+
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+      c = buf;
+    }
+
+  *value = ios_decode_uint (c, bits, endian);
+  return IOS_OK;
+}
+
 int
 ios_read_int (ios io, ios_off offset, int flags,
               int bits,
@@ -872,115 +1313,17 @@ ios_read_int (ios io, ios_off offset, int flags,
 
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
+  ios_count_access (io, 0 /* write_p */, bits);
 
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
     {
-      int ret;
-      uint8_t c[8];
-
-      ret = io->dev_if->pread (io->dev, c, bits / 8, offset / 8);
-      if (ret != IOD_OK)
-        return IOD_ERROR_TO_IOS_ERROR (ret);
-
-      switch (bits) {
-      case 8:
-        {
-          *value = (int8_t) c[0];
-          return IOS_OK;
-        }
-
-      case 16:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 8) | c[1];
-          *value = (uint64_t) *value << 48;
-          *value >>= 48;
-          return IOS_OK;
-        }
-
-      case 24:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[2] << 16) | ((uint64_t) c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 16) | ((uint64_t) c[1] << 8) | c[2];
-          *value = (uint64_t) *value << 40;
-          *value >>= 40;
-          return IOS_OK;
-        }
-
-      case 32:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[3] << 24) | ((uint64_t) c[2] << 16) | ((uint64_t) c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 24) | ((uint64_t) c[1] << 16) | ((uint64_t) c[2] << 8) | c[3];
-          *value = (uint64_t) *value << 32;
-          *value >>= 32;
-          return IOS_OK;
-        }
-
-      case 40:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 32) | ((uint64_t) c[1] << 24)
-                     | (c[2] << 16) | (c[3] << 8) | c[4];
-          *value = (uint64_t) *value << 24;
-          *value >>= 24;
-          return IOS_OK;
-        }
+      int ret = ios_read_int_fast (io, offset, flags, bits, endian,
+                                   (uint64_t *) value);
 
-      case 48:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                     | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                     | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 40) | ((uint64_t) c[1] << 32)
-                     | ((uint64_t) c[2] << 24) | (c[3] << 16)
-                     | (c[4] << 8) | c[5];
-          *value = (uint64_t) *value << 16;
-          *value >>= 16;
-          return IOS_OK;
-        }
-
-      case 56:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                     | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[2] << 16) | (c[1] << 8) | c[0];
-          else
-            *value = ((uint64_t) c[0] << 48) | ((uint64_t) c[1] << 40)
-                     | ((uint64_t) c[2] << 32) | ((uint64_t) c[3] << 24)
-                     | (c[4] << 16) | (c[5] << 8) | c[6];
-          *value = (uint64_t) *value << 8;
-          *value >>= 8;
-          return IOS_OK;
-        }
-
-      case 64:
-        {
-          if (endian == IOS_ENDIAN_LSB)
-            *value = ((uint64_t) c[7] << 56) | ((uint64_t) c[6] << 48)
-                     | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                     | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                     | c[0];
-          else
-            *value = ((uint64_t) c[0] << 56) | ((uint64_t) c[1] << 48)
-                     | ((uint64_t) c[2] << 40) | ((uint64_t) c[3] << 32)
-                     | ((uint64_t) c[4] << 24) | (c[5] << 16) | (c[6] << 8)
-                     | c[7];
-          return IOS_OK;
-        }
-      }
+      if (ret == IOS_OK)
+        *value = ((int64_t) (((uint64_t) *value) << (64 - bits))) >> (64 - bits);
+      return ret;
     }
 
   /* Fall into the case for the unaligned and the sizes other than 8x.  */
@@ -1006,88 +1349,11 @@ ios_read_uint (ios io, ios_off offset, int flags,
 
   /* Apply the IOS bias.  */
   offset += ios_get_bias (io);
+  ios_count_access (io, 0 /* write_p */, bits);
 
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
-    {
-      int ret;
-      uint8_t c[8];
-
-      ret = io->dev_if->pread (io->dev, c, bits / 8, offset / 8);
-      if (ret != IOD_OK)
-        return IOD_ERROR_TO_IOS_ERROR (ret);
-
-      switch (bits) {
-      case 8:
-        *value = c[0];
-        return IOS_OK;
-
-      case 16:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = (c[1] << 8) | c[0];
-        else
-          *value = (c[0] << 8) | c[1];
-        return IOS_OK;
-
-      case 24:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = (c[0] << 16) | (c[1] << 8) | c[2];
-        return IOS_OK;
-
-      case 32:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 24) | (c[1] << 16) | (c[2] << 8) | c[3];
-        return IOS_OK;
-
-      case 40:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 32) | ((uint64_t) c[1] << 24)
-                   | (c[2] << 16) | (c[3] << 8) | c[4];
-        return IOS_OK;
-
-      case 48:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16)
-                   | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 40) | ((uint64_t) c[1] << 32)
-                   | ((uint64_t) c[2] << 24) | (c[3] << 16)
-                   | (c[4] << 8) | c[5];
-        return IOS_OK;
-
-      case 56:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[6] << 48) | ((uint64_t) c[5] << 40)
-                   | ((uint64_t) c[4] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[2] << 16) | (c[1] << 8) | c[0];
-        else
-          *value = ((uint64_t) c[0] << 48) | ((uint64_t) c[1] << 40)
-                   | ((uint64_t) c[2] << 32) | ((uint64_t) c[3] << 24)
-                   | (c[4] << 16) | (c[5] << 8) | c[6];
-        return IOS_OK;
-
-      case 64:
-        if (endian == IOS_ENDIAN_LSB)
-          *value = ((uint64_t) c[7] << 56) | ((uint64_t) c[6] << 48)
-                   | ((uint64_t) c[5] << 40) | ((uint64_t) c[4] << 32)
-                   | ((uint64_t) c[3] << 24) | (c[2] << 16) | (c[1] << 8)
-                   | c[0];
-        else
-          *value = ((uint64_t) c[0] << 56) | ((uint64_t) c[1] << 48)
-                   | ((uint64_t) c[2] << 40) | ((uint64_t) c[3] << 32)
-                   | ((uint64_t) c[4] << 24) | (c[5] << 16) | (c[6] << 8)
-                   | c[7];
-        return IOS_OK;
-      }
-    }
+    return ios_read_int_fast (io, offset, flags, bits, endian, value);
 
   /* Fall into the case for the unaligned and the sizes other than 8x.  */
   return ios_read_int_common (io, offset, flags, bits, endian, value);
@@ -1246,7 +1512,7 @@ ios_write_int_fast (ios io, ios_off offset, int flags,
       break;
     }
 
-  ret = io->dev_if->pwrite (io->dev, c, bits / 8, offset / 8);
+  ret = ios_do_pwrite (io, flags, c, bits / 8, offset / 8);
   if (ret != IOD_OK)
     return IOD_ERROR_TO_IOS_ERROR (ret);
 
@@ -1282,23 +1548,23 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     {
       /* We are altering only a single byte.  */
       uint64_t head, tail;
-      IOS_GET_C_ERR_CHCK(head, io, offset / 8);
+      IOS_GET_C_ERR_CHCK(head, io, flags, offset / 8);
       tail = head;
       IOS_CHAR_GET_MSB(&head, offset % 8);
       IOS_CHAR_GET_LSB(&tail, 8 - lastbyte_bits);
 
       /* Write the byte back without changing the surrounding bits.  */
       c[0] = head | tail | (value << (8 - lastbyte_bits));
-      IOS_PUT_C_ERR_CHCK(c, io, 1, offset / 8);
+      IOS_PUT_C_ERR_CHCK(c, io, flags, 1, offset / 8);
       return IOS_OK;
     }
 
   case 1:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + 1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + 1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB && bits > 8)
@@ -1311,15 +1577,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
       }
     c[0] |= value >> lastbyte_bits;
     c[1] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 2, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 2, offset / 8);
     return IOS_OK;
 
   case 2:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1338,15 +1604,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[0] |= value >> (8 + lastbyte_bits);
     c[1] = (value >> lastbyte_bits) & 0xff;
     c[2] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 3, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 3, offset / 8);
     return IOS_OK;
 
   case 3:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1368,15 +1634,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[1] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[2] = (value >> lastbyte_bits) & 0xff;
     c[3] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 4, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 4, offset / 8);
     return IOS_OK;
 
   case 4:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1401,15 +1667,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[2] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[3] = (value >> lastbyte_bits) & 0xff;
     c[4] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 5, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 5, offset / 8);
     return IOS_OK;
 
   case 5:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1437,15 +1703,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[3] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[4] = (value >> lastbyte_bits) & 0xff;
     c[5] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 6, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 6, offset / 8);
     return IOS_OK;
 
   case 6:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1476,15 +1742,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[4] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[5] = (value >> lastbyte_bits) & 0xff;
     c[6] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 7, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 7, offset / 8);
     return IOS_OK;
 
   case 7:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1518,15 +1784,15 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[5] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[6] = (value >> lastbyte_bits) & 0xff;
     c[7] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 8, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 8, offset / 8);
     return IOS_OK;
 
   case 8:
     /* Correctly set the unmodified leading bits of the first byte.  */
-    IOS_GET_C_ERR_CHCK(c[0], io, offset / 8);
+    IOS_GET_C_ERR_CHCK(c[0], io, flags, offset / 8);
     IOS_CHAR_GET_MSB(&c[0], offset % 8);
     /* Correctly set the unmodified trailing bits of the last byte.  */
-    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, offset / 8 + bytes_minus1);
+    IOS_GET_C_ERR_CHCK(c[bytes_minus1], io, flags, offset / 8 + bytes_minus1);
     IOS_CHAR_GET_LSB(&c[bytes_minus1], 8 - lastbyte_bits);
 
     if (endian == IOS_ENDIAN_LSB)
@@ -1558,7 +1824,7 @@ ios_write_int_common (ios io, ios_off offset, int flags,
     c[6] = (value >> (8 + lastbyte_bits)) & 0xff;
     c[7] = (value >> lastbyte_bits) & 0xff;
     c[8] |= (value << (8 - lastbyte_bits)) & 0xff;
-    IOS_PUT_C_ERR_CHCK(c, io, 9, offset / 8);
+    IOS_PUT_C_ERR_CHCK(c, io, flags, 9, offset / 8);
     return IOS_OK;
 
   default:
@@ -1583,6 +1849,7 @@ ios_write_int (ios io, ios_off offset, int flags,
   /* Mark the range written as dirty, so that mapped values which
      overlap the range will be remapped.  */
   ios_mark_dirty_range (io, offset, offset + bits);
+  ios_count_access (io, 1 /* write_p */, bits);
 
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
@@ -1612,6 +1879,7 @@ ios_write_uint (ios io, ios_off offset, int flags,
   /* Mark the range of bits written as dirty, so that mapped values which
      overlap the range will be remapped.  */
   ios_mark_dirty_range (io, offset, offset + bits);
+  ios_count_access (io, 1 /* write_p */, bits);
 
   /* Fast track for byte-aligned 8x bits  */
   if (offset % 8 == 0 && bits % 8 == 0)
@@ -1621,58 +1889,761 @@ ios_write_uint (ios io, ios_off offset, int flags,
   return ios_write_int_common (io, offset, flags, bits, endian, value);
 }
 
-uint64_t
-ios_size (ios io)
-{
-  return io->dev_if->size (io->dev);
-}
-
 int
-ios_flush (ios io, ios_off offset)
+ios_read_bytes (ios io, ios_off offset, int flags,
+                void *buf, size_t count)
 {
-  return io->dev_if->flush (io->dev, offset / 8);
-}
+  uint8_t *p = buf;
 
-void *
-ios_get_dev (ios ios)
-{
-  return ios->dev;
-}
+  /* The IOS should be readable.  */
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    return IOS_EPERM;
 
-const struct ios_dev_if *
-ios_get_dev_if (ios ios)
-{
-  return ios->dev_if;
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+  ios_count_access (io, 0 /* write_p */, (uint64_t) count * 8);
+
+  /* Fast track for byte-aligned offsets.  */
+  if (offset % 8 == 0)
+    return IOD_ERROR_TO_IOS_ERROR (ios_do_pread (io, flags, buf, count,
+                                                 offset / 8));
+
+  /* The bytes are not aligned in the IOS.  Read them one at a time.  */
+  for (size_t i = 0; i < count; ++i)
+    {
+      uint64_t value;
+      int ret = ios_read_int_common (io, offset + i * 8, flags, 8,
+                                     IOS_ENDIAN_MSB, &value);
+
+      if (ret != IOS_OK)
+        return ret;
+      p[i] = value;
+    }
+
+  return IOS_OK;
 }
 
-struct ios_dev_if *
-ios_foreign_iod (ios_context ios_ctx)
+const void *
+ios_read_ptr (ios io, ios_off offset, int flags, size_t count)
 {
-  return ios_ctx->foreign_dev_if;
+  const void *ptr;
+
+  /* The IOS should be readable.  */
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    return NULL;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  if (offset % 8 != 0)
+    return NULL;
+
+  ptr = ios_do_get_ptr (io, flags, count, offset / 8);
+
+  /* Otherwise the caller reads the data by other means.  */
+  if (ptr)
+    ios_count_access (io, 0 /* write_p */, (uint64_t) count * 8);
+  return ptr;
 }
 
 int
-ios_register_foreign_iod (ios_context ios_ctx, struct ios_dev_if *iod_if,
-                          void *data)
+ios_prefetch (ios io, ios_off offset, ios_off size)
 {
-  if (ios_ctx->foreign_dev_if)
-    return IOS_ERROR;
+  ios_off end;
 
-  ios_ctx->foreign_dev_if = iod_if;
-  ios_ctx->foreign_dev_if_data = data;
-  return IOS_OK;
+  if (size == 0 || !(io->dev_if->get_flags (io->dev) & IOS_F_READ))
+    return IOS_OK;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  end = (offset + size + 7) / 8;
+  offset /= 8;
+
+  if ((ios_dev_off) offset >= io->prefetch_begin
+      && (ios_dev_off) end <= io->prefetch_end)
+    return IOS_OK;
+  io->prefetch_begin = offset;
+  io->prefetch_end = end;
+
+  return IOD_ERROR_TO_IOS_ERROR (ios_pprefetch (io, end - offset, offset));
 }
 
-void
-ios_inc_sub_dev (ios io)
+int
+ios_mtime (ios io, int64_t *mtime)
 {
-  ++io->num_sub_devs;
+  if (!io->dev_if->mtime)
+    return IOS_EINVAL;
+
+  return IOD_ERROR_TO_IOS_ERROR (io->dev_if->mtime (io->dev, mtime));
 }
 
-void
-ios_dec_sub_dev (ios io)
+int
+ios_next_change (ios io, ios_off offset, ios_off *begin, ios_off *end)
 {
-  assert (io->num_sub_devs != 0);
+  ios_off bias = ios_get_bias (io);
+  ios_dev_off dev_begin, dev_end;
+  int ret;
+
+  if (!io->dev_if->next_change)
+    return IOS_EINVAL;
+
+  /* The collected and cached writes shall reach the device first.  */
+  ret = ios_flush_write_buffer (io);
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+  if (io->cache)
+    {
+      ret = ios_cache_flush (io->cache);
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  offset += bias;
+  ret = io->dev_if->next_change (io->dev, offset / 8, &dev_begin, &dev_end);
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+
+  *begin = (dev_begin * 8 > offset ? dev_begin * 8 : offset) - bias;
+  *end = dev_end * 8 - bias;
+  return IOS_OK;
+}
+
+int
+ios_discard (ios io)
+{
+  int ret;
+
+  if (!io->dev_if->discard)
+    return IOS_EINVAL;
+
+  /* The collected and cached writes are discarded as well.  */
+  io->wbuf_count = 0;
+  if (io->cache)
+    {
+      ret = ios_cache_invalidate (io->cache);
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  ret = io->dev_if->discard (io->dev);
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+
+  /* The values mapped in IO may have seen the discarded changes.  */
+  ios_mark_dirty_all (io);
+  return IOS_OK;
+}
+
+/* Size of the chunks read from the IO space by ios_search_bytes.  */
+#define IOS_SEARCH_CHUNK_SIZE 65536
+
+/* Return whether the LEN bytes at BUF match PATTERN under MASK.  */
+
+static inline int
+ios_search_match_p (const uint8_t *buf, const uint8_t *pattern,
+                    const uint8_t *mask, size_t len)
+{
+  if (mask == NULL)
+    return memcmp (buf, pattern, len) == 0;
+
+  for (size_t i = 0; i < len; ++i)
+    if ((buf[i] & mask[i]) != (pattern[i] & mask[i]))
+      return 0;
+  return 1;
+}
+
+int
+ios_search_bytes (ios io, ios_off from, ios_off to,
+                  const uint8_t *pattern, const uint8_t *mask,
+                  size_t len, ios_off *result)
+{
+  uint8_t *buf;
+  size_t anchor = 0, nbytes;
+  int anchor_p = 0;
+  int ret = IOS_EOF;
+
+  if (to < from || (to - from) / 8 < len)
+    return IOS_EOF;
+
+  if (len == 0)
+    {
+      *result = from;
+      return IOS_OK;
+    }
+
+  /* Look for a byte of the pattern which is fully compared, so
+     candidate positions can be located with memchr.  */
+  for (anchor = 0; anchor < len; ++anchor)
+    if (mask == NULL || mask[anchor] == 0xff)
+      {
+        anchor_p = 1;
+        break;
+      }
+
+  buf = malloc (IOS_SEARCH_CHUNK_SIZE + len - 1);
+  if (buf == NULL)
+    return IOS_ENOMEM;
+
+  /* Number of candidate positions left.  */
+  nbytes = (to - from) / 8 - len + 1;
+
+  while (nbytes > 0)
+    {
+      /* Read the candidate positions of this chunk plus enough bytes
+         to check a match starting at the last of them.  */
+      size_t ncands = nbytes < IOS_SEARCH_CHUNK_SIZE
+                      ? nbytes : IOS_SEARCH_CHUNK_SIZE;
+      size_t i = 0;
+
+      ret = ios_read_bytes (io, from, 0 /* flags */, buf, ncands + len - 1);
+      if (ret != IOS_OK)
+        break;
+      ret = IOS_EOF;
+
+      while (i < ncands)
+        {
+          if (anchor_p)
+            {
+              uint8_t *p = memchr (buf + i + anchor, pattern[anchor],
+                                   ncands - i);
+
+              if (p == NULL)
+                break;
+              i = p - buf - anchor;
+            }
+
+          if (ios_search_match_p (buf + i, pattern, mask, len))
+            {
+              *result = from + (ios_off) i * 8;
+              ret = IOS_OK;
+              goto done;
+            }
+          i++;
+        }
+
+      from += (ios_off) ncands * 8;
+      nbytes -= ncands;
+    }
+
+ done:
+  free (buf);
+  return ret;
+}
+
+int
+ios_read_bytes_avail (ios io, ios_off offset, int flags,
+                      void *buf, size_t count, size_t *nread)
+{
+  ios_off end;
+  int ret;
+
+  *nread = 0;
+  ret = ios_read_bytes (io, offset, flags, buf, count);
+  if (ret != IOS_EOF)
+    {
+      if (ret == IOS_OK)
+        *nread = count;
+      return ret;
+    }
+
+  /* Stream devices find out where they end when they are read past
+     the end, so at this point the size of IO is right.  */
+  end = (ios_off) ios_size (io) * 8 - ios_get_bias (io);
+  if (offset >= end)
+    return IOS_OK;
+  if ((uint64_t) (end - offset) / 8 >= count)
+    return IOS_EOF;
+
+  count = (end - offset) / 8;
+  ret = ios_read_bytes (io, offset, flags, buf, count);
+  if (ret == IOS_OK)
+    *nread = count;
+  return ret;
+}
+
+/* Bytes read at once by ios_span_bytes.  The first reads are short,
+   since spans are often short.  */
+#define IOS_SPAN_CHUNK_MIN 64
+#define IOS_SPAN_CHUNK_MAX 4096
+
+int
+ios_span_bytes (ios io, ios_off from, ios_off to,
+                const uint8_t *set, int reject_p, ios_off *result)
+{
+  uint8_t buf[IOS_SPAN_CHUNK_MAX];
+  size_t chunk = IOS_SPAN_CHUNK_MIN;
+
+  reject_p = !!reject_p;
+  while (from < to)
+    {
+      size_t count = chunk, nread, i;
+      int ret;
+
+      if ((uint64_t) (to - from) / 8 < count)
+        count = (to - from) / 8;
+      if (count == 0)
+        break;
+
+      ret = ios_read_bytes_avail (io, from, 0 /* flags */, buf, count,
+                                  &nread);
+      if (ret != IOS_OK)
+        return ret;
+
+      for (i = 0; i < nread; ++i)
+        if (((set[buf[i] / 8] >> (buf[i] % 8)) & 1) == reject_p)
+          {
+            *result = from + (ios_off) i * 8;
+            return IOS_OK;
+          }
+
+      from += (ios_off) nread * 8;
+      if (nread < count)
+        break;
+      if (chunk < IOS_SPAN_CHUNK_MAX)
+        chunk *= 2;
+    }
+
+  *result = from;
+  return IOS_OK;
+}
+
+int
+ios_compare_bytes (ios io1, ios_off off1, ios io2, ios_off off2,
+                   uint64_t count, uint64_t *result)
+{
+  uint8_t *buf1, *buf2;
+  uint64_t done = 0;
+  size_t chunk = 256;
+  int ret = IOS_OK;
+
+  buf1 = malloc (2 * IOS_SEARCH_CHUNK_SIZE);
+  if (buf1 == NULL)
+    return IOS_ENOMEM;
+  buf2 = buf1 + IOS_SEARCH_CHUNK_SIZE;
+
+  while (done < count)
+    {
+      size_t n = count - done < chunk ? count - done : chunk;
+      size_t i = 0;
+
+      if ((ret = ios_read_bytes (io1, off1, 0 /* flags */, buf1, n))
+          != IOS_OK
+          || (ret = ios_read_bytes (io2, off2, 0 /* flags */, buf2, n))
+             != IOS_OK)
+        break;
+
+      /* memcmp is usually vectorized, so use it to locate the block
+         of the chunk containing the first mismatch, if any, before
+         looking at individual bytes.  */
+      if (memcmp (buf1, buf2, n) != 0)
+        {
+          while (i + 64 <= n && memcmp (buf1 + i, buf2 + i, 64) == 0)
+            i += 64;
+          while (buf1[i] == buf2[i])
+            i++;
+          done += i;
+          break;
+        }
+
+      done += n;
+      off1 += (ios_off) n * 8;
+      off2 += (ios_off) n * 8;
+
+      /* Start with small chunks, so finding a close mismatch is
+         cheap, and make them bigger as the ranges turn out to be
+         equal.  */
+      if (chunk < IOS_SEARCH_CHUNK_SIZE)
+        chunk *= 2;
+    }
+
+  free (buf1);
+  if (ret == IOS_OK)
+    *result = done;
+  return ret;
+}
+
+/* Size of the chunks moved by ios_copy_bytes.  */
+#define IOS_COPY_CHUNK_SIZE (1024 * 1024)
+
+int
+ios_copy_bytes (ios from_io, ios_off from, ios to_io, ios_off to,
+                uint64_t count, ios_progress_fn progress_fn, void *data)
+{
+  uint8_t *buf;
+  uint64_t done = 0;
+  int backwards_p;
+  int ret = IOS_OK;
+
+  if (count == 0 || (from_io == to_io && from == to))
+    return IOS_OK;
+
+  if (!(from_io->dev_if->get_flags (from_io->dev) & IOS_F_READ)
+      || !(to_io->dev_if->get_flags (to_io->dev) & IOS_F_WRITE))
+    return IOS_EPERM;
+
+  /* Let the devices copy the data by themselves if they can.  Any
+     buffered or dirty cached data shall reach the devices first, and
+     the cached data of the destination device becomes stale.  */
+  if (from_io != to_io
+      && from_io->dev_if == to_io->dev_if
+      && from_io->dev_if->copy
+      && (from + ios_get_bias (from_io)) % 8 == 0
+      && (to + ios_get_bias (to_io)) % 8 == 0)
+    {
+      ios_dev_off src = (from + ios_get_bias (from_io)) / 8;
+      ios_dev_off dst = (to + ios_get_bias (to_io)) / 8;
+
+      if ((ret = ios_flush_write_buffer (from_io)) != IOD_OK
+          || (ret = ios_flush_write_buffer (to_io)) != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+      if (from_io->cache
+          && (ret = ios_cache_sync_range (from_io->cache, src, count))
+             != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+      if (to_io->cache
+          && (ret = ios_cache_sync_range (to_io->cache, dst, count))
+             != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+
+      ret = from_io->dev_if->copy (from_io->dev, src, to_io->dev, dst, count);
+      if (ret != IOD_EINVAL)
+        {
+          to += ios_get_bias (to_io);
+          ios_mark_dirty_range (to_io, to, to + count * 8);
+          if (ret == IOD_OK && progress_fn)
+            progress_fn (to_io, count, count, data);
+          return IOD_ERROR_TO_IOS_ERROR (ret);
+        }
+      ret = IOS_OK;
+    }
+
+  buf = malloc (count < IOS_COPY_CHUNK_SIZE ? count : IOS_COPY_CHUNK_SIZE);
+  if (buf == NULL)
+    return IOS_ENOMEM;
+
+  /* If the destination range starts inside the source range then the
+     chunks shall be copied starting from the end, or the source would
+     be overwritten before being read.  */
+  backwards_p = (from_io == to_io && to > from && to < from + count * 8);
+
+  /* The writes of the chunks are batched, so the mapped values
+     overlapping the destination range get marked only once.  */
+  ios_begin_write_batch (to_io);
+  while (done < count)
+    {
+      size_t n = (count - done < IOS_COPY_CHUNK_SIZE
+                  ? count - done : IOS_COPY_CHUNK_SIZE);
+      uint64_t pos = backwards_p ? count - done - n : done;
+      ios_off src = from + (ios_off) pos * 8;
+      ios_off dst = to + (ios_off) pos * 8;
+
+      if ((ret = ios_read_bytes (from_io, src, 0 /* flags */, buf, n))
+          != IOS_OK
+          || (ret = ios_write_bytes (to_io, dst, 0 /* flags */, buf, n))
+             != IOS_OK)
+        break;
+
+      done += n;
+      if (progress_fn && progress_fn (to_io, done, count, data))
+        {
+          ret = IOS_ECANCEL;
+          break;
+        }
+    }
+  {
+    int end_ret = ios_end_write_batch (to_io);
+
+    if (ret == IOS_OK)
+      ret = end_ret;
+  }
+
+  free (buf);
+  return ret;
+}
+
+int
+ios_write_bytes (ios io, ios_off offset, int flags,
+                 const void *buf, size_t count)
+{
+  const uint8_t *p = buf;
+
+  /* The IOS should be writable.  */
+  if (!(io->dev_if->get_flags (io->dev) & IOS_F_WRITE))
+    return IOS_EPERM;
+
+  /* Apply the IOS bias.  */
+  offset += ios_get_bias (io);
+
+  /* Mark the range of bits written as dirty, so that mapped values
+     which overlap the range will be remapped.  */
+  ios_mark_dirty_range (io, offset, offset + count * 8);
+  ios_count_access (io, 1 /* write_p */, (uint64_t) count * 8);
+
+  /* Fast track for byte-aligned offsets.  */
+  if (offset % 8 == 0)
+    return IOD_ERROR_TO_IOS_ERROR (ios_do_pwrite (io, flags, buf, count,
+                                                  offset / 8));
+
+  /* The bytes are not aligned in the IOS.  Write them one at a
+     time.  */
+  for (size_t i = 0; i < count; ++i)
+    {
+      int ret = ios_write_int_common (io, offset + i * 8, flags, 8,
+                                      IOS_ENDIAN_MSB, p[i]);
+
+      if (ret != IOS_OK)
+        return ret;
+    }
+
+  return IOS_OK;
+}
+
+uint64_t
+ios_size (ios io)
+{
+  /* The collected writes may extend the device.  */
+  (void) ios_flush_write_buffer (io);
+  return io->dev_if->size (io->dev);
+}
+
+uint64_t
+ios_write_count (ios io)
+{
+  return io->write_count;
+}
+
+int
+ios_flush (ios io, ios_off offset)
+{
+  int ret;
+
+  /* The collected and cached writes shall reach the device before
+     flushing it.  */
+  ret = ios_flush_write_buffer (io);
+  if (ret != IOD_OK)
+    return IOD_ERROR_TO_IOS_ERROR (ret);
+  if (io->cache)
+    {
+      ret = ios_cache_flush (io->cache);
+      if (ret != IOD_OK)
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+    }
+
+  return io->dev_if->flush (io->dev, offset / 8);
+}
+
+int
+ios_set_cache (ios io, uint64_t block_size, uint64_t nblocks)
+{
+  struct ios_cache *cache = NULL;
+
+  if (block_size != 0 && nblocks != 0)
+    {
+      if ((block_size & (block_size - 1)) != 0
+          || block_size > SIZE_MAX || nblocks > SIZE_MAX)
+        return IOS_EINVAL;
+
+      cache = ios_cache_new (io->ctx->cache_pool, io->dev_if, io->dev,
+                             block_size, nblocks,
+                             io->volatile_p /* write_through_p */);
+      if (!cache)
+        return IOS_ENOMEM;
+      ios_cache_set_notify (cache, ios_dev_op_done, io);
+    }
+
+  /* Write back the collected writes and the contents of the old
+     cache before replacing it.  */
+  {
+    int ret = ios_flush_write_buffer (io);
+
+    if (ret != IOD_OK)
+      {
+        ios_cache_free (cache);
+        return IOD_ERROR_TO_IOS_ERROR (ret);
+      }
+  }
+  if (io->cache)
+    {
+      int ret = ios_cache_flush (io->cache);
+
+      if (ret != IOD_OK)
+        {
+          ios_cache_free (cache);
+          return IOD_ERROR_TO_IOS_ERROR (ret);
+        }
+      ios_cache_free (io->cache);
+    }
+
+  io->cache = cache;
+  return IOS_OK;
+}
+
+int
+ios_set_cache_budget (ios_context ios_ctx, uint64_t budget)
+{
+  int ret;
+
+  if (budget > SIZE_MAX)
+    return IOS_EINVAL;
+
+  ret = ios_cache_pool_set_budget (ios_ctx->cache_pool, budget);
+  return IOD_ERROR_TO_IOS_ERROR (ret);
+}
+
+uint64_t
+ios_get_cache_budget (ios_context ios_ctx)
+{
+  return ios_cache_pool_budget (ios_ctx->cache_pool);
+}
+
+uint64_t
+ios_get_cache_used (ios_context ios_ctx)
+{
+  return ios_cache_pool_used (ios_ctx->cache_pool);
+}
+
+uint64_t
+ios_get_stat (ios io, int stat)
+{
+  struct ios_cache_stats cache_stats = { 0, 0, 0 };
+
+  if (io->cache)
+    ios_cache_get_stats (io->cache, &cache_stats);
+
+  switch (stat)
+    {
+    case IOS_STAT_CACHE_HITS:
+      return cache_stats.hits;
+    case IOS_STAT_CACHE_MISSES:
+      return cache_stats.misses;
+    case IOS_STAT_CACHE_BYTES:
+      return cache_stats.bytes;
+    case IOS_STAT_RANGES:
+      return ios_rangetbl_nentries (io->ranges);
+    case IOS_STAT_RANGE_BYTES:
+      return ios_rangetbl_bytes (io->ranges);
+    default:
+      return (stat >= 0 && stat < IOS_STAT_NUM) ? io->stats[stat] : 0;
+    }
+}
+
+void
+ios_reset_stats (ios io)
+{
+  memset (io->stats, 0, sizeof (io->stats));
+  if (io->cache)
+    ios_cache_reset_stats (io->cache);
+}
+
+void
+ios_set_trace (ios io, ios_trace_fn fn)
+{
+  io->trace_fn = fn;
+}
+
+void
+ios_invalidate_volatile_caches (ios_context ios_ctx)
+{
+  for (ios io = ios_ctx->io_list; io; io = io->next)
+    {
+      /* Prefetch hints only last for a run of the PVM.  */
+      io->prefetch_begin = 0;
+      io->prefetch_end = 0;
+
+      if (!io->volatile_p)
+        continue;
+
+      if (io->cache)
+        /* Volatile caches are write-through, so this cannot fail.  */
+        (void) ios_cache_invalidate (io->cache);
+
+      /* Likewise, forget about anything the device fetched in
+         advance.  */
+      if (io->dev_if->prefetch)
+        (void) io->dev_if->prefetch (io->dev, 0, 0);
+    }
+}
+
+int
+ios_pread (ios io, void *buf, size_t count, ios_dev_off offset)
+{
+  return ios_do_pread (io, 0 /* flags */, buf, count, offset);
+}
+
+int
+ios_pwrite (ios io, const void *buf, size_t count, ios_dev_off offset)
+{
+  return ios_do_pwrite (io, 0 /* flags */, buf, count, offset);
+}
+
+const void *
+ios_get_ptr (ios io, size_t count, ios_dev_off offset)
+{
+  return ios_do_get_ptr (io, 0 /* flags */, count, offset);
+}
+
+int
+ios_pprefetch (ios io, size_t count, ios_dev_off offset)
+{
+  /* If the device can fetch the data in the background, let it do
+     so.  The cache will then get its blocks from the device as they
+     are needed.  */
+  if (io->dev_if->prefetch)
+    {
+      int ret = io->dev_if->prefetch (io->dev, offset, count);
+
+      if (ret != IOD_EINVAL)
+        return ret;
+    }
+
+  if (io->cache)
+    return ios_cache_prefetch (io->cache, offset, count);
+
+  return IOD_OK;
+}
+
+void *
+ios_get_dev (ios ios)
+{
+  return ios->dev;
+}
+
+const struct ios_dev_if *
+ios_get_dev_if (ios ios)
+{
+  return ios->dev_if;
+}
+
+struct ios_dev_if *
+ios_foreign_iod (ios_context ios_ctx)
+{
+  return ios_ctx->foreign_dev_if;
+}
+
+int
+ios_register_foreign_iod (ios_context ios_ctx, struct ios_dev_if *iod_if,
+                          void *data, int cache_p)
+{
+  if (ios_ctx->foreign_dev_if)
+    return IOS_ERROR;
+
+  ios_ctx->foreign_dev_if = iod_if;
+  ios_ctx->foreign_dev_if_data = data;
+  ios_ctx->foreign_dev_if_cache_p = cache_p;
+  return IOS_OK;
+}
+
+void
+ios_inc_sub_dev (ios io)
+{
+  ++io->num_sub_devs;
+}
+
+void
+ios_dec_sub_dev (ios io)
+{
+  assert (io->num_sub_devs != 0);
   --io->num_sub_devs;
   if (io->zombie_p && io->num_sub_devs == 0)
     free (io);
@@ -1683,6 +2654,10 @@ ios_register_range (pvm_val val, ios io, ios_off offset, ios_off size)
 {
   if (PVM_IS_ARR (val) || PVM_IS_SCT (val))
     {
+      /* Pending dirty ranges were written before VAL got mapped, so
+         they shall not affect it.  */
+      ios_flush_dirty (io);
+
       PVM_VAL_SET_IOSLIVE_P (val, 1);
       return ios_rangetbl_insert (io->ranges, val, offset, offset + size);
     }
@@ -1699,11 +2674,174 @@ ios_deregister_range (pvm_val val, ios io, ios_off offset)
 void
 ios_mark_dirty_range (ios io, ios_off begin, ios_off end)
 {
-  ios_rangetbl_dirty (io->ranges, begin, end);
+  int i;
+
+  io->write_count++;
+  io->stats[IOS_STAT_DIRTY_MARKS]++;
+
+  if (io->batch_depth == 0)
+    {
+      ios_rangetbl_dirty (io->ranges, begin, end);
+      return;
+    }
+
+  /* Merge the range with a pending range it overlaps or is adjacent
+     to, if any.  The most recent range is tried first, since writes
+     are usually sequential.  */
+  for (i = io->dirty_count - 1; i >= 0; --i)
+    {
+      if (begin <= io->dirty[i].end && end >= io->dirty[i].begin)
+        {
+          if (begin < io->dirty[i].begin)
+            io->dirty[i].begin = begin;
+          if (end > io->dirty[i].end)
+            io->dirty[i].end = end;
+          return;
+        }
+    }
+
+  if (io->dirty_count == IOS_DIRTY_BATCH_SIZE)
+    ios_flush_dirty (io);
+
+  io->dirty[io->dirty_count].begin = begin;
+  io->dirty[io->dirty_count].end = end;
+  io->dirty_count++;
 }
 
 void
 ios_mark_dirty_all (ios io)
 {
+  /* Any pending range is covered.  */
+  io->dirty_count = 0;
   ios_rangetbl_dirty_all (io->ranges);
 }
+
+void
+ios_begin_write_batch (ios io)
+{
+  io->batch_depth++;
+}
+
+int
+ios_end_write_batch (ios io)
+{
+  int ret = IOD_OK;
+
+  if (io->batch_depth > 0 && --io->batch_depth == 0)
+    {
+      ret = ios_flush_write_buffer (io);
+      ios_flush_dirty (io);
+    }
+
+  return IOD_ERROR_TO_IOS_ERROR (ret);
+}
+
+void
+ios_close_write_batches (ios_context ios_ctx)
+{
+  for (ios io = ios_ctx->io_list; io; io = io->next)
+    if (io->batch_depth > 0)
+      {
+        io->batch_depth = 1;
+        (void) ios_end_write_batch (io);
+      }
+}
+
+void
+ios_flush_dirty (ios io)
+{
+  int i;
+
+  for (i = 0; i < io->dirty_count; ++i)
+    ios_rangetbl_dirty (io->ranges, io->dirty[i].begin, io->dirty[i].end);
+  io->dirty_count = 0;
+}
+
+int
+ios_set_map_cache (ios io, uint64_t nentries)
+{
+  struct ios_map_cache_entry *map_cache = NULL;
+
+  if (nentries > SIZE_MAX / sizeof (struct ios_map_cache_entry))
+    return IOS_ENOMEM;
+
+  if (nentries != 0)
+    {
+      /* Note that uncollectable memory is cleared, so the entries
+         start with null values.  */
+      map_cache
+        = pvm_alloc_uncollectable (nentries
+                                   * sizeof (struct ios_map_cache_entry));
+      if (!map_cache)
+        return IOS_ENOMEM;
+    }
+
+  if (io->map_cache)
+    pvm_free_uncollectable (io->map_cache);
+  io->map_cache = map_cache;
+  io->map_cache_size = nentries;
+  return IOS_OK;
+}
+
+static struct ios_map_cache_entry *
+ios_map_cache_entry (ios io, uint64_t mapper, ios_off offset)
+{
+  uint64_t hash = (mapper ^ (offset * 0x9e3779b97f4a7c15ULL)) >> 3;
+
+  return &io->map_cache[hash % io->map_cache_size];
+}
+
+uint64_t
+ios_map_cache_lookup (ios io, uint64_t mapper, int strict_p,
+                      ios_off offset, enum ios_endian endian,
+                      enum ios_nenc nenc)
+{
+  struct ios_map_cache_entry *entry;
+  pvm_val val;
+
+  if (!io->map_cache || io->volatile_p)
+    return PVM_NULL;
+
+  entry = ios_map_cache_entry (io, mapper, offset);
+  val = entry->val;
+  if (val == PVM_NULL
+      || entry->mapper != mapper || entry->offset != offset
+      || entry->strict_p != strict_p
+      || entry->endian != endian || entry->nenc != nenc)
+    return PVM_NULL;
+
+  /* The value may have been unmapped, relocated or written since it
+     was cached.  Pending dirty ranges must be taken into account.  */
+  ios_flush_dirty (io);
+  if (!PVM_VAL_MAPPED_P (val) || !PVM_VAL_IOSLIVE_P (val)
+      || PVM_VAL_DIRTY_P (val)
+      || PVM_VAL_IOS_PTR (val) != io
+      || PVM_VAL_ULONG (PVM_VAL_OFFSET (val)) != offset
+      || PVM_VAL_MAPPER (val) != mapper
+      || PVM_VAL_STRICT_P (val) != strict_p)
+    {
+      entry->val = PVM_NULL;
+      return PVM_NULL;
+    }
+
+  return val;
+}
+
+void
+ios_map_cache_insert (ios io, uint64_t val, uint64_t mapper,
+                      int strict_p, ios_off offset,
+                      enum ios_endian endian, enum ios_nenc nenc)
+{
+  struct ios_map_cache_entry *entry;
+
+  if (!io->map_cache || io->volatile_p)
+    return;
+
+  entry = ios_map_cache_entry (io, mapper, offset);
+  entry->val = val;
+  entry->mapper = mapper;
+  entry->offset = offset;
+  entry->strict_p = strict_p;
+  entry->endian = endian;
+  entry->nenc = nenc;
+}
@@ -23,6 +23,8 @@
 #include <config.h>
 #include <stdint.h>
 #include <stdbool.h>
+#include <string.h>
+#include <byteswap.h>
 
 typedef struct ios_context *ios_context;
 
@@ -105,6 +107,8 @@ typedef int64_t ios_off;
 
 #define IOS_ENOENT -9  /* Specified device not found.  */
 
+#define IOS_ECANCEL -10 /* The operation was cancelled.  */
+
 #define IOD_ERROR_TO_IOS_ERROR(error_no) (error_no)
 
 /* **************** IOS flags ******************************
@@ -128,6 +132,16 @@ typedef int64_t ios_off;
 
 #define IOS_F_VOLATILE (1 << 8)
 
+/* Open the IO space read-only, sharing its device and the cache of
+   its contents with the IO spaces opened with this flag on the same
+   handler in other IO contexts of the process.  The IO spaces of
+   different contexts can then be read by different threads at the
+   same time.  This is supported by files, compressed files, NBD and
+   zero devices, and is incompatible with IOS_F_WRITE, IOS_F_CREATE
+   and IOS_F_VOLATILE.  */
+
+#define IOS_F_SHARED (1 << 9)
+
 #define IOS_M_RDONLY (IOS_F_READ)
 #define IOS_M_WRONLY (IOS_F_WRITE)
 #define IOS_M_RDWR (IOS_F_READ | IOS_F_WRITE)
@@ -278,9 +292,9 @@ int ios_zombie_p (ios io);
    impacting the way the operation is performed.  */
 
 #define IOS_F_BYPASS_CACHE  1  /* Bypass the IO space cache.  This
-                                  makes this write operation to
-                                  immediately write to the underlying
-                                  IO device.  */
+                                  makes this operation to immediately
+                                  read from or write to the
+                                  underlying IO device.  */
 
 #define IOS_F_BYPASS_UPDATE 2  /* Do not call update hooks that would
                                   be triggered by this write
@@ -314,6 +328,31 @@ enum ios_endian
    IOS_ENDIAN_MSB  /* Byte big endian.  */
   };
 
+/* Decode the BITS / 8 bytes at P as an unsigned integer encoded with
+   the ENDIAN byte endianness.  BITS shall be a multiple of 8 between
+   8 and 64.  P doesn't need to be aligned.
+
+   This doesn't branch on the width of the integer, and compiles into
+   an unaligned load followed by an optional byte swap and shift.  */
+
+static inline uint64_t
+ios_decode_uint (const uint8_t *p, int bits, enum ios_endian endian)
+{
+  uint64_t value = 0;
+
+#ifdef WORDS_BIGENDIAN
+  memcpy ((uint8_t *) &value + (8 - bits / 8), p, bits / 8);
+  if (endian == IOS_ENDIAN_LSB)
+    value = bswap_64 (value) >> (64 - bits);
+#else
+  memcpy (&value, p, bits / 8);
+  if (endian == IOS_ENDIAN_MSB)
+    value = bswap_64 (value) >> (64 - bits);
+#endif
+
+  return value;
+}
+
 /* Read a signed integer of size BITS located at the given OFFSET, and
    put its value in VALUE.  It is assumed the integer is encoded using
    the ENDIAN byte endianness and NENC negative encoding.  */
@@ -352,6 +391,125 @@ int ios_write_uint (ios io, ios_off offset, int flags,
                     enum ios_endian endian,
                     uint64_t value);
 
+/* Read COUNT bytes located at the given OFFSET, and put them in BUF.
+   OFFSET is a bit-offset and doesn't have to be aligned to a byte
+   boundary, but reads at aligned offsets are considerably faster
+   since they are performed in a single operation on the underlying
+   IO device.  */
+
+int ios_read_bytes (ios io, ios_off offset, int flags,
+                    void *buf, size_t count);
+
+/* Return a pointer to the COUNT bytes located at the given OFFSET,
+   without copying them.  Return NULL if OFFSET is not aligned to a
+   byte boundary, if the bytes are not all available, or if neither
+   the underlying IO device nor the cache of IO can provide direct
+   access to them.  The cache only can if the bytes lie in a single
+   cache block.  In that case ios_read_bytes shall be used
+   instead.
+
+   The returned pointer is only valid until the next operation
+   writing to IO.  */
+
+const void *ios_read_ptr (ios io, ios_off offset, int flags,
+                          size_t count);
+
+/* Tell IO that the SIZE bits located at the given OFFSET are about to
+   be read, so it can get them from the underlying IO device in as
+   few operations as possible.  This is just a hint, and doesn't
+   affect the result of subsequent reads.
+
+   Hints covered by the last hint given to IO since the PVM started
+   executing the current program are ignored, so the mappers of
+   nested data don't override the hint given by the mapper of the
+   enclosing data.  */
+
+int ios_prefetch (ios io, ios_off offset, ios_off size);
+
+/* Store in *MTIME the time of the last modification of the object
+   underlying IO, in seconds since the Epoch.  Return IOS_OK, or
+   IOS_EINVAL if the IO device doesn't know about modification
+   times.  */
+
+int ios_mtime (ios io, int64_t *mtime);
+
+/* Search IO for the first occurrence of the LEN bytes in PATTERN,
+   at byte steps starting at the bit-offset FROM and ending at the
+   bit-offset TO.  If MASK is not NULL, it contains LEN bytes and
+   only the bits set in MASK are compared.
+
+   If the pattern is found, set *RESULT to its bit-offset and return
+   IOS_OK.  If the pattern is not found, return IOS_EOF.  Otherwise
+   return an error code.  */
+
+/* Read up to COUNT bytes at the bit-offset OFFSET of IO into BUF,
+   and set *NREAD to the number of bytes read.  Fewer bytes than
+   COUNT are read only if IO ends before, which for stream IO spaces
+   means that the stream has ended.  In particular, no bytes are read
+   if OFFSET is at the end of IO.  Return IOS_OK, or an error code if
+   the bytes can't be read.  */
+
+int ios_read_bytes_avail (ios io, ios_off offset, int flags,
+                          void *buf, size_t count, size_t *nread);
+
+/* Scan the bytes of IO starting at the bit-offset FROM, while they
+   belong to SET, or while they don't belong to it if REJECT_P is set,
+   a la strspn and strcspn.  SET is a bitmap of 256 bits, in which the
+   bit N % 8 of the byte N / 8 is set if the byte N belongs to the set.
+   The scan stops at the bit-offset TO or at the end of IO, whatever
+   comes first.  Stream IO spaces are read as needed.
+
+   Set *RESULT to the bit-offset where the scan stopped and return
+   IOS_OK, or return an error code if the bytes can't be read.  */
+
+int ios_span_bytes (ios io, ios_off from, ios_off to,
+                    const uint8_t *set, int reject_p, ios_off *result);
+
+int ios_search_bytes (ios io, ios_off from, ios_off to,
+                      const uint8_t *pattern, const uint8_t *mask,
+                      size_t len, ios_off *result);
+
+/* Compare the COUNT bytes located at the bit-offset OFF1 in IO1 with
+   the COUNT bytes located at the bit-offset OFF2 in IO2.  IO1 and IO2
+   may be the same IO space.
+
+   If some byte differs, set *RESULT to the index of the first one,
+   counting from the beginning of the ranges.  Otherwise, set *RESULT
+   to COUNT.  Return IOS_OK, or an error code if the bytes can't be
+   read.  */
+
+int ios_compare_bytes (ios io1, ios_off off1, ios io2, ios_off off2,
+                       uint64_t count, uint64_t *result);
+
+/* Copy the COUNT bytes located at the bit-offset FROM in FROM_IO to
+   the bit-offset TO in TO_IO.  FROM_IO and TO_IO may be the same IO
+   space, and the ranges may overlap.
+
+   The data is moved in big chunks, and directly from device to
+   device when both devices support it.  The range written in TO_IO
+   is marked as dirty only once.
+
+   If PROGRESS_FN is not NULL, it is called after every chunk with
+   TO_IO, the number of bytes copied so far, COUNT and DATA.  If it
+   returns non-zero then the copy is stopped, leaving the chunks
+   already copied in place.
+
+   Return IOS_OK, IOS_ECANCEL if the copy was stopped by PROGRESS_FN,
+   or an error code if the bytes can't be read or written.  */
+
+typedef int (*ios_progress_fn) (ios io, uint64_t done, uint64_t total,
+                                void *data);
+
+int ios_copy_bytes (ios from_io, ios_off from, ios to_io, ios_off to,
+                    uint64_t count, ios_progress_fn progress_fn,
+                    void *data);
+
+/* Write the COUNT bytes in BUF to the space IO, at the given
+   OFFSET.  */
+
+int ios_write_bytes (ios io, ios_off offset, int flags,
+                     const void *buf, size_t count);
+
 /* If the current IOD is a write stream, write out the data in the buffer
    till OFFSET.  If the current IOD is a stream IOD, free (if allowed by the
    embedded buffering strategy) bytes up to OFFSET.  This function has no
@@ -359,6 +517,165 @@ int ios_write_uint (ios io, ios_off offset, int flags,
 
 int ios_flush (ios io, ios_off offset);
 
+/* Store in *BEGIN and *END the bit-offsets delimiting the first range
+   of bytes of IO ending after OFFSET that has been changed but has not
+   reached the underlying storage yet.  The range doesn't start before
+   OFFSET.  Return IOS_OK on success, IOS_EOF if there are no more
+   such changes and IOS_EINVAL if the device of IO doesn't keep track
+   of them.  */
+
+int ios_next_change (ios io, ios_off offset, ios_off *begin, ios_off *end);
+
+/* Drop the changes to IO that have not reached the underlying
+   storage yet.  Return IOS_OK on success and IOS_EINVAL if the device
+   of IO doesn't support it.  */
+
+int ios_discard (ios io);
+
+/* **************** Cache API **************** */
+
+/* Reads and writes to IO spaces operating on devices that benefit
+   from it are served by a block cache, which keeps copies of
+   aligned blocks of the accessed data.  Writes to non-volatile IO
+   spaces are kept in the cache until the cache is flushed, which
+   happens in ios_flush and ios_close.  Writes to volatile IO spaces
+   are always propagated to the device, and their caches are dropped
+   by ios_invalidate_volatile_caches.
+
+   The flag IOS_F_BYPASS_CACHE can be used in order to access the
+   underlying device directly.  */
+
+/* Set the geometry of the cache of the given IO space.  BLOCK_SIZE is
+   the size of the cache blocks, in bytes, and shall be a power of
+   two.  NBLOCKS is the maximum number of blocks to keep in the cache.
+   If either is zero then the IO space will not use a cache.
+
+   Any pending write in the existing cache is written out to the
+   device.
+
+   Return IOS_OK on success, IOS_EINVAL if the geometry is not valid,
+   IOS_ENOMEM if there is not enough memory for the new cache or some
+   other error code if the existing cache couldn't be written
+   back.  */
+
+int ios_set_cache (ios io, uint64_t block_size, uint64_t nblocks);
+
+/* The memory used by the caches of all the IO spaces of an IO
+   context is limited by a global budget.  When it is exhausted, the
+   least recently used block among all the caches is evicted to make
+   room for new blocks.  Note that sub IO spaces access their base IO
+   space through its cache, so the blocks cached for the base are
+   shared by all the sub IO spaces operating on it.
+
+   Set the cache budget of the IO context IOS_CTX to BUDGET bytes.  If
+   the cached data exceeds the new budget then the least recently used
+   blocks are evicted, writing them back if needed.
+
+   Return IOS_OK on success, IOS_EINVAL if BUDGET is too big or some
+   other error code if some block couldn't be written back.  */
+
+int ios_set_cache_budget (ios_context ios_ctx, uint64_t budget);
+
+/* Return the cache budget of the IO context IOS_CTX, in bytes.  */
+
+uint64_t ios_get_cache_budget (ios_context ios_ctx);
+
+/* Return the number of bytes currently held by the caches of the IO
+   spaces of the IO context IOS_CTX.  */
+
+uint64_t ios_get_cache_used (ios_context ios_ctx);
+
+/* **************** Statistics API **************** */
+
+/* Return the value of the given statistic of IO.  STAT shall be one
+   of the IOS_STAT_* values below.
+
+   IOS_STAT_CACHE_HITS is the number of accesses to cached blocks
+   that were found in the cache.
+
+   IOS_STAT_CACHE_MISSES is the number of blocks that had to be read
+   into the cache.
+
+   IOS_STAT_CACHE_BYTES is the memory currently used by the cached
+   blocks of IO.  The statistics of the cache of IO spaces not having
+   a cache are zero.
+
+   IOS_STAT_READS and IOS_STAT_WRITES are the number of read and
+   write operations performed on IO, like ios_read_uint or
+   ios_write_bytes.  IOS_STAT_{READS,WRITES}_{8,32,64} count the ones
+   that transferred up to 8, 32 and 64 bits respectively, and
+   IOS_STAT_{READS,WRITES}_BULK count the bigger ones.
+   IOS_STAT_BYTES_READ and IOS_STAT_BYTES_WRITTEN are the number of
+   bytes transferred by them, rounding up partial bytes.
+
+   IOS_STAT_DEV_READS and IOS_STAT_DEV_WRITES are the number of
+   operations performed on the underlying IO device in order to serve
+   the reads and writes.  A batch of reads counts as one.
+
+   IOS_STAT_DIRTY_MARKS is the number of times a range of IO has been
+   marked as dirty.
+
+   IOS_STAT_RANGES is the number of entries in the range table of
+   IO, i.e. the number of mapped values registered in IO.
+   IOS_STAT_RANGE_BYTES is the memory used by the range table.  */
+
+#define IOS_STAT_CACHE_HITS     0
+#define IOS_STAT_CACHE_MISSES   1
+#define IOS_STAT_CACHE_BYTES    2
+#define IOS_STAT_READS          3
+#define IOS_STAT_READS_8        4
+#define IOS_STAT_READS_32       5
+#define IOS_STAT_READS_64       6
+#define IOS_STAT_READS_BULK     7
+#define IOS_STAT_BYTES_READ     8
+#define IOS_STAT_WRITES         9
+#define IOS_STAT_WRITES_8      10
+#define IOS_STAT_WRITES_32     11
+#define IOS_STAT_WRITES_64     12
+#define IOS_STAT_WRITES_BULK   13
+#define IOS_STAT_BYTES_WRITTEN 14
+#define IOS_STAT_DEV_READS     15
+#define IOS_STAT_DEV_WRITES    16
+#define IOS_STAT_DIRTY_MARKS   17
+#define IOS_STAT_RANGES        18
+#define IOS_STAT_RANGE_BYTES   19
+
+#define IOS_STAT_NUM 20
+
+uint64_t ios_get_stat (ios io, int stat);
+
+/* Set the counters of all the statistics of IO to zero.  Note that
+   IOS_STAT_CACHE_BYTES, IOS_STAT_RANGES and IOS_STAT_RANGE_BYTES are
+   not counters, and are not affected.  */
+
+void ios_reset_stats (ios io);
+
+/* Trace the operations performed on the device of IO by calling FN
+   after each of them.  OP is one of the IOS_TRACE_* values below,
+   OFFSET and COUNT are the byte offset in the device and the number
+   of bytes transferred, and STATUS is the IOS_* status code of the
+   operation.  A batch of reads is traced once, with the offset of
+   its first read and the total number of bytes read.
+
+   If FN is NULL then tracing is disabled.  */
+
+#define IOS_TRACE_PREAD  0
+#define IOS_TRACE_PWRITE 1
+#define IOS_TRACE_PREADV 2
+
+typedef void (*ios_trace_fn) (ios io, int op, uint64_t offset,
+                              uint64_t count, int status);
+
+void ios_set_trace (ios io, ios_trace_fn fn);
+
+/* Drop the contents of the caches of all the volatile IO spaces in
+   the given context, and any data fetched in advance by their
+   devices, so their data is fetched again from the devices.  The
+   prefetch hints of all the IO spaces are forgotten as well.  See
+   ios_prefetch.  */
+
+void ios_invalidate_volatile_caches (ios_context ios_ctx);
+
 /* **************** Update API **************** */
 
 /* XXX: writeme.  */
@@ -381,6 +698,11 @@ struct ios_dev_if *ios_foreign_iod (ios_context ios_ctx);
 
 /* Register a foreign IO device.
 
+   DATA is passed to the OPEN function of the device.  If CACHE_P is
+   not zero then the IO spaces operated by the device get a cache,
+   like the ones of the built-in devices accessing files or the
+   network.  Otherwise every access is passed to the device.
+
    Return IOS_ERROR if a foreign IO device has been already
    registered.
 
@@ -388,7 +710,8 @@ struct ios_dev_if *ios_foreign_iod (ios_context ios_ctx);
 
 struct ios_dev_if;
 int ios_register_foreign_iod (ios_context ios_ctx,
-                              struct ios_dev_if *iod_if, void *data);
+                              struct ios_dev_if *iod_if, void *data,
+                              int cache_p);
 
 /* **************** Sub IO space **************** */
 
@@ -406,7 +729,8 @@ void ios_dec_sub_dev (ios io);
 int ios_register_range (uint64_t val, ios io, ios_off offset, ios_off size);
 
 /* De-register VAL from IO's range table.  OFFSET is the offset where VAL
-   is mapped.  Called from pvm-alloc finalizers for struct and array values.  */
+   is mapped.  Note that values that are no longer used don't need to
+   be de-registered, since the range table holds weak references.  */
 void ios_deregister_range (uint64_t val, ios io, ios_off offset);
 
 /* Mark everything mapped in IO overlapping the interval [begin, end] dirty.  */
@@ -415,4 +739,88 @@ void ios_mark_dirty_range (ios io, ios_off begin, ios_off end);
 /* Mark everything currently mapped in IOS dirty.  */
 void ios_mark_dirty_all (ios io);
 
+/* Return the number of writes performed so far in IO.  Every write
+   marks its range dirty, so this changes whenever the contents of IO
+   are modified through the IOS layer.  */
+uint64_t ios_write_count (ios io);
+
+/* Begin/end a write batch in IO.
+
+   While in a write batch the ranges written to IO are not marked
+   dirty right away.  Instead, they are accumulated and merged, and
+   the values overlapping them are marked dirty at the end of the
+   outermost batch, with one query to the range table per merged
+   range.  Batches can be nested.
+
+   Since the accumulated ranges can be flushed at any time with
+   ios_flush_dirty, the dirty flag of a value mapped in IO shall not
+   be checked without flushing first.
+
+   Also, the small writes performed while in a batch are combined, so
+   contiguous writes reach the device as a single write of up to
+   IOS_WRITE_BUFFER_SIZE bytes.  The combined writes are written to
+   the device at the end of the outermost batch, or before anything
+   else accesses the bytes written.  ios_end_write_batch returns
+   IOS_OK, or the error code of writing them.  */
+
+#define IOS_DIRTY_BATCH_SIZE 16
+#define IOS_WRITE_BUFFER_SIZE 4096
+
+void ios_begin_write_batch (ios io);
+int ios_end_write_batch (ios io);
+
+/* End the write batches left open in the IO spaces of IOS_CTX, for
+   example by writes interrupted by an exception.  Errors writing the
+   combined writes to the devices are ignored.  */
+
+void ios_close_write_batches (ios_context ios_ctx);
+
+/* Mark dirty the values overlapping the ranges written in IO in the
+   current write batch, if any.  */
+
+void ios_flush_dirty (ios io);
+
+/* **************** Map Cache ************** */
+
+/* An IO space can optionally keep a cache of struct values mapped in
+   it, so mapping the same type at the same offset several times
+   returns the same value instead of mapping it again.
+
+   The cache is keyed by the mapper closure of the type, the
+   strictness of the map, the bit-offset where the value is mapped and
+   the endianness and negative encoding in effect when it was mapped.
+   A cached value is only returned if it is still mapped at the same
+   place and it is not dirty, i.e. the range where it is mapped has
+   not been written since it was mapped.  Since nothing else is
+   checked, the cache must not be used with types whose mapping
+   depends on anything other than the contents of the IO space, such
+   as the value of global variables.  This is why it is disabled by
+   default.
+
+   The cache is direct-mapped.  It is never used with volatile IO
+   spaces.  */
+
+/* Set the number of entries of the map cache of IO to NENTRIES.  If
+   NENTRIES is zero then the cache is disabled.  The previous
+   contents of the cache are discarded.  Return IOS_OK on success or
+   IOS_ENOMEM if there is not enough memory.  */
+
+int ios_set_map_cache (ios io, uint64_t nentries);
+
+/* Return the value cached in IO for the given key, or PVM_NULL if
+   there is no valid cached value.  MAPPER is the mapper closure of
+   the type and OFFSET the bit-offset of the map.  */
+
+uint64_t ios_map_cache_lookup (ios io, uint64_t mapper, int strict_p,
+                               ios_off offset, enum ios_endian endian,
+                               enum ios_nenc nenc);
+
+/* Store VAL, a struct value mapped in IO, in the map cache of IO
+   along with its key.  This is a no-operation if the cache is
+   disabled.  */
+
+void ios_map_cache_insert (ios io, uint64_t val, uint64_t mapper,
+                           int strict_p, ios_off offset,
+                           enum ios_endian endian, enum ios_nenc nenc);
+
 #endif /* ! IOS_H */
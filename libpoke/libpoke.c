@@ -21,6 +21,8 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <assert.h>
 
 #include "libpoke.h"
 #include "pk-utils.h"
@@ -30,6 +32,7 @@
 #include "pkl-env.h" /* XXX */
 #include "pvm.h"
 #include "pvm-val.h" /* XXX */
+#include "pvm-alloc.h"
 #include "ios-dev.h" /* for struct ios_dev_if */
 #include "configmake.h"
 
@@ -46,12 +49,24 @@ struct _pk_compiler
   int completion_idx;
   struct pkl_ast_node_iter completion_iter;
   void *user_data;
+  /* Event handler installed with pk_set_event_fn.  */
+  pk_event_fn event_fn;
+  void *event_data;
+  /* Terminal interface of the compiler.  */
+  struct pk_term_if_internal term_if;
 };
 
 struct pk_term_if_internal libpoke_term_if;
+_Thread_local struct pk_term_if_internal *libpoke_thread_term_if;
 
 #define PK_RETURN(code) do { return pkc->status = (code); } while (0)
 
+/* Make the terminal interface of PKC the one of the current thread.
+   This is done by the functions that may produce output, so every
+   compiler writes to its own terminal whatever the thread using
+   it.  */
+#define PK_TERM_USE(pkc) (libpoke_thread_term_if = &(pkc)->term_if)
+
 pk_compiler
 pk_compiler_new_with_flags (struct pk_term_if *term_if, uint32_t flags)
 {
@@ -85,8 +100,10 @@ pk_compiler_new_with_flags (struct pk_term_if *term_if, uint32_t flags)
       if (libpoke_datadir == NULL)
         libpoke_datadir = PKGDATADIR;
 
-      libpoke_term_if.term_if = *term_if;
-      libpoke_term_if.pkc = pkc;
+      pkc->term_if.term_if = *term_if;
+      pkc->term_if.pkc = pkc;
+      libpoke_term_if = pkc->term_if;
+      libpoke_thread_term_if = &pkc->term_if;
 
       pkc->vm = pvm_init ();
       if (pkc->vm == NULL)
@@ -101,11 +118,19 @@ pk_compiler_new_with_flags (struct pk_term_if *term_if, uint32_t flags)
       pkc->status = PK_OK;
 
       pvm_set_compiler (pkc->vm, pkc->compiler);
+
+      /* Note that the compiler bootstrap above is run with the
+         collector enabled.  */
+      if (flags & PK_F_GCREGION)
+        pvm_set_gc_region (pkc->vm, 1);
+      if (flags & PK_F_NOEXITGC)
+        pvm_set_exit_gc (pkc->vm, 0);
     }
 
   return pkc;
 
  error:
+  libpoke_thread_term_if = NULL;
   free (pkc);
   return NULL;
 }
@@ -116,6 +141,36 @@ pk_compiler_new (struct pk_term_if *term_if)
   return pk_compiler_new_with_flags (term_if, 0 /* flags */);
 }
 
+pk_compiler
+pk_compiler_clone (pk_compiler pkc)
+{
+  pk_compiler clone = calloc (1, sizeof (struct _pk_compiler));
+
+  if (!clone)
+    return NULL;
+
+  clone->vm = pvm_clone (pkc->vm);
+  if (clone->vm == NULL)
+    goto error;
+  clone->compiler = pkl_clone (pkc->compiler, clone->vm);
+  if (clone->compiler == NULL)
+    {
+      pvm_shutdown (clone->vm);
+      goto error;
+    }
+  clone->complete_type = NULL;
+  clone->status = PK_OK;
+  clone->term_if.term_if = pkc->term_if.term_if;
+  clone->term_if.pkc = clone;
+
+  pvm_set_compiler (clone->vm, clone->compiler);
+  return clone;
+
+ error:
+  free (clone);
+  return NULL;
+}
+
 
 void
 pk_compiler_free (pk_compiler pkc)
@@ -124,6 +179,8 @@ pk_compiler_free (pk_compiler pkc)
     {
       pkl_free (pkc->compiler);
       pvm_shutdown (pkc->vm);
+      if (libpoke_thread_term_if == &pkc->term_if)
+        libpoke_thread_term_if = NULL;
     }
 
   free (pkc);
@@ -155,6 +212,7 @@ int
 pk_compile_file (pk_compiler pkc, const char *filename,
                  pk_val *exit_exception)
 {
+  PK_TERM_USE (pkc);
   PK_RETURN (pkl_execute_file (pkc->compiler, filename, exit_exception)
              ? PK_OK
              : PK_ERROR);
@@ -166,6 +224,7 @@ pk_compile_buffer_with_loc (pk_compiler pkc, const char *buffer,
                             uint32_t line, uint32_t column,
                             const char **end, pk_val *exit_exception)
 {
+  PK_TERM_USE (pkc);
   PK_RETURN (pkl_execute_buffer (pkc->compiler, buffer,
                                  source, line, column,
                                  end, exit_exception) ? PK_OK : PK_ERROR);
@@ -191,6 +250,7 @@ pk_compile_statement_with_loc (pk_compiler pkc, const char *buffer,
 {
   pvm_val val;
 
+  PK_TERM_USE (pkc);
   if (!pkl_execute_statement (pkc->compiler, buffer,
                               source, line, column,
                               end, &val,
@@ -224,6 +284,7 @@ pk_compile_expression_with_loc (pk_compiler pkc, const char *buffer,
 {
   pvm_val val;
 
+  PK_TERM_USE (pkc);
   if (!pkl_execute_expression (pkc->compiler, buffer,
                                source, line, column,
                                end, &val,
@@ -251,6 +312,7 @@ pk_compile_expression (pk_compiler pkc, const char *buffer,
 int
 pk_load (pk_compiler pkc, const char *module, pk_val *exit_exception)
 {
+  PK_TERM_USE (pkc);
   PK_RETURN (pkl_load (pkc->compiler, module, exit_exception) == 0 ? PK_ERROR
                                                                    : PK_OK);
 }
@@ -275,6 +337,47 @@ pk_get_debug_ast (pk_compiler pkc)
   return pkl_get_last_ast_str (pkc->compiler);
 }
 
+int
+pk_set_timing_p (pk_compiler pkc, int timing_p)
+{
+  if (!pkl_set_timing_p (pkc->compiler, timing_p))
+    PK_RETURN (PK_ERROR);
+  PK_RETURN (PK_OK);
+}
+
+void
+pk_phase_times (pk_compiler pkc, pk_phase_time_fn handler, void *data)
+{
+  pkl_phase_times (pkc->compiler, handler, data);
+}
+
+void
+pk_decl_times (pk_compiler pkc, pk_decl_time_fn handler, void *data)
+{
+  pkl_decl_times (pkc->compiler, handler, data);
+}
+
+void
+pk_reset_phase_times (pk_compiler pkc)
+{
+  pkl_reset_phase_times (pkc->compiler);
+}
+
+int
+pk_set_compile_stats_p (pk_compiler pkc, int compile_stats_p)
+{
+  if (!pkl_set_compile_stats_p (pkc->compiler, compile_stats_p))
+    PK_RETURN (PK_ERROR);
+  PK_RETURN (PK_OK);
+}
+
+int
+pk_compile_stats_p (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pkl_compile_stats_p (pkc->compiler);
+}
+
 void
 pk_set_lexical_cuckolding_p (pk_compiler pkc, int lexical_cuckolding_p)
 {
@@ -524,6 +627,7 @@ pk_disassemble_function_val (pk_compiler pkc,
 {
   pvm_program program;
 
+  PK_TERM_USE (pkc);
   if (!PVM_IS_CLS (val))
     PK_RETURN (PK_ERROR);
 
@@ -569,6 +673,7 @@ pk_disassemble_expression (pk_compiler pkc, const char *str,
 
   pvm_program program;
 
+  PK_TERM_USE (pkc);
   program_string = str;
   program = pkl_compile_expression (pkc->compiler,
                                     program_string, &end);
@@ -598,6 +703,7 @@ pk_disassemble_statement (pk_compiler pkc, const char *program_str,
   pvm_program program;
   const char *end;
 
+  PK_TERM_USE (pkc);
   program = pkl_compile_statement (pkc->compiler,
                                    program_str, &end);
 
@@ -622,6 +728,7 @@ pk_disassemble_statement (pk_compiler pkc, const char *program_str,
 void
 pk_print_profile (pk_compiler pkc)
 {
+  PK_TERM_USE (pkc);
   pvm_print_profile (pkc->vm);
 }
 
@@ -631,6 +738,127 @@ pk_reset_profile (pk_compiler pkc)
   pvm_reset_profile (pkc->vm);
 }
 
+int
+pk_profile_start (pk_compiler pkc, unsigned int interval)
+{
+  if (interval == 0)
+    interval = PK_PROFILE_DEFAULT_INTERVAL;
+
+  if (!pvm_start_sampling (pkc->vm, interval))
+    PK_RETURN (PK_ERROR);
+  PK_RETURN (PK_OK);
+}
+
+void
+pk_profile_stop (pk_compiler pkc)
+{
+  pvm_stop_sampling (pkc->vm);
+}
+
+void
+pk_profile_get (pk_compiler pkc, pk_profile_fn handler, void *data)
+{
+  pvm_map_samples (pkc->vm, handler, data);
+}
+
+/* The VM event handler used by pk_set_event_fn.  The struct
+   pvm_event uses the same codes as struct pk_event.  */
+
+static void
+pk_event_handler (struct pvm_event *pvm_event, void *data)
+{
+  pk_compiler pkc = data;
+  struct pk_event event;
+
+  event.kind = pvm_event->kind;
+  event.type_name = pvm_event->type_name;
+  event.ios = pvm_event->ios;
+  event.offset = pvm_event->offset;
+  event.size = pvm_event->size;
+  event.value = pvm_event->value;
+
+  pkc->event_fn (&event, pkc->event_data);
+}
+
+void
+pk_set_event_fn (pk_compiler pkc, pk_event_fn handler, void *data)
+{
+  pkc->event_fn = handler;
+  pkc->event_data = data;
+  pvm_set_event_fn (pkc->vm, handler ? pk_event_handler : NULL, pkc);
+  pkc->status = PK_OK;
+}
+
+void
+pk_gc_stats (pk_compiler pkc, struct pk_gc_stats *stats)
+{
+  struct pvm_alloc_stats alloc_stats;
+
+  pvm_alloc_stats (&alloc_stats);
+  stats->heap_size = alloc_stats.heap_size;
+  stats->free_bytes = alloc_stats.free_bytes;
+  stats->unmapped_bytes = alloc_stats.unmapped_bytes;
+  stats->bytes_since_gc = alloc_stats.bytes_since_gc;
+  stats->total_bytes = alloc_stats.total_bytes;
+  stats->collections = alloc_stats.collections;
+  stats->pause_ns = alloc_stats.pause_ns;
+  stats->max_pause_ns = alloc_stats.max_pause_ns;
+  stats->finalizers = alloc_stats.finalizers;
+  pkc->status = PK_OK;
+}
+
+void
+pk_gc_collect (pk_compiler pkc)
+{
+  pvm_alloc_gc ();
+  pkc->status = PK_OK;
+}
+
+int
+pk_gc_incremental_p (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_alloc_incremental ();
+}
+
+int
+pk_gc_set_incremental (pk_compiler pkc, int incremental_p)
+{
+  if (!pvm_alloc_set_incremental (incremental_p))
+    PK_RETURN (PK_ERROR);
+  PK_RETURN (PK_OK);
+}
+
+unsigned int
+pk_gc_free_space_divisor (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_alloc_free_space_divisor ();
+}
+
+int
+pk_gc_set_free_space_divisor (pk_compiler pkc, unsigned int divisor)
+{
+  if (divisor == 0)
+    PK_RETURN (PK_ERROR);
+  pvm_alloc_set_free_space_divisor (divisor);
+  PK_RETURN (PK_OK);
+}
+
+unsigned int
+pk_gc_full_freq (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_alloc_full_freq ();
+}
+
+void
+pk_gc_set_full_freq (pk_compiler pkc, unsigned int full_freq)
+{
+  pvm_alloc_set_full_freq (full_freq);
+  pkc->status = PK_OK;
+}
+
 pk_ios
 pk_ios_cur (pk_compiler pkc)
 {
@@ -688,6 +916,7 @@ pk_ios_open (pk_compiler pkc,
     case IOS_EOF: pkc->status = PK_EEOF; break;
     case IOS_EINVAL:
     case IOS_EOPEN:
+    case IOS_EFLAGS:
       pkc->status = PK_EINVAL;
       break;
     default:
@@ -727,6 +956,56 @@ pk_ios_get_bias (pk_ios io)
   return ios_get_bias ((ios) io);
 }
 
+int
+pk_ios_read (pk_ios io, uint64_t offset, void *buf, size_t count)
+{
+  switch (ios_read_bytes ((ios) io, offset * 8, 0 /* flags */, buf, count))
+    {
+    case IOS_OK:
+      return PK_OK;
+    case IOS_EOF:
+      return PK_EEOF;
+    default:
+      return PK_ERROR;
+    }
+}
+
+const void *
+pk_ios_read_ptr (pk_ios io, uint64_t offset, size_t count)
+{
+  return ios_read_ptr ((ios) io, offset * 8, 0 /* flags */, count);
+}
+
+void
+pk_ios_prefetch (pk_ios io, uint64_t offset, uint64_t count)
+{
+  (void) ios_prefetch ((ios) io, offset * 8, count * 8);
+}
+
+uint64_t
+pk_ios_write_count (pk_ios io)
+{
+  return ios_write_count ((ios) io);
+}
+
+uint64_t
+pk_ios_stat (pk_ios io, int stat)
+{
+  return ios_get_stat ((ios) io, stat);
+}
+
+void
+pk_ios_reset_stats (pk_ios io)
+{
+  ios_reset_stats ((ios) io);
+}
+
+void
+pk_ios_set_trace (pk_ios io, int trace_p)
+{
+  pvm_trace_ios ((ios) io, trace_p);
+}
+
 struct ios_map_fn_payload
 {
   pk_ios_map_fn cb;
@@ -918,6 +1197,8 @@ pk_call (pk_compiler pkc, pk_val cls, pk_val *ret,
   va_list ap;
   enum pvm_exit_code rret;
 
+  PK_TERM_USE (pkc);
+
   /* Compile a program that calls the function.  */
   va_start (ap, narg);
   program = pkl_compile_call (pkc->compiler, cls, ret, narg, ap);
@@ -926,13 +1207,146 @@ pk_call (pk_compiler pkc, pk_val cls, pk_val *ret,
     PK_RETURN (PK_ERROR);
 
   /* Run the program in the poke VM.  */
-  pvm_program_make_executable (program);
+  pkl_program_make_executable (pkc->compiler, program);
   rret = pvm_run (pkc->vm, program, ret, exit_exception);
 
   pvm_destroy_program (program);
   PK_RETURN (rret == PVM_EXIT_OK ? PK_OK : PK_ERROR);
 }
 
+struct _pk_prepared_call
+{
+  pk_compiler pkc;
+  pvm_program program;
+  int narg;
+  pvm_val cls;
+  /* The arguments of the call being performed.  This is allocated
+     along with the struct, which is uncollectable, so the arguments
+     are reachable while the function runs.  */
+  pvm_val args[];
+};
+
+pk_prepared_call
+pk_prepare_call (pk_compiler pkc, pk_val cls, int narg)
+{
+  pk_prepared_call call;
+  pvm_program program;
+  int i;
+
+  if (narg < 0)
+    {
+      pkc->status = PK_EINVAL;
+      return NULL;
+    }
+
+  call = pvm_alloc_uncollectable (sizeof (struct _pk_prepared_call)
+                                  + narg * sizeof (pvm_val));
+  if (call == NULL)
+    {
+      pkc->status = PK_ENOMEM;
+      return NULL;
+    }
+
+  program = pkl_compile_prepared_call (pkc->compiler, cls, narg);
+  if (!program)
+    {
+      pvm_free_uncollectable (call);
+      pkc->status = PK_ERROR;
+      return NULL;
+    }
+  pkl_program_make_executable (pkc->compiler, program);
+
+  call->pkc = pkc;
+  call->program = program;
+  call->narg = narg;
+  call->cls = cls;
+  for (i = 0; i < narg; ++i)
+    call->args[i] = PVM_NULL;
+
+  pkc->status = PK_OK;
+  return call;
+}
+
+void
+pk_prepared_call_free (pk_prepared_call call)
+{
+  if (call == NULL)
+    return;
+
+  pvm_destroy_program (call->program);
+  pvm_free_uncollectable (call);
+}
+
+int
+pk_call_prepared (pk_prepared_call call, const pk_val *args,
+                  pk_val *ret, pk_val *exit_exception)
+{
+  pk_compiler pkc = call->pkc;
+  enum pvm_exit_code rret;
+  int i;
+
+  PK_TERM_USE (pkc);
+
+  for (i = 0; i < call->narg; ++i)
+    call->args[i] = args[i];
+
+  rret = pvm_run_args (pkc->vm, call->program, call->args,
+                       ret, exit_exception);
+
+  /* Don't keep the arguments alive.  */
+  for (i = 0; i < call->narg; ++i)
+    call->args[i] = PVM_NULL;
+
+  PK_RETURN (rret == PVM_EXIT_OK ? PK_OK : PK_ERROR);
+}
+
+void
+pk_interrupt (pk_compiler pkc)
+{
+  pvm_interrupt (pkc->vm);
+}
+
+void
+pk_cancel (pk_compiler pkc)
+{
+  pvm_cancel (pkc->vm);
+}
+
+void
+pk_set_budget (pk_compiler pkc, uint64_t steps, uint64_t msec)
+{
+  pvm_set_budget (pkc->vm, steps, msec * 1000000);
+  pkc->status = PK_OK;
+}
+
+uint64_t
+pk_budget_steps (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_budget_steps (pkc->vm);
+}
+
+uint64_t
+pk_budget_msec (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_budget_nsec (pkc->vm) / 1000000;
+}
+
+void
+pk_set_stack_limit (pk_compiler pkc, uint64_t nelem)
+{
+  pvm_set_stack_limit (pkc->vm, nelem > SIZE_MAX ? SIZE_MAX : nelem);
+  pkc->status = PK_OK;
+}
+
+uint64_t
+pk_stack_limit (pk_compiler pkc)
+{
+  pkc->status = PK_OK;
+  return pvm_stack_limit (pkc->vm);
+}
+
 int
 pk_obase (pk_compiler pkc)
 {
@@ -1153,13 +1567,691 @@ pk_print_val (pk_compiler pkc, pk_val val, pk_val *exit_exception)
     pkc->status = PK_OK;
 }
 
+/* A step in the path of a field described by a layout.  NAME is the
+   name of the field, and NAME_VAL and INDEX cache the name value and
+   the index of the field in the last struct the step was looked up
+   in.  Structs of the same type share their field names, so when the
+   name found at INDEX is NAME_VAL the field doesn't need to be looked
+   up again.  */
+
+struct pk_layout_step
+{
+  char *name;
+  pvm_val name_val;
+  uint64_t index;
+};
+
+struct pk_layout_entry
+{
+  int kind;
+  size_t offset;
+  size_t size;
+  size_t nsteps;
+  struct pk_layout_step *steps;
+};
+
+/* Note that STEPS is allocated as uncollectable memory, so the cached
+   names are kept alive.  */
+
+struct _pk_layout
+{
+  size_t size;
+  size_t nentries;
+  struct pk_layout_entry *entries;
+  struct pk_layout_step *steps;
+  size_t nsteps;
+};
+
+pk_layout
+pk_layout_new (pk_compiler pkc, const struct pk_layout_field *fields,
+               size_t nfields, size_t size)
+{
+  pk_layout layout;
+  size_t i, nsteps = 0;
+
+  for (i = 0; i < nfields; ++i)
+    {
+      const struct pk_layout_field *field = &fields[i];
+
+      if (field->name == NULL
+          || field->offset > size || field->size > size - field->offset)
+        goto einval;
+
+      switch (field->kind)
+        {
+        case PK_LAYOUT_INTEGRAL:
+        case PK_LAYOUT_BITS:
+          if (field->size != 1 && field->size != 2
+              && field->size != 4 && field->size != 8)
+            goto einval;
+          break;
+        case PK_LAYOUT_STRING:
+          if (field->size != sizeof (const char *))
+            goto einval;
+          break;
+        default:
+          goto einval;
+        }
+
+      nsteps++;
+      for (const char *p = field->name; *p; ++p)
+        if (*p == '.')
+          nsteps++;
+    }
+
+  layout = calloc (1, sizeof (struct _pk_layout));
+  if (layout == NULL)
+    goto enomem;
+  layout->size = size;
+  layout->nentries = nfields;
+  layout->nsteps = nsteps;
+  layout->entries = calloc (nfields, sizeof (struct pk_layout_entry));
+  layout->steps
+    = pvm_alloc_uncollectable (nsteps * sizeof (struct pk_layout_step));
+  if (layout->steps)
+    memset (layout->steps, 0, nsteps * sizeof (struct pk_layout_step));
+  if ((nfields && layout->entries == NULL)
+      || (nsteps && layout->steps == NULL))
+    {
+      pk_layout_free (layout);
+      goto enomem;
+    }
+
+  nsteps = 0;
+  for (i = 0; i < nfields; ++i)
+    {
+      struct pk_layout_entry *entry = &layout->entries[i];
+      const char *name = fields[i].name;
+
+      entry->kind = fields[i].kind;
+      entry->offset = fields[i].offset;
+      entry->size = fields[i].size;
+      entry->steps = &layout->steps[nsteps];
+
+      for (;;)
+        {
+          const char *dot = strchr (name, '.');
+          size_t len = dot ? (size_t) (dot - name) : strlen (name);
+          struct pk_layout_step *step = &entry->steps[entry->nsteps++];
+
+          step->name = strndup (name, len);
+          if (step->name == NULL)
+            {
+              pk_layout_free (layout);
+              goto enomem;
+            }
+          nsteps++;
+
+          if (!dot)
+            break;
+          name = dot + 1;
+        }
+    }
+
+  pkc->status = PK_OK;
+  return layout;
+
+ einval:
+  pkc->status = PK_EINVAL;
+  return NULL;
+ enomem:
+  pkc->status = PK_ENOMEM;
+  return NULL;
+}
+
+void
+pk_layout_free (pk_layout layout)
+{
+  if (layout == NULL)
+    return;
+
+  if (layout->steps)
+    {
+      for (size_t i = 0; i < layout->nsteps; ++i)
+        free (layout->steps[i].name);
+      pvm_free_uncollectable (layout->steps);
+    }
+  free (layout->entries);
+  free (layout);
+}
+
+/* Look for the field of the struct SCT named as STEP.  If found,
+   return 1 and set *VALUE to its value.  Return 0 if the field is
+   absent, and -1 if it doesn't exist.  */
+
+static int
+pk_layout_lookup (pvm_val sct, struct pk_layout_step *step, pvm_val *value)
+{
+  uint64_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
+  pvm_val type;
+  uint64_t i;
+
+  if (step->name_val != PVM_NULL
+      && step->index < nfields
+      && PVM_VAL_SCT_FIELD_NAME (sct, step->index) == step->name_val)
+    {
+      *value = PVM_VAL_SCT_FIELD_VALUE (sct, step->index);
+      return 1;
+    }
+
+  for (i = 0; i < nfields; ++i)
+    {
+      pvm_val name = PVM_VAL_SCT_FIELD_NAME (sct, i);
+
+      if (name != PVM_NULL && STREQ (PVM_VAL_STR (name), step->name))
+        {
+          step->name_val = name;
+          step->index = i;
+          *value = PVM_VAL_SCT_FIELD_VALUE (sct, i);
+          return 1;
+        }
+    }
+
+  /* Absent fields have no name in the struct value, but they have
+     one in its type.  */
+  type = PVM_VAL_SCT_TYPE (sct);
+  if (type != PVM_NULL)
+    for (i = 0; i < PVM_VAL_ULONG (PVM_VAL_TYP_S_NFIELDS (type)); ++i)
+      {
+        pvm_val name = PVM_VAL_TYP_S_FNAME (type, i);
+
+        if (name != PVM_NULL && STREQ (PVM_VAL_STR (name), step->name))
+          return 0;
+      }
+
+  return -1;
+}
+
+static void
+pk_layout_store (void *ptr, size_t size, uint64_t value)
+{
+  switch (size)
+    {
+    case 1:
+      *(uint8_t *) ptr = value;
+      break;
+    case 2:
+      {
+        uint16_t v = value;
+        memcpy (ptr, &v, sizeof (v));
+        break;
+      }
+    case 4:
+      {
+        uint32_t v = value;
+        memcpy (ptr, &v, sizeof (v));
+        break;
+      }
+    default:
+      memcpy (ptr, &value, sizeof (value));
+      break;
+    }
+}
+
+static int
+pk_layout_extract (pk_layout layout, pvm_val sct, void *buf)
+{
+  if (!PVM_IS_SCT (sct))
+    return PK_EINVAL;
+
+  for (size_t i = 0; i < layout->nentries; ++i)
+    {
+      struct pk_layout_entry *entry = &layout->entries[i];
+      uint8_t *ptr = (uint8_t *) buf + entry->offset;
+      pvm_val val = sct;
+      int found = 1;
+
+      for (size_t j = 0; j < entry->nsteps && found == 1; ++j)
+        {
+          if (!PVM_IS_SCT (val))
+            return PK_EINVAL;
+          found = pk_layout_lookup (val, &entry->steps[j], &val);
+        }
+
+      if (found == -1)
+        return PK_EINVAL;
+
+      if (entry->kind == PK_LAYOUT_STRING)
+        {
+          const char *str = NULL;
+
+          if (found)
+            {
+              if (!PVM_IS_STR (val))
+                return PK_EINVAL;
+              str = PVM_VAL_STR (val);
+            }
+          memcpy (ptr, &str, sizeof (str));
+        }
+      else
+        {
+          uint64_t value = 0;
+
+          if (found)
+            {
+              uint64_t unit = 1;
+
+              if (PVM_IS_OFF (val))
+                {
+                  if (entry->kind == PK_LAYOUT_BITS)
+                    unit = PVM_VAL_ULONG (PVM_VAL_TYP_O_UNIT
+                                          (PVM_VAL_OFF_TYPE (val)));
+                  val = PVM_VAL_OFF_MAGNITUDE (val);
+                }
+              if (!PVM_IS_INTEGRAL (val))
+                return PK_EINVAL;
+              value = (uint64_t) PVM_VAL_INTEGRAL (val) * unit;
+            }
+          pk_layout_store (ptr, entry->size, value);
+        }
+    }
+
+  return PK_OK;
+}
+
+int
+pk_extract_struct (pk_compiler pkc, pk_layout layout, pk_val sct, void *buf)
+{
+  PK_RETURN (pk_layout_extract (layout, sct, buf));
+}
+
+int
+pk_extract_array (pk_compiler pkc, pk_layout layout, pk_val array,
+                  uint64_t from, uint64_t count, void *buf,
+                  uint64_t *nextracted)
+{
+  uint64_t nelem, i;
+  int ret = PK_OK;
+
+  *nextracted = 0;
+  if (!PVM_IS_ARR (array))
+    PK_RETURN (PK_EINVAL);
+
+  nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (array));
+  if (from > nelem)
+    from = nelem;
+  if (count > nelem - from)
+    count = nelem - from;
+
+  for (i = 0; i < count; ++i)
+    {
+      pvm_val elem = pvm_array_elem_value (array, from + i);
+
+      /* Elements of lazy arrays are mapped on demand.  */
+      if (elem == PVM_NULL)
+        {
+          pvm_val exception;
+
+          elem = pvm_array_map_elem (pkc->vm, array, from + i, &exception);
+          if (elem == PVM_NULL)
+            {
+              ret = PK_ERROR;
+              break;
+            }
+        }
+
+      ret = pk_layout_extract (layout, elem,
+                               (uint8_t *) buf + i * layout->size);
+      if (ret != PK_OK)
+        break;
+    }
+
+  *nextracted = i;
+  PK_RETURN (ret);
+}
+
+/* Mapping into C buffers.
+
+   pk_map_to_buffer decodes values of fixed-layout types right out of
+   the IO space, without running the mappers of the types.  The type
+   is first flattened into a plan, which is a list of leaves: integral
+   values, or integral fields of integral structs, located at a fixed
+   bit-offset from the beginning of every element.  */
+
+struct pk_mapbuf_leaf
+{
+  uint64_t boffset;        /* Bit-offset of the container.  */
+  int bits;                /* Size of the container.  */
+  enum ios_endian endian;  /* Endianness of the container.  */
+  int shift;               /* Position of the value in the container.  */
+  int width;               /* Size of the value.  */
+  int signed_p;            /* Whether the value is signed.  */
+  size_t csize;            /* Size of the C member.  */
+  size_t coffset;          /* Offset of the C member.  */
+};
+
+struct pk_mapbuf_plan
+{
+  struct pk_mapbuf_leaf *leaves;
+  size_t nleaves;
+  size_t nalloc;
+  uint64_t esize;          /* Size of the elements in the IO space.  */
+  size_t stride;           /* Size of the elements in the buffer.  */
+  size_t align;
+};
+
+#define PK_MAPBUF_MAX_LEAVES 65536
+
+/* Return the size in bits of the values of TYPE, or zero if they
+   can't be decoded directly into a C buffer.  */
+
+static uint64_t
+pk_mapbuf_type_bits (pkl_ast_node type)
+{
+  pkl_ast_node t, bound;
+  uint64_t size = 0;
+
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+      return PKL_AST_TYPE_I_DYN_P (type) ? 0 : PKL_AST_TYPE_I_SIZE (type);
+    case PKL_TYPE_OFFSET:
+      return pk_mapbuf_type_bits (PKL_AST_TYPE_O_BASE_TYPE (type));
+    case PKL_TYPE_ARRAY:
+      bound = PKL_AST_TYPE_A_BOUND (type);
+      if (!bound || PKL_AST_CODE (bound) != PKL_AST_INTEGER)
+        return 0;
+      return (PKL_AST_INTEGER_VALUE (bound)
+              * pk_mapbuf_type_bits (PKL_AST_TYPE_A_ETYPE (type)));
+    case PKL_TYPE_STRUCT:
+      if (PKL_AST_TYPE_S_ITYPE (type))
+        return pk_mapbuf_type_bits (PKL_AST_TYPE_S_ITYPE (type));
+      if (!PKL_AST_TYPE_S_STATIC_LAYOUT_P (type))
+        return 0;
+      for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+        {
+          uint64_t bits;
+
+          if (PKL_AST_CODE (t) != PKL_AST_STRUCT_TYPE_FIELD
+              || PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (t))
+            continue;
+          if (PKL_AST_STRUCT_TYPE_FIELD_OPTIONAL_P (t))
+            return 0;
+          bits = pk_mapbuf_type_bits (PKL_AST_STRUCT_TYPE_FIELD_TYPE (t));
+          if (bits == 0)
+            return 0;
+          size = PKL_AST_STRUCT_TYPE_FIELD_STATIC_OFFSET (t) + bits;
+        }
+      return size;
+    default:
+      return 0;
+    }
+}
+
+static int
+pk_mapbuf_add_leaf (struct pk_mapbuf_plan *plan, uint64_t boffset,
+                    int bits, enum ios_endian endian, int shift,
+                    int width, int signed_p)
+{
+  struct pk_mapbuf_leaf *leaf;
+  size_t csize = width <= 8 ? 1 : width <= 16 ? 2 : width <= 32 ? 4 : 8;
+
+  if (plan->nleaves == plan->nalloc)
+    {
+      size_t nalloc = plan->nalloc ? plan->nalloc * 2 : 16;
+      struct pk_mapbuf_leaf *leaves;
+
+      if (nalloc > PK_MAPBUF_MAX_LEAVES)
+        return PK_EINVAL;
+      leaves = realloc (plan->leaves, nalloc * sizeof (*leaves));
+      if (!leaves)
+        return PK_ENOMEM;
+      plan->leaves = leaves;
+      plan->nalloc = nalloc;
+    }
+
+  /* Members are laid out like in a C struct.  */
+  plan->stride = (plan->stride + csize - 1) / csize * csize;
+  if (csize > plan->align)
+    plan->align = csize;
+
+  leaf = &plan->leaves[plan->nleaves++];
+  leaf->boffset = boffset;
+  leaf->bits = bits;
+  leaf->endian = endian;
+  leaf->shift = shift;
+  leaf->width = width;
+  leaf->signed_p = signed_p;
+  leaf->csize = csize;
+  leaf->coffset = plan->stride;
+  plan->stride += csize;
+  return PK_OK;
+}
+
+/* Add the leaves of the fields of the integral struct TYPE, which
+   occupy BITS bits starting at SHIFT bits from the least significant
+   bit of the container.  */
+
+static int
+pk_mapbuf_plan_integral_struct (struct pk_mapbuf_plan *plan,
+                                pkl_ast_node type, uint64_t boffset,
+                                int container_bits, enum ios_endian endian,
+                                int shift, int bits)
+{
+  pkl_ast_node t;
+
+  for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+    {
+      pkl_ast_node ftype;
+      int fbits, ret;
+
+      if (PKL_AST_CODE (t) != PKL_AST_STRUCT_TYPE_FIELD
+          || PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (t))
+        continue;
+
+      ftype = PKL_AST_STRUCT_TYPE_FIELD_TYPE (t);
+      fbits = pk_mapbuf_type_bits (ftype);
+      if (fbits == 0 || fbits > bits)
+        return PK_EINVAL;
+      bits -= fbits;
+
+      /* The fields are stored from the most significant bit.  */
+      if (PKL_AST_TYPE_CODE (ftype) == PKL_TYPE_STRUCT)
+        ret = pk_mapbuf_plan_integral_struct (plan, ftype, boffset,
+                                              container_bits, endian,
+                                              shift + bits, fbits);
+      else
+        {
+          if (PKL_AST_TYPE_CODE (ftype) == PKL_TYPE_OFFSET)
+            ftype = PKL_AST_TYPE_O_BASE_TYPE (ftype);
+          ret = pk_mapbuf_add_leaf (plan, boffset, container_bits, endian,
+                                    shift + bits, fbits,
+                                    PKL_AST_TYPE_I_SIGNED_P (ftype));
+        }
+      if (ret != PK_OK)
+        return ret;
+    }
+
+  return PK_OK;
+}
+
+/* Add the leaves of a value of TYPE located at BOFFSET to PLAN.  */
+
+static int
+pk_mapbuf_plan_type (struct pk_mapbuf_plan *plan, pkl_ast_node type,
+                     uint64_t boffset, enum ios_endian endian)
+{
+  pkl_ast_node t;
+  uint64_t i, nelem, ebits;
+  int ret, bits;
+
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_OFFSET:
+      type = PKL_AST_TYPE_O_BASE_TYPE (type);
+      /* Fallthrough.  */
+    case PKL_TYPE_INTEGRAL:
+      bits = PKL_AST_TYPE_I_SIZE (type);
+      return pk_mapbuf_add_leaf (plan, boffset, bits, endian, 0, bits,
+                                 PKL_AST_TYPE_I_SIGNED_P (type));
+    case PKL_TYPE_ARRAY:
+      nelem = PKL_AST_INTEGER_VALUE (PKL_AST_TYPE_A_BOUND (type));
+      ebits = pk_mapbuf_type_bits (PKL_AST_TYPE_A_ETYPE (type));
+      for (i = 0; i < nelem; ++i)
+        if ((ret = pk_mapbuf_plan_type (plan, PKL_AST_TYPE_A_ETYPE (type),
+                                        boffset + i * ebits,
+                                        endian)) != PK_OK)
+          return ret;
+      return PK_OK;
+    case PKL_TYPE_STRUCT:
+      if (PKL_AST_TYPE_S_ITYPE (type))
+        {
+          bits = PKL_AST_TYPE_I_SIZE (PKL_AST_TYPE_S_ITYPE (type));
+          return pk_mapbuf_plan_integral_struct (plan, type, boffset, bits,
+                                                 endian, 0, bits);
+        }
+      for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+        {
+          enum ios_endian fendian = endian;
+          uint64_t foffset;
+
+          if (PKL_AST_CODE (t) != PKL_AST_STRUCT_TYPE_FIELD
+              || PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (t))
+            continue;
+
+          if (PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (t) == PKL_AST_ENDIAN_MSB)
+            fendian = IOS_ENDIAN_MSB;
+          else if (PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (t) == PKL_AST_ENDIAN_LSB)
+            fendian = IOS_ENDIAN_LSB;
+
+          foffset = PKL_AST_STRUCT_TYPE_FIELD_STATIC_OFFSET (t);
+          ret = pk_mapbuf_plan_type (plan,
+                                     PKL_AST_STRUCT_TYPE_FIELD_TYPE (t),
+                                     boffset + foffset, fendian);
+          if (ret != PK_OK)
+            return ret;
+        }
+      return PK_OK;
+    default:
+      return PK_EINVAL;
+    }
+}
+
+/* Build in PLAN the plan to decode values of the type named
+   TYPE_NAME.  */
+
+static int
+pk_mapbuf_plan (pk_compiler pkc, const char *type_name,
+                struct pk_mapbuf_plan *plan)
+{
+  pkl_env compiler_env = pkl_get_env (pkc->compiler);
+  pkl_ast_node decl = pkl_env_lookup (compiler_env, PKL_ENV_NS_MAIN,
+                                      type_name, NULL, NULL);
+  pkl_ast_node type;
+  int ret;
+
+  memset (plan, 0, sizeof (*plan));
+  if (decl == NULL || PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_TYPE)
+    return PK_EINVAL;
+
+  type = PKL_AST_DECL_INITIAL (decl);
+  plan->esize = pk_mapbuf_type_bits (type);
+  if (plan->esize == 0)
+    return PK_EINVAL;
+
+  ret = pk_mapbuf_plan_type (plan, type, 0, pvm_endian (pkc->vm));
+  if (ret != PK_OK)
+    {
+      free (plan->leaves);
+      return ret;
+    }
+
+  plan->stride = (plan->stride + plan->align - 1) / plan->align * plan->align;
+  return PK_OK;
+}
+
+size_t
+pk_map_buffer_size (pk_compiler pkc, const char *type_name)
+{
+  struct pk_mapbuf_plan plan;
+
+  pkc->status = pk_mapbuf_plan (pkc, type_name, &plan);
+  if (pkc->status != PK_OK)
+    return 0;
+
+  free (plan.leaves);
+  return plan.stride;
+}
+
+int
+pk_map_to_buffer (pk_compiler pkc, const char *type_name, pk_ios io,
+                  uint64_t boffset, uint64_t count, void *buf)
+{
+  struct pk_mapbuf_plan plan;
+  enum ios_nenc nenc = pvm_nenc (pkc->vm);
+  int ret;
+
+  ret = pk_mapbuf_plan (pkc, type_name, &plan);
+  if (ret != PK_OK)
+    PK_RETURN (ret);
+
+  for (uint64_t i = 0; i < count; ++i)
+    {
+      uint8_t *elem = (uint8_t *) buf + i * plan.stride;
+      uint64_t eboffset = boffset + i * plan.esize;
+
+      for (size_t j = 0; j < plan.nleaves; ++j)
+        {
+          const struct pk_mapbuf_leaf *leaf = &plan.leaves[j];
+          uint64_t value;
+
+          if (leaf->signed_p && leaf->width == leaf->bits)
+            {
+              int64_t ivalue;
+
+              ret = ios_read_int ((ios) io, eboffset + leaf->boffset, 0,
+                                  leaf->bits, leaf->endian, nenc, &ivalue);
+              value = ivalue;
+            }
+          else
+            {
+              ret = ios_read_uint ((ios) io, eboffset + leaf->boffset, 0,
+                                   leaf->bits, leaf->endian, &value);
+              value >>= leaf->shift;
+              if (leaf->width < 64)
+                {
+                  value &= ((uint64_t) 1 << leaf->width) - 1;
+                  if (leaf->signed_p
+                      && (value & ((uint64_t) 1 << (leaf->width - 1))))
+                    value |= ~(uint64_t) 0 << leaf->width;
+                }
+            }
+
+          if (ret != IOS_OK)
+            {
+              free (plan.leaves);
+              PK_RETURN (ret == IOS_EOF ? PK_EEOF : PK_ERROR);
+            }
+          pk_layout_store (elem + leaf->coffset, leaf->csize, value);
+        }
+    }
+
+  free (plan.leaves);
+  PK_RETURN (PK_OK);
+}
+
 int
 pk_register_iod (pk_compiler pkc, struct pk_iod_if *iod_if)
+{
+  return pk_register_iod_v2 (pkc, iod_if, NULL);
+}
+
+int
+pk_register_iod_v2 (pk_compiler pkc, struct pk_iod_if *iod_if,
+                    const struct pk_iod_if_v2 *iod_if_v2)
 {
   ios_context ios_ctx = pvm_ios_context (pkc->vm);
 
   pkc->status = PK_OK;
 
+  if (iod_if_v2
+      && (iod_if_v2->version != PK_IOD_IF_VERSION
+          || (iod_if_v2->pread_async && !iod_if_v2->poll)))
+    {
+      pkc->status = PK_ERROR;
+      return pkc->status;
+    }
+
 #define CF(FN) pkc->foreign_iod_if.FN = iod_if->FN
   CF (get_if_name);
   CF (handler_normalize);
@@ -1173,7 +2265,28 @@ pk_register_iod (pk_compiler pkc, struct pk_iod_if *iod_if)
   CF (flush);
 #undef CF
 
-  (void) ios_register_foreign_iod (ios_ctx, &pkc->foreign_iod_if, iod_if->data);
+  if (iod_if_v2)
+    {
+      /* The batches of reads in the public interface have the same
+         layout than the ones in the device interface.  */
+      assert (sizeof (struct pk_iod_iovec) == sizeof (struct ios_dev_iovec)
+              && (offsetof (struct pk_iod_iovec, offset)
+                  == offsetof (struct ios_dev_iovec, offset)));
+
+#define CF(FN) pkc->foreign_iod_if.FN = iod_if_v2->FN
+      CF (get_ptr);
+      CF (prefetch);
+      CF (pread_async);
+      CF (poll);
+#undef CF
+      pkc->foreign_iod_if.preadv
+        = (int (*) (void *, const struct ios_dev_iovec *, size_t))
+          iod_if_v2->preadv;
+    }
+
+  (void) ios_register_foreign_iod (ios_ctx, &pkc->foreign_iod_if,
+                                   iod_if->data,
+                                   iod_if_v2 ? iod_if_v2->cache_p : 0);
   return pkc->status;
 }
 
@@ -71,6 +71,8 @@ typedef uint64_t pk_val;
 #define PK_EC_OVERFLOW     17
 #define PK_EC_PERM         18
 #define PK_EC_STACK        19
+#define PK_EC_TIMEOUT      21
+#define PK_EC_CANCEL       22
 
 struct pk_color
 {
@@ -141,19 +143,74 @@ pk_compiler pk_compiler_new (struct pk_term_if *term_if) LIBPOKE_API;
    which are defined below.  */
 
 #define PK_F_NOSTDTYPES 1 /* Do not define standard types.  */
+#define PK_F_GCREGION   2 /* Do not collect garbage while running
+                             Poke code.  */
+/* Note that PK_F_GCREGION turns the collection off for the whole
+   process, not only for the compiler using it: while any of its
+   programs runs, no garbage is collected in any thread, and in
+   particular for other compilers running in parallel.  It is thus not
+   advisable to use it along with concurrent compilers.  To bound the
+   memory used by long runs, the collection is turned on again after
+   64 MiB have been allocated, until the programs return.  */
+#define PK_F_NOEXITGC   4 /* Do not collect garbage when the
+                             compiler is freed.  */
 
 pk_compiler pk_compiler_new_with_flags (struct pk_term_if *term_if,
                                         uint32_t flags) LIBPOKE_API;
 
+/* Create a new instance of an incremental compiler that is a clone
+   of PKC.
+
+   This is much faster than creating a new compiler with
+   pk_compiler_new, since the clone doesn't need to bootstrap itself:
+   it starts with a copy of the declarations and global variables of
+   PKC, and shares the compiled code with it.  Subsequent
+   declarations, and assignments to global variables, in either
+   compiler are not visible to the other.  However, arrays and structs
+   that were stored in global variables at the time of cloning are
+   shared, and modifications to them are visible in both compilers.
+
+   The clone doesn't have any open IO space, nor any of the foreign IO
+   devices registered in PKC.  The terminal interface and the flags
+   used to create PKC are inherited by the clone.
+
+   PKC shall not be executing Poke code at the time of cloning.
+
+   If there is an error creating the clone this function returns
+   NULL.  */
+
+pk_compiler pk_compiler_clone (pk_compiler pkc) LIBPOKE_API;
+
 /* Destroy an instance of a Poke incremental compiler.
 
    PKC is a previously created incremental compiler.  */
 
 void pk_compiler_free (pk_compiler pkc) LIBPOKE_API;
 
-/* Register/unregister a new thread (other than the thread that called
-   pk_compiler_new) that calls any of the services provided by the
-   library.  */
+/* Threads.
+
+   Independent compilers, i.e. compilers created with pk_compiler_new
+   or pk_compiler_clone, can be used at the same time by different
+   threads, and they run fully in parallel.  Each compiler shall only
+   be used by one thread at a time, and values belonging to a
+   compiler shall not be passed to another, unless the later is a
+   clone sharing them.  The state shared by all the compilers is
+   either immutable or protected by the library.
+
+   Some settings are global to the process: the settings of the
+   garbage collector, which is shared by all the compilers, and the
+   sampling profiler, as noted in pk_profile_start.  The terminal
+   interface used by a compiler is the one it was created with, even
+   when it is used by another thread.
+
+   IO spaces belong to the compiler that opened them.  Several
+   compilers can read the same file through a single device and
+   cache by opening it with the PK_IOS_F_SHARED flag.
+
+   Register/unregister a new thread (other than the thread that called
+   pk_compiler_new first) that calls any of the services provided by
+   the library.  The thread shall be registered before calling any
+   other function of the library, and unregistered before exiting.  */
 
 void pk_register_thread (void) LIBPOKE_API;
 void pk_unregister_thread (void) LIBPOKE_API;
@@ -360,10 +417,216 @@ int pk_disassemble_statement (pk_compiler pkc, const char *str,
 void pk_print_profile (pk_compiler pkc) LIBPOKE_API;
 
 /* Reset the profiling counters.  If the PVM hasn't been compiled with
-   profiling support this is a no-operation.  */
+   profiling support this is a no-operation.  This also discards the
+   samples collected by the sampling profiler.  */
 
 void pk_reset_profile (pk_compiler pkc) LIBPOKE_API;
 
+/* Start the sampling profiler.
+
+   The sampling profiler attributes execution time to Poke functions,
+   and to the mappers, constructors and writers of named struct types.
+   It works independently of the profiling counters above, and it is
+   available even if the PVM hasn't been compiled with profiling
+   support.
+
+   INTERVAL is the sampling interval, in microseconds of consumed CPU
+   time.  If it is 0, PK_PROFILE_DEFAULT_INTERVAL is used.
+
+   The sampling profiler uses a process-wide timer, so only one
+   incremental compiler can be sampled at a time.
+
+   Return PK_ERROR if sampling is not supported in this system, PK_OK
+   otherwise.  */
+
+#define PK_PROFILE_DEFAULT_INTERVAL 1000
+
+int pk_profile_start (pk_compiler pkc, unsigned int interval) LIBPOKE_API;
+
+/* Stop the sampling profiler.  The samples collected so far are
+   kept until pk_reset_profile is called.  */
+
+void pk_profile_stop (pk_compiler pkc) LIBPOKE_API;
+
+/* Call HANDLER for every distinct call stack sampled by the sampling
+   profiler.
+
+   HANDLER gets the following arguments:
+
+     STACK is a string with the names of the functions in the call
+     stack, outermost first, separated by semicolons.  Anonymous
+     functions are named "[anonymous]".  Samples taken while not
+     executing any function are attributed to "[toplevel]".  Note
+     that this is the "folded stack" format used by flame graph
+     tools.
+
+     NSAMPLES is the number of samples taken with that call stack.
+
+     DATA is a user-provided pointer at pk_profile_get invocation.
+
+   DATA is a pointer that is passed to the provided callback.  This
+   can be NULL.  */
+
+typedef void (*pk_profile_fn) (const char *stack, uint64_t nsamples,
+                               void *data);
+void pk_profile_get (pk_compiler pkc, pk_profile_fn handler,
+                     void *data) LIBPOKE_API;
+
+/* Events.
+
+   The Poke programs run by the incremental compiler can notify an
+   event handler of some of the operations they perform, so
+   applications embedding libpoke can attribute IO and CPU time to
+   them.  The events are:
+
+   PK_EVENT_MAP_BEGIN: a struct, union or array starts being mapped.
+
+   PK_EVENT_MAP_END: a struct, union or array has been mapped.
+
+   PK_EVENT_WRITE: a mapped struct or union is about to be written
+   back to its IO space.
+
+   PK_EVENT_CONSTRAINT: a constraint failed, i.e. an E_constraint
+   exception has been raised.
+
+   PK_EVENT_RAISE: some other exception has been raised.  Note that
+   exceptions like E_eof are routinely raised while mapping arrays.
+
+   PK_EVENT_PROGRESS: an operation that may take long, like mapping
+   a big array or copying data between IO spaces, has advanced.
+   These events are emitted every few array elements or copied
+   chunks, and are intended to feed progress indicators.  See also
+   pk_cancel.
+
+   Every point where events are emitted costs a single branch when
+   no event handler is installed.  */
+
+#define PK_EVENT_MAP_BEGIN  0
+#define PK_EVENT_MAP_END    1
+#define PK_EVENT_WRITE      2
+#define PK_EVENT_CONSTRAINT 3
+#define PK_EVENT_RAISE      4
+#define PK_EVENT_PROGRESS   5
+
+/* Information about an event.
+
+   KIND is one of the PK_EVENT_* codes above.
+
+   TYPE_NAME is the name of the type of the mapped or written value,
+   or NULL if the type is anonymous or if the event is an exception.
+   For PK_EVENT_PROGRESS it is the name of the operation, "map" or
+   "copy".
+
+   IOS is the id of the IO space where the value is mapped or
+   written, or -1 if the event is an exception.
+
+   OFFSET is the offset, in bits, where the value is mapped or
+   written.
+
+   SIZE is the size in bits of the mapped or written value.  It is
+   zero for PK_EVENT_MAP_BEGIN and for exceptions.
+
+   For PK_EVENT_PROGRESS, OFFSET is the number of bits processed so
+   far and SIZE the total number of bits to process, or zero if it is
+   not known.  When mapping arrays bounded by number of elements the
+   total is estimated from the size of the elements mapped so far.
+
+   VALUE is the mapped or written value, the raised exception, or
+   PK_NULL for PK_EVENT_MAP_BEGIN.  */
+
+struct pk_event
+{
+  int kind;
+  const char *type_name;
+  int ios;
+  uint64_t offset;
+  uint64_t size;
+  pk_val value;
+};
+
+/* Install HANDLER as the event handler of the incremental compiler.
+   HANDLER gets the event and DATA.  HANDLER shall not run Poke code
+   nor otherwise use PKC.  If HANDLER is NULL then no events are
+   emitted.  */
+
+typedef void (*pk_event_fn) (const struct pk_event *event, void *data);
+void pk_set_event_fn (pk_compiler pkc, pk_event_fn handler,
+                      void *data) LIBPOKE_API;
+
+/* Statistics about the garbage collector used by libpoke.
+
+   Note that the garbage collector is shared by all the incremental
+   compilers in the process, so these statistics are not specific to
+   any of them.  The times are zero if the version of the collector
+   doesn't report the collections.  */
+
+struct pk_gc_stats
+{
+  uint64_t heap_size;      /* Size of the heap, in bytes.  */
+  uint64_t free_bytes;     /* Free bytes in the heap.  */
+  uint64_t unmapped_bytes; /* Bytes of the heap returned to the OS.  */
+  uint64_t bytes_since_gc; /* Bytes allocated since the last
+                              collection.  */
+  uint64_t total_bytes;    /* Bytes allocated in total.  */
+  uint64_t collections;    /* Number of collections.  */
+  uint64_t pause_ns;       /* Total time spent collecting, in
+                              nanoseconds.  */
+  uint64_t max_pause_ns;   /* Longest collection, in nanoseconds.  */
+  uint64_t finalizers;     /* Number of finalizers run.  */
+};
+
+/* Fill STATS with the current statistics of the garbage
+   collector.  */
+
+void pk_gc_stats (pk_compiler pkc, struct pk_gc_stats *stats)
+  LIBPOKE_API;
+
+/* Run a full garbage collection.
+
+   The collector runs whenever it needs to while Poke code is being
+   executed, which may cause noticeable pauses.  An embedder can call
+   this function whenever it is idle, so the collector has less work
+   to do later.  This function shall not be called while PKC is
+   executing Poke code.  */
+
+void pk_gc_collect (pk_compiler pkc) LIBPOKE_API;
+
+/* Get/set whether the garbage collector works in incremental mode.
+
+   In incremental mode the collector is generational, and does most
+   of its work in small steps, which makes the pauses shorter at the
+   cost of some overhead.  It is disabled by default.  Once enabled,
+   the incremental mode can't be disabled.
+
+   pk_gc_set_incremental returns PK_ERROR if asked to disable the
+   incremental mode once it has been enabled, PK_OK otherwise.  */
+
+int pk_gc_incremental_p (pk_compiler pkc) LIBPOKE_API;
+int pk_gc_set_incremental (pk_compiler pkc, int incremental_p)
+  LIBPOKE_API;
+
+/* Get/set the free space divisor of the garbage collector.
+
+   The collector grows the heap, instead of collecting, when the
+   memory allocated since the last collection is bigger than the size
+   of the heap divided by DIVISOR.  Bigger values mean smaller heaps
+   and more frequent collections.
+
+   pk_gc_set_free_space_divisor returns PK_ERROR if DIVISOR is zero,
+   PK_OK otherwise.  */
+
+unsigned int pk_gc_free_space_divisor (pk_compiler pkc) LIBPOKE_API;
+int pk_gc_set_free_space_divisor (pk_compiler pkc, unsigned int divisor)
+  LIBPOKE_API;
+
+/* Get/set the number of partial collections done between full
+   collections when the garbage collector works in incremental
+   mode.  */
+
+unsigned int pk_gc_full_freq (pk_compiler pkc) LIBPOKE_API;
+void pk_gc_set_full_freq (pk_compiler pkc, unsigned int full_freq)
+  LIBPOKE_API;
+
 /* Set the QUIET_P flag in the compiler.  If this flag is set, the
    incremental compiler emits as few output as possible.  */
 
@@ -385,6 +648,87 @@ void pk_set_debug_p (pk_compiler pkc, int debug_p) LIBPOKE_API;
 
 const char *pk_get_debug_ast (pk_compiler pkc) LIBPOKE_API;
 
+/* Set the TIMING_P flag in the compiler.  If this flag is set, the
+   incremental compiler measures the time spent in each of its
+   phases, which is then available using the pk_phase_times service.
+
+   Return PK_ERROR if there is not enough memory to enable timing,
+   PK_OK otherwise.  */
+
+int pk_set_timing_p (pk_compiler pkc, int timing_p) LIBPOKE_API;
+
+/* Call HANDLER for every compiler phase measured since timing was
+   first enabled or last reset.
+
+   HANDLER gets the following arguments:
+
+     PHASE is the name of the phase, like "typify1" or "gen".  The
+     time spent traversing the AST outside of any phase is
+     attributed to "walk".
+
+     NSEC is the number of nanoseconds spent in the phase.
+
+     NCALLS is the number of node handlers of the phase that were
+     invoked.
+
+     DATA is a user-provided pointer at pk_phase_times invocation.
+
+   The phases are processed in the order in which they were first
+   run.  */
+
+typedef void (*pk_phase_time_fn) (const char *phase, uint64_t nsec,
+                                  uint64_t ncalls, void *data);
+void pk_phase_times (pk_compiler pkc, pk_phase_time_fn handler,
+                     void *data) LIBPOKE_API;
+
+/* Call HANDLER for every top-level declaration compiled since timing
+   was first enabled or last reset.
+
+   HANDLER gets the following arguments:
+
+     NAME is the name of the declared entity.
+
+     SOURCE is the name of the file where the declaration is, or NULL
+     if the declaration was not compiled from a file.
+
+     NSEC is the number of nanoseconds spent compiling the
+     declaration, in all the phases.
+
+     NNODES is the number of AST nodes in the declaration.
+
+     DATA is a user-provided pointer at pk_decl_times invocation.
+
+   The declarations are processed in the order in which they were
+   compiled.  */
+
+typedef void (*pk_decl_time_fn) (const char *name, const char *source,
+                                 uint64_t nsec, uint64_t nnodes,
+                                 void *data);
+void pk_decl_times (pk_compiler pkc, pk_decl_time_fn handler,
+                    void *data) LIBPOKE_API;
+
+/* Discard the compilation times measured so far.  */
+
+void pk_reset_phase_times (pk_compiler pkc) LIBPOKE_API;
+
+/* Set the COMPILE_STATS_P flag in the compiler.  If this flag is set,
+   the incremental compiler measures compilation times like when
+   timing is enabled, and after loading a file, either with pk_load,
+   pk_compile_file or from a `load' directive not in another loaded
+   file, prints a report with the time spent compiling and executing
+   the file, the time spent in every phase of the compiler and the
+   most expensive top-level declarations.
+
+   Return PK_ERROR if there is not enough memory to enable compile
+   stats, PK_OK otherwise.  */
+
+int pk_set_compile_stats_p (pk_compiler pkc,
+                            int compile_stats_p) LIBPOKE_API;
+
+/* Return the COMPILE_STATS_P flag of the compiler.  */
+
+int pk_compile_stats_p (pk_compiler pkc) LIBPOKE_API;
+
 /* Install a handler for alien tokens in the incremental compiler.
    The handler gets a string with the token identifier (for $foo it
    would get `foo') and should return a pk_alien_token struct with the
@@ -544,8 +888,109 @@ uint64_t pk_ios_get_bias (pk_ios ios) LIBPOKE_API;
 #define PK_IOS_F_WRITE    2
 #define PK_IOS_F_CREATE  16
 
+/* Open the IO space read-only, sharing its device and the cache of
+   its contents with the IO spaces opened with this flag on the same
+   handler by other compilers of the process, which can then read
+   them from different threads at the same time.  See "Threads."
+   above.  */
+
+#define PK_IOS_F_SHARED  (1 << 9)
+
 uint64_t pk_ios_flags (pk_ios ios) LIBPOKE_API;
 
+/* Read COUNT bytes located at the byte offset OFFSET of the given IO
+   space, and put them in BUF.  The bias of the IO space is applied to
+   OFFSET.
+
+   Return PK_OK on success, PK_EEOF if some of the bytes lie past the
+   end of the IO space, and PK_ERROR otherwise.  */
+
+int pk_ios_read (pk_ios ios, uint64_t offset, void *buf,
+                 size_t count) LIBPOKE_API;
+
+/* Like pk_ios_read, but return a pointer to the bytes instead of
+   copying them.  Return NULL if the IO space can't provide direct
+   access to the bytes, in which case pk_ios_read shall be used
+   instead.
+
+   The returned pointer is only valid until the next operation writing
+   to the IO space.  */
+
+const void *pk_ios_read_ptr (pk_ios ios, uint64_t offset,
+                             size_t count) LIBPOKE_API;
+
+/* Tell the given IO space that the COUNT bytes located at the byte
+   offset OFFSET are about to be read, so it can get them in advance.
+   This is just a hint.  */
+
+void pk_ios_prefetch (pk_ios ios, uint64_t offset,
+                      uint64_t count) LIBPOKE_API;
+
+/* Return the number of writes performed so far in the given IO
+   space.  This can be used to find out whether the contents of the
+   IO space have been modified since some point in time.  */
+
+uint64_t pk_ios_write_count (pk_ios ios) LIBPOKE_API;
+
+/* Return the value of some statistic of the given IO space.  STAT is
+   one of the PK_IOS_STAT_* values below.
+
+   PK_IOS_STAT_CACHE_HITS and PK_IOS_STAT_CACHE_MISSES are the number
+   of accesses to blocks found in the cache of the IO space, and the
+   number of blocks that had to be read into it.
+   PK_IOS_STAT_CACHE_BYTES is the memory currently used by the cache.
+
+   PK_IOS_STAT_READS and PK_IOS_STAT_WRITES are the number of reads
+   and writes performed in the IO space.  PK_IOS_STAT_READS_8,
+   PK_IOS_STAT_READS_32 and PK_IOS_STAT_READS_64 count the reads of up
+   to 8, 32 and 64 bits, and PK_IOS_STAT_READS_BULK the bigger ones.
+   Likewise for writes.  PK_IOS_STAT_BYTES_READ and
+   PK_IOS_STAT_BYTES_WRITTEN are the number of bytes transferred.
+
+   PK_IOS_STAT_DEV_READS and PK_IOS_STAT_DEV_WRITES are the number of
+   operations performed on the underlying device.
+
+   PK_IOS_STAT_DIRTY_MARKS is the number of times a range of the IO
+   space has been marked as modified, and PK_IOS_STAT_RANGES is the
+   number of mapped values registered in the IO space.
+   PK_IOS_STAT_RANGE_BYTES is the memory used to keep track of them.
+
+   Return 0 if STAT is not valid.  */
+
+#define PK_IOS_STAT_CACHE_HITS     0
+#define PK_IOS_STAT_CACHE_MISSES   1
+#define PK_IOS_STAT_CACHE_BYTES    2
+#define PK_IOS_STAT_READS          3
+#define PK_IOS_STAT_READS_8        4
+#define PK_IOS_STAT_READS_32       5
+#define PK_IOS_STAT_READS_64       6
+#define PK_IOS_STAT_READS_BULK     7
+#define PK_IOS_STAT_BYTES_READ     8
+#define PK_IOS_STAT_WRITES         9
+#define PK_IOS_STAT_WRITES_8      10
+#define PK_IOS_STAT_WRITES_32     11
+#define PK_IOS_STAT_WRITES_64     12
+#define PK_IOS_STAT_WRITES_BULK   13
+#define PK_IOS_STAT_BYTES_WRITTEN 14
+#define PK_IOS_STAT_DEV_READS     15
+#define PK_IOS_STAT_DEV_WRITES    16
+#define PK_IOS_STAT_DIRTY_MARKS   17
+#define PK_IOS_STAT_RANGES        18
+#define PK_IOS_STAT_RANGE_BYTES   19
+
+uint64_t pk_ios_stat (pk_ios ios, int stat) LIBPOKE_API;
+
+/* Set the counters of the statistics of the given IO space to
+   zero.  */
+
+void pk_ios_reset_stats (pk_ios ios) LIBPOKE_API;
+
+/* If TRACE_P is not zero, print a line using the terminal interface
+   for every operation performed on the device of the given IO space.
+   Otherwise, stop doing so.  */
+
+void pk_ios_set_trace (pk_ios ios, int trace_p) LIBPOKE_API;
+
 /* Open an IO space using a handler and if set_cur is set to 1, make
    the newly opened IO space the current space.  Return PK_IOS_NOID
    if there is an error opening the space (such as an unrecognized
@@ -684,6 +1129,109 @@ int pk_call (pk_compiler pkc, pk_val cls,
              pk_val *ret, pk_val *exit_exception,
              int narg, ...) LIBPOKE_API;
 
+/* Prepared calls.
+
+   pk_call compiles a little program every time it is called.  Code
+   calling the same function many times can instead prepare the call
+   once, and then perform it as many times as needed with different
+   arguments, without compiling anything.  */
+
+typedef struct _pk_prepared_call *pk_prepared_call;
+
+/* Prepare the calls to the closure CLS with NARG arguments.
+
+   Return NULL and set the status of PKC to PK_EINVAL if NARG is
+   negative, to PK_ENOMEM if there is not enough memory, or to
+   PK_ERROR if there is some other problem preparing the call.  */
+
+pk_prepared_call pk_prepare_call (pk_compiler pkc, pk_val cls,
+                                  int narg) LIBPOKE_API;
+
+/* Free the resources used by CALL.  */
+
+void pk_prepared_call_free (pk_prepared_call call) LIBPOKE_API;
+
+/* Call the function of the prepared call CALL, passing ARGS, an
+   array of as many values as specified to pk_prepare_call, as the
+   actual arguments.  ARGS may be NULL if the function gets no
+   arguments.  RET and EXIT_EXCEPTION and the returned value are like
+   in pk_call.  */
+
+int pk_call_prepared (pk_prepared_call call, const pk_val *args,
+                      pk_val *ret, pk_val *exit_exception) LIBPOKE_API;
+
+/* Interrupt the Poke code being executed by PKC, as if SIGINT had
+   been delivered to it.  This is intended to be called from the
+   terminal callbacks, for example when the user asks the pager to
+   stop showing the output of a command, so the command doesn't keep
+   computing and printing values that won't be shown.
+
+   The execution gets interrupted by a E_signal exception the next
+   time the running code checks for pending signals.  This function
+   has no effect if PKC is not executing any code.  */
+
+void pk_interrupt (pk_compiler pkc) LIBPOKE_API;
+
+/* Cancel the Poke code being executed by PKC.
+
+   This function is async-signal-safe, and it can be called from a
+   thread other than the one executing the code, like the thread of
+   a user interface offering a Cancel button.  The code gets an
+   E_cancel exception, whose code is PK_EC_CANCEL, raised the next
+   time it checks for pending signals, which happens at every loop
+   iteration and function call.  Copies of data between IO spaces are
+   stopped between chunks.  Poke code can handle the exception to
+   clean up, but it gets raised again at every check until the
+   function running the code returns.
+
+   This function has no effect if PKC is not executing any code.  */
+
+void pk_cancel (pk_compiler pkc) LIBPOKE_API;
+
+/* Limit the execution of the Poke code run by PKC to STEPS steps and
+   MSEC milliseconds.  Zero means no limit, which is the default.
+
+   The budget is granted anew to every call to pk_call, to the
+   pk_compile_* functions and to the other functions running Poke
+   code, and it covers all the code they run, pretty-printers
+   included.  The code is charged a step at every iteration of a loop
+   and at every function call, and the clock is checked every few
+   steps, so the limits are not exact.
+
+   When the budget is exhausted an E_timeout exception, whose code is
+   PK_EC_TIMEOUT, is raised.  Poke code can handle it, but it gets
+   raised again the next time it is charged a step.  If it is not
+   handled, it is returned in the EXIT_EXCEPTION argument of the
+   function running the code.  */
+
+void pk_set_budget (pk_compiler pkc, uint64_t steps,
+                    uint64_t msec) LIBPOKE_API;
+
+/* Return the steps and the milliseconds of the execution budget of
+   PKC.  */
+
+uint64_t pk_budget_steps (pk_compiler pkc) LIBPOKE_API;
+uint64_t pk_budget_msec (pk_compiler pkc) LIBPOKE_API;
+
+/* Limit the stacks of the Poke code run by PKC to NELEM elements.
+
+   The limit applies to the stack of values and to the stack of
+   function calls, each call taking three elements of it, so it
+   bounds the depth of recursion.  The memory of the stacks is only
+   provided by the system as it gets used, so smaller limits don't
+   make the compiler smaller, but they stop runaway recursion sooner.
+   Zero means as many elements as the stacks can hold, which is the
+   default.  Larger values are reduced to that.
+
+   When the limit is exceeded an E_stack exception, whose code is
+   PK_EC_STACK, is raised.  */
+
+void pk_set_stack_limit (pk_compiler pkc, uint64_t nelem) LIBPOKE_API;
+
+/* Return the maximum number of elements in the stacks of PKC.  */
+
+uint64_t pk_stack_limit (pk_compiler pkc) LIBPOKE_API;
+
 /* Get and set properties of the incremental compiler.  */
 
 int pk_obase (pk_compiler pkc) LIBPOKE_API;
@@ -970,7 +1518,9 @@ pk_val pk_array_nelem (pk_val array) LIBPOKE_API;
    ARRAY is the array value.
    IDX is the index of the element in the array.
 
-   If IDX is invalid, PK_NULL is returned. */
+   If IDX is invalid, PK_NULL is returned.  PK_NULL is also returned
+   for elements of lazily mapped arrays that have not been mapped
+   yet.  */
 
 pk_val pk_array_elem_value (pk_val array, uint64_t idx) LIBPOKE_API;
 
@@ -1016,6 +1566,128 @@ pk_val pk_array_elem_boffset (pk_val array, uint64_t idx) LIBPOKE_API;
 
 uint64_t pk_sizeof (pk_val val) LIBPOKE_API;
 
+/* Bulk extraction.
+
+   Reading many mapped values with the functions above requires a
+   call, a lookup by name and a boxed result per field.  A layout
+   describes instead, once, how to store the fields of Poke structs
+   in the members of a C struct, and then whole structs, or arrays of
+   structs, are copied to C memory with a single call.
+
+   Every member of the C struct is described by a pk_layout_field:
+
+   NAME is the name of the field in the Poke struct.  It can be a
+   path of names separated by dots, like "st_info.st_bind", in order
+   to get the fields of nested structs.
+
+   KIND is one of the PK_LAYOUT_* values below, and determines how the
+   value of the field is stored in the member.
+
+   OFFSET is the offset of the member in the C struct, in bytes, as
+   given by offsetof.  SIZE is the size of the member, in bytes.  */
+
+#define PK_LAYOUT_INTEGRAL 0 /* An integral value, or the magnitude of an
+                                offset, truncated to SIZE bytes, which
+                                shall be 1, 2, 4 or 8.  */
+#define PK_LAYOUT_BITS     1 /* Like PK_LAYOUT_INTEGRAL, but offsets are
+                                converted to bits.  */
+#define PK_LAYOUT_STRING   2 /* A `const char *' to the characters of a
+                                string, which are valid as long as the
+                                Poke value is alive.  SIZE shall be
+                                sizeof (const char *).  */
+
+struct pk_layout_field
+{
+  const char *name;
+  int kind;
+  size_t offset;
+  size_t size;
+};
+
+typedef struct _pk_layout *pk_layout;
+
+/* Create a layout for C structs of SIZE bytes, whose members are
+   described by the NFIELDS entries of FIELDS.  A layout can be used
+   with structs of any type having the described fields, and it
+   remembers where the fields are in the structs of the last type it
+   was used with.
+
+   Return NULL and set the status of PKC to PK_EINVAL if some entry
+   of FIELDS is not valid, or to PK_ENOMEM if there is not enough
+   memory.  */
+
+pk_layout pk_layout_new (pk_compiler pkc,
+                         const struct pk_layout_field *fields,
+                         size_t nfields, size_t size) LIBPOKE_API;
+
+/* Free the resources used by LAYOUT.  */
+
+void pk_layout_free (pk_layout layout) LIBPOKE_API;
+
+/* Store the fields of the Poke struct SCT in the C struct at BUF, as
+   described by LAYOUT.  Absent fields are stored as zero, or as NULL
+   strings.
+
+   Return PK_EINVAL if SCT is not a struct, if it has no field named
+   as described in LAYOUT, or if some field is not of the described
+   kind, in which case BUF may be partially written.  Return PK_OK
+   otherwise.  */
+
+int pk_extract_struct (pk_compiler pkc, pk_layout layout, pk_val sct,
+                       void *buf) LIBPOKE_API;
+
+/* Store up to COUNT elements of the Poke array of structs ARRAY,
+   starting at the index FROM, in consecutive C structs at BUF, as
+   described by LAYOUT, and set *NEXTRACTED to the number of stored
+   elements.  The elements of lazily mapped arrays are mapped as
+   needed.
+
+   Return PK_EINVAL if ARRAY is not an array, or as pk_extract_struct
+   for its elements.  Return PK_ERROR if mapping an element raised an
+   exception.  In both cases *NEXTRACTED is the number of elements
+   stored before the error.  Return PK_OK otherwise.  */
+
+int pk_extract_array (pk_compiler pkc, pk_layout layout, pk_val array,
+                      uint64_t from, uint64_t count, void *buf,
+                      uint64_t *nextracted) LIBPOKE_API;
+
+/* Decode COUNT consecutive values of the type named TYPE_NAME,
+   located at the bit-offset BOFFSET of the IO space IOS, straight
+   into BUF, without creating any Poke value.
+
+   The type shall have a fixed layout: integral and offset types,
+   arrays of them with a constant number of elements, integral
+   structs, and structs whose fields are all of these types, have no
+   labels nor conditions, and are not unions nor pinned.  Every value
+   is stored in BUF like a C struct whose members are the integral
+   values in the type, in order, each one in a member of the
+   smallest of int8_t, int16_t, int32_t and int64_t (or their
+   unsigned counterparts) that can hold it, with the usual alignment.
+   The magnitude of offsets is stored.  Arrays of the type are
+   consecutive in BUF.
+
+   The values are decoded using the endianness and negative encoding
+   of the compiler, or the endianness specified in the fields.  The
+   constraints of the fields are not checked, and neither the mappers
+   of the type nor its methods are run.
+
+   Return PK_EINVAL if TYPE_NAME doesn't name a type with a fixed
+   layout, PK_EEOF if the values extend past the end of the IO space,
+   PK_ERROR if there is some other error reading from the IO space,
+   and PK_OK otherwise.  */
+
+int pk_map_to_buffer (pk_compiler pkc, const char *type_name, pk_ios ios,
+                      uint64_t boffset, uint64_t count,
+                      void *buf) LIBPOKE_API;
+
+/* Return the size in bytes of the values of the type named TYPE_NAME
+   stored by pk_map_to_buffer, or zero if the type doesn't have a
+   fixed layout, in which case the status of PKC is set to
+   PK_EINVAL.  */
+
+size_t pk_map_buffer_size (pk_compiler pkc, const char *type_name)
+  LIBPOKE_API;
+
 /* Integral types.  */
 
 /* Build and return an integral type.
@@ -1301,6 +1973,47 @@ int pk_val_kind (pk_val val) LIBPOKE_API;
 
 int pk_val_equal_p (pk_val val1, pk_val val2) LIBPOKE_API;
 
+/* Account the memory used by the given value.
+
+   HANDLER is called for VAL, if it is a struct or an array, and for
+   every struct and array contained in it, with the following
+   arguments:
+
+     VAL is the struct or array.
+
+     WEIGHT is the number of values like VAL it stands for, which is
+     bigger than one for the values contained in sampled arrays.
+
+     BYTES is the number of bytes used by the value itself, including
+     the storage of its fields or elements.
+
+     BOXED_BYTES is the number of bytes used by the boxed integers and
+     offsets stored in it, including the offsets of the fields or
+     elements of mapped values.
+
+     STRING_BYTES is the number of bytes used by the names of the
+     fields and by the strings stored in it.
+
+     DATA is a user-provided pointer at pk_val_footprint invocation.
+
+   The values contained in a struct or array are not accounted in the
+   figures of the struct or array, but reported separately.
+
+   Arrays having more than SAMPLE elements are sampled, walking only
+   SAMPLE elements evenly spread over them.  If SAMPLE is zero every
+   element is walked.
+
+   Values referenced from several places, like the names of the
+   fields, are accounted once per reference, so the figures are
+   upper bounds.  */
+
+typedef void (*pk_footprint_fn) (pk_val val, double weight,
+                                 uint64_t bytes, uint64_t boxed_bytes,
+                                 uint64_t string_bytes, void *data);
+
+void pk_val_footprint (pk_val val, uint64_t sample,
+                       pk_footprint_fn handler, void *data) LIBPOKE_API;
+
 /* Print the given value using the current PKC settings.
 
    If printing the value implies to run a struct pretty-printer or to
@@ -1395,6 +2108,86 @@ struct pk_iod_if
 int pk_register_iod (pk_compiler pkc, struct pk_iod_if *iod_if)
   LIBPOKE_API;
 
+/* Version 2 of the foreign IO devices interface.
+
+   It extends struct pk_iod_if with optional operations that allow
+   foreign devices to be accessed as efficiently as the built-in ones.
+   Any of the function pointers can be NULL.  */
+
+#define PK_IOD_IF_VERSION 2
+
+/* An entry in a batch of reads.  COUNT bytes at byte offset OFFSET
+   are to be read into BUF.  */
+
+struct pk_iod_iovec
+{
+  void *buf;
+  size_t count;
+  pk_iod_off offset;
+};
+
+/* Function to be called by a foreign device when an asynchronous
+   read completes.  TAG is the value passed to the PREAD_ASYNC
+   function below, and STATUS is PK_IOD_OK or an error code.  */
+
+typedef void (*pk_iod_completion_fn) (void *tag, int status);
+
+struct pk_iod_if_v2
+{
+  /* Version of the interface.  This shall be PK_IOD_IF_VERSION.  */
+  int version;
+
+  /* If not zero then libpoke keeps a cache of blocks of the contents
+     of the IO spaces operated by the device, and the device gets
+     reads and writes of whole blocks.  Otherwise every access is
+     passed to the device right away.  */
+  int cache_p;
+
+  /* Return a pointer to the COUNT bytes at byte offset OFFSET, if the
+     device holds them contiguously in memory, or NULL otherwise.  The
+     pointer shall remain valid until the next write to the device or
+     until it is closed.  Never called if CACHE_P is not zero.  */
+  const void * (*get_ptr) (void *dev, size_t count, pk_iod_off offset);
+
+  /* Perform the IOVCNT reads described by IOV, which are not
+     necessarily contiguous.  Return PK_IOD_OK only if all of them
+     succeed.  */
+  int (*preadv) (void *dev, const struct pk_iod_iovec *iov, size_t iovcnt);
+
+  /* Hint that the COUNT bytes at byte offset OFFSET are about to be
+     read, replacing any previous hint.  If COUNT is zero then the
+     data fetched in advance shall be discarded.  Return PK_IOD_EINVAL
+     to let the cache of libpoke, if any, fetch the data instead.  */
+  int (*prefetch) (void *dev, pk_iod_off offset, size_t count);
+
+  /* Issue a read of COUNT bytes at byte offset OFFSET into BUF and
+     return PK_IOD_OK without waiting for the data, or an error code
+     if the read can't be issued.  The device shall call DONE with TAG
+     when the read completes, from within POLL.  Used to issue batches
+     of reads at once if PREADV is NULL.  */
+  int (*pread_async) (void *dev, void *buf, size_t count, pk_iod_off offset,
+                      pk_iod_completion_fn done, void *tag);
+
+  /* Call the completion functions of the asynchronous reads that have
+     completed.  If WAIT_P is not zero, wait for at least one of them.
+     Return PK_IOD_EOF if there are no pending reads, PK_IOD_OK
+     normally, and any other error code only if the completion
+     functions of the pending reads won't be called.  This shall be
+     provided if PREAD_ASYNC is provided.  */
+  int (*poll) (void *dev, int wait_p);
+};
+
+/* Register a foreign IO device, like pk_register_iod, with the
+   additional operations in IOD_IF_V2.
+
+   Return PK_ERROR if the version of IOD_IF_V2 is not supported, or if
+   it provides PREAD_ASYNC but not POLL.
+   Return PK_OK otherwise.  */
+
+int pk_register_iod_v2 (pk_compiler pkc, struct pk_iod_if *iod_if,
+                        const struct pk_iod_if_v2 *iod_if_v2)
+  LIBPOKE_API;
+
 /* Given a string, determine whether it corresponds to a Poke
    keyword.  */
 
@@ -284,6 +284,13 @@ pk_val_equal_p (pk_val val1, pk_val val2)
   return pvm_val_equal_p (val1, val2);
 }
 
+void
+pk_val_footprint (pk_val val, uint64_t sample,
+                  pk_footprint_fn handler, void *data)
+{
+  pvm_val_footprint (val, sample, (pvm_footprint_fn) handler, data);
+}
+
 pk_val
 pk_make_struct (pk_compiler pkc __attribute__ ((unused)), pk_val nfields,
                 pk_val type)
@@ -510,7 +517,7 @@ pk_val
 pk_array_elem_value (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_VALUE (array, idx);
+    return pvm_array_elem_value (array, idx);
   else
     return PK_NULL;
 }
@@ -531,7 +538,7 @@ pk_val
 pk_array_elem_boffset (pk_val array, uint64_t idx)
 {
   if (idx < pk_uint_value (pk_array_nelem (array)))
-    return PVM_VAL_ARR_ELEM_OFFSET (array, idx);
+    return pvm_array_elem_offset (array, idx);
   else
     return PK_NULL;
 }
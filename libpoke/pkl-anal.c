@@ -597,7 +597,9 @@ PKL_PHASE_END_HANDLER
    a method.
 
    Assigning to a computed fild that lacks a setter is a compile-time
-   error.  */
+   error.
+
+   It is also an error to assign to a function declared immutable.  */
 
 PKL_PHASE_BEGIN_HANDLER (pkl_anal1_ps_ass_stmt)
 {
@@ -618,6 +620,15 @@ PKL_PHASE_BEGIN_HANDLER (pkl_anal1_ps_ass_stmt)
                      "invalid assignment to struct field");
           PKL_PASS_ERROR;
         }
+
+      /* Calls to immutable functions may get inlined.  */
+      if (PKL_AST_DECL_KIND (var_decl) == PKL_AST_DECL_KIND_FUNC
+          && PKL_AST_DECL_IMMUTABLE_P (var_decl))
+        {
+          PKL_ERROR (PKL_AST_LOC (var),
+                     "invalid assignment to immutable function");
+          PKL_PASS_ERROR;
+        }
     }
 }
 PKL_PHASE_END_HANDLER
@@ -730,6 +741,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_anal1 =
   {
+    PKL_PHASE_NAME ("anal1"),
     .initialize = pkl_anal_initialize,
     .finalize = pkl_anal_finalize,
 
@@ -1106,6 +1118,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_anal2 =
   {
+    PKL_PHASE_NAME ("anal2"),
     .initialize = pkl_anal_initialize,
     .finalize = pkl_anal_finalize,
 
@@ -1190,6 +1203,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_analf =
   {
+    PKL_PHASE_NAME ("analf"),
     .initialize = pkl_anal_initialize,
     .finalize = pkl_anal_finalize,
 
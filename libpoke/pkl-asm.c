@@ -29,8 +29,10 @@
 
 #include "pkl-asm.h"
 #include "pkl-env.h"
+#include "pkl-pass.h"
 #include "pvm-alloc.h"
 #include "pvm-program.h"
+#include "pvm-val.h"
 
 /* Code generated by RAS is used to implement many macro-instructions.
    Configure it to use the right assembler, and include the assembled
@@ -104,10 +106,26 @@ struct pkl_asm_level
    AST is for creating ast nodes whenever needed.
 
    ERROR_LABEL marks the generic error handler defined in the standard
-   prologue.  */
+   prologue.
+
+   PENDING is a stack of NPENDING constants that have been pushed but
+   not yet appended to the program.  See the peephole optimizer
+   below.
+
+   TOS_NONNULL_P is 1 if the value at the top of the stack, not
+   counting the pending constants, is known to not be null.
+
+   UNREACHABLE_P is 1 if the instructions being assembled can never
+   be executed.
+
+   NONNULL contains the indexes of NNONNULL variables of the current
+   lexical frame which are known to never be null.  */
 
 #define PKL_ASM_LEVEL(PASM) ((PASM)->level)
 
+#define PKL_ASM_MAX_PENDING 3
+#define PKL_ASM_MAX_NONNULL 4
+
 struct pkl_asm
 {
   pkl_compiler compiler;
@@ -115,6 +133,13 @@ struct pkl_asm
   struct pkl_asm_level *level;
   pkl_ast ast;
   pvm_program_label error_label;
+
+  pvm_val pending[PKL_ASM_MAX_PENDING];
+  int npending;
+  int tos_nonnull_p;
+  int unreachable_p;
+  unsigned int nonnull[PKL_ASM_MAX_NONNULL];
+  int nnonnull;
 };
 
 /* Push a new level to PASM's level stack with ENV.  */
@@ -1468,6 +1493,257 @@ pkl_asm_insn_ais (pkl_asm pasm, pkl_ast_node atype)
   RAS_MACRO_AIS (PKL_AST_TYPE_A_ETYPE (atype));
 }
 
+/* The assembler performs a few simple optimizations while the
+   instructions are being appended to the program.  These are mostly
+   useful in the mapper, writer and constructor routines generated
+   from the templates in pkl-gen.pks, which are expanded for every
+   type and often end up operating on values that are known at
+   compile-time.
+
+   Pushed constants are not appended to the program right away.
+   Instead, they are kept in a small stack of pending constants, on
+   which stack manipulation instructions, unsigned integral arithmetic
+   and conditional branches are evaluated at assembly time.  The
+   pending constants are appended to the program once an instruction
+   that can't be evaluated is found, or a label is appended.
+
+   Conditional branches depending on either a constant or a variable
+   which is known to never be null (see PKL_INSN_ASSUMENN) are either
+   removed or turned into unconditional branches.
+
+   Instructions following an unconditional transfer of control are
+   not appended to the program, up to the next label.  */
+
+/* Append the pending constants of PASM to the program.  */
+
+static void
+pkl_asm_flush (pkl_asm pasm)
+{
+  int i;
+
+  if (pasm->npending == 0)
+    return;
+
+  for (i = 0; i < pasm->npending; ++i)
+    pvm_program_append_push_instruction (pasm->program,
+                                         pasm->pending[i]);
+  pasm->tos_nonnull_p = (pasm->pending[pasm->npending - 1] != PVM_NULL);
+  pasm->npending = 0;
+}
+
+/* Push the constant VAL in the stack of pending constants of PASM.
+   If the stack is full the oldest constant is appended to the
+   program.  */
+
+static void
+pkl_asm_push_pending (pkl_asm pasm, pvm_val val)
+{
+  if (pasm->npending == PKL_ASM_MAX_PENDING)
+    {
+      pvm_program_append_push_instruction (pasm->program,
+                                           pasm->pending[0]);
+      pasm->tos_nonnull_p = (pasm->pending[0] != PVM_NULL);
+      memmove (pasm->pending, pasm->pending + 1,
+               (PKL_ASM_MAX_PENDING - 1) * sizeof (pvm_val));
+      pasm->npending--;
+    }
+
+  pasm->pending[pasm->npending++] = val;
+}
+
+/* Return 1 if the variable at OVER in the current lexical frame is
+   known to never be null, 0 otherwise.  */
+
+static int
+pkl_asm_nonnull_var_p (pkl_asm pasm, unsigned int over)
+{
+  int i;
+
+  for (i = 0; i < pasm->nnonnull; ++i)
+    if (pasm->nonnull[i] == over)
+      return 1;
+  return 0;
+}
+
+/* Determine whether the conditional branch instruction INSN would
+   branch with VAL at the top of the stack.  Return 1 if it would, 0
+   if it wouldn't and -1 if it is not known.  */
+
+static int
+pkl_asm_branch_taken (enum pkl_asm_insn insn, pvm_val val)
+{
+  switch (insn)
+    {
+    case PKL_INSN_BN:
+      return val == PVM_NULL;
+    case PKL_INSN_BNN:
+      return val != PVM_NULL;
+    case PKL_INSN_BZI:
+    case PKL_INSN_BNZI:
+      if (!PVM_IS_INT (val))
+        return -1;
+      return (PVM_VAL_INT (val) == 0) == (insn == PKL_INSN_BZI);
+    case PKL_INSN_BZIU:
+    case PKL_INSN_BNZIU:
+      if (!PVM_IS_UINT (val))
+        return -1;
+      return (PVM_VAL_UINT (val) == 0) == (insn == PKL_INSN_BZIU);
+    case PKL_INSN_BZL:
+    case PKL_INSN_BNZL:
+      if (!PVM_IS_LONG (val))
+        return -1;
+      return (PVM_VAL_LONG (val) == 0) == (insn == PKL_INSN_BZL);
+    case PKL_INSN_BZLU:
+    case PKL_INSN_BNZLU:
+      if (!PVM_IS_ULONG (val))
+        return -1;
+      return (PVM_VAL_ULONG (val) == 0) == (insn == PKL_INSN_BZLU);
+    default:
+      return -1;
+    }
+}
+
+/* Evaluate the unsigned arithmetic instruction INSN with operands A
+   and B.  Return the result, or PVM_NULL if it can't be evaluated at
+   assembly time.  Like in the PVM, the size of the result is the size
+   of A.  */
+
+static pvm_val
+pkl_asm_binop (enum pkl_asm_insn insn, pvm_val a, pvm_val b)
+{
+  if (PVM_IS_ULONG (a) && PVM_IS_ULONG (b))
+    {
+      uint64_t x = PVM_VAL_ULONG (a);
+      uint64_t y = PVM_VAL_ULONG (b);
+      int size = PVM_VAL_ULONG_SIZE (a);
+
+      switch (insn)
+        {
+        case PKL_INSN_ADDLU: return pvm_make_ulong (x + y, size);
+        case PKL_INSN_SUBLU: return pvm_make_ulong (x - y, size);
+        case PKL_INSN_MULLU: return pvm_make_ulong (x * y, size);
+        case PKL_INSN_DIVLU:
+          return y == 0 ? PVM_NULL : pvm_make_ulong (x / y, size);
+        case PKL_INSN_MODLU:
+          return y == 0 ? PVM_NULL : pvm_make_ulong (x % y, size);
+        default:
+          break;
+        }
+    }
+  else if (PVM_IS_UINT (a) && PVM_IS_UINT (b))
+    {
+      uint32_t x = PVM_VAL_UINT (a);
+      uint32_t y = PVM_VAL_UINT (b);
+      int size = PVM_VAL_UINT_SIZE (a);
+
+      switch (insn)
+        {
+        case PKL_INSN_ADDIU: return pvm_make_uint (x + y, size);
+        case PKL_INSN_SUBIU: return pvm_make_uint (x - y, size);
+        case PKL_INSN_MULIU: return pvm_make_uint (x * y, size);
+        case PKL_INSN_DIVIU:
+          return y == 0 ? PVM_NULL : pvm_make_uint (x / y, size);
+        case PKL_INSN_MODIU:
+          return y == 0 ? PVM_NULL : pvm_make_uint (x % y, size);
+        default:
+          break;
+        }
+    }
+
+  return PVM_NULL;
+}
+
+/* Try to evaluate the PVM instruction INSN at assembly time.  LABEL
+   is the argument of INSN if it is a branch instruction.  Return 1
+   if INSN has been handled, 0 if it must be appended to the
+   program.  */
+
+static int
+pkl_asm_fold (pkl_asm pasm, enum pkl_asm_insn insn,
+              pvm_program_label label)
+{
+  pvm_val *pending = pasm->pending;
+  int n = pasm->npending;
+
+  switch (insn)
+    {
+    case PKL_INSN_DROP:
+      if (n < 1)
+        return 0;
+      pasm->npending--;
+      return 1;
+    case PKL_INSN_DUP:
+      if (n < 1)
+        return 0;
+      pkl_asm_push_pending (pasm, pending[n - 1]);
+      return 1;
+    case PKL_INSN_SWAP:
+      {
+        pvm_val tmp;
+
+        if (n < 2)
+          return 0;
+        tmp = pending[n - 1];
+        pending[n - 1] = pending[n - 2];
+        pending[n - 2] = tmp;
+        return 1;
+      }
+    case PKL_INSN_NIP:
+      if (n < 2)
+        return 0;
+      pending[n - 2] = pending[n - 1];
+      pasm->npending--;
+      return 1;
+    case PKL_INSN_NIP2:
+      if (n < 3)
+        return 0;
+      pending[n - 3] = pending[n - 1];
+      pasm->npending -= 2;
+      return 1;
+    case PKL_INSN_ADDLU: case PKL_INSN_SUBLU: case PKL_INSN_MULLU:
+    case PKL_INSN_DIVLU: case PKL_INSN_MODLU:
+    case PKL_INSN_ADDIU: case PKL_INSN_SUBIU: case PKL_INSN_MULIU:
+    case PKL_INSN_DIVIU: case PKL_INSN_MODIU:
+      {
+        pvm_val res;
+
+        /* Note these instructions don't consume their operands.  */
+        if (n < 2)
+          return 0;
+        res = pkl_asm_binop (insn, pending[n - 2], pending[n - 1]);
+        if (res == PVM_NULL)
+          return 0;
+        pkl_asm_push_pending (pasm, res);
+        return 1;
+      }
+    case PKL_INSN_BN: case PKL_INSN_BNN:
+    case PKL_INSN_BZI: case PKL_INSN_BZIU:
+    case PKL_INSN_BZL: case PKL_INSN_BZLU:
+    case PKL_INSN_BNZI: case PKL_INSN_BNZIU:
+    case PKL_INSN_BNZL: case PKL_INSN_BNZLU:
+      {
+        int taken;
+
+        /* Note these instructions don't consume their operands.  */
+        if (n > 0)
+          taken = pkl_asm_branch_taken (insn, pending[n - 1]);
+        else if (pasm->tos_nonnull_p
+                 && (insn == PKL_INSN_BN || insn == PKL_INSN_BNN))
+          taken = (insn == PKL_INSN_BNN);
+        else
+          return 0;
+
+        if (taken == -1)
+          return 0;
+        if (taken)
+          pkl_asm_insn (pasm, PKL_INSN_BA, label);
+        return 1;
+      }
+    default:
+      return 0;
+    }
+}
+
 /* Create a new instance of an assembler.  This initializes a new
    routine.  */
 
@@ -1514,6 +1790,9 @@ pvm_program
 pkl_asm_finish (pkl_asm pasm, int epilogue)
 {
   pvm_program program = pasm->program;
+  pkl_pass_timer timer = pkl_timer (pasm->compiler);
+  struct pkl_pass_timer_entry *timer_entry
+    = pkl_pass_timer_enter (timer, "asm");
 
   if (epilogue)
     {
@@ -1524,7 +1803,7 @@ pkl_asm_finish (pkl_asm pasm, int epilogue)
       pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_int (PVM_EXIT_OK, 32));
       pkl_asm_insn (pasm, PKL_INSN_EXIT);
 
-      pvm_program_append_label (pasm->program, pasm->error_label);
+      pkl_asm_label (pasm, pasm->error_label);
 
       /* Default exception handler.  */
       if (pkl_bootstrapped_p (pasm->compiler))
@@ -1554,9 +1833,14 @@ pkl_asm_finish (pkl_asm pasm, int epilogue)
       pkl_asm_note (pasm, "#end epilogue");
     }
 
+  /* Append any constant still pending.  */
+  pkl_asm_flush (pasm);
+
   /* Free the first level.  */
   pkl_asm_poplevel (pasm);
 
+  pkl_pass_timer_leave (timer, timer_entry);
+
   /* Free the assembler instance and return the assembled program to
      the user.  */
   return program;
@@ -1585,6 +1869,15 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
 
   va_list valist;
 
+  /* Lexical frames are changed by these instructions, also when they
+     are not reachable, so the indexes of the variables known to be
+     non-null are no longer valid.  */
+  if (insn == PKL_INSN_PUSHF || insn == PKL_INSN_POPF)
+    pasm->nnonnull = 0;
+
+  if (pasm->unreachable_p && insn < PKL_INSN_MACRO)
+    return;
+
   if (insn == PKL_INSN_PUSH)
     {
       pvm_val val;
@@ -1593,19 +1886,47 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
       val = va_arg (valist, pvm_val);
       va_end (valist);
 
-      pvm_program_append_push_instruction (pasm->program, val);
+      pkl_asm_push_pending (pasm, val);
     }
   else if (insn < PKL_INSN_MACRO)
     {
       /* This is a PVM instruction.  Process its arguments and append
-         it to the PVM program.  */
+         it to the PVM program, unless it can be evaluated at
+         assembly time.  */
 
       const char *insn_name = insn_names[insn];
       const char *p;
+      pvm_program_label label = 0;
+      int pushvar_nonnull_p = 0;
 
+      if (insn_args[insn][0] == 'l')
+        {
+          va_start (valist, insn);
+          label = va_arg (valist, pvm_program_label);
+          va_end (valist);
+        }
+
+      if (pkl_asm_fold (pasm, insn, label))
+        return;
+
+      pkl_asm_flush (pasm);
       pvm_program_append_instruction (pasm->program, insn_name);
 
       va_start (valist, insn);
+      if (insn == PKL_INSN_PUSHVAR)
+        {
+          va_list args;
+          unsigned int back, over;
+
+          va_copy (args, valist);
+          back = va_arg (args, unsigned int);
+          over = va_arg (args, unsigned int);
+          va_end (args);
+
+          pushvar_nonnull_p = (back == 0
+                               && pkl_asm_nonnull_var_p (pasm, over));
+        }
+
       for (p = insn_args[insn]; *p != '\0'; ++p)
         {
           char arg_class = *p;
@@ -1653,6 +1974,13 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
             }
         }
       va_end (valist);
+
+      pasm->tos_nonnull_p = pushvar_nonnull_p;
+      if (insn == PKL_INSN_BA
+          || insn == PKL_INSN_RAISE
+          || insn == PKL_INSN_RETURN
+          || insn == PKL_INSN_TCALL)
+        pasm->unreachable_p = 1;
     }
   else
     {
@@ -1982,6 +2310,19 @@ pkl_asm_insn (pkl_asm pasm, enum pkl_asm_insn insn, ...)
             pkl_asm_insn_ssetc (pasm, struct_type);
             break;
           }
+        case PKL_INSN_ASSUMENN:
+          {
+            unsigned int back, over;
+
+            va_start (valist, insn);
+            back = va_arg (valist, unsigned int);
+            over = va_arg (valist, unsigned int);
+            va_end (valist);
+
+            if (back == 0 && pasm->nnonnull < PKL_ASM_MAX_NONNULL)
+              pasm->nonnull[pasm->nnonnull++] = over;
+            break;
+          }
         case PKL_INSN_MACRO:
         default:
           PK_UNREACHABLE ();
@@ -2044,7 +2385,7 @@ pkl_asm_else (pkl_asm pasm)
   assert (pasm->level->current_env == PKL_ASM_ENV_CONDITIONAL);
 
   pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label2);
-  pvm_program_append_label (pasm->program, pasm->level->label1);
+  pkl_asm_label (pasm, pasm->level->label1);
   /* Pop the expression condition from the stack.  */
   pkl_asm_insn (pasm, PKL_INSN_DROP);
 }
@@ -2053,7 +2394,7 @@ void
 pkl_asm_endif (pkl_asm pasm)
 {
   assert (pasm->level->current_env == PKL_ASM_ENV_CONDITIONAL);
-  pvm_program_append_label (pasm->program, pasm->level->label2);
+  pkl_asm_label (pasm, pasm->level->label2);
 
   /* Cleanup and pop the current level.  */
   pkl_ast_node_free (pasm->level->node1);
@@ -2099,7 +2440,7 @@ pkl_asm_catch (pkl_asm pasm)
 
   pkl_asm_insn (pasm, PKL_INSN_POPE);
   pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label2);
-  pvm_program_append_label (pasm->program, pasm->level->label1);
+  pkl_asm_label (pasm, pasm->level->label1);
 
   /* At this point the Exception is at the top of the stack.  If the
      catch block received an argument, push a new environment and set
@@ -2123,7 +2464,7 @@ pkl_asm_endtry (pkl_asm pasm)
   if (pasm->level->node1)
     pkl_asm_insn (pasm, PKL_INSN_POPF, 1);
 
-  pvm_program_append_label (pasm->program, pasm->level->label2);
+  pkl_asm_label (pasm, pasm->level->label2);
 
   /* Cleanup and pop the current level.  */
   pkl_ast_node_free (pasm->level->node1);
@@ -2149,16 +2490,16 @@ pkl_asm_loop (pkl_asm pasm)
   pasm->level->label1 = pvm_program_fresh_label (pasm->program);
   pasm->level->break_label = pvm_program_fresh_label (pasm->program);
   pasm->level->continue_label = pvm_program_fresh_label (pasm->program);
-  pvm_program_append_label (pasm->program, pasm->level->label1);
+  pkl_asm_label (pasm, pasm->level->label1);
 }
 
 void
 pkl_asm_endloop (pkl_asm pasm)
 {
-  pvm_program_append_label (pasm->program, pasm->level->continue_label);
+  pkl_asm_label (pasm, pasm->level->continue_label);
   pkl_asm_insn (pasm, PKL_INSN_SYNC);
   pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label1);
-  pvm_program_append_label (pasm->program, pasm->level->break_label);
+  pkl_asm_label (pasm, pasm->level->break_label);
 
   /* Cleanup and pop the current level.  */
   pkl_asm_poplevel (pasm);
@@ -2191,7 +2532,7 @@ pkl_asm_while (pkl_asm pasm)
   pasm->level->break_label = pvm_program_fresh_label (pasm->program);
   pasm->level->continue_label = pvm_program_fresh_label (pasm->program);
 
-  pvm_program_append_label (pasm->program, pasm->level->label1);
+  pkl_asm_label (pasm, pasm->level->label1);
 }
 
 void
@@ -2208,15 +2549,14 @@ pkl_asm_while_loop (pkl_asm pasm, pkl_ast_node condition_type)
 void
 pkl_asm_while_endloop (pkl_asm pasm)
 {
-  pvm_program_append_label (pasm->program,
-                            pasm->level->continue_label);
+  pkl_asm_label (pasm, pasm->level->continue_label);
   pkl_asm_insn (pasm, PKL_INSN_SYNC);
   pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label1);
-  pvm_program_append_label (pasm->program, pasm->level->label2);
+  pkl_asm_label (pasm, pasm->level->label2);
   /* Pop the loop condition from the stack.  */
   pkl_asm_insn (pasm, PKL_INSN_DROP);
 
-  pvm_program_append_label (pasm->program, pasm->level->break_label);
+  pkl_asm_label (pasm, pasm->level->break_label);
 
   /* Cleanup and pop the current level.  */
   pkl_asm_poplevel (pasm);
@@ -2261,7 +2601,7 @@ pkl_asm_for (pkl_asm pasm, pkl_ast_node head)
 void
 pkl_asm_for_condition (pkl_asm pasm)
 {
-  pvm_program_append_label (pasm->program, pasm->level->label1);
+  pkl_asm_label (pasm, pasm->level->label1);
 }
 
 void
@@ -2278,7 +2618,7 @@ pkl_asm_for_loop (pkl_asm pasm, pkl_ast_node cond_type)
 void
 pkl_asm_for_tail (pkl_asm pasm)
 {
-  pvm_program_append_label (pasm->program, pasm->level->continue_label);
+  pkl_asm_label (pasm, pasm->level->continue_label);
 }
 
 void
@@ -2286,9 +2626,9 @@ pkl_asm_for_endloop (pkl_asm pasm)
 {
   pkl_asm_insn (pasm, PKL_INSN_SYNC);
   pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label1);
-  pvm_program_append_label (pasm->program, pasm->level->label2);
+  pkl_asm_label (pasm, pasm->level->label2);
   pkl_asm_insn (pasm, PKL_INSN_DROP); /* The condition boolean */
-  pvm_program_append_label (pasm->program, pasm->level->break_label);
+  pkl_asm_label (pasm, pasm->level->break_label);
 
   if (pasm->level->node1)
     pkl_asm_insn (pasm, PKL_INSN_POPF, 1);
@@ -2376,7 +2716,7 @@ pkl_asm_for_in (pkl_asm pasm, int container_type,
 void
 pkl_asm_for_in_where (pkl_asm pasm)
 {
-  pvm_program_append_label (pasm->program, pasm->level->label1);
+  pkl_asm_label (pasm, pasm->level->label1);
 
   pkl_asm_insn (pasm, PKL_INSN_PUSHF, 1);
   pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_NULL);
@@ -2386,7 +2726,7 @@ pkl_asm_for_in_where (pkl_asm pasm)
   pkl_asm_insn (pasm, PKL_INSN_SWAP);
   pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_NULL);
 
-  pvm_program_append_label (pasm->program, pasm->level->label2);
+  pkl_asm_label (pasm, pasm->level->label2);
 
   pkl_asm_insn (pasm, PKL_INSN_DROP);
   pkl_asm_insn (pasm, PKL_INSN_EQLU);
@@ -2428,18 +2768,17 @@ pkl_asm_for_in_loop (pkl_asm pasm)
 void
 pkl_asm_for_in_endloop (pkl_asm pasm)
 {
-  pvm_program_append_label (pasm->program,
-                            pasm->level->continue_label);
+  pkl_asm_label (pasm, pasm->level->continue_label);
   pkl_asm_insn (pasm, PKL_INSN_SYNC);
   pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_NULL);
   pkl_asm_insn (pasm, PKL_INSN_BA, pasm->level->label2);
 
-  pvm_program_append_label (pasm->program, pasm->level->label3);
+  pkl_asm_label (pasm, pasm->level->label3);
 
   /* Cleanup the stack, and pop the current frame from the
      environment.  */
   pkl_asm_insn (pasm, PKL_INSN_DROP);
-  pvm_program_append_label (pasm->program, pasm->level->break_label);
+  pkl_asm_label (pasm, pasm->level->break_label);
   pkl_asm_insn (pasm, PKL_INSN_DROP);
   pkl_asm_insn (pasm, PKL_INSN_DROP);
   pkl_asm_insn (pasm, PKL_INSN_DROP);
@@ -2527,7 +2866,12 @@ pkl_asm_fresh_label (pkl_asm pasm)
 void
 pkl_asm_label (pkl_asm pasm, pvm_program_label label)
 {
+  pkl_asm_flush (pasm);
   pvm_program_append_label (pasm->program, label);
+
+  /* The label may be the target of branches from anywhere.  */
+  pasm->tos_nonnull_p = 0;
+  pasm->unreachable_p = 0;
 }
 
 char *
@@ -2535,10 +2879,15 @@ pkl_asm_from_string (pkl_asm pasm, const char *str)
 {
   char *expanded_template
     = pvm_program_expand_asm_template (str);
+  char *ret;
 
-  char *ret
-    = pvm_program_parse_from_string (expanded_template, pasm->program);
+  pkl_asm_flush (pasm);
+  ret = pvm_program_parse_from_string (expanded_template, pasm->program);
   free (expanded_template);
 
+  /* The parsed code may contain labels and branches.  */
+  pasm->tos_nonnull_p = 0;
+  pasm->unreachable_p = 0;
+
   return ret;
 }
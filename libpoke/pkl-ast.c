@@ -131,10 +131,22 @@ pkl_ast_make_identifier (pkl_ast ast,
 
   PKL_AST_IDENTIFIER_POINTER (id) = xstrdup (str);
   PKL_AST_IDENTIFIER_LENGTH (id) = strlen (str);
+  PKL_AST_IDENTIFIER_HASH (id) = pkl_ast_hash_string (str);
 
   return id;
 }
 
+uint32_t
+pkl_ast_hash_string (const char *str)
+{
+  /* FNV-1a.  */
+  uint32_t hash = 2166136261u;
+
+  for (; *str; ++str)
+    hash = (hash ^ (unsigned char) *str) * 16777619u;
+  return hash;
+}
+
 /* Build and return an AST node for an enumerator.  */
 
 pkl_ast_node
@@ -695,6 +707,8 @@ pkl_ast_dup_type (pkl_ast_node type)
             = struct_type_elem_computed_p;
           PKL_AST_STRUCT_TYPE_FIELD_SIZE (struct_type_elem)
             = ASTREF (struct_type_elem_size);
+          PKL_AST_STRUCT_TYPE_FIELD_STATIC_OFFSET (struct_type_elem)
+            = PKL_AST_STRUCT_TYPE_FIELD_STATIC_OFFSET (t);
           PKL_AST_TYPE_S_ELEMS (new)
             = pkl_ast_chainon (PKL_AST_TYPE_S_ELEMS (new),
                                struct_type_elem);
@@ -702,6 +716,8 @@ pkl_ast_dup_type (pkl_ast_node type)
           PKL_AST_TYPE_S_PINNED_P (new) = PKL_AST_TYPE_S_PINNED_P (type);
           PKL_AST_TYPE_S_UNION_P (new) = PKL_AST_TYPE_S_UNION_P (type);
         }
+      PKL_AST_TYPE_S_STATIC_LAYOUT_P (new)
+        = PKL_AST_TYPE_S_STATIC_LAYOUT_P (type);
       break;
     case PKL_TYPE_FUNCTION:
       PKL_AST_TYPE_F_RTYPE (new)
@@ -1507,6 +1523,91 @@ pkl_ast_type_is_complete (pkl_ast_node type)
   return complete;
 }
 
+/* Compute the static layout of the struct type TYPE.
+
+   The offsets of the fields of a struct are known at compile-time if
+   the struct type is complete, is neither a union, pinned nor
+   integral, and none of its fields has a label.  In that case store
+   the offsets in the fields and set the STATIC_LAYOUT_P flag of the
+   type.
+
+   The sizes of the fields should have been constant-folded before
+   calling this function.  */
+
+void
+pkl_ast_struct_type_layout (pkl_ast_node type)
+{
+  pkl_ast_node t;
+  uint64_t offset = 0;
+
+  PKL_AST_TYPE_S_STATIC_LAYOUT_P (type) = 0;
+
+  if (PKL_AST_TYPE_COMPLETE (type) != PKL_AST_TYPE_COMPLETE_YES
+      || PKL_AST_TYPE_S_UNION_P (type)
+      || PKL_AST_TYPE_S_PINNED_P (type)
+      || PKL_AST_TYPE_S_ITYPE (type))
+    return;
+
+  for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+    {
+      pkl_ast_node size;
+
+      if (PKL_AST_CODE (t) != PKL_AST_STRUCT_TYPE_FIELD
+          || PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (t))
+        continue;
+
+      size = PKL_AST_STRUCT_TYPE_FIELD_SIZE (t);
+      if (PKL_AST_STRUCT_TYPE_FIELD_LABEL (t)
+          || !size || PKL_AST_CODE (size) != PKL_AST_INTEGER)
+        return;
+
+      PKL_AST_STRUCT_TYPE_FIELD_STATIC_OFFSET (t) = offset;
+      offset += PKL_AST_INTEGER_VALUE (size);
+    }
+
+  PKL_AST_TYPE_S_STATIC_LAYOUT_P (type) = 1;
+}
+
+/* Return whether the lazy arrays of elements of type TYPE can keep
+   the fields of their elements in columns.  This is the case of the
+   struct types with a static layout whose elements are all fields of
+   integral types, with no constraints, initializers, optional
+   conditions nor endianness attributes.  Note that struct types
+   having methods or other declarations are excluded too, since the
+   elements are built from the columns without running the mapper of
+   the struct.  See pvm_array_make_columnar.  */
+
+int
+pkl_ast_struct_type_columnar_p (pkl_ast_node type)
+{
+  pkl_ast_node t;
+
+  if (PKL_AST_TYPE_CODE (type) != PKL_TYPE_STRUCT
+      || !PKL_AST_TYPE_S_STATIC_LAYOUT_P (type)
+      || PKL_AST_TYPE_S_ELEMS (type) == NULL)
+    return 0;
+
+  for (t = PKL_AST_TYPE_S_ELEMS (type); t; t = PKL_AST_CHAIN (t))
+    {
+      pkl_ast_node ftype;
+
+      if (PKL_AST_CODE (t) != PKL_AST_STRUCT_TYPE_FIELD
+          || PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (t)
+          || PKL_AST_STRUCT_TYPE_FIELD_CONSTRAINT (t)
+          || PKL_AST_STRUCT_TYPE_FIELD_INITIALIZER (t)
+          || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND_PRE (t)
+          || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND_POST (t)
+          || PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (t) != PKL_AST_ENDIAN_DFL)
+        return 0;
+
+      ftype = PKL_AST_STRUCT_TYPE_FIELD_TYPE (t);
+      if (PKL_AST_TYPE_CODE (ftype) != PKL_TYPE_INTEGRAL)
+        return 0;
+    }
+
+  return 1;
+}
+
 
 /* Append the textual description of TYPE to BUFFER.  If TYPE is a
    named type then its given name is preferred if USE_GIVEN_NAME is
@@ -1873,6 +1974,8 @@ pkl_ast_make_decl (pkl_ast ast, int kind, pkl_ast_node name,
   PKL_AST_DECL_NAME (decl) = ASTREF (name);
   PKL_AST_DECL_INITIAL (decl) = ASTREF (initial);
   PKL_AST_DECL_IMMUTABLE_P (decl) = 0;
+  PKL_AST_DECL_FINGERPRINT (decl) = 0;
+  PKL_AST_DECL_REUSED_P (decl) = 0;
   if (source)
     PKL_AST_DECL_SOURCE (decl) = xstrdup (source);
 
@@ -3487,6 +3590,7 @@ pkl_ast_format_1 (struct string_buffer *buffer,
             case PKL_TYPE_STRUCT:
               PRINT_AST_IMM (pinned_p, TYPE_S_PINNED_P, "%d");
               PRINT_AST_IMM (union_p, TYPE_S_UNION_P, "%d");
+              PRINT_AST_IMM (static_layout_p, TYPE_S_STATIC_LAYOUT_P, "%d");
               PRINT_AST_IMM (nelem, TYPE_S_NELEM, "%zu");
               PRINT_AST_IMM (nfield, TYPE_S_NFIELD, "%zu");
               PRINT_AST_IMM (nfield, TYPE_S_NCFIELD, "%zu");
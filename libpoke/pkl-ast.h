@@ -308,12 +308,17 @@ pkl_ast_node pkl_ast_make_src (pkl_ast ast, const char *filename);
 
    LENGTH contains the size in bytes of the identifier
 
+   HASH is a hash of the identifier, computed once when the node is
+   created.  It is used by the compile-time environment.  See
+   pkl_ast_hash_string.
+
    BACK and OVER conform the lexical address to find the storage of
    the entity represented by the identifier.  See pkl-env.h for a
    description of these.  */
 
 #define PKL_AST_IDENTIFIER_LENGTH(AST) ((AST)->identifier.length)
 #define PKL_AST_IDENTIFIER_POINTER(AST) ((AST)->identifier.pointer)
+#define PKL_AST_IDENTIFIER_HASH(AST) ((AST)->identifier.hash)
 #define PKL_AST_IDENTIFIER_BACK(AST) ((AST)->identifier.back)
 #define PKL_AST_IDENTIFIER_OVER(AST) ((AST)->identifier.over)
 
@@ -322,6 +327,7 @@ struct pkl_ast_identifier
   struct pkl_ast_common common;
   size_t length;
   char *pointer;
+  uint32_t hash;
   int back;
   int over;
 };
@@ -329,6 +335,11 @@ struct pkl_ast_identifier
 pkl_ast_node pkl_ast_make_identifier (pkl_ast ast,
                                       const char *str);
 
+/* Return the hash of the NULL-terminated string STR, as stored in
+   identifier nodes.  */
+
+uint32_t pkl_ast_hash_string (const char *str);
+
 /* PKL_AST_INTEGER nodes represent integer constants in poke programs.
 
    VALUE contains a 64-bit unsigned integer.  This contains the
@@ -817,7 +828,11 @@ pkl_ast_node pkl_ast_make_struct_ref (pkl_ast ast,
    INITIALIZER is an expression, that will be used to derive an
    implicit constraint, and also as the initialization value for this
    field when constructing structs.  If no initializer is provided in
-   the struct field definition this is NULL.  */
+   the struct field definition this is NULL.
+
+   STATIC_OFFSET is the offset in bits of the field relative to the
+   beginning of the struct.  It is only meaningful if the struct type
+   containing the field has a static layout.  */
 
 #define PKL_AST_STRUCT_TYPE_FIELD_NAME(AST) ((AST)->sct_type_elem.name)
 #define PKL_AST_STRUCT_TYPE_FIELD_TYPE(AST) ((AST)->sct_type_elem.type)
@@ -833,6 +848,7 @@ pkl_ast_node pkl_ast_make_struct_ref (pkl_ast ast,
    || PKL_AST_STRUCT_TYPE_FIELD_OPTCOND_POST (AST))
 #define PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P(AST) ((AST)->sct_type_elem.computed_p)
 #define PKL_AST_STRUCT_TYPE_FIELD_INITIALIZER(AST) ((AST)->sct_type_elem.initializer)
+#define PKL_AST_STRUCT_TYPE_FIELD_STATIC_OFFSET(AST) ((AST)->sct_type_elem.static_offset)
 
 struct pkl_ast_struct_type_field
 {
@@ -849,6 +865,7 @@ struct pkl_ast_struct_type_field
   int endian;
   int computed_p;
   char *constraint_src;
+  uint64_t static_offset;
 };
 
 pkl_ast_node pkl_ast_make_struct_type_field (pkl_ast ast,
@@ -939,7 +956,10 @@ pkl_ast_node pkl_ast_make_func_type_arg (pkl_ast ast,
    CONSTRUCTOR, FORMATER, PRINTER, COMPARATOR, INTEGRATOR and
    DEINTEGRATOR are used to hold closures, or PVM_NULL.  ITYPE, if not
    NULL, is an AST node with an integral type, that defines the nature
-   of this struct type as integral.
+   of this struct type as integral.  STATIC_LAYOUT_P is 1 if the
+   offsets of the fields of the struct are known at compile-time, in
+   which case they are stored in the fields themselves.  See
+   pkl_ast_struct_type_layout.
 
    In offset types, BASE_TYPE is a PKL_AST_TYPE with the base type for
    the offset's magnitude, and UNIT is either a PKL_AST_IDENTIFIER
@@ -1004,6 +1024,7 @@ pkl_ast_node pkl_ast_make_func_type_arg (pkl_ast ast,
 #define PKL_AST_TYPE_S_DEINTEGRATOR(AST) (pkl_ast_type_resolv (AST)->type.val.sct.closures[5])
 #define PKL_AST_TYPE_S_TYPIFIER(AST) (pkl_ast_type_resolv (AST)->type.val.sct.closures[6])
 #define PKL_AST_TYPE_S_ITYPE(AST) (pkl_ast_type_resolv (AST)->type.val.sct.itype)
+#define PKL_AST_TYPE_S_STATIC_LAYOUT_P(AST) (pkl_ast_type_resolv (AST)->type.val.sct.static_layout_p)
 #define PKL_AST_TYPE_O_UNIT(AST) (pkl_ast_type_resolv (AST)->type.val.off.unit)
 #define PKL_AST_TYPE_O_BASE_TYPE(AST) (pkl_ast_type_resolv (AST)->type.val.off.base_type)
 #define PKL_AST_TYPE_O_REF_TYPE(AST) (pkl_ast_type_resolv (AST)->type.val.off.ref_type)
@@ -1066,6 +1087,7 @@ struct pkl_ast_type
       union pkl_ast_node *itype;
       int pinned_p;
       int union_p;
+      int static_layout_p;
       /* Uncollectable array for MAPPER, WRITER, CONSTRUCTOR,
          COMPARATOR, INTEGRATOR, DEINTEGRATOR, PRINTER, FORMATER, and
          TYPIFIER.  */
@@ -1137,6 +1159,8 @@ size_t pkl_ast_sizeof_integral_type (pkl_ast_node type);
 
 int pkl_ast_type_is_complete (pkl_ast_node type);
 int pkl_ast_type_is_fallible (pkl_ast_node type);
+void pkl_ast_struct_type_layout (pkl_ast_node type);
+int pkl_ast_struct_type_columnar_p (pkl_ast_node type);
 
 void pkl_print_type (FILE *out, pkl_ast_node type, int use_given_name);
 
@@ -1214,7 +1238,16 @@ pkl_ast_node pkl_ast_type_incr_step (pkl_ast ast, pkl_ast_node type,
    body of a struct type.
 
    IMMUTABLE_P indicates whether this declaration can be redefined.
-   Used when bootstrapping the compiler.  */
+   Used when bootstrapping the compiler.
+
+   FINGERPRINT is a hash of the source code of a top-level function
+   declaration and of the identities of the top-level declarations
+   it refers to.  It is 0 for other declarations.
+
+   REUSED_P indicates whether this declaration has the same
+   fingerprint than PREV_DECL, in which case its function is not
+   compiled again and the compiled code of PREV_DECL is used
+   instead.  */
 
 #define PKL_AST_DECL_KIND(AST) ((AST)->decl.kind)
 #define PKL_AST_DECL_NAME(AST) ((AST)->decl.name)
@@ -1227,6 +1260,8 @@ pkl_ast_node pkl_ast_type_incr_step (pkl_ast ast, pkl_ast_node type,
 #define PKL_AST_DECL_IMMUTABLE_P(AST) ((AST)->decl.immutable_p)
 #define PKL_AST_DECL_REDECL_CHAIN(AST) ((AST)->decl.redecl_chain)
 #define PKL_AST_DECL_TYPE_NAMES(AST) ((AST)->decl.type_names)
+#define PKL_AST_DECL_FINGERPRINT(AST) ((AST)->decl.fingerprint)
+#define PKL_AST_DECL_REUSED_P(AST) ((AST)->decl.reused_p)
 
 #define PKL_AST_DECL_KIND_ANY 0
 #define PKL_AST_DECL_KIND_VAR 1
@@ -1249,6 +1284,8 @@ struct pkl_ast_decl
   union pkl_ast_node *redecl_chain;
   union pkl_ast_node *type_names;
   int order;
+  uint64_t fingerprint;
+  int reused_p;
 };
 
 pkl_ast_node pkl_ast_make_decl (pkl_ast ast, int kind,
@@ -29,8 +29,16 @@
 #include "pkl-ast.h"
 #include "pkl-env.h"
 
-/* The declarations are organized in a hash table, chained in their
-   buckes through CHAIN2.
+/* The declarations are organized in hash tables, using open
+   addressing with linear probing.  Each entry contains a declaration
+   and the hash of the name under which it is registered, so probing
+   compares names only when their hashes are equal.
+
+   The tables are allocated lazily and grow by doubling their size,
+   so frames for local scopes, which usually contain a handful of
+   declarations, are cheap to create.  Top-level tables grow to
+   accomodate all the declarations in the standard library and the
+   loaded pickles.
 
    There are two namespaces in Poke:
 
@@ -44,11 +52,32 @@
    be able to rollback them.  See env_redecls_free function.
 
    UP is a link to the immediately enclosing frame.  This is NULL for
-   the top-level frame.  */
+   the top-level frame.
+
+   FINGERPRINT_DECL is the top-level declaration being fingerprinted,
+   or NULL.  Top-level declarations looked up while it is set are
+   mixed into FINGERPRINT.  These are only used in top-level
+   frames.  See pkl_env_start_fingerprint.  */
 
-#define HASH_TABLE_SIZE 1008
-typedef pkl_ast_node pkl_hash[HASH_TABLE_SIZE];
+#define HASH_TABLE_MIN_SIZE 8
 
+struct pkl_hash_entry
+{
+  uint32_t hash;
+  pkl_ast_node decl;
+};
+
+/* SIZE is the number of entries in ENTRIES, which is always a power
+   of two, or zero if ENTRIES is not allocated yet.  COUNT is the
+   number of used entries.  The table is grown before COUNT exceeds
+   half its size.  */
+
+typedef struct
+{
+  size_t size;
+  size_t count;
+  struct pkl_hash_entry *entries;
+} pkl_hash;
 
 struct pkl_env
 {
@@ -60,69 +89,132 @@ struct pkl_env
   int num_vars;
   int num_units;
 
+  pkl_ast_node fingerprint_decl;
+  uint64_t fingerprint;
+
   struct pkl_env *up;
 };
 
 /* The hash tables above are handled using the following
    functions.  */
-#ifdef __clang__
-__attribute__ ((no_sanitize ("integer")))
-#endif
-static int
-hash_string (const char *name)
-{
-  size_t len;
-  int hash;
-  int i;
-
-  len = strlen (name);
-  hash = len;
-  for (i = 0; i < len; i++)
-    hash = ((hash * (size_t)613) + (unsigned)(name[i]));
 
-#define HASHBITS 30
-  hash &= (1 << HASHBITS) - 1;
-  hash %= HASH_TABLE_SIZE;
-#undef HASHBITS
+static void
+free_hash_table (pkl_hash *hash_table)
+{
+  size_t i;
 
-  return hash;
+  for (i = 0; i < hash_table->size; ++i)
+    if (hash_table->entries[i].decl)
+      pkl_ast_node_free (hash_table->entries[i].decl);
+  free (hash_table->entries);
 }
 
-static void
-free_hash_table (pkl_hash hash_table)
+/* Return the entry for NAME, whose hash is HASH, in HASH_TABLE.  If
+   NAME is not registered in the table, return the unused entry where
+   it would be stored.  HASH_TABLE must be allocated.  */
+
+static struct pkl_hash_entry *
+find_entry (pkl_hash *hash_table, const char *name, uint32_t hash)
 {
+  size_t mask = hash_table->size - 1;
   size_t i;
-  pkl_ast_node t, n;
 
-  for (i = 0; i < HASH_TABLE_SIZE; ++i)
-    if (hash_table[i])
-      for (t = hash_table[i]; t; t = n)
-        {
-          n = PKL_AST_CHAIN2 (t);
-          pkl_ast_node_free (t);
-        }
+  for (i = hash & mask; ; i = (i + 1) & mask)
+    {
+      struct pkl_hash_entry *entry = &hash_table->entries[i];
+
+      if (entry->decl == NULL)
+        return entry;
+      if (entry->hash == hash
+          && STREQ (PKL_AST_IDENTIFIER_POINTER (PKL_AST_DECL_NAME (entry->decl)),
+                    name))
+        return entry;
+    }
 }
 
 static pkl_ast_node
-get_registered (pkl_hash hash_table, const char *name)
+get_registered (pkl_hash *hash_table, const char *name, uint32_t hash)
 {
-  pkl_ast_node t;
-  int hash;
-
-  if (STREQ (name, ""))
+  if (hash_table->size == 0 || STREQ (name, ""))
     return NULL;
 
-  hash = hash_string (name);
-  for (t = hash_table[hash]; t != NULL; t = PKL_AST_CHAIN2 (t))
+  return find_entry (hash_table, name, hash)->decl;
+}
+
+/* Make sure there is room in HASH_TABLE for a new entry.  Return 0 if
+   there is not enough memory.  */
+
+static int
+grow_hash_table (pkl_hash *hash_table)
+{
+  struct pkl_hash_entry *entries = hash_table->entries;
+  size_t i, size = hash_table->size;
+
+  if (2 * (hash_table->count + 1) <= size)
+    return 1;
+
+  hash_table->size = size ? 2 * size : HASH_TABLE_MIN_SIZE;
+  hash_table->entries = calloc (hash_table->size,
+                                sizeof (struct pkl_hash_entry));
+  if (!hash_table->entries)
     {
-      pkl_ast_node t_name = PKL_AST_DECL_NAME (t);
+      hash_table->size = size;
+      hash_table->entries = entries;
+      return 0;
+    }
+
+  /* Names are unique within a table, so the entries can be moved
+     without comparing them.  */
+  for (i = 0; i < size; ++i)
+    if (entries[i].decl)
+      {
+        size_t mask = hash_table->size - 1;
+        size_t j;
+
+        for (j = entries[i].hash & mask;
+             hash_table->entries[j].decl;
+             j = (j + 1) & mask)
+          ;
+        hash_table->entries[j] = entries[i];
+      }
+
+  free (entries);
+  return 1;
+}
+
+/* Copy the table FROM into TO, which is not allocated.  If CLONE_AST
+   is not NULL, store copies of the declarations allocated in it
+   rather than sharing them.  Return 0 if there is not enough
+   memory.  */
+
+static pkl_ast_node clone_decl (pkl_ast ast, pkl_ast_node decl);
+
+static int
+copy_hash_table (pkl_hash *from, pkl_hash *to, pkl_ast clone_ast)
+{
+  size_t i;
+
+  if (from->size == 0)
+    return 1;
+
+  to->entries = malloc (from->size * sizeof (struct pkl_hash_entry));
+  if (!to->entries)
+    return 0;
+  to->size = from->size;
+  to->count = from->count;
+
+  for (i = 0; i < from->size; ++i)
+    {
+      pkl_ast_node decl = from->entries[i].decl;
 
-      if (STREQ (PKL_AST_IDENTIFIER_POINTER (t_name),
-                 name))
-        return t;
+      if (decl && clone_ast)
+        decl = clone_decl (clone_ast, decl);
+
+      to->entries[i].hash = from->entries[i].hash;
+      to->entries[i].decl = decl ? ASTREF (decl) : NULL;
     }
 
-  return NULL;
+  return 1;
 }
 
 /* Rename the previous declaration of DECL from syntactically-invalid name
@@ -143,6 +235,10 @@ decl_rollback (pkl_ast_node decl)
   name = strchr (name, '$');
   assert (name != NULL);
   *name = '\0';
+  PKL_AST_IDENTIFIER_LENGTH (prev_decl_name)
+    = strlen (PKL_AST_IDENTIFIER_POINTER (prev_decl_name));
+  PKL_AST_IDENTIFIER_HASH (prev_decl_name)
+    = pkl_ast_hash_string (PKL_AST_IDENTIFIER_POINTER (prev_decl_name));
 
   prev_decl = ASTDEREF (prev_decl);
   PKL_AST_DECL_PREV_DECL (decl) = NULL;
@@ -172,11 +268,12 @@ env_redecls_free (pkl_env env, int rollback_p)
 static int
 register_decl (pkl_env env,
                pkl_ast ast,
-               pkl_hash hash_table,
+               pkl_hash *hash_table,
                const char *name,
                pkl_ast_node decl)
 {
-  int hash;
+  uint32_t hash = pkl_ast_hash_string (name);
+  struct pkl_hash_entry *entry;
   pkl_ast_node found_decl;
   int top_level_p = env->up == NULL;
 
@@ -193,10 +290,12 @@ register_decl (pkl_env env,
      We rename the previous declaration to <name>$<generation>.
      Because of '$' character, Poke user cannot refer to this
      declaration anymore.  The <generation> is a number in base 10.
+     DECL then replaces the previous declaration in the hash table,
+     which is kept alive through the PREV_DECL link of DECL.
 
      Otherwise we don't register DECL, as it is already defined.  */
 
-  found_decl = get_registered (hash_table, name);
+  found_decl = get_registered (hash_table, name, hash);
   if (found_decl != NULL)
     {
       if (top_level_p && !PKL_AST_DECL_IMMUTABLE_P (found_decl))
@@ -217,24 +316,37 @@ register_decl (pkl_env env,
               assert (generation != 0);
             }
 
+          /* Note that the entry has to be found before renaming
+             FOUND_DECL.  */
+          entry = find_entry (hash_table, name, hash);
+
           if (asprintf (&new_name, "%s$%d", name, generation + 1) == -1)
             return 0;
           pkl_ast_rename_decl (ast, found_decl, new_name);
+          free (new_name);
 
           PKL_AST_DECL_PREV_DECL (decl) = ASTREF (found_decl);
 
           /* Register DECL in re-defined declarations list.  */
           PKL_AST_DECL_REDECL_CHAIN (decl) = env->redecls;
           env->redecls = decl;
+
+          pkl_ast_node_free (entry->decl);
+          entry->decl = ASTREF (decl);
+          return 1;
         }
       else
         return 0;
     }
 
   /* Add the declaration to the hash table.  */
-  hash = hash_string (name);
-  PKL_AST_CHAIN2 (decl) = hash_table[hash];
-  hash_table[hash] = ASTREF (decl);
+  if (!grow_hash_table (hash_table))
+    return 0;
+
+  entry = find_entry (hash_table, name, hash);
+  entry->hash = hash;
+  entry->decl = ASTREF (decl);
+  hash_table->count++;
 
   return 1;
 }
@@ -274,8 +386,8 @@ pkl_env_free (pkl_env env)
     {
       pkl_env_free (env->up);
       env_redecls_free (env, /*rollback_p*/ 1);
-      free_hash_table (env->hash_table);
-      free_hash_table (env->units_hash_table);
+      free_hash_table (&env->hash_table);
+      free_hash_table (&env->units_hash_table);
       free (env);
     }
 }
@@ -312,7 +424,7 @@ pkl_env_register (pkl_env env,
 {
   pkl_hash *table = get_ns_table (env, namespace);
 
-  if (register_decl (env, ast, *table, name, decl))
+  if (register_decl (env, ast, table, name, decl))
     {
       switch (PKL_AST_DECL_KIND (decl))
         {
@@ -335,19 +447,52 @@ pkl_env_register (pkl_env env,
   return 0;
 }
 
+/* Hash functions used for fingerprints.  This is FNV-1a, operating
+   on 64-bit words.  */
+
+#define FINGERPRINT_BASIS 14695981039346656037ULL
+#define FINGERPRINT_PRIME 1099511628211ULL
+
+static uint64_t
+fingerprint_mix (uint64_t fingerprint, uint64_t word)
+{
+  return (fingerprint ^ word) * FINGERPRINT_PRIME;
+}
+
+/* Return a number identifying the entity declared by DECL.  A
+   declaration reusing the compiled code of a previous declaration
+   declares the same entity.  */
+
+static uint64_t
+decl_identity (pkl_ast_node decl)
+{
+  while (PKL_AST_DECL_REUSED_P (decl))
+    decl = PKL_AST_DECL_PREV_DECL (decl);
+  return (uint64_t) (uintptr_t) decl;
+}
+
 static pkl_ast_node
 pkl_env_lookup_1 (pkl_env env, int namespace, const char *name,
-                  int *back, int *over, int num_frame)
+                  uint32_t hash, int *back, int *over, int num_frame)
 {
-  if (env == NULL)
-    return NULL;
-  else
+  for (; env != NULL; env = env->up, num_frame++)
     {
       pkl_hash *table = get_ns_table (env, namespace);
-      pkl_ast_node decl = get_registered (*table, name);
+      pkl_ast_node decl = get_registered (table, name, hash);
 
       if (decl)
         {
+          if (env->up == NULL && env->fingerprint_decl)
+            {
+              /* References to the declaration being fingerprinted,
+                 i.e. recursive calls, don't depend on its
+                 identity.  */
+              uint64_t id = (decl == env->fingerprint_decl
+                             ? 0 : decl_identity (decl));
+
+              env->fingerprint = fingerprint_mix (env->fingerprint, id);
+            }
+
           if (back)
             *back = num_frame;
           if (over)
@@ -356,15 +501,24 @@ pkl_env_lookup_1 (pkl_env env, int namespace, const char *name,
         }
     }
 
-  return pkl_env_lookup_1 (env->up, namespace, name, back, over,
-                           num_frame + 1);
+  return NULL;
 }
 
 pkl_ast_node
 pkl_env_lookup (pkl_env env, int namespace, const char *name,
                 int *back, int *over)
 {
-  return pkl_env_lookup_1 (env, namespace, name, back, over, 0);
+  return pkl_env_lookup_1 (env, namespace, name,
+                           pkl_ast_hash_string (name), back, over, 0);
+}
+
+pkl_ast_node
+pkl_env_lookup_id (pkl_env env, int namespace, pkl_ast_node id,
+                   int *back, int *over)
+{
+  assert (PKL_AST_CODE (id) == PKL_AST_IDENTIFIER);
+  return pkl_env_lookup_1 (env, namespace, PKL_AST_IDENTIFIER_POINTER (id),
+                           PKL_AST_IDENTIFIER_HASH (id), back, over, 0);
 }
 
 pkl_ast_node
@@ -402,52 +556,60 @@ pkl_env_toplevel_p (pkl_env env)
   return env->up == NULL;
 }
 
-/* Return non-zero value if DECL has already been re-defined, otherwise return
-   zero.  */
+void
+pkl_env_start_fingerprint (pkl_env env, pkl_ast_node decl)
+{
+  while (env->up)
+    env = env->up;
 
-static int
-decl_redefined_p (pkl_ast_node decl)
+  env->fingerprint_decl = decl;
+  env->fingerprint = FINGERPRINT_BASIS;
+}
+
+uint64_t
+pkl_env_end_fingerprint (pkl_env env, uint64_t text_hash)
 {
-  pkl_ast_node name = PKL_AST_DECL_NAME (decl);
+  uint64_t fingerprint;
 
-  return strchr (PKL_AST_IDENTIFIER_POINTER (name), '$') != NULL;
+  while (env->up)
+    env = env->up;
+
+  fingerprint = fingerprint_mix (env->fingerprint, text_hash);
+  env->fingerprint_decl = NULL;
+  env->fingerprint = 0;
+
+  /* 0 means no fingerprint.  */
+  return fingerprint ? fingerprint : 1;
 }
 
+/* Note that re-defined declarations are not in the hash tables, so
+   the iterators don't need to skip them.  */
+
 void
 pkl_env_iter_begin (pkl_env env, struct pkl_ast_node_iter *iter)
 {
-  iter->bucket = 0;
-  iter->node = env->hash_table[iter->bucket];
-  /* Note that we skip re-defined declarations.  */
-  while (iter->node == NULL || decl_redefined_p (iter->node))
-    {
-      iter->bucket++;
-      if (iter->bucket >= HASH_TABLE_SIZE)
-        break;
-      iter->node = env->hash_table[iter->bucket];
-    }
+  iter->bucket = -1;
+  iter->node = NULL;
+  pkl_env_iter_next (env, iter);
 }
 
 void
 pkl_env_iter_next (pkl_env env, struct pkl_ast_node_iter *iter)
 {
-  assert (iter->node != NULL);
-
-  iter->node = PKL_AST_CHAIN2 (iter->node);
-  /* Note that we skip re-defined declarations.  */
-  while (iter->node == NULL || decl_redefined_p (iter->node))
-    {
-      iter->bucket++;
-      if (iter->bucket >= HASH_TABLE_SIZE)
-        break;
-      iter->node = env->hash_table[iter->bucket];
-    }
+  do
+    iter->bucket++;
+  while ((size_t) iter->bucket < env->hash_table.size
+         && env->hash_table.entries[iter->bucket].decl == NULL);
+
+  iter->node = ((size_t) iter->bucket < env->hash_table.size
+                ? env->hash_table.entries[iter->bucket].decl
+                : NULL);
 }
 
 bool
 pkl_env_iter_end (pkl_env env, const struct pkl_ast_node_iter *iter)
 {
-  return iter->bucket >= HASH_TABLE_SIZE;
+  return (size_t) iter->bucket >= env->hash_table.size;
 }
 
 void
@@ -470,7 +632,6 @@ pkl_env
 pkl_env_dup_toplevel (pkl_env env)
 {
   pkl_env new;
-  int i;
 
   assert (pkl_env_toplevel_p (env));
 
@@ -478,25 +639,70 @@ pkl_env_dup_toplevel (pkl_env env)
   if (!new)
     return NULL;
 
-  for (i = 0; i < HASH_TABLE_SIZE; ++i)
+  if (!copy_hash_table (&env->hash_table, &new->hash_table, NULL)
+      || !copy_hash_table (&env->units_hash_table, &new->units_hash_table,
+                           NULL))
     {
-      pkl_ast_node t;
-      pkl_ast_node decl = env->hash_table[i];
-
-      for (t = decl; t; t = PKL_AST_CHAIN2 (t))
-        t = ASTREF (t);
-      new->hash_table[i] = decl;
+      pkl_env_free (new);
+      return NULL;
     }
 
-  for (i = 0; i < HASH_TABLE_SIZE; ++i)
-    {
-      pkl_ast_node t;
-      pkl_ast_node decl = env->units_hash_table[i];
+  new->num_types = env->num_types;
+  new->num_vars = env->num_vars;
+  new->num_units = env->num_units;
+
+  return new;
+}
 
-      for (t = decl; t; t = PKL_AST_CHAIN2 (t))
-        t = ASTREF (t);
-      new->units_hash_table[i] = decl;
+/* Return a copy of the declaration DECL, allocated in AST.  */
+
+static pkl_ast_node
+clone_decl (pkl_ast ast, pkl_ast_node decl)
+{
+  pkl_ast_node name = PKL_AST_DECL_NAME (decl);
+  pkl_ast_node new
+    = pkl_ast_make_decl (ast, PKL_AST_DECL_KIND (decl),
+                         pkl_ast_make_identifier (ast,
+                                                  PKL_AST_IDENTIFIER_POINTER (name)),
+                         PKL_AST_DECL_INITIAL (decl),
+                         PKL_AST_DECL_SOURCE (decl));
+
+  PKL_AST_LOC (new) = PKL_AST_LOC (decl);
+  PKL_AST_DECL_STRUCT_FIELD_P (new) = PKL_AST_DECL_STRUCT_FIELD_P (decl);
+  PKL_AST_DECL_IN_STRUCT_P (new) = PKL_AST_DECL_IN_STRUCT_P (decl);
+  PKL_AST_DECL_IMMUTABLE_P (new) = PKL_AST_DECL_IMMUTABLE_P (decl);
+  PKL_AST_DECL_ORDER (new) = PKL_AST_DECL_ORDER (decl);
+  PKL_AST_DECL_PREV_DECL (new) = ASTREF (PKL_AST_DECL_PREV_DECL (decl));
+  PKL_AST_DECL_FINGERPRINT (new) = PKL_AST_DECL_FINGERPRINT (decl);
+  PKL_AST_DECL_REUSED_P (new) = PKL_AST_DECL_REUSED_P (decl);
+
+  /* Note that the type names linked to the declaration are not
+     copied, since they are part of the shared entities.  */
+  return new;
+}
+
+pkl_env
+pkl_env_clone_toplevel (pkl_env env)
+{
+  pkl_env new;
+  pkl_ast ast;
+
+  assert (pkl_env_toplevel_p (env));
+
+  new = pkl_env_new ();
+  if (!new)
+    return NULL;
+
+  ast = pkl_ast_init ();
+  if (!copy_hash_table (&env->hash_table, &new->hash_table, ast)
+      || !copy_hash_table (&env->units_hash_table, &new->units_hash_table,
+                           ast))
+    {
+      pkl_ast_free (ast);
+      pkl_env_free (new);
+      return NULL;
     }
+  pkl_ast_free (ast);
 
   new->num_types = env->num_types;
   new->num_vars = env->num_vars;
@@ -107,6 +107,37 @@ int pkl_env_toplevel_p (pkl_env env);
 
 pkl_env pkl_env_dup_toplevel (pkl_env env);
 
+/* Return a copy of ENV that is independent of it.  Unlike with
+   pkl_env_dup_toplevel, declarations registered in ENV are also
+   copied, so re-defining them in the copy doesn't alter ENV.  The
+   entities declared by them are shared.  Note this only works for
+   top-level environments.  Return NULL in case of memory
+   exhaustion.  */
+
+pkl_env pkl_env_clone_toplevel (pkl_env env);
+
+/* Fingerprinting of top-level declarations.
+
+   The fingerprint of a top-level declaration summarizes its source
+   code and the top-level declarations it refers to.  If a top-level
+   function is re-defined with the same fingerprint, the code compiled
+   for the previous definition is reused.
+
+   pkl_env_start_fingerprint starts recording the top-level
+   declarations looked up in ENV, on behalf of the declaration DECL.
+   Lookups of DECL itself are not recorded.
+
+   pkl_env_end_fingerprint stops recording and returns the
+   fingerprint resulting of combining the recorded declarations with
+   TEXT_HASH, which is a hash of the source code of the declaration.
+   The returned fingerprint is never 0.
+
+   ENV can be any frame; the recording is done in its top-level
+   frame.  */
+
+void pkl_env_start_fingerprint (pkl_env env, pkl_ast_node decl);
+uint64_t pkl_env_end_fingerprint (pkl_env env, uint64_t text_hash);
+
 /* Declarations in Poke live in two different, separated name spaces:
 
    The `main' namespace, shared by types, variables and functions.
@@ -129,6 +160,13 @@ pkl_ast_node pkl_env_lookup (pkl_env env, int namespace,
                              const char *name,
                              int *back, int *over);
 
+/* Like pkl_env_lookup, but look for a declaration with the name of
+   the identifier node ID, using the hash precomputed in it.  */
+
+pkl_ast_node pkl_env_lookup_id (pkl_env env, int namespace,
+                                pkl_ast_node id,
+                                int *back, int *over);
+
 /* Search in the environment ENV for a type declared with the given
    NAME.  Return the AST node for the type, or NULL if such a type is
    not found.  */
@@ -145,7 +183,7 @@ pkl_ast_node pkl_env_lookup_var (pkl_env env, const char *name);
 
 struct pkl_ast_node_iter
 {
-  int bucket;        /* The bucket in which this node resides.  */
+  int bucket;        /* The table entry in which this node resides.  */
   pkl_ast_node node; /* A pointer to the node itself.  */
 };
 
@@ -1324,6 +1324,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_fold =
   {
+    PKL_PHASE_NAME ("fold"),
     PKL_PHASE_PS_HANDLER (PKL_AST_SRC, pkl_fold_ps_src),
     PKL_PHASE_PS_HANDLER (PKL_AST_CAST, pkl_fold_ps_cast),
     PKL_PHASE_PS_HANDLER (PKL_AST_INDEXER, pkl_fold_ps_indexer),
@@ -70,6 +70,11 @@
    MAPPER_DEPTH and CONSTRUCTOR_DEPTH are used in the array mapper and
    constructor generation handlers.
 
+   STREAM_MAP is the map expression used as the container of the
+   for-in loop being compiled, if its elements can be streamed.
+   STREAM_P is set while the array mapper of that map is being
+   called.  See pkl_gen_pr_loop_stmt.
+
    IN_FILE_P indicates whether the current source is a file, as
    opposed to stdin (i.e. as opposed of compiling a statement.)
 
@@ -88,6 +93,8 @@ struct pkl_gen_payload
   pvm_program program;
   int constructor_depth;
   int mapper_depth;
+  pkl_ast_node stream_map;
+  int stream_p;
   int in_file_p;
   char *filename;
   pkl_env env;
@@ -237,6 +244,270 @@ pkl_gen_finalize (void *payload)
     PKL_AST_INTEGER_VALUE (initial);                                    \
   })
 
+/* The following functions are used in the `struct_typifier' RAS
+   function in pkl-gen.pkc, to compute the bytes that any value of a
+   given struct type has at its beginning.  These are used to quickly
+   locate candidate positions when searching for values of the type
+   in IO space.  */
+
+#define PKL_GEN_MAX_MAGIC 32
+
+/* If EXP is a variable referring to the struct field NAME, possibly
+   promoted to an integral type of at least SIZE bits, return 1.
+   Return 0 otherwise.  */
+
+static int
+pkl_gen_magic_field_var_p (pkl_ast_node exp, pkl_ast_node name,
+                           size_t size)
+{
+  if (PKL_AST_CODE (exp) == PKL_AST_CAST)
+    {
+      pkl_ast_node cast_type = PKL_AST_CAST_TYPE (exp);
+
+      if (PKL_AST_TYPE_CODE (cast_type) != PKL_TYPE_INTEGRAL
+          || PKL_AST_TYPE_I_SIZE (cast_type) <= size)
+        return 0;
+      exp = PKL_AST_CAST_EXP (exp);
+    }
+
+  return (PKL_AST_CODE (exp) == PKL_AST_VAR
+          && STREQ (PKL_AST_IDENTIFIER_POINTER (PKL_AST_VAR_NAME (exp)),
+                    PKL_AST_IDENTIFIER_POINTER (name)));
+}
+
+/* If the constraint of the struct field FIELD is of the form `FIELD
+   == EXP', return EXP.  Return NULL otherwise.  */
+
+static pkl_ast_node
+pkl_gen_magic_field_value (pkl_ast_node field, size_t size)
+{
+  pkl_ast_node constraint = PKL_AST_STRUCT_TYPE_FIELD_CONSTRAINT (field);
+  pkl_ast_node name = PKL_AST_STRUCT_TYPE_FIELD_NAME (field);
+  pkl_ast_node op1, op2;
+
+  if (!constraint || !name
+      || PKL_AST_CODE (constraint) != PKL_AST_EXP
+      || PKL_AST_EXP_CODE (constraint) != PKL_AST_OP_EQ)
+    return NULL;
+
+  op1 = PKL_AST_EXP_OPERAND (constraint, 0);
+  op2 = PKL_AST_EXP_OPERAND (constraint, 1);
+
+  if (pkl_gen_magic_field_var_p (op1, name, size))
+    return op2;
+  if (pkl_gen_magic_field_var_p (op2, name, size))
+    return op1;
+  return NULL;
+}
+
+/* If the integer literal INTEGER denotes a value representable in
+   the integral type TYPE, store its bits in *BITS and return 1.
+   Return 0 otherwise.  */
+
+static int
+pkl_gen_magic_integer (pkl_ast_node integer, pkl_ast_node type,
+                       uint64_t *bits)
+{
+  pkl_ast_node itype = PKL_AST_TYPE (integer);
+  int isize = PKL_AST_TYPE_I_SIZE (itype);
+  int size = PKL_AST_TYPE_I_SIZE (type);
+  uint64_t value = PKL_AST_INTEGER_VALUE (integer);
+  int negative_p = 0;
+
+  if (PKL_AST_TYPE_I_SIGNED_P (itype) && isize < 64)
+    value = (uint64_t) (((int64_t) (value << (64 - isize))) >> (64 - isize));
+  negative_p = PKL_AST_TYPE_I_SIGNED_P (itype) && (int64_t) value < 0;
+
+  if (size < 64)
+    {
+      if (PKL_AST_TYPE_I_SIGNED_P (type))
+        {
+          int64_t min = -((int64_t) 1 << (size - 1));
+          int64_t max = ((int64_t) 1 << (size - 1)) - 1;
+
+          if (!negative_p && value > (uint64_t) max)
+            return 0;
+          if (negative_p && (int64_t) value < min)
+            return 0;
+        }
+      else if (negative_p || value >= ((uint64_t) 1 << size))
+        return 0;
+
+      value &= ((uint64_t) 1 << size) - 1;
+    }
+  else if (negative_p != (PKL_AST_TYPE_I_SIGNED_P (type)
+                          && (int64_t) value < 0))
+    return 0;
+
+  *bits = value;
+  return 1;
+}
+
+/* Compute the bytes that any value of the struct type TYPE has at
+   its beginning, both for big and little endian, in MSB and LSB.
+   The bits in MASK tell which bits in these bytes are constant.
+   Return the number of computed bytes, which is at most
+   PKL_GEN_MAX_MAGIC.  */
+
+static size_t
+pkl_gen_struct_magic (pkl_ast_node type, uint8_t *msb, uint8_t *lsb,
+                      uint8_t *mask)
+{
+  pkl_ast_node field;
+  size_t len = 0;
+
+  if (PKL_AST_TYPE_S_UNION_P (type)
+      || PKL_AST_TYPE_S_PINNED_P (type)
+      || PKL_AST_TYPE_S_ITYPE (type))
+    return 0;
+
+  for (field = PKL_AST_TYPE_S_ELEMS (type);
+       field;
+       field = PKL_AST_CHAIN (field))
+    {
+      pkl_ast_node field_type, value;
+      int field_endian;
+
+      if (PKL_AST_CODE (field) != PKL_AST_STRUCT_TYPE_FIELD)
+        continue;
+      if (PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (field))
+        continue;
+
+      if (PKL_AST_STRUCT_TYPE_FIELD_LABEL (field)
+          || PKL_AST_STRUCT_TYPE_FIELD_OPTIONAL_P (field))
+        break;
+
+      field_type = PKL_AST_STRUCT_TYPE_FIELD_TYPE (field);
+      field_endian = PKL_AST_STRUCT_TYPE_FIELD_ENDIAN (field);
+
+      if (PKL_AST_TYPE_CODE (field_type) == PKL_TYPE_INTEGRAL
+          && !PKL_AST_TYPE_I_DYN_P (field_type))
+        {
+          size_t size = PKL_AST_TYPE_I_SIZE (field_type);
+          size_t nbytes = size / 8;
+          uint64_t bits;
+          int const_p;
+
+          if (size % 8 != 0 || len + nbytes > PKL_GEN_MAX_MAGIC)
+            break;
+
+          value = pkl_gen_magic_field_value (field, size);
+          const_p = (value
+                     && PKL_AST_CODE (value) == PKL_AST_INTEGER
+                     && pkl_gen_magic_integer (value, field_type, &bits));
+
+          for (size_t i = 0; i < nbytes; ++i)
+            {
+              uint8_t byte_msb = 0, byte_lsb = 0;
+
+              if (const_p)
+                {
+                  byte_msb = bits >> (8 * (nbytes - i - 1));
+                  byte_lsb = bits >> (8 * i);
+                }
+
+              msb[len + i] = (field_endian == PKL_AST_ENDIAN_LSB
+                              ? byte_lsb : byte_msb);
+              lsb[len + i] = (field_endian == PKL_AST_ENDIAN_MSB
+                              ? byte_msb : byte_lsb);
+              mask[len + i] = const_p ? 0xff : 0;
+            }
+
+          len += nbytes;
+        }
+      else if (PKL_AST_TYPE_CODE (field_type) == PKL_TYPE_ARRAY)
+        {
+          pkl_ast_node etype = PKL_AST_TYPE_A_ETYPE (field_type);
+          pkl_ast_node initializer;
+          size_t i = 0;
+
+          /* Only arrays of bytes constrained to be equal to an array
+             literal are supported.  */
+          if (PKL_AST_TYPE_CODE (etype) != PKL_TYPE_INTEGRAL
+              || PKL_AST_TYPE_I_SIZE (etype) != 8
+              || PKL_AST_TYPE_I_DYN_P (etype))
+            break;
+
+          value = pkl_gen_magic_field_value (field, 8);
+          if (!value
+              || PKL_AST_CODE (value) != PKL_AST_ARRAY
+              || PKL_AST_ARRAY_NELEM (value) != PKL_AST_ARRAY_NINITIALIZER (value)
+              || len + PKL_AST_ARRAY_NELEM (value) > PKL_GEN_MAX_MAGIC)
+            break;
+
+          for (initializer = PKL_AST_ARRAY_INITIALIZERS (value);
+               initializer;
+               initializer = PKL_AST_CHAIN (initializer), ++i)
+            {
+              pkl_ast_node elem = PKL_AST_ARRAY_INITIALIZER_EXP (initializer);
+              pkl_ast_node index = PKL_AST_ARRAY_INITIALIZER_INDEX (initializer);
+              uint64_t bits;
+
+              if (!index
+                  || PKL_AST_CODE (index) != PKL_AST_INTEGER
+                  || PKL_AST_INTEGER_VALUE (index) != i
+                  || PKL_AST_CODE (elem) != PKL_AST_INTEGER
+                  || !pkl_gen_magic_integer (elem, etype, &bits))
+                goto done;
+
+              msb[len + i] = lsb[len + i] = bits;
+              mask[len + i] = 0xff;
+            }
+
+          len += i;
+        }
+      else
+        break;
+    }
+
+ done:
+  /* Trailing bytes that are not constant are useless.  */
+  while (len > 0 && mask[len - 1] == 0)
+    len--;
+
+  return len;
+}
+
+/* Return the amount of bits to shift the integral value of an
+   integral struct of type ITYPE in order to get to the value of its
+   field of type FIELD_TYPE, as an uint<32>.  *BOFFSET is the
+   bit-offset of the field relative to the beginning of the struct,
+   and it is updated to the offset of the next field, unless UNION_P
+   is set, since all the alternatives of an integral union are
+   located at the beginning.
+
+   The fields of integral structs can't be optional and don't have
+   labels, so their position in the integral value doesn't depend on
+   the data.  */
+
+static pvm_val
+pkl_gen_ifield_shift (pkl_ast_node itype, pkl_ast_node field_type,
+                      uint64_t *boffset, int union_p)
+{
+  uint64_t ivalw = PKL_AST_TYPE_I_SIZE (itype);
+  uint64_t fieldw;
+
+  switch (PKL_AST_TYPE_CODE (field_type))
+    {
+    case PKL_TYPE_OFFSET:
+      fieldw = PKL_AST_TYPE_I_SIZE (PKL_AST_TYPE_O_BASE_TYPE (field_type));
+      break;
+    case PKL_TYPE_STRUCT:
+      fieldw = PKL_AST_TYPE_I_SIZE (PKL_AST_TYPE_S_ITYPE (field_type));
+      break;
+    default:
+      fieldw = PKL_AST_TYPE_I_SIZE (field_type);
+      break;
+    }
+
+  assert (*boffset + fieldw <= ivalw);
+  if (union_p)
+    return pvm_make_uint (ivalw - fieldw, 32);
+
+  *boffset += fieldw;
+  return pvm_make_uint (ivalw - *boffset, 32);
+}
+
 #include "pkl-gen.pkc"
 #include "pkl-gen-attrs.pkc"
 
@@ -295,6 +566,27 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_program)
 }
 PKL_PHASE_END_HANDLER
 
+/* Return a copy of the closure CLS, which is of the given KIND,
+   named after the type named TYPE_NAME.  For example, the mapper of a
+   struct type Foo is named "struct_mapper:Foo".  This allows to tell
+   apart the closures of different types in profiles.
+
+   CLS shall not have been completed with an environment yet.  */
+
+static pvm_val
+pkl_gen_name_type_closure (pvm_val cls, const char *kind,
+                           pkl_ast_node type_name)
+{
+  char *name = pk_str_concat (kind, ":",
+                              PKL_AST_IDENTIFIER_POINTER (type_name),
+                              NULL);
+  pvm_val named_cls = pvm_make_cls (pvm_val_cls_program (cls),
+                                    pvm_make_string (name));
+
+  free (name);
+  return named_cls;
+}
+
 /*
  * DECL
  * | INITIAL
@@ -358,6 +650,11 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_decl)
                     RAS_FUNCTION_STRUCT_WRITER (writer_closure, type_struct);
                 }
                 PKL_GEN_POP_CONTEXT;
+                writer_closure
+                  = pkl_gen_name_type_closure (writer_closure,
+                                               PKL_AST_TYPE_S_UNION_P (type_struct)
+                                               ? "union_writer" : "struct_writer",
+                                               type_name);
                 PKL_AST_TYPE_S_WRITER (type_struct) = writer_closure;
               }
 
@@ -379,6 +676,10 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_decl)
                 RAS_FUNCTION_STRUCT_CONSTRUCTOR (constructor_closure,
                                                  type_struct, type_name);
                 PKL_GEN_POP_CONTEXT;
+                constructor_closure
+                  = pkl_gen_name_type_closure (constructor_closure,
+                                               "struct_constructor",
+                                               type_name);
                 PKL_AST_TYPE_S_CONSTRUCTOR (type_struct) = constructor_closure;
               }
             pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH,
@@ -394,6 +695,9 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_decl)
                 PKL_GEN_PUSH_SET_CONTEXT (PKL_GEN_CTX_IN_MAPPER);
                 RAS_FUNCTION_STRUCT_MAPPER (mapper_closure, type_struct, type_name);
                 PKL_GEN_POP_CONTEXT;
+                mapper_closure
+                  = pkl_gen_name_type_closure (mapper_closure,
+                                               "struct_mapper", type_name);
                 PKL_AST_TYPE_S_MAPPER (type_struct) = mapper_closure;
               }
 
@@ -613,7 +917,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_decl)
             program = pkl_asm_finish (PKL_GEN_ASM,
                                       0 /* epilogue */);
             PKL_GEN_POP_ASM;
-            pvm_program_make_executable (program);
+            pkl_program_make_executable (PKL_PASS_COMPILER, program);
 
             /* XXX */
             //            pvm_disassemble_program (program);
@@ -823,7 +1127,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_lambda)
   pvm_val closure;
 
   PKL_GEN_POP_ASM;
-  pvm_program_make_executable (program);
+  pkl_program_make_executable (PKL_PASS_COMPILER, program);
   closure = pvm_make_cls (program, PVM_NULL /* name */);
 
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, closure);
@@ -1569,6 +1873,43 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_ps_break_continue_stmt)
 }
 PKL_PHASE_END_HANDLER
 
+/* Return whether the elements of the array mapped by the expression
+   EXP can be streamed by a for-in loop.
+
+   This is the case of maps of arrays bounded by number of elements,
+   whose elements are not read in bulk and have a size known at
+   compile-time, since these arrays are always mapped lazily if
+   requested.  See the array_mapper in pkl-gen.pks.  */
+
+static int
+pkl_gen_streamable_map_p (pkl_compiler compiler, pkl_ast ast,
+                          pkl_ast_node exp)
+{
+  pkl_ast_node type, bound, etype, esize;
+
+  if (PKL_AST_CODE (exp) != PKL_AST_MAP)
+    return 0;
+
+  type = PKL_AST_MAP_TYPE (exp);
+  if (PKL_AST_TYPE_CODE (type) != PKL_TYPE_ARRAY)
+    return 0;
+
+  bound = PKL_AST_TYPE_A_BOUND (type);
+  if (!bound
+      || PKL_AST_TYPE_CODE (PKL_AST_TYPE (bound)) != PKL_TYPE_INTEGRAL)
+    return 0;
+
+  etype = PKL_AST_TYPE_A_ETYPE (type);
+  if ((PKL_AST_TYPE_CODE (etype) == PKL_TYPE_INTEGRAL
+       && PKL_AST_TYPE_I_SIZE (etype) % 8 == 0)
+      || PKL_AST_TYPE_COMPLETE (etype) != PKL_AST_TYPE_COMPLETE_YES)
+    return 0;
+
+  esize = pkl_constant_fold (compiler, ast, pkl_ast_sizeof_type (ast, etype));
+  return (PKL_AST_CODE (esize) == PKL_AST_INTEGER
+          && PKL_AST_INTEGER_VALUE (esize) > 0);
+}
+
 /*
  * LOOP_STMT
  * | PARAMS
@@ -1667,7 +2008,15 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_loop_stmt)
                         PKL_AST_TYPE_CODE (container_type),
                         condition);
         {
+          /* Iterating on a map of an array means mapping every
+             element of the array once.  If the array can be mapped
+             lazily then its elements are mapped one at a time while
+             iterating, and they are not kept in the array.  */
+          if (pkl_gen_streamable_map_p (PKL_PASS_COMPILER, PKL_PASS_AST,
+                                        container))
+            PKL_GEN_PAYLOAD->stream_map = container;
           PKL_PASS_SUBPASS (container);
+          PKL_GEN_PAYLOAD->stream_map = NULL;
         }
         pkl_asm_for_in_where (PKL_GEN_ASM);
         {
@@ -2333,11 +2682,22 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_funcall)
       pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, PVM_NULL);
   }
 
-  /* Push the closure for FUNCTION and call the bloody function.  */
+  /* Push the closure for FUNCTION and call the bloody function.  If
+     the funcall is the expression of a return statement then the
+     function is called from tail position, unless the exception
+     handlers installed by the current function must remain active
+     while the callee executes.  The instructions generated for the
+     return statement after a tail call are unreachable, and
+     discarded by the assembler.  */
   PKL_GEN_PUSH_SET_CONTEXT (PKL_GEN_CTX_IN_FUNCALL);
   PKL_PASS_SUBPASS (PKL_AST_FUNCALL_FUNCTION (funcall));
   PKL_GEN_POP_CONTEXT;
-  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_CALL);
+  if (PKL_PASS_PARENT
+      && PKL_AST_CODE (PKL_PASS_PARENT) == PKL_AST_RETURN_STMT
+      && PKL_AST_RETURN_STMT_NPOPES (PKL_PASS_PARENT) == 0)
+    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_TCALL);
+  else
+    pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_CALL);
   PKL_PASS_BREAK;
 }
 PKL_PHASE_END_HANDLER
@@ -2361,6 +2721,9 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_func)
     pkl_asm_note (PKL_GEN_ASM,
                   PKL_AST_FUNC_NAME (function));
   pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PROLOG);
+  /* Attend to signals and account the execution budget, so unbounded
+     recursion can be interrupted.  */
+  pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SYNC);
 
   if (nargs > 1)
     {
@@ -2976,7 +3339,9 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_map)
         }
 
       PKL_GEN_PUSH_SET_CONTEXT (PKL_GEN_CTX_IN_MAPPER);
+      PKL_GEN_PAYLOAD->stream_p = (map == PKL_GEN_PAYLOAD->stream_map);
       PKL_PASS_SUBPASS (map_type);
+      PKL_GEN_PAYLOAD->stream_p = 0;
       PKL_GEN_POP_CONTEXT;
     }
 
@@ -3800,7 +4165,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_function)
       program = pkl_asm_finish (PKL_GEN_ASM, 0 /* epilogue */);
       PKL_GEN_POP_ASM;
 
-      pvm_program_make_executable (program);
+      pkl_program_make_executable (PKL_PASS_COMPILER, program);
 
       /* Discard constructor/mapper arguments.  */
       pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP);
@@ -3923,6 +4288,7 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_array)
 
       pvm_val array_type_mapper = PKL_AST_TYPE_A_MAPPER (array_type);
       pvm_val array_type_writer = PKL_AST_TYPE_A_WRITER (array_type);
+      int stream_p = 0;
 
       /* Make a copy of the IOS.  We will need to install it in the
          resulting value later.  */
@@ -3939,6 +4305,15 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_array)
 
       PKL_GEN_PAYLOAD->mapper_depth++;
 
+      /* Whether the array is to be streamed, see pkl_gen_pr_map.
+         This only applies to the array being mapped, not to the
+         arrays mapped while compiling its bounder and mapper.  */
+      if (PKL_GEN_PAYLOAD->mapper_depth == 1)
+        {
+          stream_p = PKL_GEN_PAYLOAD->stream_p;
+          PKL_GEN_PAYLOAD->stream_p = 0;
+        }
+
       if (PKL_GEN_PAYLOAD->mapper_depth == 1 && !PKL_AST_TYPE_NAMED_P (array_type))
         {
           /* Note that this only happens at the top-level of an
@@ -4001,6 +4376,11 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_array)
 
       pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_SWAP);
                                             /* ... CLS STRICT IOS OFF EBOUND SBOUND CLS */
+      /* The request to stream the array is made right before calling
+         the mapper, since evaluating the bounds may map other
+         arrays.  */
+      if (stream_p)
+        pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_LMAPSTRM);
       pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_CALL);  /* STRICT IOS CLS VAL */
 
       /* Install the mapper into the value.  */
@@ -4250,6 +4630,8 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
       pvm_val type_struct_mapper = PKL_AST_TYPE_S_MAPPER (type_struct);
       pvm_val type_struct_writer = PKL_AST_TYPE_S_WRITER (type_struct);
       pvm_val type_struct_constructor = PKL_AST_TYPE_S_CONSTRUCTOR (type_struct);
+      pvm_program_label cached_label = pkl_asm_fresh_label (PKL_GEN_ASM);
+      pvm_program_label done_label = pkl_asm_fresh_label (PKL_GEN_ASM);
 
       /* Make a copy of the IOS and STRICT.  We will need to install
          them in the resulting value later.  */
@@ -4264,6 +4646,20 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
       if (type_struct_mapper == PVM_NULL)
         RAS_FUNCTION_STRUCT_MAPPER (type_struct_mapper, type_struct,
                                     (pkl_ast_node) NULL /* type_name */);
+
+      /* The mapper of a named type is the same closure for every map,
+         so it identifies the type in the map cache of the IO space.
+         Use the cached value if there is one.  */
+      if (PKL_AST_TYPE_NAMED_P (type_struct))
+        {
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, type_struct_mapper);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MCGET);
+                                   /* STRICT IOS STRICT IOS OFF CLS VAL */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BNN, cached_label);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_DROP2);
+                                   /* STRICT IOS STRICT IOS OFF */
+        }
+
       pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PUSH, type_struct_mapper);
       if (!PKL_AST_TYPE_NAMED_P (type_struct))
         pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_PEC); /* ... STRICT IOS OFF CLS */
@@ -4341,6 +4737,18 @@ PKL_PHASE_BEGIN_HANDLER (pkl_gen_pr_type_struct)
       /* Install the writer into the value.  */
       pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MSETW);                /* VAL */
 
+      if (PKL_AST_TYPE_NAMED_P (type_struct))
+        {
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_MCPUT);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_BA, done_label);
+
+          pkl_asm_label (PKL_GEN_ASM, cached_label);
+                                   /* STRICT IOS STRICT IOS OFF CLS VAL */
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP3);
+          pkl_asm_insn (PKL_GEN_ASM, PKL_INSN_NIP3);  /* VAL */
+          pkl_asm_label (PKL_GEN_ASM, done_label);
+        }
+
       /* And we are done.  */
       PKL_PASS_BREAK;
     }
@@ -5519,6 +5927,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_gen =
   {
+    PKL_PHASE_NAME ("gen"),
     .initialize = pkl_gen_initialize,
     .finalize = pkl_gen_finalize,
 
@@ -0,0 +1,421 @@
+/* pkl-inline.c - Inlining phase for the poke compiler.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <string.h>
+
+#include "pk-utils.h"
+
+#include "pkl.h"
+#include "pkl-ast.h"
+#include "pkl-pass.h"
+
+/* This file implements a phase that replaces calls to small functions
+   by the expressions they return.
+
+   A function is inlined only if:
+
+   - It is declared `immutable', so it can neither be redefined nor
+     assigned to, and every call to it will always call the same
+     code.
+
+   - It is not a method, and it has neither optional arguments nor a
+     vararg.
+
+   - Its body consists on a single `return' statement, whose
+     expression only refers to the formal arguments of the function
+     and doesn't call functions.  Therefore inlined functions are
+     never recursive, and they do not capture their environment.
+
+   - The expression returned by the function has at most
+     PKL_INLINE_MAX_NODES nodes.
+
+   - The types of the arguments and of the returned value are
+     integral, offset or string types that do not depend on run-time
+     values.
+
+   The actual arguments in calls to inlined functions must be literals
+   or references to variables, so it doesn't matter how many times, or
+   in which order, they are evaluated in the inlined expression.
+
+   This phase shall run after the actual arguments in funcalls and the
+   expressions in return statements have been promoted, and before
+   transl assigns lexical addresses to variables.  */
+
+#define PKL_INLINE_MAX_NODES 16
+
+/* Return 1 if values of type TYPE can be passed to and returned from
+   inlined functions.  Return 0 otherwise.  */
+
+static int
+pkl_inline_type_p (pkl_ast_node type)
+{
+  if (!type)
+    return 0;
+
+  switch (PKL_AST_TYPE_CODE (type))
+    {
+    case PKL_TYPE_INTEGRAL:
+      return !PKL_AST_TYPE_I_DYN_P (type);
+    case PKL_TYPE_STRING:
+      return 1;
+    case PKL_TYPE_OFFSET:
+      return (pkl_inline_type_p (PKL_AST_TYPE_O_BASE_TYPE (type))
+              && PKL_AST_CODE (PKL_AST_TYPE_O_UNIT (type)) == PKL_AST_INTEGER
+              && PKL_AST_TYPE_O_REF_TYPE (type) == NULL);
+    default:
+      return 0;
+    }
+}
+
+/* Return 1 if the asm template TEMPLATE can be assembled in the
+   lexical environment of the caller, and more than once in the same
+   program.  Return 0 otherwise.  */
+
+static int
+pkl_inline_asm_template_p (const char *template)
+{
+  /* Labels are introduced with a dot.  */
+  return (strchr (template, '.') == NULL
+          && strstr (template, "var") == NULL
+          && strstr (template, "pushf") == NULL
+          && strstr (template, "popf") == NULL
+          && strstr (template, "prolog") == NULL
+          && strstr (template, "return") == NULL);
+}
+
+/* Return the position of the formal argument named NAME in the list
+   of formals FARGS, or -1 if there is no such argument.  */
+
+static int
+pkl_inline_formal (pkl_ast_node fargs, pkl_ast_node name)
+{
+  pkl_ast_node fa;
+  int i;
+
+  for (i = 0, fa = fargs; fa; fa = PKL_AST_CHAIN (fa), ++i)
+    {
+      pkl_ast_node fa_name = PKL_AST_FUNC_ARG_IDENTIFIER (fa);
+
+      if (STREQ (PKL_AST_IDENTIFIER_POINTER (fa_name),
+                 PKL_AST_IDENTIFIER_POINTER (name)))
+        return i;
+    }
+
+  return -1;
+}
+
+/* Return 1 if EXP, which is the body of a function having formal
+   arguments FARGS, can be inlined.  Return 0 otherwise.  NNODES is
+   incremented by the number of nodes in EXP.  */
+
+static int
+pkl_inline_body_p (pkl_ast_node exp, pkl_ast_node fargs, int *nnodes)
+{
+  if (++*nnodes > PKL_INLINE_MAX_NODES
+      || !pkl_inline_type_p (PKL_AST_TYPE (exp)))
+    return 0;
+
+  switch (PKL_AST_CODE (exp))
+    {
+    case PKL_AST_INTEGER:
+    case PKL_AST_STRING:
+      return 1;
+    case PKL_AST_VAR:
+      return pkl_inline_formal (fargs, PKL_AST_VAR_NAME (exp)) != -1;
+    case PKL_AST_OFFSET:
+      return (PKL_AST_CODE (PKL_AST_OFFSET_UNIT (exp)) == PKL_AST_INTEGER
+              && pkl_inline_body_p (PKL_AST_OFFSET_MAGNITUDE (exp),
+                                    fargs, nnodes));
+    case PKL_AST_CAST:
+      return (pkl_inline_type_p (PKL_AST_CAST_TYPE (exp))
+              && pkl_inline_body_p (PKL_AST_CAST_EXP (exp), fargs, nnodes));
+    case PKL_AST_COND_EXP:
+      return (pkl_inline_body_p (PKL_AST_COND_EXP_COND (exp),
+                                 fargs, nnodes)
+              && pkl_inline_body_p (PKL_AST_COND_EXP_THENEXP (exp),
+                                    fargs, nnodes)
+              && pkl_inline_body_p (PKL_AST_COND_EXP_ELSEEXP (exp),
+                                    fargs, nnodes));
+    case PKL_AST_EXP:
+      {
+        int i;
+
+        for (i = 0; i < PKL_AST_EXP_NUMOPS (exp); ++i)
+          if (!pkl_inline_body_p (PKL_AST_EXP_OPERAND (exp, i),
+                                  fargs, nnodes))
+            return 0;
+        return 1;
+      }
+    case PKL_AST_ASM_EXP:
+      {
+        pkl_ast_node template = PKL_AST_ASM_EXP_TEMPLATE (exp);
+        pkl_ast_node input;
+
+        if (!pkl_inline_asm_template_p (PKL_AST_IDENTIFIER_POINTER (template)))
+          return 0;
+        for (input = PKL_AST_ASM_EXP_INPUTS (exp);
+             input;
+             input = PKL_AST_CHAIN (input))
+          if (!pkl_inline_body_p (input, fargs, nnodes))
+            return 0;
+        return 1;
+      }
+    default:
+      return 0;
+    }
+}
+
+/* Return 1 if EXP can be passed as an actual argument to an inlined
+   function.  Return 0 otherwise.  */
+
+static int
+pkl_inline_actual_p (pkl_ast_node exp)
+{
+  switch (PKL_AST_CODE (exp))
+    {
+    case PKL_AST_INTEGER:
+    case PKL_AST_STRING:
+      return 1;
+    case PKL_AST_OFFSET:
+      return (PKL_AST_CODE (PKL_AST_OFFSET_MAGNITUDE (exp)) == PKL_AST_INTEGER
+              && PKL_AST_CODE (PKL_AST_OFFSET_UNIT (exp)) == PKL_AST_INTEGER);
+    case PKL_AST_VAR:
+      {
+        /* References to struct fields raise E_elem if the field is
+           absent, so they must be evaluated exactly once.  */
+        pkl_ast_node decl = PKL_AST_VAR_DECL (exp);
+
+        return (PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_VAR
+                && !PKL_AST_DECL_STRUCT_FIELD_P (decl));
+      }
+    default:
+      return 0;
+    }
+}
+
+/* Return the function called by FUNCALL if it can be inlined, NULL
+   otherwise.  */
+
+static pkl_ast_node
+pkl_inline_callee (pkl_ast_node funcall)
+{
+  pkl_ast_node function = PKL_AST_FUNCALL_FUNCTION (funcall);
+  pkl_ast_node decl, func, body, stmt, fa, aa;
+  int nnodes = 0;
+
+  if (PKL_AST_CODE (function) != PKL_AST_VAR)
+    return NULL;
+
+  decl = PKL_AST_VAR_DECL (function);
+  if (PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_FUNC
+      || !PKL_AST_DECL_IMMUTABLE_P (decl))
+    return NULL;
+
+  func = PKL_AST_DECL_INITIAL (decl);
+  if (PKL_AST_FUNC_METHOD_P (func)
+      || PKL_AST_FUNC_FIRST_OPT_ARG (func)
+      || PKL_AST_FUNC_NARGS (func) != PKL_AST_FUNCALL_NARG (funcall)
+      || !pkl_inline_type_p (PKL_AST_FUNC_RET_TYPE (func)))
+    return NULL;
+
+  for (fa = PKL_AST_FUNC_ARGS (func), aa = PKL_AST_FUNCALL_ARGS (funcall);
+       fa && aa;
+       fa = PKL_AST_CHAIN (fa), aa = PKL_AST_CHAIN (aa))
+    {
+      pkl_ast_node fa_type = PKL_AST_FUNC_ARG_TYPE (fa);
+      pkl_ast_node aa_exp = PKL_AST_FUNCALL_ARG_EXP (aa);
+
+      if (PKL_AST_FUNC_ARG_VARARG (fa)
+          || !pkl_inline_type_p (fa_type)
+          || !aa_exp
+          || !pkl_inline_actual_p (aa_exp)
+          || !pkl_ast_type_equal_p (PKL_AST_TYPE (aa_exp), fa_type))
+        return NULL;
+    }
+  if (fa || aa)
+    return NULL;
+
+  body = PKL_AST_FUNC_BODY (func);
+  stmt = PKL_AST_COMP_STMT_STMTS (body);
+  if (!stmt
+      || PKL_AST_CHAIN (stmt)
+      || PKL_AST_CODE (stmt) != PKL_AST_RETURN_STMT
+      || !PKL_AST_RETURN_STMT_EXP (stmt)
+      || !pkl_inline_body_p (PKL_AST_RETURN_STMT_EXP (stmt),
+                             PKL_AST_FUNC_ARGS (func), &nnodes))
+    return NULL;
+
+  return func;
+}
+
+/* Return a copy of EXP located at LOC.  If FARGS is not NULL, EXP is
+   the body of a function having formal arguments FARGS, and the
+   references to the formals are replaced by copies of the actual
+   arguments AARGS.  */
+
+static pkl_ast_node
+pkl_inline_copy (pkl_ast ast, pkl_ast_node exp,
+                 pkl_ast_node fargs, pkl_ast_node aargs,
+                 pkl_ast_loc loc)
+{
+  pkl_ast_node copy;
+
+  switch (PKL_AST_CODE (exp))
+    {
+    case PKL_AST_INTEGER:
+      copy = pkl_ast_make_integer (ast, PKL_AST_INTEGER_VALUE (exp));
+      break;
+    case PKL_AST_STRING:
+      copy = pkl_ast_make_string (ast, PKL_AST_STRING_POINTER (exp));
+      break;
+    case PKL_AST_VAR:
+      if (fargs)
+        {
+          int i = pkl_inline_formal (fargs, PKL_AST_VAR_NAME (exp));
+          pkl_ast_node aa;
+
+          for (aa = aargs; i > 0; aa = PKL_AST_CHAIN (aa), --i)
+            ;
+          return pkl_inline_copy (ast, PKL_AST_FUNCALL_ARG_EXP (aa),
+                                  NULL, NULL, loc);
+        }
+
+      copy = pkl_ast_make_var (ast, PKL_AST_VAR_NAME (exp),
+                               PKL_AST_VAR_DECL (exp),
+                               PKL_AST_VAR_BACK (exp),
+                               PKL_AST_VAR_OVER (exp));
+      PKL_AST_VAR_FUNCTION (copy) = PKL_AST_VAR_FUNCTION (exp);
+      PKL_AST_VAR_IS_PARENTHESIZED (copy)
+        = PKL_AST_VAR_IS_PARENTHESIZED (exp);
+      break;
+    case PKL_AST_OFFSET:
+      copy = pkl_ast_make_offset (ast,
+                                  pkl_inline_copy (ast,
+                                                   PKL_AST_OFFSET_MAGNITUDE (exp),
+                                                   fargs, aargs, loc),
+                                  pkl_inline_copy (ast,
+                                                   PKL_AST_OFFSET_UNIT (exp),
+                                                   NULL, NULL, loc));
+      break;
+    case PKL_AST_CAST:
+      copy = pkl_ast_make_cast (ast, PKL_AST_CAST_TYPE (exp),
+                                pkl_inline_copy (ast, PKL_AST_CAST_EXP (exp),
+                                                 fargs, aargs, loc));
+      break;
+    case PKL_AST_COND_EXP:
+      copy = pkl_ast_make_cond_exp (ast,
+                                    pkl_inline_copy (ast,
+                                                     PKL_AST_COND_EXP_COND (exp),
+                                                     fargs, aargs, loc),
+                                    pkl_inline_copy (ast,
+                                                     PKL_AST_COND_EXP_THENEXP (exp),
+                                                     fargs, aargs, loc),
+                                    pkl_inline_copy (ast,
+                                                     PKL_AST_COND_EXP_ELSEEXP (exp),
+                                                     fargs, aargs, loc));
+      break;
+    case PKL_AST_EXP:
+      {
+        pkl_ast_node ops[3] = { NULL, NULL, NULL };
+        int i;
+
+        for (i = 0; i < PKL_AST_EXP_NUMOPS (exp); ++i)
+          ops[i] = pkl_inline_copy (ast, PKL_AST_EXP_OPERAND (exp, i),
+                                    fargs, aargs, loc);
+
+        switch (PKL_AST_EXP_NUMOPS (exp))
+          {
+          case 1:
+            copy = pkl_ast_make_unary_exp (ast, PKL_AST_EXP_CODE (exp),
+                                           ops[0]);
+            break;
+          case 2:
+            copy = pkl_ast_make_binary_exp (ast, PKL_AST_EXP_CODE (exp),
+                                            ops[0], ops[1]);
+            break;
+          case 3:
+            copy = pkl_ast_make_ternary_exp (ast, PKL_AST_EXP_CODE (exp),
+                                             ops[0], ops[1], ops[2]);
+            break;
+          default:
+            PK_UNREACHABLE ();
+          }
+        PKL_AST_EXP_ATTR (copy) = PKL_AST_EXP_ATTR (exp);
+        PKL_AST_EXP_FLAG (copy) = PKL_AST_EXP_FLAG (exp);
+        break;
+      }
+    case PKL_AST_ASM_EXP:
+      {
+        pkl_ast_node inputs = NULL, input;
+
+        for (input = PKL_AST_ASM_EXP_INPUTS (exp);
+             input;
+             input = PKL_AST_CHAIN (input))
+          inputs = pkl_ast_chainon (inputs,
+                                    pkl_inline_copy (ast, input,
+                                                     fargs, aargs, loc));
+
+        copy = pkl_ast_make_asm_exp (ast, PKL_AST_ASM_EXP_TYPE (exp),
+                                     PKL_AST_ASM_EXP_TEMPLATE (exp),
+                                     inputs);
+        break;
+      }
+    default:
+      PK_UNREACHABLE ();
+    }
+
+  PKL_AST_TYPE (copy) = ASTREF (PKL_AST_TYPE (exp));
+  PKL_AST_LITERAL_P (copy) = PKL_AST_LITERAL_P (exp);
+  PKL_AST_LOC (copy) = loc;
+  return copy;
+}
+
+/* Replace calls to functions that can be inlined by a copy of the
+   expression returned by the function, in terms of the actual
+   arguments of the call.  The resulting expression is processed by
+   the rest of the phases, so it gets constant-folded if the actual
+   arguments are constant.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_inline_ps_funcall)
+{
+  pkl_ast_node funcall = PKL_PASS_NODE;
+  pkl_ast_node func = pkl_inline_callee (funcall);
+  pkl_ast_node stmt, exp;
+
+  if (!func)
+    PKL_PASS_DONE;
+
+  stmt = PKL_AST_COMP_STMT_STMTS (PKL_AST_FUNC_BODY (func));
+  exp = pkl_inline_copy (PKL_PASS_AST, PKL_AST_RETURN_STMT_EXP (stmt),
+                         PKL_AST_FUNC_ARGS (func),
+                         PKL_AST_FUNCALL_ARGS (funcall),
+                         PKL_AST_LOC (funcall));
+
+  PKL_PASS_NODE = ASTREF (exp);
+  pkl_ast_node_free (funcall);
+  PKL_PASS_RESTART = 1;
+}
+PKL_PHASE_END_HANDLER
+
+struct pkl_phase pkl_phase_inline =
+  {
+    PKL_PHASE_NAME ("inline"),
+    PKL_PHASE_PS_HANDLER (PKL_AST_FUNCALL, pkl_inline_ps_funcall),
+  };
@@ -24,6 +24,7 @@
 
 #include "pkl-ast.h"
 #include "pkl-parser.h"
+#include "pkl-pass.h"
 #include "pkl-tab.h"
 #include "pk-utils.h"
 #define YYSTYPE PKL_TAB_STYPE
@@ -49,6 +50,7 @@ pkl_parser_init (void)
   parser->interactive = 0;
   parser->filename = NULL;
   parser->nchars = 0;
+  parser->text_hash = 0;
   parser->bootstrapped = 0;
   parser->in_method_decl_p = 0;
   parser->prev_loc = PKL_AST_NOLOC;
@@ -79,6 +81,7 @@ pkl_parse_file (pkl_compiler compiler, pkl_env *env,
 {
   int ret;
   struct pkl_parser *parser;
+  struct pkl_pass_timer_entry *timer_entry;
   char *filename = strdup (fname);
   char *ast_filename = strdup (fname);
 
@@ -100,10 +103,15 @@ pkl_parse_file (pkl_compiler compiler, pkl_env *env,
   parser->ast->file = fp;
   parser->ast->filename = ast_filename;
   pkl_tab_set_in (fp, parser->scanner);
+  timer_entry = pkl_pass_timer_enter (pkl_timer (compiler), "parse");
   if (setjmp (parser->toplevel) == 0)
     ret = pkl_tab_parse (parser);
   else
-    goto out_of_memory;
+    {
+      pkl_pass_timer_leave (pkl_timer (compiler), timer_entry);
+      goto out_of_memory;
+    }
+  pkl_pass_timer_leave (pkl_timer (compiler), timer_entry);
   /* In the absence of an error, only the initial compile-time
      environment should remain after parsing.  In the case of an
      error, this doesn't matter since the environment is gonna be
@@ -138,6 +146,7 @@ pkl_parse_buffer (pkl_compiler compiler, pkl_env *env,
 {
   YY_BUFFER_STATE yybuffer;
   struct pkl_parser *parser;
+  struct pkl_pass_timer_entry *timer_entry;
   int ret;
   char *buffer_dup = strdup (buffer);
 
@@ -173,10 +182,15 @@ pkl_parse_buffer (pkl_compiler compiler, pkl_env *env,
   /* pkl_tab_debug = 1; */
   parser->env = *env;
   parser->ast->buffer = buffer_dup;
+  timer_entry = pkl_pass_timer_enter (pkl_timer (compiler), "parse");
   if (setjmp (parser->toplevel) == 0)
     ret = pkl_tab_parse (parser);
   else
-    goto out_of_memory;
+    {
+      pkl_pass_timer_leave (pkl_timer (compiler), timer_entry);
+      goto out_of_memory;
+    }
+  pkl_pass_timer_leave (pkl_timer (compiler), timer_entry);
 
   *ast = parser->ast;
   *env = parser->env;
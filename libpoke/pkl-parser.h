@@ -37,7 +37,11 @@
    otherwise.
 
    IN_METHOD_P is 1 if we are parsing the declaration of a struct
-   method.  0 otherwise.  */
+   method.  0 otherwise.
+
+   TEXT_HASH is a hash of the source code scanned since the beginning
+   of the last top-level function declaration.  It is used to compute
+   the fingerprint of the declaration.  */
 
 struct pkl_parser
 {
@@ -51,6 +55,7 @@ struct pkl_parser
   size_t nchars;
   int bootstrapped;
   int in_method_decl_p;
+  uint64_t text_hash;
   char *alien_errmsg;
   pkl_ast_loc prev_loc;
   uint32_t init_line;
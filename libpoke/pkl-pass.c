@@ -19,9 +19,297 @@
 
 #include <config.h>
 
+#include <stdlib.h>
+#include <string.h>
+#include <timespec.h>
+
 #include "pk-utils.h"
 #include "pkl-pass.h"
 
+/* Pass timers keep an entry per measured phase.  The first entry is
+   always the "walk" pseudo phase.
+
+   CURRENT is the entry to which the time elapsed since LAST is to be
+   charged.  It is NULL while the compiler is not running.
+
+   DECLS is an array of NDECLS entries, one per measured top-level
+   declaration, with room for DECLS_ALLOCATED entries.  Declarations
+   are identified by their AST node, and only the entries starting at
+   DECLS_BASE, i.e. the ones belonging to the program being compiled,
+   are looked up.
+
+   DECL_CURRENT is the index of the declaration being traversed by
+   the pass manager, or -1.  DECL_START is the time at which the
+   traversal started.  NPASSES is the number of passes run so far, and
+   it is used to count the nodes of a declaration just once.  */
+
+struct pkl_pass_timer_entry
+{
+  const char *name;
+  uint64_t nsec;
+  uint64_t ncalls;
+};
+
+struct pkl_pass_timer_decl
+{
+  const void *node;
+  char *name;
+  char *source;
+  uint64_t nsec;
+  uint64_t nnodes;
+  int npass;
+};
+
+struct pkl_pass_timer
+{
+  struct pkl_pass_timer_entry entries[PKL_PASS_TIMER_MAX_ENTRIES];
+  int nentries;
+  struct pkl_pass_timer_entry *current;
+  struct timespec last;
+
+  struct pkl_pass_timer_decl *decls;
+  size_t ndecls;
+  size_t decls_allocated;
+  size_t decls_base;
+  ssize_t decl_current;
+  struct timespec decl_start;
+  int npasses;
+};
+
+pkl_pass_timer
+pkl_pass_timer_new (void)
+{
+  pkl_pass_timer timer = calloc (1, sizeof (struct pkl_pass_timer));
+
+  if (!timer)
+    return NULL;
+
+  pkl_pass_timer_reset (timer);
+  return timer;
+}
+
+static void
+pkl_pass_timer_free_decls (pkl_pass_timer timer)
+{
+  size_t i;
+
+  for (i = 0; i < timer->ndecls; ++i)
+    {
+      free (timer->decls[i].name);
+      free (timer->decls[i].source);
+    }
+  free (timer->decls);
+}
+
+void
+pkl_pass_timer_free (pkl_pass_timer timer)
+{
+  pkl_pass_timer_free_decls (timer);
+  free (timer);
+}
+
+void
+pkl_pass_timer_reset (pkl_pass_timer timer)
+{
+  pkl_pass_timer_free_decls (timer);
+  memset (timer, 0, sizeof (struct pkl_pass_timer));
+  timer->entries[0].name = "walk";
+  timer->nentries = 1;
+  timer->current = NULL;
+  timer->decl_current = -1;
+}
+
+void
+pkl_pass_timer_map (pkl_pass_timer timer, pkl_phase_time_fn fn,
+                    void *data)
+{
+  int i;
+
+  for (i = 0; i < timer->nentries; ++i)
+    fn (timer->entries[i].name, timer->entries[i].nsec,
+        timer->entries[i].ncalls, data);
+}
+
+/* Return the entry of TIMER for the phase called NAME.  Phases
+   without a name, and phases not fitting in the timer, are charged
+   to the walker.  */
+
+static struct pkl_pass_timer_entry *
+pkl_pass_timer_entry (pkl_pass_timer timer, const char *name)
+{
+  int i;
+
+  if (!name)
+    return &timer->entries[0];
+
+  for (i = 1; i < timer->nentries; ++i)
+    if (timer->entries[i].name == name
+        || STREQ (timer->entries[i].name, name))
+      return &timer->entries[i];
+
+  if (timer->nentries == PKL_PASS_TIMER_MAX_ENTRIES)
+    return &timer->entries[0];
+
+  timer->entries[timer->nentries].name = name;
+  return &timer->entries[timer->nentries++];
+}
+
+/* Charge the time elapsed since the last switch to the current entry
+   of TIMER, if any, and make ENTRY the current entry.  Return the
+   previous current entry.  */
+
+static struct pkl_pass_timer_entry *
+pkl_pass_timer_switch (pkl_pass_timer timer,
+                       struct pkl_pass_timer_entry *entry)
+{
+  struct pkl_pass_timer_entry *prev = timer->current;
+  struct timespec now = current_timespec ();
+
+  if (prev)
+    prev->nsec += ((uint64_t) (now.tv_sec - timer->last.tv_sec) * 1000000000
+                   + now.tv_nsec - timer->last.tv_nsec);
+  timer->last = now;
+  timer->current = entry;
+  return prev;
+}
+
+struct pkl_pass_timer_entry *
+pkl_pass_timer_enter (pkl_pass_timer timer, const char *name)
+{
+  struct pkl_pass_timer_entry *entry = NULL;
+
+  if (!timer)
+    return NULL;
+
+  if (name)
+    {
+      entry = pkl_pass_timer_entry (timer, name);
+      entry->ncalls++;
+    }
+
+  return pkl_pass_timer_switch (timer, entry);
+}
+
+void
+pkl_pass_timer_leave (pkl_pass_timer timer,
+                      struct pkl_pass_timer_entry *prev)
+{
+  if (timer)
+    pkl_pass_timer_switch (timer, prev);
+}
+
+void
+pkl_pass_timer_begin_program (pkl_pass_timer timer)
+{
+  timer->decls_base = timer->ndecls;
+}
+
+size_t
+pkl_pass_timer_ndecls (pkl_pass_timer timer)
+{
+  return timer->ndecls;
+}
+
+void
+pkl_pass_timer_map_decls (pkl_pass_timer timer, size_t from,
+                          pkl_decl_time_fn fn, void *data)
+{
+  size_t i;
+
+  for (i = from; i < timer->ndecls; ++i)
+    fn (timer->decls[i].name, timer->decls[i].source,
+        timer->decls[i].nsec, timer->decls[i].nnodes, data);
+}
+
+/* Start measuring the top-level declaration NODE in TIMER, creating
+   a new entry for it if this is the first pass traversing it in the
+   current program.  Return 1 if the declaration is being measured,
+   0 otherwise.  */
+
+static int
+pkl_pass_timer_decl_begin (pkl_pass_timer timer, pkl_ast_node node)
+{
+  size_t i;
+
+  if (timer->decl_current != -1)
+    return 0;
+
+  for (i = timer->decls_base; i < timer->ndecls; ++i)
+    if (timer->decls[i].node == node)
+      break;
+
+  if (i == timer->ndecls)
+    {
+      struct pkl_pass_timer_decl *decl;
+      pkl_ast_node name = PKL_AST_DECL_NAME (node);
+      char *source = PKL_AST_DECL_SOURCE (node);
+
+      if (timer->ndecls == timer->decls_allocated)
+        {
+          size_t allocated
+            = timer->decls_allocated ? timer->decls_allocated * 2 : 64;
+          struct pkl_pass_timer_decl *decls
+            = realloc (timer->decls, allocated * sizeof (*decls));
+
+          if (!decls)
+            return 0;
+          timer->decls = decls;
+          timer->decls_allocated = allocated;
+        }
+
+      decl = &timer->decls[i];
+      memset (decl, 0, sizeof (*decl));
+      decl->node = node;
+      decl->name = strdup (name ? PKL_AST_IDENTIFIER_POINTER (name) : "");
+      decl->source = source ? strdup (source) : NULL;
+      decl->npass = timer->npasses;
+      if (!decl->name)
+        return 0;
+      timer->ndecls++;
+    }
+
+  timer->decl_current = i;
+  timer->decl_start = current_timespec ();
+  return 1;
+}
+
+/* Charge the time elapsed since the start of the traversal of the
+   current declaration of TIMER to it.  */
+
+static void
+pkl_pass_timer_decl_end (pkl_pass_timer timer)
+{
+  struct pkl_pass_timer_decl *decl = &timer->decls[timer->decl_current];
+  struct timespec now = current_timespec ();
+
+  decl->nsec += ((uint64_t) (now.tv_sec - timer->decl_start.tv_sec) * 1000000000
+                 + now.tv_nsec - timer->decl_start.tv_nsec);
+  timer->decl_current = -1;
+}
+
+/* The following macros are used to charge the time spent in a phase
+   handler to its phase.  They expect a variable TIMER to be in
+   scope.  */
+
+#define PKL_TIMER_ENTER(PHASE)                                          \
+  struct pkl_pass_timer_entry *prev_entry = NULL;                       \
+  if (timer)                                                            \
+    {                                                                   \
+      struct pkl_pass_timer_entry *entry                                \
+        = pkl_pass_timer_entry (timer, (PHASE)->name);                  \
+                                                                        \
+      entry->ncalls++;                                                  \
+      prev_entry = pkl_pass_timer_switch (timer, entry);                \
+    }
+
+#define PKL_TIMER_LEAVE                                                 \
+  do                                                                    \
+    {                                                                   \
+      if (timer)                                                        \
+        pkl_pass_timer_switch (timer, prev_entry);                      \
+    }                                                                   \
+  while (0)
+
 #define PKL_CALL_PHASES(CLASS,ORDER,DISCR)                              \
   do                                                                    \
     {                                                                   \
@@ -33,6 +321,7 @@
             {                                                           \
               int restart;                                              \
               pkl_ast_node orig_node = node;                            \
+              PKL_TIMER_ENTER (phases[i]);                              \
                                                                         \
               node                                                      \
                 = phases[i]->CLASS##_##ORDER##_handlers[(DISCR)] (compiler, \
@@ -48,6 +337,7 @@
                                                                   phases,\
                                                                   flags, \
                                                                   level); \
+              PKL_TIMER_LEAVE;                                          \
               *handlers_used += 1;                                      \
               if (dobreak)                                              \
                 goto _exit;                                             \
@@ -83,6 +373,8 @@
             {                                                           \
               int restart;                                              \
               pkl_ast_node orig_node = node;                            \
+              PKL_TIMER_ENTER (phases[i]);                              \
+                                                                        \
               node                                                      \
                 = phases[i]->what##_handler (compiler,                  \
                                              toplevel,                  \
@@ -97,6 +389,7 @@
                                              phases,                    \
                                              flags,                     \
                                              level);                    \
+              PKL_TIMER_LEAVE;                                          \
               if (dobreak)                                              \
                 goto _exit;                                             \
                                                                         \
@@ -151,6 +444,7 @@ pkl_call_node_handlers (pkl_compiler compiler,
 {
   int node_code = PKL_AST_CODE (node);
   int dobreak = 0;
+  pkl_pass_timer timer = pkl_timer (compiler);
 
   if (order == PKL_PASS_POST_ORDER)
     {
@@ -163,18 +457,8 @@ pkl_call_node_handlers (pkl_compiler compiler,
         {
           int opcode = PKL_AST_EXP_CODE (node);
 
-          switch (opcode)
-            {
-#define PKL_DEF_OP(ocode, str)                          \
-              case ocode:                               \
-                PKL_CALL_PHASES (op, ps, ocode);        \
-                break;
-#include "pkl-ops.def"
-#undef PKL_DEF_OP
-            default:
-              /* Unknown operation code.  */
-              PK_UNREACHABLE ();
-            }
+          assert (opcode >= 0 && opcode < PKL_AST_OP_LAST);
+          PKL_CALL_PHASES (op, ps, opcode);
         }
 
       /* Call the phase handlers defined for specific types, in the given
@@ -211,18 +495,8 @@ pkl_call_node_handlers (pkl_compiler compiler,
         {
           int opcode = PKL_AST_EXP_CODE (node);
 
-          switch (opcode)
-            {
-#define PKL_DEF_OP(ocode, str)                          \
-              case ocode:                               \
-                PKL_CALL_PHASES (op, pr, ocode);        \
-                break;
-#include "pkl-ops.def"
-#undef PKL_DEF_OP
-            default:
-              /* Unknown operation code.  */
-              PK_UNREACHABLE ();
-            }
+          assert (opcode >= 0 && opcode < PKL_AST_OP_LAST);
+          PKL_CALL_PHASES (op, pr, opcode);
         }
 
       /* Call the phase handlers defined for specific types, in the given
@@ -302,6 +576,8 @@ pkl_do_pass_1 (pkl_compiler compiler,
   pkl_ast_node node_orig = node;
   int handlers_used = 0;
   int dobreak = 0;
+  int decl_p = 0;
+  pkl_pass_timer timer = pkl_timer (compiler);
 
   /* If there are no passes then there is nothing to do. */
   if (phases == NULL)
@@ -313,6 +589,18 @@ pkl_do_pass_1 (pkl_compiler compiler,
       && PKL_AST_TYPE_COMPILED (node) >= level)
     goto _exit;
 
+  /* Measure top-level declarations and count the nodes in them.  */
+  if (timer)
+    {
+      if (parent && PKL_AST_CODE (parent) == PKL_AST_PROGRAM
+          && PKL_AST_CODE (node) == PKL_AST_DECL)
+        decl_p = pkl_pass_timer_decl_begin (timer, node);
+
+      if (timer->decl_current != -1
+          && timer->decls[timer->decl_current].npass == timer->npasses)
+        timer->decls[timer->decl_current].nnodes++;
+    }
+
   /* Call the pre-order handlers from registered phases.  */
   node = pkl_call_node_handlers (compiler, toplevel, ast, node, payloads, phases,
                                  &handlers_used, child_pos, parent, &dobreak,
@@ -640,6 +928,8 @@ pkl_do_pass_1 (pkl_compiler compiler,
  restart:
 
  _exit:
+  if (decl_p)
+    pkl_pass_timer_decl_end (timer);
   if (level != 0
       && PKL_AST_CODE (node) == PKL_AST_TYPE)
     PKL_AST_TYPE_COMPILED (node) = level;
@@ -653,6 +943,10 @@ pkl_do_subpass (pkl_compiler compiler,
                 int flags, int level)
 {
   jmp_buf toplevel;
+  pkl_pass_timer timer = pkl_timer (compiler);
+  struct pkl_pass_timer_entry *entry = timer ? timer->current : NULL;
+  ssize_t decl = timer ? timer->decl_current : -1;
+  int ret = 1;
 
   switch (setjmp (toplevel))
     {
@@ -666,11 +960,20 @@ pkl_do_subpass (pkl_compiler compiler,
       break;
     case 2:
       /* Error in node handler.  */
-      return 0;
+      ret = 0;
       break;
     }
 
-  return 1;
+  /* A non-local exit skips the handlers epilogues, so make sure the
+     time spent from now on is charged to the right phase.  */
+  if (timer)
+    {
+      pkl_pass_timer_switch (timer, entry);
+      if (timer->decl_current != decl)
+        pkl_pass_timer_decl_end (timer);
+    }
+
+  return ret;
 }
 
 int
@@ -683,6 +986,8 @@ pkl_do_pass (pkl_compiler compiler,
   void **payloads;
   int i, nphases;
   int ret;
+  pkl_pass_timer timer = pkl_timer (compiler);
+  struct pkl_pass_timer_entry *prev_entry = NULL;
 
   /* Allocate space for the payloads.  */
   nphases = 0;
@@ -695,6 +1000,14 @@ pkl_do_pass (pkl_compiler compiler,
     return 0;
   memset (payloads, 0, (nphases + 1) * sizeof (void*));
 
+  /* The initialization and finalization of the phases is charged to
+     the walker.  */
+  if (timer)
+    {
+      timer->npasses++;
+      prev_entry = pkl_pass_timer_switch (timer, &timer->entries[0]);
+    }
+
   /* Initialize phases.  */
   for (i = 0; i < nphases; ++i)
     {
@@ -713,6 +1026,7 @@ pkl_do_pass (pkl_compiler compiler,
         phases[i]->finalize (payloads[i]);
     }
 
+  PKL_TIMER_LEAVE;
   free (payloads);
   return ret;
 }
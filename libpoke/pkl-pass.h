@@ -38,6 +38,9 @@
    Implementing a phase involves defining a struct pkl_phase variable
    and filling it up.  A pkl_phase struct contains:
 
+   - NAME is a string identifying the phase, like "trans1".  It is
+     used when reporting the time spent in the phase.
+
    - INITIALIZE is a function that is invoked by the pass manager in
      order to perform phase-specific initialization.  The function
      returns a void pointer that is intended to hold some payload.
@@ -124,6 +127,8 @@ typedef void (*pkl_phase_finalize_fn) (void *payload);
 
 struct pkl_phase
 {
+  const char *name;
+
   pkl_phase_initialize_fn initialize;
   pkl_phase_finalize_fn finalize;
 
@@ -146,6 +151,9 @@ typedef struct pkl_phase *pkl_phase;
    in a `struct pkl_phase'.  This allows changing the structure layout
    without impacting the phase definitions.  */
 
+#define PKL_PHASE_NAME(str)                  \
+  .name = str
+
 #define PKL_PHASE_ELSE_HANDLER(handler)      \
   .else_handler = handler
 
@@ -360,6 +368,78 @@ int pkl_do_subpass (pkl_compiler compiler, pkl_ast ast, pkl_ast_node node,
                     struct pkl_phase *phases[], void *payloads[],
                     int flags, int level);
 
+/* Pass timers.
+
+   A pass timer measures the time spent by the pass manager in the
+   handlers of every phase.  The time spent in a handler that runs a
+   subpass is charged to the phases handling the nodes of the
+   subpass, so the measured times are exclusive.  The time spent
+   traversing the AST outside of any handler is charged to a pseudo
+   phase called "walk".
+
+   Phases are identified by their NAME, so the time spent by phases
+   run in several passes, like fold, is accumulated.
+
+   The pass manager uses the timer returned by `pkl_timer', if
+   any.
+
+   Pass timers also measure the time spent by the pass manager in
+   every top-level declaration of the compiled programs, and the
+   number of AST nodes in them.  The time of a declaration includes
+   the time spent in all the phases of all the passes.  */
+
+#define PKL_PASS_TIMER_MAX_ENTRIES 32
+
+typedef struct pkl_pass_timer *pkl_pass_timer;
+
+/* Create a new pass timer with no measurements.  Return NULL if
+   there is not enough memory.  */
+
+pkl_pass_timer pkl_pass_timer_new (void);
+
+/* Free all the resources used by TIMER.  */
+
+void pkl_pass_timer_free (pkl_pass_timer timer);
+
+/* Discard all the measurements in TIMER.  */
+
+void pkl_pass_timer_reset (pkl_pass_timer timer);
+
+/* Call FN for every phase measured by TIMER, in the order in which
+   the phases were first run.  The type pkl_phase_time_fn is defined
+   in pkl.h.  */
+
+void pkl_pass_timer_map (pkl_pass_timer timer, pkl_phase_time_fn fn,
+                         void *data);
+
+/* Charge the time spent from now on to the pseudo phase NAME of
+   TIMER, until `pkl_pass_timer_leave' is called with the returned
+   value.  If NAME is NULL then the time spent from now on is not
+   charged to any phase.  This is used to measure the parts of the
+   compiler that don't run in the pass manager.  Both functions do
+   nothing if TIMER is NULL.  */
+
+struct pkl_pass_timer_entry *pkl_pass_timer_enter (pkl_pass_timer timer,
+                                                   const char *name);
+void pkl_pass_timer_leave (pkl_pass_timer timer,
+                           struct pkl_pass_timer_entry *prev);
+
+/* Tell TIMER that a new program is about to be compiled.  */
+
+void pkl_pass_timer_begin_program (pkl_pass_timer timer);
+
+/* Return the number of declarations measured by TIMER.  */
+
+size_t pkl_pass_timer_ndecls (pkl_pass_timer timer);
+
+/* Call FN for every declaration measured by TIMER, starting with the
+   declaration with index FROM, in the order in which the
+   declarations were compiled.  The type pkl_decl_time_fn is defined
+   in pkl.h.  */
+
+void pkl_pass_timer_map_decls (pkl_pass_timer timer, size_t from,
+                               pkl_decl_time_fn fn, void *data);
+
 /* Macros to emit a compilation error, a warning or an ICE from a
    phase handler.  Using them reduces verbosity by not passing the
    compiler and the AST arguments explicitly.  */
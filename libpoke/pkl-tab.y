@@ -304,6 +304,44 @@ pkl_register_dummies (struct pkl_parser *parser, int n)
     }
 }
 
+/* Complete the fingerprint of the top-level function declaration
+   DECL, whose source code has just been parsed.  If DECL re-defines a
+   function with the same fingerprint, annotate DECL so the compiled
+   code of the previous definition is reused instead of compiling the
+   function again.  */
+
+static void
+pkl_fingerprint_func_decl (struct pkl_parser *parser, pkl_ast_node decl)
+{
+  uint64_t fingerprint
+    = pkl_env_end_fingerprint (parser->env, parser->text_hash);
+  pkl_ast_node func = PKL_AST_DECL_INITIAL (decl);
+  pkl_ast_node prev_decl = PKL_AST_DECL_PREV_DECL (decl);
+  pkl_ast_node prev_func;
+
+  PKL_AST_DECL_FINGERPRINT (decl) = fingerprint;
+
+  if (!prev_decl
+      || PKL_AST_DECL_KIND (prev_decl) != PKL_AST_DECL_KIND_FUNC
+      || PKL_AST_DECL_FINGERPRINT (prev_decl) != fingerprint
+      || PKL_AST_FUNC_METHOD_P (func))
+    return;
+
+  /* The previous definition must have been compiled
+     successfully.  */
+  prev_func = PKL_AST_DECL_INITIAL (prev_decl);
+  if (!PKL_AST_FUNC_PROGRAM (prev_func) || !PKL_AST_TYPE (prev_func))
+    return;
+
+  /* Install the type and the program of the previous definition in
+     the new function.  The compiler phases skip the bodies of reused
+     functions, and the code generator uses the installed program to
+     create the closure.  */
+  PKL_AST_TYPE (func) = ASTREF (PKL_AST_TYPE (prev_func));
+  PKL_AST_FUNC_PROGRAM (func) = PKL_AST_FUNC_PROGRAM (prev_func);
+  PKL_AST_DECL_REUSED_P (decl) = 1;
+}
+
 /* Load a module, given its name.
    If the module file cannot be read, return 1.
    If there is a parse error loading the module, return 2.
@@ -1189,9 +1227,9 @@ primary:
                   const char *name = PKL_AST_IDENTIFIER_POINTER ($1);
 
                   pkl_ast_node decl
-                    = pkl_env_lookup (pkl_parser->env,
-                                      PKL_ENV_NS_MAIN,
-                                      name, &back, &over);
+                    = pkl_env_lookup_id (pkl_parser->env,
+                                         PKL_ENV_NS_MAIN,
+                                         $1, &back, &over);
                   if (!decl
                       || (PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_VAR
                           && PKL_AST_DECL_KIND (decl) != PKL_AST_DECL_KIND_FUNC))
@@ -1657,10 +1695,9 @@ typename:
                     pkl_ast_node alias;
                     pkl_ast_node decl;
 
-                    decl = pkl_env_lookup (pkl_parser->env,
-                                           PKL_ENV_NS_MAIN,
-                                           PKL_AST_IDENTIFIER_POINTER ($1),
-                                           NULL, NULL);
+                    decl = pkl_env_lookup_id (pkl_parser->env,
+                                              PKL_ENV_NS_MAIN,
+                                              $1, NULL, NULL);
                     assert (decl != NULL
                             && PKL_AST_DECL_KIND (decl) == PKL_AST_DECL_KIND_TYPE);
                     alias = pkl_ast_make_named_type (pkl_parser->ast,
@@ -2232,6 +2269,11 @@ declaration:
                       YYERROR;
                     }
 
+                  /* Record the declarations referred by top-level
+                     functions, for their fingerprints.  */
+                  if (pkl_env_toplevel_p (pkl_parser->env))
+                    pkl_env_start_fingerprint (pkl_parser->env, $<ast>$);
+
                   /* function_specifier needs to know whether we are
                      in a function declaration or a method
                      declaration.  */
@@ -2258,14 +2300,32 @@ declaration:
                   if ($1 == IS_METHOD)
                     PKL_AST_FUNC_METHOD_P ($5) = 1;
 
+                  if (pkl_env_toplevel_p (pkl_parser->env))
+                    pkl_fingerprint_func_decl (pkl_parser, $<ast>3);
+
                   pkl_parser->in_method_decl_p = 0;
                 }
         | simple_declaration ';' { $$ = $1; }
         ;
 
+/* Note that the reduction of these rules doesn't require a look-ahead
+   token, so the hash of the source code of a top-level function
+   declaration covers everything from the token that follows
+   `fun'.  */
+
 defun_or_method:
-          DEFUN                { $$ = IS_DEFUN; }
-        | METHOD        { $$ = IS_METHOD; }
+          DEFUN
+                {
+                  $$ = IS_DEFUN;
+                  if (pkl_env_toplevel_p (pkl_parser->env))
+                    pkl_parser->text_hash = 14695981039346656037ULL;
+                }
+        | METHOD
+                {
+                  $$ = IS_METHOD;
+                  if (pkl_env_toplevel_p (pkl_parser->env))
+                    pkl_parser->text_hash = 14695981039346656037ULL;
+                }
         ;
 
 defvar_list:
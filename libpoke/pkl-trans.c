@@ -434,6 +434,11 @@ PKL_PHASE_BEGIN_HANDLER (pkl_trans1_pr_decl)
 
       PKL_AST_FUNC_NAME (function)
         = XSTRDUP (PKL_AST_IDENTIFIER_POINTER (name));
+
+      /* Functions reusing the code compiled for a previous
+         definition are not processed again.  */
+      if (PKL_AST_DECL_REUSED_P (decl))
+        PKL_PASS_BREAK;
     }
 }
 PKL_PHASE_END_HANDLER
@@ -1652,6 +1657,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_trans1 =
   {
+    PKL_PHASE_NAME ("trans1"),
     .initialize = pkl_trans_initialize,
     .finalize = pkl_trans_finalize,
 
@@ -2039,6 +2045,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_trans2 =
   {
+    PKL_PHASE_NAME ("trans2"),
     .initialize = pkl_trans_initialize,
     .finalize = pkl_trans_finalize,
 
@@ -2106,6 +2113,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_trans3 =
   {
+    PKL_PHASE_NAME ("trans3"),
     .initialize = pkl_trans_initialize,
     .finalize = pkl_trans_finalize,
 
@@ -2140,13 +2148,81 @@ PKL_PHASE_BEGIN_HANDLER (pkl_transf_ps_comp_stmt)
 }
 PKL_PHASE_END_HANDLER
 
+/* Functions reusing the code compiled for a previous definition are
+   not processed.  See pkl_trans1_pr_decl.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_transf_pr_decl)
+{
+  if (PKL_AST_DECL_REUSED_P (PKL_PASS_NODE))
+    PKL_PASS_BREAK;
+}
+PKL_PHASE_END_HANDLER
+
+/* The sizes of the fields of struct types having a static layout are
+   known at compile-time, so 'esize can be computed for constant
+   indexes.  */
+
+PKL_PHASE_BEGIN_HANDLER (pkl_transf_ps_op_attr)
+{
+  pkl_ast_node exp = PKL_PASS_NODE;
+  pkl_ast_node exp_type = PKL_AST_TYPE (exp);
+  pkl_ast_node operand, operand_type, index;
+  pkl_ast_node field, size, off;
+  uint64_t n;
+
+  if (PKL_AST_EXP_ATTR (exp) != PKL_AST_ATTR_ESIZE)
+    PKL_PASS_DONE;
+
+  operand = PKL_AST_EXP_OPERAND (exp, 0);
+  operand_type = PKL_AST_TYPE (operand);
+  index = PKL_AST_EXP_OPERAND (exp, 1);
+
+  if (PKL_AST_TYPE_CODE (operand_type) != PKL_TYPE_STRUCT
+      || !PKL_AST_TYPE_S_STATIC_LAYOUT_P (operand_type)
+      || PKL_AST_CODE (index) != PKL_AST_INTEGER)
+    PKL_PASS_DONE;
+
+  /* Out of bounds indexes raise an exception at run-time.  */
+  n = PKL_AST_INTEGER_VALUE (index);
+  for (field = PKL_AST_TYPE_S_ELEMS (operand_type);
+       field;
+       field = PKL_AST_CHAIN (field))
+    {
+      if (PKL_AST_CODE (field) != PKL_AST_STRUCT_TYPE_FIELD
+          || PKL_AST_STRUCT_TYPE_FIELD_COMPUTED_P (field))
+        continue;
+      if (n-- == 0)
+        break;
+    }
+  if (!field)
+    PKL_PASS_DONE;
+
+  size = pkl_ast_make_integer (PKL_PASS_AST,
+                               PKL_AST_INTEGER_VALUE (PKL_AST_STRUCT_TYPE_FIELD_SIZE (field)));
+  PKL_AST_TYPE (size) = ASTREF (PKL_AST_TYPE_O_BASE_TYPE (exp_type));
+  PKL_AST_LOC (size) = PKL_AST_LOC (exp);
+
+  off = pkl_ast_make_offset (PKL_PASS_AST, size,
+                             PKL_AST_TYPE_O_UNIT (exp_type));
+  PKL_AST_TYPE (off) = ASTREF (exp_type);
+  PKL_AST_LOC (off) = PKL_AST_LOC (exp);
+
+  PKL_PASS_NODE = ASTREF (off);
+  pkl_ast_node_free (exp);
+  PKL_PASS_RESTART = 1;
+}
+PKL_PHASE_END_HANDLER
+
 struct pkl_phase pkl_phase_transf =
   {
+    PKL_PHASE_NAME ("transf"),
     .initialize = pkl_trans_initialize,
     .finalize = pkl_trans_finalize,
 
     PKL_PHASE_PS_HANDLER (PKL_AST_SRC, pkl_trans_ps_src),
     PKL_PHASE_PS_HANDLER (PKL_AST_COMP_STMT, pkl_transf_ps_comp_stmt),
+    PKL_PHASE_PR_HANDLER (PKL_AST_DECL, pkl_transf_pr_decl),
+    PKL_PHASE_PS_OP_HANDLER (PKL_AST_OP_ATTR, pkl_transf_ps_op_attr),
   };
 
 #define PKL_TRANS_ENV (PKL_TRANS_PAYLOAD->env)
@@ -2599,9 +2675,15 @@ PKL_PHASE_END_HANDLER
 
 PKL_PHASE_BEGIN_HANDLER (pkl_transl_pr_decl)
 {
-  /* The top-level environment is to be preserved.  */
+  /* The top-level environment is to be preserved.  Functions reusing
+     the code compiled for a previous definition are not
+     processed.  */
   if (pkl_env_toplevel_p (PKL_TRANS_ENV))
-    PKL_PASS_DONE;
+    {
+      if (PKL_AST_DECL_REUSED_P (PKL_PASS_NODE))
+        PKL_PASS_BREAK;
+      PKL_PASS_DONE;
+    }
   else
     {
       pkl_ast_node decl = PKL_PASS_NODE;
@@ -2712,6 +2794,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_transl =
   {
+    PKL_PHASE_NAME ("transl"),
     .initialize = pkl_trans_initialize,
     .finalize = pkl_trans_finalize,
 
@@ -3561,6 +3561,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_typify1 =
   {
+   PKL_PHASE_NAME ("typify1"),
    PKL_PHASE_PS_HANDLER (PKL_AST_SRC, pkl_typify_ps_src),
    PKL_PHASE_PR_HANDLER (PKL_AST_PROGRAM, pkl_typify_pr_program),
    PKL_PHASE_PS_HANDLER (PKL_AST_VAR, pkl_typify1_ps_var),
@@ -3655,7 +3656,7 @@ struct pkl_phase pkl_phase_typify1 =
 
 
 /* Determine the completeness of a type node and whether the type is
-   fallible.  */
+   fallible.  Also compute the static layout of struct types.  */
 
 PKL_PHASE_BEGIN_HANDLER (pkl_typify2_ps_type)
 {
@@ -3663,6 +3664,9 @@ PKL_PHASE_BEGIN_HANDLER (pkl_typify2_ps_type)
 
   PKL_AST_TYPE_COMPLETE (type) = pkl_ast_type_is_complete (type);
   PKL_AST_TYPE_FALLIBLE (type) = pkl_ast_type_is_fallible (type);
+
+  if (PKL_AST_TYPE_CODE2 (type) == PKL_TYPE_STRUCT)
+    pkl_ast_struct_type_layout (type);
 }
 PKL_PHASE_END_HANDLER
 
@@ -3732,6 +3736,7 @@ PKL_PHASE_END_HANDLER
 
 struct pkl_phase pkl_phase_typify2 =
   {
+   PKL_PHASE_NAME ("typify2"),
    PKL_PHASE_PS_HANDLER (PKL_AST_SRC, pkl_typify_ps_src),
    PKL_PHASE_PR_HANDLER (PKL_AST_PROGRAM, pkl_typify_pr_program),
    PKL_PHASE_PS_HANDLER (PKL_AST_TYPE, pkl_typify2_ps_type),
@@ -25,6 +25,8 @@
 #include <stdio.h> /* For fopen, etc */
 #include <stdlib.h>
 #include <string.h>
+#include <inttypes.h>
+#include <timespec.h>
 
 #include "basename-lgpl.h"
 
@@ -56,7 +58,17 @@
 
    ALIEN_DTOKEN_FN is the user-provided handler for delimited alien
    tokens.  This field is NULL if the user didn't register a
-   handler.  */
+   handler.
+
+   TIMER is the pass timer measuring the time spent in the compiler
+   phases.  TIMING_P is 1 if TIMER is to be used by the pass manager.
+   TIMER is kept after disabling timing so the measurements can be
+   retrieved later.
+
+   COMPILE_STATS_P is 1 if the compiler prints a compilation report
+   after executing every file not loaded by another file.  This
+   implies using TIMER.  NFILES is the number of files being
+   executed.  */
 
 struct pkl_compiler
 {
@@ -72,6 +84,10 @@ struct pkl_compiler
   int lexical_cuckolding_p;
   pkl_alien_token_handler_fn alien_token_fn;
   pkl_alien_dtoken_handler_fn alien_dtoken_fn;
+  int timing_p;
+  pkl_pass_timer timer;
+  int compile_stats_p;
+  int nfiles;
 };
 
 
@@ -182,11 +198,40 @@ out_of_memory:
   return NULL;
 }
 
+pkl_compiler
+pkl_clone (pkl_compiler compiler, pvm vm)
+{
+  pkl_compiler clone = calloc (1, sizeof (struct pkl_compiler));
+
+  if (!clone)
+    return NULL;
+
+  clone->env = pkl_env_clone_toplevel (compiler->env);
+  if (!clone->env)
+    {
+      free (clone);
+      return NULL;
+    }
+
+  clone->vm = vm;
+  clone->bootstrapped = compiler->bootstrapped;
+  clone->error_on_warning = compiler->error_on_warning;
+  clone->quiet_p = compiler->quiet_p;
+  clone->debug_p = compiler->debug_p;
+  clone->lexical_cuckolding_p = compiler->lexical_cuckolding_p;
+  clone->alien_token_fn = compiler->alien_token_fn;
+  clone->alien_dtoken_fn = compiler->alien_dtoken_fn;
+
+  return clone;
+}
+
 void
 pkl_free (pkl_compiler compiler)
 {
   pkl_env_free (compiler->env);
   free (compiler->last_ast_str);
+  if (compiler->timer)
+    pkl_pass_timer_free (compiler->timer);
   free (compiler);
 }
 
@@ -202,6 +247,7 @@ extern struct pkl_phase pkl_phase_typify1;
 extern struct pkl_phase pkl_phase_typify2;
 extern struct pkl_phase pkl_phase_promo;
 extern struct pkl_phase pkl_phase_fold;
+extern struct pkl_phase pkl_phase_inline;
 extern struct pkl_phase pkl_phase_gen;
 
 static pvm_program
@@ -211,6 +257,9 @@ rest_of_compilation (pkl_compiler compiler,
 {
   pvm_program program;
 
+  if (pkl_timer (compiler))
+    pkl_pass_timer_begin_program (pkl_timer (compiler));
+
 #define PKL_PHASE(NAME) &pkl_phase_##NAME,
 #define PKL_PASS(FLAGS, LEVEL)                                          \
   {                                                                     \
@@ -278,7 +327,7 @@ pkl_execute_buffer (pkl_compiler compiler,
     goto error;
 
   //  pvm_disassemble_program (program);
-  pvm_program_make_executable (program);
+  pkl_program_make_executable (compiler, program);
 
   /* Execute the program in the poke vm.  Note the return value is
      discarded.  */
@@ -336,7 +385,7 @@ pkl_compile_statement (pkl_compiler compiler,
    pkl_env_free (compiler->env);
    compiler->env = env;
    pkl_env_commit_renames (compiler->env);
-   pvm_program_make_executable (program);
+   pkl_program_make_executable (compiler, program);
 
    return program;
 
@@ -383,7 +432,7 @@ pkl_execute_statement (pkl_compiler compiler,
   if (program == NULL)
     goto error;
 
-  pvm_program_make_executable (program);
+  pkl_program_make_executable (compiler, program);
 
   /* Execute the routine in the poke vm.  */
   pvm_run (compiler->vm, program, val, exit_exception);
@@ -440,7 +489,7 @@ pkl_compile_expression (pkl_compiler compiler,
    pkl_env_free (compiler->env);
    compiler->env = env;
    pkl_env_commit_renames (compiler->env);
-   pvm_program_make_executable (program);
+   pkl_program_make_executable (compiler, program);
 
    return program;
 
@@ -487,7 +536,7 @@ pkl_execute_expression (pkl_compiler compiler,
   if (program == NULL)
     goto error;
 
-  pvm_program_make_executable (program);
+  pkl_program_make_executable (compiler, program);
 
   /* Execute the routine in the poke vm.  */
   pvm_run (compiler->vm, program, val, exit_exception);
@@ -508,9 +557,9 @@ pkl_execute_expression (pkl_compiler compiler,
   return 0;
 }
 
-int
-pkl_execute_file (pkl_compiler compiler, const char *fname,
-                  pvm_val *exit_exception)
+static int
+pkl_execute_file_1 (pkl_compiler compiler, const char *fname,
+                    pvm_val *exit_exception)
 {
   int ret;
   pkl_ast ast = NULL;
@@ -543,11 +592,20 @@ pkl_execute_file (pkl_compiler compiler, const char *fname,
   if (program == NULL)
     goto error;
 
-  pvm_program_make_executable (program);
+  pkl_program_make_executable (compiler, program);
   fclose (fp);
 
-  /* Execute the program in the poke vm.  */
-  pvm_run (compiler->vm, program, &val, exit_exception);
+  /* Execute the program in the poke vm.  This may happen while
+     parsing another file, so make sure the time spent running the
+     program is not charged to the parser.  */
+  {
+    pkl_pass_timer timer = pkl_timer (compiler);
+    struct pkl_pass_timer_entry *timer_entry
+      = pkl_pass_timer_enter (timer, NULL);
+
+    pvm_run (compiler->vm, program, &val, exit_exception);
+    pkl_pass_timer_leave (timer, timer_entry);
+  }
   pvm_destroy_program (program);
 
   if (*exit_exception == PVM_NULL)
@@ -566,6 +624,204 @@ pkl_execute_file (pkl_compiler compiler, const char *fname,
   return 0;
 }
 
+/* The compilation report printed if compile_stats_p is set in the
+   compiler is about the measurements done while executing a file.
+   The following struct holds the state of the timer before executing
+   the file.  */
+
+struct pkl_compile_stats
+{
+  struct timespec start;
+  size_t ndecls;
+  int nphases;
+  struct
+  {
+    const char *name;
+    uint64_t nsec;
+    uint64_t ncalls;
+  } phases[PKL_PASS_TIMER_MAX_ENTRIES];
+
+  /* The following fields are used while printing the report.  */
+  uint64_t compile_nsec;
+  struct pkl_compile_stats_decl
+  {
+    const char *name;
+    const char *source;
+    uint64_t nsec;
+    uint64_t nnodes;
+  } *decls;
+  size_t ndecls_report;
+};
+
+/* Number of declarations listed in the compilation report.  */
+#define PKL_COMPILE_STATS_MAX_DECLS 10
+
+static void
+pkl_compile_stats_save_phase (const char *phase, uint64_t nsec,
+                              uint64_t ncalls, void *data)
+{
+  struct pkl_compile_stats *stats = data;
+
+  stats->phases[stats->nphases].name = phase;
+  stats->phases[stats->nphases].nsec = nsec;
+  stats->phases[stats->nphases].ncalls = ncalls;
+  stats->nphases++;
+}
+
+static void
+pkl_compile_stats_begin (pkl_compiler compiler,
+                         struct pkl_compile_stats *stats)
+{
+  stats->nphases = 0;
+  pkl_pass_timer_map (compiler->timer, pkl_compile_stats_save_phase,
+                      stats);
+  stats->ndecls = pkl_pass_timer_ndecls (compiler->timer);
+  stats->start = current_timespec ();
+}
+
+static void
+pkl_compile_stats_print_phase (const char *phase, uint64_t nsec,
+                               uint64_t ncalls, void *data)
+{
+  struct pkl_compile_stats *stats = data;
+  int i;
+
+  for (i = 0; i < stats->nphases; ++i)
+    if (STREQ (stats->phases[i].name, phase))
+      {
+        nsec -= stats->phases[i].nsec;
+        ncalls -= stats->phases[i].ncalls;
+        break;
+      }
+
+  if (ncalls == 0 && nsec == 0)
+    return;
+
+  pk_printf ("  %-16s %12.3f %10" PRIu64 "\n", phase, nsec / 1e6, ncalls);
+}
+
+static void
+pkl_compile_stats_sum_phase (const char *phase, uint64_t nsec,
+                             uint64_t ncalls, void *data)
+{
+  struct pkl_compile_stats *stats = data;
+  int i;
+
+  for (i = 0; i < stats->nphases; ++i)
+    if (STREQ (stats->phases[i].name, phase))
+      {
+        nsec -= stats->phases[i].nsec;
+        break;
+      }
+
+  stats->compile_nsec += nsec;
+}
+
+static void
+pkl_compile_stats_save_decl (const char *name, const char *source,
+                             uint64_t nsec, uint64_t nnodes, void *data)
+{
+  struct pkl_compile_stats *stats = data;
+  struct pkl_compile_stats_decl *decl = &stats->decls[stats->ndecls_report++];
+
+  decl->name = name;
+  decl->source = source;
+  decl->nsec = nsec;
+  decl->nnodes = nnodes;
+}
+
+static int
+pkl_compile_stats_cmp_decls (const void *a, const void *b)
+{
+  const struct pkl_compile_stats_decl *da = a;
+  const struct pkl_compile_stats_decl *db = b;
+
+  return (da->nsec < db->nsec) - (da->nsec > db->nsec);
+}
+
+/* Print a report with the measurements done since STATS was filled
+   in by `pkl_compile_stats_begin' while executing the file FNAME.  */
+
+static void
+pkl_compile_stats_report (pkl_compiler compiler,
+                          struct pkl_compile_stats *stats,
+                          const char *fname)
+{
+  struct timespec now = current_timespec ();
+  uint64_t total_nsec
+    = ((uint64_t) (now.tv_sec - stats->start.tv_sec) * 1000000000
+       + now.tv_nsec - stats->start.tv_nsec);
+  size_t ndecls = pkl_pass_timer_ndecls (compiler->timer) - stats->ndecls;
+  size_t i;
+
+  stats->compile_nsec = 0;
+  pkl_pass_timer_map (compiler->timer, pkl_compile_stats_sum_phase,
+                      stats);
+  if (stats->compile_nsec > total_nsec)
+    stats->compile_nsec = total_nsec;
+
+  pk_printf ("compile stats for %s:\n", fname);
+  pk_printf ("  %-16s %12.3f ms\n", "total", total_nsec / 1e6);
+  pk_printf ("  %-16s %12.3f ms\n", "compilation",
+             stats->compile_nsec / 1e6);
+  pk_printf ("  %-16s %12.3f ms\n", "execution",
+             (total_nsec - stats->compile_nsec) / 1e6);
+
+  pk_printf ("  %-16s %12s %10s\n", "Phase", "Time (ms)", "Calls");
+  pkl_pass_timer_map (compiler->timer, pkl_compile_stats_print_phase,
+                      stats);
+
+  if (ndecls == 0)
+    return;
+
+  stats->decls = malloc (ndecls * sizeof (struct pkl_compile_stats_decl));
+  if (!stats->decls)
+    return;
+  stats->ndecls_report = 0;
+  pkl_pass_timer_map_decls (compiler->timer, stats->ndecls,
+                            pkl_compile_stats_save_decl, stats);
+  qsort (stats->decls, ndecls, sizeof (struct pkl_compile_stats_decl),
+         pkl_compile_stats_cmp_decls);
+
+  pk_printf ("  %-32s %12s %10s\n", "Declaration", "Time (ms)", "Nodes");
+  for (i = 0; i < ndecls && i < PKL_COMPILE_STATS_MAX_DECLS; ++i)
+    {
+      struct pkl_compile_stats_decl *decl = &stats->decls[i];
+
+      pk_printf ("  %-32s %12.3f %10" PRIu64,
+                 decl->name, decl->nsec / 1e6, decl->nnodes);
+      if (decl->source && !STREQ (decl->source, fname))
+        pk_printf ("  (%s)", last_component (decl->source));
+      pk_puts ("\n");
+    }
+  if (ndecls > PKL_COMPILE_STATS_MAX_DECLS)
+    pk_printf ("  (%zu more declarations)\n",
+               ndecls - PKL_COMPILE_STATS_MAX_DECLS);
+
+  free (stats->decls);
+}
+
+int
+pkl_execute_file (pkl_compiler compiler, const char *fname,
+                  pvm_val *exit_exception)
+{
+  struct pkl_compile_stats stats;
+  int report_p = compiler->compile_stats_p && compiler->nfiles == 0;
+  int ret;
+
+  if (report_p)
+    pkl_compile_stats_begin (compiler, &stats);
+
+  compiler->nfiles++;
+  ret = pkl_execute_file_1 (compiler, fname, exit_exception);
+  compiler->nfiles--;
+
+  if (report_p && ret)
+    pkl_compile_stats_report (compiler, &stats, fname);
+
+  return ret;
+}
+
 pkl_env
 pkl_get_env (pkl_compiler compiler)
 {
@@ -627,6 +883,86 @@ pkl_set_debug_p (pkl_compiler compiler, int debug_p)
   compiler->debug_p = debug_p;
 }
 
+int
+pkl_timing_p (pkl_compiler compiler)
+{
+  return compiler->timing_p;
+}
+
+int
+pkl_set_timing_p (pkl_compiler compiler, int timing_p)
+{
+  if (timing_p && !compiler->timer)
+    {
+      compiler->timer = pkl_pass_timer_new ();
+      if (!compiler->timer)
+        return 0;
+    }
+
+  compiler->timing_p = timing_p;
+  return 1;
+}
+
+struct pkl_pass_timer *
+pkl_timer (pkl_compiler compiler)
+{
+  return ((compiler->timing_p || compiler->compile_stats_p)
+          ? compiler->timer : NULL);
+}
+
+int
+pkl_compile_stats_p (pkl_compiler compiler)
+{
+  return compiler->compile_stats_p;
+}
+
+int
+pkl_set_compile_stats_p (pkl_compiler compiler, int compile_stats_p)
+{
+  if (compile_stats_p && !compiler->timer)
+    {
+      compiler->timer = pkl_pass_timer_new ();
+      if (!compiler->timer)
+        return 0;
+    }
+
+  compiler->compile_stats_p = compile_stats_p;
+  return 1;
+}
+
+void
+pkl_program_make_executable (pkl_compiler compiler, pvm_program program)
+{
+  pkl_pass_timer timer = pkl_timer (compiler);
+  struct pkl_pass_timer_entry *timer_entry
+    = pkl_pass_timer_enter (timer, "jitter");
+
+  pvm_program_make_executable (program);
+  pkl_pass_timer_leave (timer, timer_entry);
+}
+
+void
+pkl_phase_times (pkl_compiler compiler, pkl_phase_time_fn fn,
+                 void *data)
+{
+  if (compiler->timer)
+    pkl_pass_timer_map (compiler->timer, fn, data);
+}
+
+void
+pkl_decl_times (pkl_compiler compiler, pkl_decl_time_fn fn, void *data)
+{
+  if (compiler->timer)
+    pkl_pass_timer_map_decls (compiler->timer, 0, fn, data);
+}
+
+void
+pkl_reset_phase_times (pkl_compiler compiler)
+{
+  if (compiler->timer)
+    pkl_pass_timer_reset (compiler->timer);
+}
+
 char *
 pkl_get_last_ast_str (pkl_compiler compiler)
 {
@@ -698,6 +1034,25 @@ pkl_compile_call (pkl_compiler compiler, pvm_val cls, pvm_val *ret,
   return program;
 }
 
+pvm_program
+pkl_compile_prepared_call (pkl_compiler compiler, pvm_val cls, int narg)
+{
+  pkl_asm pasm;
+  int i;
+
+  pasm = pkl_asm_new (NULL /* ast */, compiler, 1 /* prologue */);
+
+  /* Push the arguments for the function.  */
+  for (i = 0; i < narg; ++i)
+    pkl_asm_insn (pasm, PKL_INSN_PUSHARG, (unsigned int) i);
+
+  /* Call the closure.  */
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, cls);
+  pkl_asm_insn (pasm, PKL_INSN_CALL);
+
+  return pkl_asm_finish (pasm, 1 /* epilogue */);
+}
+
 pvm
 pkl_get_vm (pkl_compiler compiler)
 {
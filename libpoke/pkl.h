@@ -89,6 +89,16 @@
 pkl_compiler pkl_new (pvm vm, const char *rt_path,
                       const char *config_path, uint32_t flags);
 
+/* Create a new compiler that is a clone of COMPILER, generating code
+   for the virtual machine VM.  VM shall be a clone of the virtual
+   machine of COMPILER, as created by pvm_clone.  The top-level
+   compile-time environment of COMPILER is copied, so declarations
+   made with either compiler are not visible to the other.
+
+   Return NULL in case of memory exhaustion.  */
+
+pkl_compiler pkl_clone (pkl_compiler compiler, pvm vm);
+
 void pkl_free (pkl_compiler compiler);
 
 /* Compile an execute a Poke program from the given file FNAME.
@@ -175,6 +185,17 @@ pvm_program pkl_compile_expression (pkl_compiler compiler,
 pvm_program pkl_compile_call (pkl_compiler compiler, pvm_val cls, pvm_val *ret,
                               int narg, va_list ap);
 
+/* Like pkl_compile_call, but the NARG actual arguments are not known
+   at compile-time: the program pushes the arguments it gets from
+   pvm_run_args, so it can be run many times with different
+   arguments.
+
+   Return the compiled PVM program, or NULL if there is a problem
+   performing the operation.  */
+
+pvm_program pkl_compile_prepared_call (pkl_compiler compiler, pvm_val cls,
+                                       int narg);
+
 /* Return the VM associated with COMPILER.  */
 
 pvm pkl_get_vm (pkl_compiler compiler);
@@ -242,6 +263,67 @@ void pkl_set_debug_p (pkl_compiler compiler, int debug_p);
 
 char *pkl_get_last_ast_str (pkl_compiler compiler);
 
+/* Set/get the timing_p flag in/from the compiler.  If this flag is
+   set, the compiler measures the time spent in every phase of the
+   compilation.  Setting the flag doesn't discard the measurements
+   done so far.
+
+   Return 0 if there is not enough memory to enable timing, 1
+   otherwise.  */
+
+int pkl_timing_p (pkl_compiler compiler);
+int pkl_set_timing_p (pkl_compiler compiler, int timing_p);
+
+/* Return the pass timer to be used by the pass manager, or NULL if
+   the compiler is not measuring compilation times.  */
+
+struct pkl_pass_timer *pkl_timer (pkl_compiler compiler);
+
+/* Call FN for every compiler phase measured since timing was first
+   enabled or last reset, passing the name of the phase, the number
+   of nanoseconds spent in it, the number of node handlers of the
+   phase that were invoked and DATA.  */
+
+typedef void (*pkl_phase_time_fn) (const char *phase, uint64_t nsec,
+                                   uint64_t ncalls, void *data);
+
+void pkl_phase_times (pkl_compiler compiler, pkl_phase_time_fn fn,
+                      void *data);
+
+/* Call FN for every top-level declaration compiled since timing was
+   first enabled or last reset, passing the name of the declaration,
+   the file where it was defined or NULL, the number of nanoseconds
+   spent compiling it, the number of AST nodes in it and DATA.  */
+
+typedef void (*pkl_decl_time_fn) (const char *name, const char *source,
+                                  uint64_t nsec, uint64_t nnodes,
+                                  void *data);
+
+void pkl_decl_times (pkl_compiler compiler, pkl_decl_time_fn fn,
+                     void *data);
+
+/* Discard the compilation times measured so far.  */
+
+void pkl_reset_phase_times (pkl_compiler compiler);
+
+/* Set/get the compile_stats_p flag in/from the compiler.  If this
+   flag is set, the compiler measures compilation times like when
+   timing is enabled, and prints a report with the time spent in every
+   phase and in the declarations after executing every file that is
+   not loaded by another file.
+
+   Return 0 if there is not enough memory to enable compile stats, 1
+   otherwise.  */
+
+int pkl_compile_stats_p (pkl_compiler compiler);
+int pkl_set_compile_stats_p (pkl_compiler compiler, int compile_stats_p);
+
+/* Make PROGRAM executable, charging the time it takes to the "jitter"
+   pseudo phase of the compiler timer.  */
+
+void pkl_program_make_executable (pkl_compiler compiler,
+                                  pvm_program program);
+
 /* Get/install a handler for alien tokens.  */
 
 #define PKL_ALIEN_TOKEN_IDENTIFIER 0
@@ -30,10 +30,19 @@ struct pk_term_if_internal
   pk_compiler pkc;
 };
 
+/* LIBPOKE_THREAD_TERM_IF points to the terminal interface of the last
+   compiler created by the current thread, if any, so compilers used by
+   different threads write to their own terminals.  Threads that
+   didn't create any compiler use LIBPOKE_TERM_IF, the terminal
+   interface of the last compiler created in the process.  */
+
 extern struct pk_term_if_internal libpoke_term_if;
+extern _Thread_local struct pk_term_if_internal *libpoke_thread_term_if;
 
-#define PKT_IF (&libpoke_term_if.term_if)
-#define PKT_PKC (libpoke_term_if.pkc)
+#define PKT_CUR                                                 \
+  (libpoke_thread_term_if ? libpoke_thread_term_if : &libpoke_term_if)
+#define PKT_IF (&PKT_CUR->term_if)
+#define PKT_PKC (PKT_CUR->pkc)
 
 /* Terminal interface for Poke compiler.  */
 
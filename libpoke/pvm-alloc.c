@@ -19,19 +19,78 @@
 
 #include <config.h>
 #include <assert.h>
+#include <stdlib.h>
+#include <time.h>
+#include <pthread.h>
 
 #define GC_THREADS
 #include <gc/gc.h>
+#include <gc/gc_mark.h>
 
 #include "pvm.h"
 #include "pvm-val.h"
+#include "pvm-alloc.h"
+
+/* Statistics kept by the functions below.  The collection events are
+   only notified by newer versions of the collector, so the pause
+   times are zero with older versions.  */
+
+static uint64_t pvm_alloc_pause_ns;
+static uint64_t pvm_alloc_max_pause_ns;
+static uint64_t pvm_alloc_finalizers;
+static int pvm_alloc_incremental_p;
+
+/* State of the allocation regions.  The collector is disabled for the
+   whole process while any region is active, so the regions begun by
+   all the threads are accounted together.
+
+   PVM_ALLOC_REGION_DEPTH is the number of active regions, and
+   PVM_ALLOC_REGION_P is set while the collector is disabled because
+   of them.  PVM_ALLOC_REGION_BYTES is the number of bytes allocated
+   since then.  Once it exceeds PVM_ALLOC_REGION_MAX_BYTES the
+   collector is enabled again until all the active regions end, so the
+   heap doesn't grow without bound.  PVM_ALLOC_REGION_LOCK protects
+   the transitions of these variables.  */
+
+#define PVM_ALLOC_REGION_MAX_BYTES ((size_t) 64 * 1024 * 1024)
+
+static pthread_mutex_t pvm_alloc_region_lock = PTHREAD_MUTEX_INITIALIZER;
+static int pvm_alloc_region_depth;
+static int pvm_alloc_region_p;
+static size_t pvm_alloc_region_bytes;
+
+static void
+pvm_alloc_region_account (size_t size)
+{
+  if (__atomic_add_fetch (&pvm_alloc_region_bytes, size, __ATOMIC_RELAXED)
+      <= PVM_ALLOC_REGION_MAX_BYTES)
+    return;
+
+  pthread_mutex_lock (&pvm_alloc_region_lock);
+  if (pvm_alloc_region_p)
+    {
+      __atomic_store_n (&pvm_alloc_region_p, 0, __ATOMIC_RELAXED);
+      GC_enable ();
+    }
+  pthread_mutex_unlock (&pvm_alloc_region_lock);
+}
 
 void *
 pvm_alloc (size_t size)
 {
+  if (__atomic_load_n (&pvm_alloc_region_p, __ATOMIC_RELAXED))
+    pvm_alloc_region_account (size);
   return GC_MALLOC (size);
 }
 
+void *
+pvm_alloc_atomic (size_t size)
+{
+  if (__atomic_load_n (&pvm_alloc_region_p, __ATOMIC_RELAXED))
+    pvm_alloc_region_account (size);
+  return GC_MALLOC_ATOMIC (size);
+}
+
 void *
 pvm_alloc_uncollectable (size_t size)
 {
@@ -55,6 +114,12 @@ pvm_alloc_strdup (const char *string)
   return GC_strdup (string);
 }
 
+size_t
+pvm_alloc_size (void *ptr)
+{
+  return ptr ? GC_size (ptr) : 0;
+}
+
 static void
 pvm_alloc_finalize_closure (void *object, void *client_data)
 {
@@ -63,6 +128,8 @@ pvm_alloc_finalize_closure (void *object, void *client_data)
      themselves, be it directly or indirectly.  */
   /* pvm_cls cls = (pvm_cls) object; */
   /*  pvm_destroy_program (PVM_VAL_CLS_PROGRAM (cls)); */
+  /* Finalizers are run by whatever thread happens to allocate.  */
+  __atomic_fetch_add (&pvm_alloc_finalizers, 1, __ATOMIC_RELAXED);
 }
 
 void *
@@ -75,34 +142,13 @@ pvm_alloc_cls (void)
   return cls;
 }
 
-static void
-pvm_alloc_finalize_boxed (void *object, void *client_data)
-{
-  /* Finalizer for structs and arrays, which are boxed values that
-     may be mapped in an IOS.  If it was mapped in an IOS that is
-     still live, de-register it from the IOS' range table.
-     Note that the range table holds pvm_vals, i.e. the box rather
-     than the struct/array in the box.  Therefore de-registering
-     the value requires the box rather than the struct or array.  */
-  pvm_val_box box = (pvm_val_box) object;
-  pvm_val val = PVM_BOX (box);
-
-  if (PVM_IS_SCT (val)
-      && PVM_VAL_SCT_MAPPED_P (val)
-      && PVM_VAL_SCT_IOSLIVE_P (val))
-    ios_deregister_range (val, PVM_VAL_SCT_IOS_PTR (val),
-                          PVM_VAL_INTEGRAL (PVM_VAL_SCT_OFFSET (val)));
-  else if (PVM_IS_ARR (val)
-           && PVM_VAL_ARR_MAPPED_P (val)
-           && PVM_VAL_ARR_IOSLIVE_P (val))
-    ios_deregister_range (val, PVM_VAL_ARR_IOS_PTR (val),
-                          PVM_VAL_INTEGRAL (PVM_VAL_ARR_OFFSET (val)));
-}
-
 void *
 pvm_alloc_boxed (uint8_t tag)
 {
-  /* Allocator for boxed structs/arrays.  See the finalizer for more.  */
+  /* Allocator for boxed structs/arrays.  Note that no finalizer is
+     needed to deregister mapped values from the range tables of their
+     IO spaces, since the range tables hold weak references to the
+     values.  See ios-range.c.  */
   pvm_val_box box = pvm_alloc (sizeof (struct pvm_val_box));
   if (tag == PVM_VAL_TAG_SCT)
     {
@@ -118,12 +164,130 @@ pvm_alloc_boxed (uint8_t tag)
     assert (false); /* Only used for struct and arrays.  */
 
   PVM_VAL_BOX_TAG (box) = tag;
-
-  GC_register_finalizer_no_order (box, pvm_alloc_finalize_boxed, NULL,
-                                  NULL, NULL);
   return box;
 }
 
+/* Stacks registered with pvm_alloc_add_gc_stack.  The list is only
+   modified while holding the lock of the collector, so it is
+   consistent when the collector walks it.  */
+
+struct pvm_alloc_stack
+{
+  char *memory;
+  size_t size;
+  const int *active_p;
+  void *const *top_p;
+  size_t margin;
+  struct pvm_alloc_stack *next;
+};
+
+static struct pvm_alloc_stack *pvm_alloc_stacks;
+static GC_push_other_roots_proc pvm_alloc_prev_push_other_roots;
+
+/* Called by the collector, with the world stopped, when it pushes the
+   roots.  */
+
+static void
+pvm_alloc_push_stacks (void)
+{
+  struct pvm_alloc_stack *s;
+
+  for (s = pvm_alloc_stacks; s != NULL; s = s->next)
+    if (*s->active_p)
+      {
+        char *top = *s->top_p;
+        size_t used = (top > s->memory ? top - s->memory : 0) + s->margin;
+
+        GC_push_all (s->memory, s->memory + (used < s->size
+                                                ? used : s->size));
+      }
+
+  if (pvm_alloc_prev_push_other_roots)
+    pvm_alloc_prev_push_other_roots ();
+}
+
+static void *
+pvm_alloc_link_stack (void *data)
+{
+  struct pvm_alloc_stack *s = data;
+
+  s->next = pvm_alloc_stacks;
+  pvm_alloc_stacks = s;
+  return NULL;
+}
+
+static void *
+pvm_alloc_unlink_stack (void *data)
+{
+  struct pvm_alloc_stack **s;
+
+  for (s = &pvm_alloc_stacks; *s != NULL; s = &(*s)->next)
+    if ((*s)->memory == data)
+      {
+        struct pvm_alloc_stack *found = *s;
+
+        *s = found->next;
+        return found;
+      }
+
+  return NULL;
+}
+
+void
+pvm_alloc_add_gc_stack (void *pointer, size_t size, const int *active_p,
+                        void *const *top_p, size_t margin)
+{
+  struct pvm_alloc_stack *s = malloc (sizeof (struct pvm_alloc_stack));
+
+  assert (s != NULL);
+  s->memory = pointer;
+  s->size = size;
+  s->active_p = active_p;
+  s->top_p = top_p;
+  s->margin = margin;
+  GC_call_with_alloc_lock (pvm_alloc_link_stack, s);
+}
+
+void
+pvm_alloc_remove_gc_stack (void *pointer)
+{
+  free (GC_call_with_alloc_lock (pvm_alloc_unlink_stack, pointer));
+}
+
+#if GC_VERSION_MAJOR >= 8
+
+static uint64_t
+pvm_alloc_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Called by the collector at several points of every collection.
+   Note that the world may be stopped when this is called, so this
+   shall not allocate memory, nor lock anything.  */
+
+static void
+pvm_alloc_collection_event (GC_EventType event)
+{
+  static uint64_t start;
+
+  if (event == GC_EVENT_START)
+    start = pvm_alloc_now ();
+  else if (event == GC_EVENT_END && start != 0)
+    {
+      uint64_t pause = pvm_alloc_now () - start;
+
+      pvm_alloc_pause_ns += pause;
+      if (pause > pvm_alloc_max_pause_ns)
+        pvm_alloc_max_pause_ns = pause;
+      start = 0;
+    }
+}
+
+#endif
 
 void
 pvm_alloc_initialize ()
@@ -136,6 +300,17 @@ pvm_alloc_initialize ()
       GC_INIT ();
       GC_allow_register_threads ();
     }
+
+#if GC_VERSION_MAJOR >= 8
+  GC_set_on_collection_event (pvm_alloc_collection_event);
+#endif
+
+  /* Note that the subsystem may be initialized several times.  */
+  if (GC_get_push_other_roots () != pvm_alloc_push_stacks)
+    {
+      pvm_alloc_prev_push_other_roots = GC_get_push_other_roots ();
+      GC_set_push_other_roots (pvm_alloc_push_stacks);
+    }
 }
 
 void
@@ -184,3 +359,95 @@ pvm_alloc_gc ()
 {
   GC_gcollect ();
 }
+
+void
+pvm_alloc_stats (struct pvm_alloc_stats *stats)
+{
+  GC_word heap_size, free_bytes, unmapped_bytes, bytes_since_gc,
+    total_bytes;
+
+  GC_get_heap_usage_safe (&heap_size, &free_bytes, &unmapped_bytes,
+                          &bytes_since_gc, &total_bytes);
+
+  stats->heap_size = heap_size;
+  stats->free_bytes = free_bytes;
+  stats->unmapped_bytes = unmapped_bytes;
+  stats->bytes_since_gc = bytes_since_gc;
+  stats->total_bytes = total_bytes;
+  stats->collections = GC_get_gc_no ();
+  stats->pause_ns = pvm_alloc_pause_ns;
+  stats->max_pause_ns = pvm_alloc_max_pause_ns;
+  stats->finalizers = __atomic_load_n (&pvm_alloc_finalizers,
+                                      __ATOMIC_RELAXED);
+}
+
+int
+pvm_alloc_incremental ()
+{
+  return pvm_alloc_incremental_p;
+}
+
+int
+pvm_alloc_set_incremental (int incremental_p)
+{
+  if (!incremental_p)
+    return !pvm_alloc_incremental_p;
+
+  if (!pvm_alloc_incremental_p)
+    {
+      GC_enable_incremental ();
+      pvm_alloc_incremental_p = 1;
+    }
+  return 1;
+}
+
+unsigned int
+pvm_alloc_free_space_divisor ()
+{
+  return GC_get_free_space_divisor ();
+}
+
+void
+pvm_alloc_set_free_space_divisor (unsigned int divisor)
+{
+  assert (divisor > 0);
+  GC_set_free_space_divisor (divisor);
+}
+
+unsigned int
+pvm_alloc_full_freq ()
+{
+  return GC_get_full_freq ();
+}
+
+void
+pvm_alloc_set_full_freq (unsigned int full_freq)
+{
+  GC_set_full_freq (full_freq);
+}
+
+void
+pvm_alloc_region_begin ()
+{
+  pthread_mutex_lock (&pvm_alloc_region_lock);
+  if (pvm_alloc_region_depth++ == 0)
+    {
+      __atomic_store_n (&pvm_alloc_region_bytes, 0, __ATOMIC_RELAXED);
+      __atomic_store_n (&pvm_alloc_region_p, 1, __ATOMIC_RELAXED);
+      GC_disable ();
+    }
+  pthread_mutex_unlock (&pvm_alloc_region_lock);
+}
+
+void
+pvm_alloc_region_end ()
+{
+  pthread_mutex_lock (&pvm_alloc_region_lock);
+  assert (pvm_alloc_region_depth > 0);
+  if (--pvm_alloc_region_depth == 0 && pvm_alloc_region_p)
+    {
+      __atomic_store_n (&pvm_alloc_region_p, 0, __ATOMIC_RELAXED);
+      GC_enable ();
+    }
+  pthread_mutex_unlock (&pvm_alloc_region_lock);
+}
@@ -21,6 +21,7 @@
 #define PVM_ALLOC_H
 
 #include <config.h>
+#include <stdint.h>
 #include <gc.h>
 
 /* This file provides memory allocation services to the PVM code.  */
@@ -39,6 +40,20 @@ void pvm_alloc_finalize (void);
 void pvm_alloc_add_gc_roots (void *pointer, size_t nelems);
 void pvm_alloc_remove_gc_roots (void *pointer, size_t nelems);
 
+/* Register/unregister the SIZE bytes at POINTER as roots for the
+   garbage-collector, which are only scanned while the integer
+   pointed by ACTIVE_P is not zero.  This is intended for stacks that
+   are empty most of the time.  The integer shall only be changed by
+   the thread which registered the roots.
+
+   Only the bytes below the address pointed by TOP_P, plus MARGIN
+   bytes, are scanned.  A null top means the stack is empty.  */
+
+void pvm_alloc_add_gc_stack (void *pointer, size_t size,
+                             const int *active_p,
+                             void *const *top_p, size_t margin);
+void pvm_alloc_remove_gc_stack (void *pointer);
+
 /* Allocate SIZE bytes and return a pointer to the allocated memory.
    SIZE has the same semantics as in malloc(3).  On error, return
    NULL.  */
@@ -57,6 +72,15 @@ void *pvm_alloc_uncollectable (size_t size)
   __attribute__ ((malloc))
   __attribute__ ((alloc_size (1)));
 
+/* Allocate SIZE bytes and return a pointer to the allocated memory.
+   This function is identical to pvm_alloc, except that the resulting
+   object shall not contain pointers to other collectable objects,
+   since the collector doesn't scan it.  On error, return NULL.  */
+
+void *pvm_alloc_atomic (size_t size)
+  __attribute__ ((malloc))
+  __attribute__ ((alloc_size (1)));
+
 void pvm_free_uncollectable (void *ptr);
 
 
@@ -84,14 +108,83 @@ void *pvm_alloc_boxed (uint8_t tag)
 char *pvm_alloc_strdup (const char *string)
   __attribute__ ((malloc));
 
+/* Return the number of bytes actually used by the object PTR, which
+   shall have been allocated by one of the functions above.  This may
+   be bigger than the size requested to allocate it.  Return 0 if PTR
+   is NULL.  */
+
+size_t pvm_alloc_size (void *ptr);
+
 /* Forced collection.  */
 
 void pvm_alloc_gc (void);
 
+/* Statistics about the garbage collector.  Note that the collector,
+   and therefore these statistics, are shared by all the virtual
+   machines in the process.  */
+
+struct pvm_alloc_stats
+{
+  uint64_t heap_size;      /* Size of the heap, in bytes.  */
+  uint64_t free_bytes;     /* Free bytes in the heap.  */
+  uint64_t unmapped_bytes; /* Bytes of the heap returned to the OS.  */
+  uint64_t bytes_since_gc; /* Bytes allocated since the last
+                              collection.  */
+  uint64_t total_bytes;    /* Bytes allocated since the collector was
+                              initialized.  */
+  uint64_t collections;    /* Number of collections.  */
+  uint64_t pause_ns;       /* Total time spent in collections, in
+                              nanoseconds.  */
+  uint64_t max_pause_ns;   /* Longest collection, in nanoseconds.  */
+  uint64_t finalizers;     /* Number of finalizers run.  */
+};
+
+void pvm_alloc_stats (struct pvm_alloc_stats *stats);
+
+/* Get/set whether the collector works in incremental mode.  In this
+   mode the collector is generational, and does most of its work in
+   small steps interleaved with the allocations, which makes the
+   pauses shorter.  Once enabled, the incremental mode can't be
+   disabled.  pvm_alloc_set_incremental returns 0 if the requested
+   mode can't be set, 1 otherwise.  */
+
+int pvm_alloc_incremental (void);
+int pvm_alloc_set_incremental (int incremental_p);
+
+/* Get/set the free space divisor of the collector.  The heap is
+   grown, instead of collecting, when the memory allocated since the
+   last collection is bigger than the size of the heap divided by
+   this number.  Bigger values mean smaller heaps and more frequent
+   collections.  DIVISOR shall be bigger than zero.  */
+
+unsigned int pvm_alloc_free_space_divisor (void);
+void pvm_alloc_set_free_space_divisor (unsigned int divisor);
+
+/* Get/set the number of partial collections done between full
+   collections when the collector works in incremental mode.  */
+
+unsigned int pvm_alloc_full_freq (void);
+void pvm_alloc_set_full_freq (unsigned int full_freq);
+
+/* Begin/end an allocation region.  The garbage collector is not run
+   while in a region, so the memory allocated in the region, most of
+   which is usually used by temporary values, is reclaimed afterwards
+   in bulk, in a single collection.  Note that this means that the
+   heap keeps growing while in a region, so regions should only be
+   used for bounded computations.  Regions can be nested.
+
+   The collector is disabled for the whole process while any region
+   is active, in any thread.  Once a fixed amount of memory has been
+   allocated in the active regions, the collector is enabled again
+   until all of them end.  */
+
+void pvm_alloc_region_begin (void);
+void pvm_alloc_region_end (void);
+
 /* Register/unregister a new thread whose stack that may contain PVM
    values.  This is used for memory management.  */
 
-int pvm_alloc_register_thread (void);
-int pvm_alloc_unregister_thread (void);
+void pvm_alloc_register_thread (void);
+void pvm_alloc_unregister_thread (void);
 
 #endif /* ! PVM_ALLOC_H */
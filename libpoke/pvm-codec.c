@@ -0,0 +1,1012 @@
+/* pvm-codec.c - Checksums and encodings for the PVM.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "pvm-codec.h"
+#include "pk-utils.h"
+
+/* Data located in IO spaces is processed in chunks of this many
+   bytes.  The size of a chunk should be a multiple of 3, so the base64
+   encoding of a chunk doesn't need padding.  */
+
+#define PVM_CODEC_CHUNK_SIZE (3 * 21846)
+
+/* The CRC-32 is computed eight bytes at a time, using the "slicing by
+   8" technique: crc32_table[K][B] is the CRC of the byte B followed
+   by K zero bytes.  */
+
+static uint32_t crc32_table[8][256];
+
+/* The CRC-16 is computed one byte at a time.  */
+
+static uint16_t crc16_ccitt_table[256];
+
+static const char base64_chars[]
+  = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+/* base64_values[C] is the value of the base64 character C, or one of
+   the following codes.  */
+
+#define B64_INVALID 0x40
+#define B64_PAD     0x41
+#define B64_SPACE   0x42
+
+static uint8_t base64_values[256];
+
+void
+pvm_codec_initialize (void)
+{
+  int i, k;
+
+  for (i = 0; i < 256; ++i)
+    {
+      uint32_t c = i;
+      uint16_t d = i << 8;
+
+      for (k = 0; k < 8; ++k)
+        {
+          c = (c & 1) ? 0xedb88320U ^ (c >> 1) : c >> 1;
+          d = (d & 0x8000) ? 0x1021 ^ (d << 1) : d << 1;
+        }
+
+      crc32_table[0][i] = c;
+      crc16_ccitt_table[i] = d;
+    }
+
+  for (i = 0; i < 256; ++i)
+    for (k = 1; k < 8; ++k)
+      crc32_table[k][i]
+        = (crc32_table[k - 1][i] >> 8)
+          ^ crc32_table[0][crc32_table[k - 1][i] & 0xff];
+
+  memset (base64_values, B64_INVALID, sizeof (base64_values));
+  for (i = 0; i < 64; ++i)
+    base64_values[(unsigned char) base64_chars[i]] = i;
+  base64_values['='] = B64_PAD;
+  base64_values[' '] = B64_SPACE;
+}
+
+static uint32_t
+crc32_update (uint32_t crc, const uint8_t *buf, size_t len)
+{
+  while (len >= 8)
+    {
+      uint32_t lo = crc ^ ((uint32_t) buf[0] | (uint32_t) buf[1] << 8
+                           | (uint32_t) buf[2] << 16
+                           | (uint32_t) buf[3] << 24);
+
+      crc = crc32_table[7][lo & 0xff]
+            ^ crc32_table[6][(lo >> 8) & 0xff]
+            ^ crc32_table[5][(lo >> 16) & 0xff]
+            ^ crc32_table[4][lo >> 24]
+            ^ crc32_table[3][buf[4]]
+            ^ crc32_table[2][buf[5]]
+            ^ crc32_table[1][buf[6]]
+            ^ crc32_table[0][buf[7]];
+      buf += 8;
+      len -= 8;
+    }
+
+  while (len-- > 0)
+    crc = crc32_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+  return crc;
+}
+
+static uint32_t
+crc16_ccitt_update (uint32_t crc, const uint8_t *buf, size_t len)
+{
+  uint16_t c = crc;
+
+  while (len-- > 0)
+    c = crc16_ccitt_table[(c >> 8) ^ *buf++] ^ (uint16_t) (c << 8);
+
+  return c;
+}
+
+uint32_t
+pvm_codec_crc (enum pvm_codec_crc kind, uint32_t crc,
+               const uint8_t *buf, size_t len)
+{
+  switch (kind)
+    {
+    case PVM_CODEC_CRC32:
+      return crc32_update (crc, buf, len);
+    case PVM_CODEC_CRC16_CCITT:
+      return crc16_ccitt_update (crc, buf, len);
+    default:
+      PK_UNREACHABLE ();
+    }
+}
+
+int
+pvm_codec_crc_ios (enum pvm_codec_crc kind, uint32_t *crc,
+                   ios io, ios_off offset, uint64_t size)
+{
+  uint8_t buf[PVM_CODEC_CHUNK_SIZE];
+
+  while (size > 0)
+    {
+      size_t count = size < sizeof (buf) ? size : sizeof (buf);
+      int ret = ios_read_bytes (io, offset, 0, buf, count);
+
+      if (ret != IOS_OK)
+        return ret;
+
+      *crc = pvm_codec_crc (kind, *crc, buf, count);
+      offset += count * 8;
+      size -= count;
+    }
+
+  return IOS_OK;
+}
+
+/* Encode LEN bytes from SRC into DST, which is not null-terminated.
+   Return a pointer to the character following the encoded data.  */
+
+static char *
+base64_encode (const uint8_t *src, size_t len, char *dst)
+{
+  for (; len >= 3; src += 3, len -= 3)
+    {
+      uint32_t v = (uint32_t) src[0] << 16 | (uint32_t) src[1] << 8 | src[2];
+
+      *dst++ = base64_chars[v >> 18];
+      *dst++ = base64_chars[(v >> 12) & 0x3f];
+      *dst++ = base64_chars[(v >> 6) & 0x3f];
+      *dst++ = base64_chars[v & 0x3f];
+    }
+
+  if (len > 0)
+    {
+      uint32_t v = (uint32_t) src[0] << 16;
+
+      if (len == 2)
+        v |= (uint32_t) src[1] << 8;
+
+      *dst++ = base64_chars[v >> 18];
+      *dst++ = base64_chars[(v >> 12) & 0x3f];
+      *dst++ = len == 2 ? base64_chars[(v >> 6) & 0x3f] : '=';
+      *dst++ = '=';
+    }
+
+  return dst;
+}
+
+void
+pvm_codec_base64_encode (const uint8_t *src, size_t len, char *dst)
+{
+  *base64_encode (src, len, dst) = '\0';
+}
+
+int
+pvm_codec_base64_encode_ios (ios io, ios_off offset, uint64_t size,
+                             char *dst)
+{
+  uint8_t buf[PVM_CODEC_CHUNK_SIZE];
+
+  *dst = '\0';
+  while (size > 0)
+    {
+      size_t count = size < sizeof (buf) ? size : sizeof (buf);
+      int ret = ios_read_bytes (io, offset, 0, buf, count);
+
+      if (ret != IOS_OK)
+        return ret;
+
+      dst = base64_encode (buf, count, dst);
+      *dst = '\0';
+      offset += count * 8;
+      size -= count;
+    }
+
+  return IOS_OK;
+}
+
+/* Spaces are allowed anywhere in the input, which may end after an
+   incomplete quantum.  Padding may be incomplete, but it can only be
+   followed by spaces.  */
+
+int
+pvm_codec_base64_decode (const char *src, uint8_t *dst, size_t *len,
+                         size_t *pos)
+{
+  const unsigned char *s = (const unsigned char *) src;
+  size_t i = 0, n = 0;
+  uint32_t acc = 0;
+  int state = 0;
+
+  /* Fast path: four valid characters at a time.  */
+  for (;;)
+    {
+      uint8_t a, b, c, d;
+
+      /* Skip spaces.  */
+      while (base64_values[s[i]] == B64_SPACE)
+        i++;
+
+      if ((a = base64_values[s[i]]) >= 0x40
+          || (b = base64_values[s[i + 1]]) >= 0x40
+          || (c = base64_values[s[i + 2]]) >= 0x40
+          || (d = base64_values[s[i + 3]]) >= 0x40)
+        break;
+
+      acc = (uint32_t) a << 18 | (uint32_t) b << 12 | (uint32_t) c << 6 | d;
+      dst[n++] = acc >> 16;
+      dst[n++] = acc >> 8;
+      dst[n++] = acc;
+      i += 4;
+    }
+
+  /* Slow path: the remaining characters, which may include padding,
+     blanks and invalid characters.  */
+  acc = 0;
+  for (; s[i] != '\0'; ++i)
+    {
+      uint8_t v = base64_values[s[i]];
+
+      if (v == B64_SPACE)
+        continue;
+
+      if (v == B64_INVALID)
+        {
+          *pos = i;
+          return PVM_CODEC_BASE64_EINVCHAR;
+        }
+
+      if (v == B64_PAD)
+        {
+          /* A pad is only valid in the third or fourth position of a
+             quantum.  */
+          if (state < 2)
+            {
+              *pos = i;
+              return PVM_CODEC_BASE64_EINVPAD;
+            }
+
+          if (state == 2)
+            {
+              /* Expect a second `=', after any blanks.  The input
+                 may also end after the first `='.  */
+              for (++i; base64_values[s[i]] == B64_SPACE; ++i)
+                ;
+              if (s[i] == '\0')
+                --i;
+              else if (s[i] != '=')
+                {
+                  *pos = i;
+                  return PVM_CODEC_BASE64_EEXPPAD;
+                }
+            }
+
+          /* Only blanks can follow the padding.  */
+          for (++i; s[i] != '\0'; ++i)
+            if (base64_values[s[i]] != B64_SPACE)
+              {
+                *pos = i;
+                return PVM_CODEC_BASE64_EEXPSPACE;
+              }
+
+          /* The bits that don't make a whole byte must be zero.  */
+          if ((state == 2 && (acc & 0xf) != 0)
+              || (state == 3 && (acc & 0x3) != 0))
+            {
+              *pos = i;
+              return PVM_CODEC_BASE64_ETRAIL;
+            }
+
+          *len = n;
+          return PVM_CODEC_BASE64_OK;
+        }
+
+      acc = acc << 6 | v;
+      switch (state)
+        {
+        case 0:
+          break;
+        case 1:
+          dst[n++] = acc >> 4;
+          break;
+        case 2:
+          dst[n++] = acc >> 2;
+          break;
+        case 3:
+          dst[n++] = acc;
+          acc = 0;
+          break;
+        }
+      state = (state + 1) % 4;
+    }
+
+  /* Unpadded input ending in the middle of a quantum.  The bits that
+     don't make a whole byte must be zero.  */
+  if ((state == 2 && (acc & 0xf) != 0)
+      || (state == 3 && (acc & 0x3) != 0))
+    {
+      *pos = i;
+      return PVM_CODEC_BASE64_ETRAIL;
+    }
+
+  *len = n;
+  return PVM_CODEC_BASE64_OK;
+}
+
+/* Binary diffs, in the format of JojoDiff.
+
+   A patch is a sequence of operations, each of them introduced by an
+   escape byte followed by the opcode of the operation.  MOD and INS
+   are followed by data bytes, in which the escape byte is escaped by
+   doubling it.  DEL, EQL and BKT are followed by a length, encoded
+   as described in jojo_put_op.  All the operations work on
+   two cursors, one in the original data and another in the new
+   data:
+
+   MOD copies the data bytes to the new data and advances both
+   cursors.
+
+   INS copies the data bytes to the new data and advances the cursor
+   in the new data.
+
+   DEL advances the cursor in the original data.
+
+   EQL copies bytes from the original data to the new data and
+   advances both cursors.
+
+   BKT moves the cursor in the original data backwards.
+
+   The diff is computed as follows.  Blocks of JOJO_BLOCK bytes of the
+   original data, at offsets multiple of JOJO_BLOCK, are indexed in a
+   hash table by a rolling hash.  Then the new data is scanned, and
+   the rolling hash of the JOJO_BLOCK bytes at every position is
+   looked up in the index.  When the bytes at some position match an
+   indexed block, the match is extended forward and backward as much
+   as possible, and then the bytes preceding the match are emitted as
+   MOD or INS operations, followed by a jump of the original cursor to
+   the matching block and an EQL operation.
+
+   All the data is read and written sequentially in chunks of
+   PVM_CODEC_CHUNK_SIZE bytes, and the number of entries in the index
+   is bounded, so the memory used doesn't depend on the size of the
+   data.  When there are more blocks than entries, only some of the
+   blocks get indexed.  */
+
+#define JOJO_ESC 0xa7
+#define JOJO_MOD 0xa6
+#define JOJO_INS 0xa5
+#define JOJO_DEL 0xa4
+#define JOJO_EQL 0xa3
+#define JOJO_BKT 0xa2
+
+#define JOJO_BLOCK 32
+#define JOJO_INDEX_BITS 20
+#define JOJO_INDEX_PROBES 8
+#define JOJO_HASH_MULT 0x01000193U
+
+#define JOJO_TRY(EXP)                           \
+  do                                            \
+    {                                           \
+      int ret_ = (EXP);                         \
+      if (ret_ != IOS_OK)                       \
+        return ret_;                            \
+    }                                           \
+  while (0)
+
+/* A window of the data located at the bit-offset BASE of the IO
+   space IO.  BUF contains LEN bytes starting at the byte START of the
+   data.  When reading, SIZE is the size of the data in bytes.  When
+   writing, START is the number of bytes already written.  */
+
+struct jojo_stream
+{
+  ios io;
+  ios_off base;
+  uint64_t size;
+  uint64_t start;
+  size_t len;
+  uint8_t buf[PVM_CODEC_CHUNK_SIZE];
+};
+
+#define JOJO_BYTE(S,POS) ((S)->buf[(POS) - (S)->start])
+
+/* Make sure that the byte POS, which shall be less than the size of
+   the data, is in the window of S.  If the window has to be moved,
+   keep the BACK bytes preceding POS in it.  */
+
+static int
+jojo_fill (struct jojo_stream *s, uint64_t pos, size_t back)
+{
+  uint64_t start;
+  size_t count;
+  int ret;
+
+  if (pos >= s->start && pos < s->start + s->len)
+    return IOS_OK;
+
+  start = pos > back ? pos - back : 0;
+  count = s->size - start < sizeof (s->buf) ? s->size - start
+                                             : sizeof (s->buf);
+  ret = ios_read_bytes (s->io, s->base + start * 8, 0, s->buf, count);
+  if (ret != IOS_OK)
+    return ret;
+
+  s->start = start;
+  s->len = count;
+  return IOS_OK;
+}
+
+static int
+jojo_flush (struct jojo_stream *s)
+{
+  int ret = ios_write_bytes (s->io, s->base + s->start * 8, 0,
+                             s->buf, s->len);
+
+  s->start += s->len;
+  s->len = 0;
+  return ret;
+}
+
+static int
+jojo_put (struct jojo_stream *s, uint8_t byte)
+{
+  if (s->len == sizeof (s->buf))
+    JOJO_TRY (jojo_flush (s));
+
+  s->buf[s->len++] = byte;
+  return IOS_OK;
+}
+
+/* Emit the operation OP, which is either DEL, EQL or BKT, with the
+   given non-zero length.  Lengths are encoded in one to nine
+   bytes:
+
+              0 < LEN <= 252            LEN - 1
+            252 < LEN <= 508            252, LEN - 253
+            508 < LEN < 0x10000         253, LEN as big uint<16>
+        0x10000 <= LEN < 0x100000000    254, LEN as big uint<32>
+    0x100000000 <= LEN                  255, LEN as big uint<64>  */
+
+static int
+jojo_put_op (struct jojo_stream *out, int op, uint64_t len)
+{
+  int nbytes, i;
+
+  JOJO_TRY (jojo_put (out, JOJO_ESC));
+  JOJO_TRY (jojo_put (out, op));
+
+  if (len <= 252)
+    return jojo_put (out, len - 1);
+  else if (len <= 508)
+    {
+      JOJO_TRY (jojo_put (out, 252));
+      return jojo_put (out, len - 253);
+    }
+  else if (len < 0x10000)
+    {
+      JOJO_TRY (jojo_put (out, 253));
+      nbytes = 2;
+    }
+  else if (len < 0x100000000ULL)
+    {
+      JOJO_TRY (jojo_put (out, 254));
+      nbytes = 4;
+    }
+  else
+    {
+      JOJO_TRY (jojo_put (out, 255));
+      nbytes = 8;
+    }
+
+  for (i = nbytes - 1; i >= 0; --i)
+    JOJO_TRY (jojo_put (out, len >> (i * 8)));
+  return IOS_OK;
+}
+
+struct jojo_entry
+{
+  uint64_t pos;   /* Position of the block plus one, or zero.  */
+  uint32_t hash;
+};
+
+struct jojo_diff
+{
+  struct jojo_stream orig;
+  struct jojo_stream new;
+  struct jojo_stream lit;
+  struct jojo_stream out;
+  struct jojo_entry *index;
+  int index_bits;
+  uint64_t oc;   /* Cursor in the original data.  */
+};
+
+static inline uint32_t
+jojo_slot (struct jojo_diff *d, uint32_t hash)
+{
+  return (hash * 0x9e3779b1U) >> (32 - d->index_bits);
+}
+
+static uint32_t
+jojo_hash (const uint8_t *buf)
+{
+  uint32_t hash = 0;
+  int i;
+
+  for (i = 0; i < JOJO_BLOCK; ++i)
+    hash = hash * JOJO_HASH_MULT + buf[i];
+  return hash;
+}
+
+static int
+jojo_build_index (struct jojo_diff *d)
+{
+  uint64_t nblocks = d->orig.size / JOJO_BLOCK;
+  uint64_t stride = 1, k;
+
+  d->index_bits = 1;
+  while (d->index_bits < JOJO_INDEX_BITS
+         && ((uint64_t) 1 << d->index_bits) < 2 * nblocks)
+    d->index_bits++;
+  if (nblocks > ((uint64_t) 1 << (d->index_bits - 1)))
+    stride = (nblocks + ((uint64_t) 1 << (d->index_bits - 1)) - 1)
+             >> (d->index_bits - 1);
+
+  d->index = calloc ((size_t) 1 << d->index_bits, sizeof (*d->index));
+  if (d->index == NULL)
+    return IOS_ENOMEM;
+
+  for (k = 0; k < nblocks; k += stride)
+    {
+      uint64_t pos = k * JOJO_BLOCK;
+      uint32_t hash, slot;
+      int i;
+
+      JOJO_TRY (jojo_fill (&d->orig, pos + JOJO_BLOCK - 1,
+                           JOJO_BLOCK - 1));
+      hash = jojo_hash (&JOJO_BYTE (&d->orig, pos));
+      slot = jojo_slot (d, hash);
+
+      /* Keep the first occurrence of every block.  */
+      for (i = 0; i < JOJO_INDEX_PROBES; ++i)
+        {
+          struct jojo_entry *e
+            = &d->index[(slot + i) & (((uint32_t) 1 << d->index_bits) - 1)];
+
+          if (e->pos == 0)
+            {
+              e->pos = pos + 1;
+              e->hash = hash;
+              break;
+            }
+          if (e->hash == hash)
+            break;
+        }
+    }
+
+  return IOS_OK;
+}
+
+/* Look for an indexed block of the original data equal to the block
+   of new data starting at POS, which is in the window of the new
+   stream.  Return its position in *FOUND, or UINT64_MAX if there is
+   none.  */
+
+static int
+jojo_lookup (struct jojo_diff *d, uint32_t hash, uint64_t pos,
+             uint64_t *found)
+{
+  uint32_t slot = jojo_slot (d, hash);
+  int i;
+
+  *found = UINT64_MAX;
+  for (i = 0; i < JOJO_INDEX_PROBES; ++i)
+    {
+      struct jojo_entry *e
+        = &d->index[(slot + i) & (((uint32_t) 1 << d->index_bits) - 1)];
+      uint8_t block[JOJO_BLOCK];
+
+      if (e->pos == 0)
+        break;
+      if (e->hash != hash)
+        continue;
+
+      JOJO_TRY (ios_read_bytes (d->orig.io, d->orig.base + (e->pos - 1) * 8,
+                                0, block, JOJO_BLOCK));
+      if (memcmp (block, &JOJO_BYTE (&d->new, pos), JOJO_BLOCK) == 0)
+        {
+          *found = e->pos - 1;
+          break;
+        }
+    }
+
+  return IOS_OK;
+}
+
+/* Emit the COUNT bytes of new data starting at FROM as data bytes of
+   the operation OP.  */
+
+static int
+jojo_put_data (struct jojo_diff *d, int op, uint64_t from, uint64_t count)
+{
+  uint64_t pos;
+
+  if (count == 0)
+    return IOS_OK;
+
+  JOJO_TRY (jojo_put (&d->out, JOJO_ESC));
+  JOJO_TRY (jojo_put (&d->out, op));
+  for (pos = from; pos < from + count; ++pos)
+    {
+      uint8_t byte;
+
+      JOJO_TRY (jojo_fill (&d->lit, pos, 0));
+      byte = JOJO_BYTE (&d->lit, pos);
+      if (byte == JOJO_ESC)
+        JOJO_TRY (jojo_put (&d->out, JOJO_ESC));
+      JOJO_TRY (jojo_put (&d->out, byte));
+    }
+
+  return IOS_OK;
+}
+
+/* Emit the COUNT bytes of new data starting at FROM, which have no
+   match in the original data, followed by a jump of the original
+   cursor to TARGET.  If TARGET is UINT64_MAX, there is no jump.
+
+   Bytes are emitted as MOD as long as this makes the original cursor
+   to approach TARGET, and as INS otherwise.  */
+
+static int
+jojo_put_literal (struct jojo_diff *d, uint64_t from, uint64_t count,
+                  uint64_t target)
+{
+  uint64_t nmod;
+
+  if (target == UINT64_MAX)
+    nmod = count;
+  else if (target > d->oc)
+    nmod = target - d->oc < count ? target - d->oc : count;
+  else
+    nmod = 0;
+
+  JOJO_TRY (jojo_put_data (d, JOJO_MOD, from, nmod));
+  JOJO_TRY (jojo_put_data (d, JOJO_INS, from + nmod, count - nmod));
+  d->oc += nmod;
+
+  if (target != UINT64_MAX && target > d->oc)
+    JOJO_TRY (jojo_put_op (&d->out, JOJO_DEL, target - d->oc));
+  else if (target != UINT64_MAX && target < d->oc)
+    JOJO_TRY (jojo_put_op (&d->out, JOJO_BKT, d->oc - target));
+  if (target != UINT64_MAX)
+    d->oc = target;
+
+  return IOS_OK;
+}
+
+static int
+jojo_diff (struct jojo_diff *d)
+{
+  uint64_t osize = d->orig.size, nsize = d->new.size;
+  uint64_t pos = 0, lit = 0;
+  uint32_t hash = 0, pow = 1;
+  int hash_p = 0, i;
+
+  for (i = 1; i < JOJO_BLOCK; ++i)
+    pow *= JOJO_HASH_MULT;
+
+  if (osize >= JOJO_BLOCK)
+    JOJO_TRY (jojo_build_index (d));
+
+  while (d->index != NULL && pos + JOJO_BLOCK <= nsize)
+    {
+      uint64_t found, len, count;
+
+      /* Update the rolling hash of the block at POS.  */
+      JOJO_TRY (jojo_fill (&d->new, pos + JOJO_BLOCK - 1, JOJO_BLOCK));
+      if (hash_p)
+        hash = (hash - JOJO_BYTE (&d->new, pos - 1) * pow) * JOJO_HASH_MULT
+               + JOJO_BYTE (&d->new, pos + JOJO_BLOCK - 1);
+      else
+        hash = jojo_hash (&JOJO_BYTE (&d->new, pos));
+      hash_p = 1;
+
+      JOJO_TRY (jojo_lookup (d, hash, pos, &found));
+      if (found == UINT64_MAX)
+        {
+          pos++;
+          continue;
+        }
+
+      /* Extend the match forward...  */
+      count = (osize - found < nsize - pos ? osize - found : nsize - pos)
+              - JOJO_BLOCK;
+      JOJO_TRY (ios_compare_bytes (d->orig.io,
+                                   d->orig.base + (found + JOJO_BLOCK) * 8,
+                                   d->new.io,
+                                   d->new.base + (pos + JOJO_BLOCK) * 8,
+                                   count, &len));
+      len += JOJO_BLOCK;
+
+      /* ... and backward.  */
+      while (pos > lit && found > 0)
+        {
+          uint8_t obyte, nbyte;
+
+          JOJO_TRY (ios_read_bytes (d->orig.io,
+                                    d->orig.base + (found - 1) * 8,
+                                    0, &obyte, 1));
+          JOJO_TRY (ios_read_bytes (d->new.io,
+                                    d->new.base + (pos - 1) * 8,
+                                    0, &nbyte, 1));
+          if (obyte != nbyte)
+            break;
+          found--;
+          pos--;
+          len++;
+        }
+
+      JOJO_TRY (jojo_put_literal (d, lit, pos - lit, found));
+      JOJO_TRY (jojo_put_op (&d->out, JOJO_EQL, len));
+      d->oc += len;
+      pos += len;
+      lit = pos;
+      hash_p = 0;
+    }
+
+  JOJO_TRY (jojo_put_literal (d, lit, nsize - lit, UINT64_MAX));
+  return jojo_flush (&d->out);
+}
+
+int
+pvm_codec_jojo_diff (ios orig, ios_off orig_off, uint64_t orig_size,
+                     ios new, ios_off new_off, uint64_t new_size,
+                     ios patch, ios_off patch_off, uint64_t *patch_size)
+{
+  struct jojo_diff *d = calloc (1, sizeof (struct jojo_diff));
+  int ret;
+
+  if (d == NULL)
+    return IOS_ENOMEM;
+
+  d->orig.io = orig;
+  d->orig.base = orig_off;
+  d->orig.size = orig_size;
+  d->new.io = d->lit.io = new;
+  d->new.base = d->lit.base = new_off;
+  d->new.size = d->lit.size = new_size;
+  d->out.io = patch;
+  d->out.base = patch_off;
+
+  ret = jojo_diff (d);
+  *patch_size = d->out.start;
+
+  free (d->index);
+  free (d);
+  return ret;
+}
+
+/* Add the byte at POS of the patch to *VALUE.  Return IOS_EINVAL if
+   the patch ends before.  */
+
+static int
+jojo_get (struct jojo_stream *s, uint64_t pos, uint64_t *value)
+{
+  if (pos >= s->size)
+    return IOS_EINVAL;
+
+  JOJO_TRY (jojo_fill (s, pos, 0));
+  *value = (*value << 8) | JOJO_BYTE (s, pos);
+  return IOS_OK;
+}
+
+struct jojo_patch
+{
+  struct jojo_stream patch;
+  struct jojo_stream out;
+};
+
+static int
+jojo_patch (struct jojo_patch *p, ios orig, ios_off orig_off)
+{
+  struct jojo_stream *in = &p->patch, *out = &p->out;
+  uint64_t pos = 0, oc = 0;
+  int op = JOJO_MOD;
+
+  while (pos < in->size)
+    {
+      uint64_t byte = 0, len = 0;
+      int i, nbytes;
+
+      JOJO_TRY (jojo_get (in, pos++, &byte));
+      if (byte == JOJO_ESC && pos < in->size)
+        {
+          byte = 0;
+          JOJO_TRY (jojo_get (in, pos++, &byte));
+          switch (byte)
+            {
+            case JOJO_MOD:
+            case JOJO_INS:
+              op = byte;
+              continue;
+            case JOJO_DEL:
+            case JOJO_EQL:
+            case JOJO_BKT:
+              JOJO_TRY (jojo_get (in, pos++, &len));
+              if (len < 252)
+                len += 1;
+              else if (len == 252)
+                {
+                  len = 0;
+                  JOJO_TRY (jojo_get (in, pos++, &len));
+                  len += 253;
+                }
+              else
+                {
+                  nbytes = len == 253 ? 2 : len == 254 ? 4 : 8;
+                  len = 0;
+                  for (i = 0; i < nbytes; ++i)
+                    JOJO_TRY (jojo_get (in, pos++, &len));
+                }
+
+              if (byte == JOJO_BKT)
+                {
+                  if (len > oc)
+                    return IOS_EINVAL;
+                  oc -= len;
+                }
+              else if (byte == JOJO_DEL)
+                oc += len;
+              else
+                {
+                  /* Copy the bytes directly to the output buffer.  */
+                  while (len > 0)
+                    {
+                      size_t count;
+
+                      if (out->len == sizeof (out->buf))
+                        JOJO_TRY (jojo_flush (out));
+                      count = sizeof (out->buf) - out->len;
+                      if (count > len)
+                        count = len;
+                      JOJO_TRY (ios_read_bytes (orig, orig_off + oc * 8, 0,
+                                                out->buf + out->len, count));
+                      out->len += count;
+                      oc += count;
+                      len -= count;
+                    }
+                }
+
+              /* MOD is the default operation after DEL, EQL and
+                 BKT.  */
+              op = JOJO_MOD;
+              continue;
+            case JOJO_ESC:
+              break;
+            default:
+              /* An escape byte which doesn't introduce an operation
+                 is a data byte by itself.  */
+              JOJO_TRY (jojo_put (out, JOJO_ESC));
+              if (op == JOJO_MOD)
+                oc++;
+              break;
+            }
+        }
+
+      JOJO_TRY (jojo_put (out, byte));
+      if (op == JOJO_MOD)
+        oc++;
+    }
+
+  return jojo_flush (out);
+}
+
+int
+pvm_codec_jojo_patch (ios patch, ios_off patch_off, uint64_t patch_size,
+                      ios orig, ios_off orig_off,
+                      ios new, ios_off new_off, uint64_t *new_size)
+{
+  struct jojo_patch *p = calloc (1, sizeof (struct jojo_patch));
+  int ret;
+
+  if (p == NULL)
+    return IOS_ENOMEM;
+
+  p->patch.io = patch;
+  p->patch.base = patch_off;
+  p->patch.size = patch_size;
+  p->out.io = new;
+  p->out.base = new_off;
+
+  ret = jojo_patch (p, orig, orig_off);
+  *new_size = p->out.start;
+
+  free (p);
+  return ret;
+}
+
+/* LEB128.  */
+
+int
+pvm_codec_leb128_decode_ios (ios io, ios_off offset, int signed_p,
+                             uint64_t count, uint64_t *values,
+                             ios_off *end)
+{
+  uint8_t buf[PVM_CODEC_CHUNK_SIZE];
+  const uint8_t *data = buf;
+  size_t pos = 0, len = 0;
+  uint64_t i;
+
+  for (i = 0; i < count; ++i)
+    {
+      uint64_t result = 0;
+      unsigned int shift = 0, nbytes = 0;
+      uint8_t byte;
+
+      do
+        {
+          if (pos == len)
+            {
+              uint64_t size = ios_size (io);
+              uint64_t boff = offset / 8;
+              size_t want;
+
+              /* Don't read much more than what the remaining values
+                 may use.  */
+              want = (count - i) * PVM_CODEC_LEB128_MAX;
+              if (want > sizeof (buf))
+                want = sizeof (buf);
+              if (boff >= size)
+                return IOS_EOF;
+              if (want > size - boff)
+                want = size - boff;
+
+              data = ios_read_ptr (io, offset, 0, want);
+              if (data == NULL)
+                {
+                  int ret = ios_read_bytes (io, offset, 0, buf, want);
+
+                  if (ret != IOS_OK)
+                    return ret;
+                  data = buf;
+                }
+              pos = 0;
+              len = want;
+            }
+
+          if (++nbytes > PVM_CODEC_LEB128_MAX)
+            return IOS_EINVAL;
+
+          byte = data[pos++];
+          offset += 8;
+          if (shift < 64)
+            result |= (uint64_t) (byte & 0x7f) << shift;
+          shift += 7;
+        }
+      while (byte & 0x80);
+
+      if (signed_p && shift < 64 && (byte & 0x40))
+        result |= ~(uint64_t) 0 << shift;
+      if (values)
+        values[i] = result;
+    }
+
+  *end = offset;
+  return IOS_OK;
+}
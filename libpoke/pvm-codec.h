@@ -0,0 +1,146 @@
+/* pvm-codec.h - Checksums and encodings for the PVM.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PVM_CODEC_H
+#define PVM_CODEC_H
+
+#include <config.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ios.h"
+
+/* This module provides native implementations of some checksums and
+   encodings that are used by Poke programs, so they don't have to
+   loop over the bytes of arrays in Poke.  Every function operates
+   either on a buffer of bytes or on a range of an IO space.  */
+
+/* Checksums.
+
+   The checksum functions update the running checksum CRC with the
+   given data and return the result.  The initial value and the final
+   XOR of the checksums, if any, are handled by the callers.
+
+   PVM_CODEC_CRC32 is the CRC-32 of ISO 3309 and ITU-T V.42, which
+   uses the reflected polynomial 0xedb88320.
+
+   PVM_CODEC_CRC16_CCITT is the CRC-16 of ITU-T X.25 with polynomial
+   0x1021, not reflected.  */
+
+enum pvm_codec_crc
+{
+  PVM_CODEC_CRC32,
+  PVM_CODEC_CRC16_CCITT
+};
+
+uint32_t pvm_codec_crc (enum pvm_codec_crc kind, uint32_t crc,
+                        const uint8_t *buf, size_t len);
+
+/* Update the checksum *CRC with the SIZE bytes located at the
+   bit-offset OFFSET in IO.  Return an IOS error code.  */
+
+int pvm_codec_crc_ios (enum pvm_codec_crc kind, uint32_t *crc,
+                       ios io, ios_off offset, uint64_t size);
+
+/* Base64, as specified by RFC 4648.  */
+
+/* Return the number of characters of the base64 encoding of LEN
+   bytes, not including a terminating null character.  */
+
+#define PVM_CODEC_BASE64_LEN(LEN) (((LEN) + 2) / 3 * 4)
+
+/* Encode the LEN bytes in SRC in base64, and store the result in DST,
+   which should have room for PVM_CODEC_BASE64_LEN (LEN) + 1
+   characters.  The result is null-terminated.  */
+
+void pvm_codec_base64_encode (const uint8_t *src, size_t len, char *dst);
+
+/* Encode in base64 the SIZE bytes located at the bit-offset OFFSET in
+   IO, and store the result in DST like pvm_codec_base64_encode.
+   Return an IOS error code.  */
+
+int pvm_codec_base64_encode_ios (ios io, ios_off offset, uint64_t size,
+                                 char *dst);
+
+/* Decode the null-terminated base64 string SRC and store the result
+   in DST, which should have room for strlen (SRC) / 4 * 3 + 3 bytes.
+   Spaces are allowed between encoded characters.  Store
+   the number of decoded bytes in *LEN.
+
+   Return one of the PVM_CODEC_BASE64_* codes below.  In case of
+   error, *POS is set to the position of the offending character in
+   SRC.  */
+
+#define PVM_CODEC_BASE64_OK        0 /* Success.  */
+#define PVM_CODEC_BASE64_EINVCHAR  1 /* Non-base64 character.  */
+#define PVM_CODEC_BASE64_EINVPAD   2 /* Invalid `='.  */
+#define PVM_CODEC_BASE64_EEXPPAD   3 /* Expected `='.  */
+#define PVM_CODEC_BASE64_EEXPSPACE 4 /* Expected a space.  */
+#define PVM_CODEC_BASE64_ETRAIL    5 /* Non-zero trailing bits.  */
+
+int pvm_codec_base64_decode (const char *src, uint8_t *dst, size_t *len,
+                             size_t *pos);
+
+/* Binary diffs in the format of JojoDiff.  */
+
+/* Compute the differences between the ORIG_SIZE bytes located at the
+   bit-offset ORIG_OFF in ORIG and the NEW_SIZE bytes located at the
+   bit-offset NEW_OFF in NEW, and write a patch that transforms the
+   former into the later at the bit-offset PATCH_OFF in PATCH.  Store
+   the size of the patch, in bytes, in *PATCH_SIZE.  Return an IOS
+   error code.  */
+
+int pvm_codec_jojo_diff (ios orig, ios_off orig_off, uint64_t orig_size,
+                         ios new, ios_off new_off, uint64_t new_size,
+                         ios patch, ios_off patch_off,
+                         uint64_t *patch_size);
+
+/* Apply the patch of PATCH_SIZE bytes located at the bit-offset
+   PATCH_OFF in PATCH to the data located at the bit-offset ORIG_OFF
+   in ORIG, and write the result at the bit-offset NEW_OFF in NEW.
+   Store the number of bytes written in *NEW_SIZE.  Return an IOS
+   error code.  IOS_EINVAL means that the patch is not valid.  */
+
+int pvm_codec_jojo_patch (ios patch, ios_off patch_off, uint64_t patch_size,
+                          ios orig, ios_off orig_off,
+                          ios new, ios_off new_off, uint64_t *new_size);
+
+/* LEB128 variable-length integers.  */
+
+/* Maximum number of bytes of the LEB128 encoding of a 64-bit
+   integer.  */
+
+#define PVM_CODEC_LEB128_MAX 10
+
+/* Decode COUNT consecutive LEB128 integers located at the bit-offset
+   OFFSET in IO, which are signed if SIGNED_P is not zero.  Store them
+   in VALUES, unless it is NULL, and store the bit-offset following
+   the last of them in *END.  Return an IOS error code.  IOS_EINVAL
+   means that some of the integers is encoded in more than
+   PVM_CODEC_LEB128_MAX bytes.  */
+
+int pvm_codec_leb128_decode_ios (ios io, ios_off offset, int signed_p,
+                                 uint64_t count, uint64_t *values,
+                                 ios_off *end);
+
+/* Initialize the tables used by this module.  This should be called
+   once, before using any of the functions above.  */
+
+void pvm_codec_initialize (void);
+
+#endif /* ! PVM_CODEC_H */
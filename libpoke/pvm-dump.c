@@ -0,0 +1,266 @@
+/* pvm-dump.c - Byte dumps of IO spaces for the PVM.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+
+#include "pkt.h"
+#include "pvm-dump.h"
+
+/* Number of bytes in every line of the dump.  */
+
+#define PVM_DUMP_STEP 16
+
+/* The bytes are read from the IO space in chunks of this many bytes.
+   This shall be a multiple of PVM_DUMP_STEP, so lines never cross
+   chunks.  */
+
+#define PVM_DUMP_CHUNK_SIZE (256 * PVM_DUMP_STEP)
+
+/* Size of the output buffer.  */
+
+#define PVM_DUMP_OUT_SIZE 8192
+
+/* Status of the bytes of a chunk.  */
+
+#define PVM_DUMP_BYTE_OK 0
+#define PVM_DUMP_BYTE_UNKNOWN 1
+#define PVM_DUMP_BYTE_EOF 2
+
+struct pvm_dump_out
+{
+  char buf[PVM_DUMP_OUT_SIZE + 1];
+  size_t len;
+};
+
+static void
+pvm_dump_flush (struct pvm_dump_out *out)
+{
+  if (out->len > 0)
+    {
+      out->buf[out->len] = '\0';
+      pk_puts (out->buf);
+      out->len = 0;
+    }
+}
+
+static inline void
+pvm_dump_putc (struct pvm_dump_out *out, char c)
+{
+  if (out->len == PVM_DUMP_OUT_SIZE)
+    pvm_dump_flush (out);
+  out->buf[out->len++] = c;
+}
+
+static void
+pvm_dump_puts (struct pvm_dump_out *out, const char *str)
+{
+  size_t len = strlen (str);
+
+  while (len > 0)
+    {
+      size_t n;
+
+      if (out->len == PVM_DUMP_OUT_SIZE)
+        pvm_dump_flush (out);
+      n = PVM_DUMP_OUT_SIZE - out->len;
+      if (n > len)
+        n = len;
+      memcpy (out->buf + out->len, str, n);
+      out->len += n;
+      str += n;
+      len -= n;
+    }
+}
+
+static void
+pvm_dump_begin_class (struct pvm_dump_out *out, const char *class)
+{
+  pvm_dump_flush (out);
+  pk_term_class (class);
+}
+
+static void
+pvm_dump_end_class (struct pvm_dump_out *out, const char *class)
+{
+  pvm_dump_flush (out);
+  pk_term_end_class (class);
+}
+
+/* Read the COUNT bytes at byte offset OFFSET of IO into DATA, and set
+   the status of every byte in STATUS.  */
+
+static void
+pvm_dump_read (ios io, uint64_t offset, size_t count,
+               uint8_t *data, uint8_t *status)
+{
+  size_t i;
+
+  if (ios_read_bytes (io, offset * 8, 0 /* flags */, data, count) == IOS_OK)
+    {
+      memset (status, PVM_DUMP_BYTE_OK, count);
+      return;
+    }
+
+  /* Some of the bytes can't be read.  Find out which ones.  The bytes
+     following the end of the IO space are not looked at.  */
+  for (i = 0; i < count; ++i)
+    {
+      int ret = ios_read_bytes (io, (offset + i) * 8, 0 /* flags */,
+                                data + i, 1);
+
+      if (ret == IOS_EOF)
+        {
+          memset (status + i, PVM_DUMP_BYTE_EOF, count - i);
+          break;
+        }
+      status[i] = ret == IOS_OK ? PVM_DUMP_BYTE_OK : PVM_DUMP_BYTE_UNKNOWN;
+    }
+}
+
+void
+pvm_dump_bytes (ios io, ios_off from, ios_off top,
+                const struct pvm_dump_opts *opts)
+{
+  static const char hex[] = "0123456789abcdef";
+  struct pvm_dump_out out;
+  uint8_t data[PVM_DUMP_CHUNK_SIZE];
+  uint8_t status[PVM_DUMP_CHUNK_SIZE];
+  uint64_t cluster = opts->cluster_by * opts->group_by;
+  uint64_t offset = (uint64_t) from / 8;
+  uint64_t chunk_offset = 0;
+  size_t chunk_len = 0;
+
+  out.len = 0;
+
+  /* Offsets are compared in bits, like ios_dump_bytes does.  */
+  while (offset * 8 < (uint64_t) top)
+    {
+      const uint8_t *d, *s;
+      char addr[32];
+      int o, eof_p = 0;
+
+      if (offset >= chunk_offset + chunk_len)
+        {
+          uint64_t left = ((uint64_t) top - offset * 8 + 7) / 8;
+
+          chunk_offset = offset;
+          chunk_len = (left < PVM_DUMP_CHUNK_SIZE
+                       ? left : PVM_DUMP_CHUNK_SIZE);
+          pvm_dump_read (io, chunk_offset, chunk_len, data, status);
+        }
+
+      d = data + (offset - chunk_offset);
+      s = status + (offset - chunk_offset);
+
+      if (offset > 0xffffffff)
+        snprintf (addr, sizeof addr, "%016" PRIx64 ":", offset);
+      else
+        snprintf (addr, sizeof addr, "%08" PRIx64 ":", offset);
+      pvm_dump_begin_class (&out, "dump-address");
+      pvm_dump_puts (&out, addr);
+      pvm_dump_end_class (&out, "dump-address");
+
+      /* The bytes, in hexadecimal.  */
+      for (o = 0;
+           o < PVM_DUMP_STEP && (offset + o) * 8 < (uint64_t) top;)
+        {
+          if (s[o] == PVM_DUMP_BYTE_EOF)
+            {
+              eof_p = 1;
+              break;
+            }
+
+          if (o % opts->group_by == 0)
+            pvm_dump_putc (&out, ' ');
+          if (s[o] == PVM_DUMP_BYTE_UNKNOWN)
+            {
+              pvm_dump_begin_class (&out, "dump-unknown");
+              pvm_dump_puts (&out, opts->unknown_byte);
+              pvm_dump_end_class (&out, "dump-unknown");
+            }
+          else
+            {
+              pvm_dump_putc (&out, hex[d[o] >> 4]);
+              pvm_dump_putc (&out, hex[d[o] & 0xf]);
+            }
+
+          o++;
+          if (o < PVM_DUMP_STEP && o % cluster == 0)
+            pvm_dump_putc (&out, ' ');
+        }
+
+      /* The bytes, in ASCII.  */
+      if (opts->ascii_p)
+        {
+          int t, in_class_p = 0;
+
+          for (t = o; t < PVM_DUMP_STEP; ++t)
+            {
+              if (t % opts->group_by == 0)
+                pvm_dump_putc (&out, ' ');
+              pvm_dump_puts (&out, "  ");
+            }
+          pvm_dump_puts (&out, "  ");
+
+          for (t = 0;
+               t < PVM_DUMP_STEP && (offset + t) * 8 < (uint64_t) top;)
+            {
+              if (s[t] == PVM_DUMP_BYTE_EOF)
+                break;
+
+              if (!in_class_p)
+                {
+                  pvm_dump_begin_class (&out, "dump-ascii");
+                  in_class_p = 1;
+                }
+              if (s[t] == PVM_DUMP_BYTE_UNKNOWN
+                  || d[t] < ' ' || d[t] > '~')
+                pvm_dump_putc (&out, opts->nonprintable_char);
+              else
+                pvm_dump_putc (&out, d[t]);
+
+              t++;
+              if (t < PVM_DUMP_STEP && t % cluster == 0)
+                {
+                  pvm_dump_end_class (&out, "dump-ascii");
+                  in_class_p = 0;
+                  pvm_dump_putc (&out, ' ');
+                }
+            }
+          if (in_class_p)
+            pvm_dump_end_class (&out, "dump-ascii");
+
+          /* The dump ends at the end of the IO space when the ASCII
+             dump is shown.  */
+          if (eof_p)
+            {
+              pvm_dump_putc (&out, '\n');
+              break;
+            }
+        }
+
+      pvm_dump_putc (&out, '\n');
+      offset += PVM_DUMP_STEP;
+    }
+
+  pvm_dump_flush (&out);
+}
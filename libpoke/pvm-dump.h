@@ -0,0 +1,60 @@
+/* pvm-dump.h - Byte dumps of IO spaces for the PVM.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PVM_DUMP_H
+#define PVM_DUMP_H
+
+#include <config.h>
+#include <stdint.h>
+
+#include "ios.h"
+
+/* This module renders the byte dumps printed by the `dump' command,
+   so they don't have to be formatted byte by byte in Poke.  The
+   output is the same than the one of ios_dump_bytes in the ios
+   pickle, for dumps that don't highlight the elements of a mapped
+   value.
+
+   The bytes are read from the IO space in bulk, and the output is
+   accumulated in a buffer which is passed to the terminal only when
+   the styling class changes.  */
+
+struct pvm_dump_opts
+{
+  /* Number of bytes in a group, and number of groups in a cluster.
+     Both shall be greater than zero.  */
+  uint64_t group_by;
+  uint64_t cluster_by;
+
+  /* Whether to include an ASCII dump at the right of every line.  */
+  int ascii_p;
+
+  /* Text shown for the bytes that can't be read, and character shown
+     for the non-printable bytes in the ASCII dump.  */
+  const char *unknown_byte;
+  char nonprintable_char;
+};
+
+/* Print a dump of the bytes of IO starting at the bit-offset FROM,
+   truncated to bytes, and ending at the bit-offset TOP.  The lines
+   contain sixteen bytes each.  */
+
+void pvm_dump_bytes (ios io, ios_off from, ios_off top,
+                     const struct pvm_dump_opts *opts);
+
+#endif /* ! PVM_DUMP_H */
@@ -28,7 +28,14 @@
 /* The variables in each frame are organized in an array that can be
    efficiently accessed using OVER.
 
-   Entries are allocated in steps of STEP variables.
+   When the number of variables in the frame can be estimated, the
+   array is allocated along with the frame, in INLINE_VARS.  This
+   saves one allocation per frame, which matters since a frame is
+   created for every function call.  Should more variables than
+   estimated get registered, the array is moved to its own storage.
+
+   Entries are allocated in steps of STEP variables.  CAPACITY is the
+   number of entries currently allocated in VARS.
 
    UP is a link to the immediately enclosing frame.  This is NULL for
    the top-level frame.  */
@@ -37,9 +44,11 @@ struct pvm_env
 {
   int num_vars;
   int step;
+  int capacity;
   pvm_val *vars;
 
   struct pvm_env *up;
+  pvm_val inline_vars[];
 };
 
 
@@ -48,11 +57,14 @@ struct pvm_env
 pvm_env
 pvm_env_new (int hint)
 {
-  pvm_env env = pvm_alloc (sizeof (struct pvm_env));
+  pvm_env env = pvm_alloc (sizeof (struct pvm_env)
+                           + hint * sizeof (pvm_val));
 
   env->step = hint == 0 ? 128 : hint;
   env->num_vars = 0;
-  env->vars = NULL;
+  env->capacity = hint;
+  env->vars = hint == 0 ? NULL : env->inline_vars;
+  env->up = NULL;
   return env;
 }
 
@@ -76,41 +88,72 @@ void
 pvm_env_register (pvm_env env, pvm_val val)
 {
   assert (env->step != 0);
-  if (env->num_vars % env->step == 0)
+  if (env->num_vars == env->capacity)
     {
-      size_t size = ((env->num_vars + env->step)
+      size_t size = ((env->capacity + env->step)
                      * sizeof (pvm_val));
-      env->vars = pvm_realloc (env->vars, size);
+
+      if (env->vars == env->inline_vars)
+        {
+          pvm_val *vars = pvm_alloc (size);
+
+          memcpy (vars, env->inline_vars,
+                  env->num_vars * sizeof (pvm_val));
+          env->vars = vars;
+        }
+      else
+        env->vars = pvm_realloc (env->vars, size);
+
       memset (env->vars + env->num_vars, 0,
               env->step * sizeof (pvm_val));
+      env->capacity += env->step;
     }
 
   env->vars[env->num_vars++] = val;
 }
 
 /* Given an environment return the frame back frames up from the bottom
-   one.  back is allowed to be zero, but not negative. */
+   one.  back is allowed to be zero, but not negative.  If the frame
+   is a top-level frame and TOPLEVEL is not NULL, return TOPLEVEL
+   instead.  */
 static pvm_env
-pvm_env_back (pvm_env env, int back)
+pvm_env_back (pvm_env env, int back, pvm_env toplevel)
 {
   pvm_env frame = env;
   int i;
 
   for (i = 0; i < back; i ++)
     frame = frame->up;
+
+  if (frame->up == NULL && toplevel != NULL)
+    return toplevel;
   return frame;
 }
 
 pvm_val
 pvm_env_lookup (pvm_env env, int back, int over)
 {
-  return pvm_env_back (env, back)->vars[over];
+  return pvm_env_back (env, back, NULL)->vars[over];
 }
 
 void
 pvm_env_set_var (pvm_env env, int back, int over, pvm_val val)
 {
-  pvm_env_back (env, back)->vars[over] = val;
+  pvm_env_back (env, back, NULL)->vars[over] = val;
+}
+
+pvm_val
+pvm_env_lookup_with_toplevel (pvm_env toplevel, pvm_env env,
+                              int back, int over)
+{
+  return pvm_env_back (env, back, toplevel)->vars[over];
+}
+
+void
+pvm_env_set_var_with_toplevel (pvm_env toplevel, pvm_env env,
+                               int back, int over, pvm_val val)
+{
+  pvm_env_back (env, back, toplevel)->vars[over] = val;
 }
 
 int
@@ -128,3 +171,18 @@ pvm_env_toplevel (pvm_env env)
 
   return env;
 }
+
+pvm_env
+pvm_env_dup_toplevel (pvm_env env)
+{
+  pvm_env new;
+
+  assert (env->up == NULL);
+
+  new = pvm_env_new (env->capacity);
+  new->step = env->step;
+  if (env->num_vars > 0)
+    memcpy (new->vars, env->vars, env->num_vars * sizeof (pvm_val));
+  new->num_vars = env->num_vars;
+  return new;
+}
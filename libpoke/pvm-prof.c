@@ -0,0 +1,318 @@
+/* pvm-prof.c - Sampling profiler for the PVM.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <sys/time.h>
+
+#include "pvm.h"
+#include "pvm-val.h"
+#include "pvm-alloc.h"
+#include "pvm-prof.h"
+#include "pk-utils.h"
+
+/* Samples are kept in a hash table indexed by the folded
+   representation of the sampled stack.  */
+
+#define PVM_PROF_NBUCKETS 1021
+
+struct pvm_prof_sample
+{
+  char *stack;
+  uint64_t count;
+  struct pvm_prof_sample *next;
+};
+
+/* FRAMES is the shadow stack.  It contains the names of the closures
+   being executed, as PVM values, and is allocated as uncollectable
+   memory so the names stay alive while the frames are in the stack.
+   DEPTH is the number of frames in the stack and CAPACITY the number
+   of allocated entries.
+
+   BUF is a buffer of BUF_SIZE bytes where the folded representation
+   of the stack is built when sampling.  */
+
+struct pvm_prof
+{
+  pvm_val *frames;
+  size_t depth;
+  size_t capacity;
+
+  char *buf;
+  size_t buf_size;
+
+  struct pvm_prof_sample *buckets[PVM_PROF_NBUCKETS];
+};
+
+#define PVM_PROF_ANON_NAME "[anonymous]"
+#define PVM_PROF_TOPLEVEL_NAME "[toplevel]"
+
+/* Flag set by the SIGPROF handler every time the sampling timer
+   expires.  */
+
+static volatile sig_atomic_t pvm_prof_pending;
+
+pvm_prof
+pvm_prof_new (void)
+{
+  return calloc (1, sizeof (struct pvm_prof));
+}
+
+void
+pvm_prof_free (pvm_prof prof)
+{
+  if (!prof)
+    return;
+
+  pvm_prof_reset (prof);
+  if (prof->frames)
+    pvm_free_uncollectable (prof->frames);
+  free (prof->buf);
+  free (prof);
+}
+
+void
+pvm_prof_enter (pvm_prof prof, pvm_val name)
+{
+  if (prof->depth == prof->capacity)
+    {
+      size_t capacity = prof->capacity ? prof->capacity * 2 : 64;
+      pvm_val *frames
+        = pvm_alloc_uncollectable (capacity * sizeof (pvm_val));
+
+      if (prof->frames)
+        {
+          memcpy (frames, prof->frames, prof->depth * sizeof (pvm_val));
+          pvm_free_uncollectable (prof->frames);
+        }
+      prof->frames = frames;
+      prof->capacity = capacity;
+    }
+
+  prof->frames[prof->depth++] = name;
+  pvm_prof_tick (prof);
+}
+
+void
+pvm_prof_leave (pvm_prof prof)
+{
+  pvm_prof_tick (prof);
+  if (prof->depth > 0)
+    prof->frames[--prof->depth] = PVM_NULL;
+}
+
+size_t
+pvm_prof_depth (pvm_prof prof)
+{
+  return prof->depth;
+}
+
+void
+pvm_prof_unwind (pvm_prof prof, size_t depth)
+{
+  while (prof->depth > depth)
+    prof->frames[--prof->depth] = PVM_NULL;
+}
+
+/* Build the folded representation of the current shadow stack of
+   PROF in its buffer.  Return 0 if there is not enough memory.  */
+
+static int
+pvm_prof_fold (pvm_prof prof)
+{
+  size_t i, len = 0, needed = sizeof (PVM_PROF_TOPLEVEL_NAME);
+
+  for (i = 0; i < prof->depth; ++i)
+    {
+      pvm_val name = prof->frames[i];
+
+      needed += (name == PVM_NULL
+                 ? strlen (PVM_PROF_ANON_NAME)
+                 : strlen (PVM_VAL_STR (name))) + 1;
+    }
+
+  if (needed > prof->buf_size)
+    {
+      char *buf = realloc (prof->buf, needed);
+
+      if (!buf)
+        return 0;
+      prof->buf = buf;
+      prof->buf_size = needed;
+    }
+
+  if (prof->depth == 0)
+    {
+      strcpy (prof->buf, PVM_PROF_TOPLEVEL_NAME);
+      return 1;
+    }
+
+  for (i = 0; i < prof->depth; ++i)
+    {
+      pvm_val name = prof->frames[i];
+      const char *str
+        = name == PVM_NULL ? PVM_PROF_ANON_NAME : PVM_VAL_STR (name);
+      size_t str_len = strlen (str);
+
+      if (i > 0)
+        prof->buf[len++] = ';';
+      memcpy (prof->buf + len, str, str_len);
+      len += str_len;
+    }
+  prof->buf[len] = '\0';
+  return 1;
+}
+
+static unsigned int
+pvm_prof_hash (const char *str)
+{
+  /* FNV-1a.  */
+  uint32_t hash = 2166136261u;
+
+  for (; *str; ++str)
+    hash = (hash ^ (unsigned char) *str) * 16777619u;
+  return hash % PVM_PROF_NBUCKETS;
+}
+
+void
+pvm_prof_tick (pvm_prof prof)
+{
+  struct pvm_prof_sample *sample;
+  unsigned int bucket;
+
+  if (!pvm_prof_pending)
+    return;
+  pvm_prof_pending = 0;
+
+  if (!pvm_prof_fold (prof))
+    return;
+
+  bucket = pvm_prof_hash (prof->buf);
+  for (sample = prof->buckets[bucket]; sample; sample = sample->next)
+    if (STREQ (sample->stack, prof->buf))
+      {
+        sample->count++;
+        return;
+      }
+
+  sample = malloc (sizeof (struct pvm_prof_sample));
+  if (!sample)
+    return;
+  sample->stack = strdup (prof->buf);
+  if (!sample->stack)
+    {
+      free (sample);
+      return;
+    }
+  sample->count = 1;
+  sample->next = prof->buckets[bucket];
+  prof->buckets[bucket] = sample;
+}
+
+void
+pvm_prof_reset (pvm_prof prof)
+{
+  size_t i;
+
+  for (i = 0; i < PVM_PROF_NBUCKETS; ++i)
+    {
+      struct pvm_prof_sample *sample, *next;
+
+      for (sample = prof->buckets[i]; sample; sample = next)
+        {
+          next = sample->next;
+          free (sample->stack);
+          free (sample);
+        }
+      prof->buckets[i] = NULL;
+    }
+}
+
+void
+pvm_prof_map (pvm_prof prof, pvm_prof_fn fn, void *data)
+{
+  size_t i;
+
+  for (i = 0; i < PVM_PROF_NBUCKETS; ++i)
+    {
+      struct pvm_prof_sample *sample;
+
+      for (sample = prof->buckets[i]; sample; sample = sample->next)
+        fn (sample->stack, sample->count, data);
+    }
+}
+
+#if defined ITIMER_PROF && defined SIGPROF
+
+static void
+pvm_prof_handle_sigprof (int sig)
+{
+  pvm_prof_pending = 1;
+}
+
+int
+pvm_prof_start_timer (unsigned int interval)
+{
+  struct sigaction sa;
+  struct itimerval timer;
+
+  memset (&sa, 0, sizeof (sa));
+  sa.sa_handler = pvm_prof_handle_sigprof;
+  sa.sa_flags = SA_RESTART;
+  sigemptyset (&sa.sa_mask);
+  if (sigaction (SIGPROF, &sa, NULL) == -1)
+    return 0;
+
+  timer.it_interval.tv_sec = interval / 1000000;
+  timer.it_interval.tv_usec = interval % 1000000;
+  timer.it_value = timer.it_interval;
+  if (setitimer (ITIMER_PROF, &timer, NULL) == -1)
+    return 0;
+
+  pvm_prof_pending = 0;
+  return 1;
+}
+
+void
+pvm_prof_stop_timer (void)
+{
+  struct itimerval timer;
+
+  memset (&timer, 0, sizeof (timer));
+  setitimer (ITIMER_PROF, &timer, NULL);
+  signal (SIGPROF, SIG_IGN);
+  pvm_prof_pending = 0;
+}
+
+#else
+
+int
+pvm_prof_start_timer (unsigned int interval)
+{
+  return 0;
+}
+
+void
+pvm_prof_stop_timer (void)
+{
+}
+
+#endif
@@ -0,0 +1,100 @@
+/* pvm-prof.h - Sampling profiler for the PVM.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef PVM_PROF_H
+#define PVM_PROF_H
+
+#include <config.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pvm.h"
+
+/* The PVM sampling profiler attributes execution time to Poke-level
+   functions.
+
+   While profiling, the PVM maintains a shadow stack with the names of
+   the closures being executed, which is updated at every call and
+   return.  A process-wide interval timer periodically sets a pending
+   flag, which the PVM checks at calls, returns and `sync'
+   instructions.  When the flag is set the current shadow stack is
+   recorded as a sample.
+
+   Samples are aggregated by call stack.  Stacks are represented as
+   strings with the names of the frames, outermost first, separated
+   by semicolons, i.e. in the "folded" format understood by flame
+   graph tools.  Anonymous closures are represented as
+   "[anonymous]".  */
+
+typedef struct pvm_prof *pvm_prof;
+
+/* Create a new profiler with no samples.  Return NULL if there is not
+   enough memory.  */
+
+pvm_prof pvm_prof_new (void);
+
+/* Free all the resources used by PROF.  */
+
+void pvm_prof_free (pvm_prof prof);
+
+/* Push a frame for a closure with name NAME, which may be PVM_NULL,
+   into the shadow stack of PROF.  */
+
+void pvm_prof_enter (pvm_prof prof, pvm_val name);
+
+/* Pop the innermost frame from the shadow stack of PROF.  */
+
+void pvm_prof_leave (pvm_prof prof);
+
+/* Record a sample if the sampling timer expired since the last
+   sample.  */
+
+void pvm_prof_tick (pvm_prof prof);
+
+/* Return the current depth of the shadow stack of PROF.  */
+
+size_t pvm_prof_depth (pvm_prof prof);
+
+/* Pop frames from the shadow stack of PROF until it is DEPTH frames
+   deep.  This is used when unwinding the stack due to an exception
+   or an early exit.  */
+
+void pvm_prof_unwind (pvm_prof prof, size_t depth);
+
+/* Discard all the samples recorded in PROF.  */
+
+void pvm_prof_reset (pvm_prof prof);
+
+/* Call FN for every distinct call stack sampled by PROF, passing the
+   folded representation of the stack, the number of samples
+   attributed to it and DATA.  The type pvm_prof_fn is defined in
+   pvm.h.  */
+
+void pvm_prof_map (pvm_prof prof, pvm_prof_fn fn, void *data);
+
+/* Arm the sampling timer so it expires every INTERVAL microseconds
+   of consumed CPU time.  Return 0 if the timer cannot be armed in
+   this system, 1 otherwise.  */
+
+int pvm_prof_start_timer (unsigned int interval);
+
+/* Disarm the sampling timer.  */
+
+void pvm_prof_stop_timer (void);
+
+#endif /* ! PVM_PROF_H */
@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <string.h>
 #include <stdio.h> /* For stdout. */
+#include <pthread.h>
 #include <xalloc.h> /* For xstrdup.  */
 
 #include "jitter/jitter-print.h"
@@ -57,9 +58,16 @@ struct pvm_program
   int next_pointer;
 };
 
-/* Jitter print context to use when disassembling PVM programs.  */
-jitter_print_context_kind jitter_context_kind = NULL;
-jitter_print_context jitter_context = NULL;
+/* Kind of the Jitter print contexts to use when disassembling PVM
+   programs.  The print contexts themselves keep state, so every
+   disassembly makes its own, and programs can be disassembled by
+   several threads at the same time.  */
+static jitter_print_context_kind jitter_context_kind = NULL;
+
+/* Jitter may allocate the native code of the routines from memory
+   shared by all the routines of the process, without locking it, so
+   making routines executable and destroying them is serialized.  */
+static pthread_mutex_t pvm_program_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static void
 collect_value_pointers (pvm_program program, pvm_val val)
@@ -244,7 +252,9 @@ int
 pvm_program_make_executable (pvm_program program)
 {
   /* XXX Jitter should return an error code here.  */
+  pthread_mutex_lock (&pvm_program_lock);
   jitter_routine_make_executable_if_needed (program->routine);
+  pthread_mutex_unlock (&pvm_program_lock);
 
   return PVM_OK;
 }
@@ -252,7 +262,9 @@ pvm_program_make_executable (pvm_program program)
 void
 pvm_destroy_program (pvm_program program)
 {
+  pthread_mutex_lock (&pvm_program_lock);
   pvm_destroy_routine (program->routine);
+  pthread_mutex_unlock (&pvm_program_lock);
 }
 
 pvm_routine
@@ -309,11 +321,20 @@ pvm_jitter_end_decoration (jitter_print_context_data data,
   return 0;
 }
 
+jitter_print_context
+pvm_program_make_print_context (void)
+{
+  return jitter_print_context_make (jitter_context_kind, NULL);
+}
+
 void
 pvm_disassemble_program_nat (pvm_program program)
 {
-  pvm_routine_disassemble (jitter_context, program->routine,
+  jitter_print_context ctx = pvm_program_make_print_context ();
+
+  pvm_routine_disassemble (ctx, program->routine,
                            true, JITTER_OBJDUMP, NULL);
+  jitter_print_context_destroy (ctx);
 }
 
 char *
@@ -377,7 +398,10 @@ pvm_program_parse_from_string (const char *str, pvm_program program)
 void
 pvm_disassemble_program (pvm_program program)
 {
-  pvm_routine_print (jitter_context, program->routine, /*user_data*/ NULL);
+  jitter_print_context ctx = pvm_program_make_print_context ();
+
+  pvm_routine_print (ctx, program->routine, /*user_data*/ NULL);
+  jitter_print_context_destroy (ctx);
 }
 
 
@@ -390,14 +414,10 @@ pvm_program_init ()
   jitter_context_kind->flush = pvm_jitter_print_flush;
   jitter_context_kind->begin_decoration = pvm_jitter_begin_decoration;
   jitter_context_kind->end_decoration = pvm_jitter_end_decoration;
-
-  jitter_context = jitter_print_context_make (jitter_context_kind,
-                                              NULL);
 }
 
 void
 pvm_program_fini ()
 {
-  jitter_print_context_destroy (jitter_context);
   jitter_print_context_kind_destroy (jitter_context_kind);
 }
@@ -28,6 +28,12 @@
 void pvm_program_init (void);
 void pvm_program_fini (void);
 
+/* Make a Jitter print context whose output goes to the terminal.
+   The context shall be destroyed with jitter_print_context_destroy
+   once used.  */
+
+jitter_print_context pvm_program_make_print_context (void);
+
 /* Return the program point corresponding to the beginning of the
    given program.  */
 pvm_program_program_point pvm_program_beginning (pvm_program program);
@@ -45,9 +45,9 @@ static pvm_val void_type;
    bits.  It is therefore possible to cache these types to avoid
    allocating them again and again.
 
-   The contents of this table are initialized in pvm_val_initialize
-   and finalized in pvm_val_finalize.  New types are installed by
-   pvm_make_integral_type.
+   The contents of this table are created in pvm_val_initialize and
+   finalized in pvm_val_finalize.  The table is not modified in
+   between, so it can be read by several threads at the same time.
 
    Note that the first entry of the table is unused; it would
    correspond to an integer of "zero" bits.  This is more efficient
@@ -56,6 +56,19 @@ static pvm_val void_type;
 
 static pvm_val common_int_types[65][2];
 
+/* Cache of recently made long values.  Each value is stored in the
+   entry selected by hashing its contents, replacing the previous one,
+   if any.  Entries are initialized to PVM_NULL in
+   pvm_val_initialize.
+
+   The cache is shared by the virtual machines running in all the
+   threads.  Entries are published with release semantics after the
+   pair they point to is complete, and read with acquire semantics,
+   so a thread finding an entry also finds its contents.  Races only
+   cost misses.  */
+
+static pvm_val long_cache[PVM_LONG_CACHE_SIZE];
+
 pvm_val
 pvm_make_int (int32_t value, int size)
 {
@@ -70,6 +83,33 @@ pvm_make_uint (uint32_t value, int size)
   return PVM_MAKE_UINT (value, size);
 }
 
+pvm_val
+pvm_make_long_ulong (uint64_t value, int size, int tag)
+{
+  uint64_t bits = (size - 1) & 0x3f;
+  size_t slot = (((value ^ (bits << 56) ^ tag) * 0x9e3779b97f4a7c15ULL)
+                 >> (64 - PVM_LONG_CACHE_BITS));
+  pvm_val cached = __atomic_load_n (&long_cache[slot], __ATOMIC_ACQUIRE);
+  uint64_t *ll;
+
+  if (PVM_VAL_TAG (cached) == tag)
+    {
+      ll = (uint64_t *) (((uintptr_t) cached) & ~0x7);
+      if (ll[0] == value && ll[1] == bits)
+        return cached;
+    }
+
+  /* The pair doesn't contain pointers, so the collector doesn't need
+     to scan it.  */
+  ll = pvm_alloc_atomic (sizeof (uint64_t) * 2);
+  ll[0] = value;
+  ll[1] = bits;
+
+  cached = ((uint64_t) (uintptr_t) ll) | tag;
+  __atomic_store_n (&long_cache[slot], cached, __ATOMIC_RELEASE);
+  return cached;
+}
+
 pvm_val
 pvm_make_long (int64_t value, int size)
 {
@@ -150,6 +190,268 @@ pvm_make_string_nodup (char *str)
   return PVM_BOX (box);
 }
 
+/* Concatenations shorter than this are built as C strings.  */
+#define PVM_ROPE_MIN_LENGTH 256
+
+size_t
+pvm_string_length (pvm_val str)
+{
+  pvm_val_box box = PVM_VAL_BOX (str);
+
+  if (PVM_VAL_BOX_FLAGS (box) & PVM_VAL_BOX_F_ROPE)
+    return PVM_VAL_BOX_ROPE (box)->length;
+  return strlen (PVM_VAL_BOX_STR (box));
+}
+
+pvm_val
+pvm_string_concat (pvm_val str1, pvm_val str2)
+{
+  size_t len1 = pvm_string_length (str1);
+  size_t len2 = pvm_string_length (str2);
+  pvm_val_box box;
+  struct pvm_rope *rope;
+
+  if (len1 + len2 < PVM_ROPE_MIN_LENGTH)
+    {
+      char *s = pvm_alloc_atomic (len1 + len2 + 1);
+
+      memcpy (s, PVM_VAL_STR (str1), len1);
+      memcpy (s + len1, PVM_VAL_STR (str2), len2 + 1);
+      return pvm_make_string_nodup (s);
+    }
+
+  rope = pvm_alloc (sizeof (struct pvm_rope));
+  rope->left = str1;
+  rope->right = str2;
+  rope->length = len1 + len2;
+  rope->flat = NULL;
+
+  box = pvm_make_box (PVM_VAL_TAG_STR);
+  PVM_VAL_BOX_FLAGS (box) = PVM_VAL_BOX_F_ROPE;
+  PVM_VAL_BOX_ROPE (box) = rope;
+  return PVM_BOX (box);
+}
+
+char *
+pvm_string_flatten (pvm_val str)
+{
+  struct pvm_rope *rope = PVM_VAL_BOX_ROPE (PVM_VAL_BOX (str));
+  char *flat = __atomic_load_n (&rope->flat, __ATOMIC_ACQUIRE);
+  char *buf;
+  size_t pos = 0, nstack = 0, nallocated = 16;
+  pvm_val *stack;
+
+  if (flat != NULL)
+    return flat;
+
+  buf = pvm_alloc_atomic (rope->length + 1);
+  stack = pvm_alloc (nallocated * sizeof (pvm_val));
+
+  /* Traverse the rope from left to right.  The ropes built by
+     appending or prepending in a loop are very deep, so this doesn't
+     recurse.  The contents of the sub-ropes already flattened are
+     copied at once.  */
+  stack[nstack++] = str;
+  while (nstack > 0)
+    {
+      pvm_val_box sbox = PVM_VAL_BOX (stack[--nstack]);
+      const char *s;
+      size_t len;
+
+      if (PVM_VAL_BOX_FLAGS (sbox) & PVM_VAL_BOX_F_ROPE)
+        {
+          struct pvm_rope *srope = PVM_VAL_BOX_ROPE (sbox);
+
+          s = __atomic_load_n (&srope->flat, __ATOMIC_ACQUIRE);
+          if (s == NULL)
+            {
+              if (nstack + 2 > nallocated)
+                {
+                  nallocated *= 2;
+                  stack = pvm_realloc (stack,
+                                       nallocated * sizeof (pvm_val));
+                }
+              stack[nstack++] = srope->right;
+              stack[nstack++] = srope->left;
+              continue;
+            }
+          len = srope->length;
+        }
+      else
+        {
+          s = PVM_VAL_BOX_STR (sbox);
+          len = strlen (s);
+        }
+
+      memcpy (buf + pos, s, len);
+      pos += len;
+    }
+
+  assert (pos == rope->length);
+  buf[pos] = '\0';
+
+  /* Another thread may have flattened the rope meanwhile, in which
+     case its copy is the one used, so the contents of the string are
+     always at the same address.  */
+  flat = NULL;
+  if (!__atomic_compare_exchange_n (&rope->flat, &flat, buf, 0,
+                                    __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE))
+    return flat;
+  return buf;
+}
+
+/* Return the number of bytes used to store each element in the dense
+   representation of arrays whose elements are BITS wide.  */
+
+static inline size_t
+pvm_array_dense_elem_nbytes (int bits)
+{
+  return bits <= 8 ? 1 : bits <= 16 ? 2 : bits <= 32 ? 4 : 8;
+}
+
+/* Return the raw value of the element IDX of the dense array ARR.  */
+
+static inline uint64_t
+pvm_array_dense_get (pvm_val arr, size_t idx)
+{
+  void *data = PVM_VAL_ARR_DENSE_DATA (arr);
+
+  switch (pvm_array_dense_elem_nbytes (PVM_VAL_ARR_DENSE_BITS (arr)))
+    {
+    case 1: return ((uint8_t *) data)[idx];
+    case 2: return ((uint16_t *) data)[idx];
+    case 4: return ((uint32_t *) data)[idx];
+    default: return ((uint64_t *) data)[idx];
+    }
+}
+
+/* Set the raw value of the element IDX of the dense array ARR to
+   VALUE.  Only the DENSE_BITS less significative bits of VALUE are
+   stored.  */
+
+static inline void
+pvm_array_dense_put (pvm_val arr, size_t idx, uint64_t value)
+{
+  void *data = PVM_VAL_ARR_DENSE_DATA (arr);
+  int bits = PVM_VAL_ARR_DENSE_BITS (arr);
+
+  if (bits < 64)
+    value &= ((uint64_t) 1 << bits) - 1;
+
+  switch (pvm_array_dense_elem_nbytes (bits))
+    {
+    case 1: ((uint8_t *) data)[idx] = value; break;
+    case 2: ((uint16_t *) data)[idx] = value; break;
+    case 4: ((uint32_t *) data)[idx] = value; break;
+    default: ((uint64_t *) data)[idx] = value; break;
+    }
+}
+
+/* Return whether VAL can be stored in the dense array ARR, i.e. if it
+   is an integral value with the same size and signedness than the
+   elements of the array.  */
+
+static int
+pvm_array_dense_val_p (pvm_val arr, pvm_val val)
+{
+  int bits = PVM_VAL_ARR_DENSE_BITS (arr);
+
+  if (PVM_VAL_ARR_DENSE_SIGNED_P (arr))
+    return ((PVM_IS_INT (val) && PVM_VAL_INT_SIZE (val) == bits)
+            || (PVM_IS_LONG (val) && PVM_VAL_LONG_SIZE (val) == bits));
+  else
+    return ((PVM_IS_UINT (val) && PVM_VAL_UINT_SIZE (val) == bits)
+            || (PVM_IS_ULONG (val) && PVM_VAL_ULONG_SIZE (val) == bits));
+}
+
+/* Make room for NALLOCATED elements in the dense array ARR.  */
+
+static void
+pvm_array_dense_grow (pvm_val arr, size_t nallocated)
+{
+  size_t nbytes
+    = pvm_array_dense_elem_nbytes (PVM_VAL_ARR_DENSE_BITS (arr));
+
+  PVM_VAL_ARR_DENSE_DATA (arr)
+    = pvm_realloc (PVM_VAL_ARR_DENSE_DATA (arr), nallocated * nbytes);
+  PVM_VAL_ARR_NALLOCATED (arr) = nallocated;
+}
+
+/* Turn the dense array ARR into a regular array, whose elements are
+   stored as a list of values.  This is needed when ARR gets an
+   element that doesn't fit in the dense representation.  */
+
+static void
+pvm_array_undensify (pvm_val arr)
+{
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t nallocated = PVM_VAL_ARR_NALLOCATED (arr);
+  struct pvm_array_elem *elems
+    = pvm_alloc (nallocated * sizeof (struct pvm_array_elem));
+  size_t i;
+
+  for (i = 0; i < nallocated; ++i)
+    {
+      if (i < nelem)
+        {
+          elems[i].value = pvm_array_elem_value (arr, i);
+          elems[i].offset = pvm_array_elem_offset (arr, i);
+        }
+      else
+        {
+          elems[i].value = PVM_NULL;
+          elems[i].offset = PVM_NULL;
+        }
+    }
+
+  PVM_VAL_ARR_ELEMS (arr) = elems;
+  PVM_VAL_ARR_DENSE_DATA (arr) = NULL;
+  PVM_VAL_ARR_DENSE_BITS (arr) = 0;
+}
+
+/* Return a pointer to the slot caching the element IDX of the lazy
+   array ARR.  If the chunk containing the slot doesn't exist yet then
+   allocate it if ALLOC_P is not zero.  Otherwise return NULL.  */
+
+static pvm_val *
+pvm_array_lazy_slot (pvm_val arr, uint64_t idx, int alloc_p)
+{
+  uint64_t nchunk = idx / PVM_ARRAY_LAZY_CHUNK;
+  pvm_val **chunks = PVM_VAL_ARR_LAZY_CHUNKS (arr);
+
+  if (nchunk >= PVM_VAL_ARR_LAZY_NCHUNKS (arr))
+    {
+      uint64_t nchunks = PVM_VAL_ARR_LAZY_NCHUNKS (arr) * 2;
+      uint64_t i;
+
+      if (!alloc_p)
+        return NULL;
+
+      if (nchunks <= nchunk)
+        nchunks = nchunk + 1;
+      chunks = pvm_realloc (chunks, nchunks * sizeof (pvm_val *));
+      for (i = PVM_VAL_ARR_LAZY_NCHUNKS (arr); i < nchunks; ++i)
+        chunks[i] = NULL;
+
+      PVM_VAL_ARR_LAZY_CHUNKS (arr) = chunks;
+      PVM_VAL_ARR_LAZY_NCHUNKS (arr) = nchunks;
+    }
+
+  if (chunks[nchunk] == NULL)
+    {
+      size_t i;
+
+      if (!alloc_p)
+        return NULL;
+
+      chunks[nchunk] = pvm_alloc (PVM_ARRAY_LAZY_CHUNK * sizeof (pvm_val));
+      for (i = 0; i < PVM_ARRAY_LAZY_CHUNK; ++i)
+        chunks[nchunk][i] = PVM_NULL;
+    }
+
+  return &chunks[nchunk][idx % PVM_ARRAY_LAZY_CHUNK];
+}
+
 pvm_val
 pvm_make_array (pvm_val nelem, pvm_val type)
 {
@@ -178,6 +480,42 @@ pvm_make_array (pvm_val nelem, pvm_val type)
   arr->nallocated = num_allocated;
   arr->type = type;
 
+  arr->dense_bits = 0;
+  arr->dense_signed_p = 0;
+  arr->dense_boffset = 0;
+  arr->dense_boffset_back = 0;
+  arr->dense_data = NULL;
+  arr->lazy_mapper = PVM_NULL;
+  arr->lazy_ios = PVM_NULL;
+  arr->lazy_boffset = 0;
+  arr->lazy_esize = 0;
+  arr->lazy_chunks = NULL;
+  arr->lazy_nchunks = 0;
+  arr->lazy_stream_p = 0;
+  arr->columns = NULL;
+  arr->elems = NULL;
+
+  /* Arrays of integral values are stored densely.  Note that arrays
+     whose elements can be of any type have etype PVM_NULL.  */
+  if (type != PVM_NULL
+      && PVM_VAL_TYP_CODE (type) == PVM_TYPE_ARRAY
+      && PVM_VAL_TYP_A_ETYPE (type) != PVM_NULL
+      && PVM_VAL_TYP_CODE (PVM_VAL_TYP_A_ETYPE (type)) == PVM_TYPE_INTEGRAL)
+    {
+      pvm_val etype = PVM_VAL_TYP_A_ETYPE (type);
+      int bits = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+
+      if (0 < bits && bits <= 64)
+        {
+          arr->dense_bits = bits;
+          arr->dense_signed_p = PVM_VAL_INT (PVM_VAL_TYP_I_SIGNED_P (etype));
+          arr->dense_data
+            = pvm_alloc_atomic (num_allocated
+                                * pvm_array_dense_elem_nbytes (bits));
+          return PVM_BOX (box);
+        }
+    }
+
   arr->elems = pvm_alloc (nbytes);
   for (i = 0; i < num_allocated; ++i)
     {
@@ -188,6 +526,302 @@ pvm_make_array (pvm_val nelem, pvm_val type)
   return PVM_BOX (box);
 }
 
+void
+pvm_array_make_lazy (pvm_val arr, pvm_val ios, uint64_t nelem,
+                     uint64_t esize, pvm_val mapper)
+{
+  uint64_t nchunks
+    = (nelem + PVM_ARRAY_LAZY_CHUNK - 1) / PVM_ARRAY_LAZY_CHUNK;
+  uint64_t i;
+
+  assert (!PVM_VAL_ARR_DENSE_P (arr)
+          && PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)) == 0);
+
+  PVM_VAL_ARR_LAZY_MAPPER (arr) = mapper;
+  PVM_VAL_ARR_LAZY_IOS (arr) = ios;
+  PVM_VAL_ARR_LAZY_BOFFSET (arr) = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr));
+  PVM_VAL_ARR_LAZY_ESIZE (arr) = esize;
+  PVM_VAL_ARR_LAZY_CHUNKS (arr) = pvm_alloc ((nchunks + 1)
+                                             * sizeof (pvm_val *));
+  for (i = 0; i < nchunks; ++i)
+    PVM_VAL_ARR_LAZY_CHUNKS (arr)[i] = NULL;
+  PVM_VAL_ARR_LAZY_NCHUNKS (arr) = nchunks;
+
+  PVM_VAL_ARR_ELEMS (arr) = NULL;
+  PVM_VAL_ARR_NALLOCATED (arr) = nelem;
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem, 64);
+}
+
+/* The element IDX of the lazy array ARR, VAL, has just been mapped
+   at its original location, which is not where the array is if it
+   has been unmapped or relocated since then.  Unmap or relocate VAL
+   accordingly.  */
+
+static void
+pvm_array_lazy_place (pvm_val arr, uint64_t idx, pvm_val val)
+{
+  uint64_t boff = (PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr))
+                   + idx * PVM_VAL_ARR_LAZY_ESIZE (arr));
+
+  if (!PVM_VAL_ARR_MAPPED_P (arr))
+    pvm_val_unmap (val);
+  else if (PVM_VAL_ARR_IOS (arr) != PVM_VAL_ARR_LAZY_IOS (arr)
+           || (PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr))
+               != PVM_VAL_ARR_LAZY_BOFFSET (arr)))
+    pvm_val_reloc (val, PVM_VAL_ARR_IOS (arr), pvm_make_ulong (boff, 64));
+}
+
+/* Compute the columns of the columnar array ARR from VAL, which is
+   its element IDX mapped at its original location by the lazy
+   mapper.  If VAL doesn't have the expected layout then ARR stops
+   being columnar.  */
+
+static void
+pvm_array_columns_init (pvm_val arr, uint64_t idx, pvm_val val)
+{
+  struct pvm_array_columns *columns = PVM_VAL_ARR_COLUMNS (arr);
+  uint64_t boff = (PVM_VAL_ARR_LAZY_BOFFSET (arr)
+                   + idx * PVM_VAL_ARR_LAZY_ESIZE (arr));
+  uint64_t nfields, i;
+
+  if (!PVM_IS_SCT (val) || !PVM_VAL_SCT_MAPPED_P (val)
+      || PVM_VAL_ULONG (PVM_VAL_SCT_OFFSET (val)) != boff)
+    goto fail;
+
+  nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+  if (nfields == 0)
+    goto fail;
+
+  columns->cols = pvm_alloc (nfields * sizeof (struct pvm_array_column));
+  for (i = 0; i < nfields; ++i)
+    {
+      struct pvm_array_column *col = &columns->cols[i];
+      pvm_val fval = PVM_VAL_SCT_FIELD_VALUE (val, i);
+      uint64_t foff;
+
+      if (PVM_VAL_SCT_FIELD_ABSENT_P (val, i)
+          || !PVM_IS_INTEGRAL (fval))
+        goto fail;
+
+      foff = PVM_VAL_ULONG (PVM_VAL_SCT_FIELD_OFFSET (val, i));
+      col->boffset = foff - boff;
+      col->bits = pvm_sizeof (fval);
+      col->signed_p = PVM_IS_INT (fval) || PVM_IS_LONG (fval);
+      col->data = NULL;
+
+      if (foff < boff
+          || col->boffset + col->bits > PVM_VAL_ARR_LAZY_ESIZE (arr))
+        goto fail;
+    }
+
+  columns->nfields = nfields;
+  columns->template = val;
+  return;
+
+ fail:
+  PVM_VAL_ARR_COLUMNS (arr) = NULL;
+}
+
+void
+pvm_array_lazy_cache (pvm_val arr, uint64_t idx, pvm_val val)
+{
+  if (PVM_VAL_ARR_COLUMNS (arr) != NULL
+      && PVM_VAL_ARR_COLUMNS (arr)->template == PVM_NULL)
+    pvm_array_columns_init (arr, idx, val);
+
+  pvm_array_lazy_place (arr, idx, val);
+  if (!PVM_VAL_ARR_LAZY_STREAM_P (arr))
+    *pvm_array_lazy_slot (arr, idx, 1) = val;
+}
+
+void
+pvm_array_make_columnar (pvm_val arr)
+{
+  struct pvm_array_columns *columns;
+
+  assert (PVM_VAL_ARR_LAZY_P (arr));
+
+  columns = pvm_alloc (sizeof (struct pvm_array_columns));
+  columns->template = PVM_NULL;
+  columns->nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  columns->nfields = 0;
+  columns->cols = NULL;
+  columns->filled_p = 0;
+  columns->write_count = 0;
+  columns->endian = IOS_ENDIAN_MSB;
+  columns->nenc = IOS_NENC_2;
+  PVM_VAL_ARR_COLUMNS (arr) = columns;
+}
+
+/* Decode the fields of all the elements of the columnar array ARR
+   from the IO space IO into its columns.  Return 1 on success, 0
+   otherwise.  */
+
+static int
+pvm_array_columns_fill (pvm_val arr, ios io,
+                        enum ios_endian endian, enum ios_nenc nenc)
+{
+  struct pvm_array_columns *columns = PVM_VAL_ARR_COLUMNS (arr);
+  uint64_t esize = PVM_VAL_ARR_LAZY_ESIZE (arr);
+  uint64_t i, j;
+
+  for (j = 0; j < columns->nfields; ++j)
+    {
+      struct pvm_array_column *col = &columns->cols[j];
+
+      if (col->data == NULL)
+        col->data
+          = pvm_alloc_atomic (columns->nelem
+                              * pvm_array_dense_elem_nbytes (col->bits));
+    }
+
+  /* The elements are decoded in order, since the fields of an element
+     and the elements of the array are contiguous in IO.  */
+  for (i = 0; i < columns->nelem; ++i)
+    {
+      ios_off boff = PVM_VAL_ARR_LAZY_BOFFSET (arr) + i * esize;
+
+      for (j = 0; j < columns->nfields; ++j)
+        {
+          struct pvm_array_column *col = &columns->cols[j];
+          uint64_t value;
+          int ret;
+
+          if (col->signed_p)
+            ret = ios_read_int (io, boff + col->boffset, 0, col->bits,
+                                endian, nenc, (int64_t *) &value);
+          else
+            ret = ios_read_uint (io, boff + col->boffset, 0, col->bits,
+                                 endian, &value);
+          if (ret != IOS_OK)
+            return 0;
+
+          if (col->bits < 64)
+            value &= ((uint64_t) 1 << col->bits) - 1;
+          switch (pvm_array_dense_elem_nbytes (col->bits))
+            {
+            case 1: ((uint8_t *) col->data)[i] = value; break;
+            case 2: ((uint16_t *) col->data)[i] = value; break;
+            case 4: ((uint32_t *) col->data)[i] = value; break;
+            default: ((uint64_t *) col->data)[i] = value; break;
+            }
+        }
+    }
+
+  columns->filled_p = 1;
+  columns->write_count = ios_write_count (io);
+  columns->endian = endian;
+  columns->nenc = nenc;
+  return 1;
+}
+
+/* Return the raw value of the field COL of the element IDX.  */
+
+static inline uint64_t
+pvm_array_column_get (struct pvm_array_column *col, uint64_t idx)
+{
+  switch (pvm_array_dense_elem_nbytes (col->bits))
+    {
+    case 1: return ((uint8_t *) col->data)[idx];
+    case 2: return ((uint16_t *) col->data)[idx];
+    case 4: return ((uint32_t *) col->data)[idx];
+    default: return ((uint64_t *) col->data)[idx];
+    }
+}
+
+pvm_val
+pvm_array_columns_elem (pvm_val arr, uint64_t idx, ios io,
+                        enum ios_endian endian, enum ios_nenc nenc)
+{
+  struct pvm_array_columns *columns = PVM_VAL_ARR_COLUMNS (arr);
+  pvm_val template, sct;
+  uint64_t boff, nmethods, i;
+
+  if (columns == NULL || columns->template == PVM_NULL
+      || idx >= columns->nelem
+      || io == NULL || ios_volatile_p (io))
+    return PVM_NULL;
+
+  if (!columns->filled_p
+      || columns->write_count != ios_write_count (io)
+      || columns->endian != endian || columns->nenc != nenc)
+    {
+      if (!pvm_array_columns_fill (arr, io, endian, nenc))
+        {
+          /* Let the lazy mapper report the error.  */
+          PVM_VAL_ARR_COLUMNS (arr) = NULL;
+          return PVM_NULL;
+        }
+    }
+
+  template = columns->template;
+  boff = (PVM_VAL_ARR_LAZY_BOFFSET (arr)
+          + idx * PVM_VAL_ARR_LAZY_ESIZE (arr));
+  sct = pvm_make_struct (PVM_VAL_SCT_NFIELDS (template),
+                         PVM_VAL_SCT_NMETHODS (template),
+                         PVM_VAL_SCT_TYPE (template));
+
+  /* Note that the element is not registered in the range table of
+     IO, see ioregval.  */
+  PVM_VAL_SCT_MAPPED_P (sct) = 1;
+  PVM_VAL_SCT_STRICT_P (sct) = PVM_VAL_ARR_STRICT_P (arr);
+  PVM_VAL_SCT_IOS (sct) = PVM_VAL_ARR_LAZY_IOS (arr);
+  PVM_VAL_SCT_IOS_PTR (sct) = io;
+  PVM_VAL_SCT_OFFSET (sct) = pvm_make_ulong (boff, 64);
+  PVM_VAL_SCT_MAPPER (sct) = PVM_VAL_SCT_MAPPER (template);
+  PVM_VAL_SCT_WRITER (sct) = PVM_VAL_SCT_WRITER (template);
+
+  for (i = 0; i < columns->nfields; ++i)
+    {
+      struct pvm_array_column *col = &columns->cols[i];
+
+      PVM_VAL_SCT_FIELD_NAME (sct, i) = PVM_VAL_SCT_FIELD_NAME (template, i);
+      PVM_VAL_SCT_FIELD_VALUE (sct, i)
+        = pvm_make_integral (pvm_array_column_get (col, idx),
+                             col->bits, col->signed_p);
+      PVM_VAL_SCT_FIELD_OFFSET (sct, i)
+        = pvm_make_ulong (boff + col->boffset, 64);
+    }
+
+  nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (template));
+  for (i = 0; i < nmethods; ++i)
+    PVM_VAL_SCT_METHOD (sct, i) = PVM_VAL_SCT_METHOD (template, i);
+
+  pvm_array_lazy_place (arr, idx, sct);
+  return sct;
+}
+
+pvm_val
+pvm_array_elem_value (pvm_val arr, uint64_t idx)
+{
+  if (PVM_VAL_ARR_DENSE_P (arr))
+    return pvm_make_integral (pvm_array_dense_get (arr, idx),
+                              PVM_VAL_ARR_DENSE_BITS (arr),
+                              PVM_VAL_ARR_DENSE_SIGNED_P (arr));
+
+  if (PVM_VAL_ARR_LAZY_P (arr))
+    {
+      pvm_val *slot = pvm_array_lazy_slot (arr, idx, 0);
+      return slot ? *slot : PVM_NULL;
+    }
+
+  return PVM_VAL_ARR_ELEM_VALUE (arr, idx);
+}
+
+pvm_val
+pvm_array_elem_offset (pvm_val arr, uint64_t idx)
+{
+  if (PVM_VAL_ARR_DENSE_P (arr))
+    return pvm_make_ulong (PVM_VAL_ARR_DENSE_BOFFSET (arr)
+                           + idx * PVM_VAL_ARR_DENSE_BITS (arr), 64);
+
+  if (PVM_VAL_ARR_LAZY_P (arr))
+    return pvm_make_ulong (PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr))
+                           + idx * PVM_VAL_ARR_LAZY_ESIZE (arr), 64);
+
+  return PVM_VAL_ARR_ELEM_OFFSET (arr, idx);
+}
+
 int
 pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
 {
@@ -198,11 +832,7 @@ pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
   size_t nelem_to_allocate = index >= nallocated ? index - nallocated + 1 : 0;
   size_t val_size = pvm_sizeof (val);
   size_t array_boffset = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (arr));
-  size_t elem_boffset
-    = (nelem > 0
-       ? (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, nelem - 1)) +
-          pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, nelem - 1)))
-       : array_boffset);
+  size_t elem_boffset;
   size_t i;
 
   /* First of all, make sure that the given index doesn't correspond
@@ -215,6 +845,46 @@ pvm_array_insert (pvm_val arr, pvm_val idx, pvm_val val)
   if (nelem_to_allocate > 1024)
     return 0;
 
+  /* The elements of lazy arrays are all of the same size, so their
+     offsets don't need to be stored.  */
+  if (PVM_VAL_ARR_LAZY_P (arr))
+    {
+      for (i = nelem; i <= index; ++i)
+        *pvm_array_lazy_slot (arr, i, 1) = val;
+
+      PVM_VAL_ARR_NALLOCATED (arr) = index + 1;
+      PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem + nelem_to_add, 64);
+      return 1;
+    }
+
+  if (PVM_VAL_ARR_DENSE_P (arr) && !pvm_array_dense_val_p (arr, val))
+    pvm_array_undensify (arr);
+
+  if (PVM_VAL_ARR_DENSE_P (arr))
+    {
+      uint64_t value = PVM_VAL_INTEGRAL (val);
+
+      if ((nallocated - nelem) < nelem_to_add)
+        pvm_array_dense_grow (arr, nallocated + nelem_to_add + 16);
+
+      /* The offset of the rest of the elements follows from the
+         offset of the first one.  */
+      if (nelem == 0)
+        PVM_VAL_ARR_DENSE_BOFFSET (arr) = array_boffset;
+
+      for (i = nelem; i <= index; ++i)
+        pvm_array_dense_put (arr, i, value);
+
+      PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem + nelem_to_add, 64);
+      return 1;
+    }
+
+  elem_boffset
+    = (nelem > 0
+       ? (PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, nelem - 1)) +
+          pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (arr, nelem - 1)))
+       : array_boffset);
+
   /* Make sure there is enough room in the array for the new elements.
      Otherwise, make space for the new elements, plus a buffer of 16
      elements more.  */
@@ -260,6 +930,25 @@ pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val)
   if (index >= nelem)
     return 0;
 
+  if (PVM_VAL_ARR_LAZY_P (arr))
+    {
+      *pvm_array_lazy_slot (arr, index, 1) = val;
+      return 1;
+    }
+
+  if (PVM_VAL_ARR_DENSE_P (arr))
+    {
+      /* The new element has the same size than the old one, so the
+         offsets of the elements don't change.  */
+      if (pvm_array_dense_val_p (arr, val))
+        {
+          pvm_array_dense_put (arr, index, PVM_VAL_INTEGRAL (val));
+          return 1;
+        }
+
+      pvm_array_undensify (arr);
+    }
+
   /* Calculate the difference of size introduced by the new
      elemeent.  */
   size_diff = ((ssize_t) pvm_sizeof (val)
@@ -291,6 +980,42 @@ pvm_array_rem (pvm_val arr, pvm_val idx)
   if (index >= nelem)
     return 0;
 
+  /* Note that the offsets of the elements of lazy arrays are always
+     computed from their index.  */
+  if (PVM_VAL_ARR_LAZY_P (arr))
+    {
+      for (i = index; i < (nelem - 1); i++)
+        *pvm_array_lazy_slot (arr, i, 1) = pvm_array_elem_value (arr, i + 1);
+      *pvm_array_lazy_slot (arr, nelem - 1, 1) = PVM_NULL;
+
+      PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem - 1, 64);
+      return 1;
+    }
+
+  /* The remaining elements keep their offsets.  Dense arrays can
+     only represent that if the removed element is either the first
+     or the last one.  */
+  if (PVM_VAL_ARR_DENSE_P (arr))
+    {
+      if (index == 0)
+        {
+          size_t nbytes
+            = pvm_array_dense_elem_nbytes (PVM_VAL_ARR_DENSE_BITS (arr));
+          uint8_t *data = PVM_VAL_ARR_DENSE_DATA (arr);
+
+          memmove (data, data + nbytes, (nelem - 1) * nbytes);
+          PVM_VAL_ARR_DENSE_BOFFSET (arr) += PVM_VAL_ARR_DENSE_BITS (arr);
+        }
+      else if (index != nelem - 1)
+        pvm_array_undensify (arr);
+
+      if (PVM_VAL_ARR_DENSE_P (arr))
+        {
+          PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem - 1, 64);
+          return 1;
+        }
+    }
+
   for (i = index; i < (nelem - 1); i++)
     PVM_VAL_ARR_ELEM (arr,i) = PVM_VAL_ARR_ELEM (arr, i + 1);
   PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem - 1, 64);
@@ -298,6 +1023,498 @@ pvm_array_rem (pvm_val arr, pvm_val idx)
   return 1;
 }
 
+/* Size of the buffer used to transfer the contents of integral arrays
+   from/to IO spaces, in bytes.  */
+#define PVM_ARRAY_IO_CHUNK 8192
+
+int
+pvm_array_peek_integral (pvm_val arr, ios io, ios_off boff,
+                         uint64_t nelem, enum ios_endian endian)
+{
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (arr));
+  int bits = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+  int signed_p = PVM_VAL_INT (PVM_VAL_TYP_I_SIGNED_P (etype));
+  int nbytes = bits / 8;
+  size_t chunk_nelem = PVM_ARRAY_IO_CHUNK / nbytes;
+  uint8_t buf[PVM_ARRAY_IO_CHUNK];
+
+  assert (bits % 8 == 0 && bits <= 64);
+
+  if (PVM_VAL_ARR_DENSE_P (arr)
+      && PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr)) == 0)
+    PVM_VAL_ARR_DENSE_BOFFSET (arr) = boff;
+
+  while (nelem > 0)
+    {
+      size_t arr_nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+      size_t n = nelem < chunk_nelem ? nelem : chunk_nelem;
+      const uint8_t *src;
+
+      /* Decode the elements in place if the IOS allows it.  */
+      src = ios_read_ptr (io, boff, 0 /* flags */, n * nbytes);
+      if (src == NULL)
+        {
+          int ret = ios_read_bytes (io, boff, 0 /* flags */, buf,
+                                    n * nbytes);
+          if (ret != IOS_OK)
+            return ret;
+          src = buf;
+        }
+
+      /* Make room for the new elements.  The array grows
+         geometrically, since we are usually asked to add a lot of
+         them.  */
+      if (PVM_VAL_ARR_NALLOCATED (arr) - arr_nelem < n)
+        {
+          size_t nallocated = PVM_VAL_ARR_NALLOCATED (arr) * 2;
+
+          if (nallocated < arr_nelem + n)
+            nallocated = arr_nelem + n;
+
+          if (PVM_VAL_ARR_DENSE_P (arr))
+            pvm_array_dense_grow (arr, nallocated);
+          else
+            {
+              PVM_VAL_ARR_ELEMS (arr)
+                = pvm_realloc (PVM_VAL_ARR_ELEMS (arr),
+                               nallocated * sizeof (struct pvm_array_elem));
+              for (size_t i = PVM_VAL_ARR_NALLOCATED (arr);
+                   i < nallocated; ++i)
+                {
+                  PVM_VAL_ARR_ELEM_VALUE (arr, i) = PVM_NULL;
+                  PVM_VAL_ARR_ELEM_OFFSET (arr, i) = PVM_NULL;
+                }
+              PVM_VAL_ARR_NALLOCATED (arr) = nallocated;
+            }
+        }
+
+      if (PVM_VAL_ARR_DENSE_P (arr))
+        {
+          for (size_t i = 0; i < n; ++i)
+            pvm_array_dense_put (arr, arr_nelem + i,
+                                 ios_decode_uint (src + i * nbytes,
+                                                  bits, endian));
+          boff += (ios_off) n * bits;
+        }
+      else
+        {
+          for (size_t i = 0; i < n; ++i)
+            {
+              uint64_t value = ios_decode_uint (src + i * nbytes, bits,
+                                                endian);
+
+              PVM_VAL_ARR_ELEM_VALUE (arr, arr_nelem + i)
+                = pvm_make_integral (value, bits, signed_p);
+              PVM_VAL_ARR_ELEM_OFFSET (arr, arr_nelem + i)
+                = pvm_make_ulong (boff, 64);
+              boff += bits;
+            }
+        }
+
+      PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (arr_nelem + n, 64);
+      nelem -= n;
+    }
+
+  return IOS_OK;
+}
+
+int
+pvm_array_poke_integral (pvm_val arr, ios io, enum ios_endian endian)
+{
+  pvm_val etype = PVM_VAL_TYP_A_ETYPE (PVM_VAL_ARR_TYPE (arr));
+  int bits = PVM_VAL_ULONG (PVM_VAL_TYP_I_SIZE (etype));
+  int nbytes = bits / 8;
+  int dense_p = PVM_VAL_ARR_DENSE_P (arr);
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t chunk_nelem = PVM_ARRAY_IO_CHUNK / nbytes;
+  uint8_t buf[PVM_ARRAY_IO_CHUNK];
+  ios_off boff;
+
+  assert (bits % 8 == 0 && bits <= 64);
+
+  if (nelem == 0)
+    return IOS_OK;
+
+  /* The elements of the array are all of the same size, so they are
+     stored contiguously starting at the offset of the first
+     element.  */
+  boff = PVM_VAL_ULONG (pvm_array_elem_offset (arr, 0));
+
+  for (size_t idx = 0; idx < nelem;)
+    {
+      size_t n = nelem - idx < chunk_nelem ? nelem - idx : chunk_nelem;
+      int ret;
+
+      for (size_t i = 0; i < n; ++i)
+        {
+          uint8_t *p = buf + i * nbytes;
+          uint64_t value
+            = (dense_p
+               ? pvm_array_dense_get (arr, idx + i)
+               : (uint64_t) PVM_VAL_INTEGRAL (PVM_VAL_ARR_ELEM_VALUE (arr,
+                                                                      idx + i)));
+
+          if (endian == IOS_ENDIAN_MSB)
+            for (int j = nbytes - 1; j >= 0; --j, value >>= 8)
+              p[j] = value & 0xff;
+          else
+            for (int j = 0; j < nbytes; ++j, value >>= 8)
+              p[j] = value & 0xff;
+        }
+
+      ret = ios_write_bytes (io, boff, 0 /* flags */, buf, n * nbytes);
+      if (ret != IOS_OK)
+        return ret;
+
+      boff += (ios_off) n * bits;
+      idx += n;
+    }
+
+  return IOS_OK;
+}
+
+void
+pvm_array_get_bytes (pvm_val arr, uint8_t *buf)
+{
+  size_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+  size_t i;
+
+  if (PVM_VAL_ARR_DENSE_P (arr) && PVM_VAL_ARR_DENSE_BITS (arr) == 8)
+    {
+      memcpy (buf, PVM_VAL_ARR_DENSE_DATA (arr), nelem);
+      return;
+    }
+
+  for (i = 0; i < nelem; ++i)
+    buf[i] = PVM_VAL_INTEGRAL (pvm_array_elem_value (arr, i));
+}
+
+pvm_val
+pvm_make_byte_array (const uint8_t *buf, size_t len)
+{
+  pvm_val etype = pvm_make_integral_type (pvm_make_ulong (8, 64),
+                                          pvm_make_int (0, 32));
+  pvm_val type = pvm_make_array_type (etype, PVM_NULL);
+  pvm_val arr = pvm_make_array (pvm_make_ulong (len, 64), type);
+
+  memcpy (PVM_VAL_ARR_DENSE_DATA (arr), buf, len);
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (len, 64);
+  return arr;
+}
+
+pvm_val
+pvm_make_integral_array (const uint64_t *values, size_t nelem,
+                         int bits, int signed_p)
+{
+  pvm_val etype = pvm_make_integral_type (pvm_make_ulong (bits, 64),
+                                          pvm_make_int (signed_p, 32));
+  pvm_val type = pvm_make_array_type (etype, PVM_NULL);
+  pvm_val arr = pvm_make_array (pvm_make_ulong (nelem, 64), type);
+  size_t i;
+
+  for (i = 0; i < nelem; ++i)
+    pvm_array_dense_put (arr, i, values[i]);
+  PVM_VAL_ARR_NELEM (arr) = pvm_make_ulong (nelem, 64);
+  return arr;
+}
+
+/* Sorting keys of array elements.  Integral keys are stored in IKEY,
+   sign-extended to 64 bits if SIGNED_P is set.  Offsets are sorted by
+   magnitude, and their unit is stored in UNIT.  String keys are
+   stored in SKEY.  IDX is the index of the element, which is used to
+   make the sort stable.  */
+
+struct pvm_sort_key
+{
+  uint64_t ikey;
+  const char *skey;
+  uint64_t unit;
+  uint64_t idx;
+  int signed_p;
+};
+
+/* Compute in KEY the sorting key of VAL.  If FIELD is not NULL then
+   the key is the value of the field of that name in the struct VAL.
+
+   Return PVM_SORT_OK on success.  Return PVM_SORT_ELAZY if VAL is
+   PVM_NULL, i.e. it is an element of a lazy array that has not been
+   mapped yet.  Return PVM_SORT_EKEY if the key is not an integral,
+   an offset or a string.  */
+
+static int
+pvm_sort_key (pvm_val val, const char *field, struct pvm_sort_key *key)
+{
+  if (val == PVM_NULL)
+    return PVM_SORT_ELAZY;
+
+  if (field != NULL)
+    {
+      if (!PVM_IS_SCT (val))
+        return PVM_SORT_EKEY;
+      val = pvm_ref_struct_cstr (val, field);
+    }
+
+  key->skey = NULL;
+  key->unit = 0;
+  if (PVM_IS_OFF (val))
+    {
+      key->unit
+        = PVM_VAL_ULONG (PVM_VAL_TYP_O_UNIT (PVM_VAL_OFF_TYPE (val)));
+      val = PVM_VAL_OFF_MAGNITUDE (val);
+    }
+
+  if (PVM_IS_INTEGRAL (val))
+    {
+      key->signed_p = PVM_IS_INT (val) || PVM_IS_LONG (val);
+      key->ikey = (uint64_t) PVM_VAL_INTEGRAL (val);
+    }
+  else if (PVM_IS_STR (val))
+    key->skey = PVM_VAL_STR (val);
+  else
+    return PVM_SORT_EKEY;
+
+  return PVM_SORT_OK;
+}
+
+/* Compare the sorting keys KEY1 and KEY2, which shall be of the same
+   kind.  Return an integer less than, equal to or greater than zero
+   if KEY1 is respectively less than, equal to or greater than
+   KEY2.  */
+
+static int
+pvm_sort_key_cmp (const struct pvm_sort_key *key1,
+                  const struct pvm_sort_key *key2)
+{
+  if (key1->skey)
+    return strcmp (key1->skey, key2->skey);
+
+  /* Negative signed values are less than any unsigned value.  */
+  if (key1->signed_p && (int64_t) key1->ikey < 0)
+    return (key2->signed_p
+            ? ((int64_t) key1->ikey > (int64_t) key2->ikey)
+              - ((int64_t) key1->ikey < (int64_t) key2->ikey)
+            : -1);
+  if (key2->signed_p && (int64_t) key2->ikey < 0)
+    return 1;
+
+  return (key1->ikey > key2->ikey) - (key1->ikey < key2->ikey);
+}
+
+/* Return whether the keys KEY1 and KEY2 can be compared.  */
+
+static int
+pvm_sort_key_compatible_p (const struct pvm_sort_key *key1,
+                           const struct pvm_sort_key *key2)
+{
+  return ((key1->skey == NULL) == (key2->skey == NULL)
+          && key1->unit == key2->unit);
+}
+
+static int
+pvm_sort_cmp (const void *p1, const void *p2)
+{
+  const struct pvm_sort_key *key1 = p1;
+  const struct pvm_sort_key *key2 = p2;
+  int cmp = pvm_sort_key_cmp (key1, key2);
+
+  if (cmp == 0)
+    cmp = (key1->idx > key2->idx) - (key1->idx < key2->idx);
+  return cmp;
+}
+
+/* Compute in KEYS the sorting keys of the elements of ARR between
+   FROM and TO.  Return a PVM_SORT_* code.  */
+
+static int
+pvm_array_sort_keys (pvm_val arr, uint64_t from, uint64_t to,
+                     const char *field, struct pvm_sort_key *keys)
+{
+  uint64_t i;
+
+  /* The elements of dense arrays are integrals, whose keys are
+     extracted directly.  */
+  if (PVM_VAL_ARR_DENSE_P (arr) && field == NULL)
+    {
+      int bits = PVM_VAL_ARR_DENSE_BITS (arr);
+      int signed_p = PVM_VAL_ARR_DENSE_SIGNED_P (arr);
+
+      for (i = from; i < to; ++i)
+        {
+          struct pvm_sort_key *key = &keys[i - from];
+          uint64_t value = pvm_array_dense_get (arr, i);
+
+          if (signed_p && bits < 64)
+            value = (uint64_t) ((int64_t) (value << (64 - bits))
+                                >> (64 - bits));
+          key->ikey = value;
+          key->skey = NULL;
+          key->unit = 0;
+          key->signed_p = signed_p;
+          key->idx = i;
+        }
+
+      return PVM_SORT_OK;
+    }
+
+  for (i = from; i < to; ++i)
+    {
+      int ret = pvm_sort_key (pvm_array_elem_value (arr, i), field,
+                              &keys[i - from]);
+
+      if (ret != PVM_SORT_OK)
+        return ret;
+      if (!pvm_sort_key_compatible_p (&keys[0], &keys[i - from]))
+        return PVM_SORT_EKEY;
+      keys[i - from].idx = i;
+    }
+
+  return PVM_SORT_OK;
+}
+
+void
+pvm_array_permute (pvm_val arr, uint64_t from, uint64_t nelem,
+                   const uint64_t *perm)
+{
+  uint64_t i;
+
+  if (nelem == 0)
+    return;
+
+  if (PVM_VAL_ARR_DENSE_P (arr))
+    {
+      uint64_t *values = pvm_alloc_atomic (nelem * sizeof (uint64_t));
+
+      for (i = 0; i < nelem; ++i)
+        values[i] = pvm_array_dense_get (arr, perm[i]);
+      for (i = 0; i < nelem; ++i)
+        pvm_array_dense_put (arr, from + i, values[i]);
+    }
+  else
+    {
+      pvm_val *values = pvm_alloc (nelem * sizeof (pvm_val));
+
+      for (i = 0; i < nelem; ++i)
+        values[i] = pvm_array_elem_value (arr, perm[i]);
+
+      if (PVM_VAL_ARR_LAZY_P (arr))
+        {
+          /* The elements of lazy arrays are all of the same size.  */
+          for (i = 0; i < nelem; ++i)
+            *pvm_array_lazy_slot (arr, from + i, 1) = values[i];
+        }
+      else
+        {
+          uint64_t boff = PVM_VAL_ULONG (PVM_VAL_ARR_ELEM_OFFSET (arr, from));
+
+          /* The elements may be of different sizes, so recalculate
+             their offsets.  The elements past the permuted ones keep
+             their offsets.  */
+          for (i = 0; i < nelem; ++i)
+            {
+              PVM_VAL_ARR_ELEM_VALUE (arr, from + i) = values[i];
+              PVM_VAL_ARR_ELEM_OFFSET (arr, from + i)
+                = pvm_make_ulong (boff, 64);
+              boff += pvm_sizeof (values[i]);
+            }
+        }
+    }
+}
+
+int
+pvm_array_sort (pvm_val arr, uint64_t from, uint64_t to,
+                const char *field)
+{
+  uint64_t nelem = to - from;
+  struct pvm_sort_key *keys;
+  uint64_t *perm;
+  uint64_t i;
+  int ret;
+
+  if (nelem < 2)
+    return PVM_SORT_OK;
+
+  keys = pvm_alloc (nelem * sizeof (struct pvm_sort_key));
+  ret = pvm_array_sort_keys (arr, from, to, field, keys);
+  if (ret != PVM_SORT_OK)
+    return ret;
+
+  /* The indexes make all the keys different, so this sort is
+     stable.  */
+  qsort (keys, nelem, sizeof (struct pvm_sort_key), pvm_sort_cmp);
+
+  perm = pvm_alloc_atomic (nelem * sizeof (uint64_t));
+  for (i = 0; i < nelem; ++i)
+    perm[i] = keys[i].idx;
+  pvm_array_permute (arr, from, nelem, perm);
+
+  return PVM_SORT_OK;
+}
+
+int
+pvm_array_lower_bound (pvm_val arr, uint64_t from, uint64_t to,
+                       const char *field, pvm_val key, uint64_t *idx)
+{
+  struct pvm_sort_key key_key, elem_key;
+  uint64_t lo = from, hi = to;
+  int ret;
+
+  ret = pvm_sort_key (key, NULL, &key_key);
+  if (ret != PVM_SORT_OK)
+    return PVM_SORT_EKEY;
+
+  /* Look for the first element whose key is not less than KEY.  */
+  while (lo < hi)
+    {
+      uint64_t mid = lo + (hi - lo) / 2;
+
+      ret = pvm_array_sort_keys (arr, mid, mid + 1, field, &elem_key);
+      if (ret == PVM_SORT_ELAZY)
+        *idx = mid;
+      if (ret != PVM_SORT_OK)
+        return ret;
+      if (!pvm_sort_key_compatible_p (&key_key, &elem_key))
+        return PVM_SORT_EKEY;
+
+      if (pvm_sort_key_cmp (&elem_key, &key_key) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+
+  *idx = lo;
+  return PVM_SORT_OK;
+}
+
+int
+pvm_array_bsearch (pvm_val arr, uint64_t from, uint64_t to,
+                   const char *field, pvm_val key, int64_t *idx)
+{
+  struct pvm_sort_key key_key, elem_key;
+  uint64_t lo;
+  int ret;
+
+  ret = pvm_array_lower_bound (arr, from, to, field, key, &lo);
+  if (ret == PVM_SORT_ELAZY)
+    *idx = lo;
+  if (ret != PVM_SORT_OK)
+    return ret;
+
+  /* The element at LO, if any, has been probed by the search above,
+     so it is mapped and its key is compatible with KEY.  */
+  *idx = -1;
+  if (lo < to)
+    {
+      pvm_sort_key (key, NULL, &key_key);
+      ret = pvm_array_sort_keys (arr, lo, lo + 1, field, &elem_key);
+      if (ret != PVM_SORT_OK)
+        return ret;
+      if (pvm_sort_key_cmp (&elem_key, &key_key) == 0)
+        *idx = lo;
+    }
+
+  return PVM_SORT_OK;
+}
+
 pvm_val
 pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
 {
@@ -351,62 +1568,137 @@ pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type)
   return PVM_BOX (box);
 }
 
-pvm_val
-pvm_ref_struct_cstr (pvm_val sct, const char *name)
+/* Looking up struct fields and methods by name requires comparing
+   the given name with the names of the fields until a match is
+   found, which is slow in structs with many fields.
+
+   However, the names used to access struct fields are almost always
+   string literals in PVM programs, and the layout of the accessed
+   structs is almost always the same at every given access point.
+   Therefore we keep a direct-mapped cache, indexed by the address of
+   the looked up name, of the position of the field or method that was
+   found with that name the last time.  The cached position is just a
+   hint, which is verified before being used, so the cache never has
+   to be invalidated.  Every thread has its own cache, since PVMs can
+   run in parallel in several threads.  */
+
+#define PVM_FIELD_CACHE_BITS 8
+#define PVM_FIELD_CACHE_SIZE (1 << PVM_FIELD_CACHE_BITS)
+
+static _Thread_local struct
+{
+  const char *name;
+  size_t index;
+  int method_p;
+} field_cache[PVM_FIELD_CACHE_SIZE];
+
+#define PVM_FIELD_CACHE_SLOT(NAME)                                      \
+  ((((uintptr_t) (NAME)) * 0x9e3779b97f4a7c15ULL)                       \
+   >> (64 - PVM_FIELD_CACHE_BITS))
+
+/* Look for a field or method named NAME in the struct SCT.  If a
+   non-absent field is found, return 1 and set *INDEX to its position.
+   If a method is found, return 2 and set *INDEX to its position.
+   Return 0 otherwise.  Methods are only looked up if METHODS_P is not
+   zero.  */
+
+static int
+pvm_struct_lookup (pvm_val sct, const char *name, int methods_p,
+                   size_t *index)
 {
   size_t nfields, nmethods, i;
   struct pvm_struct_field *fields;
   struct pvm_struct_method *methods;
+  size_t slot = PVM_FIELD_CACHE_SLOT (name);
 
   assert (PVM_IS_SCT (sct));
 
-  /* Lookup fields.  */
   nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
   fields = PVM_VAL_SCT (sct)->fields;
+  nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (sct));
+  methods = PVM_VAL_SCT (sct)->methods;
+
+  /* Try the cached position first.  */
+  if (field_cache[slot].name == name)
+    {
+      i = field_cache[slot].index;
+
+      if (!field_cache[slot].method_p)
+        {
+          if (i < nfields
+              && fields[i].name != PVM_NULL
+              && STREQ (PVM_VAL_STR (fields[i].name), name))
+            {
+              *index = i;
+              return 1;
+            }
+        }
+      else if (methods_p
+               && i < nmethods
+               && STREQ (PVM_VAL_STR (methods[i].name), name))
+        {
+          *index = i;
+          return 2;
+        }
+    }
 
+  /* Lookup fields.  Note that absent fields have no name.  */
   for (i = 0; i < nfields; ++i)
     {
-      if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
-          && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    name))
-        return fields[i].value;
+      if (fields[i].name != PVM_NULL
+          && STREQ (PVM_VAL_STR (fields[i].name), name))
+        {
+          field_cache[slot].name = name;
+          field_cache[slot].index = i;
+          field_cache[slot].method_p = 0;
+          *index = i;
+          return 1;
+        }
+    }
+
+  /* Lookup methods.  */
+  if (methods_p)
+    {
+      for (i = 0; i < nmethods; ++i)
+        {
+          if (STREQ (PVM_VAL_STR (methods[i].name), name))
+            {
+              field_cache[slot].name = name;
+              field_cache[slot].index = i;
+              field_cache[slot].method_p = 1;
+              *index = i;
+              return 2;
+            }
+        }
     }
 
-  /* Lookup methods.  */
-  nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (sct));
-  methods = PVM_VAL_SCT (sct)->methods;
+  return 0;
+}
 
-  for (i = 0; i < nmethods; ++i)
+pvm_val
+pvm_ref_struct_cstr (pvm_val sct, const char *name)
+{
+  size_t i;
+
+  switch (pvm_struct_lookup (sct, name, 1 /* methods_p */, &i))
     {
-      if (STREQ (PVM_VAL_STR (methods[i].name),
-                 name))
-        return methods[i].value;
+    case 1:
+      return PVM_VAL_SCT_FIELD_VALUE (sct, i);
+    case 2:
+      return PVM_VAL_SCT_METHOD_VALUE (sct, i);
+    default:
+      return PVM_NULL;
     }
-
-  return PVM_NULL;
 }
 
 void
 pvm_ref_set_struct_cstr (pvm_val sct, const char *fname,
                          pvm_val value)
 {
-  size_t nfields, i;
-  struct pvm_struct_field *fields;
-
-  assert (PVM_IS_SCT (sct));
-
-  nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
-  fields = PVM_VAL_SCT (sct)->fields;
+  size_t i;
 
-  for (i = 0; i < nfields; ++i)
-    {
-      if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
-          && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    fname))
-        fields[i].value = value;
-    }
+  if (pvm_struct_lookup (sct, fname, 0 /* methods_p */, &i))
+    PVM_VAL_SCT_FIELD_VALUE (sct, i) = value;
 }
 
 pvm_val
@@ -419,22 +1711,12 @@ pvm_ref_struct (pvm_val sct, pvm_val name)
 pvm_val
 pvm_refo_struct (pvm_val sct, pvm_val name)
 {
-  size_t nfields, i;
-  struct pvm_struct_field *fields;
+  size_t i;
 
   assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
 
-  nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
-  fields = PVM_VAL_SCT (sct)->fields;
-
-  for (i = 0; i < nfields; ++i)
-    {
-      if (!PVM_VAL_SCT_FIELD_ABSENT_P (sct, i)
-          && fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    PVM_VAL_STR (name)))
-        return fields[i].offset;
-    }
+  if (pvm_struct_lookup (sct, PVM_VAL_STR (name), 0 /* methods_p */, &i))
+    return PVM_VAL_SCT_FIELD_OFFSET (sct, i);
 
   return PVM_NULL;
 }
@@ -442,25 +1724,16 @@ pvm_refo_struct (pvm_val sct, pvm_val name)
 int
 pvm_set_struct (pvm_val sct, pvm_val name, pvm_val val)
 {
-  size_t nfields, i;
-  struct pvm_struct_field *fields;
+  size_t i;
 
   assert (PVM_IS_SCT (sct) && PVM_IS_STR (name));
 
-  nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (sct));
-  fields = PVM_VAL_SCT (sct)->fields;
-
-  for (i = 0; i < nfields; ++i)
+  if (pvm_struct_lookup (sct, PVM_VAL_STR (name), 0 /* methods_p */, &i))
     {
-      if (fields[i].name != PVM_NULL
-          && STREQ (PVM_VAL_STR (fields[i].name),
-                    PVM_VAL_STR (name)))
-        {
-          PVM_VAL_SCT_FIELD_VALUE (sct,i) = val;
-          PVM_VAL_SCT_FIELD_MODIFIED (sct,i) =
-            PVM_MAKE_INT (1, 32);
-          return 1;
-        }
+      PVM_VAL_SCT_FIELD_VALUE (sct,i) = val;
+      PVM_VAL_SCT_FIELD_MODIFIED (sct,i) =
+        PVM_MAKE_INT (1, 32);
+      return 1;
     }
 
   return 0;
@@ -512,10 +1785,7 @@ pvm_make_integral_type (pvm_val size, pvm_val signed_p)
   pvm_val itype = common_int_types[bits][sign];
 
   if (itype == PVM_NULL)
-    {
-      itype = pvm_make_integral_type_1 (size, signed_p);
-      common_int_types[bits][sign] = itype;
-    }
+    itype = pvm_make_integral_type_1 (size, signed_p);
 
   return itype;
 }
@@ -612,6 +1882,217 @@ pvm_make_offset (pvm_val magnitude, pvm_val type)
   return PVM_BOX (box);
 }
 
+/* Minimum number of buckets in the index of hash maps.  At most three
+   quarters of the buckets are used, so there are always empty buckets
+   ending the probing sequences.  */
+#define PVM_MAP_MIN_BUCKETS 16
+
+pvm_val
+pvm_make_map (void)
+{
+  pvm_val_box box = pvm_make_box (PVM_VAL_TAG_MAP);
+  pvm_map map = pvm_alloc (sizeof (struct pvm_map));
+
+  map->nelem = 0;
+  map->nentries = 0;
+  map->nallocated = PVM_MAP_MIN_BUCKETS / 4 * 3;
+  map->entries
+    = pvm_alloc (map->nallocated * sizeof (struct pvm_map_entry));
+  map->nbuckets = PVM_MAP_MIN_BUCKETS;
+  map->index = pvm_alloc_atomic (map->nbuckets * sizeof (size_t));
+  memset (map->index, 0, map->nbuckets * sizeof (size_t));
+
+  PVM_VAL_BOX_MAP (box) = map;
+  return PVM_BOX (box);
+}
+
+int
+pvm_map_key_p (pvm_val val)
+{
+  return PVM_IS_INTEGRAL (val) || PVM_IS_STR (val) || PVM_IS_OFF (val);
+}
+
+static uint64_t
+pvm_map_mix (uint64_t h)
+{
+  h ^= h >> 30;
+  h *= 0xbf58476d1ce4e5b9ULL;
+  h ^= h >> 27;
+  h *= 0x94d049bb133111ebULL;
+  h ^= h >> 31;
+  return h;
+}
+
+/* Keys that are equal according to pvm_val_equal_p shall get the
+   same hash.  */
+
+static uint64_t
+pvm_map_hash (pvm_val key)
+{
+  if (PVM_IS_INTEGRAL (key))
+    return pvm_map_mix ((uint64_t) PVM_VAL_INTEGRAL (key)
+                        ^ (pvm_sizeof (key) << 56)
+                        ^ ((uint64_t) PVM_VAL_TAG (key) << 48));
+  else if (PVM_IS_STR (key))
+    {
+      /* FNV-1a.  */
+      uint64_t h = 0xcbf29ce484222325ULL;
+
+      for (const char *p = PVM_VAL_STR (key); *p; ++p)
+        h = (h ^ (uint8_t) *p) * 0x100000001b3ULL;
+      return pvm_map_mix (h);
+    }
+  else
+    {
+      pvm_val unit = PVM_VAL_TYP_O_UNIT (PVM_VAL_OFF_TYPE (key));
+
+      return (pvm_map_hash (PVM_VAL_OFF_MAGNITUDE (key))
+              ^ pvm_map_mix (PVM_VAL_ULONG (unit)));
+    }
+}
+
+/* Return the bucket of the index of MAP for the key KEY, whose hash
+   is HASH.  The bucket is either empty or refers to the entry of
+   KEY.  */
+
+static size_t
+pvm_map_bucket (pvm_map map, pvm_val key, uint64_t hash)
+{
+  size_t mask = map->nbuckets - 1;
+  size_t b = hash & mask;
+
+  while (map->index[b] != 0)
+    {
+      struct pvm_map_entry *e = &map->entries[map->index[b] - 1];
+
+      /* Removed entries have a null key, and they are skipped.  */
+      if (e->hash == hash && e->key != PVM_NULL
+          && pvm_val_equal_p (e->key, key))
+        break;
+      b = (b + 1) & mask;
+    }
+
+  return b;
+}
+
+/* Rebuild the index of MAP, dropping the removed entries, so it has
+   room for at least NELEM entries.  */
+
+static void
+pvm_map_rehash (pvm_map map, size_t nelem)
+{
+  size_t nbuckets = PVM_MAP_MIN_BUCKETS, i, j;
+
+  while (nbuckets / 4 * 3 <= nelem)
+    nbuckets *= 2;
+
+  /* Compact the entries.  */
+  for (i = 0, j = 0; i < map->nentries; ++i)
+    if (map->entries[i].key != PVM_NULL)
+      map->entries[j++] = map->entries[i];
+  for (i = j; i < map->nentries; ++i)
+    map->entries[i].key = map->entries[i].value = PVM_NULL;
+  map->nentries = j;
+
+  if (nbuckets != map->nbuckets)
+    {
+      struct pvm_map_entry *entries;
+
+      map->nallocated = nbuckets / 4 * 3;
+      entries = pvm_alloc (map->nallocated * sizeof (struct pvm_map_entry));
+      memcpy (entries, map->entries,
+              map->nentries * sizeof (struct pvm_map_entry));
+      map->entries = entries;
+      map->nbuckets = nbuckets;
+      map->index = pvm_alloc_atomic (nbuckets * sizeof (size_t));
+    }
+
+  memset (map->index, 0, map->nbuckets * sizeof (size_t));
+  for (i = 0; i < map->nentries; ++i)
+    {
+      size_t b = map->entries[i].hash & (map->nbuckets - 1);
+
+      while (map->index[b] != 0)
+        b = (b + 1) & (map->nbuckets - 1);
+      map->index[b] = i + 1;
+    }
+}
+
+void
+pvm_map_set (pvm_val mapv, pvm_val key, pvm_val val)
+{
+  pvm_map map = PVM_VAL_MAP (mapv);
+  uint64_t hash = pvm_map_hash (key);
+  size_t b = pvm_map_bucket (map, key, hash);
+  struct pvm_map_entry *e;
+
+  if (map->index[b] != 0)
+    {
+      map->entries[map->index[b] - 1].value = val;
+      return;
+    }
+
+  /* Removed entries use slots of ENTRIES and buckets of the index
+     until the next rehash.  */
+  if (map->nentries == map->nallocated)
+    {
+      pvm_map_rehash (map, map->nelem + 1);
+      b = pvm_map_bucket (map, key, hash);
+    }
+
+  e = &map->entries[map->nentries];
+  e->key = key;
+  e->value = val;
+  e->hash = hash;
+  map->index[b] = ++map->nentries;
+  map->nelem++;
+}
+
+pvm_val
+pvm_map_get (pvm_val mapv, pvm_val key)
+{
+  pvm_map map = PVM_VAL_MAP (mapv);
+  size_t b = pvm_map_bucket (map, key, pvm_map_hash (key));
+
+  if (map->index[b] == 0)
+    return PVM_NULL;
+  return map->entries[map->index[b] - 1].value;
+}
+
+int
+pvm_map_remove (pvm_val mapv, pvm_val key)
+{
+  pvm_map map = PVM_VAL_MAP (mapv);
+  size_t b = pvm_map_bucket (map, key, pvm_map_hash (key));
+  struct pvm_map_entry *e;
+
+  if (map->index[b] == 0)
+    return 0;
+
+  /* The bucket keeps referring to the entry, so the probing sequences
+     going through it are not cut.  */
+  e = &map->entries[map->index[b] - 1];
+  e->key = e->value = PVM_NULL;
+  map->nelem--;
+  return 1;
+}
+
+void
+pvm_map_elems (pvm_val mapv, pvm_val arr, int values_p)
+{
+  pvm_map map = PVM_VAL_MAP (mapv);
+  uint64_t n = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (arr));
+
+  for (size_t i = 0; i < map->nentries; ++i)
+    {
+      struct pvm_map_entry *e = &map->entries[i];
+
+      if (e->key != PVM_NULL)
+        pvm_array_insert (arr, pvm_make_ulong (n++, 64),
+                          values_p ? e->value : e->key);
+    }
+}
+
 int
 pvm_val_equal_p (pvm_val val1, pvm_val val2)
 {
@@ -624,7 +2105,7 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
     return (PVM_VAL_UINT_SIZE (val1) == PVM_VAL_UINT_SIZE (val2))
            && (PVM_VAL_UINT (val1) == PVM_VAL_UINT (val2));
   else if (PVM_IS_LONG (val1) && PVM_IS_LONG (val2))
-    return (PVM_VAL_LONG_SIZE (val1) && PVM_VAL_LONG_SIZE (val2))
+    return (PVM_VAL_LONG_SIZE (val1) == PVM_VAL_LONG_SIZE (val2))
            && (PVM_VAL_LONG (val1) == PVM_VAL_LONG (val2));
   else if (PVM_IS_ULONG (val1) && PVM_IS_ULONG (val2))
     return (PVM_VAL_ULONG_SIZE (val1) == PVM_VAL_ULONG_SIZE (val2))
@@ -722,14 +2203,32 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
                             PVM_VAL_ARR_SIZE_BOUND (val2)))
         return 0;
 
+      /* Dense arrays with the same kind of elements can be compared
+         without building the values of the elements.  */
+      if (PVM_VAL_ARR_DENSE_P (val1) && PVM_VAL_ARR_DENSE_P (val2)
+          && PVM_VAL_ARR_DENSE_BITS (val1) == PVM_VAL_ARR_DENSE_BITS (val2)
+          && (PVM_VAL_ARR_DENSE_SIGNED_P (val1)
+              == PVM_VAL_ARR_DENSE_SIGNED_P (val2)))
+        {
+          size_t nbytes
+            = pvm_array_dense_elem_nbytes (PVM_VAL_ARR_DENSE_BITS (val1));
+
+          return ((pvm_arr1_nelems == 0
+                   || (PVM_VAL_ARR_DENSE_BOFFSET (val1)
+                       == PVM_VAL_ARR_DENSE_BOFFSET (val2)))
+                  && memcmp (PVM_VAL_ARR_DENSE_DATA (val1),
+                             PVM_VAL_ARR_DENSE_DATA (val2),
+                             pvm_arr1_nelems * nbytes) == 0);
+        }
+
       for (size_t i = 0 ; i < pvm_arr1_nelems ; i++)
         {
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_VALUE (val1, i),
-                                PVM_VAL_ARR_ELEM_VALUE (val2, i)))
+          if (!pvm_val_equal_p (pvm_array_elem_value (val1, i),
+                                pvm_array_elem_value (val2, i)))
             return 0;
 
-          if (!pvm_val_equal_p (PVM_VAL_ARR_ELEM_OFFSET (val1, i),
-                                PVM_VAL_ARR_ELEM_OFFSET (val2, i)))
+          if (!pvm_val_equal_p (pvm_array_elem_offset (val1, i),
+                                pvm_array_elem_offset (val2, i)))
             return 0;
         }
 
@@ -737,6 +2236,9 @@ pvm_val_equal_p (pvm_val val1, pvm_val val2)
     }
   else if (PVM_IS_TYP (val1) && PVM_IS_TYP (val2))
     return pvm_type_equal_p (val1, val2);
+  else if (PVM_IS_MAP (val1) && PVM_IS_MAP (val2))
+    /* Hash maps are only equal to themselves.  */
+    return val1 == val2;
   else
     return 0;
 }
@@ -777,7 +2279,7 @@ pvm_elemsof (pvm_val val)
       return pvm_make_ulong (present_fields, 64);
     }
   else if (PVM_IS_STR (val))
-    return pvm_make_ulong (strlen (PVM_VAL_STR (val)), 64);
+    return pvm_make_ulong (pvm_string_length (val), 64);
   else
     return pvm_make_ulong (1, 64);
 }
@@ -809,7 +2311,22 @@ pvm_val_unmap (pvm_val val)
 {
   PVM_VAL_SET_MAPPED_P (val, 0);
 
-  if (PVM_IS_ARR (val))
+  /* The elements of dense arrays are integers and can't be
+     mapped.  */
+  if (PVM_IS_ARR (val) && PVM_VAL_ARR_LAZY_P (val))
+    {
+      size_t nelem, i;
+
+      nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      for (i = 0; i < nelem; ++i)
+        {
+          pvm_val elem_value = pvm_array_elem_value (val, i);
+
+          if (elem_value != PVM_NULL)
+            pvm_val_unmap (elem_value);
+        }
+    }
+  else if (PVM_IS_ARR (val) && !PVM_VAL_ARR_DENSE_P (val))
     {
       size_t nelem, i;
 
@@ -838,6 +2355,29 @@ pvm_val_reloc (pvm_val val, pvm_val ios, pvm_val boffset)
       uint64_t array_offset = PVM_VAL_ULONG (PVM_VAL_ARR_OFFSET (val));
 
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      if (PVM_VAL_ARR_DENSE_P (val))
+        {
+          PVM_VAL_ARR_DENSE_BOFFSET_BACK (val) = PVM_VAL_ARR_DENSE_BOFFSET (val);
+          PVM_VAL_ARR_DENSE_BOFFSET (val)
+            = boff + (PVM_VAL_ARR_DENSE_BOFFSET (val) - array_offset);
+          nelem = 0;
+        }
+      else if (PVM_VAL_ARR_LAZY_P (val))
+        {
+          /* Only the elements mapped so far need to be relocated.  */
+          for (i = 0; i < nelem; ++i)
+            {
+              pvm_val elem_value = pvm_array_elem_value (val, i);
+
+              if (elem_value != PVM_NULL)
+                pvm_val_reloc (elem_value, ios,
+                               pvm_make_ulong (boff
+                                               + i * PVM_VAL_ARR_LAZY_ESIZE (val),
+                                               64));
+            }
+          nelem = 0;
+        }
+
       for (i = 0; i < nelem; ++i)
         {
           pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
@@ -909,6 +2449,23 @@ pvm_val_ureloc (pvm_val val)
       size_t nelem, i;
 
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      if (PVM_VAL_ARR_DENSE_P (val))
+        {
+          PVM_VAL_ARR_DENSE_BOFFSET (val) = PVM_VAL_ARR_DENSE_BOFFSET_BACK (val);
+          nelem = 0;
+        }
+      else if (PVM_VAL_ARR_LAZY_P (val))
+        {
+          for (i = 0; i < nelem; ++i)
+            {
+              pvm_val elem_value = pvm_array_elem_value (val, i);
+
+              if (elem_value != PVM_NULL)
+                pvm_val_ureloc (elem_value);
+            }
+          nelem = 0;
+        }
+
       for (i = 0; i < nelem; ++i)
         {
           pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, i);
@@ -952,13 +2509,18 @@ pvm_sizeof (pvm_val val)
   else if (PVM_IS_ULONG (val))
     return PVM_VAL_ULONG_SIZE (val);
   else if (PVM_IS_STR (val))
-    return (strlen (PVM_VAL_STR (val)) + 1) * 8;
+    return (pvm_string_length (val) + 1) * 8;
   else if (PVM_IS_ARR (val))
     {
       size_t nelem, i;
       size_t size = 0;
 
       nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      if (PVM_VAL_ARR_DENSE_P (val))
+        return nelem * PVM_VAL_ARR_DENSE_BITS (val);
+      if (PVM_VAL_ARR_LAZY_P (val))
+        return nelem * PVM_VAL_ARR_LAZY_ESIZE (val);
+
       for (i = 0; i < nelem; ++i)
         size += pvm_sizeof (PVM_VAL_ARR_ELEM_VALUE (val, i));
 
@@ -1008,6 +2570,9 @@ pvm_sizeof (pvm_val val)
   else if (PVM_IS_CLS (val))
     /* By convention, closure values have size zero.  */
     return 0;
+  else if (PVM_IS_MAP (val))
+    /* Likewise for hash maps.  */
+    return 0;
   else if (val == PVM_NULL)
     /* By convention, PVM_NULL values have size zero.  */
     return 0;
@@ -1016,6 +2581,195 @@ pvm_sizeof (pvm_val val)
   return 0;
 }
 
+/* Return the number of bytes used by the boxed integer or offset
+   VAL, or zero if VAL is not boxed.  */
+
+static uint64_t
+pvm_footprint_boxed (pvm_val val)
+{
+  if (PVM_IS_LONG (val) || PVM_IS_ULONG (val))
+    return pvm_alloc_size ((void *) (((uintptr_t) val) & ~0x7));
+  if (PVM_IS_OFF (val))
+    return (pvm_alloc_size (PVM_VAL_BOX (val))
+            + pvm_alloc_size (PVM_VAL_OFF (val))
+            + pvm_footprint_boxed (PVM_VAL_OFF_MAGNITUDE (val)));
+  return 0;
+}
+
+/* Return the number of bytes used by the string VAL, or zero if VAL
+   is not a string.  */
+
+static uint64_t
+pvm_footprint_string (pvm_val val)
+{
+  pvm_val_box box;
+  uint64_t bytes = 0;
+  size_t nstack = 0, nallocated = 16;
+  pvm_val *stack;
+
+  if (!PVM_IS_STR (val))
+    return 0;
+
+  box = PVM_VAL_BOX (val);
+  if (!(PVM_VAL_BOX_FLAGS (box) & PVM_VAL_BOX_F_ROPE))
+    return pvm_alloc_size (box) + pvm_alloc_size (PVM_VAL_BOX_STR (box));
+
+  /* Ropes can be very deep, so they are traversed without recursing,
+     like in pvm_string_flatten.  */
+  stack = pvm_alloc (nallocated * sizeof (pvm_val));
+  stack[nstack++] = val;
+  while (nstack > 0)
+    {
+      pvm_val_box sbox = PVM_VAL_BOX (stack[--nstack]);
+
+      bytes += pvm_alloc_size (sbox);
+      if (PVM_VAL_BOX_FLAGS (sbox) & PVM_VAL_BOX_F_ROPE)
+        {
+          struct pvm_rope *rope = PVM_VAL_BOX_ROPE (sbox);
+
+          bytes += (pvm_alloc_size (rope)
+                    + pvm_alloc_size (__atomic_load_n (&rope->flat,
+                                                       __ATOMIC_ACQUIRE)));
+          if (nstack + 2 > nallocated)
+            {
+              nallocated *= 2;
+              stack = pvm_realloc (stack, nallocated * sizeof (pvm_val));
+            }
+          stack[nstack++] = rope->right;
+          stack[nstack++] = rope->left;
+        }
+      else
+        bytes += pvm_alloc_size (PVM_VAL_BOX_STR (sbox));
+    }
+
+  return bytes;
+}
+
+static void
+pvm_val_footprint_1 (pvm_val val, double weight, uint64_t sample,
+                     pvm_footprint_fn fn, void *data)
+{
+  uint64_t bytes, boxed_bytes, string_bytes;
+  uint64_t i, n;
+
+  if (PVM_IS_SCT (val))
+    {
+      pvm_struct sct = PVM_VAL_SCT (val);
+      uint64_t nfields = PVM_VAL_ULONG (PVM_VAL_SCT_NFIELDS (val));
+      uint64_t nmethods = PVM_VAL_ULONG (PVM_VAL_SCT_NMETHODS (val));
+
+      bytes = (pvm_alloc_size (PVM_VAL_BOX (val))
+               + pvm_alloc_size (sct)
+               + pvm_alloc_size (sct->fields)
+               + pvm_alloc_size (sct->methods));
+      boxed_bytes = (pvm_footprint_boxed (PVM_VAL_SCT_OFFSET (val))
+                     + pvm_footprint_boxed (PVM_VAL_SCT_NFIELDS (val))
+                     + pvm_footprint_boxed (PVM_VAL_SCT_NMETHODS (val)));
+      string_bytes = 0;
+
+      for (i = 0; i < nfields; ++i)
+        {
+          pvm_val value = PVM_VAL_SCT_FIELD_VALUE (val, i);
+
+          pvm_val offset = PVM_VAL_SCT_FIELD_OFFSET (val, i);
+          pvm_val name = PVM_VAL_SCT_FIELD_NAME (val, i);
+
+          boxed_bytes += (pvm_footprint_boxed (offset)
+                          + pvm_footprint_boxed (value));
+          string_bytes += (pvm_footprint_string (name)
+                           + pvm_footprint_string (value));
+        }
+      for (i = 0; i < nmethods; ++i)
+        string_bytes
+          += pvm_footprint_string (PVM_VAL_SCT_METHOD_NAME (val, i));
+
+      fn (val, weight, bytes, boxed_bytes, string_bytes, data);
+
+      for (i = 0; i < nfields; ++i)
+        {
+          pvm_val value = PVM_VAL_SCT_FIELD_VALUE (val, i);
+
+          if (PVM_IS_SCT (value) || PVM_IS_ARR (value))
+            pvm_val_footprint_1 (value, weight, sample, fn, data);
+        }
+    }
+  else if (PVM_IS_ARR (val))
+    {
+      pvm_array arr = PVM_VAL_ARR (val);
+      uint64_t nelem = PVM_VAL_ULONG (PVM_VAL_ARR_NELEM (val));
+      uint64_t step = 1;
+      double scale;
+
+      bytes = (pvm_alloc_size (PVM_VAL_BOX (val))
+               + pvm_alloc_size (arr)
+               + pvm_alloc_size (arr->elems)
+               + pvm_alloc_size (arr->dense_data)
+               + pvm_alloc_size (arr->lazy_chunks));
+      for (i = 0; i < arr->lazy_nchunks; ++i)
+        bytes += pvm_alloc_size (arr->lazy_chunks[i]);
+      if (arr->columns)
+        {
+          bytes += (pvm_alloc_size (arr->columns)
+                    + pvm_alloc_size (arr->columns->cols));
+          for (i = 0; i < arr->columns->nfields; ++i)
+            bytes += pvm_alloc_size (arr->columns->cols[i].data);
+        }
+      boxed_bytes = (pvm_footprint_boxed (PVM_VAL_ARR_OFFSET (val))
+                     + pvm_footprint_boxed (PVM_VAL_ARR_NELEM (val))
+                     + pvm_footprint_boxed (PVM_VAL_ARR_ELEMS_BOUND (val))
+                     + pvm_footprint_boxed (PVM_VAL_ARR_SIZE_BOUND (val)));
+      string_bytes = 0;
+
+      /* The elements of dense arrays are not boxed, and the offsets of
+         the elements of lazy arrays are not stored.  */
+      if (PVM_VAL_ARR_DENSE_P (val))
+        {
+          fn (val, weight, bytes, boxed_bytes, string_bytes, data);
+          return;
+        }
+
+      if (sample != 0 && nelem > sample)
+        step = nelem / sample;
+      n = (nelem + step - 1) / step;
+      scale = n ? (double) nelem / n : 1;
+
+      {
+        uint64_t elem_boxed_bytes = 0, elem_string_bytes = 0;
+
+        for (i = 0; i < nelem; i += step)
+          {
+            pvm_val value = pvm_array_elem_value (val, i);
+
+            if (!PVM_VAL_ARR_LAZY_P (val))
+              elem_boxed_bytes
+                += pvm_footprint_boxed (PVM_VAL_ARR_ELEM_OFFSET (val, i));
+            elem_boxed_bytes += pvm_footprint_boxed (value);
+            elem_string_bytes += pvm_footprint_string (value);
+          }
+
+        boxed_bytes += elem_boxed_bytes * scale;
+        string_bytes += elem_string_bytes * scale;
+      }
+
+      fn (val, weight, bytes, boxed_bytes, string_bytes, data);
+
+      for (i = 0; i < nelem; i += step)
+        {
+          pvm_val value = pvm_array_elem_value (val, i);
+
+          if (PVM_IS_SCT (value) || PVM_IS_ARR (value))
+            pvm_val_footprint_1 (value, weight * scale, sample, fn, data);
+        }
+    }
+}
+
+void
+pvm_val_footprint (pvm_val val, uint64_t sample,
+                   pvm_footprint_fn fn, void *data)
+{
+  pvm_val_footprint_1 (val, 1, sample, fn, data);
+}
+
 static void
 print_unit_name (uint64_t unit)
 {
@@ -1361,8 +3115,8 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
       pk_puts ("[");
       for (idx = 0; idx < nelem; idx++)
         {
-          pvm_val elem_value = PVM_VAL_ARR_ELEM_VALUE (val, idx);
-          pvm_val elem_offset = PVM_VAL_ARR_ELEM_OFFSET (val, idx);
+          pvm_val elem_value = pvm_array_elem_value (val, idx);
+          pvm_val elem_offset = pvm_array_elem_offset (val, idx);
 
           if (idx != 0)
             pk_puts (",");
@@ -1375,6 +3129,30 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
               break;
             }
 
+          /* Elements of lazy arrays are mapped only when they are
+             actually printed.  That requires running the mapper, so
+             they can't be printed if there is no VM.  */
+          if (elem_value == PVM_NULL && vm != NULL)
+            {
+              pvm_val exception;
+
+              elem_value = pvm_array_map_elem (vm, val, idx, &exception);
+              if (exception != PVM_NULL)
+                {
+                  if (exit_exception)
+                    *exit_exception = exception;
+                  break;
+                }
+            }
+
+          if (elem_value == PVM_NULL)
+            {
+              pk_term_class ("ellipsis");
+              pk_puts ("...");
+              pk_term_end_class ("ellipsis");
+              continue;
+            }
+
           PVM_PRINT_VAL_1 (elem_value, ndepth);
 
           if (maps && elem_offset != PVM_NULL)
@@ -1609,6 +3387,30 @@ pvm_print_val_1 (pvm vm, int depth, int mode, int base, int indent,
         pk_printf ("#<closure:%s>", PVM_VAL_STR (name));
       pk_term_end_class ("special");
     }
+  else if (PVM_IS_MAP (val))
+    {
+      pvm_map map = PVM_VAL_MAP (val);
+      size_t idx;
+      int first = 1;
+
+      /* The entries are printed in insertion order.  */
+      pk_puts ("{");
+      for (idx = 0; idx < map->nentries; idx++)
+        {
+          struct pvm_map_entry *e = &map->entries[idx];
+
+          if (e->key == PVM_NULL)
+            continue;
+          if (!first)
+            pk_puts (",");
+          first = 0;
+
+          PVM_PRINT_VAL_1 (e->key, ndepth);
+          pk_puts (":");
+          PVM_PRINT_VAL_1 (e->value, ndepth);
+        }
+      pk_puts ("}");
+    }
   else
     PK_UNREACHABLE ();
 }
@@ -1675,7 +3477,7 @@ pvm_typeof (pvm_val val)
     type = PVM_VAL_SCT_TYPE (val);
   else if (PVM_IS_TYP (val))
     type = val;
-  else if (PVM_IS_CLS (val))
+  else if (PVM_IS_CLS (val) || PVM_IS_MAP (val))
     type = PVM_NULL;
   else
     PK_UNREACHABLE ();
@@ -1862,13 +3664,22 @@ pvm_val_initialize (void)
   pvm_alloc_add_gc_roots (&string_type, 1);
   pvm_alloc_add_gc_roots (&void_type, 1);
   pvm_alloc_add_gc_roots (&common_int_types, 65 * 2);
+  pvm_alloc_add_gc_roots (&long_cache, PVM_LONG_CACHE_SIZE);
+
+  for (i = 0; i < PVM_LONG_CACHE_SIZE; ++i)
+    long_cache[i] = PVM_NULL;
 
   string_type = pvm_make_type (PVM_TYPE_STRING);
   void_type = pvm_make_type (PVM_TYPE_VOID);
 
-  for (i = 0; i < 65; ++i)
-    for (j = 0; j < 2; ++j)
-      common_int_types[i][j] = PVM_NULL;
+  for (j = 0; j < 2; ++j)
+    {
+      common_int_types[0][j] = PVM_NULL;
+      for (i = 1; i < 65; ++i)
+        common_int_types[i][j]
+          = pvm_make_integral_type_1 (pvm_make_ulong (i, 64),
+                                      pvm_make_int (j, 32));
+    }
 }
 
 void
@@ -1877,4 +3688,5 @@ pvm_val_finalize (void)
   pvm_alloc_remove_gc_roots (&string_type, 1);
   pvm_alloc_remove_gc_roots (&void_type, 1);
   pvm_alloc_remove_gc_roots (&common_int_types, 65 * 2);
+  pvm_alloc_remove_gc_roots (&long_cache, PVM_LONG_CACHE_SIZE);
 }
@@ -47,6 +47,7 @@
 #define PVM_VAL_TAG_SCT 0xb
 #define PVM_VAL_TAG_TYP 0xc
 #define PVM_VAL_TAG_CLS 0xd
+#define PVM_VAL_TAG_MAP 0xe
 
 #define PVM_VAL_BOXED_P(V) (PVM_VAL_TAG((V)) > 1)
 
@@ -98,16 +99,27 @@
    BITS+1 is the size of the integral value in bits, from 0 to 63.
 
    VAL is the value of the integer, sign- or zero-extended to 64 bits.
-   Bits marked with `x' are unused.  */
+   Bits marked with `x' are unused.
+
+   Allocating the pairs in the heap is expensive, and long values are
+   created all the time, as in offset arithmetic.  Since the pairs are
+   never modified once created, the recently made long values are kept
+   in a direct-mapped cache and reused whenever the same value of the
+   same size and signedness is made again.  See pvm_make_long_ulong.  */
 
 #define _PVM_VAL_LONG_ULONG_VAL(V) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[0])
 #define _PVM_VAL_LONG_ULONG_SIZE(V) ((int) (((int64_t *) ((((uintptr_t) V) & ~0x7)))[1]) + 1)
 
-#define PVM_MAKE_LONG_ULONG(V,S,T)                       \
-  ({ uint64_t *ll = pvm_alloc (sizeof (uint64_t) * 2);   \
-    ll[0] = (V);                                         \
-    ll[1] = ((S) - 1) & 0x3f;                            \
-    ((uint64_t) (uintptr_t) ll) | (T); })
+#define PVM_MAKE_LONG_ULONG(V,S,T)                      \
+  (pvm_make_long_ulong ((V),(S),(T)))
+
+/* Number of entries in the cache of long values.  This must be a
+   power of two.  */
+
+#define PVM_LONG_CACHE_BITS 10
+#define PVM_LONG_CACHE_SIZE (1 << PVM_LONG_CACHE_BITS)
+
+pvm_val pvm_make_long_ulong (uint64_t value, int size, int tag);
 
 #define PVM_VAL_LONG_SIZE(V) (_PVM_VAL_LONG_ULONG_SIZE (V))
 #define PVM_VAL_LONG(V) (((int64_t) ((uint64_t) _PVM_VAL_LONG_ULONG_VAL ((V)) \
@@ -144,32 +156,68 @@
    type `pvm_val_box'.  */
 
 #define PVM_VAL_BOX_TAG(B) ((B)->tag)
+#define PVM_VAL_BOX_FLAGS(B) ((B)->flags)
 #define PVM_VAL_BOX_STR(B) ((B)->v.string)
+#define PVM_VAL_BOX_ROPE(B) ((B)->v.rope)
 #define PVM_VAL_BOX_ARR(B) ((B)->v.array)
 #define PVM_VAL_BOX_SCT(B) ((B)->v.sct)
 #define PVM_VAL_BOX_TYP(B) ((B)->v.type)
 #define PVM_VAL_BOX_CLS(B) ((B)->v.cls)
 #define PVM_VAL_BOX_OFF(B) ((B)->v.offset)
+#define PVM_VAL_BOX_MAP(B) ((B)->v.map)
+
+#define PVM_VAL_BOX_F_ROPE 0x1
 
 struct pvm_val_box
 {
   uint8_t tag;
+  uint8_t flags;
   union
   {
     char *string;
+    struct pvm_rope *rope;
     struct pvm_array *array;
     struct pvm_struct *sct;
     struct pvm_type *type;
     struct pvm_off *offset;
     struct pvm_cls *cls;
+    struct pvm_map *map;
   } v;
 };
 
 typedef struct pvm_val_box *pvm_val_box;
 
-/* Strings are boxed.  */
+/* Strings are boxed.
+
+   A string is either a NUL-terminated C string or, if the
+   PVM_VAL_BOX_F_ROPE flag is set in its box, a rope holding the
+   concatenation of the strings LEFT and RIGHT.  LENGTH is the length
+   of the concatenation.  Ropes make repeated concatenations take
+   constant amortized time.  They are flattened into the C string
+   FLAT the first time their contents are accessed with PVM_VAL_STR.
+
+   The box of a rope is never changed, since the string may be
+   accessed by several threads at once.  FLAT is NULL until it is
+   published, with a release store, by pvm_string_flatten.
+
+   See pvm_string_concat and pvm_string_flatten in pvm-val.c.  */
+
+struct pvm_rope
+{
+  pvm_val left;
+  pvm_val right;
+  size_t length;
+  char *flat;
+};
+
+#define PVM_VAL_STR(V)                                                  \
+  ((PVM_VAL_BOX_FLAGS (PVM_VAL_BOX ((V))) & PVM_VAL_BOX_F_ROPE)          \
+   ? pvm_string_flatten ((V))                                           \
+   : PVM_VAL_BOX_STR (PVM_VAL_BOX ((V))))
+
+/* Flatten the rope STR into a C string, and return it.  */
 
-#define PVM_VAL_STR(V) (PVM_VAL_BOX_STR (PVM_VAL_BOX ((V))))
+char *pvm_string_flatten (pvm_val str);
 
 /* Map-able values share a set of properties/attributes, which are
    stored in `mapinfo' structures.
@@ -254,7 +302,45 @@ struct pvm_mapinfo
    NALLOCATED is the number of elements allocated in the array.
 
    ELEMS is a list of elements.  The order of the elements is
-   relevant.  */
+   relevant.
+
+   Arrays whose elements are integral values of at most 64 bits are
+   stored densely instead: DENSE_BITS is the size in bits of the
+   elements, DENSE_SIGNED_P tells whether they are signed, and
+   DENSE_DATA is a packed buffer with room for NALLOCATED elements
+   of 1, 2, 4 or 8 bytes each, holding the raw value of the
+   elements.  The elements of dense arrays are contiguous, and
+   DENSE_BOFFSET is the bit-offset of the first one, so the offset of
+   the element I is DENSE_BOFFSET + I * DENSE_BITS.  DENSE_BOFFSET_BACK
+   is a backup area used by the reloc instructions.  ELEMS is NULL in
+   dense arrays, and DENSE_BITS is zero in arrays using ELEMS.
+
+   Mapped arrays of elements of a known size can also be mapped
+   lazily, in which case the elements are only mapped from IO the
+   first time they are referenced.  LAZY_MAPPER is a closure that gets
+   the array, the index of the element, the strictness, the IO space
+   and the bit-offset of the element, maps it and returns it.  The
+   elements are LAZY_ESIZE bits each and they are read from the IO
+   space LAZY_IOS starting at LAZY_BOFFSET.  Note that these don't
+   change when the array gets relocated, so the elements are always
+   mapped from their original location.  The elements already mapped
+   are cached in LAZY_CHUNKS, a table of LAZY_NCHUNKS pointers to
+   chunks of PVM_ARRAY_LAZY_CHUNK values, which are allocated on
+   demand.  Elements not mapped yet are PVM_NULL.  The offset of the
+   element I of a lazy array is OFFSET + I * LAZY_ESIZE.  ELEMS is
+   NULL in lazy arrays, and LAZY_MAPPER is PVM_NULL in arrays that are
+   not lazy.  If LAZY_STREAM_P is set then the elements are never
+   cached, so every reference to an element maps it again.  This is
+   used to iterate on the elements of big arrays with constant
+   memory.
+
+   Lazy arrays of structs whose fields are all integrals located at
+   fixed offsets may also keep the contents of these fields in
+   COLUMNS, see struct pvm_array_columns below.  COLUMNS is NULL in
+   any other array.
+
+   Use pvm_array_elem_value and pvm_array_elem_offset to access the
+   elements of an array regardless of its representation.  */
 
 #define PVM_VAL_ARR(V) (PVM_VAL_BOX_ARR (PVM_VAL_BOX ((V))))
 #define PVM_VAL_ARR_MAPINFO(V) (PVM_VAL_ARR(V)->mapinfo)
@@ -275,6 +361,23 @@ struct pvm_mapinfo
 #define PVM_VAL_ARR_NALLOCATED(V) (PVM_VAL_ARR(V)->nallocated)
 #define PVM_VAL_ARR_ELEMS(V) (PVM_VAL_ARR(V)->elems)
 #define PVM_VAL_ARR_ELEM(V,I) (PVM_VAL_ARR(V)->elems[(I)])
+#define PVM_VAL_ARR_DENSE_BITS(V) (PVM_VAL_ARR(V)->dense_bits)
+#define PVM_VAL_ARR_DENSE_SIGNED_P(V) (PVM_VAL_ARR(V)->dense_signed_p)
+#define PVM_VAL_ARR_DENSE_BOFFSET(V) (PVM_VAL_ARR(V)->dense_boffset)
+#define PVM_VAL_ARR_DENSE_BOFFSET_BACK(V) (PVM_VAL_ARR(V)->dense_boffset_back)
+#define PVM_VAL_ARR_DENSE_DATA(V) (PVM_VAL_ARR(V)->dense_data)
+#define PVM_VAL_ARR_DENSE_P(V) (PVM_VAL_ARR_DENSE_BITS ((V)) != 0)
+#define PVM_VAL_ARR_LAZY_MAPPER(V) (PVM_VAL_ARR(V)->lazy_mapper)
+#define PVM_VAL_ARR_LAZY_IOS(V) (PVM_VAL_ARR(V)->lazy_ios)
+#define PVM_VAL_ARR_LAZY_BOFFSET(V) (PVM_VAL_ARR(V)->lazy_boffset)
+#define PVM_VAL_ARR_LAZY_ESIZE(V) (PVM_VAL_ARR(V)->lazy_esize)
+#define PVM_VAL_ARR_LAZY_CHUNKS(V) (PVM_VAL_ARR(V)->lazy_chunks)
+#define PVM_VAL_ARR_LAZY_NCHUNKS(V) (PVM_VAL_ARR(V)->lazy_nchunks)
+#define PVM_VAL_ARR_LAZY_STREAM_P(V) (PVM_VAL_ARR(V)->lazy_stream_p)
+#define PVM_VAL_ARR_LAZY_P(V) (PVM_VAL_ARR_LAZY_MAPPER ((V)) != PVM_NULL)
+#define PVM_VAL_ARR_COLUMNS(V) (PVM_VAL_ARR(V)->columns)
+
+#define PVM_ARRAY_LAZY_CHUNK 1024
 
 struct pvm_array
 {
@@ -288,10 +391,74 @@ struct pvm_array
   pvm_val nelem;
   uint64_t nallocated;
   struct pvm_array_elem *elems;
+  int dense_bits;
+  int dense_signed_p;
+  uint64_t dense_boffset;
+  uint64_t dense_boffset_back;
+  void *dense_data;
+  pvm_val lazy_mapper;
+  pvm_val lazy_ios;
+  uint64_t lazy_boffset;
+  uint64_t lazy_esize;
+  pvm_val **lazy_chunks;
+  uint64_t lazy_nchunks;
+  int lazy_stream_p;
+  struct pvm_array_columns *columns;
 };
 
 typedef struct pvm_array *pvm_array;
 
+/* The columns of a lazy array of structs hold the fields of all its
+   elements, decoded from IO in bulk, one packed column per field.
+   The elements that have not been mapped yet are built from the
+   columns when they are referenced, instead of running the lazy
+   mapper of the array.  These elements are neither cached in the
+   array nor registered in the range table of the IO space, so the
+   array is the only value tracked for the whole mapped area, and
+   every reference to an element gets a fresh copy of it.
+
+   TEMPLATE is the first element mapped by the lazy mapper.  The type,
+   mapper, writer, field names and methods of the elements built from
+   the columns are taken from it.  It is PVM_NULL until the first
+   element gets mapped.
+
+   NELEM is the number of rows of the columns, i.e. the number of
+   elements of the array when it was mapped, and COLS is a table of
+   NFIELDS columns, one per field of the elements.  They are computed
+   from the template.
+
+   The columns are filled the first time an element is built from
+   them, and refilled if the IO space has been written, or if the
+   endianness or the negative encoding used have changed, since then.
+   FILLED_P tells whether the columns have been filled, and
+   WRITE_COUNT, ENDIAN and NENC are the write count of the IO space,
+   the endianness and the negative encoding at that time.  */
+
+struct pvm_array_columns
+{
+  pvm_val template;
+  uint64_t nelem;
+  uint64_t nfields;
+  struct pvm_array_column *cols;
+  int filled_p;
+  uint64_t write_count;
+  enum ios_endian endian;
+  enum ios_nenc nenc;
+};
+
+/* BOFFSET is the bit-offset of the field relative to the beginning of
+   the element, and BITS and SIGNED_P are the size and signedness of
+   the field.  DATA holds the raw values of the field in all the
+   elements, in 1, 2, 4 or 8 bytes each, like in dense arrays.  */
+
+struct pvm_array_column
+{
+  uint64_t boffset;
+  int bits;
+  int signed_p;
+  void *data;
+};
+
 /* Array elements hold the data of the arrays, and/or information on
    how to obtain these values.
 
@@ -302,7 +469,9 @@ typedef struct pvm_array *pvm_array;
    OFFSET_BACK is a backup area used by the reloc instructions.
 
    VALUE is the value contained in the element.  If the array is
-   mapped this is the cached value, which is returned by `aref'.  */
+   mapped this is the cached value, which is returned by `aref'.
+
+   Note that these macros can't be used on dense or lazy arrays.  */
 
 #define PVM_VAL_ARR_ELEM_OFFSET(V,I) (PVM_VAL_ARR_ELEM((V),(I)).offset)
 #define PVM_VAL_ARR_ELEM_OFFSET_BACK(V,I) (PVM_VAL_ARR_ELEM((V),(I)).offset_back)
@@ -569,6 +738,47 @@ struct pvm_off
 
 typedef struct pvm_off *pvm_off;
 
+/* Hash maps are boxed values.
+
+   A hash map associates keys with values.  The keys are integral,
+   string or offset values, and two keys are the same key if they are
+   equal according to pvm_val_equal_p, i.e. if they have the same
+   type and value.  The values can be any PVM value.
+
+   The entries are stored in ENTRIES in the order they were added,
+   which is the order in which they are iterated.  NENTRIES is the
+   number of used entries, NELEM is the number of them that have not
+   been removed and NALLOCATED is the number of allocated entries.
+   Removed entries have a null key.
+
+   INDEX is an open-addressing hash table with NBUCKETS buckets,
+   which is a power of two.  Each bucket contains either zero, if it
+   is empty, or the index in ENTRIES of an entry plus one.  The
+   buckets of removed entries are not emptied until the index is
+   rebuilt, not to cut the probing sequences going through them.  */
+
+#define PVM_VAL_MAP(V) (PVM_VAL_BOX_MAP (PVM_VAL_BOX ((V))))
+#define PVM_VAL_MAP_NELEM(V) (PVM_VAL_MAP((V))->nelem)
+
+struct pvm_map_entry
+{
+  pvm_val key;
+  pvm_val value;
+  uint64_t hash;
+};
+
+struct pvm_map
+{
+  size_t nelem;
+  size_t nentries;
+  size_t nallocated;
+  struct pvm_map_entry *entries;
+  size_t nbuckets;
+  size_t *index;
+};
+
+typedef struct pvm_map *pvm_map;
+
 #define PVM_IS_INT(V) (PVM_VAL_TAG(V) == PVM_VAL_TAG_INT)
 #define PVM_IS_UINT(V) (PVM_VAL_TAG(V) == PVM_VAL_TAG_UINT)
 #define PVM_IS_LONG(V) (PVM_VAL_TAG(V) == PVM_VAL_TAG_LONG)
@@ -591,6 +801,9 @@ typedef struct pvm_off *pvm_off;
 #define PVM_IS_OFF(V)                                                   \
   (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
    && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_OFF)
+#define PVM_IS_MAP(V)                                                   \
+  (PVM_VAL_TAG(V) == PVM_VAL_TAG_BOX                                    \
+   && PVM_VAL_BOX_TAG (PVM_VAL_BOX ((V))) == PVM_VAL_TAG_MAP)
 
 
 #define PVM_IS_INTEGRAL(V)                                      \
@@ -641,6 +854,11 @@ typedef struct pvm_off *pvm_off;
         PVM_VAL_SCT_IOS ((V)) = (I);             \
     } while (0)
 
+#define PVM_VAL_IOS_PTR(V)                              \
+  (PVM_IS_ARR ((V)) ? PVM_VAL_ARR_IOS_PTR ((V))         \
+   : PVM_IS_SCT ((V)) ? PVM_VAL_SCT_IOS_PTR ((V))       \
+   : NULL)
+
 #define PVM_VAL_SET_IOS_PTR(V,P)                \
   do                                            \
     {                                           \
@@ -698,7 +916,7 @@ typedef struct pvm_off *pvm_off;
 
 #define PVM_VAL_IOSLIVE_P(V) \
   (PVM_IS_ARR ((V)) ? PVM_VAL_ARR_IOSLIVE_P ((V))       \
-   : PVM_IS_SCT ((V)) ? PVM_VAL_SCT_DIRTY_P ((V))       \
+   : PVM_IS_SCT ((V)) ? PVM_VAL_SCT_IOSLIVE_P ((V))     \
    : 0)
 
 #define PVM_VAL_SET_IOSLIVE_P(V,I)              \
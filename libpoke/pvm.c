@@ -19,21 +19,30 @@
 
 #include <config.h>
 
+#include <stdio.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <stdarg.h>
 #include <errno.h> /* For errno.  */
 #include <c-strtod.h> /* for c_strtof and c_strtod.  */
 #include <assert.h>
 #include <math.h>
+#include <pthread.h>
+#include <inttypes.h>
+#include <streq-opt.h>
 
 #include "pkl.h"
 #include "pkl-asm.h"
 #include "pvm.h"
 
+#include "pvm-val.h"
 #include "pvm-alloc.h"
+#include "pvm-prof.h"
+#include "pvm-codec.h"
 #include "pvm-program.h"
 #include "pvm-vm.h"
+#include "pkt.h"
 
 /* The following struct defines a Poke Virtual Machine.  */
 
@@ -49,6 +58,8 @@
   (PVM_STATE_BACKING_FIELD (& (PVM)->pvm_state, ios_ctx))
 #define PVM_STATE_ENV(PVM)                              \
   (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, env))
+#define PVM_STATE_TOPLEVEL(PVM)                         \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, toplevel))
 #define PVM_STATE_ENDIAN(PVM)                           \
   (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, endian))
 #define PVM_STATE_NENC(PVM)                             \
@@ -69,6 +80,37 @@
   (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, oacutoff))
 #define PVM_STATE_AUTOREMAP(PVM)                        \
   (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, autoremap))
+#define PVM_STATE_LAZYMAP(PVM)                          \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, lazymap))
+#define PVM_STATE_COLUMNAR(PVM)                         \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, columnar))
+#define PVM_STATE_ARGS(PVM)                             \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, args))
+#define PVM_STATE_PROF(PVM)                             \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, prof))
+#define PVM_STATE_EVENT_FN(PVM)                         \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, event_fn))
+#define PVM_STATE_BUDGET(PVM)                           \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, budget))
+#define PVM_STATE_CANCEL_P(PVM)                         \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, cancel_p))
+#define PVM_STATE_STACK_LIMIT(PVM)                      \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, stack_limit))
+#define PVM_STATE_RETURNSTACK_LIMIT(PVM)                \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, returnstack_limit))
+#define PVM_STATE_STACK_TOP(PVM)                        \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, stack_top))
+#define PVM_STATE_RETURNSTACK_TOP(PVM)                  \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, returnstack_top))
+#define PVM_STATE_EXCEPTIONSTACK_TOP(PVM)               \
+  (PVM_STATE_RUNTIME_FIELD (& (PVM)->pvm_state, exceptionstack_top))
+
+/* Number of elements of the main and return stacks that are not
+   available to programs.  The depth of the stacks is only checked
+   from time to time, by the `sync' instruction, so this leaves room
+   for the elements pushed in between.  */
+
+#define PVM_STACK_MARGIN 4096
 
 struct pvm
 {
@@ -80,8 +122,109 @@ struct pvm
   /* If not NULL, this is the compiler to be used when the PVM needs
      to build programs.  */
   pkl_compiler compiler;
+
+  /* If not zero, programs are run in allocation regions.  See
+     pvm_set_gc_region.  */
+  int gc_region_p;
+
+  /* If not zero, the garbage collector is run when the VM is shut
+     down.  See pvm_set_exit_gc.  */
+  int exit_gc_p;
+
+  /* Samples collected by the sampling profiler, or NULL if the
+     profiler has never been started.  Note that the profiler is only
+     active while PVM_STATE_PROF is not NULL.  */
+  pvm_prof prof;
+
+  /* Number of programs being run by the virtual machine, counting the
+     programs run from within other programs, like pretty-printers.
+     The stacks are only scanned by the collector while this is not
+     zero, so it shall be kept up to date wherever programs are
+     run.  */
+  int run_depth;
+
+  /* Data passed to the event handler, which is PVM_STATE_EVENT_FN.  */
+  void *event_data;
+
+  /* Execution budget granted to the programs, in steps and
+     nanoseconds.  Zero means no limit.  See pvm_set_budget.  */
+  uint64_t budget_steps;
+  uint64_t budget_nsec;
+
+  /* Budget of the program being run.  PVM_STATE_BUDGET points to it
+     while it applies.  */
+  struct pvm_budget budget;
+
+  /* Maximum number of elements in the main and return stacks, or
+     zero for as many as they can hold.  See pvm_set_stack_limit.  */
+  size_t stack_limit;
 };
 
+/* Number of virtual machines alive.  The subsystems used by the
+   virtual machines are initialized when the first one gets created,
+   and finalized when the last one gets shut down.  */
+
+static int pvm_num_instances;
+
+/* Number of virtual machines running programs in the process, and
+   the SIGINT handler that was installed when the first of them
+   started.  The handler of the PVM is installed while any virtual
+   machine is running a program.  */
+
+static int pvm_num_running;
+static sighandler_t pvm_previous_sigint_handler;
+
+/* The virtual machines can be used concurrently by different threads,
+   provided each of them is used by only one thread at a time.  This
+   lock protects the state shared by all of them: the counters above,
+   the subsystems and the list of states kept by Jitter.  */
+
+static pthread_mutex_t pvm_global_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return the number of elements that programs can use in the stack
+   whose backing is BACKING, given the limit LIMIT.  */
+
+static size_t
+pvm_stack_nelem (struct jitter_stack_backing *backing, size_t limit)
+{
+  size_t nelem = backing->element_no - PVM_STACK_MARGIN;
+
+  return (limit != 0 && limit < nelem) ? limit : nelem;
+}
+
+static void
+pvm_apply_stack_limit (pvm apvm)
+{
+  struct jitter_stack_backing *mainstack_backing
+    = & PVM_STATE_BACKING_FIELD (& apvm->pvm_state,
+                                 jitter_stack_stack_backing);
+  struct jitter_stack_backing *returnstack_backing
+    = & PVM_STATE_BACKING_FIELD (& apvm->pvm_state,
+                                 jitter_stack_returnstack_backing);
+
+  /* The stacks grow upwards.  */
+  PVM_STATE_STACK_LIMIT (apvm)
+    = (jitter_stack_height)
+      ((pvm_val *) mainstack_backing->memory
+       + pvm_stack_nelem (mainstack_backing, apvm->stack_limit));
+  PVM_STATE_RETURNSTACK_LIMIT (apvm)
+    = (jitter_stack_height)
+      ((pvm_val *) returnstack_backing->memory
+       + pvm_stack_nelem (returnstack_backing, apvm->stack_limit));
+}
+
+/* Forget the tops of the stacks recorded by the `sync' instruction
+   while running the previous program.  The stacks are empty when the
+   outermost program starts.  */
+
+static void
+pvm_reset_stack_tops (pvm apvm)
+{
+  PVM_STATE_STACK_TOP (apvm) = NULL;
+  PVM_STATE_RETURNSTACK_TOP (apvm) = NULL;
+  PVM_STATE_EXCEPTIONSTACK_TOP (apvm) = NULL;
+}
+
 static void
 pvm_initialize_state (pvm apvm, struct pvm_state *state)
 {
@@ -100,19 +243,43 @@ pvm_initialize_state (pvm apvm, struct pvm_state *state)
   exceptionstack_backing
     = & PVM_STATE_BACKING_FIELD (state, jitter_stack_exceptionstack_backing);
 
-  /* Register GC roots.  */
+  /* Register GC roots.  The stacks are empty while the VM is not
+     running a program, and they are not scanned then.  While it is
+     running, only their used part is scanned, see the `sync'
+     instruction.  The result of the last program is kept in the state
+     until pvm_run returns it.  */
   pvm_alloc_add_gc_roots (& PVM_STATE_RUNTIME_FIELD (state, env), 1);
-  pvm_alloc_add_gc_roots (mainstack_backing->memory,
-                          mainstack_backing->element_no);
-  pvm_alloc_add_gc_roots (returnstack_backing->memory,
-                          returnstack_backing->element_no);
-  pvm_alloc_add_gc_roots (exceptionstack_backing->memory,
-                          exceptionstack_backing->element_no);
+  pvm_alloc_add_gc_roots (& PVM_STATE_RUNTIME_FIELD (state, toplevel), 1);
+  pvm_alloc_add_gc_roots (& PVM_STATE_BACKING_FIELD (state, result_value), 1);
+  pvm_alloc_add_gc_roots (& PVM_STATE_BACKING_FIELD (state,
+                                                     exit_exception_value),
+                          1);
+  pvm_alloc_add_gc_stack (mainstack_backing->memory,
+                          mainstack_backing->element_no * sizeof (pvm_val),
+                          &apvm->run_depth,
+                          & PVM_STATE_RUNTIME_FIELD (state, stack_top),
+                          PVM_STACK_MARGIN * sizeof (pvm_val));
+  pvm_alloc_add_gc_stack (returnstack_backing->memory,
+                          returnstack_backing->element_no * sizeof (pvm_val),
+                          &apvm->run_depth,
+                          & PVM_STATE_RUNTIME_FIELD (state, returnstack_top),
+                          PVM_STACK_MARGIN * sizeof (pvm_val));
+  pvm_alloc_add_gc_stack (exceptionstack_backing->memory,
+                          exceptionstack_backing->element_no
+                          * sizeof (struct pvm_exception_handler),
+                          &apvm->run_depth,
+                          & PVM_STATE_RUNTIME_FIELD (state,
+                                                     exceptionstack_top),
+                          PVM_STACK_MARGIN
+                          * sizeof (struct pvm_exception_handler));
 
   /* Initialize the global environment.  Note we do this after
      registering GC roots, since we are allocating memory.  */
   PVM_STATE_RUNTIME_FIELD (state, env) = pvm_env_new (0 /* hint */);
+  PVM_STATE_RUNTIME_FIELD (state, toplevel)
+    = PVM_STATE_RUNTIME_FIELD (state, env);
   PVM_STATE_BACKING_FIELD (state, vm) = apvm;
+  pvm_apply_stack_limit (apvm);
 }
 
 pvm
@@ -124,6 +291,7 @@ pvm_init (void)
   apvm = calloc (1, sizeof (struct pvm));
   if (!apvm)
     return NULL;
+  apvm->exit_gc_p = 1;
 
   /* Initialize the IO space.  */
   ios_ctx = ios_init ();
@@ -133,33 +301,75 @@ pvm_init (void)
       return NULL;
     }
 
-  /* Initialize the memory allocation subsystem.  */
-  pvm_alloc_initialize ();
+  pthread_mutex_lock (&pvm_global_lock);
+  if (pvm_num_instances++ == 0)
+    {
+      /* Initialize the memory allocation subsystem.  */
+      pvm_alloc_initialize ();
+
+      /* Initialize values.  */
+      pvm_val_initialize ();
 
-  /* Initialize values.  */
-  pvm_val_initialize ();
+      /* Initialize the VM subsystem.  */
+      pvm_initialize ();
 
-  /* Initialize the VM subsystem.  */
-  pvm_initialize ();
+      /* Initialize pvm-program.  */
+      pvm_program_init ();
+
+      /* Initialize the tables of pvm-codec.  */
+      pvm_codec_initialize ();
+    }
 
   /* Initialize the VM state.  */
   pvm_initialize_state (apvm, &apvm->pvm_state);
+  pthread_mutex_unlock (&pvm_global_lock);
   PVM_STATE_IOS_CONTEXT (apvm) = ios_ctx;
 
-  /* Initialize pvm-program.  */
-  pvm_program_init ();
-
   return apvm;
 }
 
-extern jitter_print_context jitter_context; /* pvm-program.c */
+pvm
+pvm_clone (pvm apvm)
+{
+  pvm clone;
+
+  clone = pvm_init ();
+  if (!clone)
+    return NULL;
+
+  /* Global variables are copied, but not their values.  */
+  PVM_STATE_ENV (clone) = pvm_env_dup_toplevel (PVM_STATE_TOPLEVEL (apvm));
+  PVM_STATE_TOPLEVEL (clone) = PVM_STATE_ENV (clone);
+
+  PVM_STATE_ENDIAN (clone) = PVM_STATE_ENDIAN (apvm);
+  PVM_STATE_NENC (clone) = PVM_STATE_NENC (apvm);
+  PVM_STATE_PRETTY_PRINT (clone) = PVM_STATE_PRETTY_PRINT (apvm);
+  PVM_STATE_OMODE (clone) = PVM_STATE_OMODE (apvm);
+  PVM_STATE_OBASE (clone) = PVM_STATE_OBASE (apvm);
+  PVM_STATE_OMAPS (clone) = PVM_STATE_OMAPS (apvm);
+  PVM_STATE_ODEPTH (clone) = PVM_STATE_ODEPTH (apvm);
+  PVM_STATE_OINDENT (clone) = PVM_STATE_OINDENT (apvm);
+  PVM_STATE_OACUTOFF (clone) = PVM_STATE_OACUTOFF (apvm);
+  PVM_STATE_AUTOREMAP (clone) = PVM_STATE_AUTOREMAP (apvm);
+  PVM_STATE_LAZYMAP (clone) = PVM_STATE_LAZYMAP (apvm);
+  PVM_STATE_COLUMNAR (clone) = PVM_STATE_COLUMNAR (apvm);
+  clone->gc_region_p = apvm->gc_region_p;
+  clone->budget_steps = apvm->budget_steps;
+  clone->budget_nsec = apvm->budget_nsec;
+  pvm_set_stack_limit (clone, apvm->stack_limit);
+
+  return clone;
+}
 
 void
 pvm_print_profile (pvm apvm)
 {
   struct pvm_profile_runtime *p
     = pvm_state_profile_runtime (&apvm->pvm_state);
-  pvm_profile_runtime_print_unspecialized (jitter_context, p);
+  jitter_print_context ctx = pvm_program_make_print_context ();
+
+  pvm_profile_runtime_print_unspecialized (ctx, p);
+  jitter_print_context_destroy (ctx);
 }
 
 void
@@ -168,6 +378,177 @@ pvm_reset_profile (pvm apvm)
   struct pvm_profile_runtime *p
     = pvm_state_profile_runtime (&apvm->pvm_state);
   pvm_profile_runtime_clear (p);
+  if (apvm->prof)
+    pvm_prof_reset (apvm->prof);
+}
+
+int
+pvm_start_sampling (pvm apvm, unsigned int interval)
+{
+  if (apvm->prof == NULL)
+    {
+      apvm->prof = pvm_prof_new ();
+      if (apvm->prof == NULL)
+        return 0;
+    }
+
+  if (!pvm_prof_start_timer (interval))
+    return 0;
+
+  PVM_STATE_PROF (apvm) = apvm->prof;
+  return 1;
+}
+
+void
+pvm_stop_sampling (pvm apvm)
+{
+  if (PVM_STATE_PROF (apvm) == NULL)
+    return;
+
+  pvm_prof_stop_timer ();
+  PVM_STATE_PROF (apvm) = NULL;
+}
+
+int
+pvm_sampling_p (pvm apvm)
+{
+  return PVM_STATE_PROF (apvm) != NULL;
+}
+
+void
+pvm_map_samples (pvm apvm, pvm_prof_fn fn, void *data)
+{
+  if (apvm->prof)
+    pvm_prof_map (apvm->prof, fn, data);
+}
+
+void
+pvm_set_event_fn (pvm apvm, pvm_event_fn fn, void *data)
+{
+  PVM_STATE_EVENT_FN (apvm) = fn;
+  apvm->event_data = data;
+}
+
+void
+pvm_event_map (pvm apvm, int kind, pvm_val val)
+{
+  pvm_event_fn fn = PVM_STATE_EVENT_FN (apvm);
+  struct pvm_event event;
+  pvm_val ios, boff;
+
+  if (fn == NULL || !PVM_VAL_MAPPABLE_P (val))
+    return;
+
+  ios = PVM_VAL_IOS (val);
+  boff = PVM_VAL_OFFSET (val);
+
+  event.kind = kind;
+  event.type_name = NULL;
+  if (PVM_IS_SCT (val))
+    {
+      pvm_val name = PVM_VAL_TYP_S_NAME (PVM_VAL_SCT_TYPE (val));
+
+      if (name != PVM_NULL)
+        event.type_name = PVM_VAL_STR (name);
+    }
+  event.ios = ios == PVM_NULL ? -1 : PVM_VAL_INT (ios);
+  event.offset = boff == PVM_NULL ? 0 : PVM_VAL_ULONG (boff);
+  event.size = pvm_sizeof (val);
+  event.value = val;
+
+  fn (&event, apvm->event_data);
+}
+
+void
+pvm_event_map_begin (pvm apvm, pvm_val ios, pvm_val boff, pvm_val name)
+{
+  pvm_event_fn fn = PVM_STATE_EVENT_FN (apvm);
+  struct pvm_event event;
+
+  if (fn == NULL)
+    return;
+
+  event.kind = PVM_EVENT_MAP_BEGIN;
+  event.type_name = name == PVM_NULL ? NULL : PVM_VAL_STR (name);
+  event.ios = ios == PVM_NULL ? -1 : PVM_VAL_INT (ios);
+  event.offset = PVM_VAL_ULONG (boff);
+  event.size = 0;
+  event.value = PVM_NULL;
+
+  fn (&event, apvm->event_data);
+}
+
+void
+pvm_event_raise (pvm apvm, pvm_val exception)
+{
+  pvm_event_fn fn = PVM_STATE_EVENT_FN (apvm);
+  struct pvm_event event;
+  pvm_val code;
+
+  if (fn == NULL)
+    return;
+
+  code = pvm_ref_struct_cstr (exception, "code");
+
+  event.kind = (code != PVM_NULL && PVM_VAL_INT (code) == PVM_E_CONSTRAINT
+                ? PVM_EVENT_CONSTRAINT : PVM_EVENT_RAISE);
+  event.type_name = NULL;
+  event.ios = -1;
+  event.offset = 0;
+  event.size = 0;
+  event.value = exception;
+
+  fn (&event, apvm->event_data);
+}
+
+void
+pvm_event_progress (pvm apvm, pvm_val ios, pvm_val boff, pvm_val eboff,
+                    pvm_val eidx, pvm_val ebound, pvm_val sbound)
+{
+  pvm_event_fn fn = PVM_STATE_EVENT_FN (apvm);
+  struct pvm_event event;
+  uint64_t done = PVM_VAL_ULONG (eboff) - PVM_VAL_ULONG (boff);
+
+  if (fn == NULL)
+    return;
+
+  event.kind = PVM_EVENT_PROGRESS;
+  event.type_name = "map";
+  event.ios = PVM_VAL_INT (ios);
+  event.offset = done;
+  if (sbound != PVM_NULL)
+    event.size = PVM_VAL_ULONG (sbound);
+  else if (ebound != PVM_NULL && PVM_VAL_ULONG (eidx) != 0)
+    event.size = (uint64_t) ((double) done / PVM_VAL_ULONG (eidx)
+                             * PVM_VAL_ULONG (ebound));
+  else
+    event.size = 0;
+  event.value = PVM_NULL;
+
+  fn (&event, apvm->event_data);
+}
+
+int
+pvm_copy_progress (ios io, uint64_t done, uint64_t total, void *data)
+{
+  pvm apvm = data;
+  pvm_event_fn fn = PVM_STATE_EVENT_FN (apvm);
+
+  if (fn != NULL)
+    {
+      struct pvm_event event;
+
+      event.kind = PVM_EVENT_PROGRESS;
+      event.type_name = "copy";
+      event.ios = ios_get_id (io);
+      event.offset = done * 8;
+      event.size = total * 8;
+      event.value = PVM_NULL;
+
+      fn (&event, apvm->event_data);
+    }
+
+  return PVM_STATE_CANCEL_P (apvm);
 }
 
 pvm_env
@@ -176,19 +557,93 @@ pvm_get_env (pvm apvm)
   return PVM_STATE_ENV (apvm);
 }
 
+/* Return the current monotonic time, in nanoseconds.  */
+
+static uint64_t
+pvm_budget_now (void)
+{
+  struct timespec ts;
+
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* Install the SIGINT handler of the PVM, if no other virtual machine
+   is running a program, and account VM as running.  */
+
+static void
+pvm_sigint_acquire (void)
+{
+  pthread_mutex_lock (&pvm_global_lock);
+  if (pvm_num_running++ == 0)
+    pvm_previous_sigint_handler = signal (SIGINT, pvm_handle_signal);
+  pthread_mutex_unlock (&pvm_global_lock);
+}
+
+/* Undo pvm_sigint_acquire.  */
+
+static void
+pvm_sigint_release (void)
+{
+  pthread_mutex_lock (&pvm_global_lock);
+  if (--pvm_num_running == 0)
+    signal (SIGINT, pvm_previous_sigint_handler);
+  pthread_mutex_unlock (&pvm_global_lock);
+}
+
 enum pvm_exit_code
 pvm_run (pvm apvm, pvm_program program, pvm_val *res, pvm_val *exc)
 {
-  sighandler_t previous_handler;
   pvm_routine routine = pvm_program_routine (program);
+  pvm_prof prof = PVM_STATE_PROF (apvm);
+  size_t prof_depth = prof ? pvm_prof_depth (prof) : 0;
 
   PVM_STATE_RESULT_VALUE (apvm) = PVM_NULL;
   PVM_STATE_EXIT_EXCEPTION_VALUE (apvm) = PVM_NULL;
   PVM_STATE_EXIT_CODE (apvm) = PVM_EXIT_OK;
 
-  previous_handler = signal (SIGINT, pvm_handle_signal);
+  /* The contents of volatile IO spaces may have changed since the last
+     time we looked.  */
+  ios_invalidate_volatile_caches (PVM_STATE_IOS_CONTEXT (apvm));
+
+  if (apvm->run_depth == 0)
+    {
+      pvm_sigint_acquire ();
+      PVM_STATE_CANCEL_P (apvm) = 0;
+      pvm_reset_stack_tops (apvm);
+    }
+  if (apvm->gc_region_p)
+    pvm_alloc_region_begin ();
+  if (apvm->run_depth == 0
+      && (apvm->budget_steps != 0 || apvm->budget_nsec != 0))
+    {
+      apvm->budget.steps = apvm->budget_steps;
+      apvm->budget.max_steps = apvm->budget_steps;
+      apvm->budget.deadline
+        = apvm->budget_nsec ? pvm_budget_now () + apvm->budget_nsec : 0;
+      apvm->budget.countdown = PVM_BUDGET_CLOCK_PERIOD;
+      apvm->budget.exhausted_p = 0;
+      PVM_STATE_BUDGET (apvm) = &apvm->budget;
+    }
+  apvm->run_depth++;
   pvm_execute_routine (routine, &apvm->pvm_state);
-  signal (SIGINT, previous_handler);
+  apvm->run_depth--;
+  if (apvm->gc_region_p)
+    pvm_alloc_region_end ();
+  if (apvm->run_depth == 0)
+    {
+      /* Writes interrupted by exceptions may have left write batches
+         open.  */
+      ios_close_write_batches (PVM_STATE_IOS_CONTEXT (apvm));
+      PVM_STATE_BUDGET (apvm) = NULL;
+      PVM_STATE_CANCEL_P (apvm) = 0;
+      pvm_sigint_release ();
+    }
+
+  /* Programs may exit from within functions, leaving frames in the
+     profiler shadow stack.  */
+  if (prof && PVM_STATE_PROF (apvm) == prof)
+    pvm_prof_unwind (prof, prof_depth);
 
   if (res != NULL)
     *res = PVM_STATE_RESULT_VALUE (apvm);
@@ -198,6 +653,96 @@ pvm_run (pvm apvm, pvm_program program, pvm_val *res, pvm_val *exc)
   return PVM_STATE_EXIT_CODE (apvm);
 }
 
+enum pvm_exit_code
+pvm_run_args (pvm apvm, pvm_program program, pvm_val *args,
+              pvm_val *res, pvm_val *exc)
+{
+  pvm_val *saved_args = PVM_STATE_ARGS (apvm);
+  enum pvm_exit_code ret;
+
+  /* Programs may be run while running another program, for example
+     from the terminal callbacks, so restore the arguments of the
+     previous program afterwards.  */
+  PVM_STATE_ARGS (apvm) = args;
+  ret = pvm_run (apvm, program, res, exc);
+  PVM_STATE_ARGS (apvm) = saved_args;
+  return ret;
+}
+
+void
+pvm_set_budget (pvm apvm, uint64_t steps, uint64_t nsec)
+{
+  apvm->budget_steps = steps;
+  apvm->budget_nsec = nsec;
+}
+
+void
+pvm_set_stack_limit (pvm apvm, size_t nelem)
+{
+  apvm->stack_limit = nelem;
+  pvm_apply_stack_limit (apvm);
+}
+
+size_t
+pvm_stack_limit (pvm apvm)
+{
+  return pvm_stack_nelem (& PVM_STATE_BACKING_FIELD
+                          (& apvm->pvm_state, jitter_stack_stack_backing),
+                          apvm->stack_limit);
+}
+
+uint64_t
+pvm_budget_steps (pvm apvm)
+{
+  return apvm->budget_steps;
+}
+
+uint64_t
+pvm_budget_nsec (pvm apvm)
+{
+  return apvm->budget_nsec;
+}
+
+int
+pvm_budget_exhausted_p (struct pvm_budget *budget)
+{
+  if (budget->exhausted_p)
+    return 1;
+
+  if (budget->max_steps != 0 && budget->steps-- == 0)
+    budget->exhausted_p = 1;
+  else if (budget->deadline != 0 && --budget->countdown == 0)
+    {
+      budget->countdown = PVM_BUDGET_CLOCK_PERIOD;
+      if (pvm_budget_now () >= budget->deadline)
+        budget->exhausted_p = 1;
+    }
+
+  return budget->exhausted_p;
+}
+
+void
+pvm_interrupt (pvm apvm)
+{
+  /* Pending signals are only cleared when programs exit, so don't
+     leave one behind for the next program to be run.  */
+  if (apvm->run_depth > 0)
+    pvm_handle_signal (SIGINT);
+}
+
+void
+pvm_cancel (pvm apvm)
+{
+  if (apvm->run_depth > 0)
+    PVM_STATE_CANCEL_P (apvm) = 1;
+}
+
+int
+pvm_cancelled_p (pvm apvm)
+{
+  return PVM_STATE_CANCEL_P (apvm);
+}
+
 void
 pvm_call_closure (pvm vm, pvm_val cls, pvm_val *exit_exception, ...)
 {
@@ -227,6 +772,446 @@ pvm_call_closure (pvm vm, pvm_val cls, pvm_val *exit_exception, ...)
 
 }
 
+pvm_val
+pvm_array_map_elem (pvm vm, pvm_val arr, uint64_t idx,
+                    pvm_val *exit_exception)
+{
+  pvm_program program;
+  pkl_asm pasm;
+  pvm_val val = pvm_array_elem_value (arr, idx);
+  pvm_val exception = PVM_NULL;
+
+  if (val == PVM_NULL && PVM_VAL_ARR_COLUMNS (arr) != NULL)
+    {
+      ios io = ios_search_by_id (PVM_STATE_IOS_CONTEXT (vm),
+                                 PVM_VAL_INT (PVM_VAL_ARR_LAZY_IOS (arr)));
+
+      val = pvm_array_columns_elem (arr, idx, io,
+                                    PVM_STATE_ENDIAN (vm),
+                                    PVM_STATE_NENC (vm));
+    }
+
+  if (val == PVM_NULL && PVM_VAL_ARR_LAZY_P (arr))
+    {
+      uint64_t boff = (PVM_VAL_ARR_LAZY_BOFFSET (arr)
+                       + idx * PVM_VAL_ARR_LAZY_ESIZE (arr));
+
+      pasm = pkl_asm_new (NULL /* ast */,
+                          pvm_compiler (vm), 1 /* prologue */);
+
+      /* See the aref instruction.  */
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, arr);
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (idx, 64));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH,
+                    pvm_make_int (PVM_VAL_ARR_STRICT_P (arr), 32));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_VAL_ARR_LAZY_IOS (arr));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (boff, 64));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, PVM_VAL_ARR_LAZY_MAPPER (arr));
+      pkl_asm_insn (pasm, PKL_INSN_CALL);
+
+      program = pkl_asm_finish (pasm, 1 /* epilogue */);
+      pvm_program_make_executable (program);
+      if (pvm_run (vm, program, &val, &exception) != PVM_EXIT_OK
+          || exception != PVM_NULL)
+        val = PVM_NULL;
+      pvm_destroy_program (program);
+    }
+
+  if (exit_exception)
+    *exit_exception = exception;
+  return val;
+}
+
+/* A worker of pvm_call_closure_parallel, running a program in a
+   clone of the calling VM.  */
+
+struct pvm_worker
+{
+  pvm vm;
+  pvm_program program;
+  pthread_t thread;
+  int started_p;
+  pvm_val result;
+  pvm_val exception;
+};
+
+static void *
+pvm_worker_run (void *data)
+{
+  struct pvm_worker *worker = data;
+  pvm vm = worker->vm;
+
+  /* Note that pvm_run is not used here, since it installs a signal
+     handler for the whole process.  */
+  pvm_register_thread ();
+  PVM_STATE_RESULT_VALUE (vm) = PVM_NULL;
+  PVM_STATE_EXIT_EXCEPTION_VALUE (vm) = PVM_NULL;
+  PVM_STATE_EXIT_CODE (vm) = PVM_EXIT_OK;
+  pvm_reset_stack_tops (vm);
+  vm->run_depth++;
+  pvm_execute_routine (pvm_program_routine (worker->program),
+                       &vm->pvm_state);
+  vm->run_depth--;
+  worker->result = PVM_STATE_RESULT_VALUE (vm);
+  worker->exception = PVM_STATE_EXIT_EXCEPTION_VALUE (vm);
+  pvm_unregister_thread ();
+
+  return NULL;
+}
+
+int
+pvm_call_closure_parallel (pvm vm, pvm_val cls, ios io,
+                           uint64_t from, uint64_t to, uint64_t align,
+                           int nthreads, pvm_val *results,
+                           pvm_val *exception)
+{
+  const char *handler = ios_handler (io);
+  const char *dev_if_name = ios_get_dev_if_name (io);
+  struct pvm_worker *workers;
+  uint64_t chunk_size, nunits;
+  int i, nworkers = 0, ret;
+
+  /* Only IO spaces whose contents can be accessed again by opening
+     their handler can be accessed in parallel.  */
+  if (nthreads < 1 || align == 0 || to < from
+      || ios_volatile_p (io)
+      || (!STREQ (dev_if_name, "FILE") && !STREQ (dev_if_name, "MMAP")))
+    return -1;
+
+  nunits = (to - from + align - 1) / align;
+  chunk_size = (nunits + nthreads - 1) / nthreads * align;
+  if (chunk_size == 0)
+    chunk_size = align;
+
+  workers = calloc (nthreads, sizeof (struct pvm_worker));
+  if (workers == NULL)
+    return -1;
+
+  *exception = PVM_NULL;
+
+  /* Create the workers.  This is done in the calling thread, since
+     the assembler uses the compiler of VM, which belongs to it.  */
+  for (i = 0; i < nthreads; ++i)
+    {
+      struct pvm_worker *worker = &workers[i];
+      uint64_t chunk_from = from + i * chunk_size;
+      uint64_t chunk_to = chunk_from + chunk_size;
+      pkl_asm pasm;
+      int ios_id;
+
+      if (chunk_from >= to)
+        break;
+      if (chunk_to > to)
+        chunk_to = to;
+
+      worker->vm = pvm_clone (vm);
+      if (worker->vm == NULL)
+        goto error;
+      nworkers++;
+
+      ios_id = ios_open (PVM_STATE_IOS_CONTEXT (worker->vm), handler,
+                          IOS_F_READ, 1 /* set_cur */);
+      if (ios_id < 0)
+        goto error;
+      ios_set_bias (ios_cur (PVM_STATE_IOS_CONTEXT (worker->vm)),
+                    ios_get_bias (io));
+
+      pasm = pkl_asm_new (NULL /* ast */,
+                          pvm_compiler (vm), 1 /* prologue */);
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_int (ios_id, 32));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (chunk_from, 64));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, pvm_make_ulong (chunk_to, 64));
+      pkl_asm_insn (pasm, PKL_INSN_PUSH, cls);
+      pkl_asm_insn (pasm, PKL_INSN_CALL);
+      worker->program = pkl_asm_finish (pasm, 1 /* epilogue */);
+      pvm_program_make_executable (worker->program);
+
+      worker->result = PVM_NULL;
+      worker->exception = PVM_NULL;
+      pvm_alloc_add_gc_roots (&worker->result, 1);
+      pvm_alloc_add_gc_roots (&worker->exception, 1);
+    }
+
+  ret = nworkers;
+  for (i = 0; i < nworkers; ++i)
+    {
+      if (pthread_create (&workers[i].thread, NULL,
+                          pvm_worker_run, &workers[i]) != 0)
+        {
+          ret = -1;
+          break;
+        }
+      workers[i].started_p = 1;
+    }
+
+  for (i = 0; i < nworkers; ++i)
+    {
+      struct pvm_worker *worker = &workers[i];
+
+      if (worker->started_p)
+        pthread_join (worker->thread, NULL);
+      results[i] = worker->result;
+      if (*exception == PVM_NULL)
+        *exception = worker->exception;
+    }
+
+ done:
+  for (i = 0; i < nworkers; ++i)
+    {
+      struct pvm_worker *worker = &workers[i];
+
+      if (worker->program)
+        {
+          pvm_destroy_program (worker->program);
+          pvm_alloc_remove_gc_roots (&worker->result, 1);
+          pvm_alloc_remove_gc_roots (&worker->exception, 1);
+        }
+      pvm_shutdown (worker->vm);
+    }
+  free (workers);
+  return ret;
+
+ error:
+  ret = -1;
+  goto done;
+}
+
+/* The state shared by the workers of pvm_call_closure_regions.
+
+   NEXT is the index of the next region to process, which is
+   incremented atomically by the workers as they pull regions.
+   FAILED_P is set when a worker fails or gets interrupted by an
+   exception, so the others stop pulling regions.  */
+
+struct pvm_region_pool
+{
+  pvm_program program;
+  int nregions;
+  const int *sources;
+  const uint64_t *bases;
+  const uint64_t *lengths;
+  pvm_val *results;
+  pvm_val *exceptions;
+  int next;
+  int failed_p;
+  int error_p;
+};
+
+/* A worker of pvm_call_closure_regions.  BASE_IDS are the
+   descriptors, in the IO context of VM, of the shared IO spaces
+   opened on the handlers of the source IO spaces.  */
+
+struct pvm_region_worker
+{
+  pvm vm;
+  pthread_t thread;
+  int started_p;
+  int *base_ids;
+  struct pvm_region_pool *pool;
+};
+
+static void *
+pvm_region_worker_run (void *data)
+{
+  struct pvm_region_worker *worker = data;
+  struct pvm_region_pool *pool = worker->pool;
+  pvm vm = worker->vm;
+  ios_context ios_ctx = PVM_STATE_IOS_CONTEXT (vm);
+
+  pvm_register_thread ();
+  while (!__atomic_load_n (&pool->failed_p, __ATOMIC_RELAXED))
+    {
+      int i = __atomic_fetch_add (&pool->next, 1, __ATOMIC_RELAXED);
+      char handler[128];
+      int ios_id;
+
+      if (i >= pool->nregions)
+        break;
+
+      /* The region is accessed through a sub IO space of the shared
+         IO space, which becomes the current IO space in VM and is
+         thus the one passed to the closure by the program.  */
+      snprintf (handler, sizeof (handler),
+                "sub://%d/%" PRIu64 "/%" PRIu64 "/",
+                worker->base_ids[pool->sources[i]],
+                pool->bases[i], pool->lengths[i]);
+      ios_id = ios_open (ios_ctx, handler, IOS_F_READ, 1 /* set_cur */);
+      if (ios_id < 0)
+        {
+          pool->error_p = 1;
+          __atomic_store_n (&pool->failed_p, 1, __ATOMIC_RELAXED);
+          break;
+        }
+
+      PVM_STATE_RESULT_VALUE (vm) = PVM_NULL;
+      PVM_STATE_EXIT_EXCEPTION_VALUE (vm) = PVM_NULL;
+      PVM_STATE_EXIT_CODE (vm) = PVM_EXIT_OK;
+      pvm_reset_stack_tops (vm);
+      vm->run_depth++;
+      pvm_execute_routine (pvm_program_routine (pool->program),
+                           &vm->pvm_state);
+      vm->run_depth--;
+      pool->results[i] = PVM_STATE_RESULT_VALUE (vm);
+      pool->exceptions[i] = PVM_STATE_EXIT_EXCEPTION_VALUE (vm);
+      if (pool->exceptions[i] != PVM_NULL)
+        __atomic_store_n (&pool->failed_p, 1, __ATOMIC_RELAXED);
+
+      ios_close (ios_ctx, ios_search_by_id (ios_ctx, ios_id));
+    }
+  pvm_unregister_thread ();
+
+  return NULL;
+}
+
+int
+pvm_call_closure_regions (pvm vm, pvm_val cls, int nregions,
+                          ios *regions_ios, const uint64_t *offsets,
+                          const uint64_t *sizes, int nthreads,
+                          pvm_val *results, pvm_val *exception)
+{
+  struct pvm_region_pool pool;
+  struct pvm_region_worker *workers = NULL;
+  ios *sources = NULL;
+  int *source_idx = NULL;
+  uint64_t *bases = NULL, *lengths = NULL;
+  int i, j, nsources = 0, nworkers = 0, ret = -1;
+  pkl_asm pasm;
+
+  if (nthreads < 1 || nregions < 0)
+    return -1;
+
+  *exception = PVM_NULL;
+  if (nregions == 0)
+    return 0;
+  if (nthreads > nregions)
+    nthreads = nregions;
+
+  memset (&pool, 0, sizeof (pool));
+  sources = calloc (nregions, sizeof (ios));
+  source_idx = calloc (nregions, sizeof (int));
+  bases = calloc (nregions, sizeof (uint64_t));
+  lengths = calloc (nregions, sizeof (uint64_t));
+  workers = calloc (nthreads, sizeof (struct pvm_region_worker));
+  pool.exceptions = pvm_alloc (nregions * sizeof (pvm_val));
+  if (!sources || !source_idx || !bases || !lengths || !workers
+      || !pool.exceptions)
+    goto done;
+
+  /* Collect the distinct IO spaces the regions belong to, and
+     compute the byte offsets and sizes of the regions in their
+     devices.  The
+     regions shall be byte-aligned and be entirely contained in the
+     devices, taking the bias of the IO spaces into account.  */
+  for (i = 0; i < nregions; ++i)
+    {
+      ios io = regions_ios[i];
+      uint64_t base = offsets[i] + ios_get_bias (io);
+      uint64_t dev_size = ios_size (io);
+
+      if (base % 8 != 0 || sizes[i] % 8 != 0
+          || base / 8 >= dev_size || sizes[i] / 8 > dev_size - base / 8
+          || ios_volatile_p (io))
+        goto done;
+      bases[i] = base / 8;
+      lengths[i] = sizes[i] / 8;
+
+      for (j = 0; j < nsources; ++j)
+        if (sources[j] == io)
+          break;
+      if (j == nsources)
+        sources[nsources++] = io;
+      source_idx[i] = j;
+    }
+
+  /* The program run for every region passes the current IO space of
+     the VM running it to CLS, so it can be shared by all the
+     workers.  */
+  pasm = pkl_asm_new (NULL /* ast */, pvm_compiler (vm), 1 /* prologue */);
+  pkl_asm_insn (pasm, PKL_INSN_PUSHIOS);
+  pkl_asm_insn (pasm, PKL_INSN_PUSH, cls);
+  pkl_asm_insn (pasm, PKL_INSN_CALL);
+  pool.program = pkl_asm_finish (pasm, 1 /* epilogue */);
+  pvm_program_make_executable (pool.program);
+
+  pool.nregions = nregions;
+  pool.sources = source_idx;
+  pool.bases = bases;
+  pool.lengths = lengths;
+  pool.results = results;
+  for (i = 0; i < nregions; ++i)
+    results[i] = pool.exceptions[i] = PVM_NULL;
+
+  /* Create the workers, opening the devices of the source IO spaces
+     as shared IO spaces in their IO contexts, so all of them read
+     out of a single file descriptor and cache per device.  Only the
+     devices that can be shared are supported.  */
+  for (i = 0; i < nthreads; ++i)
+    {
+      struct pvm_region_worker *worker = &workers[i];
+
+      worker->pool = &pool;
+      worker->vm = pvm_clone (vm);
+      if (worker->vm == NULL)
+        goto done;
+      nworkers++;
+
+      worker->base_ids = calloc (nsources, sizeof (int));
+      if (worker->base_ids == NULL)
+        goto done;
+      for (j = 0; j < nsources; ++j)
+        {
+          worker->base_ids[j]
+            = ios_open (PVM_STATE_IOS_CONTEXT (worker->vm),
+                        ios_handler (sources[j]),
+                        IOS_F_READ | IOS_F_SHARED, 0 /* set_cur */);
+          if (worker->base_ids[j] < 0)
+            goto done;
+        }
+    }
+
+  ret = nregions;
+  for (i = 0; i < nworkers; ++i)
+    {
+      if (pthread_create (&workers[i].thread, NULL,
+                          pvm_region_worker_run, &workers[i]) != 0)
+        {
+          /* The workers already started process all the regions.  */
+          if (i == 0)
+            ret = -1;
+          break;
+        }
+      workers[i].started_p = 1;
+    }
+
+  for (i = 0; i < nworkers; ++i)
+    if (workers[i].started_p)
+      pthread_join (workers[i].thread, NULL);
+
+  if (pool.error_p)
+    ret = -1;
+  for (i = 0; i < nregions; ++i)
+    if (pool.exceptions[i] != PVM_NULL)
+      {
+        *exception = pool.exceptions[i];
+        break;
+      }
+
+ done:
+  if (pool.program)
+    pvm_destroy_program (pool.program);
+  for (i = 0; i < nworkers; ++i)
+    {
+      free (workers[i].base_ids);
+      pvm_shutdown (workers[i].vm);
+    }
+  free (workers);
+  free (lengths);
+  free (bases);
+  free (source_idx);
+  free (sources);
+  return ret;
+}
+
 void
 pvm_shutdown (pvm apvm)
 {
@@ -245,37 +1230,47 @@ pvm_shutdown (pvm apvm)
     = & PVM_STATE_BACKING_FIELD (& apvm->pvm_state,
                                  jitter_stack_exceptionstack_backing);
 
-  /* Finalize pvm-program.  */
-  pvm_program_fini ();
+  /* Stop and finalize the profiler.  */
+  pvm_stop_sampling (apvm);
+  pvm_prof_free (apvm->prof);
 
   /* Deregister GC roots.  */
   pvm_alloc_remove_gc_roots (&PVM_STATE_ENV (apvm), 1);
-  pvm_alloc_remove_gc_roots (mainstack_backing->memory,
-                             mainstack_backing->element_no);
-  pvm_alloc_remove_gc_roots (returnstack_backing->memory,
-                             returnstack_backing->element_no);
-  pvm_alloc_remove_gc_roots (exceptionstack_backing->memory,
-                             exceptionstack_backing->element_no);
-
-  /* Finalize values.  */
-  pvm_val_finalize ();
+  pvm_alloc_remove_gc_roots (&PVM_STATE_TOPLEVEL (apvm), 1);
+  pvm_alloc_remove_gc_roots (&PVM_STATE_RESULT_VALUE (apvm), 1);
+  pvm_alloc_remove_gc_roots (&PVM_STATE_EXIT_EXCEPTION_VALUE (apvm), 1);
+  pvm_alloc_remove_gc_stack (mainstack_backing->memory);
+  pvm_alloc_remove_gc_stack (returnstack_backing->memory);
+  pvm_alloc_remove_gc_stack (exceptionstack_backing->memory);
 
   /* Do a GC pass before shutting down IO space.  */
-  pvm_alloc_gc ();
+  if (apvm->exit_gc_p)
+    pvm_alloc_gc ();
 
   /* Shutdown the IO space.  */
   ios_shutdown (PVM_STATE_IOS_CONTEXT (apvm));
 
   /* Finalize the VM state.  */
+  pthread_mutex_lock (&pvm_global_lock);
   pvm_state_finalize (&apvm->pvm_state);
 
-  /* Finalize the VM subsystem.  */
-  pvm_finalize ();
-
   free (apvm);
 
-  /* Finalize the memory allocator.  */
-  pvm_alloc_finalize ();
+  if (--pvm_num_instances == 0)
+    {
+      /* Finalize pvm-program.  */
+      pvm_program_fini ();
+
+      /* Finalize values.  */
+      pvm_val_finalize ();
+
+      /* Finalize the VM subsystem.  */
+      pvm_finalize ();
+
+      /* Finalize the memory allocator.  */
+      pvm_alloc_finalize ();
+    }
+  pthread_mutex_unlock (&pvm_global_lock);
 }
 
 ios_context
@@ -286,6 +1281,28 @@ pvm_ios_context (pvm apvm)
   return PVM_STATE_IOS_CONTEXT (apvm);
 }
 
+/* Print a line describing an operation performed on the device of
+   the given IO space.  See ios_set_trace.  */
+
+static void
+pvm_ios_trace_op (ios io, int op, uint64_t offset, uint64_t count,
+                  int status)
+{
+  static const char *op_names[] = { [IOS_TRACE_PREAD] = "pread",
+                                    [IOS_TRACE_PWRITE] = "pwrite",
+                                    [IOS_TRACE_PREADV] = "preadv" };
+
+  pk_printf ("ios %d: %s %" PRIu64 " bytes at 0x%" PRIx64 "%s\n",
+             ios_get_id (io), op_names[op], count, offset,
+             status == IOS_OK ? "" : " failed");
+}
+
+void
+pvm_trace_ios (ios io, int trace_p)
+{
+  ios_set_trace (io, trace_p ? pvm_ios_trace_op : NULL);
+}
+
 enum ios_endian
 pvm_endian (pvm apvm)
 {
@@ -415,6 +1432,54 @@ pvm_set_autoremap (pvm apvm, int autoremap)
   PVM_STATE_AUTOREMAP (apvm) = autoremap;
 }
 
+int
+pvm_lazymap (pvm apvm)
+{
+  return PVM_STATE_LAZYMAP (apvm);
+}
+
+void
+pvm_set_lazymap (pvm apvm, int lazymap)
+{
+  PVM_STATE_LAZYMAP (apvm) = lazymap;
+}
+
+int
+pvm_columnar (pvm apvm)
+{
+  return PVM_STATE_COLUMNAR (apvm);
+}
+
+void
+pvm_set_columnar (pvm apvm, int columnar)
+{
+  PVM_STATE_COLUMNAR (apvm) = columnar;
+}
+
+int
+pvm_gc_region (pvm apvm)
+{
+  return apvm->gc_region_p;
+}
+
+void
+pvm_set_gc_region (pvm apvm, int gc_region_p)
+{
+  apvm->gc_region_p = gc_region_p;
+}
+
+int
+pvm_exit_gc (pvm apvm)
+{
+  return apvm->exit_gc_p;
+}
+
+void
+pvm_set_exit_gc (pvm apvm, int exit_gc_p)
+{
+  apvm->exit_gc_p = exit_gc_p;
+}
+
 pkl_compiler
 pvm_compiler (pvm apvm)
 {
@@ -235,6 +235,16 @@ pvm_val pvm_make_string (const char *value);
 
 pvm_val pvm_make_string_nodup (char *value);
 
+/* Return the concatenation of the strings STR1 and STR2.  This takes
+   constant amortized time, since long concatenations are built as
+   ropes that are flattened only when their contents are accessed.  */
+
+pvm_val pvm_string_concat (pvm_val str1, pvm_val str2);
+
+/* Return the length of the string STR, without flattening it.  */
+
+size_t pvm_string_length (pvm_val str);
+
 /* Make an offset PVM value.
 
    MAGNITUDE is a PVM integral value.  It shall be of the same type
@@ -277,6 +287,37 @@ pvm_val pvm_make_struct (pvm_val nfields, pvm_val nmethods, pvm_val type);
 
 pvm_val pvm_make_cls (pvm_program program, pvm_val name);
 
+/* Make a new empty hash map PVM value.  */
+
+pvm_val pvm_make_map (void);
+
+/* Return 1 if VAL can be used as a key in hash maps, i.e. if it is
+   an integral, a string or an offset.  Return 0 otherwise.  */
+
+int pvm_map_key_p (pvm_val val);
+
+/* Associate the key KEY to the value VAL in the hash map MAP,
+   replacing the value previously associated to KEY, if any.  KEY
+   shall satisfy pvm_map_key_p.  */
+
+void pvm_map_set (pvm_val map, pvm_val key, pvm_val val);
+
+/* Return the value associated to the key KEY in the hash map MAP, or
+   PVM_NULL if there is no such key in the map.  */
+
+pvm_val pvm_map_get (pvm_val map, pvm_val key);
+
+/* Remove the key KEY from the hash map MAP.  Return 1 if the key was
+   in the map, 0 otherwise.  */
+
+int pvm_map_remove (pvm_val map, pvm_val key);
+
+/* Append the keys of the hash map MAP to the array ARR, or its values
+   if VALUES_P is not zero, in the order they were added to the
+   map.  */
+
+void pvm_map_elems (pvm_val map, pvm_val arr, int values_p);
+
 /* Compare two PVM values.
 
    Returns 1 if they match, 0 otherwise.  */
@@ -351,6 +392,153 @@ int pvm_array_set (pvm_val arr, pvm_val idx, pvm_val val);
 
 int pvm_array_rem (pvm_val arr, pvm_val idx);
 
+/* Return the value of the element occupying the position IDX in the
+   array ARR.  IDX shall be within the boundaries of the array.  */
+
+pvm_val pvm_array_elem_value (pvm_val arr, uint64_t idx);
+
+/* Return the bit-offset of the element occupying the position IDX in
+   the array ARR, as an ulong<64>.  IDX shall be within the boundaries
+   of the array.  */
+
+pvm_val pvm_array_elem_offset (pvm_val arr, uint64_t idx);
+
+/* Turn the empty mapped array ARR into a lazy array of NELEM
+   elements of ESIZE bits each, located in the IO space IOS at the
+   offset of ARR.  The elements will be mapped by calling the closure
+   MAPPER the first time they are referenced.
+
+   Note that pvm_array_elem_value returns PVM_NULL for the elements of
+   lazy arrays that have not been mapped yet.  */
+
+void pvm_array_make_lazy (pvm_val arr, pvm_val ios, uint64_t nelem,
+                          uint64_t esize, pvm_val mapper);
+
+/* Cache VAL as the value of the element IDX of the lazy array ARR,
+   which has just been mapped.  Elements of streamed arrays are not
+   cached, but VAL is relocated as needed anyway.  */
+
+void pvm_array_lazy_cache (pvm_val arr, uint64_t idx, pvm_val val);
+
+/* Make the lazy array ARR keep the fields of its elements in columns,
+   see struct pvm_array_columns in pvm-val.h.  The elements of ARR
+   shall be structs whose fields are all integrals of at most 64 bits
+   located at fixed offsets, and whose mapping can't fail once the
+   array is mapped, i.e. no constraints nor optional fields.  */
+
+void pvm_array_make_columnar (pvm_val arr);
+
+/* Build the element IDX of the columnar array ARR from its columns,
+   which are filled from the IO space IO using ENDIAN and NENC if
+   needed.  IO shall be the IO space where the elements of ARR are
+   mapped from, or NULL if it doesn't exist anymore.
+
+   Return PVM_NULL if the element can't be built from the columns,
+   in which case it shall be mapped by the lazy mapper of ARR.  */
+
+pvm_val pvm_array_columns_elem (pvm_val arr, uint64_t idx, ios io,
+                                enum ios_endian endian,
+                                enum ios_nenc nenc);
+
+/* Read NELEM integral values from the IO space IO, starting at the
+   bit-offset BOFF, and append them to the array ARR.  The elements of
+   ARR shall be integrals whose size is a multiple of 8 bits.  ENDIAN
+   is the byte endianness used to decode the values.
+
+   The bytes are read from IO in bulk, which is much faster than
+   peeking each element separately.
+
+   Return IOS_OK on success, or an IOS error code otherwise.  In the
+   later case some of the elements may have been appended to ARR.  */
+
+int pvm_array_peek_integral (pvm_val arr, ios io, ios_off boff,
+                             uint64_t nelem, enum ios_endian endian);
+
+/* Write the elements of the mapped array ARR to the IO space IO, in
+   bulk.  The elements of ARR shall be integrals whose size is a
+   multiple of 8 bits, and they are encoded using the byte endianness
+   ENDIAN.
+
+   Return IOS_OK on success, or an IOS error code otherwise.  */
+
+int pvm_array_poke_integral (pvm_val arr, ios io, enum ios_endian endian);
+
+/* Store the elements of the array ARR in BUF, one byte per element.
+   The elements of ARR shall be integrals, of which only the eight
+   less significative bits are stored.  BUF shall have room for as
+   many bytes as elements has the array.  */
+
+void pvm_array_get_bytes (pvm_val arr, uint8_t *buf);
+
+/* Return a new array of uint<8> with the LEN bytes in BUF.  */
+
+pvm_val pvm_make_byte_array (const uint8_t *buf, size_t len);
+
+/* Return a new array of NELEM integrals of BITS bits, which are
+   signed if SIGNED_P is not zero, with the values in VALUES.  */
+
+pvm_val pvm_make_integral_array (const uint64_t *values, size_t nelem,
+                                 int bits, int signed_p);
+
+/* Status codes returned by pvm_array_sort and pvm_array_bsearch.  */
+
+#define PVM_SORT_OK 0     /* Success.  */
+#define PVM_SORT_EKEY 1   /* The keys are not integrals, offsets or
+                             strings, or they are not comparable.  */
+#define PVM_SORT_ELAZY 2  /* Some of the elements of a lazy array
+                             have not been mapped yet.  */
+
+/* Sort in place the elements of the array ARR whose indexes are
+   between FROM (inclusive) and TO (exclusive), in ascending order of
+   their keys.  The sort is stable.
+
+   If FIELD is NULL then the keys are the elements themselves.
+   Otherwise the elements shall be structs, and the keys are the
+   values of their fields named FIELD.  The keys shall be either
+   integrals, offsets with the same unit, or strings.
+
+   Return a PVM_SORT_* code.  In case of error ARR is not
+   modified.  */
+
+int pvm_array_sort (pvm_val arr, uint64_t from, uint64_t to,
+                    const char *field);
+
+/* Look for the first element not less than KEY in the elements of
+   the array ARR whose indexes are between FROM (inclusive) and TO
+   (exclusive), which shall be sorted as by pvm_array_sort.  FIELD has
+   the same meaning than in pvm_array_sort.  Only the keys of the
+   O(log n) elements probed by the binary search are looked at.
+
+   Set *IDX to the index of that element, or to TO if all the
+   elements are less than KEY.  Return a PVM_SORT_* code.  If some of
+   the probed elements belongs to a lazy array and has not been mapped
+   yet, *IDX is set to its index and PVM_SORT_ELAZY is returned, so
+   the caller can map it and search again.  */
+
+int pvm_array_lower_bound (pvm_val arr, uint64_t from, uint64_t to,
+                           const char *field, pvm_val key, uint64_t *idx);
+
+/* Look for KEY in the elements of the array ARR whose indexes are
+   between FROM (inclusive) and TO (exclusive), which shall be sorted
+   as by pvm_array_sort.  FIELD has the same meaning than in
+   pvm_array_sort.
+
+   Set *IDX to the index of the first element whose key is equal to
+   KEY, or to -1 if there is no such element.  Return a PVM_SORT_*
+   code.  In case of PVM_SORT_ELAZY, *IDX is set as by
+   pvm_array_lower_bound.  */
+
+int pvm_array_bsearch (pvm_val arr, uint64_t from, uint64_t to,
+                       const char *field, pvm_val key, int64_t *idx);
+
+/* Reorder the NELEM elements of the array ARR starting at the index
+   FROM, so the element at FROM + I becomes the element that was at
+   PERM[I].  The indexes in PERM shall be a permutation of the
+   indexes of the reordered elements.  */
+
+void pvm_array_permute (pvm_val arr, uint64_t from, uint64_t nelem,
+                        const uint64_t *perm);
+
 /* Return the size of VAL, in bits.  */
 
 uint64_t pvm_sizeof (pvm_val val);
@@ -382,6 +570,46 @@ void pvm_val_ureloc (pvm_val val);
    map-able then this is a no-operation.  */
 void pvm_val_unmap (pvm_val val);
 
+/* Account the memory used by the given value.
+
+   FN is called for VAL, if it is a struct or an array, and then for
+   every struct and array contained in it, with the following
+   arguments:
+
+   VAL is the struct or array.
+
+   WEIGHT is the number of values of the same kind that VAL stands
+   for.  See SAMPLE below.
+
+   BYTES is the number of bytes used by the value itself: its box,
+   its header and the storage of its fields or elements, which are
+   element descriptors, a buffer of packed integers or the chunks
+   of a lazy array.
+
+   BOXED_BYTES is the number of bytes used by the boxed integers and
+   offsets stored in the value, including the offsets of the fields and
+   elements of mapped values.
+
+   STRING_BYTES is the number of bytes used by the names of the
+   fields and by the strings stored in the value.
+
+   Arrays having more than SAMPLE elements are sampled: only SAMPLE
+   elements evenly spread over the array are walked, and WEIGHT is
+   scaled accordingly for the values contained in them.  If SAMPLE
+   is zero every element is walked.
+
+   Note that values shared by several structs or arrays, such as
+   field names, which usually come from the same string constant, or
+   the recently made long values, are accounted once per reference,
+   so the figures are upper bounds.  */
+
+typedef void (*pvm_footprint_fn) (pvm_val val, double weight,
+                                  uint64_t bytes, uint64_t boxed_bytes,
+                                  uint64_t string_bytes, void *data);
+
+void pvm_val_footprint (pvm_val val, uint64_t sample,
+                        pvm_footprint_fn fn, void *data);
+
 /* Return a PVM value for an exception with the given CODE, NAME,
    EXIT_STATUS, LOCATION and MSG.
 
@@ -466,6 +694,20 @@ pvm_val pvm_env_lookup (pvm_env env, int back, int over);
 
 void pvm_env_set_var (pvm_env env, int back, int over, pvm_val val);
 
+/* Like pvm_env_lookup and pvm_env_set_var, but references to
+   variables in the top-level frame of ENV are resolved in the frame
+   TOPLEVEL instead.
+
+   Closures refer to the top-level frame of the virtual machine where
+   they were created.  Since cloned virtual machines share closures,
+   this is used so top-level variables are always resolved in the
+   virtual machine running the closure.  See pvm_clone.  */
+
+pvm_val pvm_env_lookup_with_toplevel (pvm_env toplevel, pvm_env env,
+                                      int back, int over);
+void pvm_env_set_var_with_toplevel (pvm_env toplevel, pvm_env env,
+                                    int back, int over, pvm_val val);
+
 /* Return 1 if the given run-time environment ENV contains only one
    frame.  Return 0 otherwise.  */
 
@@ -475,6 +717,12 @@ int pvm_env_toplevel_p (pvm_env env);
 
 pvm_env pvm_env_toplevel (pvm_env env);
 
+/* Return a new top-level frame containing the same variables than
+   the top-level frame ENV.  The values of the variables are not
+   copied.  */
+
+pvm_env pvm_env_dup_toplevel (pvm_env env);
+
 /*** Other Definitions.  ***/
 
 enum pvm_omode
@@ -518,7 +766,9 @@ enum pvm_exit_code
   E(EXIT)                    \
   E(ASSERT)                  \
   E(OVERFLOW)                \
-  E(PERM)
+  E(PERM)                    \
+  E(TIMEOUT)                 \
+  E(CANCEL)
 
 #define PVM_E_GENERIC       0
 #define PVM_E_GENERIC_NAME "generic"
@@ -596,12 +846,33 @@ enum pvm_exit_code
 #define PVM_E_STACK_NAME   "invalid stack"
 #define PVM_E_STACK_ESTATUS 1
 
+#define PVM_E_TIMEOUT      21
+#define PVM_E_TIMEOUT_NAME "execution budget exhausted"
+#define PVM_E_TIMEOUT_ESTATUS 1
+
+#define PVM_E_CANCEL       22
+#define PVM_E_CANCEL_NAME "operation cancelled"
+#define PVM_E_CANCEL_ESTATUS 1
+
 typedef struct pvm *pvm;
 
 /* Initialize a new Poke Virtual Machine and return it.  */
 
 pvm pvm_init (void);
 
+/* Create a new Poke Virtual Machine that is a clone of PVM.
+
+   The clone gets a copy of the global variables and of the settings
+   of PVM, but not of its IO spaces.  The values of the variables,
+   including closures and their compiled code, are shared by both
+   virtual machines.  Assigning to a global variable in one of the
+   virtual machines doesn't affect the other, but note that modifying
+   a shared composite value, like an array, does.
+
+   Return NULL in case of error.  */
+
+pvm pvm_clone (pvm pvm);
+
 /* Finalize a Poke Virtual Machine, freeing all used resources.  */
 
 void pvm_shutdown (pvm pvm);
@@ -610,6 +881,12 @@ void pvm_shutdown (pvm pvm);
 
 ios_context pvm_ios_context (pvm apvm);
 
+/* Enable or disable, depending on TRACE_P, printing a line in the
+   terminal for every operation performed on the device of the IO
+   space IO.  */
+
+void pvm_trace_ios (ios io, int trace_p);
+
 /* Get the current run-time environment of PVM.  */
 
 pvm_env pvm_get_env (pvm pvm);
@@ -619,10 +896,150 @@ pvm_env pvm_get_env (pvm pvm);
 
 void pvm_print_profile (pvm pvm);
 
-/* Reset profiling counters in the given PVM.  */
+/* Reset profiling counters in the given PVM.  This also discards
+   the samples collected by the sampling profiler.  */
 
 void pvm_reset_profile (pvm pvm);
 
+/* Start sampling the execution of programs in PVM, taking a sample
+   of the Poke call stack every INTERVAL microseconds of consumed CPU
+   time.  Samples are accumulated until pvm_reset_profile is called.
+   Return 0 if sampling is not supported in this system, 1
+   otherwise.  */
+
+int pvm_start_sampling (pvm pvm, unsigned int interval);
+
+/* Stop sampling the execution of programs in PVM.  The samples
+   collected so far are kept.  */
+
+void pvm_stop_sampling (pvm pvm);
+
+/* Return 1 if PVM is sampling the execution of programs, 0
+   otherwise.  */
+
+int pvm_sampling_p (pvm pvm);
+
+/* Call FN for every distinct call stack sampled in PVM.  STACK is
+   the list of names of the functions in the stack, outermost first,
+   separated by semicolons.  NSAMPLES is the number of samples taken
+   with that stack.  DATA is passed to FN unchanged.  */
+
+typedef void (*pvm_prof_fn) (const char *stack, uint64_t nsamples,
+                             void *data);
+
+void pvm_map_samples (pvm pvm, pvm_prof_fn fn, void *data);
+
+/* Events.
+
+   The programs run by the PVM notify an event handler installed in
+   the virtual machine of some of the operations they perform:
+
+   PVM_EVENT_MAP_BEGIN is emitted when the mapper of a struct, union
+   or array type starts mapping a value.
+
+   PVM_EVENT_MAP_END is emitted when the mapper of a struct, union or
+   array type has mapped a value.
+
+   PVM_EVENT_WRITE is emitted when a mapped struct or union is about
+   to be written to its IO space.
+
+   PVM_EVENT_CONSTRAINT is emitted when a E_constraint exception is
+   raised, usually because of a failed struct field constraint.
+
+   PVM_EVENT_RAISE is emitted when any other exception is raised.
+
+   PVM_EVENT_PROGRESS is emitted periodically by the operations that
+   may take long, like the mapping of arrays and the copy of data
+   between IO spaces, so the user can be shown how far they got.
+
+   When no handler is installed, the cost of every emission point is
+   a single branch.  */
+
+#define PVM_EVENT_MAP_BEGIN  0
+#define PVM_EVENT_MAP_END    1
+#define PVM_EVENT_WRITE      2
+#define PVM_EVENT_CONSTRAINT 3
+#define PVM_EVENT_RAISE      4
+#define PVM_EVENT_PROGRESS   5
+
+/* The information passed to the event handler.
+
+   KIND is one of the PVM_EVENT_* codes above.
+
+   TYPE_NAME is the name of the type of the mapped or written value,
+   or NULL if the type is anonymous, or if the event is an exception.
+   For PVM_EVENT_PROGRESS it is the name of the operation, either
+   "map" or "copy".
+
+   IOS is the id of the IO space where the value is mapped or
+   written, or -1 if the event is an exception.
+
+   OFFSET is the offset in bits where the value is mapped or written.
+
+   SIZE is the size in bits of the mapped or written value.  It is
+   always zero for PVM_EVENT_MAP_BEGIN and for exceptions.
+
+   For PVM_EVENT_PROGRESS, OFFSET is instead the number of bits
+   processed so far, and SIZE the total number of bits to process,
+   or zero if it is not known.  The total of the mapping of arrays
+   bounded by number of elements is an estimation, assuming that
+   the elements mapped so far are of average size.
+
+   VALUE is the mapped or written value, the raised exception, or
+   PVM_NULL for PVM_EVENT_MAP_BEGIN.  */
+
+struct pvm_event
+{
+  int kind;
+  const char *type_name;
+  int ios;
+  uint64_t offset;
+  uint64_t size;
+  pvm_val value;
+};
+
+typedef void (*pvm_event_fn) (struct pvm_event *event, void *data);
+
+/* Install FN as the event handler of VM.  DATA is passed to FN
+   unchanged.  If FN is NULL then events are not emitted.  */
+
+void pvm_set_event_fn (pvm vm, pvm_event_fn fn, void *data);
+
+/* Notify the event handler of VM, if any, of the event KIND on the
+   mapped value VAL.  */
+
+void pvm_event_map (pvm vm, int kind, pvm_val val);
+
+/* Notify the event handler of VM, if any, that a value of the type
+   named NAME, or PVM_NULL, is about to be mapped at the bit-offset
+   BOFF of the IO space IOS.  */
+
+void pvm_event_map_begin (pvm vm, pvm_val ios, pvm_val boff, pvm_val name);
+
+/* Notify the event handler of VM, if any, that EXCEPTION has been
+   raised.  */
+
+void pvm_event_raise (pvm vm, pvm_val exception);
+
+/* Number of elements between the PVM_EVENT_PROGRESS events emitted
+   while mapping an array.  This must be a power of two.  */
+
+#define PVM_PROGRESS_PERIOD 1024
+
+/* Notify the event handler of VM, if any, that the mapper of an
+   array started at the bit-offset BOFF of the IO space IOS has
+   mapped EIDX elements, the last of them ending at the bit-offset
+   EBOFF.  EBOUND and SBOUND are the bounds of the array, or
+   PVM_NULL.  This is used by the `progress' instruction.  */
+
+void pvm_event_progress (pvm vm, pvm_val ios, pvm_val boff, pvm_val eboff,
+                         pvm_val eidx, pvm_val ebound, pvm_val sbound);
+
+/* Progress function to pass to ios_copy_bytes, with the VM to notify
+   as DATA.  Return whether the copy shall be cancelled.  */
+
+int pvm_copy_progress (ios io, uint64_t done, uint64_t total, void *data);
+
 /* Run a PVM program in a virtual machine.
 
    If the execution of PROGRAM generates a result value, it is put in
@@ -640,6 +1057,99 @@ enum pvm_exit_code pvm_run (pvm vm,
                             pvm_val *res,
                             pvm_val *exit_exception);
 
+/* Like pvm_run, but make the values in ARGS available to PROGRAM as
+   its arguments, which are pushed by the `pusharg' instruction.  */
+
+enum pvm_exit_code pvm_run_args (pvm vm,
+                                 pvm_program program,
+                                 pvm_val *args,
+                                 pvm_val *res,
+                                 pvm_val *exit_exception);
+
+/* Interrupt the programs being run by the virtual machine VM, as if
+   SIGINT had been delivered.  The programs get a E_signal exception
+   raised the next time they check for pending signals.  This has no
+   effect if VM is not running a program.  */
+
+void pvm_interrupt (pvm vm);
+
+/* Cancel the programs being run by the virtual machine VM.  The
+   programs get a E_cancel exception raised the next time they check
+   for pending signals, and again every time they check until the
+   outermost program exits, so cancelled programs can clean up but
+   can't go on.  The copies of data between IO spaces are stopped
+   between chunks.
+
+   Unlike pvm_interrupt, this only sets a flag in VM, so it can be
+   called from signal handlers and from threads other than the one
+   running the programs.  This has no effect if VM is not running a
+   program.  */
+
+void pvm_cancel (pvm vm);
+
+/* Return whether the programs being run by VM have been
+   cancelled.  */
+
+int pvm_cancelled_p (pvm vm);
+
+/* Execution budgets.
+
+   The execution of the programs run by pvm_run can be limited to a
+   number of steps and to an amount of time.  Steps are counted by the
+   `sync' instruction, which is executed at every iteration of loops
+   and at the beginning of every function, so neither unbounded loops
+   nor unbounded recursion escape the budget.  The clock is only
+   checked every PVM_BUDGET_CLOCK_PERIOD steps.
+
+   The budget is granted to every program run while no other program
+   is running, and it also covers the programs run from within it,
+   such as pretty-printers.  Once the budget is exhausted, the program
+   gets an E_timeout exception raised at every step, so code handling
+   the exception shall not take long.  */
+
+#define PVM_BUDGET_CLOCK_PERIOD 256
+
+struct pvm_budget
+{
+  uint64_t steps;      /* Remaining steps, if MAX_STEPS is not zero.  */
+  uint64_t max_steps;  /* Number of steps granted, or zero.  */
+  uint64_t deadline;   /* Monotonic time in nanoseconds, or zero.  */
+  uint32_t countdown;  /* Steps until the clock is checked.  */
+  int exhausted_p;
+};
+
+/* Set the budget of the programs run in VM to STEPS steps and NSEC
+   nanoseconds.  Zero means no limit.  */
+
+void pvm_set_budget (pvm vm, uint64_t steps, uint64_t nsec);
+
+/* Return the number of steps and of nanoseconds of the budget of the
+   programs run in VM.  */
+
+uint64_t pvm_budget_steps (pvm vm);
+uint64_t pvm_budget_nsec (pvm vm);
+
+/* Limit the main stack and the return stack of VM to NELEM elements
+   each.  Zero means as many elements as the stacks can hold, which is
+   the default.  Larger values are reduced to that.
+
+   The depth of the stacks is checked by the `sync' instruction, which
+   raises E_stack if the limit is exceeded.  This happens at every
+   function call, so this effectively limits the depth of recursion,
+   and the memory used by the stacks.  */
+
+void pvm_set_stack_limit (pvm vm, size_t nelem);
+
+/* Return the maximum number of elements in the main stack and the
+   return stack of VM.  */
+
+size_t pvm_stack_limit (pvm vm);
+
+/* Account a step in BUDGET and return whether the budget is
+   exhausted.  This is used by the `sync' instruction.  */
+
+int pvm_budget_exhausted_p (struct pvm_budget *budget);
+
 /* Given a PVM and a closure value, call the closure.
 
    A list of pvm_val arguments terminated with PVM_NULL are passed as
@@ -649,6 +1159,66 @@ enum pvm_exit_code pvm_run (pvm vm,
 void pvm_call_closure (pvm vm, pvm_val cls, pvm_val *exit_exception,
                        ...);
 
+/* Return the element IDX of the array ARR.  If ARR is a lazy array
+   and the element hasn't been mapped yet, run the lazy mapper of the
+   array in VM in order to map it, or build it from the columns of the
+   array if it is columnar, like the aref instruction does.
+
+   If not NULL, *EXIT_EXCEPTION is set to the exception raised while
+   mapping the element, or to PVM_NULL.  PVM_NULL is returned if the
+   element couldn't be mapped.  */
+
+pvm_val pvm_array_map_elem (pvm vm, pvm_val arr, uint64_t idx,
+                            pvm_val *exit_exception);
+
+/* Given a PVM, a closure value CLS and an IO space IO, split the
+   range of bit-offsets [FROM,TO) of IO in up to NTHREADS chunks whose
+   sizes are multiple of ALIGN bits, and call CLS once per chunk in
+   NTHREADS threads, in parallel.
+
+   Each call runs in its own clone of VM, in which IO is open again
+   for reading.  The arguments passed to CLS are the descriptor of the
+   IO space in the clone and the limits of the chunk, as an int<32> and
+   two uint<64> bit-offsets.  The values returned by the calls are
+   stored in RESULTS, in chunk order.  *EXCEPTION is set to the
+   exception raised by the first call, in chunk order, that got
+   interrupted by an unhandled exception, or to PVM_NULL.
+
+   Return the number of calls, or -1 if IO can't be accessed in
+   parallel or in case of error.  Note that only IO spaces backed by
+   files can be accessed in parallel.  */
+
+int pvm_call_closure_parallel (pvm vm, pvm_val cls, ios io,
+                               uint64_t from, uint64_t to, uint64_t align,
+                               int nthreads, pvm_val *results,
+                               pvm_val *exception);
+
+/* Given a PVM, a closure value CLS and NREGIONS regions, the Ith of
+   which spans SIZES[I] bits starting at bit-offset OFFSETS[I] of the
+   IO space REGIONS_IOS[I], call CLS once per region in a pool of up
+   to NTHREADS threads, in parallel.
+
+   Every thread runs the calls in its own clone of VM, in which the
+   devices of the IO spaces of the regions are opened again as
+   shared read-only IO spaces.  The argument passed to CLS is the
+   descriptor of a sub IO space that starts at the beginning of the
+   region and covers it exactly, as an int<32>.  The threads pull the
+   regions in order, so there can be more regions than threads.  The
+   values returned by the calls are stored in RESULTS, in region
+   order.  *EXCEPTION is set to the exception raised by the first
+   call, in region order, that got interrupted by an unhandled
+   exception, or to PVM_NULL.  In that case the regions not yet
+   pulled by the threads are not processed.
+
+   Return NREGIONS, or -1 if some of the regions is not byte-aligned,
+   doesn't fit in its IO space or belongs to an IO space that can't
+   be shared, or in case of error.  */
+
+int pvm_call_closure_regions (pvm vm, pvm_val cls, int nregions,
+                              ios *regions_ios, const uint64_t *offsets,
+                              const uint64_t *sizes, int nthreads,
+                              pvm_val *results, pvm_val *exception);
+
 /* Get/set the current byte endianness of a virtual machine.
 
    The current endianness is used by certain VM instructions that
@@ -730,6 +1300,41 @@ void pvm_set_oacutoff (pvm vm, unsigned int cutoff);
 int pvm_autoremap (pvm vm);
 void pvm_set_autoremap (pvm vm, int autoremap);
 
+/* Get/set the `lazymap' flag in the virtual machine.  If set, mapped
+   arrays whose elements have a known size and whose number of
+   elements is known in advance are mapped lazily, i.e. their elements
+   are mapped from IO when they are first referenced.  */
+
+int pvm_lazymap (pvm vm);
+void pvm_set_lazymap (pvm vm, int lazymap);
+
+/* Get/set the `columnar' flag in the virtual machine.  If set, the
+   arrays of structs mapped lazily whose fields are all integrals at
+   fixed offsets keep the values of the fields in columns, decoded
+   from IO in bulk, and the elements are built from these columns
+   when referenced instead of being mapped one by one.  See
+   pvm_array_make_columnar.  */
+
+int pvm_columnar (pvm vm);
+void pvm_set_columnar (pvm vm, int columnar);
+
+/* Get/set whether the programs run by the virtual machine are
+   executed in allocation regions.  In that case the garbage collector
+   is not run during the execution of the program, and the temporary
+   values created by it are reclaimed in bulk afterwards.  See
+   pvm_alloc_region_begin.  */
+
+int pvm_gc_region (pvm vm);
+void pvm_set_gc_region (pvm vm, int gc_region_p);
+
+/* Get/set whether the garbage collector is run when the virtual
+   machine is shut down.  This is the default.  Programs that exit
+   right after shutting down the virtual machine can disable it, since
+   the memory is going to be reclaimed anyway.  */
+
+int pvm_exit_gc (pvm vm);
+void pvm_set_exit_gc (pvm vm, int exit_gc_p);
+
 /* Get/set the compiler associated to a virtual machine.
 
    This compiler is used when the VM needs to build programs and
@@ -18,6 +18,7 @@
 
 #include <config.h>
 #include <assert.h>
+#include <inttypes.h>
 
 #include "poke.h"
 #include "pk-cmd.h"
@@ -59,7 +60,62 @@ pk_cmd_compiler_ast (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+static int
+pk_cmd_compiler_timing_start (int argc, struct pk_cmd_arg argv[],
+                              uint64_t uflags)
+{
+  if (pk_set_timing_p (poke_compiler, 1) != PK_OK)
+    {
+      pk_term_class ("error");
+      pk_puts ("error: ");
+      pk_term_end_class ("error");
+      pk_puts ("out of memory\n");
+      return 0;
+    }
+  return 1;
+}
+
+static int
+pk_cmd_compiler_timing_stop (int argc, struct pk_cmd_arg argv[],
+                             uint64_t uflags)
+{
+  pk_set_timing_p (poke_compiler, 0);
+  return 1;
+}
+
+static int
+pk_cmd_compiler_timing_reset (int argc, struct pk_cmd_arg argv[],
+                              uint64_t uflags)
+{
+  pk_reset_phase_times (poke_compiler);
+  return 1;
+}
+
+static void
+print_phase_time (const char *phase, uint64_t nsec, uint64_t ncalls,
+                  void *data)
+{
+  uint64_t *total = data;
+
+  pk_printf ("%-10s %12.3f ms %12" PRIu64 "\n",
+             phase, nsec / 1e6, ncalls);
+  *total += nsec;
+}
+
+static int
+pk_cmd_compiler_timing_show (int argc, struct pk_cmd_arg argv[],
+                             uint64_t uflags)
+{
+  uint64_t total = 0;
+
+  pk_printf ("%-10s %15s %12s\n", "Phase", "Time", "Handlers");
+  pk_phase_times (poke_compiler, print_phase_time, &total);
+  pk_printf ("%-10s %12.3f ms\n", "total", total / 1e6);
+  return 1;
+}
+
 struct pk_trie *compiler_trie;
+struct pk_trie *compiler_timing_trie;
 
 const struct pk_cmd compiler_ast_cmd =
   {"ast", "s", "", 0, NULL, NULL, pk_cmd_compiler_ast,
@@ -67,9 +123,46 @@ const struct pk_cmd compiler_ast_cmd =
 
 extern struct pk_cmd null_cmd; /* pk-cmd.c  */
 
+const struct pk_cmd compiler_timing_start_cmd =
+  {"start", "", "", 0, NULL, NULL, pk_cmd_compiler_timing_start,
+   ".compiler timing start", NULL};
+
+const struct pk_cmd compiler_timing_stop_cmd =
+  {"stop", "", "", 0, NULL, NULL, pk_cmd_compiler_timing_stop,
+   ".compiler timing stop", NULL};
+
+const struct pk_cmd compiler_timing_show_cmd =
+  {"show", "", "", 0, NULL, NULL, pk_cmd_compiler_timing_show,
+   ".compiler timing show", NULL};
+
+const struct pk_cmd compiler_timing_reset_cmd =
+  {"reset", "", "", 0, NULL, NULL, pk_cmd_compiler_timing_reset,
+   ".compiler timing reset", NULL};
+
+const struct pk_cmd *compiler_timing_cmds[] =
+  {
+    &compiler_timing_start_cmd,
+    &compiler_timing_stop_cmd,
+    &compiler_timing_show_cmd,
+    &compiler_timing_reset_cmd,
+    &null_cmd
+  };
+
+static char *
+compiler_timing_completion_function (const char *x, int state)
+{
+  return pk_cmd_completion_function (compiler_timing_cmds, x, state);
+}
+
+const struct pk_cmd compiler_timing_cmd =
+  {"timing", "", "", 0, compiler_timing_cmds, &compiler_timing_trie, NULL,
+   ".compiler timing (start|stop|show|reset)",
+   compiler_timing_completion_function};
+
 const struct pk_cmd *compiler_cmds[] =
   {
     &compiler_ast_cmd,
+    &compiler_timing_cmd,
     &null_cmd
   };
 
@@ -80,5 +173,5 @@ compiler_completion_function (const char *x, int state)
 }
 
 const struct pk_cmd compiler_cmd =
-  {"compiler", "", "", 0, compiler_cmds, &compiler_trie, NULL, ".compiler (ast)",
+  {"compiler", "", "", 0, compiler_cmds, &compiler_trie, NULL, ".compiler (ast|timing)",
    compiler_completion_function};
@@ -19,6 +19,8 @@
 
 #include <config.h>
 #include <string.h>
+#include <stdlib.h>
+#include <inttypes.h>
 #include <assert.h>
 #include <regex.h>
 
@@ -27,6 +29,7 @@
 
 #include "poke.h"
 #include "pk-cmd.h"
+#include "pk-utils.h"
 #include "pk-table.h"
 #include "pk-hserver.h"
 #include "pk-repl.h" /* For poke_completion_function */
@@ -293,6 +296,246 @@ pk_cmd_info_type (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 0;
 }
 
+/* The memory used by the values of the variables is accounted per
+   type, in entries of the following kind.  NAME is the name of the
+   type.  The other fields hold the totals reported by
+   pk_val_footprint for the values of that type, and the number of
+   them which are mapped.  */
+
+struct footprint_entry
+{
+  char *name;
+  double count;
+  double mapped;
+  double bytes;
+  double boxed_bytes;
+  double string_bytes;
+};
+
+struct footprint_payload
+{
+  int regexp_p;
+  regex_t regexp;
+  struct footprint_entry *entries;
+  size_t nentries;
+};
+
+/* Arrays having more elements than this are sampled.  */
+#define FOOTPRINT_SAMPLE 256
+
+/* Return a string with the name of the given type, to be freed by the
+   caller.  */
+
+static char *
+footprint_type_name (pk_val type)
+{
+  char *name = NULL;
+
+  switch (pk_type_code (type))
+    {
+    case PK_TYPE_INT:
+    case PK_TYPE_UINT:
+      asprintf (&name, "%sint<%d>",
+                pk_type_code (type) == PK_TYPE_INT ? "" : "u",
+                (int) pk_uint_value (pk_integral_type_size (type)));
+      break;
+    case PK_TYPE_STRING:
+      name = xstrdup ("string");
+      break;
+    case PK_TYPE_OFFSET:
+      name = xstrdup ("offset");
+      break;
+    case PK_TYPE_ARRAY:
+      {
+        char *etype_name
+          = footprint_type_name (pk_array_type_etype (type));
+
+        asprintf (&name, "%s[]", etype_name);
+        free (etype_name);
+        break;
+      }
+    case PK_TYPE_STRUCT:
+      {
+        pk_val type_name = pk_type_name (type);
+
+        name = xstrdup (type_name == PK_NULL
+                        ? "struct {...}" : pk_string_str (type_name));
+        break;
+      }
+    default:
+      name = xstrdup ("?");
+      break;
+    }
+
+  return name;
+}
+
+static void
+footprint_account (pk_val val, double weight,
+                   uint64_t bytes, uint64_t boxed_bytes,
+                   uint64_t string_bytes, void *data)
+{
+  struct footprint_payload *payload = (struct footprint_payload *) data;
+  char *name = footprint_type_name (pk_typeof (val));
+  struct footprint_entry *entry = NULL;
+  size_t i;
+
+  for (i = 0; i < payload->nentries; ++i)
+    if (STREQ (payload->entries[i].name, name))
+      {
+        entry = &payload->entries[i];
+        free (name);
+        break;
+      }
+
+  if (entry == NULL)
+    {
+      payload->entries
+        = xrealloc (payload->entries,
+                    (payload->nentries + 1) * sizeof (*payload->entries));
+      entry = &payload->entries[payload->nentries++];
+      memset (entry, 0, sizeof (*entry));
+      entry->name = name;
+    }
+
+  entry->count += weight;
+  if (pk_val_mapped_p (val))
+    entry->mapped += weight;
+  entry->bytes += weight * bytes;
+  entry->boxed_bytes += weight * boxed_bytes;
+  entry->string_bytes += weight * string_bytes;
+}
+
+static void
+footprint_var_decl (int kind,
+                    const char *source,
+                    const char *name,
+                    const char *type,
+                    int first_line, int last_line,
+                    int first_column, int last_column,
+                    pk_val val,
+                    void *data)
+{
+  struct footprint_payload *payload = (struct footprint_payload *) data;
+  regmatch_t match;
+
+  if (payload->regexp_p
+      && regexec (&payload->regexp, name, 1, &match, 0) != 0)
+    return;
+
+  pk_val_footprint (val, FOOTPRINT_SAMPLE, footprint_account, payload);
+}
+
+static int
+footprint_entry_cmp (const void *p1, const void *p2)
+{
+  const struct footprint_entry *e1 = p1;
+  const struct footprint_entry *e2 = p2;
+  double total1 = e1->bytes + e1->boxed_bytes + e1->string_bytes;
+  double total2 = e2->bytes + e2->boxed_bytes + e2->string_bytes;
+
+  return (total1 < total2) - (total1 > total2);
+}
+
+static void
+footprint_column (pk_table table, double value)
+{
+  char *str;
+
+  asprintf (&str, "%" PRIu64, (uint64_t) (value + 0.5));
+  pk_table_column (table, str);
+  free (str);
+}
+
+static void
+footprint_ios (pk_ios io, void *data)
+{
+  pk_table table = (pk_table) data;
+  char *str;
+
+  pk_table_row (table);
+  asprintf (&str, "#%d", pk_ios_get_id (io));
+  pk_table_column (table, str);
+  free (str);
+  pk_table_column (table, pk_ios_handler (io));
+  footprint_column (table, pk_ios_stat (io, PK_IOS_STAT_RANGES));
+  footprint_column (table, pk_ios_stat (io, PK_IOS_STAT_RANGE_BYTES));
+}
+
+static int
+pk_cmd_info_memory (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  struct footprint_payload payload;
+  struct pk_gc_stats stats;
+  pk_table table;
+  regex_t regexp;
+  size_t i;
+
+  assert (argc == 2);
+  assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_STR);
+
+  PREP_REGEXP_PAYLOAD;
+  payload.entries = NULL;
+  payload.nentries = 0;
+
+  pk_decl_map (poke_compiler, PK_DECL_KIND_VAR, footprint_var_decl,
+               &payload);
+  if (payload.nentries > 0)
+    qsort (payload.entries, payload.nentries,
+           sizeof (*payload.entries), footprint_entry_cmp);
+
+  table = pk_table_new (7);
+  pk_table_row_cl (table, "table-header");
+  pk_table_column (table, "Type");
+  pk_table_column (table, "Values");
+  pk_table_column (table, "Mapped");
+  pk_table_column (table, "Bytes");
+  pk_table_column (table, "Boxed");
+  pk_table_column (table, "Strings");
+  pk_table_column (table, "Total");
+
+  for (i = 0; i < payload.nentries; ++i)
+    {
+      struct footprint_entry *entry = &payload.entries[i];
+
+      pk_table_row (table);
+      pk_table_column (table, entry->name);
+      footprint_column (table, entry->count);
+      footprint_column (table, entry->mapped);
+      footprint_column (table, entry->bytes);
+      footprint_column (table, entry->boxed_bytes);
+      footprint_column (table, entry->string_bytes);
+      footprint_column (table, (entry->bytes + entry->boxed_bytes
+                                + entry->string_bytes));
+      free (entry->name);
+    }
+  free (payload.entries);
+  pk_table_print (table);
+  pk_table_free (table);
+
+  if (pk_ios_cur (poke_compiler) != NULL)
+    {
+      table = pk_table_new (4);
+      pk_table_row_cl (table, "table-header");
+      pk_table_column (table, "IOS");
+      pk_table_column (table, "Handler");
+      pk_table_column (table, "Ranges");
+      pk_table_column (table, "Bytes");
+      pk_ios_map (poke_compiler, footprint_ios, table);
+      pk_puts ("\n");
+      pk_table_print (table);
+      pk_table_free (table);
+    }
+
+  pk_gc_stats (poke_compiler, &stats);
+  pk_printf ("\nGC heap: %" PRIu64 " bytes, %" PRIu64 " free\n",
+             stats.heap_size, stats.free_bytes);
+
+  if (payload.regexp_p)
+    regfree (&payload.regexp);
+  return 1;
+}
+
 const struct pk_cmd info_var_cmd =
   {"variables", "s?", "", 0, NULL, NULL, pk_cmd_info_var,
    ".info variables [REGEXP]", poke_completion_function};
@@ -305,6 +548,10 @@ const struct pk_cmd info_types_cmd =
   {"types", "s?", "", 0, NULL, NULL, pk_cmd_info_types,
    ".info types [REGEXP]", poke_completion_function};
 
+const struct pk_cmd info_memory_cmd =
+  {"memory", "s?", "", 0, NULL, NULL, pk_cmd_info_memory,
+   ".info memory [REGEXP]", poke_completion_function};
+
 const struct pk_cmd info_type_cmd =
   {"type", "s", "", 0, NULL, NULL, pk_cmd_info_type,
    ".info type NAME", poke_completion_function};
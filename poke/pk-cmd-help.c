@@ -36,6 +36,10 @@ pk_cmd_help (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_STR);
   topic = pk_make_string (poke_compiler, PK_CMD_ARG_STR (argv[1]));
 
+  /* The commands written in Poke register their help topics when
+     they are compiled.  */
+  pk_cmd_load_all ();
+
   pk_help = pk_decl_val (poke_compiler, "pk_help");
   assert (pk_help != PK_NULL);
   if (pk_call (poke_compiler, pk_help, &ret, &exit_exception,
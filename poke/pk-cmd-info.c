@@ -27,6 +27,7 @@ extern struct pk_cmd info_var_cmd;   /* pk-cmd-def.c  */
 extern struct pk_cmd info_fun_cmd;   /* pk-cmd-def.c  */
 extern struct pk_cmd info_types_cmd; /* pk-cmd-def.c */
 extern struct pk_cmd info_type_cmd;  /* pk-cmd-def.c */
+extern struct pk_cmd info_memory_cmd; /* pk-cmd-def.c */
 
 const struct pk_cmd * info_cmds[] =
   {
@@ -35,6 +36,7 @@ const struct pk_cmd * info_cmds[] =
     &info_fun_cmd,
     &info_types_cmd,
     &info_type_cmd,
+    &info_memory_cmd,
     &null_cmd
   };
 
@@ -47,5 +49,5 @@ info_completion_function (const char *x, int state)
 }
 
 const struct pk_cmd info_cmd =
-  {"info", "", "", 0, info_cmds, &info_trie, NULL, ".info (ios|variables|functions|types|type)",
+  {"info", "", "", 0, info_cmds, &info_trie, NULL, ".info (ios|variables|functions|types|type|memory)",
    info_completion_function};
@@ -273,10 +273,16 @@ pk_cmd_close (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+#define PK_INFO_IOS_UFLAGS "s"
+#define PK_INFO_IOS_F_STATS 0x1
+
 static int
 pk_cmd_info_ios (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
-  pk_val pk_info_ios = pk_decl_val (poke_compiler, "pk_info_ios");
+  pk_val pk_info_ios
+    = pk_decl_val (poke_compiler,
+                   (uflags & PK_INFO_IOS_F_STATS
+                    ? "pk_info_ios_stats" : "pk_info_ios"));
   pk_val retval, exit_exception;
   assert (pk_info_ios != PK_NULL);
 
@@ -494,7 +500,8 @@ const struct pk_cmd close_cmd =
    ".close [IOS]", poke_completion_function};
 
 const struct pk_cmd info_ios_cmd =
-  {"ios", "", "", 0, NULL, NULL, pk_cmd_info_ios, ".info ios", NULL};
+  {"ios", "", PK_INFO_IOS_UFLAGS, 0, NULL, NULL, pk_cmd_info_ios,
+   ".info ios[/s]", NULL};
 
 const struct pk_cmd load_cmd =
   {"load", "f", "", 0, NULL, NULL, pk_cmd_load_file, ".load FILE-NAME",
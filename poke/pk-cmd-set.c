@@ -47,6 +47,11 @@ pk_cmd_set_dump (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   pk_term_end_class ("setting-header");
   pk_printf (" %s\n", pk_error_on_warning (poke_compiler) ? "yes" : "no");
 
+  pk_term_class ("setting-header");
+  pk_puts ("compile-stats");
+  pk_term_end_class ("setting-header");
+  pk_printf (" %s\n", pk_compile_stats_p (poke_compiler) ? "yes" : "no");
+
   return 0;
 }
 
@@ -177,6 +182,59 @@ pk_cmd_set_error_on_warning (int argc, struct pk_cmd_arg argv[],
   return 1;
 }
 
+static int
+pk_cmd_set_compile_stats (int argc, struct pk_cmd_arg argv[],
+                          uint64_t uflags)
+{
+  /* set compile-stats {yes,no} */
+
+  const char *arg;
+
+  /* See the note in pk_cmd_set_error_on_warning above.  */
+
+  if (argc != 2)
+    PK_UNREACHABLE ();
+
+  arg = PK_CMD_ARG_STR (argv[1]);
+
+  if (*arg == '\0')
+    {
+      if (pk_compile_stats_p (poke_compiler))
+        pk_puts ("yes\n");
+      else
+        pk_puts ("no\n");
+    }
+  else
+    {
+      int compile_stats_p;
+
+      if (STREQ (arg, "yes"))
+        compile_stats_p = 1;
+      else if (STREQ (arg, "no"))
+        compile_stats_p = 0;
+      else
+        {
+          pk_term_class ("error");
+          pk_puts (_("error: "));
+          pk_term_end_class ("error");
+          pk_puts (_("compile-stats should be one of `yes' or `no'\n"));
+          return 0;
+        }
+
+      if (pk_set_compile_stats_p (poke_compiler, compile_stats_p)
+          != PK_OK)
+        {
+          pk_term_class ("error");
+          pk_puts (_("error: "));
+          pk_term_end_class ("error");
+          pk_puts (_("out of memory\n"));
+          return 0;
+        }
+    }
+
+  return 1;
+}
+
 static char *
 yesno_completion_function (const char *x, int state)
 {
@@ -209,6 +267,10 @@ const struct pk_cmd set_error_on_warning_cmd =
   {"error-on-warning", "s?", "", 0, NULL, NULL, pk_cmd_set_error_on_warning,
    ".set error-on-warning (yes|no)", yesno_completion_function};
 
+const struct pk_cmd set_compile_stats_cmd =
+  {"compile-stats", "s?", "", 0, NULL, NULL, pk_cmd_set_compile_stats,
+   ".set compile-stats (yes|no)", yesno_completion_function};
+
 const struct pk_cmd **set_cmds;
 
 static char *
@@ -245,7 +307,7 @@ pk_cmd_set_init ()
   nsettings = pk_array_nelem (registry_settings);
 
   set_cmds = xmalloc (sizeof (struct pk_cmd *)
-                      * (pk_int_value (nsettings) + 2));
+                      * (pk_int_value (nsettings) + 3));
 
   for (i = 0; i < pk_int_value (nsettings); ++i)
     {
@@ -290,6 +352,9 @@ pk_cmd_set_init ()
   /* Add error-on-warning. */
   set_cmds[i++] = &set_error_on_warning_cmd;
 
+  /* Add compile-stats.  */
+  set_cmds[i++] = &set_compile_stats_cmd;
+
   /* NOTE: if you add more C-handled commands here like
      `error-on-warning' and `set-pager', please do not forget to
      update the xmalloc count above.  */
@@ -19,6 +19,11 @@
 
 #include <config.h>
 #include <assert.h>
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <inttypes.h>
+#include <readline.h>
 
 #include "poke.h"
 #include "pk-cmd.h"
@@ -135,6 +140,94 @@ pk_cmd_vm_profile_reset (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+static int
+pk_cmd_vm_profile_start (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* profile start [INTERVAL] */
+
+  int64_t interval = 0;
+
+  assert (argc == 2);
+  if (PK_CMD_ARG_TYPE (argv[1]) != PK_CMD_ARG_NULL)
+    {
+      assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_INT);
+      interval = PK_CMD_ARG_INT (argv[1]);
+      if (interval <= 0 || interval > UINT32_MAX)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_puts ("invalid sampling interval\n");
+          return 0;
+        }
+    }
+
+  if (pk_profile_start (poke_compiler, interval) != PK_OK)
+    {
+      pk_term_class ("error");
+      pk_puts ("error: ");
+      pk_term_end_class ("error");
+      pk_puts ("sampling is not supported in this system\n");
+      return 0;
+    }
+  return 1;
+}
+
+static int
+pk_cmd_vm_profile_stop (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  pk_profile_stop (poke_compiler);
+  return 1;
+}
+
+static void
+print_folded_stack (const char *stack, uint64_t nsamples, void *data)
+{
+  FILE *out = data;
+
+  if (out)
+    fprintf (out, "%s %" PRIu64 "\n", stack, nsamples);
+  else
+    pk_printf ("%s %" PRIu64 "\n", stack, nsamples);
+}
+
+static int
+pk_cmd_vm_profile_folded (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* profile folded [FILE] */
+
+  FILE *out = NULL;
+  const char *filename = NULL;
+
+  assert (argc == 2);
+  if (PK_CMD_ARG_TYPE (argv[1]) != PK_CMD_ARG_NULL)
+    {
+      assert (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_STR);
+      filename = PK_CMD_ARG_STR (argv[1]);
+      out = fopen (filename, "w");
+      if (!out)
+        {
+          pk_term_class ("error");
+          pk_puts ("error: ");
+          pk_term_end_class ("error");
+          pk_printf ("%s: %s\n", filename, strerror (errno));
+          return 0;
+        }
+    }
+
+  pk_profile_get (poke_compiler, print_folded_stack, out);
+
+  if (out && fclose (out) != 0)
+    {
+      pk_term_class ("error");
+      pk_puts ("error: ");
+      pk_term_end_class ("error");
+      pk_printf ("%s: %s\n", filename, strerror (errno));
+      return 0;
+    }
+  return 1;
+}
+
 static int
 pk_cmd_vm_dispatch (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
 {
@@ -150,6 +243,113 @@ pk_cmd_vm_dispatch (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
   return 1;
 }
 
+static int
+pk_cmd_vm_gc_show (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  struct pk_gc_stats stats;
+
+  pk_gc_stats (poke_compiler, &stats);
+
+  pk_printf ("Heap size:          %" PRIu64 " bytes\n", stats.heap_size);
+  pk_printf ("Free:               %" PRIu64 " bytes\n", stats.free_bytes);
+  pk_printf ("Unmapped:           %" PRIu64 " bytes\n",
+             stats.unmapped_bytes);
+  pk_printf ("Allocated since GC: %" PRIu64 " bytes\n",
+             stats.bytes_since_gc);
+  pk_printf ("Allocated in total: %" PRIu64 " bytes\n", stats.total_bytes);
+  pk_printf ("Collections:        %" PRIu64 "\n", stats.collections);
+  pk_printf ("Pause time:         %.3f ms (longest %.3f ms)\n",
+             stats.pause_ns / 1e6, stats.max_pause_ns / 1e6);
+  pk_printf ("Finalizers run:     %" PRIu64 "\n", stats.finalizers);
+  pk_printf ("Incremental mode:   %s\n",
+             pk_gc_incremental_p (poke_compiler) ? "yes" : "no");
+  pk_printf ("Free space divisor: %u\n",
+             pk_gc_free_space_divisor (poke_compiler));
+  pk_printf ("Full GC frequency:  %u\n", pk_gc_full_freq (poke_compiler));
+  return 1;
+}
+
+static int
+pk_cmd_vm_gc_collect (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  pk_gc_collect (poke_compiler);
+  return 1;
+}
+
+static int
+pk_cmd_vm_gc_incremental (int argc, struct pk_cmd_arg argv[],
+                          uint64_t uflags)
+{
+  pk_gc_set_incremental (poke_compiler, 1);
+  return 1;
+}
+
+/* Get the value of an optional unsigned argument of a .vm gc command,
+   which shall be bigger than MIN.  Return 0 if the argument is
+   invalid.  */
+
+static int
+pk_cmd_vm_gc_uint_arg (struct pk_cmd_arg *arg, unsigned int min,
+                       unsigned int *value)
+{
+  int64_t n;
+
+  assert (PK_CMD_ARG_TYPE (*arg) == PK_CMD_ARG_INT);
+  n = PK_CMD_ARG_INT (*arg);
+  if (n < min || n > UINT32_MAX)
+    {
+      pk_term_class ("error");
+      pk_puts ("error: ");
+      pk_term_end_class ("error");
+      pk_printf ("the value shall be between %u and %" PRIu32 "\n",
+                 min, UINT32_MAX);
+      return 0;
+    }
+
+  *value = n;
+  return 1;
+}
+
+static int
+pk_cmd_vm_gc_divisor (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* gc divisor [DIVISOR] */
+
+  unsigned int divisor;
+
+  assert (argc == 2);
+  if (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_NULL)
+    {
+      pk_printf ("%u\n", pk_gc_free_space_divisor (poke_compiler));
+      return 1;
+    }
+
+  if (!pk_cmd_vm_gc_uint_arg (&argv[1], 1, &divisor))
+    return 0;
+  pk_gc_set_free_space_divisor (poke_compiler, divisor);
+  return 1;
+}
+
+static int
+pk_cmd_vm_gc_full_freq (int argc, struct pk_cmd_arg argv[], uint64_t uflags)
+{
+  /* gc full-freq [FREQ] */
+
+  unsigned int full_freq;
+
+  assert (argc == 2);
+  if (PK_CMD_ARG_TYPE (argv[1]) == PK_CMD_ARG_NULL)
+    {
+      pk_printf ("%u\n", pk_gc_full_freq (poke_compiler));
+      return 1;
+    }
+
+  if (!pk_cmd_vm_gc_uint_arg (&argv[1], 0, &full_freq))
+    return 0;
+  pk_gc_set_full_freq (poke_compiler, full_freq);
+  return 1;
+}
+
 extern struct pk_cmd null_cmd; /* pk-cmd.c  */
 
 const struct pk_cmd vm_disas_exp_cmd =
@@ -199,10 +399,25 @@ const struct pk_cmd vm_profile_reset_cmd =
   {"reset", "", "", 0, NULL, NULL, pk_cmd_vm_profile_reset,
    ".vm profile reset", NULL};
 
+const struct pk_cmd vm_profile_start_cmd =
+  {"start", "?i", "", 0, NULL, NULL, pk_cmd_vm_profile_start,
+   ".vm profile start [INTERVAL]", NULL};
+
+const struct pk_cmd vm_profile_stop_cmd =
+  {"stop", "", "", 0, NULL, NULL, pk_cmd_vm_profile_stop,
+   ".vm profile stop", NULL};
+
+const struct pk_cmd vm_profile_folded_cmd =
+  {"folded", "?f", "", 0, NULL, NULL, pk_cmd_vm_profile_folded,
+   ".vm profile folded [FILE-NAME]", rl_filename_completion_function};
+
 const struct pk_cmd *vm_profile_cmds[] =
   {
     &vm_profile_show_cmd,
     &vm_profile_reset_cmd,
+    &vm_profile_start_cmd,
+    &vm_profile_stop_cmd,
+    &vm_profile_folded_cmd,
     &null_cmd
   };
 
@@ -216,7 +431,52 @@ struct pk_trie *vm_profile_trie;
 
 const struct pk_cmd vm_profile_cmd =
   {"profile", "", "", 0, vm_profile_cmds, &vm_profile_trie, NULL,
-   ".vm profile (show|reset)", vm_profile_completion_function};
+   ".vm profile (show|reset|start|stop|folded)", vm_profile_completion_function};
+
+const struct pk_cmd vm_gc_show_cmd =
+  {"show", "", "", 0, NULL, NULL, pk_cmd_vm_gc_show,
+   ".vm gc show", NULL};
+
+const struct pk_cmd vm_gc_collect_cmd =
+  {"collect", "", "", 0, NULL, NULL, pk_cmd_vm_gc_collect,
+   ".vm gc collect", NULL};
+
+const struct pk_cmd vm_gc_incremental_cmd =
+  {"incremental", "", "", 0, NULL, NULL, pk_cmd_vm_gc_incremental,
+   ".vm gc incremental", NULL};
+
+const struct pk_cmd vm_gc_divisor_cmd =
+  {"divisor", "?i", "", 0, NULL, NULL, pk_cmd_vm_gc_divisor,
+   ".vm gc divisor [DIVISOR]", NULL};
+
+const struct pk_cmd vm_gc_full_freq_cmd =
+  {"full-freq", "?i", "", 0, NULL, NULL, pk_cmd_vm_gc_full_freq,
+   ".vm gc full-freq [FREQUENCY]", NULL};
+
+const struct pk_cmd *vm_gc_cmds[] =
+  {
+    &vm_gc_show_cmd,
+    &vm_gc_collect_cmd,
+    &vm_gc_incremental_cmd,
+    &vm_gc_divisor_cmd,
+    &vm_gc_full_freq_cmd,
+    &null_cmd
+  };
+
+static char *
+vm_gc_completion_function (const char *x, int state)
+{
+  return pk_cmd_completion_function (vm_gc_cmds, x, state);
+}
+
+struct pk_trie *vm_gc_trie;
+
+/* `.vm gc' without a subcommand is the same than `.vm gc show'.  */
+
+const struct pk_cmd vm_gc_cmd =
+  {"gc", "", "", 0, vm_gc_cmds, &vm_gc_trie, pk_cmd_vm_gc_show,
+   ".vm gc [show|collect|incremental|divisor|full-freq]",
+   vm_gc_completion_function};
 
 struct pk_trie *vm_trie;
 
@@ -229,6 +489,7 @@ const struct pk_cmd *vm_cmds[] =
     &vm_disas_cmd,
     &vm_profile_cmd,
     &vm_dispatch_cmd,
+    &vm_gc_cmd,
     &null_cmd
   };
 
@@ -240,4 +501,4 @@ vm_completion_function (const char *x, int state)
 
 const struct pk_cmd vm_cmd =
   {"vm", "", "", 0, vm_cmds, &vm_trie, NULL,
-   ".vm (disassemble|profile|dispatch)", vm_completion_function};
+   ".vm (disassemble|profile|dispatch|gc)", vm_completion_function};
@@ -29,6 +29,7 @@
 #include <glob.h> /* For tilde-expansion.  */
 #include <xalloc.h>
 #include <xstrndup.h>
+#include <read-file.h>
 #include <ctype.h>
 
 #include "poke.h"
@@ -574,17 +575,139 @@ extern struct pk_trie *vm_trie;  /* pk-cmd-vm.c  */
 extern const struct pk_cmd *compiler_cmds[]; /* pk-cmd-compiler.c */
 extern struct pk_trie *compiler_trie; /* pk-cmd-compiler.c */
 
+extern const struct pk_cmd *compiler_timing_cmds[]; /* pk-cmd-compiler.c */
+extern struct pk_trie *compiler_timing_trie; /* pk-cmd-compiler.c */
+
 extern const struct pk_cmd *vm_disas_cmds[];  /* pk-cmd-vm.c */
 extern struct pk_trie *vm_disas_trie; /* pk-cmd-vm.c */
 
 extern const struct pk_cmd *vm_profile_cmds[]; /* pk-cmd-vm.c */
 extern struct pk_trie *vm_profile_trie; /* pk-cmd-vm.c */
 
+extern const struct pk_cmd *vm_gc_cmds[]; /* pk-cmd-vm.c */
+extern struct pk_trie *vm_gc_trie; /* pk-cmd-vm.c */
+
 extern const struct pk_cmd **set_cmds; /* pk-cmd-set.c */
 extern struct pk_trie *set_trie; /* pk-cmd-set.c */
 
 static struct pk_trie *cmds_trie;
 
+/* The commands written in Poke are compiled the first time they are
+   referred to, since most sessions use a few of them, if any.  Every
+   entry in the table below associates a module implementing commands
+   with the names it defines that are meant to be used by the user.
+   Names ending with an underscore match any identifier starting with
+   them, like the variables holding the default arguments of the
+   commands.  */
+
+struct pk_cmd_module
+{
+  const char *module;
+  const char *names[4];
+  int loaded_p;
+};
+
+static struct pk_cmd_module pk_cmd_modules[] =
+{
+  {"pk-cmd-dump", {"dump", "dumpval", "pk_dump_", NULL}, 0},
+  {"pk-cmd-copy", {"copy", "pk_copy_", NULL}, 0},
+  {"pk-cmd-save", {"save", "pk_save_", NULL}, 0},
+  {"pk-cmd-extract", {"extract", NULL}, 0},
+  {"pk-cmd-scrabble", {"scrabble", "pk_scrabble_", NULL}, 0},
+  {"pk-cmd-diff", {"sdiff", "pk_diff_", "pk_sdiff_", NULL}, 0},
+};
+
+#define PK_CMD_NUM_MODULES \
+  (sizeof (pk_cmd_modules) / sizeof (pk_cmd_modules[0]))
+
+static void
+pk_cmd_load_module (struct pk_cmd_module *module)
+{
+  pk_val exception;
+
+  if (module->loaded_p)
+    return;
+  module->loaded_p = 1;
+
+  if (pk_load (poke_compiler, module->module, &exception) != PK_OK)
+    pk_fatal ("unable to load a pk-cmd module due to compile-time error");
+  else if (exception != PK_NULL)
+    {
+      poke_handle_exception (exception);
+      pk_fatal ("unable to load a pk-cmd module due to run-time exception");
+    }
+}
+
+void
+pk_cmd_load_all (void)
+{
+  size_t i;
+
+  for (i = 0; i < PK_CMD_NUM_MODULES; ++i)
+    pk_cmd_load_module (&pk_cmd_modules[i]);
+}
+
+/* Return whether the identifier ID, of LEN characters, matches NAME
+   as described above.  */
+
+static int
+pk_cmd_name_match_p (const char *id, size_t len, const char *name)
+{
+  size_t name_len = strlen (name);
+
+  if (name[name_len - 1] == '_')
+    return len >= name_len && strncmp (id, name, name_len) == 0;
+  return len == name_len && strncmp (id, name, len) == 0;
+}
+
+void
+pk_cmd_autoload (const char *text, size_t size)
+{
+  const char *p = text, *end = text + size;
+
+  while (p < end)
+    {
+      const char *id;
+      size_t i, j;
+
+      if (!isalpha ((unsigned char) *p) && *p != '_')
+        {
+          p++;
+          continue;
+        }
+
+      for (id = p; p < end && (isalnum ((unsigned char) *p) || *p == '_'); p++)
+        ;
+
+      /* Modules loaded by the code in TEXT may use any of the
+         commands.  Load them all.  */
+      if (pk_cmd_name_match_p (id, p - id, "load"))
+        {
+          pk_cmd_load_all ();
+          return;
+        }
+
+      for (i = 0; i < PK_CMD_NUM_MODULES; ++i)
+        for (j = 0; pk_cmd_modules[i].names[j]; ++j)
+          if (pk_cmd_name_match_p (id, p - id, pk_cmd_modules[i].names[j]))
+            pk_cmd_load_module (&pk_cmd_modules[i]);
+    }
+}
+
+void
+pk_cmd_autoload_file (const char *filename)
+{
+  size_t size;
+  char *text = read_file (filename, RF_BINARY, &size);
+
+  /* If the file can't be read, let the compiler complain about it.  */
+  if (text != NULL)
+    {
+      pk_cmd_autoload (text, size);
+      free (text);
+    }
+}
+
 #define IS_COMMAND(input, cmd) \
   (strncmp ((input), (cmd), sizeof (cmd) - 1) == 0 \
    && ((input)[sizeof (cmd) - 1] == ' ' || (input)[sizeof (cmd) - 1] == '\t'))
@@ -598,6 +721,8 @@ pk_cmd_exec (const char *str)
 
   const char *cmd = skip_blanks (str);
 
+  pk_cmd_autoload (cmd, strlen (cmd));
+
   if (*cmd == '.')
     return pk_cmd_exec_1 (cmd + 1, cmds_trie, NULL);
   else
@@ -752,28 +877,22 @@ pk_cmd_exec_script (const char *filename)
 void
 pk_cmd_init (void)
 {
-  pk_val exception;
-
   cmds_trie = pk_trie_from_cmds (dot_cmds);
   info_trie = pk_trie_from_cmds (info_cmds);
   vm_trie = pk_trie_from_cmds (vm_cmds);
   compiler_trie = pk_trie_from_cmds (compiler_cmds);
+  compiler_timing_trie = pk_trie_from_cmds (compiler_timing_cmds);
   vm_disas_trie = pk_trie_from_cmds (vm_disas_cmds);
   vm_profile_trie = pk_trie_from_cmds (vm_profile_cmds);
+  vm_gc_trie = pk_trie_from_cmds (vm_gc_cmds);
 
   /* The set_cmds are built dynamically.  */
   pk_cmd_set_init ();
   set_trie = pk_trie_from_cmds (set_cmds);
   set_cmd.subcommands = set_cmds;
 
-  /* Compile commands written in Poke.  */
-  if (pk_load (poke_compiler, "pk-cmd", &exception) != PK_OK)
-    pk_fatal ("unable to load the pk-cmd module due to compile-time error");
-  else if (exception != PK_NULL)
-    {
-      poke_handle_exception (exception);
-      pk_fatal ("unable to load the pk-cmd module due to run-time exception");
-    }
+  /* Note that the commands written in Poke are compiled on demand.
+     See pk_cmd_autoload.  */
 }
 
 void
@@ -783,8 +902,10 @@ pk_cmd_shutdown (void)
   pk_trie_free (info_trie);
   pk_trie_free (vm_trie);
   pk_trie_free (compiler_trie);
+  pk_trie_free (compiler_timing_trie);
   pk_trie_free (vm_disas_trie);
   pk_trie_free (vm_profile_trie);
+  pk_trie_free (vm_gc_trie);
   pk_trie_free (set_trie);
 }
 
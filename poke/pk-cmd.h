@@ -94,6 +94,21 @@ int pk_cmd_exec (const char *str);
 
 int pk_cmd_exec_script (const char *filename);
 
+/* Compile the commands written in Poke that are referred to in the
+   SIZE characters of Poke code at TEXT, unless they have been
+   compiled already.  This shall be called before compiling code
+   provided by the user.  */
+
+void pk_cmd_autoload (const char *text, size_t size);
+
+/* Likewise, but for the code in the file FILENAME.  */
+
+void pk_cmd_autoload_file (const char *filename);
+
+/* Compile all the commands written in Poke.  */
+
+void pk_cmd_load_all (void);
+
 /* Initialize the cmd subsystem.  */
 
 void pk_cmd_init (void);
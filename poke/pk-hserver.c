@@ -25,15 +25,17 @@
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdbool.h>
-#include <sys/time.h>
+#include <string.h>
+#include <fcntl.h>
+#include <poll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
-#include <sys/select.h>
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <netdb.h>
 #include <assert.h>
 #include "xalloc.h"
+#include "xstrndup.h"
 
 #include "libpoke.h"
 #include "poke.h"
@@ -56,11 +58,27 @@ static int hserver_socket;
 /* Port where the server listens for connections.  */
 static pk_val hserver_port;
 
-/* hserver_finish is used to tell the server threads to terminate.  It
-   is protected with a mutex.  */
-static int hserver_finish;
+/* The server thread doesn't run any Poke code.  It just reads the
+   requests sent by the clients and queues them, and the main thread
+   handles them while it waits for input in the REPL.  The queue is
+   protected with a mutex.  */
+
+struct hserver_request
+{
+  char *payload;
+  struct hserver_request *next;
+};
+
+static struct hserver_request *hserver_queue_head;
+static struct hserver_request *hserver_queue_tail;
 static pthread_mutex_t hserver_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/* A byte is written in hserver_notify_pipe whenever a request is
+   queued, to wake up the main thread, and in hserver_finish_pipe to
+   tell the server thread to terminate.  */
+static int hserver_notify_pipe[2] = { -1, -1 };
+static int hserver_finish_pipe[2] = { -1, -1 };
+
 /* The server maintains a table with tokens.  Each hyperlink uses its
    own unique token, which is included in the payload and checked upon
    connection.  */
@@ -180,11 +198,170 @@ make_socket (uint16_t port)
   return sock;
 }
 
+/* Execute the request PAYLOAD.  This is called by the main
+   thread.  */
+
+static void
+hserver_handle_request (const char *payload)
+{
+  uint64_t token;
+  char kind;
+  const char *p = payload;
+  const char *cmd;
+  pk_val cls;
+
+  /* The format of the payload is:
+     [0-9]+/{e,i} */
+
+  /* Get the token and check it.  */
+  if (!pk_atou (&p, &token))
+    {
+      printf ("PARSING INT\n");
+      return;
+    }
+
+  if (!pk_hserver_token_p (token))
+    return;
+
+  kind = pk_hserver_token_kind (token);
+
+  if (*p != '\0')
+    return;
+
+  switch (kind)
+    {
+    case 'e':
+      /* Command 'execute'.  */
+      cmd = pk_hserver_cmd (token);
+      pk_repl_display_begin ();
+      pk_puts (p);
+      pk_puts (cmd);
+      pk_puts ("\n");
+      pk_cmd_exec (cmd);
+      pk_repl_display_end ();
+      break;
+    case 'c':
+      /* Command 'closure'.  */
+      cls = pk_hserver_function (token);
+      cmd = pk_hserver_cmd (token);
+      pk_repl_display_begin ();
+      pk_puts (p);
+      pk_puts (cmd);
+      pk_puts ("\n");
+      /* Note we just ignore raised exceptions.  */
+      pk_call (poke_compiler, cls, NULL, NULL, 0);
+      pk_repl_display_end ();
+      break;
+    case 'i':
+      /* Command 'insert'.  */
+      cmd = pk_hserver_cmd (token);
+      pk_repl_insert (cmd);
+      break;
+    default:
+      break;
+    }
+}
+
+/* Queue the request PAYLOAD and wake up the main thread.  This is
+   called by the server thread.  */
+
+static void
+hserver_queue_request (char *payload)
+{
+  struct hserver_request *req = xmalloc (sizeof (*req));
+  char c = 0;
+
+  req->payload = payload;
+  req->next = NULL;
+
+  pthread_mutex_lock (&hserver_mutex);
+  if (hserver_queue_tail)
+    hserver_queue_tail->next = req;
+  else
+    hserver_queue_head = req;
+  hserver_queue_tail = req;
+  pthread_mutex_unlock (&hserver_mutex);
+
+  /* The pipe is non-blocking.  If it is full the main thread has
+     pending notifications anyway.  */
+  if (write (hserver_notify_pipe[1], &c, 1) < 0
+      && errno != EAGAIN && errno != EWOULDBLOCK)
+    {
+      perror ("write");
+      pk_fatal (NULL);
+    }
+}
+
+/* Execute all the queued requests.  This is called by the main
+   thread.  */
+
+static void
+hserver_run_requests (void)
+{
+  char buf[64];
+
+  /* Consume the notifications before taking the requests, so none is
+     missed.  */
+  while (read (hserver_notify_pipe[0], buf, sizeof (buf)) > 0)
+    ;
+
+  while (1)
+    {
+      struct hserver_request *req;
+
+      pthread_mutex_lock (&hserver_mutex);
+      req = hserver_queue_head;
+      if (req)
+        {
+          hserver_queue_head = req->next;
+          if (hserver_queue_head == NULL)
+            hserver_queue_tail = NULL;
+        }
+      pthread_mutex_unlock (&hserver_mutex);
+
+      if (req == NULL)
+        break;
+
+      hserver_handle_request (req->payload);
+      free (req->payload);
+      free (req);
+    }
+}
+
+void
+pk_hserver_wait_input (int fd)
+{
+  struct pollfd fds[2];
+
+  fds[0].fd = fd;
+  fds[0].events = POLLIN;
+  fds[1].fd = hserver_notify_pipe[0];
+  fds[1].events = POLLIN;
+
+  while (1)
+    {
+      if (poll (fds, 2, -1 /* timeout */) < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          perror ("poll");
+          pk_fatal (NULL);
+        }
+
+      if (fds[1].revents & POLLIN)
+        hserver_run_requests ();
+
+      /* Errors and hang-ups in FD are reported by the reader.  */
+      if (fds[0].revents)
+        break;
+    }
+}
+
 static int
 read_from_client (int filedes)
 {
   char buffer[MAXMSG];
-  int nbytes;
+  ssize_t nbytes;
 
   nbytes = read (filedes, buffer, MAXMSG);
   if (nbytes < 0)
@@ -199,145 +376,102 @@ read_from_client (int filedes)
     return -1;
   else
     {
-      uint64_t token;
-      char kind;
-      const char *p = buffer;
-      const char *cmd;
-      pk_val cls;
-
       /* Remove the newline at the end.  */
-      buffer[nbytes-1] = '\0';
-
-      /* The format of the payload is:
-         [0-9]+/{e,i} */
-
-      /* Get the token and check it.  */
-      if (!pk_atou (&p, &token))
-        {
-          printf ("PARSING INT\n");
-          return 0;
-        }
-
-      if (!pk_hserver_token_p (token))
-        return 0;
-
-      kind = pk_hserver_token_kind (token);
-
-      if (*p != '\0')
-        return 0;
-
-      switch (kind)
-        {
-        case 'e':
-          /* Command 'execute'.  */
-          cmd = pk_hserver_cmd (token);
-          pthread_mutex_lock (&hserver_mutex);
-          pk_repl_display_begin ();
-          pk_puts (p);
-          pk_puts (cmd);
-          pk_puts ("\n");
-          pk_cmd_exec (cmd);
-          pk_repl_display_end ();
-          pthread_mutex_unlock (&hserver_mutex);
-          break;
-        case 'c':
-          /* Command 'closure'.  */
-          cls = pk_hserver_function (token);
-          cmd = pk_hserver_cmd (token);
-          pthread_mutex_lock (&hserver_mutex);
-          pk_repl_display_begin ();
-          pk_puts (p);
-          pk_puts (cmd);
-          pk_puts ("\n");
-          /* Note we just ignore raised exceptions.  */
-          pk_call (poke_compiler, cls, NULL, NULL, 0);
-          pk_repl_display_end ();
-          pthread_mutex_unlock (&hserver_mutex);
-          break;
-        case 'i':
-          /* Command 'insert'.  */
-          cmd = pk_hserver_cmd (token);
-          pthread_mutex_lock (&hserver_mutex);
-          pk_repl_insert (cmd);
-          pthread_mutex_unlock (&hserver_mutex);
-          break;
-        default:
-          break;
-        }
-
+      hserver_queue_request (xstrndup (buffer, nbytes - 1));
       return 0;
     }
 }
 
+/* The server thread waits for connections and requests with poll,
+   without timeout, until something is written in
+   hserver_finish_pipe.  The first two entries of the array of polled
+   descriptors are used by the socket of the server and the pipe, and
+   the rest by the connected clients.  */
+
 static void *
 hserver_thread_worker (void *data)
 {
-  fd_set active_fd_set, read_fd_set;
-  int i;
+  struct pollfd *fds;
+  size_t nfds = 2, nalloc = 16;
   struct sockaddr_in clientname;
   socklen_t size;
 
-  pk_register_thread ();
-
-  /* Initialize the set of active sockets. */
-  FD_ZERO (&active_fd_set);
-  FD_SET (hserver_socket, &active_fd_set);
+  fds = xmalloc (nalloc * sizeof (*fds));
+  fds[0].fd = hserver_socket;
+  fds[0].events = POLLIN;
+  fds[1].fd = hserver_finish_pipe[0];
+  fds[1].events = POLLIN;
 
   while (1)
     {
-      struct timeval timeout = { 0, 200000 };
+      size_t i;
 
       /* Block until input arrives on one or more active sockets.  */
-      read_fd_set = active_fd_set;
-      if (select (FD_SETSIZE, &read_fd_set, NULL, NULL, &timeout) < 0)
+      if (poll (fds, nfds, -1 /* timeout */) < 0)
         {
           if (errno == EINTR)
             continue;
-          perror ("select");
+          perror ("poll");
           pk_fatal (NULL);
         }
 
-      /* Service all the sockets with input pending. */
-      for (i = 0; i < FD_SETSIZE; ++i)
-        if (FD_ISSET (i, &read_fd_set))
+      if (fds[1].revents)
+        break;
+
+      /* Data arriving on already-connected sockets.  Closed clients
+         are replaced by the last one.  */
+      for (i = 2; i < nfds;)
+        if (fds[i].revents && read_from_client (fds[i].fd) < 0)
           {
-            if (i == hserver_socket)
-              {
-                /* Connection request on original socket. */
-                int new;
-                size = sizeof (clientname);
-                new = accept (hserver_socket,
-                              (struct sockaddr *) &clientname,
-                              &size);
-                if (new < 0)
-                  {
-                    perror ("accept");
-                    pk_fatal (NULL);
-                  }
-                FD_SET (new, &active_fd_set);
-              }
-            else
-              {
-                /* Data arriving on an already-connected socket. */
-                if (read_from_client (i) < 0)
-                  {
-                    close (i);
-                    FD_CLR (i, &active_fd_set);
-                  }
-              }
+            close (fds[i].fd);
+            fds[i] = fds[--nfds];
           }
+        else
+          ++i;
 
-      pthread_mutex_lock (&hserver_mutex);
-      if (hserver_finish)
+      if (fds[0].revents & POLLIN)
         {
-          pthread_mutex_unlock (&hserver_mutex);
-          pk_unregister_thread ();
-          pthread_exit (NULL);
+          /* Connection request on original socket. */
+          int new;
+
+          size = sizeof (clientname);
+          new = accept (hserver_socket,
+                        (struct sockaddr *) &clientname,
+                        &size);
+          if (new < 0)
+            {
+              perror ("accept");
+              pk_fatal (NULL);
+            }
+
+          if (nfds == nalloc)
+            {
+              nalloc *= 2;
+              fds = xrealloc (fds, nalloc * sizeof (*fds));
+            }
+          fds[nfds].fd = new;
+          fds[nfds].events = POLLIN;
+          fds[nfds].revents = 0;
+          nfds++;
         }
-      pthread_mutex_unlock (&hserver_mutex);
     }
 
-  pk_unregister_thread ();
+  for (size_t i = 2; i < nfds; ++i)
+    close (fds[i].fd);
+  free (fds);
+  return NULL;
+}
+
+/* Create a pipe with both ends non-blocking.  */
+
+static void
+make_pipe (int fds[2])
+{
+  if (pipe2 (fds, O_CLOEXEC | O_NONBLOCK) != 0)
+    {
+      perror ("pipe2");
+      pk_fatal (NULL);
+    }
 }
 
 void
@@ -388,7 +522,8 @@ pk_hserver_start (void)
       poke_compiler, "hserver_port",
       pk_make_int (poke_compiler, ntohs (clientname.sin_port), 32));
 
-  hserver_finish = 0;
+  make_pipe (hserver_notify_pipe);
+  make_pipe (hserver_finish_pipe);
   ret = pthread_create (&hserver_thread,
                         NULL /* attr */,
                         hserver_thread_worker,
@@ -407,10 +542,13 @@ pk_hserver_shutdown (void)
 {
   int ret;
   void *res;
+  char c = 0;
 
-  pthread_mutex_lock (&hserver_mutex);
-  hserver_finish = 1;
-  pthread_mutex_unlock (&hserver_mutex);
+  if (write (hserver_finish_pipe[1], &c, 1) != 1)
+    {
+      perror ("write");
+      pk_fatal (NULL);
+    }
 
   ret = pthread_join (hserver_thread, &res);
   if (ret != 0)
@@ -419,6 +557,25 @@ pk_hserver_shutdown (void)
       perror ("pthread_join");
       pk_fatal (NULL);
     }
+
+  /* Requests not handled by now are discarded.  */
+  while (hserver_queue_head)
+    {
+      struct hserver_request *req = hserver_queue_head;
+
+      hserver_queue_head = req->next;
+      free (req->payload);
+      free (req);
+    }
+  hserver_queue_tail = NULL;
+
+  close (hserver_socket);
+  for (int i = 0; i < 2; ++i)
+    {
+      close (hserver_notify_pipe[i]);
+      close (hserver_finish_pipe[i]);
+      hserver_notify_pipe[i] = hserver_finish_pipe[i] = -1;
+    }
 }
 
 char *
@@ -30,6 +30,12 @@ void pk_hserver_init (void);
 void pk_hserver_start (void);
 void pk_hserver_shutdown (void);
 
+/* Wait until there is input to read in the file descriptor FD,
+   handling meanwhile the requests received by the server.  This
+   function shall be called by the main thread, while the server is
+   running.  */
+void pk_hserver_wait_input (int fd);
+
 /* Get a new token.  */
 unsigned int pk_hserver_get_token (void);
 
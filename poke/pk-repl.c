@@ -165,6 +165,13 @@ poke_getc (FILE *stream)
   else
     rl_completion_entry_function = poke_completion_function;
 
+#if HAVE_HSERVER
+  /* The hyperlinks requests are handled here, while waiting for the
+     user to type.  */
+  if (poke_hserver_p)
+    pk_hserver_wait_input (fileno (stream));
+#endif
+
   int c =  rl_getc (stream);
 
   /* Due to readline's apparent inability to change the word break
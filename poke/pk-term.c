@@ -26,7 +26,6 @@
 #include <textstyle.h>
 #include <assert.h>
 #include <xalloc.h>
-#include <xstrndup.h>
 #include <stdio.h>
 #include <termios.h>
 #include <signal.h>
@@ -51,6 +50,11 @@ static int pager_active_p;
 static int pager_inhibited_p;
 static int nlines = 1;
 
+/* Whether the output is styled.  When it is not, like when poke runs
+   non-interactively or with --color=no, the styling classes are not
+   passed to the output stream at all.  */
+static int styling_p;
+
 /* Default style to use when the user doesn't specify a style file.
    We provide two defaults: one for dark backgrounds (the default) and
    another for bright backgrounds.  */
@@ -110,42 +114,81 @@ uninstall_sigwinch_handler (void)
 #endif
 
 
-/* Stack of active classes.  */
+/* Stack of active classes.
+
+   Styling classes are opened and closed for almost every fragment of
+   output, so their names are interned once and the stack just holds
+   pointers to the interned names.  This avoids allocating memory for
+   every styled fragment.  */
 
-struct class_entry
+struct class_name
 {
-  char *class;
-  struct class_entry *next;
+  char *name;
+  struct class_name *next;
 };
 
-static struct class_entry *active_classes;
+static struct class_name *class_names;
+
+static const char **active_classes;
+static size_t num_active_classes;
+static size_t active_classes_size;
+
+static const char *
+intern_class (const char *name)
+{
+  struct class_name *entry;
+
+  for (entry = class_names; entry; entry = entry->next)
+    if (STREQ (entry->name, name))
+      return entry->name;
+
+  entry = xmalloc (sizeof (struct class_name));
+  entry->name = xstrdup (name);
+  entry->next = class_names;
+  class_names = entry;
+  return entry->name;
+}
 
 static void
 push_active_class (const char *name)
 {
-  struct class_entry *new;
-
-  new = xmalloc (sizeof (struct class_entry));
-  new->class = xstrdup (name);
-  new->next = active_classes;
-  active_classes = new;
+  if (num_active_classes == active_classes_size)
+    {
+      active_classes_size = active_classes_size ? active_classes_size * 2 : 16;
+      active_classes = xrealloc (active_classes,
+                                 active_classes_size * sizeof (char *));
+    }
+  active_classes[num_active_classes++] = intern_class (name);
 }
 
 static int
 pop_active_class (const char *name)
 {
-  struct class_entry *tmp;
-
-  if (!active_classes || !STREQ (active_classes->class, name))
+  if (num_active_classes == 0
+      || !STREQ (active_classes[num_active_classes - 1], name))
     return 0;
 
-  tmp = active_classes;
-  active_classes = active_classes->next;
-  free (tmp->class);
-  free (tmp);
+  num_active_classes--;
   return 1;
 }
 
+static void
+dispose_class_names (void)
+{
+  struct class_name *entry;
+
+  while (class_names)
+    {
+      entry = class_names->next;
+      free (class_names->name);
+      free (class_names);
+      class_names = entry;
+    }
+  free (active_classes);
+  active_classes = NULL;
+  num_active_classes = active_classes_size = 0;
+}
+
 /* Color registry.
 
    The libtextstyle streams identify colors with integers, whose
@@ -293,6 +336,8 @@ pk_term_init (int argc, char *argv[])
     style_file_name = NULL;
 #endif
 
+  styling_p = color_mode == color_html || pk_term_color_p ();
+
   /* Create the output styled stream.  */
   pk_ostream =
     (color_mode == color_html
@@ -318,7 +363,10 @@ pk_term_init (int argc, char *argv[])
     }
 #endif
 
-  /* Get the terminal dimensions and some terminal control sequences.  */
+  /* Get the terminal dimensions and some terminal control sequences.
+     These are only used by the pager, which is never active in batch
+     mode.  */
+  if (!poke_batch_p)
   {
     int done = 0;
     const char *termtype = getenv ("TERM");
@@ -358,17 +406,17 @@ pk_term_init (int argc, char *argv[])
 #endif
     if (!done)
       update_screen_dimensions ();
+    install_sigwinch_handler ();
   }
-  install_sigwinch_handler ();
 }
 
 void
 pk_term_shutdown ()
 {
-  uninstall_sigwinch_handler ();
+  if (!poke_batch_p)
+    uninstall_sigwinch_handler ();
 
-  while (active_classes)
-    pop_active_class (active_classes->class);
+  dispose_class_names ();
   dispose_color_registry ();
   styled_ostream_free (pk_ostream);
 }
@@ -405,13 +453,11 @@ pk_puts_paged (const char *lines)
 
   do
   {
-    char *line;
-
+    /* Write the line in place, including the newline if there is
+       one.  */
     end = strchrnul (start, '\n');
-    line = xstrndup (start, end - start + 1);
-
-    ostream_write_str (pk_ostream, line);
-    free (line);
+    ostream_write_mem (pk_ostream, start,
+                       end - start + (*end == '\n'));
     start = end + 1;
     if (*end != '\0')
       nlines++;
@@ -473,7 +519,11 @@ pk_puts_paged (const char *lines)
               }
             if (c == 'q')
               {
+                /* Stop the command producing the output, instead of
+                   letting it run to completion with nobody
+                   watching.  */
                 pager_inhibited_p = 1;
+                pk_interrupt (poke_compiler);
                 break;
               }
 
@@ -518,9 +568,23 @@ void
 pk_printf_1 (pk_compiler pkc, const char *format, ...)
 {
   va_list ap;
+  char buf[256];
   char *str;
   int r;
 
+  /* Most formatted strings are short, like numbers, so try to avoid
+     allocating memory for them.  */
+  va_start (ap, format);
+  r = vsnprintf (buf, sizeof buf, format, ap);
+  assert (r >= 0);
+  va_end (ap);
+
+  if ((size_t) r < sizeof buf)
+    {
+      pk_puts_1 (pkc, buf);
+      return;
+    }
+
   va_start (ap, format);
   r = vasprintf (&str, format, ap);
   assert (r != -1);
@@ -552,7 +616,8 @@ pk_term_indent_1 (pk_compiler pkc, unsigned int lvl, unsigned int step)
 void
 pk_term_class_1 (pk_compiler pkc __attribute__ ((unused)), const char *class)
 {
-  styled_ostream_begin_use_class (pk_ostream, class);
+  if (styling_p)
+    styled_ostream_begin_use_class (pk_ostream, class);
   push_active_class (class);
 }
 
@@ -562,7 +627,8 @@ pk_term_end_class_1 (pk_compiler pkc __attribute__ ((unused)), const char *class
   if (!pop_active_class (class))
     return 0;
 
-  styled_ostream_end_use_class (pk_ostream, class);
+  if (styling_p)
+    styled_ostream_end_use_class (pk_ostream, class);
   return 1;
 }
 
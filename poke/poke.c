@@ -60,6 +60,13 @@ int poke_hserver_p;
 
 int poke_quiet_p;
 
+/* The following global indicates whether poke runs in batch mode,
+   i.e. whether it should avoid setting up anything that is only
+   useful to interactive sessions.  This is useful when poke is
+   invoked many times from scripts.  */
+
+int poke_batch_p;
+
 /* The following global contains the directory holding libpoke's
    architecture independent files, such as scripts.  */
 
@@ -139,7 +146,8 @@ enum
   STYLE_BRIGHT_ARG,
   NO_HSERVER_ARG,
   HSERVER_PORT_ARG,
-  NO_STDTYPES_ARG
+  NO_STDTYPES_ARG,
+  BATCH_ARG
 };
 
 static const struct option long_options[] =
@@ -158,6 +166,7 @@ static const struct option long_options[] =
   {"no-hserver", no_argument, NULL, NO_HSERVER_ARG},
   {"hserver-port", required_argument, NULL, HSERVER_PORT_ARG},
   {"no-stdtypes", no_argument, NULL, NO_STDTYPES_ARG},
+  {"batch", no_argument, NULL, BATCH_ARG},
   {NULL, 0, NULL, 0},
 };
 
@@ -205,6 +214,7 @@ print_help (void)
   puts (_("  -p, --hserver-port                  set the port the hyperlink server will listen on"));
 #endif
   puts (_("      --no-stdtypes                   do not define standard types"));
+  puts (_("      --batch                         do not set up interactive features"));
   puts (_("      --quiet                         be as terse as possible"));
   puts (_("      --help                          print a help message and exit"));
   puts (_("      --version                       show version and exit"));
@@ -407,6 +417,10 @@ parse_args_1 (int argc, char *argv[])
         case NO_STDTYPES_ARG:
           poke_no_stdtypes_arg = 1;
           break;
+        case BATCH_ARG:
+          poke_batch_p = 1;
+          poke_interactive_p = 0;
+          break;
         case 'q':
         case NO_INIT_FILE_ARG:
           poke_load_init_file = 0;
@@ -455,6 +469,7 @@ parse_args_2 (int argc, char *argv[])
           {
             pk_val exception;
 
+            pk_cmd_autoload_file (optarg);
             if (pk_compile_file (poke_compiler, optarg, &exception) != PK_OK)
               goto exit_success;
             if (exception != PK_NULL)
@@ -489,6 +504,7 @@ parse_args_2 (int argc, char *argv[])
                command-line arguments.  Then execute the script and
                return.  */
             set_script_args (argc, argv);
+            pk_cmd_autoload_file (optarg);
             if (pk_compile_file (poke_compiler, optarg, &exception) != PK_OK)
               goto exit_failure;
             if (exception != PK_NULL)
@@ -510,6 +526,7 @@ parse_args_2 (int argc, char *argv[])
 #endif
         case NO_HSERVER_ARG:
         case NO_STDTYPES_ARG:
+        case BATCH_ARG:
         case 'q':
         case NO_INIT_FILE_ARG:
         case QUIET_ARG:
@@ -609,8 +626,13 @@ initialize (int argc, char *argv[])
   pk_term_init (argc, argv);
 
   /* Initialize the poke incremental compiler.  */
+  /* In batch mode poke exits right after freeing the compiler, so
+     don't bother collecting garbage then.  */
   poke_compiler = pk_compiler_new_with_flags (&poke_term_if,
-                                              poke_no_stdtypes_arg ? PK_F_NOSTDTYPES : 0);
+                                              (poke_no_stdtypes_arg
+                                               ? PK_F_NOSTDTYPES : 0)
+                                              | (poke_batch_p
+                                                 ? PK_F_NOEXITGC : 0));
   if (poke_compiler == NULL)
     pk_fatal ("creating the incremental compiler");
 
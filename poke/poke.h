@@ -31,6 +31,7 @@
 
 extern int poke_interactive_p;
 extern int poke_quiet_p;
+extern int poke_batch_p;
 extern int poke_exit_p;
 #if HAVE_HSERVER
 extern int poke_hserver_p;
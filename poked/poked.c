@@ -18,15 +18,20 @@
 
 #include <config.h>
 #include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include <getopt.h>
 #include <pthread.h>
 #include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
 
 #include "pk-utils.h"
 #include "usock.h"
@@ -67,6 +72,15 @@ err(int eval, const char *fmt, ...)
 pk_compiler pkc;
 struct usock *srv;
 
+/* Every session is served by a separate worker process, with its own
+   socket and its own Poke environment, so that a long-running command
+   only blocks the pokelets connected to the same session.  This is
+   the number of the session served by this process.  */
+
+static int poked_session;
+
+#define POKED_SESSIONS_MAX 64
+
 #define OK 0
 #define NOK 1
 
@@ -88,6 +102,8 @@ static void poked_free (void);
 #define VUCMD_CLEAR 3
 #define VUCMD_APPEND 4
 #define VUCMD_HIGHLIGHT 5
+#define VUCMD_VIEWPORT 6
+#define VUCMD_ROW 7
 
 /* Auto-completion  */
 #define AUTOCMPL_ITER_BEGIN OUTCMD_ITER_BEGIN
@@ -103,6 +119,18 @@ static void poked_free (void);
 #define PDISAS_TXT OUTCMD_TXT
 #define PDISAS_KIND 5
 
+/* Binary values (val)  */
+#define VALCMD_ITER_BEGIN OUTCMD_ITER_BEGIN
+#define VALCMD_ITER_END OUTCMD_ITER_END
+#define VALCMD_VAL 4
+#define VALCMD_VAL_END 5
+#define VALCMD_BYTES 6
+
+/* Latency statistics (stats)  */
+#define STATSCMD_ITER_BEGIN OUTCMD_ITER_BEGIN
+#define STATSCMD_ITER_END OUTCMD_ITER_END
+#define STATSCMD_HIST 4
+
 static uint8_t termout_chan = USOCK_CHAN_OUT_OUT;
 static uint32_t termout_cmdkind = OUTCMD_TXT;
 
@@ -278,6 +306,579 @@ bufb_free (struct bufb *b)
     }
 }
 
+//--- binary values
+
+/* Values are serialized in the format described by the PDAP_Val type
+   in pdap.pk, and sent in chunks over the binary values channel so
+   pokelets don't have to parse their printed representation.  */
+
+#define PDAP_VAL_NULL 0
+#define PDAP_VAL_INT 1
+#define PDAP_VAL_UINT 2
+#define PDAP_VAL_STRING 3
+#define PDAP_VAL_OFFSET 4
+#define PDAP_VAL_ARRAY 5
+#define PDAP_VAL_STRUCT 6
+#define PDAP_VAL_OTHER 7
+
+/* Maximum number of bytes of data in a message of the binary values
+   channel.  */
+#define VAL_CHUNK_SIZE 32768
+
+static void
+val_put (struct bufb *b, const void *data, size_t len)
+{
+  if (bufb_append (b, data, len) != OK)
+    err (1, "bufb_append() failed");
+}
+
+static void
+val_put_u8 (struct bufb *b, uint8_t v)
+{
+  val_put (b, &v, 1);
+}
+
+static void
+val_put_u64 (struct bufb *b, uint64_t v)
+{
+  uint8_t buf[8] = {
+#define b(i) (uint8_t) (v >> (i))
+    b (0), b (8), b (16), b (24), b (32), b (40), b (48), b (56),
+#undef b
+  };
+
+  val_put (b, buf, sizeof (buf));
+}
+
+static void
+val_put_str (struct bufb *b, pk_val str)
+{
+  const char *s = str == PK_NULL ? "" : pk_string_str (str);
+
+  val_put (b, s, strlen (s) + 1);
+}
+
+/* Where the array or struct VAL is mapped: a flag, followed by the IO
+   space and the bit-offset if the flag is set.  */
+
+static void
+val_put_mapping (struct bufb *b, pk_val val)
+{
+  int mapped_p = pk_val_mapped_p (val);
+
+  val_put_u8 (b, mapped_p);
+  if (mapped_p)
+    {
+      val_put_u64 (b, (uint64_t)pk_int_value (pk_val_ios (val)));
+      val_put_u64 (b, pk_uint_value (pk_val_boffset (val)));
+    }
+}
+
+static void
+poked_val_serialize (struct bufb *b, pk_val val)
+{
+  if (val == PK_NULL)
+    {
+      val_put_u8 (b, PDAP_VAL_NULL);
+      return;
+    }
+
+  switch (pk_val_kind (val))
+    {
+    case PK_VAL_INT:
+      val_put_u8 (b, PDAP_VAL_INT);
+      val_put_u8 (b, pk_int_size (val));
+      val_put_u64 (b, (uint64_t)pk_int_value (val));
+      break;
+    case PK_VAL_UINT:
+      val_put_u8 (b, PDAP_VAL_UINT);
+      val_put_u8 (b, pk_uint_size (val));
+      val_put_u64 (b, pk_uint_value (val));
+      break;
+    case PK_VAL_STRING:
+      val_put_u8 (b, PDAP_VAL_STRING);
+      val_put_str (b, val);
+      break;
+    case PK_VAL_OFFSET:
+      val_put_u8 (b, PDAP_VAL_OFFSET);
+      poked_val_serialize (b, pk_offset_magnitude (val));
+      val_put_u64 (b, pk_uint_value (pk_offset_unit (val)));
+      break;
+    case PK_VAL_ARRAY:
+      {
+        uint64_t nelem = pk_uint_value (pk_array_nelem (val));
+
+        val_put_u8 (b, PDAP_VAL_ARRAY);
+        val_put_mapping (b, val);
+        val_put_u64 (b, nelem);
+        for (uint64_t i = 0; i < nelem; ++i)
+          {
+            val_put_u64 (b, pk_uint_value (pk_array_elem_boffset (val, i)));
+            poked_val_serialize (b, pk_array_elem_value (val, i));
+          }
+      }
+      break;
+    case PK_VAL_STRUCT:
+      {
+        uint64_t nfields = pk_uint_value (pk_struct_nfields (val));
+
+        val_put_u8 (b, PDAP_VAL_STRUCT);
+        val_put_mapping (b, val);
+        val_put_str (b, pk_type_name (pk_typeof (val)));
+        val_put_u64 (b, nfields);
+        for (uint64_t i = 0; i < nfields; ++i)
+          {
+            pk_val boffset = pk_struct_field_boffset (val, i);
+
+            val_put_str (b, pk_struct_field_name (val, i));
+            val_put_u64 (b, boffset == PK_NULL ? 0 : pk_uint_value (boffset));
+            poked_val_serialize (b, pk_struct_field_value (val, i));
+          }
+      }
+      break;
+    default:
+      val_put_u8 (b, PDAP_VAL_OTHER);
+      break;
+    }
+}
+
+/* Send the serialization of VAL over the binary values channel.  */
+
+static void
+poked_val_send (pk_val val)
+{
+  struct bufb b;
+  size_t len;
+
+  if (bufb_init (&b, malloc (1024), 1024) != OK)
+    err (1, "bufb_init() failed");
+  poked_val_serialize (&b, val);
+
+  len = b.cur - b.mem;
+  for (size_t off = 0; off < len; off += VAL_CHUNK_SIZE)
+    {
+      size_t n = len - off < VAL_CHUNK_SIZE ? len - off : VAL_CHUNK_SIZE;
+      struct iovec iov = { .iov_base = b.mem + off, .iov_len = n };
+
+      usock_outv (srv, USOCK_CHAN_OUT_VAL,
+                  off + n == len ? VALCMD_VAL_END : VALCMD_VAL, &iov, 1);
+    }
+  bufb_free (&b);
+}
+
+/* Send the SIZE bytes at byte offset FROM of the IO space IOS over the
+   binary values channel.  Every message is prefixed by the IO space
+   and the offset of its bytes.  The bytes are taken directly from the
+   IO space whenever it allows it.  */
+
+static void
+poked_bytes_send (pk_ios ios, uint64_t from, uint64_t size)
+{
+  uint8_t *buf = NULL;
+  int id = pk_ios_get_id (ios);
+
+  while (size > 0)
+    {
+      uint64_t n = size < VAL_CHUNK_SIZE ? size : VAL_CHUNK_SIZE;
+      const void *data = pk_ios_read_ptr (ios, from, n);
+      uint8_t hdr[12] = {
+#define b(v, i) (uint8_t) ((v) >> (i))
+        b (id, 0), b (id, 8), b (id, 16), b (id, 24),
+        b (from, 0), b (from, 8), b (from, 16), b (from, 24),
+        b (from, 32), b (from, 40), b (from, 48), b (from, 56),
+#undef b
+      };
+      struct iovec iov[2];
+
+      if (data == NULL)
+        {
+          if (buf == NULL && (buf = malloc (VAL_CHUNK_SIZE)) == NULL)
+            err (1, "malloc() failed");
+          if (pk_ios_read (ios, from, buf, n) != PK_OK)
+            break;
+          data = buf;
+        }
+      iov[0].iov_base = hdr;
+      iov[0].iov_len = sizeof (hdr);
+      iov[1].iov_base = (void *)data;
+      iov[1].iov_len = n;
+      usock_outv (srv, USOCK_CHAN_OUT_VAL, VALCMD_BYTES, iov, 2);
+      from += n;
+      size -= n;
+    }
+  free (buf);
+}
+
+/* Send the values and bytes queued by `poked_val_send' and
+   `poked_bytes_send' in Poke.  */
+
+static void
+poked_val_send_queued (void)
+{
+  pk_val vals = pk_decl_val (pkc, "__poked_val_send_vals");
+  pk_val reqs = pk_decl_val (pkc, "__poked_bytes_send_reqs");
+  uint64_t nvals = pk_uint_value (pk_array_nelem (vals));
+  uint64_t nreqs = pk_uint_value (pk_array_nelem (reqs));
+  pk_val exc;
+
+  for (uint64_t i = 0; i < nvals; ++i)
+    poked_val_send (pk_array_elem_value (vals, i));
+  for (uint64_t i = 0; i < nreqs; ++i)
+    {
+      pk_val req = pk_array_elem_value (reqs, i);
+      pk_ios ios = pk_ios_search_by_id (
+          pkc, pk_int_value (pk_struct_field_value (req, 0)));
+
+      if (ios != NULL)
+        poked_bytes_send (ios, pk_uint_value (pk_struct_field_value (req, 1)),
+                          pk_uint_value (pk_struct_field_value (req, 2)));
+    }
+  (void)pk_call (pkc, pk_decl_val (pkc, "__poked_val_send_reset"), NULL,
+                 &exc, 0);
+}
+
+//--- viewport
+
+/* The viewport is a window of rows of an IO space that is kept up to
+   date in the vu pokelet.  After every command the bytes in the
+   window are compared with the ones last sent, and only the rows that
+   changed are sent again.  The window is not even read when the IO
+   space hasn't been written since the last time.  */
+
+#define VU_ROW_SIZE 16
+
+static struct poked_viewport
+{
+  int ios;              /* -1 if there is no viewport.  */
+  uint64_t from;        /* Byte offset of the first row.  */
+  uint64_t nrows;
+  uint64_t write_count; /* Of the IO space when the rows were sent.  */
+  uint8_t *bytes;       /* Bytes of the rows last sent.  */
+  uint8_t *rowlen;      /* Length of every row last sent.  */
+} viewport = { .ios = -1 };
+
+/* The length of the rows that haven't been sent yet.  */
+#define VU_ROW_UNSENT 0xff
+
+static void
+poked_viewport_reset (int ios, uint64_t from, uint64_t nrows)
+{
+  free (viewport.bytes);
+  free (viewport.rowlen);
+  viewport.bytes = viewport.rowlen = NULL;
+  viewport.ios = ios;
+  viewport.from = from;
+  viewport.nrows = nrows;
+  if (ios != -1 && nrows > 0)
+    {
+      viewport.bytes = malloc (nrows * VU_ROW_SIZE);
+      viewport.rowlen = malloc (nrows);
+      if (viewport.bytes == NULL || viewport.rowlen == NULL)
+        err (1, "malloc() failed");
+      memset (viewport.rowlen, VU_ROW_UNSENT, nrows);
+    }
+  else
+    viewport.ios = -1;
+}
+
+/* Render the LEN bytes of the row at byte offset OFFSET like the
+   `dump' command does in the vu pokelet.  */
+
+static void
+poked_viewport_render (char *buf, uint64_t offset, const uint8_t *bytes,
+                       int len)
+{
+  static const char hex[] = "0123456789abcdef";
+  char *p = buf;
+  int i;
+
+  p += sprintf (p, offset > 0xffffffff ? "%016" PRIx64 ":" : "%08" PRIx64 ":",
+                offset);
+  for (i = 0; i < VU_ROW_SIZE; ++i)
+    {
+      if (i % 2 == 0)
+        *p++ = ' ';
+      *p++ = i < len ? hex[bytes[i] >> 4] : ' ';
+      *p++ = i < len ? hex[bytes[i] & 0xf] : ' ';
+    }
+  *p++ = ' ';
+  *p++ = ' ';
+  for (i = 0; i < len; ++i)
+    *p++ = bytes[i] < ' ' || bytes[i] > '~' ? '.' : bytes[i];
+  *p = '\0';
+}
+
+static void
+poked_viewport_update (void)
+{
+  uint64_t nbytes, avail, size;
+  uint8_t *bytes;
+  pk_ios ios;
+  int sent_p = 0;
+
+  if (pk_int_value (pk_decl_val (pkc, "__plet_vu_viewport_p")))
+    {
+      pk_decl_set_val (pkc, "__plet_vu_viewport_p", pk_make_int (pkc, 0, 32));
+      poked_viewport_reset (
+          pk_int_value (pk_decl_val (pkc, "__plet_vu_viewport_ios")),
+          pk_uint_value (pk_decl_val (pkc, "__plet_vu_viewport_from")),
+          pk_uint_value (pk_decl_val (pkc, "__plet_vu_viewport_nrows")));
+      usock_out (srv, USOCK_CHAN_OUT_VU, VUCMD_ITER_BEGIN, "", 1);
+      usock_out_printf (srv, USOCK_CHAN_OUT_VU, VUCMD_VIEWPORT,
+                        "%d,%" PRIu64 ",%" PRIu64, viewport.ios,
+                        viewport.from, viewport.nrows);
+      sent_p = 1;
+    }
+  if (viewport.ios == -1)
+    goto done;
+
+  ios = pk_ios_search_by_id (pkc, viewport.ios);
+  if (ios == NULL)
+    {
+      /* The IO space has been closed.  */
+      poked_viewport_reset (-1, 0, 0);
+      if (!sent_p)
+        usock_out (srv, USOCK_CHAN_OUT_VU, VUCMD_ITER_BEGIN, "", 1);
+      usock_out (srv, USOCK_CHAN_OUT_VU, VUCMD_VIEWPORT, "-1,0,0", 7);
+      sent_p = 1;
+      goto done;
+    }
+
+  /* The rows are all unsent after a reset.  */
+  if (!sent_p && pk_ios_write_count (ios) == viewport.write_count)
+    goto done;
+  viewport.write_count = pk_ios_write_count (ios);
+
+  nbytes = viewport.nrows * VU_ROW_SIZE;
+  size = pk_ios_size (ios);
+  avail = viewport.from >= size ? 0 : size - viewport.from;
+  if (avail > nbytes)
+    avail = nbytes;
+
+  bytes = malloc (nbytes);
+  if (bytes == NULL)
+    err (1, "malloc() failed");
+  if (avail > 0 && pk_ios_read (ios, viewport.from, bytes, avail) != PK_OK)
+    avail = 0;
+
+  for (uint64_t r = 0; r < viewport.nrows; ++r)
+    {
+      uint64_t off = r * VU_ROW_SIZE;
+      int len = off >= avail ? 0
+                : avail - off > VU_ROW_SIZE ? VU_ROW_SIZE
+                : (int)(avail - off);
+      char row[128];
+
+      if (viewport.rowlen[r] == len
+          && memcmp (viewport.bytes + off, bytes + off, len) == 0)
+        continue;
+      memcpy (viewport.bytes + off, bytes + off, len);
+      viewport.rowlen[r] = len;
+
+      if (!sent_p)
+        usock_out (srv, USOCK_CHAN_OUT_VU, VUCMD_ITER_BEGIN, "", 1);
+      sent_p = 1;
+      if (len == 0)
+        row[0] = '\0';
+      else
+        poked_viewport_render (row, viewport.from + off, bytes + off, len);
+      usock_out_printf (srv, USOCK_CHAN_OUT_VU, VUCMD_ROW, "%" PRIu64 ",%s",
+                        r, row);
+    }
+  free (bytes);
+
+  /* Scrolling is likely, so get the adjacent windows in advance.  */
+  pk_ios_prefetch (ios, viewport.from > nbytes ? viewport.from - nbytes : 0,
+                   viewport.from > nbytes ? nbytes : viewport.from);
+  pk_ios_prefetch (ios, viewport.from + nbytes, nbytes);
+
+done:
+  if (sent_p)
+    usock_out (srv, USOCK_CHAN_OUT_VU, VUCMD_ITER_END, "", 1);
+}
+
+//--- latency statistics
+
+/* The time spent serving every kind of request is collected in a
+   histogram, so that pokelets can tell the time spent in the queue
+   from the time spent running Poke code.  Keep the kinds in-sync with
+   the names below and with `pdap.pk'.  */
+
+enum poked_lat_kind
+{
+  POKED_LAT_QUEUE,    /* Wait between the arrival and the dispatch.  */
+  POKED_LAT_COMPILE,  /* Code input.  */
+  POKED_LAT_EVAL,     /* Command input.  */
+  POKED_LAT_VU,       /* vu output, including the viewport.  */
+  POKED_LAT_AUTOCMPL, /* Auto-completion output.  */
+  POKED_LAT_PDISAS,   /* Poke disassembly output.  */
+  POKED_LAT_NKINDS
+};
+
+static const char *poked_lat_names[POKED_LAT_NKINDS] = {
+  "queue", "compile", "eval", "vu", "autocmpl", "pdisas",
+};
+
+/* The bucket I counts the latencies below 2^I microseconds, except the
+   last one which counts all the rest.  */
+
+#define POKED_LAT_NBUCKETS 32
+
+static struct poked_lat_hist
+{
+  uint64_t count;
+  uint64_t total_ns;
+  uint64_t max_ns;
+  uint64_t buckets[POKED_LAT_NBUCKETS];
+} poked_lat[POKED_LAT_NKINDS];
+
+/* If not NULL, every request is also written to this file as a trace
+   made of one span per kind of work, in the JSON encoding of
+   OpenTelemetry spans, one span per line.  The trace identifiers are
+   made of the time at which poked started and the number of the
+   request.  */
+
+static FILE *poked_trace;
+static uint64_t poked_trace_base;
+static uint64_t poked_trace_nreqs;
+static uint64_t poked_trace_nspans;
+static int64_t poked_trace_epoch; /* CLOCK_REALTIME - CLOCK_MONOTONIC.  */
+
+static uint64_t
+poked_now (void)
+{
+  struct timespec ts;
+
+  if (clock_gettime (CLOCK_MONOTONIC, &ts) != 0)
+    return 0;
+  return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void
+poked_trace_open (const char *path)
+{
+  struct timespec ts;
+
+  poked_trace = fopen (path, "a");
+  if (poked_trace == NULL)
+    err (1, "fopen() failed for trace file %s", path);
+  if (clock_gettime (CLOCK_REALTIME, &ts) != 0)
+    err (1, "clock_gettime() failed");
+  poked_trace_epoch
+      = (int64_t)((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec)
+        - (int64_t)poked_now ();
+  poked_trace_base = ((uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec)
+                     ^ ((uint64_t)getpid () << 48);
+}
+
+/* Write a span of the current request.  The root span of the request
+   has the number 1, and the rest of them are its children.  */
+
+static void
+poked_trace_span (const char *name, uint64_t start, uint64_t end)
+{
+  uint64_t id = ++poked_trace_nspans;
+
+  fprintf (poked_trace,
+           "{\"traceId\":\"%016" PRIx64 "%016" PRIx64 "\","
+           "\"spanId\":\"%016" PRIx64 "\",",
+           poked_trace_base, poked_trace_nreqs, id);
+  if (id != 1)
+    fprintf (poked_trace, "\"parentSpanId\":\"%016" PRIx64 "\",",
+             (uint64_t)1);
+  fprintf (poked_trace,
+           "\"name\":\"%s\",\"startTimeUnixNano\":%" PRIu64 ","
+           "\"endTimeUnixNano\":%" PRIu64 ","
+           "\"attributes\":{\"poked.session\":%d}}\n",
+           name, start + poked_trace_epoch, end + poked_trace_epoch,
+           poked_session);
+}
+
+static void
+poked_lat_record (enum poked_lat_kind kind, uint64_t start, uint64_t end)
+{
+  struct poked_lat_hist *h = &poked_lat[kind];
+  uint64_t ns = end > start ? end - start : 0;
+  uint64_t us = ns / 1000;
+  int b = 0;
+
+  while (us != 0 && b < POKED_LAT_NBUCKETS - 1)
+    {
+      us >>= 1;
+      ++b;
+    }
+  h->count++;
+  h->total_ns += ns;
+  if (ns > h->max_ns)
+    h->max_ns = ns;
+  h->buckets[b]++;
+
+  if (poked_trace)
+    poked_trace_span (poked_lat_names[kind], start, end);
+}
+
+/* Start the trace of a request which arrived at STAMP and is being
+   dispatched now, and account for the time it was queued.  Note that
+   the spans of the children are written before the root span.  */
+
+static uint64_t
+poked_lat_request_begin (struct usock_buf *inbuf)
+{
+  uint64_t now = poked_now ();
+  uint64_t stamp = usock_buf_stamp (inbuf);
+
+  if (stamp == 0 || stamp > now)
+    stamp = now;
+  ++poked_trace_nreqs;
+  poked_trace_nspans = 1;
+  poked_lat_record (POKED_LAT_QUEUE, stamp, now);
+  return stamp;
+}
+
+static void
+poked_lat_request_end (uint8_t chan, uint64_t stamp)
+{
+  if (poked_trace)
+    {
+      poked_trace_nspans = 0;
+      poked_trace_span (chan == USOCK_CHAN_IN_CODE ? "code" : "cmd", stamp,
+                        poked_now ());
+      fflush (poked_trace);
+    }
+}
+
+/* Send all the histograms over the latency statistics channel, and
+   reset them if the pokelet asked for it.  */
+
+static void
+poked_lat_send (void)
+{
+  static uint64_t iteration;
+  pk_val exc;
+
+  ++iteration;
+  iteration_begin (srv, USOCK_CHAN_OUT_STATS, iteration);
+  for (int k = 0; k < POKED_LAT_NKINDS; ++k)
+    {
+      struct poked_lat_hist *h = &poked_lat[k];
+      char buckets[POKED_LAT_NBUCKETS * 21];
+      char *p = buckets;
+
+      for (int b = 0; b < POKED_LAT_NBUCKETS; ++b)
+        p += sprintf (p, b == 0 ? "%" PRIu64 : " %" PRIu64, h->buckets[b]);
+      usock_out_printf (srv, USOCK_CHAN_OUT_STATS, STATSCMD_HIST,
+                        "%s,%" PRIu64 ",%" PRIu64 ",%" PRIu64 ",%s",
+                        poked_lat_names[k], h->count, h->total_ns / 1000,
+                        h->max_ns / 1000, buckets);
+    }
+  iteration_end (srv, USOCK_CHAN_OUT_STATS, iteration);
+
+  if (pk_int_value (pk_decl_val (pkc, "__poked_latency_reset_p")))
+    memset (poked_lat, 0, sizeof (poked_lat));
+  (void)pk_call (pkc, pk_decl_val (pkc, "__poked_latency_reset"), NULL, &exc,
+                 0);
+}
+
 //---
 
 static void
@@ -439,6 +1040,8 @@ poked_compile (const char *src, uint8_t chan, int *poked_restart_p,
 {
   int ok = 0;
   pk_val exc;
+  uint64_t start = poked_now ();
+  int vu_p;
 
   switch (chan)
     {
@@ -469,6 +1072,8 @@ poked_compile (const char *src, uint8_t chan, int *poked_restart_p,
                 termout_eval ();
                 pk_print_val (pkc, val, &exc);
                 termout_restore ();
+                if (pk_int_value (pk_decl_val (pkc, "poked_val_eval_p")))
+                  poked_val_send (val);
               }
             (void)pk_call (pkc,
                            pk_decl_val (pkc, "__poked_run_after_cmd_hooks"),
@@ -482,6 +1087,9 @@ poked_compile (const char *src, uint8_t chan, int *poked_restart_p,
     default:
       assert (0 && "impossible");
     }
+  poked_lat_record (chan == USOCK_CHAN_IN_CODE ? POKED_LAT_COMPILE
+                                               : POKED_LAT_EVAL,
+                    start, poked_now ());
   if (pk_int_value (pk_decl_val (pkc, "__poked_restart_p")))
     {
       *poked_restart_p = 1;
@@ -493,9 +1101,21 @@ poked_compile (const char *src, uint8_t chan, int *poked_restart_p,
       return ok;
     }
   if (pk_int_value (pk_decl_val (pkc, "__poked_autocmpl_p")))
-    poked_autocmpl_send ();
+    {
+      start = poked_now ();
+      poked_autocmpl_send ();
+      poked_lat_record (POKED_LAT_AUTOCMPL, start, poked_now ());
+    }
   if (pk_int_value (pk_decl_val (pkc, "__poked_disas_p")))
-    poked_disas_send ();
+    {
+      start = poked_now ();
+      poked_disas_send ();
+      poked_lat_record (POKED_LAT_PDISAS, start, poked_now ());
+    }
+  /* The viewport is updated right after the vu command, so that both
+     are accounted as a single vu update.  */
+  start = poked_now ();
+  vu_p = viewport.ios != -1;
   if (pk_int_value (pk_decl_val (pkc, "__plet_vu_do_p")))
     {
       const char *filt = pk_string_str (pk_decl_val (pkc, "__plet_vu_filter"));
@@ -508,9 +1128,17 @@ poked_compile (const char *src, uint8_t chan, int *poked_restart_p,
       assert (exc == PK_NULL);
       termout_restore ();
       usock_out (srv, USOCK_CHAN_OUT_VU, VUCMD_ITER_END, "", 1);
+      vu_p = 1;
     }
+  poked_viewport_update ();
+  if (vu_p || viewport.ios != -1)
+    poked_lat_record (POKED_LAT_VU, start, poked_now ());
   if (pk_int_value (pk_decl_val (pkc, "__poked_chan_send_p")))
     poked_buf_send ();
+  if (pk_int_value (pk_decl_val (pkc, "__poked_val_send_p")))
+    poked_val_send_queued ();
+  if (pk_int_value (pk_decl_val (pkc, "__poked_latency_p")))
+    poked_lat_send ();
 
   return ok;
 }
@@ -527,6 +1155,10 @@ static struct poked_options
 {
   int debug_p;
   char *socket_path;
+  int nsessions;
+  char *trace_path;
+  uint64_t max_steps;
+  uint64_t timeout;
 } poked_options;
 
 static void
@@ -538,18 +1170,27 @@ poked_options_init (int argc, char *argv[])
     OPT_VERSION,
     OPT_DEBUG,
     OPT_SOCK_PATH,
+    OPT_SESSIONS,
+    OPT_TRACE,
+    OPT_MAX_STEPS,
+    OPT_TIMEOUT,
   };
   static const struct option options[] = {
     { "help", no_argument, NULL, OPT_HELP },
     { "version", no_argument, NULL, OPT_VERSION },
     { "debug", no_argument, NULL, OPT_DEBUG },
     { "socket-path", required_argument, NULL, OPT_SOCK_PATH },
+    { "sessions", required_argument, NULL, OPT_SESSIONS },
+    { "trace", required_argument, NULL, OPT_TRACE },
+    { "max-steps", required_argument, NULL, OPT_MAX_STEPS },
+    { "timeout", required_argument, NULL, OPT_TIMEOUT },
     { NULL, 0, NULL, 0 },
   };
   char c;
   int ret;
 
-  while ((ret = getopt_long (argc, argv, "hvdS:", options, NULL)) != -1)
+  poked_options.nsessions = 1;
+  while ((ret = getopt_long (argc, argv, "hvdS:j:", options, NULL)) != -1)
     {
       c = ret;
       switch (c)
@@ -572,6 +1213,40 @@ poked_options_init (int argc, char *argv[])
         case 'S':
           poked_options.socket_path = strdup (optarg);
           break;
+        case OPT_SESSIONS:
+        case 'j':
+          {
+            char *end;
+            long n = strtol (optarg, &end, 10);
+
+            if (*optarg == '\0' || *end != '\0'
+                || n < 1 || n > POKED_SESSIONS_MAX)
+              errx (1, "invalid number of sessions: %s", optarg);
+            poked_options.nsessions = n;
+          }
+          break;
+        case OPT_TRACE:
+          poked_options.trace_path = strdup (optarg);
+          break;
+        case OPT_MAX_STEPS:
+        case OPT_TIMEOUT:
+          {
+            char *end;
+            unsigned long long n;
+
+            errno = 0;
+            n = strtoull (optarg, &end, 10);
+            if (*optarg == '\0' || *optarg == '-' || *end != '\0'
+                || errno != 0)
+              errx (1, "invalid %s: %s",
+                    c == OPT_MAX_STEPS ? "number of steps" : "timeout",
+                    optarg);
+            if (c == OPT_MAX_STEPS)
+              poked_options.max_steps = n;
+            else
+              poked_options.timeout = n;
+          }
+          break;
         default:
           poked_help ();
           exit (EXIT_FAILURE);
@@ -595,6 +1270,10 @@ poked_help (void)
   puts ("  -v, --version             show version and exit");
   puts ("  -d, --debug               be more verbose during the execution");
   puts ("  -S, --socket-path=PATH    path of unix domain socket to listen on");
+  puts ("  -j, --sessions=N          serve N independent sessions");
+  puts ("      --trace=FILE          append the spans of every request to FILE");
+  puts ("      --max-steps=N         limit the steps run by every request");
+  puts ("      --timeout=MSEC        limit the time taken by every request");
   printf ("\n\
 Report bugs in the bug tracker at\n\
   <%s>\n\
@@ -619,6 +1298,81 @@ This is free software: you are free to change and redistribute it.\n\
 There is NO WARRANTY, to the extent permitted by law.");
 }
 
+/* Return the path of the socket of the session N, or NULL if there is
+   not enough memory.  The first session uses the socket path given in
+   the command line.  */
+
+static char *
+poked_session_socket_path (int n)
+{
+  char *path;
+
+  if (n == 0)
+    return strdup (poked_options.socket_path);
+  if (asprintf (&path, "%s.%d", poked_options.socket_path, n) == -1)
+    return NULL;
+  return path;
+}
+
+/* Create the sockets of all the sessions, print the options and fork
+   one worker process per session.  This function only returns in the
+   worker processes, with `srv' and `poked_session' set.  The parent
+   process waits for all the workers to finish and exits.  */
+
+static void
+poked_sessions_spawn (int pdap_version)
+{
+  struct usock *srvs[POKED_SESSIONS_MAX];
+  char *paths[POKED_SESSIONS_MAX];
+  pid_t pids[POKED_SESSIONS_MAX];
+  int nsessions = poked_options.nsessions;
+  int i, status;
+
+  for (i = 0; i < nsessions; ++i)
+    {
+      paths[i] = poked_session_socket_path (i);
+      if (paths[i] == NULL)
+        err (1, "asprintf() failed for session socket path");
+      srvs[i] = usock_new (paths[i]);
+      if (srvs[i] == NULL)
+        err (1, "usock_new() failed");
+    }
+
+  printf ("socket_path %s\npdap_version %d\nsessions %d\n", paths[0],
+          pdap_version, nsessions);
+  for (i = 1; i < nsessions; ++i)
+    printf ("socket_path_%d %s\n", i, paths[i]);
+  printf ("\n");
+  fflush (stdout);
+
+  for (i = 0; i < nsessions; ++i)
+    free (paths[i]);
+
+  for (i = 0; i < nsessions; ++i)
+    {
+      pids[i] = fork ();
+      if (pids[i] == -1)
+        err (1, "fork() failed");
+      if (pids[i] == 0)
+        {
+          for (int j = 0; j < nsessions; ++j)
+            if (j != i)
+              usock_free (srvs[j]);
+          srv = srvs[i];
+          poked_session = i;
+          return;
+        }
+    }
+
+  for (i = 0; i < nsessions; ++i)
+    usock_free (srvs[i]);
+  for (i = 0; i < nsessions; ++i)
+    while (waitpid (pids[i], &status, 0) == -1 && errno == EINTR)
+      ;
+  free (poked_options.socket_path);
+  exit (EXIT_SUCCESS);
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -639,17 +1393,27 @@ main (int argc, char *argv[])
 
   poked_options_init (argc, argv);
 
-  srv = usock_new (poked_options.socket_path);
-  if (srv == NULL)
-    err (1, "usock_new() failed");
+  if (poked_options.nsessions > 1)
+    poked_sessions_spawn (pdap_version);
+  else
+    {
+      srv = usock_new (poked_options.socket_path);
+      if (srv == NULL)
+        err (1, "usock_new() failed");
+    }
+
+  /* Every session appends its own traces to the same file.  */
+  if (poked_options.trace_path)
+    poked_trace_open (poked_options.trace_path);
 
   if (pthread_attr_init (&thattr) != 0)
     err (1, "pthread_attr_init() failed");
   if (pthread_create (&th, &thattr, srvthread, srv) != 0)
     err (1, "pthread_create() failed");
 
-  printf ("socket_path %s\npdap_version %d\n\n", poked_options.socket_path,
-          pdap_version);
+  if (poked_options.nsessions == 1)
+    printf ("socket_path %s\npdap_version %d\n\n",
+            poked_options.socket_path, pdap_version);
 
 poked_restart:
   poked_restart_p = 0;
@@ -672,6 +1436,7 @@ poked_restart:
               {
                 char *src;
                 size_t srclen;
+                uint64_t stamp;
 
                 src = (char *)usock_buf_data (inbuf, &srclen);
                 if (srclen == 0)
@@ -683,9 +1448,13 @@ poked_restart:
                 if (poked_options.debug_p)
                   printf ("< '%.*s'\n", (int)srclen, src);
                 n_iteration++;
+                stamp = poked_lat_request_begin (inbuf);
                 iteration_begin (srv, USOCK_CHAN_OUT_OUT, n_iteration);
+                iteration_begin (srv, USOCK_CHAN_OUT_VAL, n_iteration);
                 (void)poked_compile (src, chan, &poked_restart_p, &done_p);
+                iteration_end (srv, USOCK_CHAN_OUT_VAL, n_iteration);
                 iteration_end (srv, USOCK_CHAN_OUT_OUT, n_iteration);
+                poked_lat_request_end (chan, stamp);
                 if (poked_restart_p)
                   {
                     usock_buf_free_chain (inbuf);
@@ -710,6 +1479,9 @@ poked_restart:
 
 done:
   free (poked_options.socket_path);
+  if (poked_trace)
+    fclose (poked_trace);
+  free (poked_options.trace_path);
   poked_free ();
   usock_done (srv);
   pthread_join (th, &ret);
@@ -945,6 +1717,16 @@ static struct pk_iod_if iod = {
 
 //--- poke
 
+/* Cancel the request being run, if any.  Pokelets offering a way to
+   stop long operations send SIGUSR1 to poked.  */
+
+static void
+poked_cancel_handler (int signum)
+{
+  (void) signum;
+  pk_cancel (pkc);
+}
+
 static int
 poked_init (int pdap_version)
 {
@@ -1046,6 +1828,14 @@ poked_init (int pdap_version)
                    pk_make_int (pkc, pdap_version, 32));
   pk_decl_set_val (pkc, "__poked_libpoke_version",
                    pk_make_string (pkc, VERSION));
+  pk_decl_set_val (pkc, "__poked_session",
+                   pk_make_int (pkc, poked_session, 32));
+
+  /* Every request is run with the budget given in the command line,
+     but not the loading of poked.pk.  */
+  pk_set_budget (pkc, poked_options.max_steps, poked_options.timeout);
+
+  signal (SIGUSR1, poked_cancel_handler);
 
   return OK;
 }
@@ -1053,6 +1843,7 @@ poked_init (int pdap_version)
 static void
 poked_free (void)
 {
+  poked_viewport_reset (-1, 0, 0);
   if (pkc)
     (void)pk_call (pkc, pk_decl_val (pkc, "poked_defer"), NULL, NULL, 0);
   pk_compiler_free (pkc);
@@ -23,7 +23,7 @@
 #include "usock-buf.h"
 
 // small-buffer size
-#define USOCK_BUF_SBUFSZ 23
+#define USOCK_BUF_SBUFSZ 15
 
 struct usock_buf_data
 {
@@ -40,6 +40,7 @@ struct usock_buf
   struct usock_buf *next;
   struct usock_buf *prev;
   uint64_t tag; // user-defined interpretation
+  uint64_t stamp; // monotonic time of arrival in nanoseconds, or zero
   size_t cap;
   size_t len;
   union
@@ -80,6 +81,12 @@ struct usock_buf *usock_buf_new (const char *data, size_t len);
 struct usock_buf *usock_buf_new_prefix (const void *prefix, size_t prelen,
                                         const char *data, size_t len);
 
+// Append LEN bytes of DATA after the first `len' bytes of the data of
+// buffer B, growing the buffer if necessary.
+// B shall not share its data with other buffers.
+// On success return 0.  On failure return -1, and B is left untouched.
+int usock_buf_append (struct usock_buf *b, const void *data, size_t len);
+
 // Append buffer B to the end of buffer BS chain and return BS.
 // If BS is null, return B.
 struct usock_buf *__attribute__ ((warn_unused_result))
@@ -29,6 +29,8 @@ usock_buf_data_new (size_t cap)
 {
   struct usock_buf_data *d = malloc (sizeof (struct usock_buf_data) + cap + 1);
 
+  if (d == NULL)
+    return NULL;
   d->refcount = 1;
   d->bytes = (unsigned char *)(d + 1);
   d->bytes[cap] = 0;
@@ -55,6 +57,7 @@ usock_buf_new_size (size_t cap)
   b->next = NULL;
   b->prev = NULL;
   b->tag = -1;
+  b->stamp = 0;
   b->cap = cap + /*'\0'*/ 1;
   b->len = 0;
   if (USOCK_BUF_SHORTBUF_P (b))
@@ -78,6 +81,7 @@ usock_buf_dup (struct usock_buf *b)
   bnew->next = NULL;
   bnew->prev = NULL;
   bnew->tag = b->tag;
+  bnew->stamp = b->stamp;
   assert (bnew->cap == b->cap);
   bnew->len = b->len;
   if (USOCK_BUF_SHORTBUF_P (b))
@@ -138,6 +142,44 @@ usock_buf_new (const char *data, size_t len)
   return usock_buf_new_prefix (NULL, 0, data, len);
 }
 
+int
+usock_buf_append (struct usock_buf *b, const void *data, size_t len)
+{
+  assert (b);
+
+  size_t cap = b->cap - 1;
+
+  if (b->len + len > cap)
+    {
+      size_t newcap = cap * 2;
+      struct usock_buf_data *d;
+
+      if (newcap < b->len + len)
+        newcap = b->len + len;
+      if (USOCK_BUF_SHORTBUF_P (b))
+        {
+          d = usock_buf_data_new (newcap);
+          if (d == NULL)
+            return -1;
+          memcpy (d->bytes, b->bytes, b->len);
+        }
+      else
+        {
+          assert (b->data->refcount == 1);
+          d = realloc (b->data, sizeof (struct usock_buf_data) + newcap + 1);
+          if (d == NULL)
+            return -1;
+          d->bytes = (unsigned char *)(d + 1);
+          d->bytes[newcap] = 0;
+        }
+      b->data = d;
+      b->cap = newcap + 1;
+    }
+  memcpy (USOCK_BUF_DATA (b) + b->len, data, len);
+  b->len += len;
+  return 0;
+}
+
 struct usock_buf *__attribute__ ((warn_unused_result))
 usock_buf_chain (struct usock_buf *bs, struct usock_buf *b)
 {
@@ -208,6 +250,14 @@ usock_buf_tag (struct usock_buf *b)
   return b->tag;
 }
 
+// API
+uint64_t
+usock_buf_stamp (struct usock_buf *b)
+{
+  assert (b);
+  return b->stamp;
+}
+
 // API
 unsigned char *
 usock_buf_data (struct usock_buf *b, size_t *len)
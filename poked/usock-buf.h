@@ -35,6 +35,11 @@ char *usock_buf_str (struct usock_buf *b);
 // Give the TAG associated with buffer. The interpretation is up to the user.
 uint64_t usock_buf_tag (struct usock_buf *b);
 
+// Give the time at which the buffer was received, in nanoseconds of
+// CLOCK_MONOTONIC, or zero for the buffers which were not received
+// from a client.
+uint64_t usock_buf_stamp (struct usock_buf *b);
+
 // Give the next buffer in the chain.
 struct usock_buf *usock_buf_next (struct usock_buf *b);
 
@@ -25,11 +25,16 @@
 #include <stdio.h> // vasprintf
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <sys/types.h>
 
 #include <fcntl.h>
+#if HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#else
 #include <poll.h>
+#endif
 #include <pthread.h>
 #include <sys/socket.h>
 #include <sys/stat.h>
@@ -92,41 +97,8 @@ read_n_bytes (int fd, unsigned char *data, size_t *len, size_t cap)
 #define USOCK_WRITE_PARTIAL 1
 #define USOCK_WRITE_COMPLETE 2
 
-static int
-write_n_bytes (int fd, unsigned char *data, size_t *len, size_t cap)
-{
-  assert (fd > 2); // :)
-  assert (data);
-  assert (len);
-  assert (cap);
-
-  ssize_t n;
-  int ret;
-
-  while (1)
-    {
-      n = write (fd, data + *len, cap - *len);
-      if (n == -1)
-        {
-          if (errno == EAGAIN || errno == EWOULDBLOCK)
-            {
-              ret = USOCK_WRITE_PARTIAL;
-              break;
-            }
-          if (errno == EINTR)
-            continue;
-          ret = USOCK_WRITE_ERR;
-          break;
-        }
-      *len += n;
-      if (*len == cap)
-        {
-          ret = USOCK_WRITE_COMPLETE;
-          break;
-        }
-    }
-  return ret;
-}
+// Maximum number of buffers written with a single `writev' call.
+#define USOCK_IOV_MAX 64
 
 // CHKME proper use
 #define USOCK_DIR_UNK 0
@@ -145,13 +117,18 @@ struct usock_client
     USOCK_CLIENT_OUT_WRITE,
     USOCK_CLIENT_GARBAGE,
   } state;
-  struct pollfd *pollfd;
   short direction;
   short collect_p; // if non-zero, means remove this client
   uint8_t chan;    // [0, 128)
   union
   {
-    struct usock_buf *outbufs;
+    struct
+    {
+      struct usock_buf *outbufs;
+      struct usock_buf *outlast;
+      size_t outoff; // number of bytes of `outbufs' already written
+      size_t outlen; // number of bytes waiting to be written
+    };
     struct
     {
       struct usock_buf *inbufs; // ready for consumption
@@ -191,8 +168,347 @@ usock_client_dtor (struct usock_client *c)
   usock_client_init (c);
 }
 
+// Queue the buffer B to be written to the output client C.
+// Return non-zero if the client wasn't waiting to write anything else.
+static int
+usock_client_queue (struct usock_client *c, struct usock_buf *b)
+{
+  int idle_p = c->outbufs == NULL;
+
+  b->next = NULL;
+  b->prev = c->outlast;
+  if (c->outlast)
+    c->outlast->next = b;
+  else
+    c->outbufs = b;
+  c->outlast = b;
+  c->outlen += b->len;
+  return idle_p;
+}
+
+// Write as much as possible of the buffers queued for client C,
+// several buffers at a time.
+static int
+usock_client_write (struct usock_client *c)
+{
+  struct iovec iov[USOCK_IOV_MAX];
+
+  while (c->outbufs)
+    {
+      struct usock_buf *b;
+      ssize_t n;
+      int niov = 0;
+
+      for (b = c->outbufs; b && niov < USOCK_IOV_MAX; b = b->next, ++niov)
+        {
+          iov[niov].iov_base = USOCK_BUF_DATA (b);
+          iov[niov].iov_len = b->len;
+        }
+      iov[0].iov_base = (unsigned char *)iov[0].iov_base + c->outoff;
+      iov[0].iov_len -= c->outoff;
+
+      n = writev (c->fd, iov, niov);
+      if (n == -1)
+        {
+          if (errno == EAGAIN || errno == EWOULDBLOCK)
+            return USOCK_WRITE_PARTIAL;
+          if (errno == EINTR)
+            continue;
+          return USOCK_WRITE_ERR;
+        }
+
+      c->outlen -= n;
+      n += c->outoff;
+      while (c->outbufs && (size_t)n >= c->outbufs->len)
+        {
+          n -= c->outbufs->len;
+          c->outbufs = usock_buf_free (c->outbufs);
+        }
+      if (c->outbufs)
+        c->outbufs->prev = NULL;
+      else
+        c->outlast = NULL;
+      c->outoff = n;
+    }
+  return USOCK_WRITE_COMPLETE;
+}
+
+#define USOCK_NOTIFY_FD(u) (u->pipefd[1])
+#define USOCK_CLIENTS_MAX 1024
+#define USOCK_ERRBUF_SIZE 128
+#define USOCK_CHANS_MAX 128
+
+// Output waiting to be written to a client beyond this number of bytes
+// stalls the producers of the channel of the client, until the output
+// of all the clients of the channel drops below USOCK_OUT_LOWAT bytes.
+// The other channels are not affected.
+#define USOCK_OUT_HIWAT (1024 * 1024)
+#define USOCK_OUT_LOWAT (256 * 1024)
+
+// Initial size of the buffers accumulating the messages of a channel
+// until they are dispatched by the server thread.
+#define USOCK_OUT_STAGE_SIZE 4096
+
+// Maximum number of events handled at once by the server loop.
+#define USOCK_EVENTS_MAX 64
+
+// Events are identified by the index of the client in `clients' plus
+// two; the first two identifiers are for the server socket and the
+// notification pipe.
+#define USOCK_EV_ID_SRV 0
+#define USOCK_EV_ID_NOTIF 1
+#define USOCK_EV_ID_CLIENT(u, c) ((int)((c) - (u)->clients) + 2)
+
+#define USOCK_EV_IN 1
+#define USOCK_EV_OUT 2
+#define USOCK_EV_HUP 4
+
+struct usock_event
+{
+  int id;
+  int flags;
+};
+
+struct usock
+{
+  int fd;
+  int pipefd[2]; // for notification from other threads
+  size_t nclients;
+  size_t nslots; // clients[nslots..] are all free
+  struct usock_client clients[USOCK_CLIENTS_MAX];
+
+#if HAVE_SYS_EPOLL_H
+  int epfd;
+#else
+  struct pollfd polls[/*server*/ 1 + /*pipefd[0]*/ 1 + USOCK_CLIENTS_MAX];
+#endif
+
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;
+  pthread_cond_t outcond; // signalled when a channel is no longer stalled
+  int done_p;
+  int notified_p;
+  struct usock_buf *inbufs;
+  struct usock_buf *outstage[USOCK_CHANS_MAX];
+  uint8_t stalled_p[USOCK_CHANS_MAX];
+
+  char errbuf[USOCK_ERRBUF_SIZE];
+};
+
+/* Format an error message in internal error buffer `usock->errbuf'.
+
+   First put printf-like formatted message in the buffer, and then
+   append an error message describing provided error number `errnum'.  */
+
+static void
+usock_errorf (struct usock *usock, int errnum, const char *fmt, ...)
+{
+  int n;
+  va_list ap;
+  char *buf;
+  size_t bufsz;
+
+  assert (usock);
+  assert (fmt);
+
+  buf = usock->errbuf;
+  bufsz = USOCK_ERRBUF_SIZE;
+
+  va_start (ap, fmt);
+  n = vsnprintf (buf, bufsz, fmt, ap);
+  va_end (ap);
+
+  if (n < 0)
+    {
+      buf[0] = buf[1] = buf[2] = '?';
+      buf[3] = '\0';
+      n = 3;
+    }
+
+  /* Available space is `bufsz' bytes from `buf'.  */
+  bufsz -= n;
+  buf += n;
+
+  /* Append ": " string and narrow the buffer.  */
+  if (bufsz < 3)
+    return;
+  buf[0] = ':';
+  buf[1] = ' ';
+  buf[2] = '\0';
+  bufsz -= 2;
+  buf += 2;
+
+  strerror_r (errnum, buf, bufsz);
+}
+
+//--- poller
+
+/* The server loop waits for events using epoll where available, and
+   poll otherwise.  In both cases the set of watched file descriptors
+   is kept across iterations of the loop and only updated when the
+   clients change.
+
+   With epoll, the output clients are watched in edge-triggered mode:
+   they are written to as soon as there is new output for them, and
+   only an EAGAIN makes them wait for the next writability event.  */
+
+static int
+usock_poller_init (struct usock *u)
+{
+#if HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  u->epfd = epoll_create1 (EPOLL_CLOEXEC);
+  if (u->epfd == -1)
+    return -1;
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN;
+  ev.data.u32 = USOCK_EV_ID_SRV;
+  if (epoll_ctl (u->epfd, EPOLL_CTL_ADD, u->fd, &ev) == -1)
+    return -1;
+  ev.data.u32 = USOCK_EV_ID_NOTIF;
+  if (epoll_ctl (u->epfd, EPOLL_CTL_ADD, u->pipefd[0], &ev) == -1)
+    return -1;
+#else
+  for (size_t i = 0; i < sizeof (u->polls) / sizeof (u->polls[0]); ++i)
+    {
+      u->polls[i].fd = -1;
+      u->polls[i].events = 0;
+    }
+  u->polls[USOCK_EV_ID_SRV].fd = u->fd;
+  u->polls[USOCK_EV_ID_SRV].events = POLLIN;
+  u->polls[USOCK_EV_ID_NOTIF].fd = u->pipefd[0];
+  u->polls[USOCK_EV_ID_NOTIF].events = POLLIN;
+#endif
+  return 0;
+}
+
+static void
+usock_poller_fini (struct usock *u)
+{
+#if HAVE_SYS_EPOLL_H
+  if (u->epfd != -1)
+    close (u->epfd);
+  u->epfd = -1;
+#else
+  (void)u;
+#endif
+}
+
+// Start watching the new client C for input.
+static int
+usock_poller_add (struct usock *u, struct usock_client *c)
+{
+#if HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLIN | EPOLLRDHUP;
+  ev.data.u32 = USOCK_EV_ID_CLIENT (u, c);
+  return epoll_ctl (u->epfd, EPOLL_CTL_ADD, c->fd, &ev);
+#else
+  struct pollfd *p = &u->polls[USOCK_EV_ID_CLIENT (u, c)];
+
+  p->fd = c->fd;
+  p->events = POLLIN;
+  return 0;
+#endif
+}
+
+// Watch client C, which just became an output client, for
+// writability.
+static int
+usock_poller_set_out (struct usock *u, struct usock_client *c)
+{
+#if HAVE_SYS_EPOLL_H
+  struct epoll_event ev;
+
+  memset (&ev, 0, sizeof (ev));
+  ev.events = EPOLLOUT | EPOLLET | EPOLLRDHUP;
+  ev.data.u32 = USOCK_EV_ID_CLIENT (u, c);
+  return epoll_ctl (u->epfd, EPOLL_CTL_MOD, c->fd, &ev);
+#else
+  // Hang-ups are reported even if no event is requested.
+  u->polls[USOCK_EV_ID_CLIENT (u, c)].events = 0;
+  return 0;
+#endif
+}
+
+// Tell whether the output client C is waiting for its socket to
+// become writable.
+static void
+usock_poller_want_out (struct usock *u, struct usock_client *c, int want_p)
+{
+#if HAVE_SYS_EPOLL_H
+  // Edge-triggered.
+  (void)u;
+  (void)c;
+  (void)want_p;
+#else
+  u->polls[USOCK_EV_ID_CLIENT (u, c)].events = want_p ? POLLOUT : 0;
+#endif
+}
+
+// Stop watching client C.  This shall be called before closing the
+// socket of the client.
+static void
+usock_poller_del (struct usock *u, struct usock_client *c)
+{
+#if HAVE_SYS_EPOLL_H
+  (void)epoll_ctl (u->epfd, EPOLL_CTL_DEL, c->fd, NULL);
+#else
+  u->polls[USOCK_EV_ID_CLIENT (u, c)].fd = -1;
+  u->polls[USOCK_EV_ID_CLIENT (u, c)].events = 0;
+#endif
+}
+
+// Wait for events and put at most MAX of them in EVS.
+// Return the number of events, or -1 on failure.
+static int
+usock_poller_wait (struct usock *u, struct usock_event *evs, int max)
+{
+#if HAVE_SYS_EPOLL_H
+  struct epoll_event eevs[USOCK_EVENTS_MAX];
+  int n;
+
+  assert (max <= USOCK_EVENTS_MAX);
+  n = epoll_wait (u->epfd, eevs, max, -1);
+  for (int i = 0; i < n; ++i)
+    {
+      evs[i].id = eevs[i].data.u32;
+      evs[i].flags = ((eevs[i].events & EPOLLIN ? USOCK_EV_IN : 0)
+                      | (eevs[i].events & EPOLLOUT ? USOCK_EV_OUT : 0)
+                      | (eevs[i].events & (EPOLLHUP | EPOLLERR | EPOLLRDHUP)
+                             ? USOCK_EV_HUP
+                             : 0));
+    }
+  return n;
+#else
+  int npoll = poll (u->polls, 2 + u->nslots, -1);
+  int n = 0;
+
+  if (npoll == -1)
+    return -1;
+  for (int i = 0; i < (int)(2 + u->nslots) && n < max; ++i)
+    if (u->polls[i].revents)
+      {
+        short re = u->polls[i].revents;
+
+        evs[n].id = i;
+        evs[n].flags = ((re & POLLIN ? USOCK_EV_IN : 0)
+                        | (re & POLLOUT ? USOCK_EV_OUT : 0)
+                        | (re & (POLLHUP | POLLERR | POLLNVAL) ? USOCK_EV_HUP
+                                                               : 0));
+        ++n;
+      }
+  return n;
+#endif
+}
+
+//---
+
 static int
-usock_client_step (struct usock_client *c)
+usock_client_step (struct usock *u, struct usock_client *c)
 {
   if (c == NULL)
     return 0;
@@ -216,13 +532,18 @@ usock_client_step (struct usock_client *c)
             c->state = USOCK_CLIENT_IN_READ_LENGTH;
           else
             {
-              c->pollfd->fd = -c->fd;
-              c->pollfd->events = POLLOUT;
+              // The input part of the union is not used anymore.
+              c->outbufs = c->outlast = NULL;
+              c->outoff = c->outlen = 0;
+              if (usock_poller_set_out (u, c) == -1)
+                {
+                  c->state = USOCK_CLIENT_GARBAGE;
+                  c->collect_p = 1;
+                  return 0;
+                }
               c->state = USOCK_CLIENT_OUT_WRITE;
             }
-          c->bufidx = 0;
           assert (c->fd > 0);
-          assert (c->pollfd->fd == c->fd || c->pollfd->fd == -c->fd);
           break;
         case USOCK_READ_PARTIAL:
           return 0;
@@ -279,6 +600,14 @@ usock_client_step (struct usock_client *c)
           case USOCK_READ_PARTIAL:
             return 0;
           case USOCK_READ_COMPLETE:
+            {
+              struct timespec ts;
+
+              // Let the consumer tell how long the message was queued.
+              if (clock_gettime (CLOCK_MONOTONIC, &ts) == 0)
+                c->inbuf->stamp
+                    = (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+            }
             c->inbufs = usock_buf_chain (c->inbufs, c->inbuf);
             c->inbuf = NULL;
             c->state = USOCK_CLIENT_IN_READ_LENGTH;
@@ -288,33 +617,19 @@ usock_client_step (struct usock_client *c)
       break;
 
     case USOCK_CLIENT_OUT_WRITE:
-      while (c->outbufs)
+      switch (usock_client_write (c))
         {
-          int s = write_n_bytes (c->fd, USOCK_BUF_DATA (c->outbufs),
-                                 &c->outbufs->len, c->outbufs->cap);
-
-          switch (s)
-            {
-            case USOCK_WRITE_ERR:
-              c->state = USOCK_CLIENT_GARBAGE;
-              c->collect_p = 1;
-              c->pollfd->fd = -c->fd; // disable polling
-              return 0;
-            case USOCK_WRITE_PARTIAL:
-              c->pollfd->fd = c->fd; // enable polling
-              return 0;
-            case USOCK_WRITE_COMPLETE:
-              {
-                struct usock_buf *bnext = c->outbufs->next;
-
-                assert (c->outbufs != bnext);
-                usock_buf_free (c->outbufs);
-                c->outbufs = bnext;
-              }
-              break;
-            }
+        case USOCK_WRITE_ERR:
+          c->state = USOCK_CLIENT_GARBAGE;
+          c->collect_p = 1;
+          return 0;
+        case USOCK_WRITE_PARTIAL:
+          usock_poller_want_out (u, c, 1);
+          return 0;
+        case USOCK_WRITE_COMPLETE:
+          usock_poller_want_out (u, c, 0);
+          return 0;
         }
-      c->pollfd->fd = -c->fd; // disable polling
       return 0;
 
     case USOCK_CLIENT_GARBAGE:
@@ -324,80 +639,34 @@ usock_client_step (struct usock_client *c)
   return 1;
 }
 
-#define USOCK_NOTIFY_FD(u) (u->pipefd[1])
-#define USOCK_CLIENTS_MAX 1024
-#define USOCK_ERRBUF_SIZE 128
-
-struct usock
-{
-  int fd;
-  int pipefd[2]; // for notification from other threads
-  size_t nclients;
-  struct usock_client clients[USOCK_CLIENTS_MAX];
-
-  pthread_mutex_t mutex;
-  pthread_cond_t cond;
-  int done_p;
-  struct usock_buf *inbufs;
-  struct usock_buf *outbufs;
-
-  char errbuf[USOCK_ERRBUF_SIZE];
-};
-
-/* Format an error message in internal error buffer `usock->errbuf'.
-
-   First put printf-like formatted message in the buffer, and then
-   append an error message describing provided error number `errnum'.  */
-
+// Move the messages received from client C to the chain of buffers
+// INBUFS, and remove the client if it's gone.
 static void
-usock_errorf (struct usock *usock, int errnum, const char *fmt, ...)
+usock_client_collect (struct usock *u, struct usock_client *c,
+                      struct usock_buf **inbufs)
 {
-  int n;
-  va_list ap;
-  char *buf;
-  size_t bufsz;
-
-  assert (usock);
-  assert (fmt);
-
-  buf = usock->errbuf;
-  bufsz = USOCK_ERRBUF_SIZE;
-
-  va_start (ap, fmt);
-  n = vsnprintf (buf, bufsz, fmt, ap);
-  va_end (ap);
-
-  if (n < 0)
+  if (c->direction == USOCK_DIR_IN && c->inbufs)
     {
-      buf[0] = buf[1] = buf[2] = '?';
-      buf[3] = '\0';
-      n = 3;
+      *inbufs = usock_buf_chain (*inbufs, c->inbufs);
+      c->inbufs = NULL;
+    }
+  if (c->collect_p)
+    {
+      usock_poller_del (u, c);
+      usock_client_dtor (c);
+      --u->nclients;
+      while (u->nslots && u->clients[u->nslots - 1].fd == -1)
+        --u->nslots;
     }
-
-  /* Available space is `bufsz' bytes from `buf'.  */
-  bufsz -= n;
-  buf += n;
-
-  /* Append ": " string and narrow the buffer.  */
-  if (bufsz < 3)
-    return;
-  buf[0] = ':';
-  buf[1] = ' ';
-  buf[2] = '\0';
-  bufsz -= 2;
-  buf += 2;
-
-  strerror_r (errnum, buf, bufsz);
 }
 
 #define USOCK_HANDLE_SRV_OK 0
 #define USOCK_HANDLE_SRV_NOK -1
 
 static int
-usock_handle_srv (struct usock *u, struct pollfd *pfds)
+usock_handle_srv (struct usock *u, struct usock_buf **inbufs)
 {
   assert (u);
-  assert (pfds);
 
   struct sockaddr adr;
   socklen_t adrlen = sizeof (adr);
@@ -407,6 +676,7 @@ usock_handle_srv (struct usock *u, struct pollfd *pfds)
   while (1)
     {
       int flags;
+      size_t i;
 
       if ((fd = accept (u->fd, &adr, &adrlen)) == -1)
         {
@@ -430,16 +700,27 @@ usock_handle_srv (struct usock *u, struct pollfd *pfds)
                         __func__, fd);
           return USOCK_HANDLE_SRV_NOK;
         }
-      c = &u->clients[u->nclients];
+
+      // Reuse the first free slot.
+      for (i = 0; i < u->nslots && u->clients[i].fd != -1; ++i)
+        ;
+      c = &u->clients[i];
       usock_client_init (c);
       c->fd = fd;
       c->state = USOCK_CLIENT_READ_ROLE;
-      c->pollfd = pfds + u->nclients;
-      c->pollfd->fd = fd;
-      c->pollfd->events = POLLIN;
+      if (usock_poller_add (u, c) == -1)
+        {
+          usock_errorf (u, errno, "[%s] failed to watch client %d",
+                        __func__, fd);
+          usock_client_dtor (c);
+          return USOCK_HANDLE_SRV_NOK;
+        }
+      if (i == u->nslots)
+        ++u->nslots;
       ++u->nclients;
-      while (usock_client_step (c))
+      while (usock_client_step (u, c))
         ;
+      usock_client_collect (u, c, inbufs);
     }
   return USOCK_HANDLE_SRV_OK;
 }
@@ -448,14 +729,14 @@ usock_handle_srv (struct usock *u, struct pollfd *pfds)
 #define USOCK_HANDLE_NOTIF_NOK -1
 
 static int
-usock_handle_notif (struct usock *u, struct pollfd *pfds)
+usock_handle_notif (struct usock *u)
 {
   assert (u);
-  assert (pfds);
 
   char buf[32];
   ssize_t n;
-  struct usock_buf *outbufs;
+  struct usock_buf *outstage[USOCK_CHANS_MAX];
+  uint8_t chan;
 
   while (1)
     {
@@ -474,121 +755,72 @@ usock_handle_notif (struct usock *u, struct pollfd *pfds)
         }
     }
 
-  // append buf to out clients
+  // take the messages accumulated in every channel
 
   pthread_mutex_lock (&u->mutex);
-  outbufs = u->outbufs;
-  u->outbufs = NULL;
+  memcpy (outstage, u->outstage, sizeof (outstage));
+  memset (u->outstage, 0, sizeof (u->outstage));
+  u->notified_p = 0;
   pthread_mutex_unlock (&u->mutex);
 
-  // Spurious wake up :)
-  if (outbufs == NULL)
-    return USOCK_HANDLE_NOTIF_OK;
-
-  // reverse the chain
-  outbufs = usock_buf_chain_rev (outbufs);
-
-  while (outbufs)
+  // Every output client of a channel gets a reference to the same data.
+  for (chan = 0; chan < USOCK_CHANS_MAX; ++chan)
     {
-      uint8_t chan = outbufs->tag & 0x7f;
+      if (outstage[chan] == NULL)
+        continue;
 
-      for (size_t i = 0; i < u->nclients; ++i)
+      for (size_t i = 0; i < u->nslots; ++i)
         {
           struct usock_client *c = &u->clients[i];
 
-          if (c->direction != USOCK_DIR_OUT)
+          if (c->fd == -1 || c->direction != USOCK_DIR_OUT || c->chan != chan
+              || c->state != USOCK_CLIENT_OUT_WRITE)
             continue;
-          if (c->chan == chan)
-            c->outbufs = usock_buf_chain (c->outbufs, usock_buf_dup (outbufs));
+          // Clients already waiting to write are resumed by the poller.
+          if (usock_client_queue (c, usock_buf_dup (outstage[chan])))
+            {
+              while (usock_client_step (u, c))
+                ;
+              if (c->collect_p)
+                usock_client_collect (u, c, NULL);
+            }
         }
-
-      outbufs = usock_buf_free (outbufs); // free current node and get next
-    }
-
-  for (size_t i = 0; i < u->nclients; ++i)
-    {
-      struct usock_client *c = &u->clients[i];
-
-      if (c->outbufs)
-        while (usock_client_step (c))
-          ;
+      usock_buf_free (outstage[chan]);
     }
 
   return USOCK_HANDLE_NOTIF_OK;
 }
 
+// Stall the producers of the channels with slow clients, and resume
+// the ones whose clients caught up.
 static void
-usock_clients_collect (struct usock *u, struct pollfd *pfds)
+usock_update_stalls (struct usock *u)
 {
-  assert (u);
-  assert (pfds);
-
-  struct usock_client *cf = u->clients;
-  struct usock_client *cl = u->clients + u->nclients;
-  struct usock_client *c;
-  struct pollfd *pf = pfds;
-  struct pollfd *p = pf;
+  size_t outlen[USOCK_CHANS_MAX];
+  int resume_p = 0;
 
-  // sanity check
-  for (int i = 0; i < (int)u->nclients; ++i)
+  memset (outlen, 0, sizeof (outlen));
+  for (size_t i = 0; i < u->nslots; ++i)
     {
-      assert (u->clients[i].pollfd == pfds + i);
-      assert (u->clients[i].pollfd->fd == u->clients[i].fd
-              || u->clients[i].pollfd->fd == -u->clients[i].fd);
+      struct usock_client *c = &u->clients[i];
+
+      if (c->fd != -1 && c->direction == USOCK_DIR_OUT
+          && c->outlen > outlen[c->chan])
+        outlen[c->chan] = c->outlen;
     }
 
-  // remove if collect_p
-  while (cf != cl)
-    if (cf->collect_p)
-      {
-        if (cf->direction == USOCK_DIR_IN)
-          assert (cf->inbufs
-                  == NULL); // not the `inbuf`; possible ongoing read
-        usock_client_dtor (cf);
-        break;
-      }
-    else
-      {
-        ++cf;
-        ++pf;
-      }
-  if (cf != cl)
-    for (c = cf, p = pf; ++p, ++c != cl;)
+  pthread_mutex_lock (&u->mutex);
+  for (int chan = 0; chan < USOCK_CHANS_MAX; ++chan)
+    if (outlen[chan] > USOCK_OUT_HIWAT)
+      u->stalled_p[chan] = 1;
+    else if (u->stalled_p[chan] && outlen[chan] < USOCK_OUT_LOWAT)
       {
-        if (!c->collect_p)
-          {
-            *cf = *c;
-            *pf = *p;
-            cf->pollfd = pf;
-            ++cf;
-            ++pf;
-          }
-        else
-          {
-            if (c->direction == USOCK_DIR_IN)
-              assert (c->inbufs
-                      == NULL); // not the `inbuf`; possible ongoing read
-            usock_client_dtor (c);
-          }
+        u->stalled_p[chan] = 0;
+        resume_p = 1;
       }
-
-  u->nclients = cf - u->clients;
-
-  // sanity check
-  for (int i = 0; i < (int)u->nclients; ++i)
-    {
-      assert (u->clients[i].pollfd == pfds + i);
-      assert (u->clients[i].pollfd->fd == u->clients[i].fd
-              || u->clients[i].pollfd->fd == -u->clients[i].fd);
-    }
-}
-
-static void
-usock_clients_collect_stupid (struct usock *u)
-{
-  for (int i = 0; i < (int)u->nclients; ++i)
-    if (u->clients[i].collect_p && u->clients[i].pollfd->fd > 0)
-      u->clients[i].pollfd->fd *= -1;
+  pthread_mutex_unlock (&u->mutex);
+  if (resume_p)
+    pthread_cond_broadcast (&u->outcond);
 }
 
 // NOTE This has to run on a separate thread
@@ -596,29 +828,29 @@ usock_clients_collect_stupid (struct usock *u)
 int
 usock_serve (struct usock *u)
 {
-  struct pollfd polls[/*server*/ 1 + /*pipefd[0]*/ 1 + USOCK_CLIENTS_MAX];
-  int npoll;
+  struct usock_event evs[USOCK_EVENTS_MAX];
+  int nev;
   int done_p = 0;
   int ret = USOCK_SERVE_OK;
   int i;
 
-#define SRV 0
-#define NOTIF 1
-
-  memset (polls, 0, sizeof (polls));
-  polls[SRV].fd = u->fd;
-  polls[SRV].events = POLLIN;
-  polls[NOTIF].fd = u->pipefd[0];
-  polls[NOTIF].events = POLLIN;
+  if (usock_poller_init (u) == -1)
+    {
+      usock_errorf (u, errno, "failed to initialize the poller");
+      return USOCK_SERVE_NOK;
+    }
 
   while (1)
     {
-      npoll = poll (polls, 1 + 1 + u->nclients, -1);
-      if (npoll == -1)
+      struct usock_buf *inbufs = NULL;
+      int srv_p = 0, notif_p = 0;
+
+      nev = usock_poller_wait (u, evs, USOCK_EVENTS_MAX);
+      if (nev == -1)
         {
           if (errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK)
             continue;
-          usock_errorf (u, errno, "poll() failed");
+          usock_errorf (u, errno, "waiting for events failed");
           ret = USOCK_SERVE_NOK;
           break;
         }
@@ -631,64 +863,70 @@ usock_serve (struct usock *u)
       if (done_p)
         break;
 
-      if (polls[SRV].revents
-          && usock_handle_srv (u, polls + 2) != USOCK_HANDLE_SRV_OK)
+      // The clients are handled before accepting new ones, so the
+      // events always refer to the current occupant of the slot.
+      for (i = 0; i < nev; ++i)
+        {
+          struct usock_client *c;
+
+          if (evs[i].id == USOCK_EV_ID_SRV)
+            {
+              srv_p = 1;
+              continue;
+            }
+          if (evs[i].id == USOCK_EV_ID_NOTIF)
+            {
+              notif_p = 1;
+              continue;
+            }
+
+          c = &u->clients[evs[i].id - 2];
+          if (c->fd == -1)
+            continue;
+          if ((evs[i].flags & USOCK_EV_HUP) && c->direction == USOCK_DIR_OUT)
+            c->collect_p = 1;
+          else
+            while (usock_client_step (u, c))
+              ;
+          usock_client_collect (u, c, &inbufs);
+        }
+
+      if (srv_p && usock_handle_srv (u, &inbufs) != USOCK_HANDLE_SRV_OK)
         {
+          usock_buf_free_chain (inbufs);
           ret = USOCK_SERVE_NOK;
           break;
         }
-      if (polls[NOTIF].revents
-          && usock_handle_notif (u, polls + 2) != USOCK_HANDLE_NOTIF_OK)
+      if (notif_p && usock_handle_notif (u) != USOCK_HANDLE_NOTIF_OK)
         {
+          usock_buf_free_chain (inbufs);
           ret = USOCK_SERVE_NOK;
           break;
         }
-      for (i = 0; i < (int)u->nclients; ++i)
-        {
-          struct usock_client *c = &u->clients[i];
 
-          assert (&polls[2 + i] == c->pollfd);
-          if (polls[2 + i].revents)
-            while (usock_client_step (c))
-              ;
+      // report input messages
+      if (inbufs)
+        {
+          pthread_mutex_lock (&u->mutex);
+          u->inbufs = usock_buf_chain (u->inbufs, inbufs); // FIXME O(n)
+          pthread_mutex_unlock (&u->mutex);
+          pthread_cond_signal (&u->cond);
         }
 
-      // collect input messages and report
-      {
-        struct usock_buf *inbufs = NULL;
-
-        for (i = 0; i < (int)u->nclients; ++i)
-          if (u->clients[i].direction == USOCK_DIR_IN && u->clients[i].inbufs)
-            {
-              inbufs = usock_buf_chain (inbufs, u->clients[i].inbufs);
-              u->clients[i].inbufs = NULL;
-            }
-        if (inbufs)
-          {
-            pthread_mutex_lock (&u->mutex);
-            u->inbufs = usock_buf_chain (u->inbufs, inbufs); // FIXME O(n)
-            pthread_mutex_unlock (&u->mutex);
-            pthread_cond_signal (&u->cond);
-            inbufs = NULL;
-          }
-      }
-
-#if 1
-      usock_clients_collect (u, polls + 2);
-      (void)usock_clients_collect_stupid;
-#else
-      (void)usock_clients_collect;
-      usock_clients_collect_stupid (u);
-#endif
+      usock_update_stalls (u);
     } // while (1)
 
-#undef NOTIF
-#undef SRV
-
-  // Close all clients (because of `polls`)
-  for (i = 0; i < (int)u->nclients; ++i)
+  // Close all clients
+  for (i = 0; i < (int)u->nslots; ++i)
     usock_client_dtor (&u->clients[i]);
-  u->nclients = 0;
+  u->nclients = u->nslots = 0;
+  usock_poller_fini (u);
+
+  // Nobody will consume the output anymore.
+  pthread_mutex_lock (&u->mutex);
+  memset (u->stalled_p, 0, sizeof (u->stalled_p));
+  pthread_mutex_unlock (&u->mutex);
+  pthread_cond_broadcast (&u->outcond);
 
   return ret;
 }
@@ -714,10 +952,16 @@ usock_new (const char *path)
   if (u == NULL)
     return NULL;
 
+#if HAVE_SYS_EPOLL_H
+  u->epfd = -1;
+#endif
+
   if (pthread_mutex_init (&u->mutex, NULL) != 0)
     goto error;
   if (pthread_cond_init (&u->cond, NULL) != 0)
     goto error;
+  if (pthread_cond_init (&u->outcond, NULL) != 0)
+    goto error;
 
   u->pipefd[0] = -1;
   u->pipefd[1] = -1;
@@ -756,6 +1000,7 @@ usock_new (const char *path)
 error:
   pthread_mutex_destroy (&u->mutex);
   pthread_cond_destroy (&u->cond);
+  pthread_cond_destroy (&u->outcond);
   if (u->fd != -1)
     close (u->fd);
   if (u->pipefd[0] != -1)
@@ -774,11 +1019,14 @@ usock_free (struct usock *u)
     return;
   pthread_mutex_destroy (&u->mutex);
   pthread_cond_destroy (&u->cond);
+  pthread_cond_destroy (&u->outcond);
   close (u->fd);
   for (int i = 0; i < USOCK_CLIENTS_MAX; ++i)
     usock_client_dtor (&u->clients[i]);
+  usock_poller_fini (u);
   usock_buf_free_chain (u->inbufs);
-  usock_buf_free_chain (u->outbufs);
+  for (int i = 0; i < USOCK_CHANS_MAX; ++i)
+    usock_buf_free (u->outstage[i]);
   memset (u, 0, sizeof (*u));
   free (u);
 }
@@ -805,34 +1053,85 @@ usock_done (struct usock *u)
   pthread_mutex_lock (&u->mutex);
   u->done_p = 1;
   pthread_mutex_unlock (&u->mutex);
+  pthread_cond_broadcast (&u->outcond);
   usock_notify (u);
 }
 
+// Frame a message with the data of the IOVCNT buffers described by IOV,
+// of total length LEN, in the buffer of the channel CHAN.
+static void
+usock_out_1 (struct usock *u, uint8_t chan, uint32_t kind,
+             const struct iovec *iov, int iovcnt, size_t len)
+{
+  assert (u);
+  assert (chan < 0x80);
+  assert (kind <= 0x7f); // TODO implement ULEB128
+  assert (0 < (kind != 0) + len && (kind != 0) + len <= 0xffff);
+
+  uint16_t len16 = (kind != 0) + len;
+  uint8_t prefix[/*len*/ 2 + /*kind*/ 5] = { len16, len16 >> 8, kind & 0x7f };
+  struct usock_buf *stage;
+  int notify_p;
+
+  pthread_mutex_lock (&u->mutex);
+
+  // Backpressure: wait for the slow clients of the channel.
+  while (u->stalled_p[chan] && !u->done_p)
+    pthread_cond_wait (&u->outcond, &u->mutex);
+
+  // The message is framed in the buffer of the channel; the
+  // server thread sends everything accumulated there at once.
+  stage = u->outstage[chan];
+  if (stage == NULL)
+    {
+      stage = usock_buf_new_size (USOCK_OUT_STAGE_SIZE);
+      assert (stage);
+      stage->tag = chan;
+      u->outstage[chan] = stage;
+    }
+  if (usock_buf_append (stage, prefix, 2 + (kind != 0)) != 0)
+    assert (0 && "out of memory");
+  for (int i = 0; i < iovcnt; ++i)
+    if (iov[i].iov_len
+        && usock_buf_append (stage, iov[i].iov_base, iov[i].iov_len) != 0)
+      assert (0 && "out of memory");
+
+  notify_p = !u->notified_p;
+  u->notified_p = 1;
+  pthread_mutex_unlock (&u->mutex);
+
+  if (notify_p)
+    usock_notify (u);
+}
+
 // API
 void
 usock_out (struct usock *u, uint8_t chan, uint32_t kind, const void *data,
            size_t len)
 {
-  assert (u);
-  assert (chan < 0x80);
   assert (data);
   assert (0 < len && len <= 0xffff);
 
-  assert (kind <= 0x7f); // TODO implement ULEB128
+  // The data is always sent with a terminating null byte.
+  int nullterm_p = ((const char *)data)[len - 1] == '\0';
+  struct iovec iov[2] = {
+    { .iov_base = (void *)data, .iov_len = len - nullterm_p },
+    { .iov_base = "", .iov_len = 1 },
+  };
 
-  uint16_t len16
-      = (kind != 0) + (len & 0xffff) + (((char *)data)[len - 1] != '\0');
-  uint8_t prefix[/*len*/ 2 + /*kind*/ 5] = { len16, len16 >> 8, kind & 0x7f };
-  struct usock_buf *buf
-      = usock_buf_new_prefix (prefix, 2 + (kind != 0), data, len & 0xffff);
+  usock_out_1 (u, chan, kind, iov, 2, len - nullterm_p + 1);
+}
 
-  buf->len = 0; // cursor for how much data has been written
-  buf->tag = chan;
+// API
+void
+usock_outv (struct usock *u, uint8_t chan, uint32_t kind,
+            const struct iovec *iov, int iovcnt)
+{
+  size_t len = 0;
 
-  pthread_mutex_lock (&u->mutex);
-  u->outbufs = usock_buf_chain (buf, u->outbufs);
-  pthread_mutex_unlock (&u->mutex);
-  usock_notify (u);
+  for (int i = 0; i < iovcnt; ++i)
+    len += iov[i].iov_len;
+  usock_out_1 (u, chan, kind, iov, iovcnt, len);
 }
 
 // API
@@ -21,6 +21,8 @@
 
 #include <config.h>
 
+#include <sys/uio.h>
+
 #include "usock-buf.h"
 
 // Pre-defined channels
@@ -33,6 +35,8 @@
 #define USOCK_CHAN_OUT_TREEVU 0x04
 #define USOCK_CHAN_OUT_AUTOCMPL 0x05
 #define USOCK_CHAN_OUT_CDISAS 0x06 /* CPU disasm.  */
+#define USOCK_CHAN_OUT_VAL 0x07    /* Binary values.  */
+#define USOCK_CHAN_OUT_STATS 0x08  /* Latency statistics.  */
 
 struct usock;
 
@@ -73,6 +77,13 @@ struct usock_buf *usock_in (struct usock *u);
 void usock_out (struct usock *u, uint8_t chan, uint32_t kind, const void *data,
                 size_t len);
 
+// Like `usock_out' but the data is gathered from the IOVCNT buffers
+// described by IOV, and is sent as is, without a terminating null byte.
+// The total length of the data shall be greater than zero.
+// This call is non-blocking.
+void usock_outv (struct usock *u, uint8_t chan, uint32_t kind,
+                 const struct iovec *iov, int iovcnt);
+
 // Like `usock_out' but with a printf-like interface.
 // On success return the number of characters sent (excluding the null byte).
 // On failure return -1.
@@ -20,6 +20,7 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stddef.h>
 #include <string.h>
 #include "libpoke.h"
 
@@ -180,6 +181,18 @@ test_pk_ios (pk_compiler pkc)
   T ("pk_ios_handler_7", STREQ (pk_ios_handler (ios[2]), "*funfoo*"));
   T ("pk_ios_handler_8", STREQ (pk_ios_handler (ios[3]), "*baz*"));
 
+  {
+    unsigned char buf[4] = { 1, 1, 1, 1 };
+    uint64_t size = pk_ios_size (ios[0]);
+
+    T ("pk_ios_read_1", pk_ios_read (ios[0], 0, buf, sizeof (buf)) == PK_OK);
+    T ("pk_ios_read_2", buf[0] == 0 && buf[3] == 0);
+    T ("pk_ios_read_3", pk_ios_read (ios[0], size - 1, buf, 2) == PK_EEOF);
+    T ("pk_ios_read_ptr_1", pk_ios_read_ptr (ios[0], 0, sizeof (buf)) != NULL);
+    T ("pk_ios_read_ptr_2", pk_ios_read_ptr (ios[0], size, 1) == NULL);
+    T ("pk_ios_write_count_1", pk_ios_write_count (ios[0]) == 0);
+  }
+
   T ("pk_ios_search_1",
      pk_ios_search (pkc, "/some/non-existent/thing", PK_IOS_SEARCH_F_PARTIAL)
          == NULL);
@@ -226,6 +239,765 @@ test_pk_ios (pk_compiler pkc)
 #undef N
 }
 
+static void
+test_pk_compiler_clone (pk_compiler pkc)
+{
+  pk_compiler clone;
+  pk_val val, exception;
+
+  T ("pk_compiler_clone_1",
+     pk_compile_buffer (pkc, "var clone_x = 1;"
+                        "fun clone_getx = int<32>: { return clone_x; }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+
+  clone = pk_compiler_clone (pkc);
+  T ("pk_compiler_clone_2", clone != NULL);
+  T ("pk_compiler_clone_3", pk_decl_p (clone, "clone_x", PK_DECL_KIND_VAR));
+
+  /* Assigning to a global variable in the clone doesn't affect the
+     original compiler, also when the assignment is performed by a
+     function compiled before cloning.  */
+  T ("pk_compiler_clone_4",
+     pk_compile_buffer (clone, "clone_x = 2;", NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  T ("pk_compiler_clone_5",
+     pk_int_value (pk_decl_val (pkc, "clone_x")) == 1);
+  T ("pk_compiler_clone_6",
+     pk_compile_expression (clone, "clone_getx", NULL, &val,
+                            &exception) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (val) == 2);
+  T ("pk_compiler_clone_7",
+     pk_compile_expression (pkc, "clone_getx", NULL, &val,
+                            &exception) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (val) == 1);
+
+  /* New declarations and re-definitions are not visible in the
+     original compiler.  */
+  T ("pk_compiler_clone_8",
+     pk_compile_buffer (clone, "var clone_y = 3; var clone_x = 4;",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  T ("pk_compiler_clone_9", !pk_decl_p (pkc, "clone_y", PK_DECL_KIND_VAR));
+  T ("pk_compiler_clone_10",
+     pk_decl_p (pkc, "clone_x", PK_DECL_KIND_VAR)
+     && pk_int_value (pk_decl_val (pkc, "clone_x")) == 1);
+  T ("pk_compiler_clone_11",
+     pk_int_value (pk_decl_val (clone, "clone_x")) == 4);
+
+  pk_compiler_free (clone);
+
+  /* The original compiler is still usable.  */
+  T ("pk_compiler_clone_12",
+     pk_compile_expression (pkc, "clone_getx", NULL, &val,
+                            &exception) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (val) == 1);
+}
+
+#define PHASE_GEN    0x1
+#define PHASE_PARSE  0x2
+#define PHASE_ASM    0x4
+#define PHASE_JITTER 0x8
+
+static void
+phase_time_cb (const char *phase, uint64_t nsec, uint64_t ncalls,
+               void *data)
+{
+  int *found = data;
+
+  if (ncalls == 0)
+    return;
+
+  if (STREQ (phase, "gen"))
+    *found |= PHASE_GEN;
+  else if (STREQ (phase, "parse"))
+    *found |= PHASE_PARSE;
+  else if (STREQ (phase, "asm"))
+    *found |= PHASE_ASM;
+  else if (STREQ (phase, "jitter"))
+    *found |= PHASE_JITTER;
+}
+
+static void
+decl_time_cb (const char *name, const char *source, uint64_t nsec,
+              uint64_t nnodes, void *data)
+{
+  int *found_decl = data;
+
+  if (STREQ (name, "timing_x") && nnodes > 1)
+    *found_decl = 1;
+}
+
+static void
+test_pk_phase_times (pk_compiler pkc)
+{
+  pk_val exception;
+  int found = 0;
+  int found_decl = 0;
+
+  T ("pk_set_timing_p_1", pk_set_timing_p (pkc, 1) == PK_OK);
+  T ("pk_phase_times_1",
+     pk_compile_buffer (pkc, "var timing_x = 1 + 2;", NULL,
+                        &exception) == PK_OK
+     && exception == PK_NULL);
+  pk_phase_times (pkc, phase_time_cb, &found);
+  T ("pk_phase_times_2", found & PHASE_GEN);
+  T ("pk_phase_times_3",
+     (found & (PHASE_PARSE | PHASE_ASM | PHASE_JITTER))
+     == (PHASE_PARSE | PHASE_ASM | PHASE_JITTER));
+  pk_decl_times (pkc, decl_time_cb, &found_decl);
+  T ("pk_decl_times_1", found_decl);
+
+  pk_reset_phase_times (pkc);
+  found = 0;
+  found_decl = 0;
+  pk_phase_times (pkc, phase_time_cb, &found);
+  T ("pk_reset_phase_times_1", !found);
+  pk_decl_times (pkc, decl_time_cb, &found_decl);
+  T ("pk_reset_phase_times_2", !found_decl);
+
+  T ("pk_set_timing_p_2", pk_set_timing_p (pkc, 0) == PK_OK);
+
+  T ("pk_compile_stats_p_1", !pk_compile_stats_p (pkc));
+  T ("pk_set_compile_stats_p_1",
+     pk_set_compile_stats_p (pkc, 1) == PK_OK
+     && pk_compile_stats_p (pkc));
+  T ("pk_set_compile_stats_p_2",
+     pk_set_compile_stats_p (pkc, 0) == PK_OK
+     && !pk_compile_stats_p (pkc));
+}
+
+static void
+test_pk_gc (pk_compiler pkc)
+{
+  struct pk_gc_stats stats1, stats2;
+  unsigned int divisor;
+  pk_val exception;
+
+  pk_gc_stats (pkc, &stats1);
+  T ("pk_gc_stats_1", stats1.heap_size > 0 && stats1.total_bytes > 0);
+
+  T ("pk_gc_stats_2",
+     pk_compile_buffer (pkc, "var gc_x = [1,2,3] + [4,5,6];", NULL,
+                        &exception) == PK_OK
+     && exception == PK_NULL);
+  pk_gc_collect (pkc);
+  pk_gc_stats (pkc, &stats2);
+  T ("pk_gc_collect_1", stats2.collections > stats1.collections);
+  T ("pk_gc_stats_3", stats2.total_bytes > stats1.total_bytes);
+  T ("pk_gc_stats_4", stats2.max_pause_ns <= stats2.pause_ns);
+
+  divisor = pk_gc_free_space_divisor (pkc);
+  T ("pk_gc_set_free_space_divisor_1",
+     pk_gc_set_free_space_divisor (pkc, 0) == PK_ERROR);
+  T ("pk_gc_set_free_space_divisor_2",
+     pk_gc_set_free_space_divisor (pkc, divisor + 1) == PK_OK
+     && pk_gc_free_space_divisor (pkc) == divisor + 1);
+  pk_gc_set_free_space_divisor (pkc, divisor);
+
+  pk_gc_set_full_freq (pkc, 9);
+  T ("pk_gc_set_full_freq_1", pk_gc_full_freq (pkc) == 9);
+
+  T ("pk_gc_incremental_p_1", !pk_gc_incremental_p (pkc));
+  T ("pk_gc_set_incremental_1", pk_gc_set_incremental (pkc, 0) == PK_OK);
+}
+
+struct profile_counts
+{
+  uint64_t nsamples;
+  uint64_t nspin;
+  uint64_t nleaf;
+};
+
+static void
+profile_cb (const char *stack, uint64_t nsamples, void *data)
+{
+  struct profile_counts *counts = data;
+
+  counts->nsamples += nsamples;
+  if (strstr (stack, "prof_spin"))
+    counts->nspin += nsamples;
+  if (strstr (stack, "prof_spin;prof_leaf"))
+    counts->nleaf += nsamples;
+}
+
+static void
+test_pk_profile (pk_compiler pkc)
+{
+  struct profile_counts counts, counts2;
+  pk_val exception, ret;
+  int i;
+
+  T ("pk_profile_1",
+     pk_compile_buffer (pkc,
+                        "fun prof_leaf = (int i) int: { return i * 3; }"
+                        "fun prof_spin = (int n) int:"
+                        "{ var s = 0; for (var i = 0; i < n; i++)"
+                        "    s += prof_leaf (i) % 7;"
+                        "  return s; }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+
+  T ("pk_profile_start_1", pk_profile_start (pkc, 100) == PK_OK);
+
+  /* Run until the function called by prof_spin gets sampled, which
+     shall take a few milliseconds of CPU time.  */
+  memset (&counts, 0, sizeof (counts));
+  for (i = 0; i < 500 && counts.nleaf == 0; ++i)
+    {
+      if (pk_call (pkc, pk_decl_val (pkc, "prof_spin"), &ret, &exception,
+                   1, pk_make_int (pkc, 10000, 32)) != PK_OK
+          || exception != PK_NULL)
+        break;
+      memset (&counts, 0, sizeof (counts));
+      pk_profile_get (pkc, profile_cb, &counts);
+    }
+  pk_profile_stop (pkc);
+
+  T ("pk_profile_get_1", counts.nleaf > 0);
+  T ("pk_profile_get_2",
+     counts.nspin >= counts.nleaf && counts.nsamples >= counts.nspin);
+
+  /* The samples are kept after stopping the profiler, but no more are
+     taken.  */
+  pk_call (pkc, pk_decl_val (pkc, "prof_spin"), &ret, &exception,
+           1, pk_make_int (pkc, 100000, 32));
+  memset (&counts2, 0, sizeof (counts2));
+  pk_profile_get (pkc, profile_cb, &counts2);
+  T ("pk_profile_stop_1",
+     counts2.nsamples == counts.nsamples && counts2.nleaf == counts.nleaf);
+
+  pk_reset_profile (pkc);
+  memset (&counts2, 0, sizeof (counts2));
+  pk_profile_get (pkc, profile_cb, &counts2);
+  T ("pk_reset_profile_1", counts2.nsamples == 0);
+}
+
+struct event_counts
+{
+  int nevents[PK_EVENT_PROGRESS + 1];
+  uint64_t foo_size;
+};
+
+static void
+event_cb (const struct pk_event *event, void *data)
+{
+  struct event_counts *counts = data;
+
+  counts->nevents[event->kind]++;
+  if (event->kind == PK_EVENT_MAP_END
+      && event->type_name && STREQ (event->type_name, "Ev_Foo"))
+    counts->foo_size = event->size;
+}
+
+static void
+test_pk_events (pk_compiler pkc)
+{
+  struct event_counts counts;
+  pk_val exception;
+  int nevents;
+
+  memset (&counts, 0, sizeof (counts));
+  pk_set_event_fn (pkc, event_cb, &counts);
+  T ("pk_set_event_fn_1",
+     pk_compile_buffer (pkc,
+                        "type Ev_Foo = struct { uint<8> a; uint<8> b : b == 2; };"
+                        "var ev_ios = open (\"*events*\");"
+                        "uint<8>[2] @ ev_ios : 0#B = [1UB, 2UB];"
+                        "var ev_foo = Ev_Foo @ ev_ios : 0#B;"
+                        "ev_foo.a = 3;"
+                        "try Ev_Foo @ ev_ios : 1#B; catch if E_constraint {}"
+                        "close (ev_ios);",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  T ("pk_event_map_begin_1", counts.nevents[PK_EVENT_MAP_BEGIN] >= 2);
+  T ("pk_event_map_end_1", counts.nevents[PK_EVENT_MAP_END] >= 1);
+  T ("pk_event_map_end_2", counts.foo_size == 16);
+  T ("pk_event_write_1", counts.nevents[PK_EVENT_WRITE] >= 1);
+  T ("pk_event_constraint_1", counts.nevents[PK_EVENT_CONSTRAINT] == 1);
+
+  pk_set_event_fn (pkc, NULL, NULL);
+  nevents = counts.nevents[PK_EVENT_MAP_BEGIN];
+  T ("pk_set_event_fn_2",
+     pk_compile_buffer (pkc, "type Ev_Bar = struct { uint<8> a; };"
+                        "var ev_ios2 = open (\"*events2*\");"
+                        "Ev_Bar @ ev_ios2 : 0#B; close (ev_ios2);",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL
+     && counts.nevents[PK_EVENT_MAP_BEGIN] == nevents);
+}
+
+static int
+timeout_p (pk_val exception)
+{
+  return (exception != PK_NULL
+          && (pk_int_value (pk_struct_ref_field_value (exception, "code"))
+              == PK_EC_TIMEOUT));
+}
+
+static void
+test_pk_budget (pk_compiler pkc)
+{
+  pk_val exception, ret;
+
+  pk_set_budget (pkc, 1000, 0);
+  T ("pk_set_budget_1",
+     pk_budget_steps (pkc) == 1000 && pk_budget_msec (pkc) == 0);
+  T ("pk_budget_loop_1",
+     pk_compile_buffer (pkc, "while (1) {}", NULL, &exception) == PK_OK
+     && timeout_p (exception));
+  T ("pk_budget_handled_1",
+     pk_compile_buffer (pkc,
+                        "var budget_caught = 0;"
+                        "try { while (1) {} }"
+                        "catch if E_timeout { budget_caught = 1; }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (pk_decl_val (pkc, "budget_caught")) == 1);
+
+  /* Every call gets its own budget.  */
+  T ("pk_budget_call_1",
+     pk_compile_buffer (pkc,
+                        "fun budget_sum = (int n) int:"
+                        "{ var s = 0; for (var i = 0; i < n; i++) s += i;"
+                        "  return s; }"
+                        "fun budget_rec = (int n) int:"
+                        "{ return budget_rec (n + 1); }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  for (int i = 0; i < 2; ++i)
+    T ("pk_budget_call_2",
+       pk_call (pkc, pk_decl_val (pkc, "budget_sum"), &ret, &exception,
+                1, pk_make_int (pkc, 500, 32)) == PK_OK
+       && exception == PK_NULL
+       && pk_int_value (ret) == 124750);
+  T ("pk_budget_call_3",
+     pk_call (pkc, pk_decl_val (pkc, "budget_sum"), &ret, &exception,
+              1, pk_make_int (pkc, 5000, 32)) == PK_ERROR
+     && timeout_p (exception));
+  T ("pk_budget_recursion_1",
+     pk_call (pkc, pk_decl_val (pkc, "budget_rec"), &ret, &exception,
+              1, pk_make_int (pkc, 0, 32)) == PK_ERROR
+     && timeout_p (exception));
+
+  pk_set_budget (pkc, 0, 50);
+  T ("pk_set_budget_2",
+     pk_budget_steps (pkc) == 0 && pk_budget_msec (pkc) == 50);
+  T ("pk_budget_time_1",
+     pk_compile_buffer (pkc, "while (1) {}", NULL, &exception) == PK_OK
+     && timeout_p (exception));
+
+  pk_set_budget (pkc, 0, 0);
+  T ("pk_budget_call_4",
+     pk_call (pkc, pk_decl_val (pkc, "budget_sum"), &ret, &exception,
+              1, pk_make_int (pkc, 5000, 32)) == PK_OK
+     && exception == PK_NULL);
+}
+
+static void
+test_pk_stack_limit (pk_compiler pkc)
+{
+  pk_val exception, ret;
+  uint64_t capacity = pk_stack_limit (pkc);
+
+  T ("pk_stack_limit_1", capacity > 3000);
+  T ("pk_stack_limit_2",
+     pk_compile_buffer (pkc,
+                        "fun stack_rec = (int n) int:"
+                        "{ return n == 0 ? 0 : 1 + stack_rec (n - 1); }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+
+  pk_set_stack_limit (pkc, 3000);
+  T ("pk_set_stack_limit_1", pk_stack_limit (pkc) == 3000);
+  T ("pk_stack_limit_call_1",
+     pk_call (pkc, pk_decl_val (pkc, "stack_rec"), &ret, &exception,
+              1, pk_make_int (pkc, 100, 32)) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (ret) == 100);
+  T ("pk_stack_limit_call_2",
+     pk_call (pkc, pk_decl_val (pkc, "stack_rec"), &ret, &exception,
+              1, pk_make_int (pkc, 10000, 32)) == PK_ERROR
+     && exception != PK_NULL
+     && (pk_int_value (pk_struct_ref_field_value (exception, "code"))
+         == PK_EC_STACK));
+  T ("pk_stack_limit_handled_1",
+     pk_compile_buffer (pkc,
+                        "var stack_caught = 0;"
+                        "try stack_rec (10000);"
+                        "catch if E_stack { stack_caught = 1; }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (pk_decl_val (pkc, "stack_caught")) == 1);
+
+  pk_set_stack_limit (pkc, capacity + 1);
+  T ("pk_set_stack_limit_2", pk_stack_limit (pkc) == capacity);
+  pk_set_stack_limit (pkc, 0);
+  T ("pk_set_stack_limit_3", pk_stack_limit (pkc) == capacity);
+  T ("pk_stack_limit_call_3",
+     pk_call (pkc, pk_decl_val (pkc, "stack_rec"), &ret, &exception,
+              1, pk_make_int (pkc, 10000, 32)) == PK_OK
+     && exception == PK_NULL
+     && pk_int_value (ret) == 10000);
+}
+
+struct progress_state
+{
+  pk_compiler pkc;
+  int nmap;
+  int ncopy;
+  int cancel_p;
+  uint64_t done;
+  uint64_t total;
+};
+
+static void
+progress_cb (const struct pk_event *event, void *data)
+{
+  struct progress_state *state = data;
+
+  if (event->kind != PK_EVENT_PROGRESS)
+    return;
+
+  if (STREQ (event->type_name, "map"))
+    state->nmap++;
+  else if (STREQ (event->type_name, "copy"))
+    state->ncopy++;
+  state->done = event->offset;
+  state->total = event->size;
+  if (state->cancel_p)
+    pk_cancel (state->pkc);
+}
+
+static int
+cancel_p (pk_val exception)
+{
+  return (exception != PK_NULL
+          && (pk_int_value (pk_struct_ref_field_value (exception, "code"))
+              == PK_EC_CANCEL));
+}
+
+static void
+test_pk_cancel (pk_compiler pkc)
+{
+  struct progress_state state;
+  pk_val exception;
+
+  memset (&state, 0, sizeof (state));
+  state.pkc = pkc;
+  pk_set_event_fn (pkc, progress_cb, &state);
+
+  T ("pk_progress_map_1",
+     pk_compile_buffer (pkc,
+                        "type Pg_Foo = struct { uint<8> a; };"
+                        "var pg_ios = open (\"*progress*\");"
+                        "var pg_ios2 = open (\"*progress2*\");"
+                        "Pg_Foo[4096] @ pg_ios : 0#B;",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  T ("pk_progress_map_2",
+     state.nmap == 4096 / 1024
+     && state.done == 4096 * 8 && state.total == 4096 * 8);
+
+  T ("pk_progress_copy_1",
+     pk_compile_buffer (pkc,
+                        "iocopy (pg_ios, 0#B, pg_ios2, 0#B, 16#B);",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL
+     && state.ncopy == 1 && state.done == 128 && state.total == 128);
+
+  /* Cancel the mapping when it reports progress.  */
+  state.cancel_p = 1;
+  T ("pk_cancel_map_1",
+     pk_compile_buffer (pkc, "Pg_Foo[4096] @ pg_ios : 0#B;",
+                        NULL, &exception) == PK_OK
+     && cancel_p (exception));
+  T ("pk_cancel_handled_1",
+     pk_compile_buffer (pkc,
+                        "var pg_caught = 0;"
+                        "try Pg_Foo[4096] @ pg_ios : 0#B;"
+                        "catch if E_cancel { pg_caught = 1; }",
+                        NULL, &exception) == PK_OK
+     && pk_int_value (pk_decl_val (pkc, "pg_caught")) == 1);
+  state.cancel_p = 0;
+
+  /* Cancellation requests don't outlive the code being run.  */
+  T ("pk_cancel_loop_1",
+     pk_compile_buffer (pkc,
+                        "for (var i = 0; i < 10; i++) {}"
+                        "close (pg_ios); close (pg_ios2);",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  pk_cancel (pkc);
+  T ("pk_cancel_idle_1",
+     pk_compile_buffer (pkc, "for (var i = 0; i < 10; i++) {}",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+
+  pk_set_event_fn (pkc, NULL, NULL);
+}
+
+struct ex_sym
+{
+  uint32_t name;
+  uint8_t bind;
+  uint8_t type;
+  uint64_t size_bits;
+  uint16_t size;
+  uint8_t other;
+  const char *str;
+};
+
+static const struct pk_layout_field ex_sym_fields[] =
+  {
+    { "st_name", PK_LAYOUT_INTEGRAL, offsetof (struct ex_sym, name), 4 },
+    { "st_info.st_bind", PK_LAYOUT_INTEGRAL,
+      offsetof (struct ex_sym, bind), 1 },
+    { "st_info.st_type", PK_LAYOUT_INTEGRAL,
+      offsetof (struct ex_sym, type), 1 },
+    { "st_size", PK_LAYOUT_BITS, offsetof (struct ex_sym, size_bits), 8 },
+    { "st_size", PK_LAYOUT_INTEGRAL, offsetof (struct ex_sym, size), 2 },
+    { "st_other", PK_LAYOUT_INTEGRAL, offsetof (struct ex_sym, other), 1 },
+  };
+
+static int
+check_ex_sym (const struct ex_sym *sym, int k)
+{
+  uint32_t b = (uint32_t) k * 7;
+
+  return (sym->name == ((b << 24) | ((b + 1) << 16)
+                        | ((b + 2) << 8) | (b + 3))
+          && sym->bind == (b + 4) >> 4
+          && sym->type == ((b + 4) & 0xf)
+          && sym->size == (((b + 5) << 8) | (b + 6))
+          && sym->size_bits == sym->size * 8
+          && sym->other == 0);
+}
+
+static void
+test_pk_extract (pk_compiler pkc)
+{
+  struct pk_layout_field bad_field = { "st_name", PK_LAYOUT_INTEGRAL, 0, 3 };
+  struct pk_layout_field str_field
+    = { "s", PK_LAYOUT_STRING, offsetof (struct ex_sym, str),
+        sizeof (const char *) };
+  struct pk_layout_field missing_field
+    = { "st_nope", PK_LAYOUT_INTEGRAL, 0, 4 };
+  struct ex_sym syms[10];
+  pk_layout layout;
+  pk_val exception;
+  uint64_t n;
+  int ok;
+
+  T ("pk_layout_new_1",
+     pk_layout_new (pkc, &bad_field, 1, sizeof (struct ex_sym)) == NULL
+     && pk_errno (pkc) == PK_EINVAL);
+
+  layout = pk_layout_new (pkc, ex_sym_fields,
+                          sizeof (ex_sym_fields) / sizeof (ex_sym_fields[0]),
+                          sizeof (struct ex_sym));
+  T ("pk_layout_new_2", layout != NULL);
+  if (layout == NULL)
+    return;
+
+  T ("pk_extract_1",
+     pk_compile_buffer (pkc,
+                        "type Ex_Sym = struct"
+                        "{"
+                        "  uint<32> st_name;"
+                        "  struct uint<8>"
+                        "  {"
+                        "    uint<4> st_bind;"
+                        "    uint<4> st_type;"
+                        "  } st_info;"
+                        "  offset<uint<16>,B> st_size;"
+                        "  uint<8> st_other if st_name == 0;"
+                        "};"
+                        "var ex_ios = open (\"*extract*\");"
+                        "for (var i = 0; i < 128; i++)"
+                        "  byte @ ex_ios : i#B = i;"
+                        "var ex_syms = Ex_Sym[16] @ ex_ios : 0#B;",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+
+  memset (syms, 0xff, sizeof (syms));
+  T ("pk_extract_struct_1",
+     pk_extract_struct (pkc, layout,
+                        pk_array_elem_value (pk_decl_val (pkc, "ex_syms"), 3),
+                        &syms[0]) == PK_OK
+     && check_ex_sym (&syms[0], 3));
+
+  /* The last elements requested don't exist.  */
+  memset (syms, 0xff, sizeof (syms));
+  ok = (pk_extract_array (pkc, layout, pk_decl_val (pkc, "ex_syms"),
+                          8, 10, syms, &n) == PK_OK
+        && n == 8);
+  for (int i = 0; ok && i < 8; ++i)
+    ok = check_ex_sym (&syms[i], 8 + i);
+  T ("pk_extract_array_1", ok && syms[8].name == 0xffffffff);
+
+  T ("pk_extract_array_2",
+     pk_extract_array (pkc, layout, pk_make_int (pkc, 1, 32),
+                       0, 1, syms, &n) == PK_EINVAL
+     && n == 0);
+  pk_layout_free (layout);
+
+  layout = pk_layout_new (pkc, &missing_field, 1, sizeof (struct ex_sym));
+  T ("pk_extract_struct_2",
+     layout != NULL
+     && pk_extract_array (pkc, layout, pk_decl_val (pkc, "ex_syms"),
+                          0, 4, syms, &n) == PK_EINVAL
+     && n == 0);
+  pk_layout_free (layout);
+
+  layout = pk_layout_new (pkc, &str_field, 1, sizeof (struct ex_sym));
+  T ("pk_extract_struct_3",
+     layout != NULL
+     && pk_compile_buffer (pkc,
+                           "var ex_str = struct { s = \"foo\" };"
+                           "close (ex_ios);",
+                           NULL, &exception) == PK_OK
+     && exception == PK_NULL
+     && pk_extract_struct (pkc, layout, pk_decl_val (pkc, "ex_str"),
+                           &syms[0]) == PK_OK
+     && STREQ (syms[0].str, "foo"));
+  pk_layout_free (layout);
+}
+
+struct mb_rec
+{
+  uint16_t a;
+  int16_t b;
+  uint8_t x;
+  int8_t y;
+  uint8_t d;
+  uint8_t e[2];
+};
+
+static int
+check_mb_rec (const struct mb_rec *rec, int k)
+{
+  uint8_t b = k * 8;
+  int8_t y = (b + 4) & 0x1f;
+
+  if (y & 0x10)
+    y -= 0x20;
+  return (rec->a == ((b << 8) | (b + 1))
+          && rec->b == (int16_t) (((b + 3) << 8) | (b + 2))
+          && rec->x == (uint8_t) (b + 4) >> 5
+          && rec->y == y
+          && rec->d == b + 5
+          && rec->e[0] == b + 6 && rec->e[1] == b + 7);
+}
+
+static void
+test_pk_map_to_buffer (pk_compiler pkc)
+{
+  struct mb_rec recs[8];
+  pk_val exception;
+  pk_ios ios;
+  int ok;
+
+  pk_set_endian (pkc, PK_ENDIAN_MSB);
+  T ("pk_map_to_buffer_1",
+     pk_compile_buffer (pkc,
+                        "type Mb_Rec = struct"
+                        "{"
+                        "  uint<16> a;"
+                        "  little int<16> b;"
+                        "  struct uint<8> { uint<3> x; int<5> y; } c;"
+                        "  offset<uint<8>,B> d;"
+                        "  uint<8>[2] e;"
+                        "};"
+                        "type Mb_Opt = struct"
+                        "{"
+                        "  uint<8> a;"
+                        "  uint<8> b if a > 2;"
+                        "};"
+                        "var mb_ios = open (\"*map-to-buffer*\");"
+                        "for (var i = 0; i < 64; i++)"
+                        "  byte @ mb_ios : i#B = i;",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+  ios = pk_ios_search (pkc, "*map-to-buffer*", PK_IOS_SEARCH_F_EXACT);
+
+  T ("pk_map_buffer_size_1",
+     pk_map_buffer_size (pkc, "Mb_Rec") == sizeof (struct mb_rec));
+  T ("pk_map_buffer_size_2",
+     pk_map_buffer_size (pkc, "Mb_Opt") == 0 && pk_errno (pkc) == PK_EINVAL);
+
+  ok = pk_map_to_buffer (pkc, "Mb_Rec", ios, 0, 8, recs) == PK_OK;
+  for (int i = 0; ok && i < 8; ++i)
+    ok = check_mb_rec (&recs[i], i);
+  T ("pk_map_to_buffer_2", ok);
+
+  T ("pk_map_to_buffer_3",
+     pk_map_to_buffer (pkc, "Mb_Rec", ios, 16 * 8, 1, recs) == PK_OK
+     && check_mb_rec (&recs[0], 2));
+  /* Memory IO spaces are 4096 bytes long.  */
+  T ("pk_map_to_buffer_4",
+     pk_map_to_buffer (pkc, "Mb_Rec", ios, 4092 * 8, 1, recs) == PK_EEOF);
+  T ("pk_map_to_buffer_5",
+     pk_map_to_buffer (pkc, "Mb_Opt", ios, 0, 1, recs) == PK_EINVAL
+     && pk_map_to_buffer (pkc, "mb_ios", ios, 0, 1, recs) == PK_EINVAL);
+
+  pk_ios_close (pkc, ios);
+}
+
+static void
+test_pk_prepare_call (pk_compiler pkc)
+{
+  pk_prepared_call call;
+  pk_val exception, ret, args[2];
+  int ok = 1;
+
+  T ("pk_prepare_call_1",
+     pk_compile_buffer (pkc,
+                        "fun pc_sub = (int a, int b) int: { return a - b; }"
+                        "var pc_count = 0;"
+                        "fun pc_inc = void: { pc_count++; }"
+                        "fun pc_raise = (int a) void: { raise E_inval; }",
+                        NULL, &exception) == PK_OK
+     && exception == PK_NULL);
+
+  call = pk_prepare_call (pkc, pk_decl_val (pkc, "pc_sub"), 2);
+  T ("pk_prepare_call_2", call != NULL && pk_errno (pkc) == PK_OK);
+  for (int i = 0; call && i < 1000; ++i)
+    {
+      args[0] = pk_make_int (pkc, i, 32);
+      args[1] = pk_make_int (pkc, 2 * i, 32);
+      ok = ok && (pk_call_prepared (call, args, &ret, &exception) == PK_OK
+                  && exception == PK_NULL
+                  && pk_int_value (ret) == -i);
+    }
+  T ("pk_call_prepared_1", call != NULL && ok);
+  pk_prepared_call_free (call);
+
+  call = pk_prepare_call (pkc, pk_decl_val (pkc, "pc_inc"), 0);
+  T ("pk_call_prepared_2",
+     call != NULL
+     && pk_call_prepared (call, NULL, &ret, &exception) == PK_OK
+     && pk_call_prepared (call, NULL, &ret, &exception) == PK_OK
+     && ret == PK_NULL
+     && pk_int_value (pk_decl_val (pkc, "pc_count")) == 2);
+  pk_prepared_call_free (call);
+
+  call = pk_prepare_call (pkc, pk_decl_val (pkc, "pc_raise"), 1);
+  args[0] = pk_make_int (pkc, 0, 32);
+  T ("pk_call_prepared_3",
+     call != NULL
+     && pk_call_prepared (call, args, &ret, &exception) == PK_ERROR
+     && exception != PK_NULL);
+  pk_prepared_call_free (call);
+
+  T ("pk_prepare_call_3",
+     pk_prepare_call (pkc, pk_decl_val (pkc, "pc_sub"), -1) == NULL
+     && pk_errno (pkc) == PK_EINVAL);
+}
+
 int
 main ()
 {
@@ -237,6 +1009,17 @@ main ()
   test_pk_keyword_p (pkc);
   test_pk_load (pkc);
   test_pk_ios (pkc);
+  test_pk_compiler_clone (pkc);
+  test_pk_phase_times (pkc);
+  test_pk_gc (pkc);
+  test_pk_profile (pkc);
+  test_pk_events (pkc);
+  test_pk_budget (pkc);
+  test_pk_stack_limit (pkc);
+  test_pk_cancel (pkc);
+  test_pk_extract (pkc);
+  test_pk_map_to_buffer (pkc);
+  test_pk_prepare_call (pkc);
   T ("pk_get_user_data",
      pk_get_user_data (pkc) == (void *)(uintptr_t)0xdeadbeef);
   test_pk_compiler_free (pkc);
@@ -160,6 +160,263 @@ struct pk_iod_if iod_if =
     (void*)&USER_DATA,
   };
 
+/* Implementation of a foreign IO device using the version 2 of the
+   interface.  It is backed by a buffer in memory, and queues the
+   asynchronous reads until it is polled.  */
+
+#define IOD2_SIZE 16384
+#define IOD2_QUEUE_LEN 16
+
+uint8_t iod2_mem[IOD2_SIZE];
+int iod2_preads;
+int iod2_async_preads;
+int iod2_get_ptrs;
+
+struct
+{
+  void *buf;
+  size_t count;
+  pk_iod_off offset;
+  pk_iod_completion_fn done;
+  void *tag;
+} iod2_queue[IOD2_QUEUE_LEN];
+int iod2_queue_len;
+
+char *
+iod2_handler_normalize (const char *handler, uint64_t flags, int *error)
+{
+  char *new_handler = NULL;
+
+  if (STREQ (handler, "<foreign2>"))
+    {
+      new_handler = strdup (handler);
+      if (new_handler == NULL && error)
+        *error = PK_IOD_ENOMEM;
+    }
+
+  if (error)
+    *error = PK_IOD_OK;
+  return new_handler;
+}
+
+void *
+iod2_open (const char *handler, uint64_t flags, int *error, void *data)
+{
+  if (error)
+    *error = PK_IOD_OK;
+  return iod2_mem;
+}
+
+int
+iod2_pread (void *dev, void *buf, size_t count, pk_iod_off offset)
+{
+  iod2_preads++;
+  if (offset > IOD2_SIZE || count > IOD2_SIZE - offset)
+    return PK_IOD_EOF;
+  memcpy (buf, iod2_mem + offset, count);
+  return PK_IOD_OK;
+}
+
+int
+iod2_pwrite (void *dev, const void *buf, size_t count, pk_iod_off offset)
+{
+  if (offset > IOD2_SIZE || count > IOD2_SIZE - offset)
+    return PK_IOD_EOF;
+  memcpy (iod2_mem + offset, buf, count);
+  return PK_IOD_OK;
+}
+
+pk_iod_off
+iod2_size (void *dev)
+{
+  return IOD2_SIZE;
+}
+
+const void *
+iod2_get_ptr (void *dev, size_t count, pk_iod_off offset)
+{
+  iod2_get_ptrs++;
+  if (offset > IOD2_SIZE || count > IOD2_SIZE - offset)
+    return NULL;
+  return iod2_mem + offset;
+}
+
+int
+iod2_pread_async (void *dev, void *buf, size_t count, pk_iod_off offset,
+                  pk_iod_completion_fn done, void *tag)
+{
+  if (iod2_queue_len == IOD2_QUEUE_LEN)
+    return PK_IOD_ERROR;
+
+  iod2_async_preads++;
+  iod2_queue[iod2_queue_len].buf = buf;
+  iod2_queue[iod2_queue_len].count = count;
+  iod2_queue[iod2_queue_len].offset = offset;
+  iod2_queue[iod2_queue_len].done = done;
+  iod2_queue[iod2_queue_len].tag = tag;
+  iod2_queue_len++;
+  return PK_IOD_OK;
+}
+
+int
+iod2_poll (void *dev, int wait_p)
+{
+  int i;
+
+  if (iod2_queue_len == 0)
+    return PK_IOD_EOF;
+
+  /* Complete all the pending reads at once.  */
+  for (i = 0; i < iod2_queue_len; ++i)
+    {
+      int status = PK_IOD_OK;
+
+      if (iod2_queue[i].offset > IOD2_SIZE
+          || iod2_queue[i].count > IOD2_SIZE - iod2_queue[i].offset)
+        status = PK_IOD_EOF;
+      else
+        memcpy (iod2_queue[i].buf, iod2_mem + iod2_queue[i].offset,
+                iod2_queue[i].count);
+      iod2_queue[i].done (iod2_queue[i].tag, status);
+    }
+  iod2_queue_len = 0;
+  return PK_IOD_OK;
+}
+
+struct pk_iod_if iod2_if =
+  {
+    iod_get_if_name,
+    iod2_handler_normalize,
+    iod2_open,
+    iod_close,
+    iod2_pread,
+    iod2_pwrite,
+    iod_volatile_by_default,
+    iod_get_flags,
+    iod2_size,
+    iod_flush,
+    NULL,
+  };
+
+/* Open the version 2 foreign device in a new compiler, registering it
+   with the given additional operations, and return the compiler.  */
+
+static pk_compiler
+iod2_compiler (const struct pk_iod_if_v2 *iod_if_v2)
+{
+  pk_compiler pkc = pk_compiler_new (&poke_term_if);
+  pk_val val, exit_exception;
+
+  if (!pkc
+      || pk_register_iod_v2 (pkc, &iod2_if, iod_if_v2) != PK_OK
+      || pk_compile_statement (pkc, "open (\"<foreign2>\");", NULL, &val,
+                               &exit_exception) != PK_OK)
+    return NULL;
+
+  return pkc;
+}
+
+/* Return the byte at byte offset OFFSET of the current IO space of
+   PKC, or -1 on error.  */
+
+static int
+iod2_peek (pk_compiler pkc, int offset)
+{
+  char expr[64];
+  pk_val val, exit_exception;
+
+  snprintf (expr, sizeof expr, "uint<8> @ %d#B", offset);
+  if (pk_compile_expression (pkc, expr, NULL, &val, &exit_exception)
+      != PK_OK
+      || val == PK_NULL)
+    return -1;
+  return pk_uint_value (val);
+}
+
+static int
+test_iod_v2 (void)
+{
+  pk_compiler pkc;
+  int i;
+
+  for (i = 0; i < IOD2_SIZE; ++i)
+    iod2_mem[i] = i * 7;
+
+  /* Unsupported versions are rejected.  */
+  {
+    struct pk_iod_if_v2 iod_if_v2 = { PK_IOD_IF_VERSION + 1 };
+
+    pkc = pk_compiler_new (&poke_term_if);
+    if (!pkc || pk_register_iod_v2 (pkc, &iod2_if, &iod_if_v2) == PK_OK)
+      {
+        fail ("rejecting unsupported version of foreign IOD interface");
+        return 1;
+      }
+    pk_compiler_free (pkc);
+    pass ("rejecting unsupported version of foreign IOD interface");
+  }
+
+  /* Devices providing pointers to their data are read without calling
+     pread.  */
+  {
+    struct pk_iod_if_v2 iod_if_v2 = { PK_IOD_IF_VERSION };
+
+    iod_if_v2.get_ptr = iod2_get_ptr;
+    pkc = iod2_compiler (&iod_if_v2);
+    if (!pkc)
+      {
+        fail ("opening foreign IOD with get_ptr");
+        return 1;
+      }
+
+    iod2_preads = iod2_get_ptrs = 0;
+    if (iod2_peek (pkc, 100) != (uint8_t) (100 * 7)
+        || iod2_preads != 0 || iod2_get_ptrs == 0)
+      {
+        fail ("reading foreign IOD with get_ptr");
+        return 1;
+      }
+    pk_compiler_free (pkc);
+    pass ("reading foreign IOD with get_ptr");
+  }
+
+  /* Cached devices get the reads of a prefetched range issued at
+     once.  */
+  {
+    struct pk_iod_if_v2 iod_if_v2 = { PK_IOD_IF_VERSION };
+
+    iod_if_v2.cache_p = 1;
+    iod_if_v2.pread_async = iod2_pread_async;
+    iod_if_v2.poll = iod2_poll;
+    pkc = iod2_compiler (&iod_if_v2);
+    if (!pkc)
+      {
+        fail ("opening cached foreign IOD with pread_async");
+        return 1;
+      }
+
+    iod2_preads = iod2_async_preads = 0;
+    pk_ios_prefetch (pk_ios_cur (pkc), 0, IOD2_SIZE);
+    if (iod2_async_preads < 2 || iod2_queue_len != 0)
+      {
+        fail ("prefetching cached foreign IOD with pread_async");
+        return 1;
+      }
+    pass ("prefetching cached foreign IOD with pread_async");
+
+    if (iod2_peek (pkc, 10000) != (uint8_t) (10000 * 7)
+        || iod2_preads != 0)
+      {
+        fail ("reading prefetched foreign IOD");
+        return 1;
+      }
+    pk_compiler_free (pkc);
+    pass ("reading prefetched foreign IOD");
+  }
+
+  return 0;
+}
+
 int
 main (int argc, char *argv[])
 {
@@ -262,6 +519,10 @@ main (int argc, char *argv[])
   }
 
   pk_compiler_free (poke_compiler);
+
+  if (test_iod_v2 ())
+    return 1;
+
   totals ();
   return 0;
 }
@@ -0,0 +1,347 @@
+/* ios-codecs.c -- Cross-check the IOS integer codecs.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libpoke.h"
+
+#include <poke-unit.h>
+
+#include "term-if.h"
+
+/* This test writes and reads integers of every width between 1 and
+   64 bits, at every bit offset within a byte, in both endiannesses
+   and with both negative encodings, using Poke maps on a memory IO
+   space.  The contents of the IO space are compared after every
+   write with a copy of them kept by the test and updated by a simple
+   reference implementation, which works bit by bit.  This covers
+   both the fast path for byte-aligned integers whose size is a
+   multiple of eight bits and all the cases of the general path.
+
+   The sequence of values is always the same, so failures are
+   reproducible.  */
+
+#define WINDOW 16       /* Bytes of the IO space used by the test.  */
+#define NVALUES 12      /* Values tested per width, offset, etc.  */
+
+static pk_compiler pkc;
+static pk_ios ios;
+static uint8_t mirror[WINDOW];
+
+static uint64_t prng_state = 0x9e3779b97f4a7c15ULL;
+
+static uint64_t
+prng (void)
+{
+  /* xorshift64.  */
+  prng_state ^= prng_state << 13;
+  prng_state ^= prng_state >> 7;
+  prng_state ^= prng_state << 17;
+  return prng_state;
+}
+
+/* Reference implementation.
+
+   The BITS bits of an integer located at the bit-offset OFFSET form a
+   string of bits, the first one being the most significant bit of the
+   byte containing OFFSET.  In big-endian the string is the value,
+   most significant bit first.  In little-endian the string is made of
+   the bytes of the value, least significant byte first, the last
+   "byte" having only the remaining BITS % 8 bits.  */
+
+static int
+ref_get_bit (const uint8_t *buf, uint64_t bit)
+{
+  return (buf[bit / 8] >> (7 - bit % 8)) & 1;
+}
+
+static void
+ref_set_bit (uint8_t *buf, uint64_t bit, int b)
+{
+  uint8_t mask = 1 << (7 - bit % 8);
+
+  buf[bit / 8] = b ? (buf[bit / 8] | mask) : (buf[bit / 8] & ~mask);
+}
+
+/* Return the number of the bit of the value stored at the position I
+   of the string of bits.  */
+
+static int
+ref_bit_index (int bits, enum pk_endian endian, int i)
+{
+  int byte, nbits;
+
+  if (endian == PK_ENDIAN_MSB)
+    return bits - 1 - i;
+
+  byte = i / 8;
+  nbits = (byte == bits / 8) ? bits % 8 : 8;
+  return byte * 8 + nbits - 1 - i % 8;
+}
+
+static uint64_t
+ref_decode (const uint8_t *buf, uint64_t offset, int bits,
+            enum pk_endian endian)
+{
+  uint64_t value = 0;
+
+  for (int i = 0; i < bits; ++i)
+    if (ref_get_bit (buf, offset + i))
+      value |= (uint64_t) 1 << ref_bit_index (bits, endian, i);
+  return value;
+}
+
+static void
+ref_encode (uint8_t *buf, uint64_t offset, int bits,
+            enum pk_endian endian, uint64_t value)
+{
+  for (int i = 0; i < bits; ++i)
+    ref_set_bit (buf, offset + i,
+                 (value >> ref_bit_index (bits, endian, i)) & 1);
+}
+
+/* Poke functions doing the reads and writes, one per width and
+   signedness.  */
+
+static pk_val readers[2][65];
+static pk_val writers[2][65];
+
+static int
+compile_accessors (void)
+{
+  for (int bits = 1; bits <= 64; ++bits)
+    for (int signed_p = 0; signed_p < 2; ++signed_p)
+      {
+        const char *t = signed_p ? "int" : "uint";
+        char src[512], name[32];
+        pk_val exc;
+
+        snprintf (src, sizeof (src),
+                  "fun __rd_%s%d = (int<32> ios, uint<64> o) %s<64>:"
+                  " { return %s<%d> @ ios : o#b; }\n"
+                  "fun __wr_%s%d = (int<32> ios, uint<64> o, %s<64> v) void:"
+                  " { %s<%d> @ ios : o#b = v as %s<%d>; }\n",
+                  t, bits, t, t, bits,
+                  t, bits, t, t, bits, t, bits);
+        if (pk_compile_buffer (pkc, src, NULL, &exc) != PK_OK
+            || exc != PK_NULL)
+          return 0;
+
+        snprintf (name, sizeof (name), "__rd_%s%d", t, bits);
+        readers[signed_p][bits] = pk_decl_val (pkc, name);
+        snprintf (name, sizeof (name), "__wr_%s%d", t, bits);
+        writers[signed_p][bits] = pk_decl_val (pkc, name);
+        if (readers[signed_p][bits] == PK_NULL
+            || writers[signed_p][bits] == PK_NULL)
+          return 0;
+      }
+  return 1;
+}
+
+static int
+ios_write (int signed_p, int bits, uint64_t offset, uint64_t value)
+{
+  pk_val exc;
+  pk_val v = signed_p ? pk_make_int (pkc, (int64_t) value, 64)
+                      : pk_make_uint (pkc, value, 64);
+
+  return (pk_call (pkc, writers[signed_p][bits], NULL, &exc, 3,
+                   pk_make_int (pkc, pk_ios_get_id (ios), 32),
+                   pk_make_uint (pkc, offset, 64), v) == PK_OK
+          && exc == PK_NULL);
+}
+
+static int
+ios_read (int signed_p, int bits, uint64_t offset, uint64_t *value)
+{
+  pk_val exc, ret;
+
+  if (pk_call (pkc, readers[signed_p][bits], &ret, &exc, 2,
+               pk_make_int (pkc, pk_ios_get_id (ios), 32),
+               pk_make_uint (pkc, offset, 64)) != PK_OK
+      || exc != PK_NULL)
+    return 0;
+  *value = signed_p ? (uint64_t) pk_int_value (ret) : pk_uint_value (ret);
+  return 1;
+}
+
+/* Return the value to be used in the iteration I for integers of
+   BITS bits.  The first iterations use the values which are more
+   likely to expose errors in the handling of the first and last
+   bytes.  */
+
+static uint64_t
+test_value (int bits, int i)
+{
+  uint64_t mask = bits == 64 ? ~(uint64_t) 0 : ((uint64_t) 1 << bits) - 1;
+
+  switch (i)
+    {
+    case 0: return 0;
+    case 1: return mask;
+    case 2: return 1;
+    case 3: return (uint64_t) 1 << (bits - 1);
+    case 4: return 0x5555555555555555ULL & mask;
+    default:
+      return prng () & mask;
+    }
+}
+
+/* Sign-extend the BITS bits VALUE.  */
+
+static uint64_t
+sign_extend (uint64_t value, int bits)
+{
+  return (uint64_t) ((int64_t) (value << (64 - bits)) >> (64 - bits));
+}
+
+/* The negative encoding doesn't change the bits that get stored, but
+   the codecs get it and therefore both encodings are checked.  */
+
+static int
+check_width (enum pk_endian endian, int bits, const char **what,
+             uint64_t *where)
+{
+  for (int bit = 0; bit < 8; ++bit)
+    for (int i = 0; i < NVALUES; ++i)
+      {
+        /* Move the integer over the first bytes of the window too.  */
+        uint64_t offset = (i % 4) * 8 + bit;
+        int signed_p = i % 2;
+        uint64_t value = test_value (bits, i);
+        uint64_t expected, got;
+        uint8_t contents[WINDOW];
+
+        *where = offset;
+
+        /* Signed values are passed sign-extended.  */
+        *what = "write";
+        if (!ios_write (signed_p, bits, offset,
+                        signed_p ? sign_extend (value, bits) : value))
+          return 0;
+        ref_encode (mirror, offset, bits, endian, value);
+        if (pk_ios_read (ios, 0, contents, WINDOW) != PK_OK
+            || memcmp (contents, mirror, WINDOW) != 0)
+          return 0;
+
+        /* Read the integer back, and also read an integer at another
+           offset, which will often overlap with the one written.  */
+        for (int j = 0; j < 2; ++j)
+          {
+            uint64_t o = j == 0 ? offset : prng () % (WINDOW * 8 - bits + 1);
+
+            *where = o;
+            for (int s = 0; s < 2; ++s)
+              {
+                *what = s ? "signed read" : "unsigned read";
+                expected = ref_decode (mirror, o, bits, endian);
+                if (s)
+                  expected = sign_extend (expected, bits);
+                if (!ios_read (s, bits, o, &got) || got != expected)
+                  return 0;
+              }
+          }
+      }
+
+  return 1;
+}
+
+void
+test_ios_codecs ()
+{
+  static const enum pk_endian endians[] = { PK_ENDIAN_LSB, PK_ENDIAN_MSB };
+  static const enum pk_nenc nencs[] = { PK_NENC_2, PK_NENC_1 };
+  pk_val exc;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (!pkc)
+    {
+      fail ("ios_codecs: creating compiler");
+      return;
+    }
+  if (pk_compile_buffer (pkc, "open (\"*ios-codecs*\");", NULL, &exc)
+      != PK_OK || exc != PK_NULL
+      || (ios = pk_ios_search (pkc, "*ios-codecs*",
+                               PK_IOS_SEARCH_F_EXACT)) == NULL)
+    {
+      fail ("ios_codecs: opening IO space");
+      goto done;
+    }
+  if (!compile_accessors ())
+    {
+      fail ("ios_codecs: compiling accessors");
+      goto done;
+    }
+
+  /* Fill the IO space with a known pattern.  */
+  pk_set_endian (pkc, PK_ENDIAN_MSB);
+  for (int i = 0; i < WINDOW; ++i)
+    {
+      mirror[i] = prng ();
+      if (!ios_write (0, 8, i * 8, mirror[i]))
+        {
+          fail ("ios_codecs: filling IO space");
+          goto done;
+        }
+    }
+
+  for (int e = 0; e < 2; ++e)
+    for (int n = 0; n < 2; ++n)
+      {
+        const char *ename = endians[e] == PK_ENDIAN_LSB ? "lsb" : "msb";
+        const char *nname = nencs[n] == PK_NENC_2 ? "2c" : "1c";
+
+        pk_set_endian (pkc, endians[e]);
+        pk_set_nenc (pkc, nencs[n]);
+        for (int bits = 1; bits <= 64; ++bits)
+          {
+            const char *what = "";
+            uint64_t where = 0;
+
+            if (check_width (endians[e], bits, &what, &where))
+              pass ("ios_codecs_%s_%s_%d", ename, nname, bits);
+            else
+              {
+                fail ("ios_codecs_%s_%s_%d: %s at bit %d", ename, nname,
+                      bits, what, (int) where);
+                /* Don't let the error affect the rest of widths.  */
+                if (pk_ios_read (ios, 0, mirror, WINDOW) != PK_OK)
+                  goto done;
+              }
+          }
+      }
+
+  pk_set_endian (pkc, PK_ENDIAN_MSB);
+  pk_set_nenc (pkc, PK_NENC_2);
+
+ done:
+  pk_compiler_free (pkc);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_ios_codecs ();
+
+  totals ();
+  return 0;
+}
@@ -0,0 +1,241 @@
+/* ios-ranges.c -- Tracking the mapped values of an IO space.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include "libpoke.h"
+
+#include <poke-unit.h>
+
+#include "term-if.h"
+
+/* RG_NVALS overlapping byte arrays are mapped in a memory IO space,
+   and every value I with I % 3 != 0 is kept alive in the array
+   rg_kept.  The others are dropped.  The offsets and lengths below
+   shall be kept in sync with rg_off and rg_len in RANGES_SRC.
+
+   These are enough values to fill the unsorted buffer of the range
+   table many times, so they end up spread over several sorted runs
+   that get merged as the table grows.  */
+
+#define RG_NVALS 3000
+#define RG_NKEPT 2000
+#define RG_OFF(I) ((I) * 1237 % 4001)
+#define RG_LEN(I) (1 + (I) * 7 % 64)
+#define RG_KEPT_P(I) ((I) % 3 != 0)
+
+/* Number of extra values mapped after the collection, which are also
+   kept alive.  The range table sweeps its dead entries once its size
+   doubles, so this many insertions are guaranteed to trigger a
+   sweep.  */
+
+#define RG_NEXTRA (2 * RG_NVALS + 1025)
+
+/* Values kept alive by the conservative collector from stale stack
+   slots and registers.  */
+
+#define RG_SLACK 64
+
+static const char *ranges_src =
+  "var rg_ios = open (\"*ranges*\");"
+  "type Rg_Bytes = uint<8>[];"
+  "var rg_kept = Rg_Bytes[3000] ();"
+  "var rg_extra = Rg_Bytes[7025] ();"
+  "fun rg_off = (uint<64> i) uint<64>: { return i * 1237 % 4001; }"
+  "fun rg_len = (uint<64> i) uint<64>: { return 1 + i * 7 % 64; }"
+  "fun rg_map = (uint<64> i) Rg_Bytes:"
+  "{"
+  "  return uint<8>[rg_len (i)] @ rg_ios : (rg_off (i))#B;"
+  "}"
+  "fun rg_map_all = void:"
+  "{"
+  "  for (var i = 0UL; i < 3000; i++)"
+  "    {"
+  "      var v = rg_map (i);"
+  "      if (i % 3 != 0)"
+  "        rg_kept[i] = v;"
+  "    }"
+  "}"
+  "fun rg_map_extra = void:"
+  "{"
+  "  for (var i = 0UL; i < 7025; i++)"
+  "    rg_extra[i] = uint<8>[1] @ rg_ios : (i % 4000)#B;"
+  "}"
+  "fun rg_remap_kept = void:"
+  "{"
+  "  for (var i = 0UL; i < 3000; i++)"
+  "    if (i % 3 != 0)"
+  "      rg_kept[i] = rg_map (i);"
+  "}"
+  "fun rg_write = (uint<64> off, uint<64> count) void:"
+  "{"
+  "  uint<8>[count] @ rg_ios : off#B = uint<8>[count] (0xff);"
+  "}"
+  "fun rg_dirty_p = (uint<64> i) int<32>:"
+  "{"
+  "  var reads = iostat (IOS_STAT_READS, rg_ios);"
+  "  var v = remap rg_kept[i];"
+  "  return iostat (IOS_STAT_READS, rg_ios) != reads;"
+  "}";
+
+static pk_compiler pkc;
+static pk_ios rg_ios;
+
+static int
+call (const char *name, pk_val *ret, int narg, pk_val arg1, pk_val arg2)
+{
+  pk_val exc;
+
+  return (pk_call (pkc, pk_decl_val (pkc, name), ret, &exc, narg,
+                   arg1, arg2) == PK_OK
+          && exc == PK_NULL);
+}
+
+/* Whether a value of RG_LEN (I) bytes at RG_OFF (I) gets marked dirty
+   when COUNT bytes are written at OFF.  The intervals of both the
+   mapped values and the writes include their end, so the values
+   adjacent to the written bytes are also marked.  */
+
+static int
+expected_dirty_p (uint64_t i, uint64_t off, uint64_t count)
+{
+  return RG_OFF (i) <= off + count && RG_OFF (i) + RG_LEN (i) >= off;
+}
+
+/* The values left unreachable are dropped from the range table, and
+   the live ones are kept.  */
+
+static void
+test_drop (void)
+{
+  uint64_t nranges;
+
+  if (!call ("rg_map_all", NULL, 0, PK_NULL, PK_NULL))
+    {
+      fail ("ranges_drop: mapping");
+      return;
+    }
+  nranges = pk_ios_stat (rg_ios, PK_IOS_STAT_RANGES);
+  if (nranges >= RG_NKEPT && nranges <= RG_NVALS)
+    pass ("ranges_drop_mapped");
+  else
+    fail ("ranges_drop_mapped: %" PRIu64 " ranges", nranges);
+
+  pk_gc_collect (pkc);
+  if (!call ("rg_map_extra", NULL, 0, PK_NULL, PK_NULL))
+    {
+      fail ("ranges_drop: mapping extra values");
+      return;
+    }
+  nranges = pk_ios_stat (rg_ios, PK_IOS_STAT_RANGES);
+  if (nranges >= RG_NKEPT + RG_NEXTRA
+      && nranges <= RG_NKEPT + RG_NEXTRA + RG_SLACK)
+    pass ("ranges_drop_swept");
+  else
+    fail ("ranges_drop_swept: %" PRIu64 " ranges, expected %d",
+          nranges, RG_NKEPT + RG_NEXTRA);
+}
+
+/* Writing COUNT bytes at OFF marks dirty exactly the kept values
+   overlapping with them.  */
+
+static void
+test_dirty (const char *name, uint64_t off, uint64_t count)
+{
+  int ndirty = 0, nwrong = 0;
+  uint64_t i;
+
+  if (!call ("rg_remap_kept", NULL, 0, PK_NULL, PK_NULL)
+      || !call ("rg_write", NULL, 2,
+                pk_make_uint (pkc, off, 64), pk_make_uint (pkc, count, 64)))
+    {
+      fail ("%s: writing", name);
+      return;
+    }
+
+  for (i = 0; i < RG_NVALS; ++i)
+    {
+      pk_val ret;
+      int expected;
+
+      if (!RG_KEPT_P (i))
+        continue;
+      if (!call ("rg_dirty_p", &ret, 1, pk_make_uint (pkc, i, 64), PK_NULL))
+        {
+          fail ("%s: remapping value %" PRIu64, name, i);
+          return;
+        }
+
+      expected = expected_dirty_p (i, off, count);
+      ndirty += expected;
+      if (pk_int_value (ret) != expected)
+        {
+          if (nwrong++ == 0)
+            printf ("%s: value %" PRIu64 " at %" PRIu64 "#B is %sdirty\n",
+                    name, i, (uint64_t) RG_OFF (i),
+                    expected ? "not " : "");
+        }
+    }
+
+  if (nwrong == 0 && ndirty > 0)
+    pass (name);
+  else
+    fail ("%s: %d wrong out of %d dirty values", name, nwrong, ndirty);
+}
+
+int
+main (int argc, char *argv[])
+{
+  pk_val exc, ios_id;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (pkc == NULL)
+    {
+      fail ("ranges: creating compiler");
+      goto done;
+    }
+  if (pk_compile_buffer (pkc, ranges_src, NULL, &exc) != PK_OK
+      || exc != PK_NULL)
+    {
+      fail ("ranges: compiling");
+      goto done;
+    }
+  ios_id = pk_decl_val (pkc, "rg_ios");
+  rg_ios = pk_ios_search_by_id (pkc, pk_int_value (ios_id));
+  if (rg_ios == NULL)
+    {
+      fail ("ranges: opening");
+      goto done;
+    }
+
+  test_drop ();
+  test_dirty ("ranges_dirty_first", 32, 1);
+  test_dirty ("ranges_dirty_middle", 1237, 1);
+  test_dirty ("ranges_dirty_wide", 2048, 100);
+  test_dirty ("ranges_dirty_last", 4030, 1);
+
+ done:
+  pk_compiler_free (pkc);
+  totals ();
+  return 0;
+}
@@ -0,0 +1,241 @@
+/* ios-stream.c -- Mapping and flushing the standard input.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include "libpoke.h"
+
+#include <poke-unit.h>
+
+#include "term-if.h"
+
+/* The standard input of this test is redirected to a file of
+   STREAM_SIZE bytes, which spans several chunks of the buffer of the
+   stream device, and then it is opened as the IO space <stdin>.  The
+   bytes are read with maps, and flushed with the flush builtin.  */
+
+#define STREAM_FILE "ios-stream.data"
+#define STREAM_CHUNK (64 * 1024)
+#define STREAM_SIZE (3 * STREAM_CHUNK + 1000)
+
+#define PEEK_E_IO -1
+#define PEEK_E_EOF -2
+
+static const char *stream_src =
+  "fun st_peek = (int<32> ios, uint<64> off) int<32>:"
+  "{"
+  "  var r = 0;"
+  "  try r = uint<8> @ ios : off#B;"
+  "  catch (Exception e)"
+  "  {"
+  "    if (e.code == EC_io)"
+  "      r = -1;"
+  "    else if (e.code == EC_eof)"
+  "      r = -2;"
+  "    else"
+  "      raise e;"
+  "  }"
+  "  return r;"
+  "}"
+  "fun st_flush = (int<32> ios, uint<64> off) void:"
+  "{"
+  "  flush (ios, off#B);"
+  "}";
+
+static pk_compiler pkc;
+
+/* The bytes of the stream don't repeat at the chunk size.  */
+
+static int
+stream_byte (uint64_t offset)
+{
+  return offset % 251;
+}
+
+static int
+write_stream_file (void)
+{
+  FILE *f = fopen (STREAM_FILE, "wb");
+
+  if (f == NULL)
+    return 0;
+  for (uint64_t i = 0; i < STREAM_SIZE; ++i)
+    if (fputc (stream_byte (i), f) == EOF)
+      {
+        fclose (f);
+        return 0;
+      }
+  return fclose (f) == 0;
+}
+
+/* Rewind the standard input and open it.  Return the IO space.  */
+
+static pk_ios
+stream_open (void)
+{
+  int id;
+
+  if (freopen (STREAM_FILE, "rb", stdin) == NULL)
+    return NULL;
+  id = pk_ios_open (pkc, "<stdin>", 0, 0);
+  return id == PK_IOS_NOID ? NULL : pk_ios_search_by_id (pkc, id);
+}
+
+/* Return the byte at OFFSET in IOS, PEEK_E_IO or PEEK_E_EOF.  */
+
+static int
+stream_peek (pk_ios ios, uint64_t offset)
+{
+  pk_val exc, ret;
+
+  if (pk_call (pkc, pk_decl_val (pkc, "st_peek"), &ret, &exc, 2,
+               pk_make_int (pkc, pk_ios_get_id (ios), 32),
+               pk_make_uint (pkc, offset, 64)) != PK_OK
+      || exc != PK_NULL)
+    return -100;
+  return pk_int_value (ret);
+}
+
+static int
+stream_flush (pk_ios ios, uint64_t offset)
+{
+  pk_val exc;
+
+  return (pk_call (pkc, pk_decl_val (pkc, "st_flush"), NULL, &exc, 2,
+                   pk_make_int (pkc, pk_ios_get_id (ios), 32),
+                   pk_make_uint (pkc, offset, 64)) == PK_OK
+          && exc == PK_NULL);
+}
+
+#define CHECK_PEEK(NAME, IOS, OFFSET, EXPECTED)                 \
+  do                                                            \
+    {                                                           \
+      int got = stream_peek ((IOS), (OFFSET));                  \
+                                                                \
+      if (got == (EXPECTED))                                    \
+        pass (NAME);                                            \
+      else                                                      \
+        fail ("%s: got %d, expected %d", NAME, got, (EXPECTED)); \
+    }                                                           \
+  while (0)
+
+/* Mapping past the data read so far gets the right bytes, and the
+   data in between is kept.  */
+
+static void
+test_map_ahead (void)
+{
+  pk_ios ios = stream_open ();
+  uint64_t offset = STREAM_CHUNK + 12345;
+
+  if (ios == NULL)
+    {
+      fail ("stream_map_ahead: opening");
+      return;
+    }
+  CHECK_PEEK ("stream_map_ahead_1", ios, offset, stream_byte (offset));
+  CHECK_PEEK ("stream_map_ahead_2", ios, 7, stream_byte (7));
+  CHECK_PEEK ("stream_map_ahead_3", ios, offset - 1, stream_byte (offset - 1));
+  pk_ios_close (pkc, ios);
+}
+
+/* The data preceding the forget point is lost, and reading it raises
+   E_io rather than E_eof.  The forget point is exact, despite the
+   buffer only freeing whole chunks.  */
+
+static void
+test_forget (void)
+{
+  pk_ios ios = stream_open ();
+  uint64_t forget = STREAM_CHUNK + 300;
+
+  if (ios == NULL)
+    {
+      fail ("stream_forget: opening");
+      return;
+    }
+  CHECK_PEEK ("stream_forget_read", ios, forget + 500,
+              stream_byte (forget + 500));
+  if (!stream_flush (ios, forget))
+    fail ("stream_forget: flushing");
+  CHECK_PEEK ("stream_forget_before", ios, forget - 1, PEEK_E_IO);
+  CHECK_PEEK ("stream_forget_at", ios, forget, stream_byte (forget));
+  CHECK_PEEK ("stream_forget_first_chunk", ios, 0, PEEK_E_IO);
+  CHECK_PEEK ("stream_forget_eof", ios, STREAM_SIZE, PEEK_E_EOF);
+  pk_ios_close (pkc, ios);
+}
+
+/* Flushing past the data read so far skips the data in between.  */
+
+static void
+test_flush_ahead (void)
+{
+  pk_ios ios = stream_open ();
+  uint64_t forget = 2 * STREAM_CHUNK + 77;
+
+  if (ios == NULL)
+    {
+      fail ("stream_flush_ahead: opening");
+      return;
+    }
+  if (!stream_flush (ios, forget))
+    fail ("stream_flush_ahead: flushing");
+  CHECK_PEEK ("stream_flush_ahead_at", ios, forget, stream_byte (forget));
+  CHECK_PEEK ("stream_flush_ahead_before", ios, forget - 1, PEEK_E_IO);
+  CHECK_PEEK ("stream_flush_ahead_last", ios, STREAM_SIZE - 1,
+              stream_byte (STREAM_SIZE - 1));
+  pk_ios_close (pkc, ios);
+}
+
+int
+main (int argc, char *argv[])
+{
+  pk_val exc;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (pkc == NULL)
+    {
+      fail ("stream: creating compiler");
+      goto done;
+    }
+  if (!write_stream_file ())
+    {
+      fail ("stream: writing file");
+      goto done;
+    }
+  if (pk_compile_buffer (pkc, stream_src, NULL, &exc) != PK_OK
+      || exc != PK_NULL)
+    {
+      fail ("stream: compiling");
+      goto done;
+    }
+
+  test_map_ahead ();
+  test_forget ();
+  test_flush_ahead ();
+
+ done:
+  remove (STREAM_FILE);
+  pk_compiler_free (pkc);
+  totals ();
+  return 0;
+}
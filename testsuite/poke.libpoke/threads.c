@@ -0,0 +1,518 @@
+/* threads.c -- Run several compilers in parallel threads.  */
+
+/* Copyright (C) 2026 Jose E. Marchesi */
+
+/* This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include "libpoke.h"
+
+#include <poke-unit.h>
+
+#include "term-if.h"
+
+/* This test runs NTHREADS threads at the same time, each of them
+   using its own compilers: one created by the thread itself, and a
+   clone of a compiler created by the main thread.  Every compiler
+   maps and writes integral values and structs in its own memory IO
+   space, builds strings, collects garbage and prints to its terminal,
+   and the results are checked against the values computed in C.
+
+   The terminal interface of the compilers counts the bytes printed
+   by each of them, so the output of every compiler is checked to
+   reach its own terminal.
+
+   Then all the threads read a file, which they open as a shared IO
+   space, at the same time.
+
+   Finally, test_ropes builds long strings by concatenation, which
+   are ropes, and reads them from the threads of ioparallel at the
+   same time, so they get flattened concurrently.  */
+
+#define NTHREADS 4
+#define NROUNDS 50
+#define NELEM 256
+#define SHARED_FILE "threads-shared.data"
+#define SHARED_K 7
+#define NROPE 512
+#define NROPE_THREADS 8
+
+/* Per-compiler data, stored as the user data of the compiler.  */
+
+struct compiler_data
+{
+  size_t nbytes;
+};
+
+static void
+counting_puts (pk_compiler pkc, const char *str)
+{
+  struct compiler_data *data = pk_get_user_data (pkc);
+
+  /* The user data is not set yet while the compiler bootstraps.  */
+  if (data)
+    data->nbytes += strlen (str);
+}
+
+static void
+counting_printf (pk_compiler pkc, const char *format, ...)
+{
+  struct compiler_data *data = pk_get_user_data (pkc);
+  va_list ap;
+
+  va_start (ap, format);
+  if (data)
+    data->nbytes += vsnprintf (NULL, 0, format, ap);
+  va_end (ap);
+}
+
+static struct pk_term_if counting_term_if;
+
+static const char *worker_src =
+  "type Th_Pair = struct { uint<32> a; uint<16> b; uint<16> c; };"
+  "fun th_fill = (int<32> ios, uint<32> k) void:"
+  "{"
+  "  for (var i = 0; i < %d; i++)"
+  "    uint<32> @ ios : (i * 4)#B = i * k;"
+  "}"
+  "fun th_sum = (int<32> ios) uint<64>:"
+  "{"
+  "  var s = 0UL;"
+  "  for (e in uint<32>[%d] @ ios : 0#B)"
+  "    s += e;"
+  "  return s;"
+  "}"
+  "fun th_pairs = (int<32> ios) uint<64>:"
+  "{"
+  "  var s = 0UL;"
+  "  for (p in Th_Pair[%d / 2] @ ios : 0#B)"
+  "    {"
+  "      s += p.a;"
+  "      s += p.b;"
+  "      s += p.c;"
+  "    }"
+  "  return s;"
+  "}"
+  "fun th_strings = (uint<32> k) uint<64>:"
+  "{"
+  "  var s = \"\";"
+  "  for (var i = 0; i < 64; i++)"
+  "    s = format (\"%%u32d,\", i * k);"
+  "  return s'length;"
+  "}"
+  "fun th_print = (uint<32> k) void:"
+  "{"
+  "  printf (\"%%u32d\\n\", k);"
+  "}";
+
+struct worker
+{
+  pthread_t thread;
+  int id;
+  pk_compiler clone;
+  struct compiler_data clone_data;
+  const char *error;
+};
+
+static int
+call_uint (pk_compiler pkc, const char *name, uint64_t *result,
+           int narg, pk_val arg1, pk_val arg2)
+{
+  pk_val exc, ret, fun = pk_decl_val (pkc, name);
+
+  if (fun == PK_NULL)
+    return 0;
+  if ((narg == 1
+       ? pk_call (pkc, fun, &ret, &exc, 1, arg1)
+       : pk_call (pkc, fun, &ret, &exc, 2, arg1, arg2)) != PK_OK
+      || exc != PK_NULL)
+    return 0;
+  if (result)
+    *result = ret == PK_NULL ? 0 : pk_uint_value (ret);
+  return 1;
+}
+
+/* Expected results of th_sum, th_pairs and th_strings for K.  The
+   IO spaces are big endian.  */
+
+static uint64_t
+expected_sum (uint32_t k)
+{
+  uint64_t s = 0;
+
+  for (uint32_t i = 0; i < NELEM; ++i)
+    s += (uint32_t) (i * k);
+  return s;
+}
+
+static uint64_t
+expected_pairs (uint32_t k)
+{
+  uint64_t s = 0;
+
+  for (uint32_t i = 0; i < NELEM; i += 2)
+    {
+      uint32_t b = i + 1 < NELEM ? (uint32_t) ((i + 1) * k) : 0;
+
+      s += (uint32_t) (i * k) + (b >> 16) + (b & 0xffff);
+    }
+  return s;
+}
+
+static uint64_t
+expected_strings (uint32_t k)
+{
+  char buf[32];
+
+  return snprintf (buf, sizeof (buf), "%" PRIu32 ",", (uint32_t) (63 * k));
+}
+
+/* Run the rounds of the test with PKC, which is using the IO space
+   named HANDLER.  */
+
+static const char *
+run_rounds (pk_compiler pkc, struct compiler_data *data, const char *handler,
+            int id)
+{
+  char buf[128];
+  pk_val exc, ios;
+  size_t printed = 0;
+
+  snprintf (buf, sizeof (buf), "var th_ios = open (\"%s\");", handler);
+  if (pk_compile_buffer (pkc, buf, NULL, &exc) != PK_OK || exc != PK_NULL)
+    return "opening IO space";
+  ios = pk_decl_val (pkc, "th_ios");
+
+  for (int round = 0; round < NROUNDS; ++round)
+    {
+      uint32_t k = (uint32_t) (id + 1) * 2654435761u + round;
+      pk_val kval = pk_make_uint (pkc, k, 32);
+      uint64_t result;
+
+      if (!call_uint (pkc, "th_fill", NULL, 2, ios, kval))
+        return "th_fill";
+      if (!call_uint (pkc, "th_sum", &result, 1, ios, PK_NULL)
+          || result != expected_sum (k))
+        return "th_sum";
+      if (!call_uint (pkc, "th_pairs", &result, 1, ios, PK_NULL)
+          || result != expected_pairs (k))
+        return "th_pairs";
+      if (!call_uint (pkc, "th_strings", &result, 1, kval, PK_NULL)
+          || result != expected_strings (k))
+        return "th_strings";
+      if (!call_uint (pkc, "th_print", NULL, 1, kval, PK_NULL))
+        return "th_print";
+      printed += snprintf (buf, sizeof (buf), "%" PRIu32 "\n", k);
+      if (data->nbytes != printed)
+        return "terminal output";
+
+      if (round % 10 == 0)
+        pk_gc_collect (pkc);
+    }
+
+  if (pk_compile_buffer (pkc, "close (th_ios);", NULL, &exc) != PK_OK
+      || exc != PK_NULL)
+    return "closing IO space";
+  return NULL;
+}
+
+/* Read the shared file with PKC.  */
+
+static const char *
+run_shared (pk_compiler pkc)
+{
+  int id = pk_ios_open (pkc, SHARED_FILE,
+                        PK_IOS_F_READ | PK_IOS_F_SHARED, 0);
+  pk_val ios;
+  uint64_t result;
+
+  if (id == PK_IOS_NOID)
+    return "opening shared IO space";
+  if (!(pk_ios_flags (pk_ios_search_by_id (pkc, id)) & PK_IOS_F_SHARED))
+    return "shared IO space flags";
+
+  ios = pk_make_int (pkc, id, 32);
+  for (int round = 0; round < NROUNDS; ++round)
+    if (!call_uint (pkc, "th_sum", &result, 1, ios, PK_NULL)
+        || result != expected_sum (SHARED_K))
+      return "th_sum on shared IO space";
+
+  pk_ios_close (pkc, pk_ios_search_by_id (pkc, id));
+  return NULL;
+}
+
+/* Create the file read by run_shared, holding NELEM big-endian
+   32-bit integers.  */
+
+static int
+write_shared_file (void)
+{
+  FILE *f = fopen (SHARED_FILE, "wb");
+
+  if (f == NULL)
+    return 0;
+  for (uint32_t i = 0; i < NELEM; ++i)
+    {
+      uint32_t v = i * SHARED_K;
+      uint8_t bytes[4] = { v >> 24, v >> 16, v >> 8, v };
+
+      if (fwrite (bytes, 1, sizeof (bytes), f) != sizeof (bytes))
+        {
+          fclose (f);
+          return 0;
+        }
+    }
+  return fclose (f) == 0;
+}
+
+static void *
+worker_run (void *arg)
+{
+  struct worker *worker = arg;
+  struct compiler_data data = { 0 };
+  char src[2048], handler[32];
+  pk_compiler pkc;
+  pk_val exc;
+
+  pk_register_thread ();
+
+  pkc = pk_compiler_new (&counting_term_if);
+  if (pkc == NULL)
+    {
+      worker->error = "creating compiler";
+      goto done;
+    }
+  pk_set_user_data (pkc, &data);
+  snprintf (src, sizeof (src), worker_src, NELEM, NELEM, NELEM);
+  if (pk_compile_buffer (pkc, src, NULL, &exc) != PK_OK || exc != PK_NULL)
+    worker->error = "compiling";
+  else
+    {
+      snprintf (handler, sizeof (handler), "*thread-%d*", worker->id);
+      worker->error = run_rounds (pkc, &data, handler, worker->id);
+    }
+
+  /* The clone was created by the main thread.  */
+  if (worker->error == NULL)
+    {
+      snprintf (handler, sizeof (handler), "*clone-%d*", worker->id);
+      worker->error = run_rounds (worker->clone, &worker->clone_data,
+                                  handler, NTHREADS + worker->id);
+    }
+
+  if (worker->error == NULL)
+    worker->error = run_shared (pkc);
+
+  pk_compiler_free (pkc);
+ done:
+  pk_unregister_thread ();
+  return NULL;
+}
+
+void
+test_threads ()
+{
+  struct worker workers[NTHREADS];
+  struct compiler_data base_data = { 0 };
+  char src[2048];
+  pk_compiler base;
+  pk_val exc;
+
+  counting_term_if = poke_term_if;
+  counting_term_if.puts_fn = counting_puts;
+  counting_term_if.printf_fn = counting_printf;
+
+  base = pk_compiler_new (&counting_term_if);
+  if (base == NULL)
+    {
+      fail ("threads: creating compiler");
+      return;
+    }
+  pk_set_user_data (base, &base_data);
+  if (!write_shared_file ())
+    {
+      fail ("threads: writing shared file");
+      goto done;
+    }
+  snprintf (src, sizeof (src), worker_src, NELEM, NELEM, NELEM);
+  if (pk_compile_buffer (base, src, NULL, &exc) != PK_OK || exc != PK_NULL)
+    {
+      fail ("threads: compiling");
+      goto done;
+    }
+
+  for (int i = 0; i < NTHREADS; ++i)
+    {
+      workers[i].id = i;
+      workers[i].error = NULL;
+      workers[i].clone_data.nbytes = 0;
+      workers[i].clone = pk_compiler_clone (base);
+      if (workers[i].clone == NULL)
+        {
+          fail ("threads: cloning compiler");
+          goto done;
+        }
+      pk_set_user_data (workers[i].clone, &workers[i].clone_data);
+    }
+
+  for (int i = 0; i < NTHREADS; ++i)
+    if (pthread_create (&workers[i].thread, NULL, worker_run,
+                        &workers[i]) != 0)
+      {
+        fail ("threads: creating thread");
+        exit (1);
+      }
+
+  for (int i = 0; i < NTHREADS; ++i)
+    {
+      pthread_join (workers[i].thread, NULL);
+      if (workers[i].error)
+        fail ("threads_%d: %s", i, workers[i].error);
+      else
+        pass ("threads_%d", i);
+      pk_compiler_free (workers[i].clone);
+    }
+
+  /* Shared IO spaces are read-only.  */
+  if (pk_ios_open (base, SHARED_FILE,
+                   PK_IOS_F_READ | PK_IOS_F_WRITE | PK_IOS_F_SHARED, 0)
+      == PK_IOS_NOID)
+    pass ("threads_shared_rdwr");
+  else
+    fail ("threads_shared_rdwr");
+
+  /* The output of the other compilers didn't reach this one.  */
+  if (base_data.nbytes == 0)
+    pass ("threads_terminal");
+  else
+    fail ("threads_terminal");
+
+ done:
+  remove (SHARED_FILE);
+  pk_compiler_free (base);
+}
+
+static const char *rope_src =
+  "var th_rope = \"\";"
+  "fun th_build_rope = (uint<32> k) void:"
+  "{"
+  "  th_rope = \"\";"
+  "  for (var i = 0; i < %d; i++)"
+  "    th_rope = th_rope + format (\"%%u32d,\", i * k);"
+  "}"
+  "fun th_rope_sum = (int<32> ios, uint<64> from, uint<64> to) uint<64>:"
+  "{"
+  "  var s = 0UL;"
+  "  for (var i = 0UL; i < th_rope'length; i++)"
+  "    s += th_rope[i];"
+  "  return s;"
+  "}"
+  "fun th_rope_par = (int<32> ios, uint<64> expected) uint<64>:"
+  "{"
+  "  var sums = uint<64>[]();"
+  "  var n = 0UL;"
+  "  ioparallel (sums, th_rope_sum, 0#B, %d#B, 8#1, %d, ios);"
+  "  for (s in sums)"
+  "    if (s == expected)"
+  "      n++;"
+  "  return n;"
+  "}";
+
+/* Expected result of th_rope_sum after th_build_rope (K).  */
+
+static uint64_t
+expected_rope_sum (uint32_t k)
+{
+  char buf[32];
+  uint64_t s = 0;
+
+  for (uint32_t i = 0; i < NROPE; ++i)
+    {
+      snprintf (buf, sizeof (buf), "%" PRIu32 ",", (uint32_t) (i * k));
+      for (char *p = buf; *p; ++p)
+        s += (uint8_t) *p;
+    }
+  return s;
+}
+
+void
+test_ropes ()
+{
+  char src[2048];
+  pk_compiler pkc;
+  pk_val exc, ios;
+
+  pkc = pk_compiler_new (&poke_term_if);
+  if (pkc == NULL)
+    {
+      fail ("ropes: creating compiler");
+      return;
+    }
+  if (!write_shared_file ())
+    {
+      fail ("ropes: writing shared file");
+      goto done;
+    }
+  snprintf (src, sizeof (src), rope_src, NROPE, NELEM * 4, NROPE_THREADS);
+  if (pk_compile_buffer (pkc, src, NULL, &exc) != PK_OK || exc != PK_NULL
+      || pk_compile_buffer (pkc, "var th_ios = open (\"" SHARED_FILE "\");",
+                            NULL, &exc) != PK_OK
+      || exc != PK_NULL)
+    {
+      fail ("ropes: compiling");
+      goto done;
+    }
+  ios = pk_decl_val (pkc, "th_ios");
+
+  for (int round = 0; round < NROUNDS / 5; ++round)
+    {
+      uint32_t k = (uint32_t) (round + 1) * 2654435761u;
+      uint64_t result;
+
+      /* The rope is not flattened before the threads read it.  */
+      if (!call_uint (pkc, "th_build_rope", NULL, 1,
+                      pk_make_uint (pkc, k, 32), PK_NULL)
+          || !call_uint (pkc, "th_rope_par", &result, 2, ios,
+                         pk_make_uint (pkc, expected_rope_sum (k), 64))
+          || result != NROPE_THREADS)
+        {
+          fail ("ropes_%d", round);
+          goto done;
+        }
+    }
+  pass ("ropes");
+
+ done:
+  remove (SHARED_FILE);
+  pk_compiler_free (pkc);
+}
+
+int
+main (int argc, char *argv[])
+{
+  test_threads ();
+  test_ropes ();
+
+  totals ();
+  return 0;
+}